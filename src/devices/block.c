@@ -3,7 +3,22 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/vaddr.h"
+
+/* Largest number of sectors merged into one transfer, which is
+   the size of a request thread's bounce buffer. */
+#define BLOCK_MERGE_MAX (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Number of requests in a row that may be picked from more
+   urgent classes while a class has requests waiting.  The next
+   one is then that class's. */
+#define BLOCK_STARVE_LIMIT 8
 
 /* A block device. */
 struct block
@@ -16,9 +31,24 @@ struct block
 
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
+    int channel;                        /* Controller channel, or -1. */
+    struct block *parent;               /* Device this one is part of. */
+    block_sector_t start;               /* First sector within PARENT. */
+
+    struct block_stats stats;           /* I/O statistics. */
+    block_sector_t next_sector;         /* Sector after last transfer. */
 
-    unsigned long long read_cnt;        /* Number of sectors read. */
-    unsigned long long write_cnt;       /* Number of sectors written. */
+    /* Asynchronous requests, queued on the physical device. */
+    struct rbtree queues[BLOCK_CLASS_CNT]; /* Queued requests by class,
+                                           each by sector. */
+    struct lock queue_lock;             /* Protects the members below. */
+    struct condition queue_cond;        /* Signaled when QUEUED grows. */
+    size_t queued;                      /* Requests in all of QUEUES. */
+    unsigned passed_over[BLOCK_CLASS_CNT]; /* Picks from other classes
+                                           while each waited. */
+    bool worker_started;                /* Request thread created? */
+    struct thread *worker;              /* Request thread, once running. */
+    block_sector_t head;                /* Sector after last request. */
   };
 
 /* List of all block devices. */
@@ -28,6 +58,21 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static thread_func request_thread NO_RETURN;
+static struct block_request *pick_request (struct block *);
+static struct block_request *find_request (struct block *,
+                                           block_sector_t, bool write,
+                                           struct block *part);
+static void remove_request (struct block *, struct block_request *);
+static void sync_transfer (struct block *, block_sector_t, size_t cnt,
+                           void *buffer, bool write);
+static void transfer (struct block *, block_sector_t, size_t cnt,
+                      void *buffer, bool write);
+static void complete_request (struct block_request *);
+static rb_less_func sector_less;
+static struct block *resolve_device (struct block *, block_sector_t *);
+static void account_transfer (struct block *, block_sector_t, size_t cnt,
+                              bool write, uint64_t start);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +165,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multi (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +176,121 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multi (block, sector, 1, buffer);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that can transfer several sectors with one
+   command do so.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multi (struct block *block, block_sector_t sector, size_t cnt,
+                  void *buffer)
+{
+  sync_transfer (block, sector, cnt, buffer, false);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving the
+   data.  Drivers that can transfer several sectors with one
+   command do so.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multi (struct block *block, block_sector_t sector, size_t cnt,
+                   const void *buffer)
+{
+  sync_transfer (block, sector, cnt, (void *) buffer, true);
+}
+
+/* Sets the I/O class of the running thread to CLASS and returns
+   the class it had.  Its requests and synchronous transfers take
+   this class from then on. */
+enum block_class
+block_set_class (enum block_class class)
+{
+  struct thread *t = thread_current ();
+  enum block_class old = t->io_class;
+
+  ASSERT (class < BLOCK_CLASS_CNT);
+  t->io_class = class;
+  return old;
+}
+
+/* Initializes REQ to transfer CNT sectors starting at SECTOR to
+   or from BUFFER, writing if WRITE is true, in the I/O class of
+   the running thread.  REQ->DONE is set to null, so that the
+   submitter can wait with block_wait(). */
+void
+block_request_init (struct block_request *req, block_sector_t sector,
+                    size_t cnt, void *buffer, bool write)
+{
+  req->sector = sector;
+  req->cnt = cnt;
+  req->buffer = buffer;
+  req->write = write;
+  req->class = thread_current ()->io_class;
+  req->done = NULL;
+  req->aux = NULL;
+  sema_init (&req->finished, 0);
+}
+
+/* Queues REQ on BLOCK and returns without waiting for it.  The
+   request goes to the queue of the physical device that BLOCK is
+   part of, whose request thread is started on first use. */
+void
+block_submit (struct block *block, struct block_request *req)
+{
+  enum intr_level old_level;
+  struct block *dev;
+  size_t depth;
+
+  ASSERT (req->cnt > 0);
+  ASSERT (req->class < BLOCK_CLASS_CNT);
+  check_sector (block, req->sector);
+  check_sector (block, req->sector + req->cnt - 1);
+  ASSERT (!req->write || block->type != BLOCK_FOREIGN);
+
+  req->block = block;
+  req->dev_sector = req->sector;
+  dev = resolve_device (block, &req->dev_sector);
+
+  lock_acquire (&dev->queue_lock);
+  if (!dev->worker_started)
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "io-%.12s", dev->name);
+      if (thread_create (name, PRI_DEFAULT, request_thread, dev)
+          == TID_ERROR)
+        PANIC ("%s: can't start request thread", dev->name);
+      dev->worker_started = true;
+    }
+  rb_insert (&dev->queues[req->class], &req->queue_elem);
+  TRACE (TRACE_BLOCK_QUEUE, req->sector,
+         req->cnt | (req->write ? TRACE_BLOCK_WRITE : 0));
+  depth = ++dev->queued;
+  old_level = intr_disable ();
+  block->stats.submit_cnt++;
+  block->stats.depth_sum += depth;
+  if (depth > block->stats.max_depth)
+    block->stats.max_depth = depth;
+  block->stats.class_reqs[req->class]++;
+  intr_set_level (old_level);
+  cond_signal (&dev->queue_cond, &dev->queue_lock);
+  lock_release (&dev->queue_lock);
+}
+
+/* Waits for REQ, which must have a null DONE function, to
+   finish. */
+void
+block_wait (struct block_request *req)
+{
+  ASSERT (req->done == NULL);
+  sema_down (&req->finished);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,6 +314,88 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Returns the number of the controller channel that BLOCK is
+   attached to, or -1 if unknown.  Devices on different channels
+   can transfer data at the same time. */
+int
+block_channel (struct block *block)
+{
+  return block->channel;
+}
+
+/* Records that BLOCK is attached to controller channel CHANNEL. */
+void
+block_set_channel (struct block *block, int channel)
+{
+  block->channel = channel;
+}
+
+/* Copies BLOCK's I/O statistics into *STATS. */
+void
+block_get_stats (struct block *block, struct block_stats *stats)
+{
+  enum intr_level old_level = intr_disable ();
+  *stats = block->stats;
+  intr_set_level (old_level);
+}
+
+/* Declares that BLOCK occupies the sectors of PARENT starting at
+   START, as a partition does.  Transfers to BLOCK are then sent
+   straight to PARENT's driver, and BLOCK inherits PARENT's
+   channel. */
+void
+block_set_parent (struct block *block, struct block *parent,
+                  block_sector_t start)
+{
+  ASSERT (parent != block);
+  ASSERT (start + block->size <= parent->size);
+
+  block->parent = parent;
+  block->start = start;
+  block->channel = parent->channel;
+}
+
+/* Returns the sector of the underlying physical device at which
+   BLOCK begins.  A file system can use this to align its own
+   allocations with those of the disk, e.g. to keep page-sized
+   groups of sectors within a single physical page-sized
+   extent. */
+block_sector_t
+block_alignment_offset (struct block *block)
+{
+  block_sector_t sector = 0;
+
+  resolve_device (block, &sector);
+  return sector;
+}
+
+/* Stores the statistics of the block device in each Pintos role
+   in STATS, which is indexed by role. */
+void
+block_get_kstat (struct kstat_block stats[KSTAT_BLOCK_CNT])
+{
+  int i;
+
+  ASSERT (BLOCK_ROLE_CNT == KSTAT_BLOCK_CNT);
+  for (i = 0; i < BLOCK_ROLE_CNT; i++)
+    {
+      struct block *block = block_by_role[i];
+      struct kstat_block *k = &stats[i];
+      struct block_stats s;
+
+      memset (k, 0, sizeof *k);
+      if (block == NULL)
+        continue;
+      block_get_stats (block, &s);
+      strlcpy (k->name, block->name, sizeof k->name);
+      k->read_cnt = s.read_cnt;
+      k->write_cnt = s.write_cnt;
+      k->read_reqs = s.read_reqs;
+      k->write_reqs = s.write_reqs;
+      k->cycles = s.cycles;
+    }
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
@@ -171,9 +407,40 @@ block_print_stats (void)
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
+          struct block_stats s;
+          unsigned long long reqs;
+          int j;
+
+          block_get_stats (block, &s);
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  s.read_cnt, s.write_cnt);
+
+          reqs = s.read_reqs + s.write_reqs;
+          if (reqs == 0)
+            continue;
+          printf ("  %llu read and %llu write transfers, "
+                  "%llu%% sequential, %llu cycles (%llu us) average\n",
+                  s.read_reqs, s.write_reqs, s.seq_reqs * 100 / reqs,
+                  s.cycles / reqs,
+                  timer_cycles_to_ns (s.cycles / reqs) / 1000);
+          if (s.submit_cnt > 0)
+            {
+              printf ("  %llu queued requests, average depth %llu, "
+                      "maximum %zu\n", s.submit_cnt,
+                      s.depth_sum / s.submit_cnt, s.max_depth);
+              printf ("  by class: %llu fault, %llu sync, %llu async, "
+                      "%llu background\n",
+                      s.class_reqs[BLOCK_CLASS_FAULT],
+                      s.class_reqs[BLOCK_CLASS_SYNC],
+                      s.class_reqs[BLOCK_CLASS_ASYNC],
+                      s.class_reqs[BLOCK_CLASS_BACKGROUND]);
+            }
+          printf ("  latency (2^n cycles):");
+          for (j = 0; j < BLOCK_LATENCY_BUCKETS; j++)
+            if (s.latency[j] != 0)
+              printf (" %d:%llu", j + BLOCK_LATENCY_SHIFT, s.latency[j]);
+          printf ("\n");
         }
     }
 }
@@ -189,6 +456,8 @@ block_register (const char *name, enum block_type type,
                 const struct block_operations *ops, void *aux)
 {
   struct block *block = malloc (sizeof *block);
+  int i;
+
   if (block == NULL)
     PANIC ("Failed to allocate memory for block device descriptor");
 
@@ -198,8 +467,22 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  block->channel = -1;
+  block->parent = NULL;
+  block->start = 0;
+  memset (&block->stats, 0, sizeof block->stats);
+  block->next_sector = 0;
+  for (i = 0; i < BLOCK_CLASS_CNT; i++)
+    {
+      rb_init (&block->queues[i], sector_less, NULL);
+      block->passed_over[i] = 0;
+    }
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_cond);
+  block->queued = 0;
+  block->worker_started = false;
+  block->worker = NULL;
+  block->head = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -221,3 +504,307 @@ list_elem_to_block (struct list_elem *list_elem)
           : NULL);
 }
 
+
+/* Request thread for physical block device DEV_.  Takes
+   requests off the queues in the order pick_request() gives,
+   merges runs of requests for adjacent sectors of one device
+   when they fit in its bounce buffer, and carries them out. */
+static void
+request_thread (void *dev_)
+{
+  struct block *dev = dev_;
+  uint8_t *bounce = palloc_get_page (0);
+
+  dev->worker = thread_current ();
+  for (;;)
+    {
+      struct list batch;
+      struct block_request *req, *next;
+      struct block *block;
+      block_sector_t sector, dev_sector;
+      size_t cnt;
+      bool write;
+
+      /* Pick the next request and any that continue it. */
+      lock_acquire (&dev->queue_lock);
+      while (dev->queued == 0)
+        cond_wait (&dev->queue_cond, &dev->queue_lock);
+      req = pick_request (dev);
+      remove_request (dev, req);
+      list_init (&batch);
+      list_push_back (&batch, &req->elem);
+      block = req->block;
+      sector = req->sector;
+      dev_sector = req->dev_sector;
+      cnt = req->cnt;
+      write = req->write;
+      if (bounce != NULL)
+        while ((next = find_request (dev, dev_sector + cnt, write, block))
+               != NULL
+               && cnt + next->cnt <= BLOCK_MERGE_MAX)
+          {
+            remove_request (dev, next);
+            list_push_back (&batch, &next->elem);
+            cnt += next->cnt;
+          }
+      dev->head = dev_sector + cnt;
+      lock_release (&dev->queue_lock);
+
+      if (list_size (&batch) == 1)
+        {
+          /* A single request moves directly to or from its
+             buffer. */
+          transfer (block, sector, cnt, req->buffer, write);
+          complete_request (req);
+        }
+      else
+        {
+          /* Merged requests go through the bounce buffer. */
+          struct list_elem *e;
+          size_t ofs;
+
+          if (write)
+            {
+              ofs = 0;
+              for (e = list_begin (&batch); e != list_end (&batch);
+                   e = list_next (e))
+                {
+                  req = list_entry (e, struct block_request, elem);
+                  memcpy (bounce + ofs, req->buffer,
+                          req->cnt * BLOCK_SECTOR_SIZE);
+                  ofs += req->cnt * BLOCK_SECTOR_SIZE;
+                }
+            }
+          transfer (block, sector, cnt, bounce, write);
+
+          ofs = 0;
+          while (!list_empty (&batch))
+            {
+              req = list_entry (list_pop_front (&batch),
+                                struct block_request, elem);
+              if (!write)
+                memcpy (req->buffer, bounce + ofs,
+                        req->cnt * BLOCK_SECTOR_SIZE);
+              ofs += req->cnt * BLOCK_SECTOR_SIZE;
+              complete_request (req);
+            }
+        }
+    }
+}
+
+/* Returns the queued request of DEV to carry out next.  It comes
+   from the most urgent class that has requests, unless a less
+   urgent one has been passed over BLOCK_STARVE_LIMIT times, and
+   within the class it is the one with the lowest sector at or
+   after the head, or if there is none, the lowest sector
+   overall (C-LOOK).  DEV must have queued requests.
+   Must be called with DEV's queue_lock held. */
+static struct block_request *
+pick_request (struct block *dev)
+{
+  struct block_request key;
+  struct rbtree *queue;
+  struct rb_elem *e;
+  int class = BLOCK_CLASS_CNT;
+  int i;
+
+  for (i = 0; i < BLOCK_CLASS_CNT; i++)
+    if (!rb_empty (&dev->queues[i]))
+      {
+        if (class == BLOCK_CLASS_CNT)
+          class = i;
+        else if (dev->passed_over[i] >= BLOCK_STARVE_LIMIT)
+          {
+            class = i;
+            break;
+          }
+      }
+  ASSERT (class < BLOCK_CLASS_CNT);
+  for (i = 0; i < BLOCK_CLASS_CNT; i++)
+    if (i == class || rb_empty (&dev->queues[i]))
+      dev->passed_over[i] = 0;
+    else
+      dev->passed_over[i]++;
+
+  queue = &dev->queues[class];
+  key.dev_sector = dev->head;
+  e = rb_lower_bound (queue, &key.queue_elem);
+  if (e == NULL)
+    e = rb_min (queue);
+  return rb_entry (e, struct block_request, queue_elem);
+}
+
+/* Returns a queued request of DEV, of any class, for device PART
+   that starts at DEV_SECTOR of DEV and has the same direction as
+   WRITE, or a null pointer if there is none.
+   Must be called with DEV's queue_lock held. */
+static struct block_request *
+find_request (struct block *dev, block_sector_t dev_sector, bool write,
+              struct block *part)
+{
+  struct block_request key;
+  int i;
+
+  key.dev_sector = dev_sector;
+  for (i = 0; i < BLOCK_CLASS_CNT; i++)
+    {
+      struct rb_elem *e;
+
+      for (e = rb_lower_bound (&dev->queues[i], &key.queue_elem);
+           e != NULL; e = rb_next (e))
+        {
+          struct block_request *req = rb_entry (e, struct block_request,
+                                                queue_elem);
+          if (req->dev_sector != dev_sector)
+            break;
+          if (req->write == write && req->block == part)
+            return req;
+        }
+    }
+  return NULL;
+}
+
+/* Removes REQ from the queues of DEV.
+   Must be called with DEV's queue_lock held. */
+static void
+remove_request (struct block *dev, struct block_request *req)
+{
+  rb_remove (&dev->queues[req->class], &req->queue_elem);
+  dev->queued--;
+}
+
+/* Carries out a synchronous transfer of CNT sectors starting at
+   SECTOR between BLOCK and BUFFER, a write if WRITE is true.  It
+   is queued like any request, in the running thread's class, and
+   waited for, unless waiting for the request thread is not
+   possible: in an interrupt handler, with interrupts off, as
+   during a panic, or in the request thread itself. */
+static void
+sync_transfer (struct block *block, block_sector_t sector, size_t cnt,
+               void *buffer, bool write)
+{
+  block_sector_t dev_sector = sector;
+  struct block_request req;
+
+  if (cnt == 0)
+    return;
+  if (intr_context () || intr_get_level () == INTR_OFF
+      || resolve_device (block, &dev_sector)->worker == thread_current ())
+    {
+      transfer (block, sector, cnt, buffer, write);
+      return;
+    }
+  block_request_init (&req, sector, cnt, buffer, write);
+  block_submit (block, &req);
+  block_wait (&req);
+}
+
+/* Transfers CNT sectors starting at SECTOR between BLOCK and
+   BUFFER, a write if WRITE is true, by calling the driver right
+   away. */
+static void
+transfer (struct block *block, block_sector_t sector, size_t cnt,
+          void *buffer_, bool write)
+{
+  uint8_t *buffer = buffer_;
+  uint64_t start = timer_cycles ();
+  block_sector_t dev_sector = sector;
+  struct block *dev;
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (!write || block->type != BLOCK_FOREIGN);
+  dev = resolve_device (block, &dev_sector);
+  TRACE (TRACE_BLOCK_SUBMIT, sector, cnt | (write ? TRACE_BLOCK_WRITE : 0));
+  if (write && dev->ops->write_multi != NULL)
+    dev->ops->write_multi (dev->aux, dev_sector, cnt, buffer);
+  else if (write)
+    for (i = 0; i < cnt; i++)
+      dev->ops->write (dev->aux, dev_sector + i,
+                       buffer + i * BLOCK_SECTOR_SIZE);
+  else if (dev->ops->read_multi != NULL)
+    dev->ops->read_multi (dev->aux, dev_sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      dev->ops->read (dev->aux, dev_sector + i,
+                      buffer + i * BLOCK_SECTOR_SIZE);
+  TRACE (TRACE_BLOCK_DONE, sector, cnt | (write ? TRACE_BLOCK_WRITE : 0));
+  account_transfer (block, sector, cnt, write, start);
+}
+
+/* Signals that REQ is done. */
+static void
+complete_request (struct block_request *req)
+{
+  if (req->done != NULL)
+    req->done (req);
+  else
+    sema_up (&req->finished);
+}
+
+/* Orders a block device's request queue: returns true if
+   request A starts at a lower sector of the physical device than
+   request B. */
+static bool
+sector_less (const struct rb_elem *a_, const struct rb_elem *b_,
+             void *aux UNUSED)
+{
+  const struct block_request *a = rb_entry (a_, struct block_request,
+                                            queue_elem);
+  const struct block_request *b = rb_entry (b_, struct block_request,
+                                            queue_elem);
+
+  return a->dev_sector < b->dev_sector;
+}
+
+/* Returns the physical device underlying BLOCK, translating
+   *SECTOR, a sector within BLOCK, into a sector of that device.
+   SECTOR must already have been checked against BLOCK's size. */
+static struct block *
+resolve_device (struct block *block, block_sector_t *sector)
+{
+  while (block->parent != NULL)
+    {
+      *sector += block->start;
+      block = block->parent;
+    }
+  return block;
+}
+
+/* Adds a transfer of CNT sectors starting at SECTOR, a write if
+   WRITE is true, that began at time-stamp START, to BLOCK's
+   statistics. */
+static void
+account_transfer (struct block *block, block_sector_t sector, size_t cnt,
+                  bool write, uint64_t start)
+{
+  uint64_t cycles = timer_cycles () - start;
+  struct block_stats *s = &block->stats;
+  enum intr_level old_level;
+  int bucket;
+
+  for (bucket = 0; bucket < BLOCK_LATENCY_BUCKETS - 1; bucket++)
+    if ((cycles >> (BLOCK_LATENCY_SHIFT + bucket + 1)) == 0)
+      break;
+
+  old_level = intr_disable ();
+  if (write)
+    {
+      s->write_cnt += cnt;
+      s->write_reqs++;
+    }
+  else
+    {
+      s->read_cnt += cnt;
+      s->read_reqs++;
+    }
+  if (sector == block->next_sector)
+    s->seq_reqs++;
+  block->next_sector = sector + cnt;
+  s->cycles += cycles;
+  s->latency[bucket]++;
+  intr_set_level (old_level);
+}
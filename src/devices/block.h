@@ -3,6 +3,10 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include <kstat.h>
+#include <rbtree.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,10 +57,103 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multi (struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multi (struct block *, block_sector_t, size_t cnt,
+                        const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
+int block_channel (struct block *);
+void block_set_channel (struct block *, int channel);
+void block_set_parent (struct block *, struct block *parent,
+                       block_sector_t start);
+block_sector_t block_alignment_offset (struct block *);
+
+/* I/O classes, most urgent first.  Each thread has one, which
+   tags the requests it submits and its synchronous transfers. */
+enum block_class
+  {
+    BLOCK_CLASS_FAULT,                  /* Page faults. */
+    BLOCK_CLASS_SYNC,                   /* Other waited-for I/O (default). */
+    BLOCK_CLASS_ASYNC,                  /* Write-behind, asynchronous I/O. */
+    BLOCK_CLASS_BACKGROUND,             /* Cleaning, read-ahead, defrag. */
+    BLOCK_CLASS_CNT
+  };
+
+enum block_class block_set_class (enum block_class);
+
+/* Asynchronous requests.
+
+   A request is submitted with block_submit(), which returns at
+   once.  Each physical block device has a thread that carries
+   out the queued requests of the device and its partitions.  It
+   takes them from the most urgent class that has any, in
+   elevator (C-LOOK) order within the class, but a class passed
+   over several times in a row goes next, so that background work
+   is never starved.  Requests for adjacent sectors of one device
+   are merged into a single transfer, whatever their classes.
+   When a request is done, its DONE function is called, in that
+   thread, if it is non-null; otherwise block_wait() on the
+   request returns.  The request and its buffer must stay valid
+   until then, and DONE must not block.
+
+   Synchronous transfers with block_read() and the like go
+   through the same queue, so that a page fault is not kept
+   waiting behind a burst of write-behind. */
+struct block_request
+  {
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    void *buffer;                       /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    bool write;                         /* Write if true, else read. */
+    enum block_class class;             /* Submitter's class by default. */
+    void (*done) (struct block_request *); /* Completion function. */
+    void *aux;                          /* For use by DONE. */
+
+    /* Owned by the block layer. */
+    struct block *block;                /* Device submitted to. */
+    block_sector_t dev_sector;          /* SECTOR on the physical device. */
+    struct rb_elem queue_elem;          /* Element in request queue. */
+    struct list_elem elem;              /* Element in merged batch. */
+    struct semaphore finished;          /* Up'd when done, if no DONE. */
+  };
+
+void block_request_init (struct block_request *, block_sector_t,
+                         size_t cnt, void *buffer, bool write);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
 
 /* Statistics. */
+
+/* Number of buckets in a latency histogram.  Bucket 0 counts
+   transfers that took fewer than 2**(BLOCK_LATENCY_SHIFT + 1)
+   CPU cycles, bucket I counts those that took at least
+   2**(BLOCK_LATENCY_SHIFT + I) cycles and fewer than twice that,
+   and the last bucket also counts everything slower. */
+#define BLOCK_LATENCY_BUCKETS 16
+#define BLOCK_LATENCY_SHIFT 10
+
+/* I/O statistics for one block device. */
+struct block_stats
+  {
+    unsigned long long read_cnt;        /* Number of sectors read. */
+    unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long read_reqs;       /* Number of read transfers. */
+    unsigned long long write_reqs;      /* Number of write transfers. */
+    unsigned long long seq_reqs;        /* Transfers that began where
+                                           the previous one ended. */
+    unsigned long long cycles;          /* Total time in transfers. */
+    unsigned long long latency[BLOCK_LATENCY_BUCKETS];
+                                        /* Histogram of transfer times. */
+    unsigned long long submit_cnt;      /* Number of queued requests. */
+    unsigned long long depth_sum;       /* Sum of queue depths seen by
+                                           submitted requests. */
+    size_t max_depth;                   /* Deepest the queue has been. */
+    unsigned long long class_reqs[BLOCK_CLASS_CNT];
+                                        /* Queued requests by class. */
+  };
+
+void block_get_stats (struct block *, struct block_stats *);
+void block_get_kstat (struct kstat_block[KSTAT_BLOCK_CNT]);
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
@@ -65,6 +162,13 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors at once.  If
+       null, the block layer calls READ or WRITE once per sector. */
+    void (*read_multi) (void *aux, block_sector_t, size_t cnt,
+                        void *buffer);
+    void (*write_multi) (void *aux, block_sector_t, size_t cnt,
+                         const void *buffer);
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -5,10 +5,13 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -34,6 +37,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +53,53 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA with retries. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA with retries. */
+#define CMD_READ_SECTOR_EXT 0x24        /* READ SECTOR EXT (LBA48). */
+#define CMD_WRITE_SECTOR_EXT 0x34       /* WRITE SECTOR EXT (LBA48). */
+#define CMD_READ_DMA_EXT 0x25           /* READ DMA EXT (LBA48). */
+#define CMD_WRITE_DMA_EXT 0x35          /* WRITE DMA EXT (LBA48). */
+
+/* Sectors at or beyond this one need 48-bit addressing. */
+#define LBA28_LIMIT (1UL << 28)
+
+/* Largest number of sectors moved by one READ or WRITE SECTOR
+   command.  A sector count of 0 would mean 256, so we stay
+   below that. */
+#define IDE_MAX_SECTORS 255
+
+/* Bus-master IDE register port addresses, relative to the bus
+   master base found through PCI.  (See the "Programming
+   Interface for Bus Master IDE Controller" specification.) */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus-master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start/stop bus master. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus-master Status Register bits. */
+#define BM_STA_ERR 0x02         /* Error. */
+#define BM_STA_INTR 0x04        /* Interrupt. */
+
+/* PCI identification of a bus-master IDE controller. */
+#define PCI_CLASS_IDE 0x0101    /* Mass storage, IDE. */
+#define PCI_PROGIF_BM 0x8000    /* Prog. i/f: bus master capable. */
+
+/* A physical region descriptor, which tells the bus master
+   where in physical memory a piece of a DMA transfer goes. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Byte count; 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last descriptor. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* Number of PRDs per channel, enough for IDE_MAX_SECTORS
+   sectors split at 64 kB boundaries. */
+#define PRD_CNT 4
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +108,8 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool use_dma;               /* Transfer by bus-master DMA? */
+    bool lba48;                 /* Supports 48-bit addressing? */
   };
 
 /* An ATA channel (aka controller).
@@ -71,8 +124,14 @@ struct channel
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    unsigned unexpected_cnt;    /* Spurious interrupts not yet reported. */
+    struct intr_work report_work;       /* Reports them. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
+
+    uint16_t bm_base;               /* Bus-master registers, 0 if none. */
+    struct prd prdt[PRD_CNT] __attribute__ ((aligned (64)));
+                                    /* DMA descriptor table. */
   };
 
 /* We support the two "legacy" ATA channels found in a standard PC. */
@@ -85,7 +144,7 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static bool select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -95,13 +154,31 @@ static bool wait_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
+static uint16_t find_bus_master (void);
+static bool dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          void *, bool write);
+
 static void interrupt_handler (struct intr_frame *);
+static intr_work_func report_unexpected;
+static thread_func probe_channel;
+
+/* Up'd by each channel's probe thread when it is done. */
+static struct semaphore probe_done;
 
-/* Initialize the disk subsystem and detect disks. */
+/* Initialize the disk subsystem and detect disks.
+
+   Resetting a channel and waiting for its devices takes most of
+   the time, so each channel is reset and probed by a thread of
+   its own, all at once.  The disks found are then identified and
+   registered in channel order, so that they always get the same
+   names and roles. */
 void
 ide_init (void) 
 {
   size_t chan_no;
+  uint16_t bm_base = find_bus_master ();
+
+  sema_init (&probe_done, 0);
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
@@ -126,6 +203,9 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->unexpected_cnt = 0;
+      intr_work_init (&c->report_work, report_unexpected, c);
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,24 +216,48 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->use_dma = false;
+          d->lba48 = false;
         }
 
       /* Register interrupt handler. */
       intr_register_ext (c->irq, interrupt_handler, c->name);
 
-      /* Reset hardware. */
-      reset_channel (c);
+      /* Reset and probe hardware in the background. */
+      if (thread_create (c->name, PRI_DEFAULT, probe_channel, c)
+          == TID_ERROR)
+        probe_channel (c);
+    }
 
-      /* Distinguish ATA hard disks from other devices. */
-      if (check_device_type (&c->devices[0]))
-        check_device_type (&c->devices[1]);
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    sema_down (&probe_done);
+
+  /* Read hard disk identity information. */
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      int dev_no;
 
-      /* Read hard disk identity information. */
       for (dev_no = 0; dev_no < 2; dev_no++)
-        if (c->devices[dev_no].is_ata)
-          identify_ata_device (&c->devices[dev_no]);
+        if (channels[chan_no].devices[dev_no].is_ata)
+          identify_ata_device (&channels[chan_no].devices[dev_no]);
     }
 }
+
+/* Resets channel C_ and finds out which of its devices are ATA
+   disks.  Runs in a thread of its own for each channel. */
+static void
+probe_channel (void *c_) 
+{
+  struct channel *c = c_;
+
+  reset_channel (c);
+
+  /* Distinguish ATA hard disks from other devices. */
+  if (check_device_type (&c->devices[0]))
+    check_device_type (&c->devices[1]);
+
+  sema_up (&probe_done);
+}
 
 /* Disk detection and identification. */
 
@@ -196,7 +300,9 @@ reset_channel (struct channel *c)
   timer_usleep (10);
   outb (reg_ctl (c), 0);
 
-  timer_msleep (150);
+  /* The devices may take 2 ms to set BSY after the reset.  After
+     that, polling BSY tells when they are done. */
+  timer_msleep (2);
 
   /* Wait for device 0 to clear BSY. */
   if (present[0]) 
@@ -215,7 +321,7 @@ reset_channel (struct channel *c)
         {
           if (inb (reg_nsect (c)) == 1 && inb (reg_lbal (c)) == 1)
             break;
-          timer_msleep (10);
+          timer_msleep (1);
         }
       wait_while_busy (&c->devices[1]);
     }
@@ -281,9 +387,21 @@ identify_ata_device (struct ata_disk *d)
     }
   input_sector (c, id);
 
-  /* Calculate capacity.
+  /* Use DMA if both the controller and the disk support it. */
+  d->use_dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100) != 0;
+
+  /* Calculate capacity, which for a disk that supports 48-bit
+     addressing is in words 100 to 103.  We can address at most
+     2**32 sectors.
      Read model name and serial number. */
-  capacity = *(uint32_t *) &id[60 * 2];
+  d->lba48 = (*(uint16_t *) &id[83 * 2] & 0x400) != 0;
+  if (d->lba48)
+    {
+      uint64_t capacity48 = *(uint64_t *) &id[100 * 2];
+      capacity = capacity48 > UINT32_MAX ? UINT32_MAX : capacity48;
+    }
+  else
+    capacity = *(uint32_t *) &id[60 * 2];
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
@@ -306,6 +424,7 @@ identify_ata_device (struct ata_disk *d)
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  block_set_channel (block, c - channels);
   partition_scan (block);
 }
 
@@ -337,68 +456,157 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.  Up to
+   IDE_MAX_SECTORS sectors are read per command.  If the disk
+   supports it, they are moved by bus-master DMA; otherwise, by
+   PIO, with the disk raising an interrupt as each sector becomes
+   ready.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multi (void *d_, block_sector_t sec_no, size_t cnt, void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      size_t n = cnt < IDE_MAX_SECTORS ? cnt : IDE_MAX_SECTORS;
+      size_t i;
+
+      if (!d->use_dma || !dma_transfer (d, sec_no, n, buffer, false))
+        {
+          issue_pio_command (c, select_sector (d, sec_no, n)
+                                ? CMD_READ_SECTOR_EXT
+                                : CMD_READ_SECTOR_RETRY);
+          for (i = 0; i < n; i++)
+            {
+              sema_down (&c->completion_wait);
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                       d->name, sec_no + i);
+              input_sector (c, buffer + i * BLOCK_SECTOR_SIZE);
+            }
+        }
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sec_no += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Returns
+   after the disk has acknowledged receiving the data.  Up to
+   IDE_MAX_SECTORS sectors are written per command, by DMA if the
+   disk supports it, otherwise by PIO, with the disk raising an
+   interrupt after accepting each sector.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multi (void *d_, block_sector_t sec_no, size_t cnt,
+                 const void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t n = cnt < IDE_MAX_SECTORS ? cnt : IDE_MAX_SECTORS;
+      size_t i;
+
+      if (!d->use_dma
+          || !dma_transfer (d, sec_no, n, (void *) buffer, true))
+        {
+          issue_pio_command (c, select_sector (d, sec_no, n)
+                                ? CMD_WRITE_SECTOR_EXT
+                                : CMD_WRITE_SECTOR_RETRY);
+          for (i = 0; i < n; i++)
+            {
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                       d->name, sec_no + i);
+              output_sector (c, buffer + i * BLOCK_SECTOR_SIZE);
+              sema_down (&c->completion_wait);
+            }
+        }
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sec_no += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ide_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multi (d_, sec_no, 1, buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multi (d_, sec_no, 1, buffer);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multi,
+    ide_write_multi
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
-static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+   writes SEC_NO and the sector count CNT to the disk's sector
+   selection registers.  (We use LBA mode.)  Returns true if the
+   transfer reaches past the 28-bit limit, in which case the
+   registers are loaded for 48-bit addressing and the caller must
+   issue an EXT command. */
+static bool
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= IDE_MAX_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  if (sec_no + cnt > LBA28_LIMIT)
+    {
+      /* LBA48: each register takes the high-order byte, then the
+         low-order byte.  Sector numbers fit in 32 bits, so bits
+         32 to 47 are zero. */
+      ASSERT (d->lba48);
+      outb (reg_nsect (c), cnt >> 8);
+      outb (reg_lbal (c), sec_no >> 24);
+      outb (reg_lbam (c), 0);
+      outb (reg_lbah (c), 0);
+      outb (reg_nsect (c), cnt);
+      outb (reg_lbal (c), sec_no);
+      outb (reg_lbam (c), sec_no >> 8);
+      outb (reg_lbah (c), sec_no >> 16);
+      outb (reg_device (c),
+            DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0));
+      return true;
+    }
+
+  outb (reg_nsect (c), cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
   outb (reg_device (c),
         DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0) | (sec_no >> 24));
+  return false;
 }
 
 /* Writes COMMAND to channel C and prepares for receiving a
@@ -430,6 +638,109 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Bus-master DMA. */
+
+/* Looks on PCI bus 0 for an IDE controller capable of bus-master
+   DMA, enables bus mastering on it and returns the I/O base of
+   its bus-master registers, or 0 if there is no such
+   controller. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, fn;
+
+  for (dev = 0; dev < 32; dev++)
+    for (fn = 0; fn < 8; fn++)
+      {
+        uint32_t class, bar;
+
+        if ((pci_read_config (0, dev, fn, PCI_REG_ID) & 0xffff) == 0xffff)
+          continue;
+        class = pci_read_config (0, dev, fn, PCI_REG_CLASS);
+        if ((class >> 16) != PCI_CLASS_IDE || (class & PCI_PROGIF_BM) == 0)
+          continue;
+        bar = pci_read_config (0, dev, fn, PCI_REG_BAR (4));
+        if ((bar & 1) == 0 || (bar & ~3u) == 0)
+          continue;
+
+        pci_write_config (0, dev, fn, PCI_REG_COMMAND,
+                          pci_read_config (0, dev, fn, PCI_REG_COMMAND)
+                          | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+        return bar & ~3u;
+      }
+  return 0;
+}
+
+/* Transfers CNT sectors starting at SEC_NO between disk D and
+   BUFFER by DMA, reading into BUFFER if WRITE is false and
+   writing from it otherwise.  The caller must hold D's channel
+   lock.  Returns true if successful.  Returns false without
+   touching the disk if BUFFER is unsuitable for DMA, or after
+   turning DMA off for D if the transfer fails, so that the
+   caller can fall back to PIO. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              void *buffer, bool write)
+{
+  struct channel *c = d->channel;
+  uintptr_t paddr;
+  size_t size = cnt * BLOCK_SECTOR_SIZE;
+  uint8_t bm_sta, sta;
+  int i;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  /* The controller moves words to and from physical memory. */
+  if (!is_kernel_vaddr (buffer) || ((uintptr_t) buffer & 1) != 0)
+    return false;
+
+  /* Describe BUFFER, splitting it at 64 kB boundaries, which a
+     PRD entry must not cross.  A byte count of 0 means 64 kB. */
+  paddr = vtop (buffer);
+  for (i = 0; size > 0; i++)
+    {
+      size_t chunk = 0x10000 - (paddr & 0xffff);
+      if (chunk > size)
+        chunk = size;
+
+      ASSERT (i < PRD_CNT);
+      c->prdt[i].addr = paddr;
+      c->prdt[i].size = chunk & 0xffff;
+      c->prdt[i].flags = 0;
+      paddr += chunk;
+      size -= chunk;
+    }
+  c->prdt[i - 1].flags = PRD_EOT;
+
+  /* Program the bus master, then the disk, then start. */
+  outb (reg_bm_command (c), 0);
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_status (c), BM_STA_ERR | BM_STA_INTR);
+  outb (reg_bm_command (c), write ? 0 : BM_CMD_READ);
+  if (select_sector (d, sec_no, cnt))
+    issue_pio_command (c, write ? CMD_WRITE_DMA_EXT : CMD_READ_DMA_EXT);
+  else
+    issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), inb (reg_bm_command (c)) | BM_CMD_START);
+
+  /* Sleep until the disk says it's done. */
+  sema_down (&c->completion_wait);
+  outb (reg_bm_command (c), inb (reg_bm_command (c)) & ~BM_CMD_START);
+  bm_sta = inb (reg_bm_status (c));
+  sta = inb (reg_alt_status (c));
+  outb (reg_bm_status (c), BM_STA_ERR | BM_STA_INTR);
+
+  if ((bm_sta & BM_STA_ERR) != 0 || (sta & (STA_ERR | STA_DRQ)) != 0)
+    {
+      printf ("%s: DMA transfer failed, sector=%"PRDSNu", using PIO\n",
+              d->name, sec_no);
+      d->use_dma = false;
+      wait_until_idle (d);
+      return false;
+    }
+  return true;
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -472,7 +783,9 @@ wait_while_busy (const struct ata_disk *d)
             printf ("ok\n");
           return (inb (reg_alt_status (c)) & STA_DRQ) != 0;
         }
-      timer_msleep (10);
+
+      /* Poll often at first: most waits are short. */
+      timer_msleep (i < 10 ? 1 : 10);
     }
 
   printf ("failed\n");
@@ -517,11 +830,35 @@ interrupt_handler (struct intr_frame *f)
             sema_up (&c->completion_wait);      /* Wake up waiter. */
           }
         else
-          printf ("%s: unexpected interrupt\n", c->name);
+          {
+            /* Printing is too slow to do here. */
+            c->unexpected_cnt++;
+            intr_work_queue (&c->report_work);
+          }
         return;
       }
 
   NOT_REACHED ();
 }
 
+/* Reports the unexpected interrupts counted on channel C_ by
+   interrupt_handler().  Deferred interrupt work. */
+static void
+report_unexpected (void *c_)
+{
+  struct channel *c = c_;
+  enum intr_level old_level;
+  unsigned cnt;
+
+  old_level = intr_disable ();
+  cnt = c->unexpected_cnt;
+  c->unexpected_cnt = 0;
+  intr_set_level (old_level);
+
+  if (cnt == 1)
+    printf ("%s: unexpected interrupt\n", c->name);
+  else if (cnt > 1)
+    printf ("%s: %u unexpected interrupts\n", c->name, cnt);
+}
+
 
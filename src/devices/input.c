@@ -1,28 +1,66 @@
 #include "devices/input.h"
 #include <debug.h>
-#include "devices/intq.h"
 #include "devices/serial.h"
+#include "devices/spscq.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#ifdef USERPROG
+#include "userprog/poll.h"
+#endif
 
-/* Stores keys from the keyboard and serial port. */
-static struct intq buffer;
+/* Size of the input buffer, in bytes.  Large enough to hold a
+   pasted line or two while no thread is reading. */
+#define INPUT_BUFSIZE 1024
+
+/* Stores keys from the keyboard and serial port.  The keyboard
+   and serial interrupt handlers, which do not nest, are its
+   producer, and the thread holding READ_LOCK its consumer, so
+   reading keys does not turn interrupts off. */
+static struct spscq buffer;
+static uint8_t buffer_data[INPUT_BUFSIZE];
+static struct lock read_lock;
+
+/* Set when a key fills the buffer, which may have made the
+   serial port stop receive interrupts, and cleared by the reader
+   that tells it there is room again. */
+static volatile bool throttled;
+
+static void unthrottle (void);
 
 /* Initializes the input buffer. */
 void
 input_init (void) 
 {
-  intq_init (&buffer);
+  spscq_init (&buffer, buffer_data, 1, sizeof buffer_data);
+  lock_init_named (&read_lock, "input");
 }
 
 /* Adds a key to the input buffer.
    Interrupts must be off and the buffer must not be full. */
 void
 input_putc (uint8_t key) 
+{
+  input_putbuf (&key, 1);
+}
+
+/* Adds the SIZE keys in KEYS to the input buffer.
+   Interrupts must be off and the buffer must have room for all
+   of them. */
+void
+input_putbuf (const uint8_t *keys, size_t size) 
 {
   ASSERT (intr_get_level () == INTR_OFF);
-  ASSERT (!intq_full (&buffer));
+  ASSERT (size <= spscq_room (&buffer));
 
-  intq_putc (&buffer, key);
+  if (size == 0)
+    return;
+  spscq_push (&buffer, keys, size);
+  if (spscq_full (&buffer))
+    throttled = true;
   serial_notify ();
+#ifdef USERPROG
+  poll_notify ();
+#endif
 }
 
 /* Retrieves a key from the input buffer.
@@ -30,23 +68,67 @@ input_putc (uint8_t key)
 uint8_t
 input_getc (void) 
 {
-  enum intr_level old_level;
   uint8_t key;
 
-  old_level = intr_disable ();
-  key = intq_getc (&buffer);
-  serial_notify ();
-  intr_set_level (old_level);
-  
+  input_read (&key, 1);
   return key;
 }
 
+/* Retrieves up to SIZE keys from the input buffer into BUF and
+   returns the number retrieved.  Waits for a key to be pressed
+   if the buffer is empty, but otherwise takes only the keys that
+   are already there. */
+size_t
+input_read (uint8_t *buf, size_t size) 
+{
+  size_t cnt;
+
+  if (size == 0)
+    return 0;
+
+  lock_acquire (&read_lock);
+  spscq_wait (&buffer);
+  cnt = spscq_pop (&buffer, buf, size);
+  if (throttled)
+    unthrottle ();
+  lock_release (&read_lock);
+
+  return cnt;
+}
+
+/* Returns true if the input buffer is empty,
+   false otherwise. */
+bool
+input_empty (void) 
+{
+  return spscq_empty (&buffer);
+}
+
 /* Returns true if the input buffer is full,
-   false otherwise.
-   Interrupts must be off. */
+   false otherwise. */
 bool
 input_full (void) 
 {
-  ASSERT (intr_get_level () == INTR_OFF);
-  return intq_full (&buffer);
+  return spscq_full (&buffer);
+}
+
+/* Returns the number of keys that can be added to the input
+   buffer before it is full. */
+size_t
+input_room (void) 
+{
+  return spscq_room (&buffer);
+}
+
+/* Tells the serial port that the input buffer has room again,
+   so that it receives once more.  If the buffer has filled up
+   again already, it stays throttled until the next read. */
+static void
+unthrottle (void)
+{
+  enum intr_level old_level = intr_disable ();
+
+  throttled = spscq_full (&buffer);
+  serial_notify ();
+  intr_set_level (old_level);
 }
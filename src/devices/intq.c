@@ -1,17 +1,36 @@
 #include "devices/intq.h"
 #include <debug.h>
+#include <string.h>
 #include "threads/thread.h"
 
-static int next (int pos);
+static size_t min (size_t, size_t);
 static void wait (struct intq *q, struct thread **waiter);
 static void signal (struct intq *q, struct thread **waiter);
+static void wait_for_data (struct intq *);
+static void wait_for_room (struct intq *, size_t want);
 
-/* Initializes interrupt queue Q. */
+/* Initializes interrupt queue Q with a buffer of INTQ_BUFSIZE
+   bytes of its own. */
 void
 intq_init (struct intq *q) 
 {
+  intq_init_buf (q, q->default_buf, sizeof q->default_buf);
+}
+
+/* Initializes interrupt queue Q to hold up to SIZE bytes in BUF,
+   which must stay valid as long as Q is in use.  SIZE must be a
+   power of 2. */
+void
+intq_init_buf (struct intq *q, uint8_t *buf, size_t size) 
+{
+  ASSERT (buf != NULL);
+  ASSERT (size > 0 && (size & (size - 1)) == 0);
+
   lock_init (&q->lock);
   q->not_full = q->not_empty = NULL;
+  q->want_room = 0;
+  q->buf = buf;
+  q->size = size;
   q->head = q->tail = 0;
 }
 
@@ -28,7 +47,24 @@ bool
 intq_full (const struct intq *q) 
 {
   ASSERT (intr_get_level () == INTR_OFF);
-  return next (q->head) == q->tail;
+  return q->head - q->tail == q->size;
+}
+
+/* Returns the number of bytes in Q. */
+size_t
+intq_count (const struct intq *q) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  return q->head - q->tail;
+}
+
+/* Returns the number of bytes that can be added to Q before it
+   is full. */
+size_t
+intq_room (const struct intq *q) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  return q->size - (q->head - q->tail);
 }
 
 /* Removes a byte from Q and returns it.
@@ -40,16 +76,9 @@ intq_getc (struct intq *q)
   uint8_t byte;
   
   ASSERT (intr_get_level () == INTR_OFF);
-  while (intq_empty (q)) 
-    {
-      ASSERT (!intr_context ());
-      lock_acquire (&q->lock);
-      wait (q, &q->not_empty);
-      lock_release (&q->lock);
-    }
+  wait_for_data (q);
   
-  byte = q->buf[q->tail];
-  q->tail = next (q->tail);
+  byte = q->buf[q->tail++ & (q->size - 1)];
   signal (q, &q->not_full);
   return byte;
 }
@@ -61,24 +90,99 @@ void
 intq_putc (struct intq *q, uint8_t byte) 
 {
   ASSERT (intr_get_level () == INTR_OFF);
-  while (intq_full (q))
+  wait_for_room (q, 1);
+
+  q->buf[q->head++ & (q->size - 1)] = byte;
+  signal (q, &q->not_empty);
+}
+
+/* Removes up to SIZE bytes from Q into BUF and returns the
+   number removed.  If Q is empty, sleeps until a byte is added,
+   but otherwise takes only the bytes that are already there.
+   When called from an interrupt handler, Q must not be empty. */
+size_t
+intq_get_bulk (struct intq *q, uint8_t *buf, size_t size) 
+{
+  size_t cnt, ofs, first;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (size == 0)
+    return 0;
+  wait_for_data (q);
+
+  cnt = min (size, intq_count (q));
+  ofs = q->tail & (q->size - 1);
+  first = min (cnt, q->size - ofs);
+  memcpy (buf, q->buf + ofs, first);
+  memcpy (buf + first, q->buf, cnt - first);
+  q->tail += cnt;
+  signal (q, &q->not_full);
+  return cnt;
+}
+
+/* Adds up to SIZE bytes from BUF to the end of Q and returns the
+   number added.  If Q is full, sleeps until there is room for
+   all SIZE bytes or for half of Q, whichever is less, but
+   otherwise adds only as many bytes as fit.
+   When called from an interrupt handler, Q must not be full. */
+size_t
+intq_put_bulk (struct intq *q, const uint8_t *buf, size_t size) 
+{
+  size_t cnt, ofs, first;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (size == 0)
+    return 0;
+  if (intq_full (q))
+    wait_for_room (q, min (size, q->size / 2));
+
+  cnt = min (size, intq_room (q));
+  ofs = q->head & (q->size - 1);
+  first = min (cnt, q->size - ofs);
+  memcpy (q->buf + ofs, buf, first);
+  memcpy (q->buf, buf + first, cnt - first);
+  q->head += cnt;
+  signal (q, &q->not_empty);
+  return cnt;
+}
+
+/* Returns the lesser of A and B. */
+static size_t
+min (size_t a, size_t b) 
+{
+  return a < b ? a : b;
+}
+
+/* Sleeps until Q is not empty.
+   When called from an interrupt handler, Q must not be empty. */
+static void
+wait_for_data (struct intq *q) 
+{
+  while (intq_empty (q)) 
     {
       ASSERT (!intr_context ());
       lock_acquire (&q->lock);
-      wait (q, &q->not_full);
+      wait (q, &q->not_empty);
       lock_release (&q->lock);
     }
-
-  q->buf[q->head] = byte;
-  q->head = next (q->head);
-  signal (q, &q->not_empty);
 }
-
-/* Returns the position after POS within an intq. */
-static int
-next (int pos) 
+
+/* Sleeps until Q has room for at least WANT bytes.
+   When called from an interrupt handler, Q must have that much
+   room. */
+static void
+wait_for_room (struct intq *q, size_t want) 
 {
-  return (pos + 1) % INTQ_BUFSIZE;
+  ASSERT (want > 0 && want <= q->size);
+  while (intq_room (q) < want)
+    {
+      ASSERT (!intr_context ());
+      lock_acquire (&q->lock);
+      q->want_room = want;
+      if (intq_room (q) < want)
+        wait (q, &q->not_full);
+      lock_release (&q->lock);
+    }
 }
 
 /* WAITER must be the address of Q's not_empty or not_full
@@ -89,16 +193,17 @@ wait (struct intq *q UNUSED, struct thread **waiter)
   ASSERT (!intr_context ());
   ASSERT (intr_get_level () == INTR_OFF);
   ASSERT ((waiter == &q->not_empty && intq_empty (q))
-          || (waiter == &q->not_full && intq_full (q)));
+          || (waiter == &q->not_full && intq_room (q) < q->want_room));
 
   *waiter = thread_current ();
   thread_block ();
 }
 
 /* WAITER must be the address of Q's not_empty or not_full
-   member, and the associated condition must be true.  If a
-   thread is waiting for the condition, wakes it up and resets
-   the waiting thread. */
+   member.  If a thread is waiting for the condition and it is
+   now true, wakes it up and resets the waiting thread.  A thread
+   waiting for room is woken only once it has as much room as it
+   asked for. */
 static void
 signal (struct intq *q UNUSED, struct thread **waiter) 
 {
@@ -106,7 +211,8 @@ signal (struct intq *q UNUSED, struct thread **waiter)
   ASSERT ((waiter == &q->not_empty && !intq_empty (q))
           || (waiter == &q->not_full && !intq_full (q)));
 
-  if (*waiter != NULL) 
+  if (*waiter != NULL
+      && (waiter == &q->not_empty || intq_room (q) >= q->want_room)) 
     {
       thread_unblock (*waiter);
       *waiter = NULL;
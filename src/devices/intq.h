@@ -1,6 +1,7 @@
 #ifndef DEVICES_INTQ_H
 #define DEVICES_INTQ_H
 
+#include <stddef.h>
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 
@@ -15,9 +16,17 @@
    and condition variables from threads/synch.h cannot be used in
    this case, as they normally would, because they can only
    protect kernel threads from one another, not from interrupt
-   handlers. */
+   handlers.
 
-/* Queue buffer size, in bytes. */
+   Bytes can be moved one at a time with intq_getc() and
+   intq_putc(), or in batches with intq_get_bulk() and
+   intq_put_bulk(), which copy as much as they can at once and
+   wake up the thread waiting on the other side only once per
+   batch.  A thread waiting for room is not woken until a
+   reasonable amount of room is free, rather than after every
+   byte removed. */
+
+/* Default queue buffer size, in bytes. */
 #define INTQ_BUFSIZE 64
 
 /* A circular queue of bytes. */
@@ -27,17 +36,25 @@ struct intq
     struct lock lock;           /* Only one thread may wait at once. */
     struct thread *not_full;    /* Thread waiting for not-full condition. */
     struct thread *not_empty;   /* Thread waiting for not-empty condition. */
+    size_t want_room;           /* Free bytes NOT_FULL is waiting for. */
 
     /* Queue. */
-    uint8_t buf[INTQ_BUFSIZE];  /* Buffer. */
-    int head;                   /* New data is written here. */
-    int tail;                   /* Old data is read here. */
+    uint8_t *buf;               /* Buffer. */
+    size_t size;                /* Buffer size, a power of 2. */
+    size_t head;                /* Total bytes ever written. */
+    size_t tail;                /* Total bytes ever read. */
+    uint8_t default_buf[INTQ_BUFSIZE]; /* Buffer if none is supplied. */
   };
 
 void intq_init (struct intq *);
+void intq_init_buf (struct intq *, uint8_t *buf, size_t size);
 bool intq_empty (const struct intq *);
 bool intq_full (const struct intq *);
+size_t intq_count (const struct intq *);
+size_t intq_room (const struct intq *);
 uint8_t intq_getc (struct intq *);
 void intq_putc (struct intq *, uint8_t);
+size_t intq_get_bulk (struct intq *, uint8_t *, size_t);
+size_t intq_put_bulk (struct intq *, const uint8_t *, size_t);
 
 #endif /* devices/intq.h */
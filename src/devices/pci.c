@@ -0,0 +1,39 @@
+#include "devices/pci.h"
+#include "threads/io.h"
+
+/* PCI configuration space access, by configuration mechanism
+   #1, which covers every PC that Pintos runs on. */
+
+/* Configuration space access ports. */
+#define PCI_CONFIG_ADDR 0xcf8   /* Configuration address port. */
+#define PCI_CONFIG_DATA 0xcfc   /* Configuration data port. */
+
+/* Selects the 32-bit register at byte offset REG of the
+   configuration space of PCI function FN of device DEV on bus
+   BUS. */
+static void
+select_config (int bus, int dev, int fn, int reg)
+{
+  outl (PCI_CONFIG_ADDR, (0x80000000 | (bus << 16) | (dev << 11)
+                          | (fn << 8) | (reg & 0xfc)));
+}
+
+/* Reads the 32-bit register at byte offset REG of the
+   configuration space of PCI function FN of device DEV on bus
+   BUS.  Reads 0xffffffff if there is no such function. */
+uint32_t
+pci_read_config (int bus, int dev, int fn, int reg)
+{
+  select_config (bus, dev, fn, reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit register at byte offset REG of the
+   configuration space of PCI function FN of device DEV on bus
+   BUS. */
+void
+pci_write_config (int bus, int dev, int fn, int reg, uint32_t value)
+{
+  select_config (bus, dev, fn, reg);
+  outl (PCI_CONFIG_DATA, value);
+}
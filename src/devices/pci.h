@@ -0,0 +1,20 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdint.h>
+
+/* PCI configuration space registers, as byte offsets. */
+#define PCI_REG_ID 0x00         /* Vendor and device ID. */
+#define PCI_REG_COMMAND 0x04    /* Command and status. */
+#define PCI_REG_CLASS 0x08      /* Class, subclass, prog. i/f, rev. */
+#define PCI_REG_BAR(N) (0x10 + 4 * (N)) /* Base address register N. */
+#define PCI_REG_INTR 0x3c       /* Interrupt line and pin. */
+
+/* Command register bits. */
+#define PCI_COMMAND_IO 0x0001   /* Enable I/O space. */
+#define PCI_COMMAND_MASTER 0x0004       /* Enable bus mastering. */
+
+uint32_t pci_read_config (int bus, int dev, int fn, int reg);
+void pci_write_config (int bus, int dev, int fn, int reg, uint32_t value);
+
+#endif /* devices/pci.h */
@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -45,11 +42,7 @@
 void
 pit_configure_channel (int channel, int mode, int frequency)
 {
-  uint16_t count;
-  enum intr_level old_level;
-
-  ASSERT (channel == 0 || channel == 2);
-  ASSERT (mode == 2 || mode == 3);
+  unsigned count;
 
   /* Convert FREQUENCY to a PIT counter value.  The PIT has a
      clock that runs at PIT_HZ cycles per second.  We must
@@ -57,10 +50,10 @@ pit_configure_channel (int channel, int mode, int frequency)
   if (frequency < 19)
     {
       /* Frequency is too low: the quotient would overflow the
-         16-bit counter.  Force it to 0, which the PIT treats as
-         65536, the highest possible count.  This yields a 18.2
-         Hz timer, approximately. */
-      count = 0;
+         16-bit counter.  Force it to 65536, the highest
+         possible count.  This yields a 18.2 Hz timer,
+         approximately. */
+      count = 65536;
     }
   else if (frequency > PIT_HZ)
     {
@@ -74,10 +67,46 @@ pit_configure_channel (int channel, int mode, int frequency)
   else
     count = (PIT_HZ + frequency / 2) / frequency;
 
-  /* Configure the PIT mode and load its counters. */
+  pit_set_count (channel, mode, count);
+}
+
+/* Configures CHANNEL in MODE, as for pit_configure_channel(), but
+   with a period of COUNT PIT cycles, which must be between 2 and
+   65536.  The channel starts its first period at once. */
+void
+pit_set_count (int channel, int mode, unsigned count)
+{
+  enum intr_level old_level;
+
+  ASSERT (channel == 0 || channel == 2);
+  ASSERT (mode == 2 || mode == 3);
+  ASSERT (count >= 2 && count <= 65536);
+
+  /* Configure the PIT mode and load its counters.  A count of
+     65536 is written as 0. */
   old_level = intr_disable ();
   outb (PIT_PORT_CONTROL, (channel << 6) | 0x30 | (mode << 1));
   outb (PIT_PORT_COUNTER (channel), count);
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Returns the number of PIT cycles left in the current period of
+   CHANNEL, between 1 and 65536. */
+unsigned
+pit_read_count (int channel)
+{
+  enum intr_level old_level;
+  unsigned count;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  /* Latch the counter, then read it low byte first. */
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, channel << 6);
+  count = inb (PIT_PORT_COUNTER (channel));
+  count |= inb (PIT_PORT_COUNTER (channel)) << 8;
+  intr_set_level (old_level);
+
+  return count != 0 ? count : 65536;
+}
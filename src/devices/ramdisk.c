@@ -0,0 +1,180 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* RAM disks.
+
+   A RAM disk is a block device whose sectors are kept in pages
+   of the user pool, taken when it is created and never given
+   back.  Transfers are plain copies, so a RAM disk can stand in
+   for a disk to tell CPU costs from disk costs, or serve as a
+   fast swap device, scratch device or temporary file system.
+   Its contents do not survive a reboot. */
+
+/* Sectors in a page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Most RAM disks. */
+#define RAMDISK_MAX 4
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    uint8_t **pages;                    /* Pages holding the sectors. */
+    size_t page_cnt;                    /* Number of pages. */
+  };
+
+static struct block_operations ramdisk_operations;
+
+static void create_ramdisk (int nr, enum block_type, size_t kb);
+static uint8_t *sector_addr (struct ramdisk *, block_sector_t);
+
+/* Creates the RAM disks described by SPEC, which may be null, a
+   comma-separated list of TYPE:KB items.  TYPE is the block type
+   of a disk, such as "swap" or "filesys", and KB its size in kB,
+   rounded up to a whole page.  The disks are named ram0, ram1,
+   and so on.  Panics if SPEC is malformed or there is not enough
+   memory for the disks. */
+void
+ramdisk_init (const char *spec)
+{
+  char items[64];
+  char *item, *save_ptr;
+  int nr = 0;
+
+  if (spec == NULL)
+    return;
+  if (strlcpy (items, spec, sizeof items) >= sizeof items)
+    PANIC ("RAM disk list `%s' too long", spec);
+  for (item = strtok_r (items, ",", &save_ptr); item != NULL;
+       item = strtok_r (NULL, ",", &save_ptr))
+    {
+      char *colon = strchr (item, ':');
+      enum block_type type;
+      int kb;
+
+      if (colon == NULL)
+        PANIC ("bad RAM disk `%s' (use TYPE:KB)", item);
+      *colon = '\0';
+      for (type = 0; type < BLOCK_CNT; type++)
+        if (!strcmp (item, block_type_name (type)))
+          break;
+      if (type == BLOCK_CNT || type == BLOCK_KERNEL)
+        PANIC ("bad RAM disk type `%s'", item);
+      kb = atoi (colon + 1);
+      if (kb <= 0)
+        PANIC ("bad RAM disk size `%s'", colon + 1);
+      if (nr >= RAMDISK_MAX)
+        PANIC ("too many RAM disks");
+      create_ramdisk (nr++, type, kb);
+    }
+}
+
+/* Creates RAM disk NR, of the given TYPE and KB kB, and registers
+   it with the block layer. */
+static void
+create_ramdisk (int nr, enum block_type type, size_t kb)
+{
+  struct ramdisk *rd = malloc (sizeof *rd);
+  char name[16];
+  size_t i;
+
+  if (rd == NULL)
+    PANIC ("out of memory for RAM disk");
+  rd->page_cnt = DIV_ROUND_UP (kb * 1024, PGSIZE);
+  rd->pages = malloc (rd->page_cnt * sizeof *rd->pages);
+  if (rd->pages == NULL)
+    PANIC ("out of memory for RAM disk");
+  for (i = 0; i < rd->page_cnt; i++)
+    {
+      rd->pages[i] = palloc_get_page (PAL_USER | PAL_ZERO);
+      if (rd->pages[i] == NULL)
+        PANIC ("out of memory for %zu kB RAM disk", kb);
+    }
+
+  snprintf (name, sizeof name, "ram%d", nr);
+  block_register (name, type, "RAM disk", rd->page_cnt * SECTORS_PER_PAGE,
+                  &ramdisk_operations, rd);
+}
+
+/* Returns the address of SECTOR within RD. */
+static uint8_t *
+sector_addr (struct ramdisk *rd, block_sector_t sector)
+{
+  return (rd->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads CNT sectors starting at SECTOR of RAM disk RD_ into
+   BUFFER. */
+static void
+ramdisk_read_multi (void *rd_, block_sector_t sector, size_t cnt,
+                    void *buffer_)
+{
+  struct ramdisk *rd = rd_;
+  uint8_t *buffer = buffer_;
+
+  /* A run stops at the end of a page. */
+  while (cnt > 0)
+    {
+      size_t run = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+
+      if (run > cnt)
+        run = cnt;
+      memcpy (buffer, sector_addr (rd, sector), run * BLOCK_SECTOR_SIZE);
+      buffer += run * BLOCK_SECTOR_SIZE;
+      sector += run;
+      cnt -= run;
+    }
+}
+
+/* Writes CNT sectors starting at SECTOR of RAM disk RD_ from
+   BUFFER. */
+static void
+ramdisk_write_multi (void *rd_, block_sector_t sector, size_t cnt,
+                     const void *buffer_)
+{
+  struct ramdisk *rd = rd_;
+  const uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      size_t run = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+
+      if (run > cnt)
+        run = cnt;
+      memcpy (sector_addr (rd, sector), buffer, run * BLOCK_SECTOR_SIZE);
+      buffer += run * BLOCK_SECTOR_SIZE;
+      sector += run;
+      cnt -= run;
+    }
+}
+
+/* Reads sector SECTOR of RAM disk RD into BUFFER. */
+static void
+ramdisk_read (void *rd, block_sector_t sector, void *buffer)
+{
+  ramdisk_read_multi (rd, sector, 1, buffer);
+}
+
+/* Writes sector SECTOR of RAM disk RD from BUFFER. */
+static void
+ramdisk_write (void *rd, block_sector_t sector, const void *buffer)
+{
+  ramdisk_write_multi (rd, sector, 1, buffer);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multi,
+    ramdisk_write_multi
+  };
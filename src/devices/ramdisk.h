@@ -0,0 +1,6 @@
+#ifndef DEVICES_RAMDISK_H
+#define DEVICES_RAMDISK_H
+
+void ramdisk_init (const char *spec);
+
+#endif /* devices/ramdisk.h */
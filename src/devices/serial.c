@@ -37,6 +37,22 @@
 #define IER_RECV 0x01           /* Interrupt when data received. */
 #define IER_XMIT 0x02           /* Interrupt when transmit finishes. */
 
+/* FIFO Control Register bits. */
+#define FCR_ENABLE 0x01         /* Enable the 16-byte FIFOs. */
+#define FCR_CLEAR 0x06          /* Clear both FIFOs. */
+#define FCR_TRIGGER_8 0x80      /* Receive interrupt at 8 bytes. */
+
+/* Speed of the serial port, in bits per second. */
+#define SERIAL_BPS 115200
+
+/* Bytes the transmit FIFO holds.  When THR Empty is set in FIFO
+   mode, this many bytes may be written without checking again. */
+#define TX_FIFO_SIZE 16
+
+/* Bytes that putc_poll() knows it may still write into the
+   transmit FIFO without checking the Line Status Register. */
+static int tx_fifo_room;
+
 /* Line Control Register bits. */
 #define LCR_N81 0x03            /* No parity, 8 data bits, 1 stop bit. */
 #define LCR_DLAB 0x80           /* Divisor Latch Access Bit (DLAB). */
@@ -52,7 +68,9 @@
 static enum { UNINIT, POLL, QUEUE } mode;
 
 /* Data to be transmitted. */
+#define TXQ_BUFSIZE 512
 static struct intq txq;
+static uint8_t txq_data[TXQ_BUFSIZE];
 
 static void set_serial (int bps);
 static void putc_poll (uint8_t);
@@ -68,10 +86,10 @@ init_poll (void)
 {
   ASSERT (mode == UNINIT);
   outb (IER_REG, 0);                    /* Turn off all interrupts. */
-  outb (FCR_REG, 0);                    /* Disable FIFO. */
-  set_serial (9600);                    /* 9.6 kbps, N-8-1. */
+  outb (FCR_REG, FCR_ENABLE | FCR_CLEAR | FCR_TRIGGER_8);
+  set_serial (SERIAL_BPS);              /* N-8-1. */
   outb (MCR_REG, MCR_OUT2);             /* Required to enable interrupts. */
-  intq_init (&txq);
+  intq_init_buf (&txq, txq_data, sizeof txq_data);
   mode = POLL;
 } 
 
@@ -129,6 +147,47 @@ serial_putc (uint8_t byte)
   intr_set_level (old_level);
 }
 
+/* Sends the N bytes in BUFFER to the serial port.  Like
+   serial_putc(), but the bytes are queued in batches with
+   interrupts disabled once, and the interrupt enable register is
+   only updated when the queue fills up and at the end. */
+void
+serial_putbuf (const uint8_t *buffer, size_t n) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (mode != QUEUE)
+    {
+      if (mode == UNINIT)
+        init_poll ();
+      while (n-- > 0)
+        putc_poll (*buffer++);
+    }
+  else 
+    {
+      while (n > 0)
+        {
+          size_t cnt;
+
+          if (intq_full (&txq))
+            {
+              /* Let the transmit interrupt drain the queue while
+                 intq_put_bulk() waits, or, with interrupts off,
+                 make room by polling as serial_putc() does. */
+              write_ier ();
+              if (old_level == INTR_OFF)
+                putc_poll (intq_getc (&txq));
+            }
+          cnt = intq_put_bulk (&txq, buffer, n);
+          buffer += cnt;
+          n -= cnt;
+        }
+      write_ier ();
+    }
+
+  intr_set_level (old_level);
+}
+
 /* Flushes anything in the serial buffer out the port in polling
    mode. */
 void
@@ -194,34 +253,56 @@ write_ier (void)
 }
 
 /* Polls the serial port until it's ready,
-   and then transmits BYTE. */
+   and then transmits BYTE.  Each time the transmit FIFO is found
+   empty, the next TX_FIFO_SIZE bytes are written without
+   polling. */
 static void
 putc_poll (uint8_t byte) 
 {
   ASSERT (intr_get_level () == INTR_OFF);
 
-  while ((inb (LSR_REG) & LSR_THRE) == 0)
-    continue;
+  if (tx_fifo_room == 0)
+    {
+      while ((inb (LSR_REG) & LSR_THRE) == 0)
+        continue;
+      tx_fifo_room = TX_FIFO_SIZE;
+    }
   outb (THR_REG, byte);
+  tx_fifo_room--;
 }
 
 /* Serial interrupt handler. */
 static void
 serial_interrupt (struct intr_frame *f UNUSED) 
 {
+  uint8_t bytes[TX_FIFO_SIZE];
+  size_t room, cnt, i;
+
   /* Inquire about interrupt in UART.  Without this, we can
      occasionally miss an interrupt running under QEMU. */
   inb (IIR_REG);
 
   /* As long as we have room to receive a byte, and the hardware
-     has a byte for us, receive a byte.  */
-  while (!input_full () && (inb (LSR_REG) & LSR_DR) != 0)
-    input_putc (inb (RBR_REG));
-
-  /* As long as we have a byte to transmit, and the hardware is
-     ready to accept a byte for transmission, transmit a byte. */
-  while (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0) 
-    outb (THR_REG, intq_getc (&txq));
+     has a byte for us, receive a byte.  The receive interrupt
+     comes when 8 bytes are waiting, or once the line has been
+     idle for a few character times with fewer, so this usually
+     takes several.  They are added to the input buffer
+     together. */
+  room = input_room ();
+  for (cnt = 0; cnt < room && cnt < sizeof bytes
+         && (inb (LSR_REG) & LSR_DR) != 0; cnt++)
+    bytes[cnt] = inb (RBR_REG);
+  input_putbuf (bytes, cnt);
+
+  /* If we have bytes to transmit and the transmit FIFO is empty,
+     refill it from the queue. */
+  if (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0) 
+    {
+      cnt = intq_get_bulk (&txq, bytes, sizeof bytes);
+      for (i = 0; i < cnt; i++)
+        outb (THR_REG, bytes[i]);
+      tx_fifo_room = TX_FIFO_SIZE - cnt;
+    }
 
   /* Update interrupt enable register based on queue status. */
   write_ier ();
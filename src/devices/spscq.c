@@ -0,0 +1,161 @@
+#include "devices/spscq.h"
+#include <debug.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static void copy_slots (struct spscq *, size_t idx, uint8_t *, size_t cnt,
+                        bool in);
+
+/* Initializes Q to hold up to CNT elements of ELEM_SIZE bytes
+   each in BUF, which must stay valid as long as Q is in use.
+   CNT must be a power of 2. */
+void
+spscq_init (struct spscq *q, void *buf, size_t elem_size, size_t cnt)
+{
+  ASSERT (buf != NULL);
+  ASSERT (elem_size > 0);
+  ASSERT (cnt > 0 && (cnt & (cnt - 1)) == 0);
+
+  q->buf = buf;
+  q->elem_size = elem_size;
+  q->size = cnt;
+  q->head = q->tail = 0;
+  q->waiter = NULL;
+}
+
+/* Returns true if Q is empty, false otherwise.  Only the
+   consumer can rely on the answer staying true. */
+bool
+spscq_empty (const struct spscq *q)
+{
+  return q->head == q->tail;
+}
+
+/* Returns true if Q is full, false otherwise.  Only the
+   producer can rely on the answer staying true. */
+bool
+spscq_full (const struct spscq *q)
+{
+  return q->head - q->tail == q->size;
+}
+
+/* Returns the number of elements in Q.  For the consumer, this
+   many can be popped. */
+size_t
+spscq_count (const struct spscq *q)
+{
+  return q->head - q->tail;
+}
+
+/* Returns the number of elements that can be added to Q before
+   it is full.  For the producer, this many can be pushed. */
+size_t
+spscq_room (const struct spscq *q)
+{
+  return q->size - (q->head - q->tail);
+}
+
+/* Adds as many of the CNT elements in ELEMS to Q as there is
+   room for, and returns the number added.  Wakes the consumer if
+   it is waiting.  Never sleeps, so it may be called from an
+   interrupt handler.  Must be called only by Q's producer. */
+size_t
+spscq_push (struct spscq *q, const void *elems, size_t cnt)
+{
+  size_t head = q->head;
+
+  if (cnt > q->size - (head - q->tail))
+    cnt = q->size - (head - q->tail);
+  if (cnt == 0)
+    return 0;
+
+  /* The slots must be filled before the consumer sees them, and
+     the waiter checked only after, or a consumer going to sleep
+     between the two could miss its wake-up. */
+  copy_slots (q, head, (uint8_t *) elems, cnt, true);
+  barrier ();
+  q->head = head + cnt;
+  barrier ();
+
+  if (q->waiter != NULL)
+    {
+      enum intr_level old_level = intr_disable ();
+      struct thread *t = q->waiter;
+
+      q->waiter = NULL;
+      if (t != NULL)
+        thread_unblock (t);
+      intr_set_level (old_level);
+    }
+  return cnt;
+}
+
+/* Removes up to CNT elements from Q into ELEMS, oldest first,
+   and returns the number removed, which is 0 if Q is empty.
+   Never sleeps.  Must be called only by Q's consumer. */
+size_t
+spscq_pop (struct spscq *q, void *elems, size_t cnt)
+{
+  size_t tail = q->tail;
+
+  if (cnt > q->head - tail)
+    cnt = q->head - tail;
+  if (cnt == 0)
+    return 0;
+
+  /* The slots must be read before the producer may refill
+     them. */
+  barrier ();
+  copy_slots (q, tail, elems, cnt, false);
+  barrier ();
+  q->tail = tail + cnt;
+  return cnt;
+}
+
+/* Sleeps until Q is not empty.  Must be called only by Q's
+   consumer, from a kernel thread.  Interrupts are turned off
+   only while checking one last time and going to sleep, so a
+   push from an interrupt handler cannot slip in between. */
+void
+spscq_wait (struct spscq *q)
+{
+  ASSERT (!intr_context ());
+
+  while (spscq_empty (q))
+    {
+      enum intr_level old_level = intr_disable ();
+
+      if (spscq_empty (q))
+        {
+          ASSERT (q->waiter == NULL);
+          q->waiter = thread_current ();
+          thread_block ();
+        }
+      intr_set_level (old_level);
+    }
+}
+
+/* Copies CNT elements between BUF and the slots of Q starting
+   at index IDX, which wraps, into the slots if IN is true and
+   out of them otherwise. */
+static void
+copy_slots (struct spscq *q, size_t idx, uint8_t *buf, size_t cnt, bool in)
+{
+  while (cnt > 0)
+    {
+      size_t ofs = idx & (q->size - 1);
+      size_t chunk = q->size - ofs < cnt ? q->size - ofs : cnt;
+      uint8_t *slot = q->buf + ofs * q->elem_size;
+      size_t bytes = chunk * q->elem_size;
+
+      if (in)
+        memcpy (slot, buf, bytes);
+      else
+        memcpy (buf, slot, bytes);
+      buf += bytes;
+      idx += chunk;
+      cnt -= chunk;
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef DEVICES_SPSCQ_H
+#define DEVICES_SPSCQ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A single-producer, single-consumer queue, a circular buffer of
+   fixed-size elements that passes completions or data from an
+   external interrupt handler to a kernel thread, or from one
+   thread to another, without locking.
+
+   Unlike an interrupt queue (devices/intq.h), neither side has
+   to turn interrupts off.  Only the producer ever writes HEAD
+   and only the consumer ever writes TAIL, and each fills or
+   empties a slot before moving its index past it, so the two
+   sides never touch the same slot at once.  The producer may be
+   an interrupt handler, and the consumer may be interrupted by
+   it anywhere, but there must be only one of each at a time: a
+   queue fed by several interrupt handlers relies on them not
+   nesting, and threads that share the consuming side must
+   serialize themselves, for example with a lock.
+
+   spscq_push() and spscq_pop() never sleep and move as many
+   elements as they can.  A consumer thread that finds the queue
+   empty may sleep in spscq_wait(), which turns interrupts off
+   only to block; the next push wakes it.  The producer cannot
+   wait for room. */
+
+/* A single-producer, single-consumer queue. */
+struct spscq
+  {
+    uint8_t *buf;               /* Buffer of SIZE elements. */
+    size_t elem_size;           /* Bytes in an element. */
+    size_t size;                /* Capacity in elements, a power of 2. */
+    volatile size_t head;       /* Elements ever pushed. */
+    volatile size_t tail;       /* Elements ever popped. */
+    struct thread *volatile waiter; /* Consumer sleeping for data. */
+  };
+
+void spscq_init (struct spscq *, void *buf, size_t elem_size, size_t cnt);
+bool spscq_empty (const struct spscq *);
+bool spscq_full (const struct spscq *);
+size_t spscq_count (const struct spscq *);
+size_t spscq_room (const struct spscq *);
+size_t spscq_push (struct spscq *, const void *, size_t cnt);
+size_t spscq_pop (struct spscq *, void *, size_t cnt);
+void spscq_wait (struct spscq *);
+
+#endif /* devices/spscq.h */
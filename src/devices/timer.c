@@ -4,7 +4,9 @@
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
+#include "threads/alarm.h"
 #include "threads/interrupt.h"
+#include "threads/profile.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
   
@@ -24,18 +26,62 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Time-stamp counter frequency in Hz, or 0 until measured by
+   timer_calibrate(), and the counter's value at timer_init().
+   The TSC counts CPU cycles, so it gives timestamps far finer
+   than a timer tick at the cost of one instruction. */
+#define TSC_CALIBRATE_TICKS 5
+static uint64_t tsc_hz;
+static uint64_t tsc_base;
+
+/* The timing wheel.  Level 0 has a slot for each of the next
+   WHEEL_SIZE ticks, and each slot of level L covers WHEEL_SIZE
+   slots of level L - 1.  When the lower levels wrap around, the
+   events of the next slot of the level above are "cascaded" down
+   to where they now belong.  Events further away than the whole
+   wheel covers wait in its last slot and are cascaded again.
+   Protected by disabling interrupts. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+static struct list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+/* Tickless idle.  While only the idle thread can run, the PIT is
+   reprogrammed to interrupt at the next tick that has work to
+   do, and that interrupt catches up on the ticks skipped.  The
+   PIT's 16-bit counter limits this to IDLE_SKIP_MAX ticks at a
+   time.  SKIP_TICKS is the number of ticks the next timer
+   interrupt accounts for, or 0 if the timer is periodic.
+   Protected by disabling interrupts. */
+#define TICK_CYCLES ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+#define IDLE_SKIP_MAX (65536 / TICK_CYCLES)
+static int skip_ticks;
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static void wheel_insert (struct timer_event *);
+static void wheel_cascade (int level);
+static void wheel_run (void);
+static int wheel_next (int max);
+static void calibrate_tsc (void);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void) 
 {
-  pit_configure_channel (0, 2, TIMER_FREQ);
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SIZE; slot++)
+      list_init (&wheel[level][slot]);
+
+  tsc_base = timer_cycles ();
+  pit_set_count (0, 2, TICK_CYCLES);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
@@ -64,6 +110,61 @@ timer_calibrate (void)
       loops_per_tick |= test_bit;
 
   printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+  calibrate_tsc ();
+}
+
+/* Measures the frequency of the time-stamp counter against the
+   timer. */
+static void
+calibrate_tsc (void)
+{
+  int64_t start;
+  uint64_t tsc_start;
+
+  /* Count cycles over whole ticks, starting just after one. */
+  start = ticks;
+  while (ticks == start)
+    barrier ();
+  start = ticks;
+  tsc_start = timer_cycles ();
+  while (ticks < start + TSC_CALIBRATE_TICKS)
+    barrier ();
+  tsc_hz = (timer_cycles () - tsc_start) * TIMER_FREQ / TSC_CALIBRATE_TICKS;
+  printf ("Time-stamp counter: %'"PRIu64" Hz.\n", tsc_hz);
+}
+
+/* Returns the CPU's time-stamp counter, which counts CPU cycles.
+   It is not synchronized with timer_ticks() and, until
+   timer_calibrate() has run, its rate is unknown. */
+uint64_t
+timer_cycles (void) 
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Converts CYCLES time-stamp counter cycles into nanoseconds.
+   Returns 0 before timer_calibrate() has run. */
+uint64_t
+timer_cycles_to_ns (uint64_t cycles) 
+{
+  if (tsc_hz == 0)
+    return 0;
+
+  /* Split the conversion so that CYCLES * 1e9 cannot overflow. */
+  return (cycles / tsc_hz * 1000000000
+          + cycles % tsc_hz * 1000000000 / tsc_hz);
+}
+
+/* Returns the number of nanoseconds since the timer was
+   initialized, measured with the time-stamp counter.
+   Returns 0 before timer_calibrate() has run. */
+uint64_t
+timer_ns (void) 
+{
+  return timer_cycles_to_ns (timer_cycles () - tsc_base);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -89,11 +190,8 @@ timer_elapsed (int64_t then)
 void
 timer_sleep (int64_t ticks) 
 {
-  int64_t start = timer_ticks ();
-
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks) 
-    thread_yield ();
+  set_alarm (ticks);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -166,12 +264,212 @@ timer_print_stats (void)
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
-/* Timer interrupt handler. */
+/* Called by the idle thread, with interrupts off, just before it
+   halts the CPU.  Stops the timer interrupting until the next
+   tick at which a timer event expires, if that is more than one
+   tick away. */
+void
+timer_idle_enter (void)
+{
+  int n;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (skip_ticks != 0)
+    return;
+  n = wheel_next (IDLE_SKIP_MAX);
+  if (n > 1)
+    {
+      /* Keep the phase of the periodic tick: the first tick's
+         period has already partly elapsed. */
+      pit_set_count (0, 2, pit_read_count (0) + (n - 1) * TICK_CYCLES);
+      skip_ticks = n;
+    }
+}
+
+/* Called with interrupts off when the idle thread stops running.
+   If the timer was stopped by timer_idle_enter(), makes it
+   interrupt again at the next tick boundary, which accounts for
+   all the ticks elapsed since.  A timer interrupt that is already
+   pending accounts for all the skipped ticks itself. */
+void
+timer_idle_exit (void)
+{
+  unsigned left;
+  int later;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (skip_ticks == 0 || intr_is_pending (0x20))
+    return;
+
+  /* The skipped ticks end every TICK_CYCLES cycles back from the
+     end of the current period.  LATER of them are still to come
+     after the next. */
+  left = pit_read_count (0);
+  later = (left - 1) / TICK_CYCLES;
+  if (later > 0)
+    {
+      left -= later * TICK_CYCLES;
+      pit_set_count (0, 2, left >= 2 ? left : 2);
+      skip_ticks -= later;
+    }
+}
+
+/* Timer interrupt handler.  After the timer was stopped in the
+   idle thread, accounts for each tick skipped, all but the last
+   of which passed in the idle thread. */
+static void
+timer_interrupt (struct intr_frame *args)
+{
+  int n = 1;
+
+  if (skip_ticks != 0)
+    {
+      n = skip_ticks;
+      skip_ticks = 0;
+      pit_set_count (0, 2, TICK_CYCLES);
+    }
+  if (profile_enabled)
+    profile_sample (args, n);
+  while (n-- > 0)
+    {
+      ticks++;
+      wheel_run ();
+      thread_tick (n > 0);
+    }
+}
+
+/* Initializes timer event EV to call FUNC with AUX when it
+   expires.  EV is not pending. */
+void
+timer_event_init (struct timer_event *ev, timer_event_func *func, void *aux)
+{
+  ASSERT (ev != NULL && func != NULL);
+
+  ev->pending = false;
+  ev->func = func;
+  ev->aux = aux;
+}
+
+/* Makes EV expire TICKS timer ticks from now, at the earliest on
+   the next tick, replacing any earlier expiry.  Its function is
+   called by the timer interrupt handler, with interrupts off, and
+   must not sleep.  It may add EV again. */
+void
+timer_event_add (struct timer_event *ev, int64_t t)
+{
+  enum intr_level old_level = intr_disable ();
+
+  timer_idle_exit ();
+  if (ev->pending)
+    list_remove (&ev->elem);
+  ev->expires = ticks + (t > 0 ? t : 1);
+  ev->pending = true;
+  wheel_insert (ev);
+  intr_set_level (old_level);
+}
+
+/* Stops pending timer event EV from expiring.  Returns true if
+   it was pending, false if it had already expired or was never
+   added. */
+bool
+timer_event_cancel (struct timer_event *ev)
+{
+  enum intr_level old_level = intr_disable ();
+  bool pending = ev->pending;
+
+  if (pending)
+    {
+      list_remove (&ev->elem);
+      ev->pending = false;
+    }
+  intr_set_level (old_level);
+  return pending;
+}
+
+/* Puts pending event EV into the wheel slot for its expiry, which
+   is not in the past. */
+static void
+wheel_insert (struct timer_event *ev)
+{
+  int64_t delta = ev->expires - ticks;
+  int64_t expires = ev->expires;
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (delta >= 0);
+
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+      break;
+  if (delta >= (int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+    expires = ticks + ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+  list_push_back (&wheel[level][(expires >> (WHEEL_BITS * level))
+                                & WHEEL_MASK],
+                  &ev->elem);
+}
+
+/* Moves the events in the current slot of LEVEL down to the
+   levels below. */
+static void
+wheel_cascade (int level)
+{
+  struct list *slot = &wheel[level][(ticks >> (WHEEL_BITS * level))
+                                    & WHEEL_MASK];
+  struct list events;
+
+  list_init (&events);
+  while (!list_empty (slot))
+    list_push_back (&events, list_pop_front (slot));
+  while (!list_empty (&events))
+    wheel_insert (list_entry (list_pop_front (&events),
+                              struct timer_event, elem));
+}
+
+/* Runs the timer events that expire at the current tick, after
+   cascading the levels that have wrapped around. */
 static void
-timer_interrupt (struct intr_frame *args UNUSED)
+wheel_run (void)
+{
+  struct list *slot = &wheel[0][ticks & WHEEL_MASK];
+  int level;
+
+  for (level = 1; level < WHEEL_LEVELS; level++)
+    {
+      if (((ticks >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK) != 0)
+        break;
+      wheel_cascade (level);
+    }
+
+  while (!list_empty (slot))
+    {
+      struct timer_event *ev = list_entry (list_pop_front (slot),
+                                           struct timer_event, elem);
+
+      ev->pending = false;
+      ev->func (ev->aux);
+    }
+}
+
+/* Returns the number of ticks, between 1 and MAX, until the next
+   tick that runs an event or cascades the wheel, or MAX if there
+   is none that soon. */
+static int
+wheel_next (int max)
 {
-  ticks++;
-  thread_tick ();
+  int i;
+
+  ASSERT (max < WHEEL_SIZE);
+  for (i = 1; i < max; i++)
+    {
+      int64_t t = ticks + i;
+
+      if ((t & WHEEL_MASK) == 0 || !list_empty (&wheel[0][t & WHEEL_MASK]))
+        break;
+    }
+  return i;
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -235,12 +533,24 @@ real_time_sleep (int64_t num, int32_t denom)
     }
 }
 
-/* Busy-wait for approximately NUM/DENOM seconds. */
+/* Busy-wait for approximately NUM/DENOM seconds.  Once the
+   time-stamp counter has been calibrated, waits until it has
+   counted the right number of cycles; before that, runs the
+   calibrated busy loop. */
 static void
 real_time_delay (int64_t num, int32_t denom)
 {
   /* Scale the numerator and denominator down by 1000 to avoid
      the possibility of overflow. */
   ASSERT (denom % 1000 == 0);
-  busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000)); 
+  if (tsc_hz != 0)
+    {
+      uint64_t start = timer_cycles ();
+      uint64_t cycles = tsc_hz / 1000 * num / (denom / 1000);
+
+      while (timer_cycles () - start < cycles)
+        barrier ();
+    }
+  else
+    busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000)); 
 }
@@ -1,18 +1,42 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+/* Function run by a timer event when it expires, in the timer
+   interrupt handler. */
+typedef void timer_event_func (void *aux);
+
+/* A timer event: a callback to run at a given tick.  Events are
+   kept in a hierarchical timing wheel, so that adding,
+   cancelling and expiring one take constant time however many
+   are pending. */
+struct timer_event
+  {
+    struct list_elem elem;      /* Element in a wheel slot. */
+    int64_t expires;            /* Tick at which to run FUNC. */
+    bool pending;               /* In the wheel? */
+    timer_event_func *func;     /* Callback. */
+    void *aux;                  /* Argument for FUNC. */
+  };
+
 void timer_init (void);
 void timer_calibrate (void);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
 
+/* Fine-grained time from the CPU's time-stamp counter. */
+uint64_t timer_cycles (void);
+uint64_t timer_cycles_to_ns (uint64_t cycles);
+uint64_t timer_ns (void);
+
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
 void timer_msleep (int64_t milliseconds);
@@ -26,4 +50,13 @@ void timer_ndelay (int64_t nanoseconds);
 
 void timer_print_stats (void);
 
+/* Tickless idle. */
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
+/* Timer events. */
+void timer_event_init (struct timer_event *, timer_event_func *, void *aux);
+void timer_event_add (struct timer_event *, int64_t ticks);
+bool timer_event_cancel (struct timer_event *);
+
 #endif /* devices/timer.h */
@@ -14,19 +14,35 @@
 #define COL_CNT 80
 #define ROW_CNT 25
 
+/* Number of rows of text that fit in the 32 kB of video memory
+   at 0xb8000. */
+#define FB_ROW_CNT (0x8000 / (COL_CNT * 2))
+
 /* Current cursor position.  (0,0) is in the upper left corner of
    the display. */
 static size_t cx, cy;
 
+/* Row of video memory shown at the top of the display, and the
+   value last written to the CRTC start address registers.
+
+   Scrolling moves TOP down a row instead of moving the whole
+   screen, and the display is pointed at the new TOP when the
+   cursor is next moved, so any number of newlines in one
+   vga_putbuf() cost one register update.  Only when TOP reaches
+   the end of video memory is the screen copied back to row 0,
+   once every FB_ROW_CNT - ROW_CNT lines. */
+static size_t top, shown_top;
+
 /* Attribute value for gray text on a black background. */
 #define GRAY_ON_BLACK 0x07
 
 /* Framebuffer.  See [FREEVGA] under "VGA Text Mode Operation".
-   The character at (x,y) is fb[y][x][0].
-   The attribute at (x,y) is fb[y][x][1]. */
+   The character at (x,y) is fb[top + y][x][0].
+   The attribute at (x,y) is fb[top + y][x][1]. */
 static uint8_t (*fb)[COL_CNT][2];
 
-static void clear_row (size_t y);
+static void putc_no_cursor (int c, enum intr_level *old_level);
+static void clear_row (size_t row);
 static void cls (void);
 static void newline (void);
 static void move_cursor (void);
@@ -56,7 +72,34 @@ vga_putc (int c)
   enum intr_level old_level = intr_disable ();
 
   init ();
-  
+  putc_no_cursor (c, &old_level);
+  move_cursor ();
+
+  intr_set_level (old_level);
+}
+
+/* Writes the N characters in BUFFER to the VGA text display like
+   vga_putc(), but with interrupts disabled once and the hardware
+   cursor moved only at the end. */
+void
+vga_putbuf (const char *buffer, size_t n)
+{
+  enum intr_level old_level = intr_disable ();
+
+  init ();
+  while (n-- > 0)
+    putc_no_cursor (*buffer++, &old_level);
+  move_cursor ();
+
+  intr_set_level (old_level);
+}
+
+/* Writes C to the framebuffer without moving the hardware
+   cursor.  Interrupts must be off; *OLD_LEVEL is the level to
+   restore while beeping. */
+static void
+putc_no_cursor (int c, enum intr_level *old_level)
+{
   switch (c) 
     {
     case '\n':
@@ -83,31 +126,27 @@ vga_putc (int c)
       break;
 
     case '\a':
-      intr_set_level (old_level);
+      intr_set_level (*old_level);
       speaker_beep ();
       intr_disable ();
       break;
       
     default:
-      fb[cy][cx][0] = c;
-      fb[cy][cx][1] = GRAY_ON_BLACK;
+      fb[top + cy][cx][0] = c;
+      fb[top + cy][cx][1] = GRAY_ON_BLACK;
       if (++cx >= COL_CNT)
         newline ();
       break;
     }
-
-  /* Update cursor position. */
-  move_cursor ();
-
-  intr_set_level (old_level);
 }
-
+
 /* Clears the screen and moves the cursor to the upper left. */
 static void
 cls (void)
 {
   size_t y;
 
+  top = 0;
   for (y = 0; y < ROW_CNT; y++)
     clear_row (y);
 
@@ -115,16 +154,16 @@ cls (void)
   move_cursor ();
 }
 
-/* Clears row Y to spaces. */
+/* Clears ROW of video memory to spaces. */
 static void
-clear_row (size_t y) 
+clear_row (size_t row) 
 {
   size_t x;
 
   for (x = 0; x < COL_CNT; x++)
     {
-      fb[y][x][0] = ' ';
-      fb[y][x][1] = GRAY_ON_BLACK;
+      fb[row][x][0] = ' ';
+      fb[row][x][1] = GRAY_ON_BLACK;
     }
 }
 
@@ -139,17 +178,33 @@ newline (void)
   if (cy >= ROW_CNT)
     {
       cy = ROW_CNT - 1;
-      memmove (&fb[0], &fb[1], sizeof fb[0] * (ROW_CNT - 1));
-      clear_row (ROW_CNT - 1);
+      if (top + ROW_CNT < FB_ROW_CNT)
+        top++;
+      else
+        {
+          memcpy (&fb[0], &fb[top + 1], sizeof fb[0] * (ROW_CNT - 1));
+          top = 0;
+        }
+      clear_row (top + cy);
     }
 }
 
-/* Moves the hardware cursor to (cx,cy). */
+/* Moves the hardware cursor to (cx,cy), first pointing the
+   display at TOP if the screen has scrolled. */
 static void
 move_cursor (void) 
 {
-  /* See [FREEVGA] under "Manipulating the Text-mode Cursor". */
-  uint16_t cp = cx + COL_CNT * cy;
+  /* See [FREEVGA] under "Manipulating the Text-mode Cursor" and
+     under "CRTC Registers" for the start address. */
+  uint16_t cp = cx + COL_CNT * (top + cy);
+
+  if (top != shown_top)
+    {
+      uint16_t start = COL_CNT * top;
+      outw (0x3d4, 0x0c | (start & 0xff00));
+      outw (0x3d4, 0x0d | (start << 8));
+      shown_top = top;
+    }
   outw (0x3d4, 0x0e | (cp & 0xff00));
   outw (0x3d4, 0x0f | (cp << 8));
 }
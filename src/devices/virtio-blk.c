@@ -0,0 +1,473 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The code in this file drives virtio block devices, the
+   paravirtual disks of QEMU and other hypervisors, through the
+   "legacy" PCI interface of [VIRTIO-0.9.5].  Where an IDE
+   transfer costs the hypervisor a trap for each port access, a
+   virtio request is a chain of descriptors in memory that the
+   device picks up on a single notification, moving any number of
+   sectors, and it reports completion by interrupt.  Several
+   requests may be outstanding on a disk at once. */
+
+/* PCI identification of a virtio block device. */
+#define PCI_VENDOR_VIRTIO 0x1af4        /* Red Hat, Inc. */
+#define PCI_DEVICE_VIRTIO_BLK 0x1001    /* Block device, legacy i/f. */
+
+/* Legacy virtio registers, relative to the I/O base in BAR 0. */
+#define reg_features(D) ((D)->io_base + 0x00)   /* Device features. */
+#define reg_guest_features(D) ((D)->io_base + 0x04) /* Accepted. */
+#define reg_queue_pfn(D) ((D)->io_base + 0x08)  /* Queue page number. */
+#define reg_queue_size(D) ((D)->io_base + 0x0c) /* Queue entries. */
+#define reg_queue_select(D) ((D)->io_base + 0x0e) /* Queue select. */
+#define reg_queue_notify(D) ((D)->io_base + 0x10) /* Queue notify. */
+#define reg_status(D) ((D)->io_base + 0x12)     /* Device status. */
+#define reg_isr(D) ((D)->io_base + 0x13)        /* ISR status. */
+#define reg_capacity(D) ((D)->io_base + 0x14)   /* Sectors, 64 bits. */
+
+/* Device Status Register bits. */
+#define STATUS_ACKNOWLEDGE 0x01 /* Guest has noticed the device. */
+#define STATUS_DRIVER 0x02      /* Guest knows how to drive it. */
+#define STATUS_DRIVER_OK 0x04   /* Driver is ready. */
+#define STATUS_FAILED 0x80      /* Driver gave up on the device. */
+
+/* ISR Status Register bits.  Reading the register clears it. */
+#define ISR_QUEUE 0x01          /* A used ring was updated. */
+
+/* A virtqueue's rings start on page boundaries, in guest pages
+   of this size. */
+#define VRING_ALIGN 4096
+
+/* A descriptor: one physically contiguous piece of a request. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address. */
+    uint32_t len;               /* Length in bytes. */
+    uint16_t flags;             /* VRING_DESC_F_* bits. */
+    uint16_t next;              /* Next descriptor if F_NEXT. */
+  };
+#define VRING_DESC_F_NEXT 0x01  /* Chain continues at NEXT. */
+#define VRING_DESC_F_WRITE 0x02 /* Device writes, rather than reads. */
+
+/* Ring of descriptor chains offered to the device. */
+struct vring_avail
+  {
+    uint16_t flags;             /* Unused. */
+    uint16_t idx;               /* Where the next entry goes. */
+    uint16_t ring[];            /* Heads of descriptor chains. */
+  };
+
+/* Ring of descriptor chains the device is done with. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head of the descriptor chain. */
+    uint32_t len;               /* Bytes written into it. */
+  };
+struct vring_used
+  {
+    uint16_t flags;             /* Unused. */
+    uint16_t idx;               /* Where the next entry goes. */
+    struct vring_used_elem ring[];
+  };
+
+/* Header of a block request, the first descriptor of its
+   chain. */
+struct virtio_blk_header
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;          /* Must be zero. */
+    uint64_t sector;            /* First sector. */
+  };
+#define VIRTIO_BLK_T_IN 0       /* Read from the disk. */
+#define VIRTIO_BLK_T_OUT 1      /* Write to the disk. */
+#define VIRTIO_BLK_S_OK 0       /* Status: success. */
+
+/* Each request is a chain of a header, the data, and a status
+   byte. */
+#define REQ_DESC_CNT 3
+
+/* Largest number of sectors moved by one request. */
+#define VIRTIO_MAX_SECTORS 256
+
+/* Most virtio disks we drive. */
+#define DISK_MAX 4
+
+/* Block layer channel number of the first virtio disk, after the
+   two IDE channels.  Each disk has its own, because virtio disks
+   transfer independently of one another. */
+#define CHANNEL_BASE 2
+
+/* A request in progress.  Lives on its caller's stack, which the
+   device reads and writes directly. */
+struct request
+  {
+    struct virtio_blk_header header;    /* Read by device. */
+    volatile uint8_t status;    /* Written by device. */
+    struct semaphore done;      /* Up'd by interrupt handler. */
+  };
+
+/* A virtio disk. */
+struct virtio_disk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    uint16_t io_base;           /* Base I/O port. */
+    uint8_t irq;                /* Interrupt in use. */
+
+    /* The request queue, in physically contiguous pages. */
+    uint16_t queue_size;        /* Entries, a power of 2. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    struct vring_avail *avail;  /* Available ring. */
+    volatile struct vring_used *used;   /* Used ring. */
+    struct request **reqs;      /* Request of each chain, by head. */
+
+    struct lock lock;           /* Protects the members below. */
+    struct condition desc_freed;        /* Signaled as chains free. */
+    uint16_t free_head;         /* First free descriptor. */
+    uint16_t free_cnt;          /* Number of free descriptors. */
+
+    uint16_t last_used;         /* Used entries seen, by interrupt
+                                   handler only. */
+  };
+
+static struct virtio_disk disks[DISK_MAX];
+static size_t disk_cnt;
+
+static struct block_operations virtio_operations;
+
+static void probe_disk (int dev, int fn);
+static bool setup_queue (struct virtio_disk *);
+static void transfer (struct virtio_disk *, block_sector_t, size_t cnt,
+                      void *, bool write);
+static void issue_request (struct virtio_disk *, block_sector_t,
+                           size_t cnt, void *, bool write);
+static uint16_t alloc_desc (struct virtio_disk *);
+static void set_desc (struct virtio_disk *, uint16_t, const void *,
+                      size_t size, uint16_t flags, uint16_t next);
+static void interrupt_handler (struct intr_frame *);
+
+/* Finds the virtio block devices on PCI bus 0, sets them up, and
+   registers them with the block layer as vda, vdb, and so on,
+   with their partitions. */
+void
+virtio_blk_init (void)
+{
+  int dev, fn;
+
+  for (dev = 0; dev < 32; dev++)
+    for (fn = 0; fn < 8; fn++)
+      if (pci_read_config (0, dev, fn, PCI_REG_ID)
+          == (PCI_DEVICE_VIRTIO_BLK << 16 | PCI_VENDOR_VIRTIO))
+        probe_disk (dev, fn);
+}
+
+/* Sets up the virtio block device that is PCI function FN of
+   device DEV on bus 0 and registers it. */
+static void
+probe_disk (int dev, int fn)
+{
+  struct virtio_disk *d;
+  uint32_t bar, intr;
+  uint64_t capacity;
+  struct block *block;
+  size_t i;
+
+  if (disk_cnt >= DISK_MAX)
+    return;
+  bar = pci_read_config (0, dev, fn, PCI_REG_BAR (0));
+  intr = pci_read_config (0, dev, fn, PCI_REG_INTR) & 0xff;
+  if ((bar & 1) == 0 || (bar & ~3u) == 0 || intr == 0 || intr >= 16)
+    return;
+  pci_write_config (0, dev, fn, PCI_REG_COMMAND,
+                    pci_read_config (0, dev, fn, PCI_REG_COMMAND)
+                    | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+  d = &disks[disk_cnt];
+  snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) disk_cnt);
+  d->io_base = bar & ~3u;
+  d->irq = intr + 0x20;
+  lock_init (&d->lock);
+  cond_init (&d->desc_freed);
+  d->last_used = 0;
+
+  /* Reset the device and tell it we drive it.  We use none of its
+     optional features. */
+  outb (reg_status (d), 0);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  inl (reg_features (d));
+  outl (reg_guest_features (d), 0);
+  if (!setup_queue (d))
+    {
+      printf ("%s: cannot set up request queue\n", d->name);
+      outb (reg_status (d), STATUS_FAILED);
+      return;
+    }
+  capacity = ((uint64_t) inl (reg_capacity (d) + 4) << 32
+              | inl (reg_capacity (d)));
+
+  /* Disks may share an interrupt line, and then they share a
+     handler. */
+  for (i = 0; i < disk_cnt; i++)
+    if (disks[i].irq == d->irq)
+      break;
+  if (i == disk_cnt)
+    intr_register_ext (d->irq, interrupt_handler, d->name);
+  disk_cnt++;
+  outb (reg_status (d),
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+  /* Register.  We can address at most 2**32 sectors. */
+  block = block_register (d->name, BLOCK_RAW, "virtio",
+                          capacity > UINT32_MAX ? UINT32_MAX : capacity,
+                          &virtio_operations, d);
+  block_set_channel (block, CHANNEL_BASE + (d - disks));
+  partition_scan (block);
+}
+
+/* Allocates and lays out the request queue of disk D, queue 0,
+   and gives its address to the device.  Returns false if the
+   device has no queue or memory is exhausted. */
+static bool
+setup_queue (struct virtio_disk *d)
+{
+  size_t used_ofs, page_cnt;
+  uint8_t *queue;
+  uint16_t i;
+
+  outw (reg_queue_select (d), 0);
+  d->queue_size = inw (reg_queue_size (d));
+  if (d->queue_size < REQ_DESC_CNT)
+    return false;
+
+  /* The descriptors and available ring come first, and the used
+     ring starts on the next page boundary. */
+  used_ofs = ROUND_UP (d->queue_size * sizeof *d->desc
+                       + sizeof *d->avail
+                       + (d->queue_size + 1) * sizeof (uint16_t),
+                       VRING_ALIGN);
+  page_cnt = DIV_ROUND_UP (used_ofs + sizeof *d->used
+                           + d->queue_size * sizeof *d->used->ring
+                           + sizeof (uint16_t), PGSIZE);
+  queue = palloc_get_multiple (PAL_ZERO, page_cnt);
+  d->reqs = malloc (d->queue_size * sizeof *d->reqs);
+  if (queue == NULL || d->reqs == NULL)
+    {
+      palloc_free_multiple (queue, page_cnt);
+      free (d->reqs);
+      return false;
+    }
+  d->desc = (struct vring_desc *) queue;
+  d->avail = (struct vring_avail *) (queue
+                                     + d->queue_size * sizeof *d->desc);
+  d->used = (struct vring_used *) (queue + used_ofs);
+
+  /* Chain all the descriptors into the free list. */
+  for (i = 0; i < d->queue_size; i++)
+    d->desc[i].next = i + 1;
+  d->free_head = 0;
+  d->free_cnt = d->queue_size;
+
+  outl (reg_queue_pfn (d), vtop (queue) / VRING_ALIGN);
+  return true;
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+virtio_read_multi (void *d, block_sector_t sec_no, size_t cnt,
+                   void *buffer)
+{
+  transfer (d, sec_no, cnt, buffer, false);
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Returns
+   after the disk has acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+virtio_write_multi (void *d, block_sector_t sec_no, size_t cnt,
+                    const void *buffer)
+{
+  transfer (d, sec_no, cnt, (void *) buffer, true);
+}
+
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+virtio_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  transfer (d, sec_no, 1, buffer, false);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+virtio_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  transfer (d, sec_no, 1, (void *) buffer, true);
+}
+
+static struct block_operations virtio_operations =
+  {
+    virtio_read,
+    virtio_write,
+    virtio_read_multi,
+    virtio_write_multi
+  };
+
+/* Transfers CNT sectors starting at SEC_NO between disk D and
+   BUFFER, reading into BUFFER if WRITE is false and writing from
+   it otherwise, in requests of up to VIRTIO_MAX_SECTORS sectors.
+   The device reaches BUFFER by physical address, so a buffer
+   outside kernel memory is bounced through a page of its own. */
+static void
+transfer (struct virtio_disk *d, block_sector_t sec_no, size_t cnt,
+          void *buffer_, bool write)
+{
+  uint8_t *buffer = buffer_;
+  uint8_t *bounce = NULL;
+  size_t max = VIRTIO_MAX_SECTORS;
+
+  if (!is_kernel_vaddr (buffer))
+    {
+      bounce = palloc_get_page (PAL_ASSERT);
+      max = PGSIZE / BLOCK_SECTOR_SIZE;
+    }
+  while (cnt > 0)
+    {
+      size_t n = cnt < max ? cnt : max;
+      size_t size = n * BLOCK_SECTOR_SIZE;
+
+      if (bounce == NULL)
+        issue_request (d, sec_no, n, buffer, write);
+      else
+        {
+          if (write)
+            memcpy (bounce, buffer, size);
+          issue_request (d, sec_no, n, bounce, write);
+          if (!write)
+            memcpy (buffer, bounce, size);
+        }
+      buffer += size;
+      sec_no += n;
+      cnt -= n;
+    }
+  palloc_free_page (bounce);
+}
+
+/* Carries out one request to transfer CNT sectors starting at
+   SEC_NO between disk D and BUFFER, in kernel memory, and waits
+   for it to complete. */
+static void
+issue_request (struct virtio_disk *d, block_sector_t sec_no, size_t cnt,
+               void *buffer, bool write)
+{
+  struct request req;
+  uint16_t head, data, status;
+
+  req.header.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  req.header.reserved = 0;
+  req.header.sector = sec_no;
+  req.status = 0xff;
+  sema_init (&req.done, 0);
+
+  /* Build the chain and offer it to the device. */
+  lock_acquire (&d->lock);
+  while (d->free_cnt < REQ_DESC_CNT)
+    cond_wait (&d->desc_freed, &d->lock);
+  head = alloc_desc (d);
+  data = alloc_desc (d);
+  status = alloc_desc (d);
+  set_desc (d, head, &req.header, sizeof req.header,
+            VRING_DESC_F_NEXT, data);
+  set_desc (d, data, buffer, cnt * BLOCK_SECTOR_SIZE,
+            VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE), status);
+  set_desc (d, status, (const void *) &req.status, 1,
+            VRING_DESC_F_WRITE, 0);
+  d->reqs[head] = &req;
+  d->avail->ring[d->avail->idx & (d->queue_size - 1)] = head;
+  barrier ();
+  d->avail->idx++;
+  barrier ();
+  outw (reg_queue_notify (d), 0);
+  lock_release (&d->lock);
+
+  sema_down (&req.done);
+
+  /* Give the chain back. */
+  lock_acquire (&d->lock);
+  d->desc[status].next = d->free_head;
+  d->free_head = head;
+  d->free_cnt += REQ_DESC_CNT;
+  cond_signal (&d->desc_freed, &d->lock);
+  lock_release (&d->lock);
+
+  if (req.status != VIRTIO_BLK_S_OK)
+    PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+           d->name, write ? "write" : "read", sec_no);
+}
+
+/* Takes a descriptor off the free list of disk D, which must
+   hold D's lock and have one. */
+static uint16_t
+alloc_desc (struct virtio_disk *d)
+{
+  uint16_t i = d->free_head;
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
+  ASSERT (d->free_cnt > 0);
+
+  d->free_head = d->desc[i].next;
+  d->free_cnt--;
+  return i;
+}
+
+/* Points descriptor I of disk D at the SIZE bytes at kernel
+   address ADDR, with FLAGS, followed by descriptor NEXT if FLAGS
+   includes VRING_DESC_F_NEXT. */
+static void
+set_desc (struct virtio_disk *d, uint16_t i, const void *addr, size_t size,
+          uint16_t flags, uint16_t next)
+{
+  d->desc[i].addr = vtop (addr);
+  d->desc[i].len = size;
+  d->desc[i].flags = flags;
+  d->desc[i].next = next;
+}
+
+/* Virtio interrupt handler.  Wakes the waiter of each request
+   that a disk on this interrupt line has completed. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  struct virtio_disk *d;
+
+  for (d = disks; d < disks + disk_cnt; d++)
+    if (d->irq == f->vec_no && (inb (reg_isr (d)) & ISR_QUEUE) != 0)
+      while (d->last_used != d->used->idx)
+        {
+          uint32_t id;
+
+          barrier ();
+          id = d->used->ring[d->last_used & (d->queue_size - 1)].id;
+          sema_up (&d->reqs[id]->done);
+          d->last_used++;
+        }
+}
@@ -0,0 +1,84 @@
+/* membench.h
+
+   Measurement shared by the memory-system benchmarks in this
+   directory: mmbench, stream, ptrchase and mscan.  Each brackets
+   a phase of its work with membench_start() and membench_end(),
+   which prints one line with what the phase cost:
+
+      NAME: T ticks, C cycles, M minor + J major faults, E evictions
+
+   Ticks come from the kstat system call, faults and
+   evictions from vmstat for the calling process, and cycles from
+   the time-stamp counter.  The numbers depend on the simulator
+   and the host, so compare runs made on the same one. */
+
+#ifndef EXAMPLES_MEMBENCH_H
+#define EXAMPLES_MEMBENCH_H
+
+#include <kstat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <syscall.h>
+#include <vmstat.h>
+
+/* Timer ticks per second, as in devices/timer.h. */
+#define TIMER_FREQ 100
+
+/* The counters at the start of a phase. */
+struct membench
+  {
+    long long ticks;            /* Timer ticks. */
+    struct vmstat vm;           /* Paging statistics. */
+    uint64_t tsc;               /* Time-stamp counter. */
+  };
+
+/* Reads the CPU's time-stamp counter. */
+static inline uint64_t
+membench_cycles (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Returns the timer ticks since boot. */
+static inline long long
+membench_ticks (void)
+{
+  struct kstat k;
+
+  kstat (&k);
+  return k.sched.ticks;
+}
+
+/* Starts timing a phase in B. */
+static inline void
+membench_start (struct membench *b)
+{
+  b->ticks = membench_ticks ();
+  vmstat (0, &b->vm);
+  b->tsc = membench_cycles ();
+}
+
+/* Ends the phase started in B and prints its cost, labeled with
+   NAME.  B is left holding the cost instead of the counters at
+   the start. */
+static inline void
+membench_end (struct membench *b, const char *name)
+{
+  uint64_t tsc = membench_cycles ();
+  long long ticks = membench_ticks ();
+  struct vmstat vm;
+
+  vmstat (0, &vm);
+  b->tsc = tsc - b->tsc;
+  b->ticks = ticks - b->ticks;
+  b->vm.minor_faults = vm.minor_faults - b->vm.minor_faults;
+  b->vm.major_faults = vm.major_faults - b->vm.major_faults;
+  b->vm.evictions = vm.evictions - b->vm.evictions;
+  printf ("%s: %lld ticks, %llu cycles, %u minor + %u major faults, "
+          "%u evictions\n", name, b->ticks, (unsigned long long) b->tsc,
+          b->vm.minor_faults, b->vm.major_faults, b->vm.evictions);
+}
+
+#endif /* examples/membench.h */
@@ -0,0 +1,111 @@
+/* mscan.c
+
+   Measures page faults on memory mapped from a file:
+
+      mscan [KB]
+
+   Creates a file "mscan.dat" of KB kilobytes, 1024 by default,
+   maps it, and scans the mapping four times: reading a word of
+   every page, which faults each page in; doing so again, which
+   faults nothing unless the pages were evicted; reading every
+   word; and writing a word of every page.  Unmapping the file
+   writes the dirty pages back and is timed as well.  The file is
+   removed at the end. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "membench.h"
+
+/* Bytes per kilobyte and per page. */
+#define KB 1024
+#define PAGE 4096
+
+/* Name of the scanned file. */
+#define FILE_NAME "mscan.dat"
+
+/* Where the benchmark maps the file. */
+#define MAP_ADDR ((int *) 0x10000000)
+
+/* Where the scans' sums go, so that they are not optimized
+   away. */
+static volatile int sink;
+
+/* Reads the first word of each page of the SIZE bytes at P. */
+static void
+touch_pages (const int *p, size_t size)
+{
+  int sum = 0;
+  size_t i;
+
+  for (i = 0; i < size / sizeof *p; i += PAGE / sizeof *p)
+    sum += p[i];
+  sink = sum;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int kb = argc > 1 ? atoi (argv[1]) : 1024;
+  size_t size = (size_t) kb * KB;
+  struct membench mb;
+  mapid_t map;
+  int *p = MAP_ADDR;
+  int sum = 0;
+  size_t i;
+  int fd;
+
+  if (kb <= 0)
+    {
+      printf ("usage: mscan [KB]\n");
+      return EXIT_FAILURE;
+    }
+  remove (FILE_NAME);
+  if (!create (FILE_NAME, size))
+    {
+      printf ("mscan: create failed\n");
+      return EXIT_FAILURE;
+    }
+  fd = open (FILE_NAME);
+  if (fd < 0)
+    {
+      printf ("mscan: open failed\n");
+      remove (FILE_NAME);
+      return EXIT_FAILURE;
+    }
+  map = mmap (fd, p);
+  if (map == MAP_FAILED)
+    {
+      printf ("mscan: mmap failed\n");
+      close (fd);
+      remove (FILE_NAME);
+      return EXIT_FAILURE;
+    }
+
+  membench_start (&mb);
+  touch_pages (p, size);
+  membench_end (&mb, "mscan cold");
+
+  membench_start (&mb);
+  touch_pages (p, size);
+  membench_end (&mb, "mscan warm");
+
+  membench_start (&mb);
+  for (i = 0; i < size / sizeof *p; i++)
+    sum += p[i];
+  sink = sum;
+  membench_end (&mb, "mscan read");
+
+  membench_start (&mb);
+  for (i = 0; i < size / sizeof *p; i += PAGE / sizeof *p)
+    p[i] = i;
+  membench_end (&mb, "mscan write");
+
+  membench_start (&mb);
+  munmap (map);
+  membench_end (&mb, "mscan unmap");
+
+  close (fd);
+  remove (FILE_NAME);
+  return EXIT_SUCCESS;
+}
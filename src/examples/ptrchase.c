@@ -0,0 +1,106 @@
+/* ptrchase.c
+
+   Measures memory latency by following a chain of pointers, so
+   that each load waits for the one before it:
+
+      ptrchase [KB [STRIDE]]
+
+   The chain takes KB kilobytes, 1024 by default, with one link
+   every STRIDE bytes, 64 by default, the size of a cache line.
+   A STRIDE of 4096 puts each link on a page of its own, which
+   measures the TLB instead of the cache, and with KB beyond the
+   size of memory, paging.
+
+   The links are first put in random order, as a single cycle
+   made by Sattolo's algorithm, which no prefetcher can predict.
+   A first lap faults the chain in and a second one is timed.
+   Then the same links are put in address order and timed again,
+   for comparison.  Each timed lap is followed by the cycles it
+   took per load. */
+
+#include <malloc.h>
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "membench.h"
+
+/* Bytes per kilobyte. */
+#define KB 1024
+
+/* Where the walk ends, kept so that it is not optimized away. */
+static void *volatile sink;
+
+/* Follows the chain from P for CNT links. */
+static void
+chase (void *p, size_t cnt)
+{
+  while (cnt-- > 0)
+    p = *(void **) p;
+  sink = p;
+}
+
+/* Times one lap of the CNT links that start at BASE, labeled
+   with NAME. */
+static void
+timed_lap (char *base, size_t cnt, const char *name)
+{
+  struct membench mb;
+
+  membench_start (&mb);
+  chase (base, cnt);
+  membench_end (&mb, name);
+  printf ("  %llu cycles per load\n",
+          (unsigned long long) mb.tsc / cnt);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int kb = argc > 1 ? atoi (argv[1]) : 1024;
+  int stride = argc > 2 ? atoi (argv[2]) : 64;
+  size_t cnt, i;
+  size_t *next;
+  char *base;
+
+  if (kb <= 0 || stride < (int) sizeof (void *)
+      || stride % sizeof (void *) != 0 || stride > kb * KB)
+    {
+      printf ("usage: ptrchase [KB [STRIDE]]\n");
+      return EXIT_FAILURE;
+    }
+  cnt = (size_t) kb * KB / stride;
+  base = malloc ((size_t) kb * KB);
+  next = malloc (cnt * sizeof *next);
+  if (base == NULL || next == NULL)
+    {
+      printf ("ptrchase: out of memory\n");
+      return EXIT_FAILURE;
+    }
+
+  /* Sattolo's algorithm: swapping each element only with one
+     before it yields a permutation that is a single cycle, so the
+     walk visits every link before it comes back.  The seed is
+     fixed, so that runs follow the same order. */
+  random_init (0);
+  for (i = 0; i < cnt; i++)
+    next[i] = i;
+  for (i = cnt - 1; i > 0; i--)
+    {
+      size_t j = random_ulong () % i;
+      size_t t = next[i];
+      next[i] = next[j];
+      next[j] = t;
+    }
+  for (i = 0; i < cnt; i++)
+    *(void **) (base + i * stride) = base + next[i] * stride;
+  free (next);
+
+  chase (base, cnt);
+  timed_lap (base, cnt, "ptrchase random");
+
+  for (i = 0; i < cnt; i++)
+    *(void **) (base + i * stride) = base + (i + 1) % cnt * stride;
+  timed_lap (base, cnt, "ptrchase sequential");
+  return EXIT_SUCCESS;
+}
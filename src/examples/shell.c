@@ -3,8 +3,12 @@
 #include <string.h>
 #include <syscall.h>
 
+/* Most commands in a pipeline. */
+#define MAX_STAGES 8
+
 static void read_line (char line[], size_t);
 static bool backspace (char **pos, char line[]);
+static void run_pipeline (char *line);
 
 int
 main (void)
@@ -31,19 +35,68 @@ main (void)
           /* Empty command. */
         }
       else
-        {
-          pid_t pid = exec (command);
-          if (pid != PID_ERROR)
-            printf ("\"%s\": exit code %d\n", command, wait (pid));
-          else
-            printf ("exec failed\n");
-        }
+        run_pipeline (command);
     }
 
   printf ("Shell exiting.");
   return EXIT_SUCCESS;
 }
 
+/* Runs the commands in LINE, which are separated by `|', all at
+   once, with the standard output of each going through a pipe
+   to the standard input of the next.  Each command is started
+   with spawn(), with the pipes around it as its descriptors 0
+   and 1, and then we close our ends of those. */
+static void
+run_pipeline (char *line)
+{
+  char *stages[MAX_STAGES];
+  pid_t pids[MAX_STAGES];
+  char *stage, *save_ptr;
+  int stage_cnt = 0;
+  int in_fd = -1;
+  int i;
+
+  for (stage = strtok_r (line, "|", &save_ptr); stage != NULL;
+       stage = strtok_r (NULL, "|", &save_ptr))
+    {
+      if (stage_cnt == MAX_STAGES)
+        {
+          printf ("too many commands\n");
+          return;
+        }
+      stages[stage_cnt++] = stage;
+    }
+
+  for (i = 0; i < stage_cnt; i++)
+    {
+      int fds[2] = { -1, -1 };
+
+      if (i + 1 < stage_cnt && pipe (fds) < 0)
+        {
+          printf ("pipe failed\n");
+          break;
+        }
+
+      pids[i] = spawn (stages[i], in_fd != -1 ? in_fd : STDIN_FILENO,
+                       fds[1] != -1 ? fds[1] : STDOUT_FILENO);
+      if (in_fd != -1)
+        close (in_fd);
+      if (fds[1] != -1)
+        close (fds[1]);
+      in_fd = fds[0];
+    }
+  if (in_fd != -1)
+    close (in_fd);
+
+  stage_cnt = i;
+  for (i = 0; i < stage_cnt; i++)
+    if (pids[i] != PID_ERROR)
+      printf ("\"%s\": exit code %d\n", stages[i], wait (pids[i]));
+    else
+      printf ("exec failed\n");
+}
+
 /* Reads a line of input from the user into LINE, which has room
    for SIZE bytes.  Handles backspace and Ctrl+U in the ways
    expected by Unix users.  On return, LINE will always be
@@ -54,8 +107,8 @@ read_line (char line[], size_t size)
   char *pos = line;
   for (;;)
     {
-      char c;
-      read (STDIN_FILENO, &c, 1);
+      /* getchar() also writes the characters echoed so far. */
+      char c = getchar ();
 
       switch (c) 
         {
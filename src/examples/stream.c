@@ -0,0 +1,111 @@
+/* stream.c
+
+   Measures memory bandwidth with the four kernels of the STREAM
+   benchmark over arrays of ints, since user programs are built
+   without floating point:
+
+      stream [KB [PASSES]]
+
+   Each of the three arrays takes KB kilobytes, 256 by default,
+   and each kernel runs PASSES times, 4 by default.  Filling the
+   arrays first faults them in, and is reported on its own.  Each
+   kernel's line is followed by the bandwidth it reached, counting
+   the bytes it read and wrote. */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "membench.h"
+
+/* Bytes per kilobyte. */
+#define KB 1024
+
+static int *a, *b, *c;
+static size_t n;
+
+/* Prints the bandwidth of moving BYTES bytes in TICKS ticks. */
+static void
+print_bandwidth (unsigned long long bytes, long long ticks)
+{
+  if (ticks > 0)
+    printf ("  %llu kB/s\n", bytes * TIMER_FREQ / KB / ticks);
+  else
+    printf ("  under a tick\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+  int kb = argc > 1 ? atoi (argv[1]) : 256;
+  int passes = argc > 2 ? atoi (argv[2]) : 4;
+  unsigned long long bytes;
+  struct membench mb;
+  size_t i;
+  int p;
+
+  if (kb <= 0 || passes <= 0)
+    {
+      printf ("usage: stream [KB [PASSES]]\n");
+      return EXIT_FAILURE;
+    }
+  n = (size_t) kb * KB / sizeof (int);
+  a = malloc (n * sizeof *a);
+  b = malloc (n * sizeof *b);
+  c = malloc (n * sizeof *c);
+  if (a == NULL || b == NULL || c == NULL)
+    {
+      printf ("stream: out of memory\n");
+      return EXIT_FAILURE;
+    }
+
+  membench_start (&mb);
+  for (i = 0; i < n; i++)
+    {
+      a[i] = 1;
+      b[i] = 2;
+      c[i] = 0;
+    }
+  membench_end (&mb, "stream fill");
+
+  /* Copy and scale move two arrays' worth of bytes per pass, add
+     and triad three. */
+  bytes = (unsigned long long) n * sizeof (int) * passes;
+  membench_start (&mb);
+  for (p = 0; p < passes; p++)
+    for (i = 0; i < n; i++)
+      c[i] = a[i];
+  membench_end (&mb, "stream copy");
+  print_bandwidth (2 * bytes, mb.ticks);
+
+  membench_start (&mb);
+  for (p = 0; p < passes; p++)
+    for (i = 0; i < n; i++)
+      b[i] = 3 * c[i];
+  membench_end (&mb, "stream scale");
+  print_bandwidth (2 * bytes, mb.ticks);
+
+  membench_start (&mb);
+  for (p = 0; p < passes; p++)
+    for (i = 0; i < n; i++)
+      c[i] = a[i] + b[i];
+  membench_end (&mb, "stream add");
+  print_bandwidth (3 * bytes, mb.ticks);
+
+  membench_start (&mb);
+  for (p = 0; p < passes; p++)
+    for (i = 0; i < n; i++)
+      a[i] = b[i] + 3 * c[i];
+  membench_end (&mb, "stream triad");
+  print_bandwidth (3 * bytes, mb.ticks);
+
+  /* B is 3 * 1 and C is 1 + 3, so each element of A is now
+     3 + 3 * 4. */
+  for (i = 0; i < n; i++)
+    if (a[i] != 15)
+      {
+        printf ("stream: a[%zu] is %d instead of 15\n", i, a[i]);
+        return EXIT_FAILURE;
+      }
+  return EXIT_SUCCESS;
+}
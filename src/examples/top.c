@@ -0,0 +1,91 @@
+/* top.c
+
+   Prints kernel-wide statistics every INTERVAL timer ticks,
+   COUNT times:
+
+      top [COUNT [INTERVAL]]
+
+   COUNT defaults to 10 and INTERVAL to 100 ticks, one second.
+   Each line shows how the CPU was spent, the context switches
+   and page faults per second, memory in use and sectors
+   transferred over the interval.  User programs cannot sleep, so
+   top polls the kstat system call between snapshots, and the
+   polling is counted as user time. */
+
+#include <kstat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+
+/* Timer ticks per second, as in devices/timer.h. */
+#define TIMER_FREQ 100
+
+/* Waits until INTERVAL ticks have passed since the snapshot in
+   OLD and stores a new snapshot in NEW. */
+static void
+wait_ticks (const struct kstat *old, struct kstat *new, long long interval)
+{
+  do
+    kstat (new);
+  while (new->sched.ticks - old->sched.ticks < interval);
+}
+
+/* Returns the number of sectors transferred by all block devices
+   in snapshot K. */
+static unsigned long long
+sectors (const struct kstat *k)
+{
+  unsigned long long cnt = 0;
+  int i;
+
+  for (i = 0; i < KSTAT_BLOCK_CNT; i++)
+    cnt += k->block[i].read_cnt + k->block[i].write_cnt;
+  return cnt;
+}
+
+/* Returns N events over TICKS ticks as a rate per second. */
+static long long
+per_sec (long long n, long long ticks)
+{
+  return n * TIMER_FREQ / ticks;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int count = argc > 1 ? atoi (argv[1]) : 10;
+  long long interval = argc > 2 ? atoi (argv[2]) : TIMER_FREQ;
+  struct kstat old, new;
+  int i;
+
+  if (count <= 0 || interval <= 0)
+    {
+      printf ("usage: top [COUNT [INTERVAL]]\n");
+      return EXIT_FAILURE;
+    }
+
+  printf ("%5s %5s %5s %8s %7s %6s %6s %6s %8s\n",
+          "idle%", "krnl%", "user%", "switch/s", "fault/s",
+          "kpages", "upages", "heapkB", "sectors");
+  kstat (&old);
+  for (i = 0; i < count; i++)
+    {
+      const struct kstat_sched *o = &old.sched;
+      const struct kstat_sched *n = &new.sched;
+      long long ticks;
+
+      wait_ticks (&old, &new, interval);
+      ticks = n->ticks - o->ticks;
+      printf ("%5lld %5lld %5lld %8lld %7lld %6u %6u %6u %8llu\n",
+              (n->idle_ticks - o->idle_ticks) * 100 / ticks,
+              (n->kernel_ticks - o->kernel_ticks) * 100 / ticks,
+              (n->user_ticks - o->user_ticks) * 100 / ticks,
+              per_sec ((n->voluntary + n->involuntary)
+                       - (o->voluntary + o->involuntary), ticks),
+              per_sec (new.mem.page_faults - old.mem.page_faults, ticks),
+              new.mem.kernel_used, new.mem.user_used,
+              new.mem.heap_bytes / 1024, sectors (&new) - sectors (&old));
+      old = new;
+    }
+  return EXIT_SUCCESS;
+}
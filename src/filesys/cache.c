@@ -0,0 +1,780 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <list.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/sysctl.h"
+#include "threads/thread.h"
+#include "threads/workqueue.h"
+
+/* Number of timer ticks between two write-behind passes, the
+   tunable fs.flush_interval. */
+#define CACHE_FLUSH_INTERVAL (5 * TIMER_FREQ)
+static int flush_interval = CACHE_FLUSH_INTERVAL;
+
+/* Runs write-behind in the background. */
+static struct workqueue flush_wq;
+static struct work flush_work;
+
+/* Maximum number of queued read-ahead requests.  Requests made
+   while the queue is full are dropped: read-ahead is only a
+   hint. */
+#define READ_AHEAD_MAX 16
+
+/* A cached sector.
+
+   An entry is "pinned" while some thread is using it, that is,
+   between cache_get() and cache_put().  Pinned entries are never
+   chosen for eviction, so a pinned entry keeps its sector.
+   PIN_CNT, SECTOR and the membership of an entry in the cache
+   are protected by cache_lock; the sector data and the VALID,
+   DIRTY and META flags are protected by the entry's own LOCK.
+
+   A dirty entry with META set holds file system metadata that
+   has changed since the last journal commit.  It may only be
+   written to its home sector after it has been logged in the
+   journal by cache_flush(), so it is never evicted.
+
+   A dirty entry that holds file data may have an OWNER, the
+   inode sector of the file, and is then on a dirty list for
+   cache_flush_file().  OWNER and DIRTY_ELEM are protected by
+   cache_lock. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Cached sector, if in use. */
+    bool in_use;                        /* Does SECTOR mean anything? */
+    bool valid;                         /* Has DATA been read from disk? */
+    bool dirty;                         /* Must DATA be written back? */
+    bool meta;                          /* Metadata to be journaled? */
+    bool accessed;                      /* Used since the clock hand passed? */
+    unsigned use_cnt;                   /* Uses since SECTOR was cached. */
+    block_sector_t owner;               /* File of dirty data, if any. */
+    struct list_elem dirty_elem;        /* Element in a dirty list. */
+    int pin_cnt;                        /* Number of current users. */
+    struct lock lock;                   /* Protects DATA and flags. */
+    struct block_request req;           /* Write-back request. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+/* The cache itself, its lock and the clock hand. */
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+static size_t clock_hand;
+
+/* Sectors waiting to be read ahead, as a ring buffer, together
+   with the lock and condition that guard it. */
+static block_sector_t read_ahead_queue[READ_AHEAD_MAX];
+static size_t read_ahead_head, read_ahead_cnt;
+static struct lock read_ahead_lock;
+static struct condition read_ahead_cond;
+
+/* Identifies a cache manifest. */
+#define MANIFEST_MAGIC 0x484f5453
+
+/* On-disk manifest, in CACHE_MANIFEST_SECTOR.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   After a reboot the cache is cold, and the same executables and
+   files are read again a sector at a time as they are first
+   used.  So that it warms up sooner, cache_save_manifest() lists
+   the sectors that were in use more than once in the cache when
+   the file system was shut down, and cache_load_manifest() reads
+   them into the cache in the background at the next boot.  The
+   manifest is only a hint: sectors that no longer hold the same
+   data, after a crash for example, cost a read and nothing
+   else. */
+struct cache_manifest
+  {
+    unsigned magic;                     /* Magic number. */
+    uint32_t cnt;                       /* Number of sectors. */
+    block_sector_t sectors[CACHE_SIZE]; /* Sectors, in ascending order. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 2 * sizeof (uint32_t)
+                   - CACHE_SIZE * sizeof (block_sector_t)];
+  };
+
+/* Number of dirty metadata entries.  Protected by cache_lock,
+   but read without it as a hint. */
+static size_t meta_dirty_cnt;
+
+/* Value of OWNER for an entry without one.  Sector 0 holds the
+   free map's inode, and the free map is metadata, so no file
+   data is owned by it. */
+#define NO_OWNER 0
+
+/* Dirty data entries with an owner, hashed by owner, so that
+   cache_flush_file() only looks at the entries of files that
+   share its file's list.  Protected by cache_lock. */
+#define DIRTY_LIST_CNT 16
+static struct list dirty_lists[DIRTY_LIST_CNT];
+
+static void write_at (block_sector_t, block_sector_t owner, const void *,
+                      int sector_ofs, int size, bool meta);
+static void mark_dirty (struct cache_entry *, block_sector_t owner,
+                        bool meta);
+static void mark_clean (struct cache_entry *);
+static void log_metadata (void);
+static struct cache_entry *cache_get (block_sector_t, bool need_data);
+static void cache_put (struct cache_entry *);
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *cache_evict (void);
+static work_func write_behind;
+static thread_func read_ahead_daemon NO_RETURN;
+static thread_func warm_up;
+
+/* Initializes the buffer cache and starts the write-behind and
+   read-ahead threads. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init_named (&cache_lock, "cache");
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      memset (&cache[i], 0, sizeof cache[i]);
+      lock_init (&cache[i].lock);
+    }
+  clock_hand = 0;
+  for (i = 0; i < DIRTY_LIST_CNT; i++)
+    list_init (&dirty_lists[i]);
+
+  lock_init_named (&read_ahead_lock, "read_ahead");
+  cond_init (&read_ahead_cond);
+  read_ahead_head = read_ahead_cnt = 0;
+
+  sysctl_register ("fs.flush_interval", &flush_interval,
+                   1, 60 * TIMER_FREQ);
+  workqueue_init (&flush_wq, "cache-flush", 1);
+  work_init (&flush_work, write_behind, NULL, PRI_DEFAULT);
+  workqueue_queue_delayed (&flush_wq, &flush_work, flush_interval);
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead_daemon, NULL);
+}
+
+/* Reads a whole SECTOR into BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes a whole SECTOR from BUFFER. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  write_at (sector, NO_OWNER, buffer, 0, BLOCK_SECTOR_SIZE, false);
+}
+
+/* Writes a whole metadata SECTOR from BUFFER. */
+void
+cache_write_meta (block_sector_t sector, const void *buffer)
+{
+  write_at (sector, NO_OWNER, buffer, 0, BLOCK_SECTOR_SIZE, true);
+}
+
+/* Copies SIZE bytes starting at byte SECTOR_OFS of SECTOR into
+   BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, int sector_ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (sector_ofs >= 0 && size >= 0);
+  ASSERT (sector_ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + sector_ofs, size);
+  cache_put (e);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR into BUFFER,
+   for a caller that keeps the data itself, such as a page fault
+   filling a frame.  Sectors in the cache are copied from it,
+   since they may be newer than the disk, and each run of the
+   others is read straight from disk in one transfer, without
+   taking cache entries that would only hold a second copy. */
+void
+cache_read_direct (block_sector_t sector, size_t cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      size_t run;
+
+      lock_acquire (&cache_lock);
+      for (run = 0; run < cnt && cache_lookup (sector + run) == NULL; run++)
+        continue;
+      lock_release (&cache_lock);
+
+      if (run == 0)
+        {
+          cache_read (sector, buffer);
+          run = 1;
+        }
+      else
+        block_read_multi (fs_device, sector, run, buffer);
+      sector += run;
+      buffer += run * BLOCK_SECTOR_SIZE;
+      cnt -= run;
+    }
+}
+
+/* Copies SIZE bytes from BUFFER into SECTOR starting at byte
+   SECTOR_OFS.  The sector is written back to disk later, when it
+   is evicted or flushed.  Writing a whole sector never reads
+   the old contents from disk. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                int sector_ofs, int size)
+{
+  write_at (sector, NO_OWNER, buffer, sector_ofs, size, false);
+}
+
+/* Like cache_write_at(), for a data sector of the file whose
+   inode is in sector OWNER.  cache_flush_file() writes the
+   sectors written this way. */
+void
+cache_write_file_at (block_sector_t sector, block_sector_t owner,
+                     const void *buffer, int sector_ofs, int size)
+{
+  write_at (sector, owner, buffer, sector_ofs, size, false);
+}
+
+/* Like cache_write_at(), but for a sector of file system
+   metadata, which reaches its home sector only through the
+   journal.  Must be called between journal_begin() and
+   journal_end(). */
+void
+cache_write_meta_at (block_sector_t sector, const void *buffer,
+                     int sector_ofs, int size)
+{
+  write_at (sector, NO_OWNER, buffer, sector_ofs, size, true);
+}
+
+/* Returns the number of metadata sectors changed since the last
+   journal commit. */
+size_t
+cache_meta_dirty_cnt (void)
+{
+  return meta_dirty_cnt;
+}
+
+/* Copies SIZE bytes from BUFFER into SECTOR starting at byte
+   SECTOR_OFS, marking the sector as metadata if META is true or
+   as data of file OWNER otherwise. */
+static void
+write_at (block_sector_t sector, block_sector_t owner, const void *buffer,
+          int sector_ofs, int size, bool meta)
+{
+  struct cache_entry *e;
+
+  ASSERT (sector_ofs >= 0 && size >= 0);
+  ASSERT (sector_ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + sector_ofs, buffer, size);
+  e->valid = true;
+  lock_acquire (&cache_lock);
+  mark_dirty (e, owner, meta);
+  lock_release (&cache_lock);
+  cache_put (e);
+}
+
+/* Writes the dirty data sectors of the file whose inode is in
+   sector OWNER back to disk, as far as they were written with
+   cache_write_file_at().  Only the entries on OWNER's dirty list
+   are examined. */
+void
+cache_flush_file (block_sector_t owner)
+{
+  struct list *dirty = &dirty_lists[owner % DIRTY_LIST_CNT];
+  size_t i;
+
+  ASSERT (owner != NO_OWNER);
+
+  /* Each round writes one sector, which leaves the list.  The
+     bound keeps writers that keep dirtying the file from holding
+     us here forever. */
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = NULL;
+      struct list_elem *elem;
+
+      lock_acquire (&cache_lock);
+      for (elem = list_begin (dirty); elem != list_end (dirty);
+           elem = list_next (elem))
+        {
+          e = list_entry (elem, struct cache_entry, dirty_elem);
+          if (e->owner == owner)
+            break;
+        }
+      if (elem == list_end (dirty))
+        {
+          lock_release (&cache_lock);
+          return;
+        }
+      e->pin_cnt++;
+      lock_release (&cache_lock);
+
+      lock_acquire (&e->lock);
+      if (e->dirty && e->owner == owner)
+        {
+          block_write (fs_device, e->sector, e->data);
+          lock_acquire (&cache_lock);
+          mark_clean (e);
+          lock_release (&cache_lock);
+        }
+      cache_put (e);
+    }
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache in
+   the background.  Returns immediately. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&read_ahead_lock);
+  if (read_ahead_cnt < READ_AHEAD_MAX)
+    {
+      size_t tail = (read_ahead_head + read_ahead_cnt) % READ_AHEAD_MAX;
+      read_ahead_queue[tail] = sector;
+      read_ahead_cnt++;
+      cond_signal (&read_ahead_cond, &read_ahead_lock);
+    }
+  lock_release (&read_ahead_lock);
+}
+
+/* Starts reading the sectors listed in the manifest into the
+   cache, in the background.  The file system must not have been
+   formatted since the manifest was written. */
+void
+cache_load_manifest (void)
+{
+  struct cache_manifest *m = malloc (sizeof *m);
+
+  ASSERT (sizeof *m == BLOCK_SECTOR_SIZE);
+  if (m == NULL)
+    return;
+  block_read (fs_device, CACHE_MANIFEST_SECTOR, m);
+  if (m->magic != MANIFEST_MAGIC || m->cnt == 0 || m->cnt > CACHE_SIZE
+      || thread_create ("cache-warm", PRI_MIN, warm_up, m) == TID_ERROR)
+    free (m);
+}
+
+/* Compares the sectors that A_ and B_ point to, for qsort(). */
+static int
+compare_sectors (const void *a_, const void *b_)
+{
+  block_sector_t a = *(const block_sector_t *) a_;
+  block_sector_t b = *(const block_sector_t *) b_;
+
+  return a < b ? -1 : a > b;
+}
+
+/* Writes the manifest, listing the cached sectors that have been
+   used more than once since they were read, for
+   cache_load_manifest() at the next boot.  Called when the file
+   system shuts down. */
+void
+cache_save_manifest (void)
+{
+  static struct cache_manifest m;
+  size_t i;
+
+  memset (&m, 0, sizeof m);
+  m.magic = MANIFEST_MAGIC;
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].in_use && cache[i].valid && cache[i].use_cnt > 1)
+      m.sectors[m.cnt++] = cache[i].sector;
+  lock_release (&cache_lock);
+  qsort (m.sectors, m.cnt, sizeof *m.sectors, compare_sectors);
+  block_write (fs_device, CACHE_MANIFEST_SECTOR, &m);
+}
+
+/* Writes all dirty cached sectors back to disk: first file data,
+   and then metadata through the journal, so that committed
+   metadata never refers to data that is not on disk yet.  The
+   caller must have called journal_begin_commit(), so that the
+   metadata is consistent.
+
+   The writes are submitted to the disk's request queue together,
+   so that it can sort and merge them, and then waited for.
+   Data entries that are busy when the batch is built are written
+   one at a time afterward. */
+void
+cache_flush (void)
+{
+  size_t i;
+  bool busy = false;
+
+  /* Queue a write for every idle dirty data entry. */
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      lock_acquire (&cache_lock);
+      if (!e->in_use || !e->dirty || e->meta)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->pin_cnt++;
+      lock_release (&cache_lock);
+
+      if (!lock_try_acquire (&e->lock))
+        {
+          lock_acquire (&cache_lock);
+          e->pin_cnt--;
+          lock_release (&cache_lock);
+          busy = true;
+          continue;
+        }
+      if (e->dirty && !e->meta)
+        {
+          block_request_init (&e->req, e->sector, 1, e->data, true);
+          block_submit (fs_device, &e->req);
+        }
+      else
+        cache_put (e);
+    }
+
+  /* Wait for the queued writes, which are those of the entries
+     still locked by this thread. */
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      if (!lock_held_by_current_thread (&e->lock))
+        continue;
+      block_wait (&e->req);
+      lock_acquire (&cache_lock);
+      mark_clean (e);
+      lock_release (&cache_lock);
+      cache_put (e);
+    }
+
+  /* Write the entries that were busy, waiting for each. */
+  if (busy)
+    for (i = 0; i < CACHE_SIZE; i++)
+      {
+        struct cache_entry *e = &cache[i];
+
+        lock_acquire (&cache_lock);
+        if (!e->in_use || !e->dirty || e->meta)
+          {
+            lock_release (&cache_lock);
+            continue;
+          }
+        e->pin_cnt++;
+        lock_release (&cache_lock);
+
+        lock_acquire (&e->lock);
+        if (e->dirty && !e->meta)
+          {
+            block_write (fs_device, e->sector, e->data);
+            lock_acquire (&cache_lock);
+            mark_clean (e);
+            lock_release (&cache_lock);
+          }
+        cache_put (e);
+      }
+
+  log_metadata ();
+}
+
+/* Dirty metadata entries being committed by log_metadata(), and
+   their sectors.  Only one thread commits at a time. */
+static struct cache_entry *commit_entries[CACHE_SIZE];
+static block_sector_t commit_sectors[CACHE_SIZE];
+
+/* Commits every dirty metadata entry as one journal transaction:
+   writes the entries to the journal, then the commit record, and
+   then the entries to their home sectors.  A crash before the
+   commit record is written loses the whole transaction; a crash
+   after it is repaired by replaying the journal. */
+static void
+log_metadata (void)
+{
+  size_t cnt = 0;
+  size_t i;
+
+  /* Lock every dirty metadata entry.  No operation is in progress,
+     so any other holder of an entry's lock is only reading. */
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      lock_acquire (&cache_lock);
+      if (!e->in_use || !e->dirty || !e->meta)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->pin_cnt++;
+      lock_release (&cache_lock);
+
+      lock_acquire (&e->lock);
+      if (e->dirty && e->meta)
+        {
+          commit_entries[cnt] = e;
+          commit_sectors[cnt] = e->sector;
+          cnt++;
+        }
+      else
+        cache_put (e);
+    }
+  if (cnt == 0)
+    return;
+
+  /* Log the entries and commit. */
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_entry *e = commit_entries[i];
+      block_request_init (&e->req, journal_slot (i), 1, e->data, true);
+      block_submit (fs_device, &e->req);
+    }
+  for (i = 0; i < cnt; i++)
+    block_wait (&commit_entries[i]->req);
+  journal_commit (commit_sectors, cnt);
+
+  /* Write the entries in place. */
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_entry *e = commit_entries[i];
+      block_request_init (&e->req, e->sector, 1, e->data, true);
+      block_submit (fs_device, &e->req);
+    }
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_entry *e = commit_entries[i];
+      block_wait (&e->req);
+      lock_acquire (&cache_lock);
+      mark_clean (e);
+      lock_release (&cache_lock);
+      cache_put (e);
+    }
+  journal_checkpointed ();
+}
+
+/* Returns the pinned and locked cache entry for SECTOR, loading
+   it into the cache if necessary.  If NEED_DATA is false, the
+   caller promises to overwrite the whole sector, so its old
+   contents are not read from disk.  The caller must release the
+   entry with cache_put(). */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool need_data)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = cache_lookup (sector);
+  if (e == NULL)
+    {
+      e = cache_evict ();
+      e->sector = sector;
+      e->in_use = true;
+      e->valid = false;
+      e->use_cnt = 0;
+    }
+  e->pin_cnt++;
+  lock_release (&cache_lock);
+
+  lock_acquire (&e->lock);
+  if (need_data && !e->valid)
+    {
+      block_read (fs_device, sector, e->data);
+      e->valid = true;
+    }
+  e->accessed = true;
+  e->use_cnt++;
+  return e;
+}
+
+/* Unlocks and unpins E, previously returned by cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  ASSERT (e->pin_cnt > 0);
+  e->pin_cnt--;
+  lock_release (&cache_lock);
+}
+
+/* Returns the cache entry holding SECTOR, or a null pointer if
+   SECTOR is not cached.  The cache is small enough that a linear
+   search is faster than maintaining an index.
+   Must be called with cache_lock held. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].in_use && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Marks E dirty, as metadata if META is true or as data of file
+   OWNER otherwise.  Must be called with cache_lock and E's lock
+   held. */
+static void
+mark_dirty (struct cache_entry *e, block_sector_t owner, bool meta)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  if (meta && !(e->dirty && e->meta))
+    meta_dirty_cnt++;
+  e->dirty = true;
+  e->meta = e->meta || meta;
+  if (e->meta)
+    owner = NO_OWNER;
+  if (owner != e->owner)
+    {
+      if (e->owner != NO_OWNER)
+        list_remove (&e->dirty_elem);
+      if (owner != NO_OWNER)
+        list_push_back (&dirty_lists[owner % DIRTY_LIST_CNT],
+                        &e->dirty_elem);
+      e->owner = owner;
+    }
+}
+
+/* Marks E clean, after it has been written to disk.  Must be
+   called with cache_lock held, and with E's lock held or E
+   unpinned. */
+static void
+mark_clean (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  if (e->dirty && e->meta)
+    meta_dirty_cnt--;
+  if (e->owner != NO_OWNER)
+    list_remove (&e->dirty_elem);
+  e->owner = NO_OWNER;
+  e->dirty = false;
+  e->meta = false;
+}
+
+/* Chooses an unpinned entry to reuse with the clock algorithm,
+   writing its sector back first if it is dirty, and returns it.
+   Must be called with cache_lock held.  Because the victim is
+   unpinned, no other thread can be using it.
+
+   Uncommitted metadata is never chosen: it may only reach its
+   home sector after its commit record.  If every unpinned entry
+   holds uncommitted metadata, the committing thread commits it
+   at once, since no operation is in progress while it commits.
+   Any other thread asks write-behind to commit and waits for
+   that, or for the users of pinned entries to finish.
+   journal_begin() commits before uncommitted metadata takes up
+   much of the cache, so operations in progress, which hold up
+   the commit, always find entries to spare. */
+static struct cache_entry *
+cache_evict (void)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (;;)
+    {
+      size_t i;
+
+      /* Two sweeps are enough to find an entry if there is one:
+         the first may only clear accessed bits. */
+      for (i = 0; i < 2 * CACHE_SIZE; i++)
+        {
+          struct cache_entry *e = &cache[clock_hand];
+          clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+          if (e->pin_cnt > 0 || (e->dirty && e->meta))
+            continue;
+          if (e->in_use && e->accessed)
+            {
+              e->accessed = false;
+              continue;
+            }
+
+          if (e->in_use && e->dirty)
+            {
+              block_write (fs_device, e->sector, e->data);
+              mark_clean (e);
+            }
+          e->in_use = false;
+          return e;
+        }
+
+      lock_release (&cache_lock);
+      if (meta_dirty_cnt > 0 && journal_committing ())
+        log_metadata ();
+      else
+        {
+          if (meta_dirty_cnt > 0)
+            {
+              workqueue_cancel (&flush_work);
+              workqueue_queue (&flush_wq, &flush_work);
+            }
+          thread_yield ();
+        }
+      lock_acquire (&cache_lock);
+    }
+}
+
+/* Write-behind.  Every fs.flush_interval ticks, writes the free
+   map and dirty sectors back to disk so that a crash loses at
+   most a few seconds of work, then queues itself again. */
+static void
+write_behind (void *aux UNUSED)
+{
+  block_set_class (BLOCK_CLASS_ASYNC);
+  free_map_flush ();
+  workqueue_queue_delayed (&flush_wq, &flush_work, flush_interval);
+}
+
+/* Read-ahead thread.  Loads the sectors queued by
+   cache_read_ahead() so that the disk works while the requesting
+   thread is busy with the data it already has. */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+  block_set_class (BLOCK_CLASS_BACKGROUND);
+  for (;;)
+    {
+      block_sector_t sector;
+
+      lock_acquire (&read_ahead_lock);
+      while (read_ahead_cnt == 0)
+        cond_wait (&read_ahead_cond, &read_ahead_lock);
+      sector = read_ahead_queue[read_ahead_head];
+      read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_MAX;
+      read_ahead_cnt--;
+      lock_release (&read_ahead_lock);
+
+      cache_put (cache_get (sector, true));
+    }
+}
+
+/* Reads the sectors of manifest M_ into the cache, in order, and
+   frees M_.  Sectors already cached are left alone. */
+static void
+warm_up (void *m_)
+{
+  struct cache_manifest *m = m_;
+  size_t i;
+
+  block_set_class (BLOCK_CLASS_BACKGROUND);
+  for (i = 0; i < m->cnt; i++)
+    if (m->sectors[i] < block_size (fs_device))
+      cache_put (cache_get (m->sectors[i], true));
+  free (m);
+}
@@ -0,0 +1,36 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Number of sectors held in the buffer cache. */
+#define CACHE_SIZE 64
+
+/* Sector that lists the sectors to read into the cache at boot.
+   It is reserved right after the journal, whose sectors are
+   defined in filesys/journal.h. */
+#define CACHE_MANIFEST_SECTOR (JOURNAL_SECTOR + JOURNAL_SECTORS)
+
+void cache_init (void);
+
+void cache_read (block_sector_t, void *);
+void cache_write (block_sector_t, const void *);
+void cache_read_at (block_sector_t, void *, int sector_ofs, int size);
+void cache_read_direct (block_sector_t, size_t cnt, void *);
+void cache_write_at (block_sector_t, const void *, int sector_ofs, int size);
+void cache_write_file_at (block_sector_t, block_sector_t owner,
+                          const void *, int sector_ofs, int size);
+void cache_write_meta (block_sector_t, const void *);
+void cache_write_meta_at (block_sector_t, const void *,
+                          int sector_ofs, int size);
+size_t cache_meta_dirty_cnt (void);
+
+void cache_read_ahead (block_sector_t);
+void cache_load_manifest (void);
+void cache_save_manifest (void);
+void cache_flush (void);
+void cache_flush_file (block_sector_t owner);
+
+#endif /* filesys/cache.h */
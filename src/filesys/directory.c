@@ -1,10 +1,15 @@
 #include "filesys/directory.h"
+#include <dirent.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/tmpfs.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir 
@@ -19,14 +24,201 @@ struct dir_entry
     block_sector_t inode_sector;        /* Sector number of header. */
     char name[NAME_MAX + 1];            /* Null terminated file name. */
     bool in_use;                        /* In use or free? */
+    bool is_dir;                        /* Is the file a directory? */
   };
 
+/* Directory entries are packed a sector at a time.  Each sector
+   of a directory's data starts with a header, followed by up to
+   DIR_BLOCK_ENTRIES entries, so that no entry straddles two
+   sectors.  A sector whose header says it is full is skipped
+   when looking for a free slot, and one that is empty is skipped
+   when looking for entries. */
+struct dir_header
+  {
+    uint16_t used_cnt;                  /* Number of entries in use. */
+    uint16_t unused;                    /* Padding. */
+  };
+
+/* Number of entries in each sector of a directory. */
+#define DIR_BLOCK_ENTRIES \
+  ((BLOCK_SECTOR_SIZE - sizeof (struct dir_header)) / sizeof (struct dir_entry))
+
+/* One sector of a directory's data. */
+struct dir_block
+  {
+    struct dir_header header;
+    struct dir_entry entries[DIR_BLOCK_ENTRIES];
+  };
+
+/* Maximum number of directories whose entries are cached. */
+#define DIR_CACHE_MAX 16
+
+/* In-memory index of the entries of one directory, built the
+   first time the directory is searched.  It is keyed by the
+   directory's inode sector rather than attached to a `struct
+   dir', so it survives the directory being closed and
+   reopened, as filesys_open() does on every call. */
+struct dir_cache
+  {
+    block_sector_t sector;              /* Directory's inode sector. */
+    struct hash names;                  /* Entries, keyed by name. */
+    off_t free_ofs;                     /* No free slot before this. */
+    struct list_elem lru_elem;          /* Element in dir_caches. */
+  };
+
+/* A cached directory entry. */
+struct dir_cache_entry
+  {
+    struct hash_elem elem;              /* Element in dir_cache's NAMES. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    block_sector_t inode_sector;        /* Sector number of header. */
+    off_t ofs;                          /* Byte offset of the entry. */
+  };
+
+/* Cached directories, most recently used first.
+   dir_cache_lock protects the list and every dir_cache, and
+   makes each directory operation atomic. */
+static struct list dir_caches = LIST_INITIALIZER (dir_caches);
+static struct lock dir_cache_lock;
+static size_t dir_cache_cnt;
+
+static struct dir_cache *dir_cache_get (const struct dir *);
+static struct dir_cache_entry *dir_cache_find (struct dir_cache *,
+                                               const char *);
+static bool dir_cache_insert (struct dir_cache *, const char *,
+                              block_sector_t, off_t);
+static void dir_cache_drop (block_sector_t);
+
+/* Returns the byte offset of slot SLOT of sector BLOCK of a
+   directory.  slot_ofs (cnt / DIR_BLOCK_ENTRIES,
+   cnt % DIR_BLOCK_ENTRIES) is the size of a directory with room
+   for CNT entries. */
+static off_t
+slot_ofs (size_t block, size_t slot)
+{
+  return (block * BLOCK_SECTOR_SIZE + sizeof (struct dir_header)
+          + slot * sizeof (struct dir_entry));
+}
+
+/* Reads the header of sector BLOCK of directory INODE into *H.
+   Returns false if the directory ends before it. */
+static bool
+read_header (struct inode *inode, size_t block, struct dir_header *h)
+{
+  return (inode_read_at (inode, h, sizeof *h, block * BLOCK_SECTOR_SIZE)
+          == sizeof *h);
+}
+
+/* Reads the entry at byte offset OFS in directory INODE into *E.
+   Returns false if the directory ends before it. */
+static bool
+read_entry (struct inode *inode, off_t ofs, struct dir_entry *e)
+{
+  return inode_read_at (inode, e, sizeof *e, ofs) == sizeof *e;
+}
+
+/* Adds DELTA to the number of entries in use in the sector of
+   directory INODE that contains byte offset OFS.
+   Returns true if successful, false on failure. */
+static bool
+adjust_used_cnt (struct inode *inode, off_t ofs, int delta)
+{
+  size_t block = ofs / BLOCK_SECTOR_SIZE;
+  struct dir_header h;
+
+  if (!read_header (inode, block, &h))
+    return false;
+  h.used_cnt += delta;
+  return (inode_write_at (inode, &h, sizeof h, block * BLOCK_SECTOR_SIZE)
+          == sizeof h);
+}
+
+/* Searches directory INODE, from byte offset *POSP onward, for
+   the first entry in use, skipping sectors that have none.  If
+   one is found, stores it in *E, sets *POSP to its offset, and
+   returns true.  Otherwise returns false. */
+static bool
+find_used (struct inode *inode, off_t *posp, struct dir_entry *e)
+{
+  size_t block = *posp / BLOCK_SECTOR_SIZE;
+  off_t ofs = *posp < slot_ofs (block, 0) ? slot_ofs (block, 0) : *posp;
+  struct dir_header h;
+
+  for (; read_header (inode, block, &h); block++, ofs = slot_ofs (block, 0))
+    {
+      if (h.used_cnt == 0)
+        continue;
+      for (; ofs < slot_ofs (block, DIR_BLOCK_ENTRIES); ofs += sizeof *e)
+        {
+          if (!read_entry (inode, ofs, e))
+            return false;
+          if (e->in_use)
+            {
+              *posp = ofs;
+              return true;
+            }
+        }
+    }
+  return false;
+}
+
+/* Returns the offset of the first free slot in directory INODE
+   at or after byte offset OFS, skipping full sectors.  If there
+   is none, returns the offset of the slot that extends the
+   directory. */
+static off_t
+find_free (struct inode *inode, off_t ofs)
+{
+  size_t block = ofs / BLOCK_SECTOR_SIZE;
+  struct dir_header h;
+  struct dir_entry e;
+
+  if (ofs < slot_ofs (block, 0))
+    ofs = slot_ofs (block, 0);
+  for (; read_header (inode, block, &h); block++, ofs = slot_ofs (block, 0))
+    {
+      if (h.used_cnt >= DIR_BLOCK_ENTRIES)
+        continue;
+      for (; ofs < slot_ofs (block, DIR_BLOCK_ENTRIES); ofs += sizeof e)
+        if (!read_entry (inode, ofs, &e) || !e.in_use)
+          return ofs;
+    }
+  return slot_ofs (block, 0);
+}
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  lock_init_named (&dir_cache_lock, "dir_cache");
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, whose parent directory has its inode in sector
+   PARENT.  The new directory starts out with entries "." and
+   "..", for itself and its parent, so that path lookups treat
+   them like any other name.  Returns true if successful, false
+   on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt, block_sector_t parent)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir *dir;
+  bool success;
+
+  off_t size = slot_ofs (entry_cnt / DIR_BLOCK_ENTRIES,
+                         entry_cnt % DIR_BLOCK_ENTRIES);
+
+  ASSERT (sizeof (struct dir_header)
+          + DIR_BLOCK_ENTRIES * sizeof (struct dir_entry) <= BLOCK_SECTOR_SIZE);
+
+  if (!inode_create (sector, size, true))
+    return false;
+  dir = dir_open (inode_open (sector));
+  success = (dir != NULL
+             && dir_add (dir, ".", sector, true)
+             && dir_add (dir, "..", parent, true));
+  dir_close (dir);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -87,20 +279,40 @@ dir_get_inode (struct dir *dir)
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   Must be called with dir_cache_lock held. */
 static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
+  struct dir_cache *dc;
   struct dir_entry e;
-  size_t ofs;
+  off_t ofs;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
+  ASSERT (lock_held_by_current_thread (&dir_cache_lock));
+
+  dc = dir_cache_get (dir);
+  if (dc != NULL)
+    {
+      struct dir_cache_entry *ce = dir_cache_find (dc, name);
+      if (ce == NULL)
+        return false;
+      if (ep != NULL)
+        {
+          ep->inode_sector = ce->inode_sector;
+          strlcpy (ep->name, ce->name, sizeof ep->name);
+          ep->in_use = true;
+        }
+      if (ofsp != NULL)
+        *ofsp = ce->ofs;
+      return true;
+    }
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
+  /* Out of memory for the cache: search the directory itself. */
+  for (ofs = 0; find_used (dir->inode, &ofs, &e); ofs += sizeof e)
+    if (!strcmp (name, e.name)) 
       {
         if (ep != NULL)
           *ep = e;
@@ -114,7 +326,9 @@ lookup (const struct dir *dir, const char *name,
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.  An entry for
+   the directory that tmpfs is mounted on leads to the root of
+   the tmpfs instead. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
@@ -124,23 +338,27 @@ dir_lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  lock_acquire (&dir_cache_lock);
   if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+    *inode = inode_open (tmpfs_cross (e.inode_sector));
   else
     *inode = NULL;
+  lock_release (&dir_cache_lock);
 
   return *inode != NULL;
 }
 
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
-   INODE_SECTOR.
+   INODE_SECTOR, and IS_DIR tells whether it is a directory.
    Returns true if successful, false on failure.
    Fails if NAME is invalid (i.e. too long) or a disk or memory
    error occurs. */
 bool
-dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
+dir_add (struct dir *dir, const char *name, block_sector_t inode_sector,
+         bool is_dir)
 {
+  struct dir_cache *dc;
   struct dir_entry e;
   off_t ofs;
   bool success = false;
@@ -152,38 +370,77 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  lock_acquire (&dir_cache_lock);
+
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
-     current end-of-file.
+     slot past the current end-of-file.  The cache remembers where
+     the last search stopped, so that slots known to be in use are
+     not read again.
      
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  dc = dir_cache_get (dir);
+  ofs = find_free (dir->inode, dc != NULL ? dc->free_ofs : 0);
 
-  /* Write slot. */
+  /* Write slot, then count it in its sector's header.  If the
+     slot starts a new sector, writing it zero-fills the
+     header. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  e.is_dir = is_dir;
+  success = (inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e
+             && adjust_used_cnt (dir->inode, ofs, 1));
+
+  if (dc != NULL && success)
+    {
+      dc->free_ofs = ofs + sizeof e;
+      if (!dir_cache_insert (dc, name, inode_sector, ofs))
+        dir_cache_drop (dc->sector);
+    }
 
  done:
+  lock_release (&dir_cache_lock);
   return success;
 }
 
+/* Returns true if NAME is "." or "..". */
+static bool
+is_dot_name (const char *name)
+{
+  return !strcmp (name, ".") || !strcmp (name, "..");
+}
+
+/* Returns true if directory INODE has no entries other than "."
+   and "..". */
+static bool
+dir_is_empty (struct inode *inode)
+{
+  struct dir_entry e;
+  off_t ofs;
+
+  for (ofs = 0; find_used (inode, &ofs, &e); ofs += sizeof e)
+    if (!is_dot_name (e.name))
+      return false;
+  return true;
+}
+
 /* Removes any entry for NAME in DIR.
-   Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   Returns true if successful, false on failure, which occurs if
+   there is no file with the given NAME, if NAME is "." or "..",
+   or if NAME is a directory that is not empty or that is open
+   elsewhere, for example as some process's working
+   directory. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
+  struct dir_cache *dc;
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
@@ -192,25 +449,53 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (is_dot_name (name))
+    return false;
+
+  lock_acquire (&dir_cache_lock);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
 
-  /* Open inode. */
+  /* Open inode.  Directories are opened through dir_lookup(),
+     which holds dir_cache_lock, so nobody can open this one
+     between the checks and the removal. */
   inode = inode_open (e.inode_sector);
   if (inode == NULL)
     goto done;
+  if (inode_is_dir (inode)
+      && (inode_open_cnt (inode) > 1 || !dir_is_empty (inode)))
+    goto done;
 
   /* Erase directory entry. */
   e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
+  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e
+      || !adjust_used_cnt (dir->inode, ofs, -1))
     goto done;
 
+  /* Forget the entry, and the removed inode's own entries in
+     case it is a directory. */
+  dc = dir_cache_get (dir);
+  if (dc != NULL)
+    {
+      struct dir_cache_entry *ce = dir_cache_find (dc, name);
+      if (ce != NULL)
+        {
+          hash_delete (&dc->names, &ce->elem);
+          free (ce);
+        }
+      if (ofs < dc->free_ofs)
+        dc->free_ofs = ofs;
+    }
+  dir_cache_drop (e.inode_sector);
+
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  lock_release (&dir_cache_lock);
   inode_close (inode);
   return success;
 }
@@ -220,13 +505,24 @@ dir_remove (struct dir *dir, const char *name)
    contains no more entries. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
+{
+  return dir_readdir_at (dir->inode, &dir->pos, name);
+}
+
+/* Reads the next entry of directory INODE from byte offset *POSP
+   onward, stores its name in NAME and advances *POSP past it.
+   "." and ".." are skipped.  Returns true if successful, false
+   if the directory contains no more entries.  This lets a
+   directory open as a file be read with the file's position. */
+bool
+dir_readdir_at (struct inode *inode, off_t *posp, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  while (find_used (inode, posp, &e))
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      *posp += sizeof e;
+      if (!is_dot_name (e.name))
         {
           strlcpy (name, e.name, NAME_MAX + 1);
           return true;
@@ -234,3 +530,233 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
     }
   return false;
 }
+
+/* Reads entries of directory INODE from byte offset *POSP
+   onward into the CNT elements of ENTRIES, skipping "." and "..",
+   and advances *POSP past them.  Returns the number of entries
+   stored, which is less than CNT only at the end of the
+   directory.  The directory is read a whole sector at a time. */
+size_t
+dir_readdir_many (struct inode *inode, off_t *posp, struct dirent *entries,
+                  size_t cnt)
+{
+  struct dir_block b;
+  off_t ofs = *posp;
+  size_t n = 0;
+
+  while (n < cnt)
+    {
+      size_t block = ofs / BLOCK_SECTOR_SIZE;
+      off_t size = inode_read_at (inode, &b, sizeof b,
+                                  block * BLOCK_SECTOR_SIZE);
+      size_t slot, slot_cnt;
+
+      if (size < (off_t) sizeof b.header)
+        break;
+      slot_cnt = (size - sizeof b.header) / sizeof (struct dir_entry);
+      slot = (ofs < slot_ofs (block, 0) ? 0
+              : (ofs - slot_ofs (block, 0)) / sizeof (struct dir_entry));
+      if (b.header.used_cnt == 0 || slot > slot_cnt)
+        slot = slot_cnt;
+      for (; slot < slot_cnt && n < cnt; slot++)
+        {
+          struct dir_entry *e = &b.entries[slot];
+          if (e->in_use && !is_dot_name (e->name))
+            {
+              entries[n].inumber = e->inode_sector;
+              entries[n].is_dir = e->is_dir;
+              strlcpy (entries[n].name, e->name, sizeof entries[n].name);
+              n++;
+            }
+        }
+
+      /* Stop inside this sector if ENTRIES is full or the
+         directory ends in it. */
+      if (slot < slot_cnt || slot_cnt < DIR_BLOCK_ENTRIES)
+        {
+          ofs = slot_ofs (block, slot);
+          break;
+        }
+      ofs = slot_ofs (block + 1, 0);
+    }
+  *posp = ofs;
+  return n;
+}
+
+/* Returns a hash value for dir_cache_entry E. */
+static unsigned
+dir_cache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dir_cache_entry *ce
+    = hash_entry (e, struct dir_cache_entry, elem);
+  return hash_string (ce->name);
+}
+
+/* Returns true if dir_cache_entry A precedes B. */
+static bool
+dir_cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                void *aux UNUSED)
+{
+  const struct dir_cache_entry *a
+    = hash_entry (a_, struct dir_cache_entry, elem);
+  const struct dir_cache_entry *b
+    = hash_entry (b_, struct dir_cache_entry, elem);
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Frees dir_cache_entry E. */
+static void
+dir_cache_free_entry (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct dir_cache_entry, elem));
+}
+
+/* Frees DC, which must already be off the dir_caches list. */
+static void
+dir_cache_free (struct dir_cache *dc)
+{
+  hash_destroy (&dc->names, dir_cache_free_entry);
+  free (dc);
+  dir_cache_cnt--;
+}
+
+/* Returns the entry for NAME in DC, or a null pointer if there
+   is none. */
+static struct dir_cache_entry *
+dir_cache_find (struct dir_cache *dc, const char *name)
+{
+  struct dir_cache_entry key;
+  struct hash_elem *e;
+
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dc->names, &key.elem);
+  return e != NULL ? hash_entry (e, struct dir_cache_entry, elem) : NULL;
+}
+
+/* Adds an entry for NAME, stored at byte offset OFS and
+   referring to INODE_SECTOR, to DC.
+   Returns false if memory allocation fails. */
+static bool
+dir_cache_insert (struct dir_cache *dc, const char *name,
+                  block_sector_t inode_sector, off_t ofs)
+{
+  struct dir_cache_entry *ce = malloc (sizeof *ce);
+  if (ce == NULL)
+    return false;
+
+  strlcpy (ce->name, name, sizeof ce->name);
+  ce->inode_sector = inode_sector;
+  ce->ofs = ofs;
+  hash_insert (&dc->names, &ce->elem);
+  return true;
+}
+
+/* Discards the cached entries of the directory whose inode is
+   in SECTOR, if any. */
+static void
+dir_cache_drop (block_sector_t sector)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&dir_caches); e != list_end (&dir_caches);
+       e = list_next (e))
+    {
+      struct dir_cache *dc = list_entry (e, struct dir_cache, lru_elem);
+      if (dc->sector == sector)
+        {
+          list_remove (&dc->lru_elem);
+          dir_cache_free (dc);
+          return;
+        }
+    }
+}
+
+/* Returns the entry cache for DIR, reading the whole directory
+   to build it if it isn't cached yet.  Returns a null pointer if
+   memory allocation fails.
+   Must be called with dir_cache_lock held. */
+static struct dir_cache *
+dir_cache_get (const struct dir *dir)
+{
+  block_sector_t sector = inode_get_inumber (dir->inode);
+  struct dir_cache *dc;
+  struct list_elem *e;
+  struct dir_block b;
+  size_t block;
+
+  ASSERT (lock_held_by_current_thread (&dir_cache_lock));
+
+  for (e = list_begin (&dir_caches); e != list_end (&dir_caches);
+       e = list_next (e))
+    {
+      dc = list_entry (e, struct dir_cache, lru_elem);
+      if (dc->sector == sector)
+        {
+          /* Move to front of the LRU list. */
+          list_remove (&dc->lru_elem);
+          list_push_front (&dir_caches, &dc->lru_elem);
+          return dc;
+        }
+    }
+
+  /* Make room by discarding the least recently used cache. */
+  if (dir_cache_cnt >= DIR_CACHE_MAX)
+    {
+      dc = list_entry (list_pop_back (&dir_caches), struct dir_cache,
+                       lru_elem);
+      dir_cache_free (dc);
+    }
+
+  dc = malloc (sizeof *dc);
+  if (dc == NULL)
+    return NULL;
+  if (!hash_init (&dc->names, dir_cache_hash, dir_cache_less, NULL))
+    {
+      free (dc);
+      return NULL;
+    }
+  dc->sector = sector;
+  dir_cache_cnt++;
+
+  /* Index every entry in use and note the first free slot,
+     reading the directory a sector at a time.  Once the index
+     exists, it answers lookups of names that are not in the
+     directory too, without reading it again. */
+  dc->free_ofs = -1;
+  for (block = 0; ; block++)
+    {
+      off_t size = inode_read_at (dir->inode, &b, sizeof b,
+                                  block * BLOCK_SECTOR_SIZE);
+      size_t slot, slot_cnt;
+
+      if (size < (off_t) sizeof b.header)
+        break;
+      slot_cnt = (size - sizeof b.header) / sizeof (struct dir_entry);
+      for (slot = 0; slot < slot_cnt; slot++)
+        {
+          struct dir_entry *de = &b.entries[slot];
+          if (!de->in_use)
+            {
+              if (dc->free_ofs < 0)
+                dc->free_ofs = slot_ofs (block, slot);
+            }
+          else if (!dir_cache_insert (dc, de->name, de->inode_sector,
+                                      slot_ofs (block, slot)))
+            {
+              dir_cache_free (dc);
+              return NULL;
+            }
+        }
+      if (slot_cnt < DIR_BLOCK_ENTRIES)
+        break;
+    }
+
+  /* Without a free slot, one is added past the last, possibly in
+     the directory's last sector. */
+  if (dc->free_ofs < 0)
+    dc->free_ofs = (slot_ofs (block, 0) <= inode_length (dir->inode)
+                    ? inode_length (dir->inode) : slot_ofs (block, 0));
+
+  list_push_front (&dir_caches, &dc->lru_elem);
+  return dc;
+}
@@ -1,5 +1,6 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "devices/block.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
@@ -9,6 +10,7 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    bool append;                /* Do writes go to end of file? */
   };
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -23,6 +25,7 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->append = false;
       return file;
     }
   else
@@ -84,27 +87,40 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
   return inode_read_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Like file_read_at(), but the data is not kept in the buffer
+   cache, for a caller that keeps it itself. */
+off_t
+file_read_direct (struct file *file, void *buffer, off_t size,
+                  off_t file_ofs)
+{
+  return inode_read_direct (file->inode, buffer, size, file_ofs);
+}
+
 /* Writes SIZE bytes from BUFFER into FILE,
-   starting at the file's current position.
+   starting at the file's current position, or at end of file in
+   one step if FILE is in append mode.
+   Writing past end of file grows the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
-   Advances FILE's position by the number of bytes read. */
+   which may be less than SIZE if the disk is full.
+   Advances FILE's position to the end of the bytes written. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
 {
-  off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+  off_t bytes_written;
+
+  if (file->append)
+    bytes_written = inode_append (file->inode, buffer, size, &file->pos);
+  else
+    bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_written;
   return bytes_written;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
+   Writing past end of file grows the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -113,6 +129,92 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Copies up to SIZE bytes from SRC, starting at its current
+   position, to DST at its current position, advancing both.
+   Returns the number of bytes copied, which is less than SIZE if
+   SRC ends or DST cannot grow.
+
+   The data moves one sector at a time through a buffer on the
+   kernel stack, with each chunk ending on a sector boundary of
+   SRC so that each read touches a single cache entry. */
+off_t
+file_copy (struct file *dst, struct file *src, off_t size)
+{
+  uint8_t buffer[BLOCK_SECTOR_SIZE];
+  off_t bytes_copied = 0;
+
+  ASSERT (dst != NULL);
+  ASSERT (src != NULL);
+
+  while (size > 0)
+    {
+      off_t chunk_size = BLOCK_SECTOR_SIZE - src->pos % BLOCK_SECTOR_SIZE;
+      off_t bytes_read, bytes_written;
+
+      if (chunk_size > size)
+        chunk_size = size;
+      bytes_read = file_read (src, buffer, chunk_size);
+      if (bytes_read == 0)
+        break;
+      bytes_written = file_write (dst, buffer, bytes_read);
+      bytes_copied += bytes_written;
+      if (bytes_written < bytes_read)
+        {
+          src->pos -= bytes_read - bytes_written;
+          break;
+        }
+      size -= bytes_read;
+    }
+  return bytes_copied;
+}
+
+/* Writes FILE's data and metadata to disk. */
+void
+file_sync (struct file *file)
+{
+  ASSERT (file != NULL);
+  inode_sync (file->inode);
+}
+
+/* Allocates unwritten, zero-reading sectors for bytes OFS up to
+   OFS + LEN of FILE, growing FILE if needed.  Returns false if
+   writes are denied or the disk is full. */
+bool
+file_allocate (struct file *file, off_t ofs, off_t len)
+{
+  ASSERT (file != NULL);
+  return inode_allocate (file->inode, ofs, len);
+}
+
+/* Frees the sectors of bytes OFS up to OFS + LEN of FILE, which
+   read as zeros afterward.  Returns false if writes are
+   denied. */
+bool
+file_punch_hole (struct file *file, off_t ofs, off_t len)
+{
+  ASSERT (file != NULL);
+  return inode_punch (file->inode, ofs, len);
+}
+
+/* Puts FILE in append mode if APPEND is true, so that
+   file_write() goes to end of file even if other openers grow
+   it, or takes it out of append mode otherwise.  Writes at a
+   given offset are not affected. */
+void
+file_set_append (struct file *file, bool append)
+{
+  ASSERT (file != NULL);
+  file->append = append;
+}
+
+/* Returns true if FILE is in append mode. */
+bool
+file_is_append (struct file *file)
+{
+  ASSERT (file != NULL);
+  return file->append;
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
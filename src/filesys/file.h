@@ -1,10 +1,17 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <stdbool.h>
 #include "filesys/off_t.h"
 
 struct inode;
 
+/* Mode flag of file space requests, as in lib/user/syscall.h. */
+#define FALLOC_PUNCH_HOLE 1     /* Free the range instead. */
+
+/* Flag of open_flags(), as in lib/user/syscall.h. */
+#define O_APPEND 1              /* Every write goes to end of file. */
+
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
@@ -14,8 +21,17 @@ struct inode *file_get_inode (struct file *);
 /* Reading and writing. */
 off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
+off_t file_read_direct (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+off_t file_copy (struct file *dst, struct file *src, off_t size);
+void file_sync (struct file *);
+bool file_allocate (struct file *, off_t ofs, off_t len);
+bool file_punch_hole (struct file *, off_t ofs, off_t len);
+
+/* Appending. */
+void file_set_append (struct file *, bool);
+bool file_is_append (struct file *);
 
 /* Preventing writes. */
 void file_deny_write (struct file *);
@@ -2,15 +2,23 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "filesys/tmpfs.h"
+#include "threads/thread.h"
+#include "userprog/process.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
 static void do_format (void);
+static bool allocate_inode (struct dir *, bool is_dir, block_sector_t *);
+static void release_inode (block_sector_t);
+static struct dir *resolve (const char *path, char name[NAME_MAX + 1]);
 
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
@@ -21,44 +29,94 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  dir_init ();
+  tmpfs_init ();
+  journal_init (format);
   free_map_init ();
 
   if (format) 
     do_format ();
 
   free_map_open ();
+  if (!format)
+    cache_load_manifest ();
 }
 
 /* Shuts down the file system module, writing any unwritten data
-   to disk. */
+   to disk.  free_map_close() writes the whole cache. */
 void
 filesys_done (void) 
 {
+  cache_save_manifest ();
   free_map_close ();
 }
+
+/* Writes all modified file system data and metadata to disk. */
+void
+filesys_sync (void)
+{
+  free_map_flush ();
+}
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
+   NAME is a path, relative to the current process's working
+   directory unless it starts with "/".
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
    or if internal memory allocation fails. */
 bool
 filesys_create (const char *name, off_t initial_size) 
 {
+  char last[NAME_MAX + 1];
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = resolve (name, last);
+  success = (dir != NULL
+             && allocate_inode (dir, false, &inode_sector)
+             && inode_create (inode_sector, initial_size, false)
+             && dir_add (dir, last, inode_sector, false));
   if (!success && inode_sector != 0) 
-    free_map_release (inode_sector, 1);
+    release_inode (inode_sector);
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
 
-/* Opens the file with the given NAME.
+/* Creates a directory named NAME, a path like that of
+   filesys_create().  Returns true if successful, false
+   otherwise.  Fails if a file named NAME already exists, or if
+   internal memory allocation fails. */
+bool
+filesys_mkdir (const char *name)
+{
+  char last[NAME_MAX + 1];
+  block_sector_t inode_sector = 0;
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = resolve (name, last);
+  success = (dir != NULL
+             && allocate_inode (dir, true, &inode_sector)
+             && dir_create (inode_sector, 16,
+                            inode_get_inumber (dir_get_inode (dir)))
+             && dir_add (dir, last, inode_sector, true));
+  if (!success && inode_sector != 0) 
+    release_inode (inode_sector);
+  dir_close (dir);
+  journal_end ();
+
+  return success;
+}
+
+/* Opens the file with the given NAME, a path like that of
+   filesys_create().  A directory may be opened too.
    Returns the new file if successful or a null pointer
    otherwise.
    Fails if no file named NAME exists,
@@ -66,37 +124,185 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
+  char last[NAME_MAX + 1];
+  struct dir *dir = resolve (name, last);
   struct inode *inode = NULL;
 
   if (dir != NULL)
-    dir_lookup (dir, name, &inode);
+    dir_lookup (dir, last, &inode);
   dir_close (dir);
 
   return file_open (inode);
 }
 
-/* Deletes the file named NAME.
+/* Deletes the file named NAME, a path like that of
+   filesys_create().
    Returns true if successful, false on failure.
-   Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   Fails if no file named NAME exists, if NAME is a directory
+   that is not empty or in use, or if an internal memory
+   allocation fails. */
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char last[NAME_MAX + 1];
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = resolve (name, last);
+  success = dir != NULL && dir_remove (dir, last);
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
-
+
+/* Makes directory NAME, a path like that of filesys_create(),
+   the current process's working directory.  Returns true if
+   successful, false if NAME does not exist or is not a
+   directory. */
+bool
+filesys_chdir (const char *name)
+{
+  struct thread *cur = process_current ();
+  char last[NAME_MAX + 1];
+  struct dir *dir = resolve (name, last);
+  struct inode *inode = NULL;
+
+  if (dir != NULL)
+    dir_lookup (dir, last, &inode);
+  dir_close (dir);
+
+  if (inode == NULL || !inode_is_dir (inode))
+    {
+      inode_close (inode);
+      return false;
+    }
+  dir = dir_open (inode);
+  if (dir == NULL)
+    return false;
+  dir_close (cur->cwd);
+  cur->cwd = dir;
+  return true;
+}
+
+/* Allocates an inode number for a new file or, if IS_DIR is
+   true, directory in DIR and stores it into *SECTORP: a sector
+   near DIR's on disk, or a tmpfs inode number for a file in
+   tmpfs.  Returns false if none is left. */
+static bool
+allocate_inode (struct dir *dir, bool is_dir, block_sector_t *sectorp)
+{
+  struct inode *parent = dir_get_inode (dir);
+
+  if (tmpfs_is_inumber (inode_get_inumber (parent)))
+    return tmpfs_allocate_inumber (sectorp);
+  return free_map_allocate_inode (parent, is_dir, sectorp);
+}
+
+/* Releases inode number SECTOR from allocate_inode() after a
+   failure to create its file. */
+static void
+release_inode (block_sector_t sector)
+{
+  if (tmpfs_is_inumber (sector))
+    tmpfs_release (sector);
+  else
+    free_map_release (sector, 1);
+}
+
+/* Copies the first file name component of *SRCP into PART and
+   advances *SRCP past it.  Returns 1 if successful, 0 at the end
+   of the string, or -1 if the component is longer than
+   NAME_MAX. */
+static int
+next_part (char part[NAME_MAX + 1], const char **srcp)
+{
+  const char *src = *srcp;
+  char *dst = part;
+
+  while (*src == '/')
+    src++;
+  if (*src == '\0')
+    return 0;
+
+  while (*src != '/' && *src != '\0')
+    {
+      if (dst == part + NAME_MAX)
+        return -1;
+      *dst++ = *src++;
+    }
+  *dst = '\0';
+  *srcp = src;
+  return 1;
+}
+
+/* Walks PATH, which is relative to the current process's working
+   directory unless it starts with "/", up to its last
+   component.  Returns the directory that should contain the last
+   component, which the caller must close, and copies the last
+   component into NAME.  A path with no components, such as "/",
+   names the directory itself, as ".".  Returns a null pointer if
+   PATH is empty, if a component is too long, or if a directory
+   along the way does not exist.
+
+   Each step is a dir_lookup(), which is served from the
+   directory entry cache, and relative paths start from the
+   working directory's already open inode, so resolving a deep
+   path rarely reads a directory from disk. */
+static struct dir *
+resolve (const char *path, char name[NAME_MAX + 1])
+{
+  struct thread *cur = process_current ();
+  char next[NAME_MAX + 1];
+  struct dir *dir;
+  int result;
+
+  if (*path == '\0')
+    return NULL;
+  if (*path == '/' || cur->cwd == NULL)
+    dir = dir_open_root ();
+  else
+    dir = dir_reopen (cur->cwd);
+  if (dir == NULL)
+    return NULL;
+
+  result = next_part (name, &path);
+  if (result == 0)
+    strlcpy (name, ".", NAME_MAX + 1);
+  while (result > 0 && (result = next_part (next, &path)) > 0)
+    {
+      struct inode *inode;
+
+      /* NAME is not the last component, so descend into it. */
+      if (!dir_lookup (dir, name, &inode))
+        break;
+      dir_close (dir);
+      if (!inode_is_dir (inode))
+        {
+          inode_close (inode);
+          return NULL;
+        }
+      dir = dir_open (inode);
+      if (dir == NULL)
+        return NULL;
+      strlcpy (name, next, NAME_MAX + 1);
+    }
+  if (result != 0)
+    {
+      dir_close (dir);
+      return NULL;
+    }
+  return dir;
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, 16, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
   free_map_close ();
   printf ("done.\n");
@@ -1,12 +1,70 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/cache.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Number of sectors summarized by each entry of chunk_free. */
+#define FREE_MAP_CHUNK 256
+
+/* Number of sectors in each block group, a multiple of
+   FREE_MAP_CHUNK. */
+#define FREE_MAP_GROUP 4096
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Protects all of the above. */
+
+/* The free map is not written to its file on every change.
+   Instead it is marked dirty and written out by free_map_flush(),
+   which the buffer cache's write-behind thread calls periodically.
+
+   The free map is metadata, so it is written as part of a journal
+   commit, which free_map_flush() performs.  Released sectors are
+   not freed at once.  They stay marked in FREE_MAP, and are also
+   marked in RELEASED, until free_map_flush() has committed the
+   metadata that no longer refers to them.  Otherwise a sector
+   could be reused, and overwritten, while the committed
+   metadata on disk still refers to it. */
+static struct bitmap *released;      /* Released, not yet reusable. */
+static size_t released_cnt;          /* Number of bits set in RELEASED. */
+static bool free_map_dirty;          /* Changed since last written? */
+
+/* Number of free sectors in each FREE_MAP_CHUNK-sector chunk of
+   the disk, so that full stretches of the disk can be skipped
+   without looking at their bits. */
+static size_t *chunk_free;
+static size_t chunk_cnt;
+
+/* Next-fit cursor: the search for free sectors starts just past
+   the last allocation, which keeps sectors allocated one after
+   another close together on disk. */
+static block_sector_t next_fit;
+
+/* The disk is divided into block groups of FREE_MAP_GROUP sectors
+   each, which keep related sectors together.  A new file's inode
+   goes in the group of its directory, as early in the group as
+   there is room, so that the inodes of a directory's files
+   gather at the group's start; a new directory's inode goes in
+   the group with the most free sectors, so that directories, and
+   the files in them, are spread over the disk.  The data of a
+   file is then allocated starting at its inode. */
+static size_t group_cnt;
+
+static void count_free (void);
+static void adjust_free (block_sector_t, size_t, bool allocated);
+static block_sector_t scan_from (block_sector_t, size_t);
+static block_sector_t find_free (block_sector_t, size_t);
+static bool allocate (block_sector_t, size_t, block_sector_t *);
+static size_t emptiest_group (void);
+static void reclaim_released (void);
+static bool write_free_map (void);
 
 /* Initializes the free map. */
 void
@@ -15,38 +73,108 @@ free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  released = bitmap_create (bitmap_size (free_map));
+  if (released == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  released_cnt = 0;
+  free_map_dirty = false;
+  lock_init_named (&free_map_lock, "free_map");
+  chunk_cnt = DIV_ROUND_UP (bitmap_size (free_map), FREE_MAP_CHUNK);
+  chunk_free = malloc (chunk_cnt * sizeof *chunk_free);
+  if (chunk_free == NULL)
+    PANIC ("free map summary allocation failed");
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), FREE_MAP_GROUP);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  bitmap_mark (free_map, CACHE_MANIFEST_SECTOR);
+  count_free ();
+  next_fit = 0;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.  Sectors released since the last
+   commit are not available yet: the caller is in the middle of
+   an operation, so the commit that would free them cannot be
+   made now. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
-    }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = allocate (find_free (next_fit, cnt), cnt, sectorp);
+  lock_release (&free_map_lock);
+
+  return success;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Allocates CNT consecutive sectors like free_map_allocate(), but
+   as close after sector GOAL as possible, for data that belongs
+   with GOAL's. */
+bool
+free_map_allocate_near (size_t cnt, block_sector_t goal,
+                        block_sector_t *sectorp)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = allocate (find_free (goal % bitmap_size (free_map), cnt),
+                      cnt, sectorp);
+  lock_release (&free_map_lock);
+
+  return success;
+}
+
+/* Allocates a sector for the inode of a new file, or of a new
+   directory if IS_DIR is true, in directory PARENT, and stores it
+   into *SECTORP.  Returns false if the disk is full. */
+bool
+free_map_allocate_inode (const struct inode *parent, bool is_dir,
+                         block_sector_t *sectorp)
+{
+  size_t group;
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  group = (is_dir ? emptiest_group ()
+           : inode_get_inumber (parent) / FREE_MAP_GROUP);
+  success = allocate (find_free (group * FREE_MAP_GROUP, 1), 1, sectorp);
+  lock_release (&free_map_lock);
+
+  return success;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use.
+   They can be allocated again once the next free_map_flush() has
+   written the metadata that used to refer to them. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  ASSERT (bitmap_none (released, sector, cnt));
+  bitmap_set_multiple (released, sector, cnt, true);
+  released_cnt += cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Commits the free map and all other metadata to the journal and
+   writes every dirty cached sector to disk.  Afterward, sectors
+   released before the call become free for reuse. */
+void
+free_map_flush (void)
+{
+  journal_begin_commit ();
+  lock_acquire (&free_map_lock);
+  if (free_map_dirty && write_free_map ())
+    free_map_dirty = false;
+  cache_flush ();
+  reclaim_released ();
+  lock_release (&free_map_lock);
+  journal_end_commit ();
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,13 +186,27 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_free ();
 }
 
-/* Writes the free map to disk and closes the free map file. */
+/* Writes the free map to disk and closes the free map file, and
+   writes every other dirty cached sector to disk as well.  The
+   file system must be otherwise idle, so every released sector
+   is freed first. */
 void
 free_map_close (void) 
 {
+  journal_begin_commit ();
+  lock_acquire (&free_map_lock);
+  reclaim_released ();
+  if (free_map_dirty && !write_free_map ())
+    PANIC ("can't write free map");
+  free_map_dirty = false;
   file_close (free_map_file);
+  free_map_file = NULL;
+  cache_flush ();
+  lock_release (&free_map_lock);
+  journal_end_commit ();
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -73,7 +215,7 @@ void
 free_map_create (void) 
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
@@ -83,3 +225,152 @@ free_map_create (void)
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
+
+/* Returns the first sector of a run of CNT free sectors, searching
+   from sector START and wrapping around to the start of the disk,
+   or BITMAP_ERROR if there is no such run.
+   Must be called with free_map_lock held. */
+static block_sector_t
+find_free (block_sector_t start, size_t cnt)
+{
+  block_sector_t sector = scan_from (start, cnt);
+  if (sector == BITMAP_ERROR && start != 0)
+    sector = scan_from (0, cnt);
+  return sector;
+}
+
+/* Marks the CNT sectors starting at SECTOR allocated and stores
+   SECTOR into *SECTORP.  Returns false, doing nothing, if SECTOR
+   is BITMAP_ERROR.
+   Must be called with free_map_lock held. */
+static bool
+allocate (block_sector_t sector, size_t cnt, block_sector_t *sectorp)
+{
+  if (sector == BITMAP_ERROR)
+    return false;
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  adjust_free (sector, cnt, true);
+  next_fit = (sector + cnt) % bitmap_size (free_map);
+  free_map_dirty = true;
+  *sectorp = sector;
+  return true;
+}
+
+/* Returns the block group with the most free sectors, the first
+   one of them if there is a tie.
+   Must be called with free_map_lock held. */
+static size_t
+emptiest_group (void)
+{
+  size_t best = 0, best_free = 0;
+  size_t group;
+
+  for (group = 0; group < group_cnt; group++)
+    {
+      size_t first = group * (FREE_MAP_GROUP / FREE_MAP_CHUNK);
+      size_t last = first + FREE_MAP_GROUP / FREE_MAP_CHUNK;
+      size_t free_cnt = 0;
+      size_t chunk;
+
+      for (chunk = first; chunk < last && chunk < chunk_cnt; chunk++)
+        free_cnt += chunk_free[chunk];
+      if (free_cnt > best_free)
+        {
+          best = group;
+          best_free = free_cnt;
+        }
+    }
+  return best;
+}
+
+/* Frees the sectors marked in RELEASED.
+   Must be called with free_map_lock held. */
+static void
+reclaim_released (void)
+{
+  size_t start = 0;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+  while (released_cnt > 0)
+    {
+      size_t end;
+
+      start = bitmap_scan (released, start, 1, true);
+      ASSERT (start != BITMAP_ERROR);
+      for (end = start + 1; end < bitmap_size (released); end++)
+        if (!bitmap_test (released, end))
+          break;
+
+      bitmap_set_multiple (released, start, end - start, false);
+      bitmap_set_multiple (free_map, start, end - start, false);
+      adjust_free (start, end - start, false);
+      released_cnt -= end - start;
+      free_map_dirty = true;
+      start = end;
+    }
+}
+
+/* Writes the free map to its file, if it is open.
+   Returns false if the file could not be written.
+   Must be called with free_map_lock held. */
+static bool
+write_free_map (void)
+{
+  return free_map_file == NULL || bitmap_write (free_map, free_map_file);
+}
+
+/* Recomputes every entry of chunk_free from the bitmap. */
+static void
+count_free (void)
+{
+  size_t bit_cnt = bitmap_size (free_map);
+  size_t i;
+
+  for (i = 0; i < chunk_cnt; i++)
+    {
+      size_t start = i * FREE_MAP_CHUNK;
+      size_t len = bit_cnt - start < FREE_MAP_CHUNK
+                   ? bit_cnt - start : FREE_MAP_CHUNK;
+      chunk_free[i] = bitmap_count (free_map, start, len, false);
+    }
+}
+
+/* Updates chunk_free for CNT sectors starting at SECTOR that
+   were just allocated, if ALLOCATED is true, or released. */
+static void
+adjust_free (block_sector_t sector, size_t cnt, bool allocated)
+{
+  while (cnt > 0)
+    {
+      size_t chunk = sector / FREE_MAP_CHUNK;
+      size_t chunk_left = FREE_MAP_CHUNK - sector % FREE_MAP_CHUNK;
+      size_t n = cnt < chunk_left ? cnt : chunk_left;
+
+      if (allocated)
+        {
+          ASSERT (chunk_free[chunk] >= n);
+          chunk_free[chunk] -= n;
+        }
+      else
+        chunk_free[chunk] += n;
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Returns the first sector of a run of CNT free sectors at or
+   after START, or BITMAP_ERROR if there is none.  Chunks with no
+   free sectors are skipped using chunk_free. */
+static block_sector_t
+scan_from (block_sector_t start, size_t cnt)
+{
+  size_t chunk = start / FREE_MAP_CHUNK;
+
+  while (chunk < chunk_cnt && chunk_free[chunk] == 0)
+    chunk++;
+  if (chunk >= chunk_cnt)
+    return BITMAP_ERROR;
+  if (chunk * FREE_MAP_CHUNK > start)
+    start = chunk * FREE_MAP_CHUNK;
+  return bitmap_scan (free_map, start, cnt, false);
+}
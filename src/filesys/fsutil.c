@@ -1,16 +1,36 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ustar.h>
+#include "devices/timer.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
+/* Seconds between passes of the background defragmenter. */
+#define DEFRAG_INTERVAL 30
+
+/* Totals of a defragmentation pass. */
+struct defrag_stats
+  {
+    int files;                  /* Regular files looked at. */
+    int before;                 /* Their fragments before the pass. */
+    int after;                  /* Their fragments after the pass. */
+    int busy;                   /* Files that could not be moved. */
+  };
+
+static void defrag_tree (struct inode *, const char *name,
+                         struct defrag_stats *, bool verbose);
+static thread_func defrag_daemon;
+
 /* List files in the root directory. */
 void
 fsutil_ls (char **argv UNUSED) 
@@ -76,9 +96,9 @@ fsutil_extract (char **argv UNUSED)
   struct block *src;
   void *header, *data;
 
-  /* Allocate buffers. */
+  /* Allocate buffers.  File data is read a page at a time. */
   header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
+  data = palloc_get_page (0);
   if (header == NULL || data == NULL)
     PANIC ("couldn't allocate buffers");
 
@@ -123,13 +143,18 @@ fsutil_extract (char **argv UNUSED)
           if (dst == NULL)
             PANIC ("%s: open failed", file_name);
 
-          /* Do copy. */
+          /* Do copy, as many sectors at a time as fit in DATA.
+             The file's sectors were allocated by filesys_create()
+             without being zeroed, and whole-sector writes fill
+             them in the buffer cache without reading them. */
           while (size > 0)
             {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
-                                : size);
-              block_read (src, sector++, data);
+              int chunk_size = size > PGSIZE ? PGSIZE : size;
+              size_t chunk_sectors = DIV_ROUND_UP (chunk_size,
+                                                   BLOCK_SECTOR_SIZE);
+
+              block_read_multi (src, sector, chunk_sectors, data);
+              sector += chunk_sectors;
               if (file_write (dst, data, chunk_size) != chunk_size)
                 PANIC ("%s: write failed with %d bytes unwritten",
                        file_name, size);
@@ -150,7 +175,7 @@ fsutil_extract (char **argv UNUSED)
   block_write (src, 0, header);
   block_write (src, 1, header);
 
-  free (data);
+  palloc_free_page (data);
   free (header);
 }
 
@@ -168,15 +193,16 @@ fsutil_append (char **argv)
   static block_sector_t sector = 0;
 
   const char *file_name = argv[1];
-  void *buffer;
+  char *buffer;
   struct file *src;
   struct block *dst;
-  off_t size;
+  off_t size, ofs;
+  size_t used;
 
   printf ("Appending '%s' to ustar archive on scratch device...\n", file_name);
 
-  /* Allocate buffer. */
-  buffer = malloc (BLOCK_SECTOR_SIZE);
+  /* Allocate buffer.  Data is copied a page at a time. */
+  buffer = palloc_get_page (0);
   if (buffer == NULL)
     PANIC ("couldn't allocate buffer");
 
@@ -191,32 +217,135 @@ fsutil_append (char **argv)
   if (dst == NULL)
     PANIC ("couldn't open scratch device");
   
-  /* Write ustar header to first sector. */
+  /* Make the ustar header, which goes out in the same transfer as
+     the start of the data. */
   if (!ustar_make_header (file_name, USTAR_REGULAR, size, buffer))
     PANIC ("%s: name too long for ustar format", file_name);
-  block_write (dst, sector++, buffer);
+  used = BLOCK_SECTOR_SIZE;
 
-  /* Do copy. */
-  while (size > 0) 
+  /* Do copy.  The data is read around the buffer cache, which it
+     would only flush, and each page is written to the scratch
+     device in one request, the last one padded with zeros to a
+     whole sector. */
+  for (ofs = 0; ofs < size || used > 0; ofs += PGSIZE - used, used = 0)
     {
-      int chunk_size = size > BLOCK_SECTOR_SIZE ? BLOCK_SECTOR_SIZE : size;
-      if (sector >= block_size (dst))
+      off_t chunk_size = size - ofs < (off_t) (PGSIZE - used)
+                         ? size - ofs : (off_t) (PGSIZE - used);
+      size_t sectors = DIV_ROUND_UP (used + chunk_size, BLOCK_SECTOR_SIZE);
+
+      if (sector + sectors > block_size (dst))
         PANIC ("%s: out of space on scratch device", file_name);
-      if (file_read (src, buffer, chunk_size) != chunk_size)
-        PANIC ("%s: read failed with %"PROTd" bytes unread", file_name, size);
-      memset (buffer + chunk_size, 0, BLOCK_SECTOR_SIZE - chunk_size);
-      block_write (dst, sector++, buffer);
-      size -= chunk_size;
+      if (file_read_direct (src, buffer + used, chunk_size, ofs)
+          != chunk_size)
+        PANIC ("%s: read failed with %"PROTd" bytes unread", file_name,
+               size - ofs);
+      memset (buffer + used + chunk_size, 0,
+              sectors * BLOCK_SECTOR_SIZE - used - chunk_size);
+      block_write_multi (dst, sector, sectors, buffer);
+      sector += sectors;
     }
 
   /* Write ustar end-of-archive marker, which is two consecutive
      sectors full of zeros.  Don't advance our position past
      them, though, in case we have more files to append. */
-  memset (buffer, 0, BLOCK_SECTOR_SIZE);
-  block_write (dst, sector, buffer);
-  block_write (dst, sector, buffer + 1);
+  if (sector + 2 > block_size (dst))
+    PANIC ("%s: out of space on scratch device", file_name);
+  memset (buffer, 0, 2 * BLOCK_SECTOR_SIZE);
+  block_write_multi (dst, sector, 2, buffer);
 
   /* Finish up. */
   file_close (src);
-  free (buffer);
+  palloc_free_page (buffer);
+}
+
+/* Defragments file ARGV[1], or every file under it if it is a
+   directory, and reports how many runs of consecutive sectors
+   the files were in before and after.  A file open elsewhere is
+   left alone. */
+void
+fsutil_defrag (char **argv)
+{
+  const char *file_name = argv[1];
+  struct defrag_stats stats = { 0, 0, 0, 0 };
+  struct file *file;
+
+  printf ("Defragmenting '%s'...\n", file_name);
+  file = filesys_open (file_name);
+  if (file == NULL)
+    PANIC ("%s: open failed", file_name);
+  defrag_tree (file_get_inode (file), file_name, &stats, true);
+  file_close (file);
+  printf ("%d file(s): %d fragment(s) before, %d after, %d busy.\n",
+          stats.files, stats.before, stats.after, stats.busy);
+}
+
+/* Starts a thread that defragments the whole file system every
+   DEFRAG_INTERVAL seconds, at the lowest priority. */
+void
+fsutil_defrag_start (void)
+{
+  thread_create ("defrag", PRI_MIN, defrag_daemon, NULL);
+}
+
+/* Defragments INODE, named NAME, or every file under it if it is
+   a directory, adding to STATS.  If VERBOSE, prints a line for
+   each fragmented file. */
+static void
+defrag_tree (struct inode *inode, const char *name,
+             struct defrag_stats *stats, bool verbose)
+{
+  if (inode_is_dir (inode))
+    {
+      struct dir *dir = dir_open (inode_reopen (inode));
+      char entry[NAME_MAX + 1];
+
+      if (dir == NULL)
+        return;
+      while (dir_readdir (dir, entry))
+        {
+          struct inode *child;
+
+          if (dir_lookup (dir, entry, &child))
+            {
+              defrag_tree (child, entry, stats, verbose);
+              inode_close (child);
+            }
+        }
+      dir_close (dir);
+    }
+  else
+    {
+      int before = inode_fragments (inode);
+      bool moved = before <= 1 || inode_defrag (inode);
+      int after = before <= 1 ? before : inode_fragments (inode);
+
+      stats->files++;
+      stats->before += before;
+      stats->after += after;
+      if (!moved)
+        stats->busy++;
+      if (verbose && before > 1)
+        printf ("%s: %d fragment(s) before, %d after%s\n",
+                name, before, after, moved ? "" : ", busy");
+    }
+}
+
+/* Defragments the file system every DEFRAG_INTERVAL seconds. */
+static void
+defrag_daemon (void *aux UNUSED)
+{
+  block_set_class (BLOCK_CLASS_BACKGROUND);
+  for (;;)
+    {
+      struct defrag_stats stats = { 0, 0, 0, 0 };
+      struct dir *root;
+
+      timer_sleep (DEFRAG_INTERVAL * TIMER_FREQ);
+      root = dir_open_root ();
+      if (root != NULL)
+        {
+          defrag_tree (dir_get_inode (root), "/", &stats, false);
+          dir_close (root);
+        }
+    }
 }
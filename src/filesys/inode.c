@@ -1,23 +1,92 @@
 #include "filesys/inode.h"
 #include <list.h>
 #include <debug.h>
+#include <ohash.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "filesys/tmpfs.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/sysctl.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of consecutive data sectors reserved at a time for a
+   growing file. */
+#define PREALLOC_SECTORS 16
+
+/* Most data sectors inode_defrag() moves in one journal
+   operation, so that the index blocks and free map sectors it
+   changes fit in one transaction. */
+#define DEFRAG_BATCH (8 * INODE_PTRS_PER_SECTOR)
+
+/* Number of runs of data sectors cached by each open inode, and
+   most index entries looked at to find where a run ends. */
+#define EXTENT_CNT 4
+#define EXTENT_SCAN 32
+
+/* Most inodes kept in memory after their last opener closes
+   them. */
+#define INODE_UNUSED_MAX 32
+
+/* Number of sectors to read ahead of a sequential reader, the
+   tunable fs.read_ahead. */
+#define READ_AHEAD_SECTORS 2
+static int read_ahead_sectors = READ_AHEAD_SECTORS;
+
+/* Number of direct sector pointers in an inode. */
+#define INODE_DIRECT_CNT 12
+
+/* Number of sector pointers in an indirect block. */
+#define INODE_PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Largest number of data sectors a file can have. */
+#define INODE_MAX_SECTORS (INODE_DIRECT_CNT + INODE_PTRS_PER_SECTOR \
+                           + INODE_PTRS_PER_SECTOR * INODE_PTRS_PER_SECTOR)
+
+/* Largest file whose data is kept in the inode sector itself. */
+#define INODE_INLINE_MAX 444
+
+/* Set in a data sector pointer whose sector has been allocated
+   but never written.  Such a sector reads as zeros without
+   touching the disk, and is filled in by the first write to it. */
+#define INODE_UNWRITTEN 0x80000000u
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   Data sectors are found through a multi-level index: the first
+   INODE_DIRECT_CNT sectors of the file are listed directly, the
+   next INODE_PTRS_PER_SECTOR through the indirect block, and the
+   rest through the doubly indirect block, which lists indirect
+   blocks.  A pointer of 0 means "not allocated"; sector 0 holds
+   the free map inode, so it is never a data or index sector.
+   Data sector pointers may have INODE_UNWRITTEN set.  A data
+   sector inside the file may be unallocated too, if it was freed
+   by inode_punch(); it reads as zeros and is allocated again by
+   the next write to it.
+
+   A file of at most INODE_INLINE_MAX bytes has no data sectors:
+   its data is stored in INLINE_DATA, so that reading it takes no
+   disk access beyond the inode.  Files never shrink, so a file
+   is inline exactly when its length is that small, and the
+   unused part of INLINE_DATA is always zero.  When the file
+   grows past INODE_INLINE_MAX bytes, its data moves to its first
+   data sector. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    block_sector_t direct[INODE_DIRECT_CNT]; /* Direct data sectors. */
+    block_sector_t indirect;            /* Indirect block. */
+    block_sector_t doubly_indirect;     /* Doubly indirect block. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t is_dir;                    /* Nonzero for a directory. */
+    uint8_t inline_data[INODE_INLINE_MAX]; /* Data of a small file. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,51 +97,552 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* Returns true if the data of the file described by DISK_INODE
+   is stored inline. */
+static inline bool
+is_inline (const struct inode_disk *disk_inode)
+{
+  return disk_inode->length <= INODE_INLINE_MAX;
+}
+
+/* Consecutive free sectors reserved for the data of one growing
+   file.
+
+   Allocating each data sector when a write first reaches it
+   interleaves the sectors of files that grow at the same time,
+   so that reading any one of them back seeks all over the disk.
+   Instead, a growing file takes its data sectors from a run of
+   PREALLOC_SECTORS sectors reserved for it alone, so it is laid
+   out sequentially however writers interleave.  Sectors still
+   reserved when the last opener closes the file are released.
+   Each run is looked for past GOAL, which starts out as the
+   inode's own sector, so the data follows the inode on disk. */
+struct prealloc
+  {
+    block_sector_t start;               /* First reserved sector. */
+    size_t cnt;                         /* Number of reserved sectors. */
+    block_sector_t goal;                /* Where to look for the next run. */
+  };
+
+/* A run of data sectors of a file that are stored in as many
+   consecutive sectors on disk, all of them allocated and
+   written. */
+struct extent
+  {
+    size_t first;                       /* Index of the first data sector. */
+    size_t cnt;                         /* Number of sectors, 0 if unused. */
+    block_sector_t sector;              /* Disk sector of the first. */
+  };
+
+/* In-memory inode.
+
+   LOCK protects DATA, PREALLOC and DENY_WRITE_CNT.  Readers hold it for
+   reading and writers for writing, but only while the index is
+   looked up or changed, not while data is copied to or from the
+   buffer cache.  READ_AHEAD_POS is only a
+   hint, so readers update it without excluding each other.
+   WRITE_CNT only has to change after every write, so it is
+   updated without a lock too.
+
+   Only one thread at a time extends the file, holding
+   EXTEND_LOCK, which is taken before LOCK.  An extending write
+   allocates the new sectors, writes them without holding LOCK,
+   like any other write, and only then sets the new length, so
+   readers below the old length go on meanwhile and none sees the
+   new part before its data is there.  The length never changes
+   without EXTEND_LOCK.
+
+   EXTENTS caches runs of data sectors found in the index, so that
+   translating a file position usually takes no index block read.
+   Only a thread that holds LOCK looks it up or fills it, but
+   readers share LOCK, so EXTENT_LOCK protects the cache itself.
+   A thread that changes an allocated, written index entry holds
+   LOCK for writing and drops the runs that cover it.
+
+   An inode in tmpfs has TMP set and no use for DATA, PREALLOC or
+   EXTENTS: its data is TMP's, protected by LOCK like DATA. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct list_elem unused_elem;       /* In unused_inodes if not open. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    struct lock extend_lock;            /* Held by the one extender. */
+    struct rwlock lock;                 /* Protects the members below. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    off_t read_ahead_pos;               /* Where a sequential read resumes. */
+    unsigned write_cnt;                 /* Number of completed writes. */
+    struct prealloc prealloc;           /* Sectors reserved for data. */
+    struct lock extent_lock;            /* Protects the members below. */
+    struct extent extents[EXTENT_CNT];  /* Recently translated runs. */
+    size_t extent_next;                 /* Entry of EXTENTS to reuse next. */
     struct inode_disk data;             /* Inode content. */
+    struct tmpfs_node *tmp;             /* Node in tmpfs, or null. */
   };
 
+/* A sector full of zeros. */
+static const char zeros[BLOCK_SECTOR_SIZE];
+
+static off_t write_inode (struct inode *, const void *, off_t size,
+                          off_t *offset, bool append);
+
+/* Copies SIZE bytes from BUFFER into data sector SECTOR of
+   INODE at byte SECTOR_OFS.  The data of directories and of the
+   free map is metadata and goes through the journal; other data
+   is recorded as INODE's, for inode_sync(). */
+static void
+write_data (struct inode *inode, block_sector_t sector, const void *buffer,
+            int sector_ofs, int size)
+{
+  if (inode->data.is_dir || inode->sector == FREE_MAP_SECTOR)
+    cache_write_meta_at (sector, buffer, sector_ofs, size);
+  else
+    cache_write_file_at (sector, inode->sector, buffer, sector_ofs, size);
+}
+
+/* Takes a data sector from PA, reserving a new run of sectors
+   first if PA is empty, and stores it into *SECTORP.  If no run
+   of PREALLOC_SECTORS sectors is free, shorter runs are tried.
+   Returns false if the disk is full. */
+static bool
+prealloc_take (struct prealloc *pa, block_sector_t *sectorp)
+{
+  if (pa->cnt == 0)
+    {
+      size_t cnt;
+
+      for (cnt = PREALLOC_SECTORS;
+           !free_map_allocate_near (cnt, pa->goal, &pa->start); cnt /= 2)
+        if (cnt == 1)
+          return false;
+      pa->cnt = cnt;
+      pa->goal = pa->start + cnt;
+    }
+  *sectorp = pa->start++;
+  pa->cnt--;
+  return true;
+}
+
+/* Releases the sectors left in PA. */
+static void
+prealloc_release (struct prealloc *pa)
+{
+  if (pa->cnt > 0)
+    free_map_release (pa->start, pa->cnt);
+  pa->cnt = 0;
+}
+
+/* If *SECTORP is 0, allocates a sector and stores its number
+   into *SECTORP.  An index sector (DATA false) is allocated on
+   its own and filled with zeros; a data sector is taken from PA
+   and only marked INODE_UNWRITTEN.
+   Returns false if *SECTORP is 0 and no sector can be
+   allocated, true otherwise. */
+static bool
+allocate_sector (block_sector_t *sectorp, bool data, struct prealloc *pa)
+{
+  if (*sectorp != 0)
+    return true;
+  if (data)
+    {
+      if (!prealloc_take (pa, sectorp))
+        return false;
+      *sectorp |= INODE_UNWRITTEN;
+    }
+  else
+    {
+      if (!free_map_allocate_near (1, pa->goal, sectorp))
+        return false;
+      cache_write_meta (*sectorp, zeros);
+    }
+  return true;
+}
+
+/* Returns entry IDX of index block INDEX_SECTOR.  If the entry
+   is 0 and PA is non-null, allocates a sector for it first, as
+   a data sector taken from PA if DATA is true.  Returns 0 if the
+   entry is unallocated or allocation fails. */
+static block_sector_t
+index_get (block_sector_t index_sector, size_t idx, struct prealloc *pa,
+           bool data)
+{
+  block_sector_t sector;
+  int ofs = idx * sizeof sector;
+
+  cache_read_at (index_sector, &sector, ofs, sizeof sector);
+  if (sector == 0 && pa != NULL)
+    {
+      if (!allocate_sector (&sector, data, pa))
+        return 0;
+      cache_write_meta_at (index_sector, &sector, ofs, sizeof sector);
+    }
+  return sector;
+}
+
+/* Returns the sector that holds data sector IDX of the file
+   described by DISK_INODE.  If that sector, or any index block
+   leading to it, is not allocated, then it is allocated if PA
+   is non-null, with the data sector taken from PA, otherwise 0
+   is returned.  0 is also returned if allocation fails.  The
+   returned pointer may have INODE_UNWRITTEN set.  The caller is
+   responsible for writing DISK_INODE back if it changed. */
+static block_sector_t
+index_to_sector (struct inode_disk *disk_inode, size_t idx,
+                 struct prealloc *pa)
+{
+  block_sector_t indirect;
+
+  if (idx < INODE_DIRECT_CNT)
+    {
+      if (pa != NULL && !allocate_sector (&disk_inode->direct[idx], true, pa))
+        return 0;
+      return disk_inode->direct[idx];
+    }
+  idx -= INODE_DIRECT_CNT;
+
+  if (idx < INODE_PTRS_PER_SECTOR)
+    {
+      if (disk_inode->indirect == 0
+          && (pa == NULL
+              || !allocate_sector (&disk_inode->indirect, false, pa)))
+        return 0;
+      return index_get (disk_inode->indirect, idx, pa, true);
+    }
+  idx -= INODE_PTRS_PER_SECTOR;
+
+  if (idx < INODE_PTRS_PER_SECTOR * INODE_PTRS_PER_SECTOR)
+    {
+      if (disk_inode->doubly_indirect == 0
+          && (pa == NULL
+              || !allocate_sector (&disk_inode->doubly_indirect, false, pa)))
+        return 0;
+      indirect = index_get (disk_inode->doubly_indirect,
+                            idx / INODE_PTRS_PER_SECTOR, pa, false);
+      if (indirect == 0)
+        return 0;
+      return index_get (indirect, idx % INODE_PTRS_PER_SECTOR, pa, true);
+    }
+
+  return 0;
+}
+
+/* Returns the index block that lists data sector *IDX of the
+   file described by DISK_INODE, and makes *IDX the position in
+   it, or returns 0 if the sector is listed in DISK_INODE itself.
+   The index block must be allocated. */
+static block_sector_t
+index_block (struct inode_disk *disk_inode, size_t *idx)
+{
+  block_sector_t index_sector;
+
+  if (*idx < INODE_DIRECT_CNT)
+    return 0;
+  *idx -= INODE_DIRECT_CNT;
+
+  if (*idx < INODE_PTRS_PER_SECTOR)
+    index_sector = disk_inode->indirect;
+  else
+    {
+      *idx -= INODE_PTRS_PER_SECTOR;
+      index_sector = index_get (disk_inode->doubly_indirect,
+                                *idx / INODE_PTRS_PER_SECTOR, NULL, false);
+      *idx %= INODE_PTRS_PER_SECTOR;
+    }
+  ASSERT (index_sector != 0);
+  return index_sector;
+}
+
+/* Sets the pointer to data sector IDX of INODE, which must be
+   allocated, to SECTOR, and drops the cached run that covers
+   it.  INODE's lock must be held for writing. */
+static void
+set_data_sector (struct inode *inode, size_t idx, block_sector_t sector)
+{
+  struct inode_disk *disk_inode = &inode->data;
+  block_sector_t index_sector;
+  size_t i;
+
+  lock_acquire (&inode->extent_lock);
+  for (i = 0; i < EXTENT_CNT; i++)
+    if (idx - inode->extents[i].first < inode->extents[i].cnt)
+      inode->extents[i].cnt = 0;
+  lock_release (&inode->extent_lock);
+
+  index_sector = index_block (disk_inode, &idx);
+  if (index_sector == 0)
+    {
+      disk_inode->direct[idx] = sector;
+      cache_write_meta (inode->sector, disk_inode);
+    }
+  else
+    cache_write_meta_at (index_sector, &sector, idx * sizeof sector,
+                         sizeof sector);
+}
+
+/* Returns the disk sector of data sector IDX of INODE if a
+   cached run covers it, otherwise 0. */
+static block_sector_t
+extent_lookup (struct inode *inode, size_t idx)
+{
+  block_sector_t sector = 0;
+  size_t i;
+
+  lock_acquire (&inode->extent_lock);
+  for (i = 0; i < EXTENT_CNT; i++)
+    if (idx - inode->extents[i].first < inode->extents[i].cnt)
+      {
+        sector = inode->extents[i].sector + (idx - inode->extents[i].first);
+        break;
+      }
+  lock_release (&inode->extent_lock);
+  return sector;
+}
+
+/* Caches the run that starts with data sector IDX of INODE,
+   stored in written disk sector SECTOR.  The run extends as far
+   as the following entries of the same index block, up to
+   EXTENT_SCAN of them, list the following disk sectors. */
+static void
+extent_fill (struct inode *inode, size_t idx, block_sector_t sector)
+{
+  block_sector_t next[EXTENT_SCAN];
+  size_t pos = idx, avail, cnt;
+  block_sector_t index_sector = index_block (&inode->data, &pos);
+  struct extent *e;
+
+  /* Read the entries after IDX's in its index block. */
+  if (index_sector == 0)
+    {
+      avail = INODE_DIRECT_CNT - pos - 1;
+      if (avail > EXTENT_SCAN)
+        avail = EXTENT_SCAN;
+      memcpy (next, &inode->data.direct[pos + 1], avail * sizeof *next);
+    }
+  else
+    {
+      avail = INODE_PTRS_PER_SECTOR - pos - 1;
+      if (avail > EXTENT_SCAN)
+        avail = EXTENT_SCAN;
+      cache_read_at (index_sector, next, (pos + 1) * sizeof *next,
+                     avail * sizeof *next);
+    }
+  for (cnt = 1; cnt <= avail && next[cnt - 1] == sector + cnt; cnt++)
+    continue;
+
+  lock_acquire (&inode->extent_lock);
+  e = &inode->extents[inode->extent_next];
+  inode->extent_next = (inode->extent_next + 1) % EXTENT_CNT;
+  e->first = idx;
+  e->cnt = cnt;
+  e->sector = sector;
+  lock_release (&inode->extent_lock);
+}
+
+/* Clears INODE_UNWRITTEN in the pointer to data sector IDX of
+   INODE, which must be allocated. */
+static void
+mark_written (struct inode *inode, size_t idx)
+{
+  block_sector_t sector = index_to_sector (&inode->data, idx, NULL);
+  set_data_sector (inode, idx, sector & ~INODE_UNWRITTEN);
+}
+
+/* Returns the number of runs of consecutive sectors that data
+   sectors FIRST up to END of INODE are stored in. */
+static int
+count_fragments (struct inode *inode, size_t first, size_t end)
+{
+  block_sector_t prev = 0;
+  int cnt = 0;
+  size_t i;
+
+  for (i = first; i < end; i++)
+    {
+      block_sector_t sector = (index_to_sector (&inode->data, i, NULL)
+                               & ~INODE_UNWRITTEN);
+      if (i == first || sector != prev + 1)
+        cnt++;
+      prev = sector;
+    }
+  return cnt;
+}
+
+/* Allocates the data sectors that the file described by
+   DISK_INODE would need at LENGTH bytes, past those it has,
+   taking them from PA.  The length and any inline data are left
+   alone.  Returns false if the free map runs out of space or
+   LENGTH exceeds the largest possible file; sectors allocated
+   so far stay in the index, to be freed with the rest of the
+   file. */
+static bool
+allocate_data (struct inode_disk *disk_inode, off_t length,
+               struct prealloc *pa)
+{
+  size_t sectors = bytes_to_sectors (length);
+  size_t i;
+
+  if (sectors > INODE_MAX_SECTORS)
+    return false;
+  for (i = is_inline (disk_inode) ? 0 : bytes_to_sectors (disk_inode->length);
+       i < sectors; i++)
+    if (index_to_sector (disk_inode, i, pa) == 0)
+      return false;
+  return true;
+}
+
+/* Allocates data sectors so that the file described by
+   DISK_INODE is LENGTH bytes long, taking them from PA, and
+   moving inline data to the first data sector if the file
+   outgrows the inode.  Returns
+   true if successful, false if the free map runs out of space or
+   LENGTH exceeds the largest possible file.  On failure the
+   length is unchanged, but sectors allocated so far stay in the
+   index, to be freed with the rest of the file. */
+static bool
+extend_disk_inode (struct inode_disk *disk_inode, off_t length,
+                   struct prealloc *pa)
+{
+  if (length <= disk_inode->length)
+    return true;
+  if (length <= INODE_INLINE_MAX)
+    {
+      disk_inode->length = length;
+      return true;
+    }
+  if (!allocate_data (disk_inode, length, pa))
+    return false;
+
+  if (is_inline (disk_inode) && disk_inode->length > 0)
+    {
+      block_sector_t sector = disk_inode->direct[0] & ~INODE_UNWRITTEN;
+      if (disk_inode->is_dir)
+        {
+          cache_write_meta (sector, zeros);
+          cache_write_meta_at (sector, disk_inode->inline_data, 0,
+                               disk_inode->length);
+        }
+      else
+        {
+          cache_write (sector, zeros);
+          cache_write_at (sector, disk_inode->inline_data, 0,
+                          disk_inode->length);
+        }
+      disk_inode->direct[0] = sector;
+      memset (disk_inode->inline_data, 0, sizeof disk_inode->inline_data);
+    }
+  disk_inode->length = length;
+  return true;
+}
+
+/* Releases SECTOR, which is 0 or an allocated sector.  DEPTH is
+   0 for a data sector, 1 for an indirect block and 2 for a
+   doubly indirect block; the sectors listed in index blocks are
+   released recursively. */
+static void
+release_index (block_sector_t sector, int depth)
+{
+  size_t i;
+
+  sector &= ~INODE_UNWRITTEN;
+  if (sector == 0)
+    return;
+
+  if (depth > 0)
+    for (i = 0; i < INODE_PTRS_PER_SECTOR; i++)
+      {
+        block_sector_t entry;
+        cache_read_at (sector, &entry, i * sizeof entry, sizeof entry);
+        release_index (entry, depth - 1);
+      }
+  free_map_release (sector, 1);
+}
+
+/* Releases all the data and index sectors of DISK_INODE. */
+static void
+release_disk_inode (struct inode_disk *disk_inode)
+{
+  size_t i;
+
+  for (i = 0; i < INODE_DIRECT_CNT; i++)
+    release_index (disk_inode->direct[i], 0);
+  release_index (disk_inode->indirect, 1);
+  release_index (disk_inode->doubly_indirect, 2);
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   POS.  The result has INODE_UNWRITTEN set if the sector has never
+   been written. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t sector;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
+  ASSERT (!is_inline (&inode->data));
+  if (pos >= inode->data.length)
     return -1;
+
+  sector = extent_lookup (inode, idx);
+  if (sector == 0)
+    {
+      sector = index_to_sector (&inode->data, idx, NULL);
+      if (sector != 0 && !(sector & INODE_UNWRITTEN))
+        extent_fill (inode, idx, sector);
+    }
+  return sector;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Table of open inodes, keyed by sector, so that opening a
+   single inode twice returns the same `struct inode'.  Every
+   inode_open() looks its sector up here, so the table keeps the
+   sectors inline instead of in the inodes.
+   open_inodes_lock protects the table and every inode's
+   open_cnt.
+
+   An inode whose last opener closes it stays in the table, with
+   an open_cnt of 0, and goes to the front of UNUSED_INODES, so
+   that opening it again soon takes no disk read.  Its in-memory
+   copy is still the latest, because every change to it is made
+   there first.  Once more than INODE_UNUSED_MAX inodes are
+   unused, the one unused longest is freed.  A removed inode is
+   freed at once.  The list is protected by open_inodes_lock
+   too. */
+static struct ohash open_inodes;
+static struct list unused_inodes;
+static size_t unused_cnt;
+static struct lock open_inodes_lock;
+
+/* Object cache for in-memory inodes. */
+static struct kmem_cache *inode_cache;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!ohash_init (&open_inodes, ohash_word, NULL))
+    PANIC ("out of memory for the inode table");
+  list_init (&unused_inodes);
+  unused_cnt = 0;
+  lock_init_named (&open_inodes_lock, "open_inodes");
+  inode_cache = kmem_cache_create ("inode", sizeof (struct inode), NULL);
+  sysctl_register ("fs.read_ahead", &read_ahead_sectors, 0, 16);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The inode is a directory if IS_DIR is true.  Its
+   data sectors are allocated in one run if possible.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
+  struct prealloc pa = { 0, 0, sector };
+  size_t cnt = length > INODE_INLINE_MAX ? bytes_to_sectors (length) : 0;
   bool success = false;
 
   ASSERT (length >= 0);
@@ -81,25 +651,28 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  if (tmpfs_is_inumber (sector))
+    return tmpfs_create (sector, length, is_dir);
+
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
+      disk_inode->length = 0;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      disk_inode->is_dir = is_dir;
+      if (cnt > 0 && free_map_allocate_near (cnt, sector, &pa.start))
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          pa.cnt = cnt;
+          pa.goal = pa.start + cnt;
+        }
+      if (extend_disk_inode (disk_inode, length, &pa)) 
+        {
+          cache_write_meta (sector, disk_inode);
           success = true; 
         } 
+      else
+        release_disk_inode (disk_inode);
+      prealloc_release (&pa);
       free (disk_inode);
     }
   return success;
@@ -111,33 +684,58 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  inode = ohash_find (&open_inodes, sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      if (inode->open_cnt++ == 0)
         {
-          inode_reopen (inode);
-          return inode; 
+          list_remove (&inode->unused_elem);
+          unused_cnt--;
         }
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (inode_cache);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The inode is read while the table is locked so
+     that a concurrent opener can't see it half-initialized. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  lock_init (&inode->extend_lock);
+  rwlock_init (&inode->lock);
+  inode->read_ahead_pos = 0;
+  inode->write_cnt = 0;
+  inode->prealloc.cnt = 0;
+  inode->prealloc.goal = sector;
+  lock_init (&inode->extent_lock);
+  memset (inode->extents, 0, sizeof inode->extents);
+  inode->extent_next = 0;
+  inode->tmp = tmpfs_is_inumber (sector) ? tmpfs_lookup (sector) : NULL;
+  if ((tmpfs_is_inumber (sector) && inode->tmp == NULL)
+      || !ohash_insert (&open_inodes, sector, inode))
+    {
+      lock_release (&open_inodes_lock);
+      kmem_cache_free (inode_cache, inode);
+      return NULL;
+    }
+  if (inode->tmp == NULL)
+    cache_read (inode->sector, &inode->data);
+
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,7 +744,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -158,8 +760,10 @@ inode_get_inumber (const struct inode *inode)
 }
 
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If this was the last reference to INODE, gives back the sectors
+   reserved for it and keeps it among the unused inodes, freeing
+   the one unused longest if there are too many.
+   If INODE was also a removed inode, frees it and its blocks. */
 void
 inode_close (struct inode *inode) 
 {
@@ -167,22 +771,45 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  if (--inode->open_cnt > 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
+      lock_release (&open_inodes_lock);
+      return;
+    }
+
+  /* Nobody can use INODE without reopening it, which waits for
+     the lock, so its reserved sectors are given back here. */
+  if (!inode->removed)
+    {
+      prealloc_release (&inode->prealloc);
+      list_push_front (&unused_inodes, &inode->unused_elem);
+      if (++unused_cnt <= INODE_UNUSED_MAX)
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          lock_release (&open_inodes_lock);
+          return;
         }
+      inode = list_entry (list_pop_back (&unused_inodes),
+                          struct inode, unused_elem);
+      unused_cnt--;
+    }
 
-      free (inode); 
+  /* Remove from inode table and release lock. */
+  ohash_delete (&open_inodes, inode->sector);
+  lock_release (&open_inodes_lock);
+
+  /* Give back reserved sectors, and deallocate blocks if
+     removed. */
+  prealloc_release (&inode->prealloc);
+  if (inode->removed && inode->tmp != NULL)
+    tmpfs_release (inode->sector);
+  else if (inode->removed) 
+    {
+      free_map_release (inode->sector, 1);
+      release_disk_inode (&inode->data);
     }
+
+  kmem_cache_free (inode_cache, inode);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -202,128 +829,546 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  bool sequential = offset == inode->read_ahead_pos;
+
+  /* Inline data is copied straight out of the inode, and tmpfs
+     data out of its pages. */
+  rwlock_acquire_read (&inode->lock);
+  if (inode->tmp != NULL)
+    {
+      bytes_read = tmpfs_read (inode->tmp, buffer, size, offset);
+      rwlock_release_read (&inode->lock);
+      return bytes_read;
+    }
+  if (is_inline (&inode->data))
+    {
+      if (offset < inode->data.length)
+        {
+          bytes_read = inode->data.length - offset;
+          if (size < bytes_read)
+            bytes_read = size;
+          memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+        }
+      rwlock_release_read (&inode->lock);
+      return bytes_read;
+    }
+  rwlock_release_read (&inode->lock);
 
   while (size > 0) 
     {
-      /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      off_t inode_left;
+      int sector_left, min_left, chunk_size;
+
+      /* Disk sector to read and bytes left in inode. */
+      rwlock_acquire_read (&inode->lock);
+      sector_idx = byte_to_sector (inode, offset);
+      inode_left = inode->data.length - offset;
+      rwlock_release_read (&inode->lock);
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      /* Bytes left in sector, lesser of the two. */
+      sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      min_left = inode_left < sector_left ? inode_left : sector_left;
 
       /* Number of bytes to actually copy out of this sector. */
-      int chunk_size = size < min_left ? size : min_left;
+      chunk_size = size < min_left ? size : min_left;
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      /* Copy the chunk out of the buffer cache.  A sector that
+         has never been written reads as zeros. */
+      if (sector_idx != 0 && !(sector_idx & INODE_UNWRITTEN))
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+
+  /* A read that picks up where the previous one stopped is
+     probably part of a sequential scan, so start fetching the
+     sectors that come next. */
+  rwlock_acquire_read (&inode->lock);
+  if (sequential && bytes_read > 0)
+    {
+      off_t pos = ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+      int cnt = read_ahead_sectors;
+      int i;
+
+      for (i = 0; i < cnt && pos < inode->data.length; i++)
+        {
+          block_sector_t sector = byte_to_sector (inode, pos);
+          if (sector != 0 && !(sector & INODE_UNWRITTEN))
+            cache_read_ahead (sector);
+          pos += BLOCK_SECTOR_SIZE;
+        }
+    }
+  inode->read_ahead_pos = offset;
+  rwlock_release_read (&inode->lock);
 
   return bytes_read;
 }
 
+/* Like inode_read_at(), but for a caller that keeps the data
+   itself, such as a page fault filling a frame.  Whole sectors
+   are read with cache_read_direct(), so they are not cached a
+   second time, and sectors that follow each other on disk are
+   read in one transfer.  Only the partial sectors at either end
+   go through the cache.  There is no read-ahead. */
+off_t
+inode_read_direct (struct inode *inode, void *buffer_, off_t size,
+                   off_t offset)
+{
+  uint8_t *buffer = buffer_;
+  off_t bytes_read = 0;
+
+  rwlock_acquire_read (&inode->lock);
+  if (inode->tmp != NULL || is_inline (&inode->data))
+    {
+      rwlock_release_read (&inode->lock);
+      return inode_read_at (inode, buffer, size, offset);
+    }
+  rwlock_release_read (&inode->lock);
+
+  while (size > 0)
+    {
+      block_sector_t sector_idx;
+      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      off_t inode_left, run_left;
+      size_t run = 1;
+      off_t chunk_size;
+
+      /* First sector to read, and how many more follow it on
+         disk and are wanted whole. */
+      rwlock_acquire_read (&inode->lock);
+      sector_idx = byte_to_sector (inode, offset);
+      inode_left = inode->data.length - offset;
+      if (sector_ofs == 0 && !(sector_idx & INODE_UNWRITTEN))
+        while ((off_t) (run + 1) * BLOCK_SECTOR_SIZE <= size
+               && (off_t) (run + 1) * BLOCK_SECTOR_SIZE <= inode_left
+               && (byte_to_sector (inode, offset + run * BLOCK_SECTOR_SIZE)
+                   == sector_idx + run))
+          run++;
+      rwlock_release_read (&inode->lock);
+
+      run_left = run * BLOCK_SECTOR_SIZE - sector_ofs;
+      chunk_size = size < inode_left ? size : inode_left;
+      if (run_left < chunk_size)
+        chunk_size = run_left;
+      if (chunk_size <= 0)
+        break;
+
+      if (sector_idx == 0 || (sector_idx & INODE_UNWRITTEN))
+        memset (buffer + bytes_read, 0, chunk_size);
+      else if (chunk_size == run_left && sector_ofs == 0)
+        cache_read_direct (sector_idx, run, buffer + bytes_read);
+      else
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
+
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_read += chunk_size;
+    }
+  return bytes_read;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   A write past end of file extends the inode, filling any gap
+   with zeros.  Returns the number of bytes actually written,
+   which may be less than SIZE if the disk is full or an error
+   occurs.  The write is one journal operation. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
                 off_t offset) 
+{
+  off_t bytes_written;
+
+  journal_begin ();
+  bytes_written = write_inode (inode, buffer, size, &offset, false);
+  journal_end ();
+  return bytes_written;
+}
+
+/* Writes SIZE bytes from BUFFER at the end of INODE, as one
+   journal operation, and stores the offset they went to in
+   *OFFSET.  Other appends and writes that extend INODE come
+   before or after it, never in between, so appenders never
+   overwrite each other.  Returns the number of bytes actually
+   written, which may be less than SIZE if the disk is full. */
+off_t
+inode_append (struct inode *inode, const void *buffer, off_t size,
+              off_t *offset)
+{
+  off_t bytes_written;
+
+  journal_begin ();
+  bytes_written = write_inode (inode, buffer, size, offset, true);
+  journal_end ();
+  return bytes_written;
+}
+
+/* Does the work of inode_write_at(), writing at *OFFSET_, or of
+   inode_append() if APPEND is true. */
+static off_t
+write_inode (struct inode *inode, const void *buffer_, off_t size,
+             off_t *offset_, bool append)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  off_t new_length = 0;
+  off_t offset;
+  bool extending, locked;
 
+  /* A write that ends past end of file takes EXTEND_LOCK.  The
+     length may have grown by the time it is held, and then the
+     write does not extend the file after all; it cannot shrink,
+     so a write that did not look like an extension is none.  An
+     append learns where the file ends once it holds the lock,
+     since the length only changes under it. */
+  if (append)
+    {
+      lock_acquire (&inode->extend_lock);
+      offset = *offset_ = inode_length (inode);
+      extending = true;
+    }
+  else
+    {
+      offset = *offset_;
+      extending = offset + size > inode_length (inode);
+      if (extending)
+        lock_acquire (&inode->extend_lock);
+    }
+  rwlock_acquire_write (&inode->lock);
+  if (extending && offset + size <= inode_length (inode))
+    {
+      lock_release (&inode->extend_lock);
+      extending = false;
+    }
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      rwlock_release_write (&inode->lock);
+      if (extending)
+        lock_release (&inode->extend_lock);
+      return 0;
+    }
+  if (inode->tmp != NULL)
+    {
+      bytes_written = tmpfs_write (inode->tmp, buffer, size, offset);
+      if (bytes_written > 0)
+        inode->write_cnt++;
+      rwlock_release_write (&inode->lock);
+      if (extending)
+        lock_release (&inode->extend_lock);
+      return bytes_written;
+    }
 
-  while (size > 0) 
+  /* Allocate the sectors first if the write ends past end of
+     file.  If that fails, write as much as fits in the current
+     length.  Either way the index may have changed, so write it
+     back.  An inline file is small and its data moves when it
+     grows, so it gets its new length at once and stays locked
+     until the write is done.  Any other file gets it at the end,
+     in NEW_LENGTH meanwhile.  A write that stays in the last
+     sector, like most appends of a log record, allocates nothing
+     and leaves the inode alone until then. */
+  locked = extending && is_inline (&inode->data);
+  if (locked)
+    {
+      extend_disk_inode (&inode->data, offset + size, &inode->prealloc);
+      cache_write_meta (inode->sector, &inode->data);
+    }
+  else if (extending)
+    {
+      if (allocate_data (&inode->data, offset + size, &inode->prealloc))
+        new_length = offset + size;
+      if (bytes_to_sectors (offset + size)
+          > bytes_to_sectors (inode->data.length))
+        cache_write_meta (inode->sector, &inode->data);
+    }
+
+  /* Inline data is written into the inode, which goes back to
+     the cache as a whole. */
+  if (is_inline (&inode->data))
+    {
+      if (offset < inode->data.length)
+        {
+          bytes_written = inode->data.length - offset;
+          if (size < bytes_written)
+            bytes_written = size;
+          memcpy (inode->data.inline_data + offset, buffer, bytes_written);
+          cache_write_meta (inode->sector, &inode->data);
+          inode->write_cnt++;
+        }
+      rwlock_release_write (&inode->lock);
+      if (extending)
+        lock_release (&inode->extend_lock);
+      return bytes_written;
+    }
+
+  if (!locked)
+    rwlock_release_write (&inode->lock);
+
+  while (size > 0)
     {
-      /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      off_t inode_left;
+      int sector_left, min_left, chunk_size;
+
+      if (!locked)
+        rwlock_acquire_write (&inode->lock);
+
+      /* Sector to write and bytes left in inode, counting those
+         past end of file that this write is adding. */
+      if (offset < inode->data.length)
+        sector_idx = byte_to_sector (inode, offset);
+      else
+        sector_idx = index_to_sector (&inode->data,
+                                      offset / BLOCK_SECTOR_SIZE, NULL);
+      inode_left = (new_length > inode->data.length
+                    ? new_length : inode->data.length) - offset;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      /* Bytes left in sector, lesser of the two. */
+      sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      min_left = inode_left < sector_left ? inode_left : sector_left;
 
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
+      chunk_size = size < min_left ? size : min_left;
       if (chunk_size <= 0)
-        break;
-
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          if (!locked)
+            rwlock_release_write (&inode->lock);
+          break;
         }
-      else 
+
+      /* A sector freed by inode_punch() is allocated again. */
+      if (sector_idx == 0)
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
+          sector_idx = index_to_sector (&inode->data,
+                                        offset / BLOCK_SECTOR_SIZE,
+                                        &inode->prealloc);
+          cache_write_meta (inode->sector, &inode->data);
+          if (sector_idx == 0)
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              if (!locked)
+                rwlock_release_write (&inode->lock);
+              break;
             }
+        }
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+      /* The first write to a sector fills in the rest of it with
+         zeros, in the cache only, and clears INODE_UNWRITTEN.  This
+         is done with the inode locked so that two writers can't
+         both zero-fill the sector. */
+      if (sector_idx & INODE_UNWRITTEN)
+        {
+          sector_idx &= ~INODE_UNWRITTEN;
+          if (chunk_size < BLOCK_SECTOR_SIZE)
+            write_data (inode, sector_idx, zeros, 0, BLOCK_SECTOR_SIZE);
+          mark_written (inode, offset / BLOCK_SECTOR_SIZE);
         }
+      if (!locked)
+        rwlock_release_write (&inode->lock);
+
+      /* Copy the chunk into the buffer cache.  The rest of the
+         sector is read in first only if the chunk doesn't cover
+         it completely. */
+      write_data (inode, sector_idx, buffer + bytes_written, sector_ofs,
+                  chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* Publish the new length now that the data is in place. */
+  if (new_length > 0)
+    {
+      rwlock_acquire_write (&inode->lock);
+      inode->data.length = new_length;
+      cache_write_meta (inode->sector, &inode->data);
+      rwlock_release_write (&inode->lock);
+    }
+  if (locked)
+    rwlock_release_write (&inode->lock);
+  if (extending)
+    lock_release (&inode->extend_lock);
+  if (bytes_written > 0)
+    inode->write_cnt++;
 
   return bytes_written;
 }
 
+/* Allocates the data sectors of bytes OFFSET up to OFFSET + LEN
+   of INODE that are not allocated yet, growing the file if it is
+   shorter, as one journal operation.  The sectors are reserved in
+   one run if one is free, following the file's last run, and are
+   marked INODE_UNWRITTEN, so they read as zeros without being
+   written.  Returns false if writes to INODE are denied, the disk
+   is full or the file would be too big; sectors allocated by then
+   stay allocated, but the length is unchanged. */
+bool
+inode_allocate (struct inode *inode, off_t offset, off_t len)
+{
+  struct inode_disk *disk_inode = &inode->data;
+  struct prealloc pa = { 0, 0, inode->prealloc.goal };
+  struct prealloc *source = &inode->prealloc;
+  off_t end = offset + len;
+  size_t old_cnt, new_cnt, need = 0, i;
+  bool success = true;
+
+  ASSERT (offset >= 0 && len >= 0);
+
+  journal_begin ();
+  lock_acquire (&inode->extend_lock);
+  rwlock_acquire_write (&inode->lock);
+  if (inode->deny_write_cnt)
+    success = false;
+  else if (inode->tmp != NULL)
+    {
+      success = tmpfs_allocate (inode->tmp, offset, len);
+      rwlock_release_write (&inode->lock);
+      lock_release (&inode->extend_lock);
+      journal_end ();
+      return success;
+    }
+  else if (!is_inline (disk_inode) || end > INODE_INLINE_MAX)
+    {
+      /* Count the holes in the range and the sectors past the end
+         of the file, and reserve them together if possible. */
+      old_cnt = (is_inline (disk_inode) ? 0
+                 : bytes_to_sectors (disk_inode->length));
+      new_cnt = bytes_to_sectors (end);
+      for (i = offset / BLOCK_SECTOR_SIZE; i < old_cnt && i < new_cnt; i++)
+        if (index_to_sector (disk_inode, i, NULL) == 0)
+          need++;
+      if (new_cnt > old_cnt)
+        need += new_cnt - old_cnt;
+      if (new_cnt <= INODE_MAX_SECTORS && need > 0
+          && free_map_allocate_near (need, pa.goal, &pa.start))
+        {
+          pa.cnt = need;
+          source = &pa;
+        }
+
+      for (i = offset / BLOCK_SECTOR_SIZE; i < old_cnt && i < new_cnt; i++)
+        if (index_to_sector (disk_inode, i, source) == 0)
+          {
+            success = false;
+            break;
+          }
+    }
+  if (success)
+    success = extend_disk_inode (disk_inode, end, source);
+  cache_write_meta (inode->sector, disk_inode);
+  if (source == &pa)
+    inode->prealloc.goal = pa.start;
+  prealloc_release (&pa);
+  rwlock_release_write (&inode->lock);
+  lock_release (&inode->extend_lock);
+  journal_end ();
+  return success;
+}
+
+/* Frees the data sectors that bytes OFFSET up to OFFSET + LEN of
+   INODE cover entirely, and zeros the parts of the sectors at
+   either end that the range covers, as one journal operation.
+   The length of the file is unchanged, and the range reads as
+   zeros afterward.  Index blocks are kept.  Returns false if
+   writes to INODE are denied. */
+bool
+inode_punch (struct inode *inode, off_t offset, off_t len)
+{
+  struct inode_disk *disk_inode = &inode->data;
+  off_t end = offset + len;
+  off_t pos;
+
+  ASSERT (offset >= 0 && len >= 0);
+
+  journal_begin ();
+  rwlock_acquire_write (&inode->lock);
+  if (inode->deny_write_cnt)
+    {
+      rwlock_release_write (&inode->lock);
+      journal_end ();
+      return false;
+    }
+  if (inode->tmp == NULL && end > disk_inode->length)
+    end = disk_inode->length;
+
+  if (inode->tmp != NULL)
+    tmpfs_punch (inode->tmp, offset, len);
+  else if (is_inline (disk_inode))
+    {
+      if (offset < end)
+        {
+          memset (disk_inode->inline_data + offset, 0, end - offset);
+          cache_write_meta (inode->sector, disk_inode);
+        }
+    }
+  else
+    for (pos = offset; pos < end; )
+      {
+        size_t idx = pos / BLOCK_SECTOR_SIZE;
+        int sector_ofs = pos % BLOCK_SECTOR_SIZE;
+        off_t chunk_size = BLOCK_SECTOR_SIZE - sector_ofs;
+        block_sector_t sector = index_to_sector (disk_inode, idx, NULL);
+
+        if (end - pos < chunk_size)
+          chunk_size = end - pos;
+
+        /* A sector is freed if the range covers all of it that is
+           in the file, and otherwise zeroed in part. */
+        if (sector != 0 && sector_ofs == 0
+            && (chunk_size == BLOCK_SECTOR_SIZE
+                || pos + chunk_size == disk_inode->length))
+          {
+            set_data_sector (inode, idx, 0);
+            free_map_release (sector & ~INODE_UNWRITTEN, 1);
+          }
+        else if (sector != 0 && !(sector & INODE_UNWRITTEN))
+          write_data (inode, sector, zeros, sector_ofs, chunk_size);
+        pos += chunk_size;
+      }
+  inode->write_cnt++;
+  rwlock_release_write (&inode->lock);
+  journal_end ();
+  return true;
+}
+
+/* Writes INODE's data, and its metadata, to disk.  The data
+   sectors written since they were last flushed are found through
+   the buffer cache's list for INODE, so the cost depends on
+   INODE's dirty data rather than on the whole cache.  Metadata
+   only reaches the disk through a journal commit, which writes
+   all dirty data first, so uncommitted metadata costs a full
+   commit. */
+void
+inode_sync (struct inode *inode)
+{
+  if (inode->tmp != NULL)
+    return;
+  cache_flush_file (inode->sector);
+  if (cache_meta_dirty_cnt () > 0)
+    free_map_flush ();
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,14 +1377,140 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->lock);
+}
+
+/* Returns the number of writes to INODE completed since it was
+   opened.  Data read from INODE before the count last changed
+   may be stale. */
+unsigned
+inode_write_cnt (const struct inode *inode)
+{
+  return inode->write_cnt;
+}
+
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
+/* Returns true if INODE is a directory. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return (inode->tmp != NULL ? tmpfs_is_dir (inode->tmp)
+          : inode->data.is_dir != 0);
+}
+
+/* Returns the number of openers of INODE. */
+int
+inode_open_cnt (const struct inode *inode)
+{
+  return inode->open_cnt;
+}
+
+/* Returns the number of runs of consecutive sectors that the
+   data of INODE is stored in: 0 if it has no data sectors, 1 if
+   it is laid out contiguously. */
+int
+inode_fragments (struct inode *inode)
+{
+  int cnt;
+
+  rwlock_acquire_read (&inode->lock);
+  cnt = (inode->tmp != NULL || is_inline (&inode->data) ? 0
+         : count_fragments (inode, 0, bytes_to_sectors (inode->data.length)));
+  rwlock_release_read (&inode->lock);
+  return cnt;
+}
+
+/* Moves the data sectors of regular file INODE into consecutive
+   sectors following its inode, DEFRAG_BATCH sectors at a time,
+   each batch to one free run of sectors as close after the
+   previous one as possible.  A batch already stored in one run is
+   left where it is.
+
+   Each batch is copied through the buffer cache and its index
+   entries rewritten in one journal operation, so after a crash
+   the file has either its old sectors or its new ones; the old
+   ones are only reused after the change is committed.  Readers
+   wait while a batch is moved.  A write in progress could land
+   in an old sector after it was copied, so INODE must have no
+   opener besides the caller; otherwise, or if no free run is big
+   enough, the batch is skipped.  Returns false if any batch was
+   skipped. */
+bool
+inode_defrag (struct inode *inode)
+{
+  block_sector_t goal = inode->sector;
+  uint8_t *buffer;
+  bool success = true;
+  size_t cnt, first;
+
+  ASSERT (!inode_is_dir (inode));
+  if (inode->tmp != NULL)
+    return true;
+  buffer = malloc (BLOCK_SECTOR_SIZE);
+  if (buffer == NULL)
+    return false;
+
+  rwlock_acquire_read (&inode->lock);
+  cnt = is_inline (&inode->data) ? 0 : bytes_to_sectors (inode->data.length);
+  rwlock_release_read (&inode->lock);
+
+  for (first = 0; first < cnt; first += DEFRAG_BATCH)
+    {
+      size_t end = first + DEFRAG_BATCH < cnt ? first + DEFRAG_BATCH : cnt;
+      block_sector_t start;
+      size_t i;
+
+      journal_begin ();
+      rwlock_acquire_write (&inode->lock);
+      if (count_fragments (inode, first, end) == 1)
+        goal = (index_to_sector (&inode->data, end - 1, NULL)
+                & ~INODE_UNWRITTEN) + 1;
+      else if (inode->open_cnt == 1
+               && free_map_allocate_near (end - first, goal, &start))
+        {
+          for (i = first; i < end; i++)
+            {
+              block_sector_t old = index_to_sector (&inode->data, i, NULL);
+              block_sector_t new = start + (i - first);
+
+              if (old == 0 || (old & INODE_UNWRITTEN))
+                new |= INODE_UNWRITTEN;
+              else
+                {
+                  cache_read (old, buffer);
+                  write_data (inode, new, buffer, 0, BLOCK_SECTOR_SIZE);
+                }
+              set_data_sector (inode, i, new);
+              if (old != 0)
+                free_map_release (old & ~INODE_UNWRITTEN, 1);
+            }
+          goal = start + (end - first);
+          inode->prealloc.goal = goal;
+        }
+      else
+        success = false;
+      rwlock_release_write (&inode->lock);
+      journal_end ();
+    }
+
+  free (buffer);
+  return success;
 }
 
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
 {
-  return inode->data.length;
+  return (inode->tmp != NULL ? tmpfs_length (inode->tmp)
+          : inode->data.length);
 }
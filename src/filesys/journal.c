@@ -0,0 +1,226 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Write-ahead journal for file system metadata.
+
+   Inodes, index blocks, directories and the free map are changed
+   only in the buffer cache, between journal_begin() and
+   journal_end().  A commit, made by free_map_flush() every few
+   seconds or as soon as JOURNAL_COMMIT_CNT metadata sectors are
+   dirty, waits until no operation is in progress and then
+   writes every dirty metadata sector to the journal, followed
+   by a commit record in the journal header.  Only then are the
+   sectors written to their home locations, after which the
+   header is cleared.  A crash before the commit record leaves
+   the home sectors as of the previous commit; a crash after it
+   is repaired at the next boot by copying the logged sectors
+   home again.  Either way each operation is on disk entirely or
+   not at all, and many operations share the cost of one
+   commit. */
+
+/* Identifies a journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Commit once this many metadata sectors are dirty, so that
+   uncommitted metadata, which the buffer cache never evicts,
+   never takes up much of the cache. */
+#define JOURNAL_COMMIT_CNT (CACHE_SIZE / 4)
+
+/* On-disk journal header, in JOURNAL_SECTOR.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   CNT is nonzero while a committed transaction may not have
+   reached its home sectors: slot I of the journal then holds the
+   new contents of SECTORS[I]. */
+struct journal_header
+  {
+    unsigned magic;                     /* Magic number. */
+    uint32_t cnt;                       /* Number of logged sectors. */
+    block_sector_t sectors[JOURNAL_MAX]; /* Home of each slot. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 2 * sizeof (uint32_t)
+                   - JOURNAL_MAX * sizeof (block_sector_t)];
+  };
+
+/* Header as last written.  Only the committing thread uses it. */
+static struct journal_header header;
+
+/* Operations in progress and the thread committing, if any.
+   journal_lock protects both. */
+static struct lock journal_lock;
+static int op_cnt;
+static struct thread *committer;
+static struct condition ops_done;       /* OP_CNT dropped to 0. */
+static struct condition commit_done;    /* COMMITTER became null. */
+
+static void recover (void);
+static void write_header (const block_sector_t sectors[], size_t cnt);
+
+/* Initializes the journal.  Unless FORMAT is true, first replays
+   the transaction committed last if it may not have been written
+   in place. */
+void
+journal_init (bool format)
+{
+  ASSERT (sizeof header == BLOCK_SECTOR_SIZE);
+
+  lock_init_named (&journal_lock, "journal");
+  cond_init (&ops_done);
+  cond_init (&commit_done);
+  op_cnt = 0;
+  committer = NULL;
+
+  if (!format)
+    recover ();
+  write_header (NULL, 0);
+}
+
+/* Begins an operation that changes metadata.  Waits while a
+   commit is in progress, and commits first if enough metadata
+   has changed: operations in progress hold up the commit, so
+   the uncommitted metadata they find in the cache, which the
+   cache cannot evict, must leave room for them.  Operations
+   nest: only the outermost journal_begin() and journal_end()
+   count.  The committing thread itself never waits. */
+void
+journal_begin (void)
+{
+  struct thread *cur = thread_current ();
+
+  if (cur->journal_depth > 0 || committer == cur)
+    {
+      cur->journal_depth++;
+      return;
+    }
+  if (cache_meta_dirty_cnt () >= JOURNAL_COMMIT_CNT)
+    free_map_flush ();
+  cur->journal_depth++;
+  lock_acquire (&journal_lock);
+  while (committer != NULL)
+    cond_wait (&commit_done, &journal_lock);
+  op_cnt++;
+  lock_release (&journal_lock);
+}
+
+/* Ends an operation begun with journal_begin().  Commits if
+   enough metadata has changed. */
+void
+journal_end (void)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (cur->journal_depth > 0);
+  if (--cur->journal_depth > 0 || committer == cur)
+    return;
+  lock_acquire (&journal_lock);
+  if (--op_cnt == 0)
+    cond_broadcast (&ops_done, &journal_lock);
+  lock_release (&journal_lock);
+
+  if (cache_meta_dirty_cnt () >= JOURNAL_COMMIT_CNT)
+    free_map_flush ();
+}
+
+/* Waits until no operation is in progress and keeps new ones
+   from starting, so that the metadata in the cache is
+   consistent and may be committed. */
+void
+journal_begin_commit (void)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (cur->journal_depth == 0);
+  lock_acquire (&journal_lock);
+  while (committer != NULL)
+    cond_wait (&commit_done, &journal_lock);
+  committer = cur;
+  while (op_cnt > 0)
+    cond_wait (&ops_done, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Lets operations start again after journal_begin_commit(). */
+void
+journal_end_commit (void)
+{
+  lock_acquire (&journal_lock);
+  ASSERT (committer == thread_current ());
+  committer = NULL;
+  cond_broadcast (&commit_done, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Returns true if the running thread is committing, between
+   journal_begin_commit() and journal_end_commit(). */
+bool
+journal_committing (void)
+{
+  return committer == thread_current ();
+}
+
+/* Returns the journal sector that logs the IDX'th sector of a
+   transaction. */
+block_sector_t
+journal_slot (size_t idx)
+{
+  ASSERT (idx < JOURNAL_MAX);
+  return JOURNAL_SECTOR + 1 + idx;
+}
+
+/* Writes the commit record for a transaction of the CNT
+   SECTORS, which must already be logged in slots 0 to CNT - 1.
+   Returns once the record is on disk. */
+void
+journal_commit (const block_sector_t sectors[], size_t cnt)
+{
+  ASSERT (committer == thread_current ());
+  ASSERT (cnt > 0 && cnt <= JOURNAL_MAX);
+  write_header (sectors, cnt);
+}
+
+/* Marks the committed transaction as written in place, so that
+   it is not replayed. */
+void
+journal_checkpointed (void)
+{
+  ASSERT (committer == thread_current ());
+  write_header (NULL, 0);
+}
+
+/* Copies the sectors of a committed transaction home, in case a
+   crash interrupted that. */
+static void
+recover (void)
+{
+  static uint8_t buf[BLOCK_SECTOR_SIZE];
+  size_t i;
+
+  block_read (fs_device, JOURNAL_SECTOR, &header);
+  if (header.magic != JOURNAL_MAGIC || header.cnt == 0
+      || header.cnt > JOURNAL_MAX)
+    return;
+
+  printf ("Replaying %u journaled sectors...\n", (unsigned) header.cnt);
+  for (i = 0; i < header.cnt; i++)
+    {
+      block_read (fs_device, journal_slot (i), buf);
+      block_write (fs_device, header.sectors[i], buf);
+    }
+}
+
+/* Writes a journal header listing the CNT SECTORS. */
+static void
+write_header (const block_sector_t sectors[], size_t cnt)
+{
+  memset (&header, 0, sizeof header);
+  header.magic = JOURNAL_MAGIC;
+  header.cnt = cnt;
+  if (cnt > 0)
+    memcpy (header.sectors, sectors, cnt * sizeof *sectors);
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
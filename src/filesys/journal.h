@@ -0,0 +1,33 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+#include "filesys/cache.h"
+
+/* Largest number of sectors in one journal transaction.  Every
+   sector of a transaction is in the buffer cache when it is
+   committed, so this is the size of the cache. */
+#define JOURNAL_MAX CACHE_SIZE
+
+/* Sectors of the journal: a header holding the commit record,
+   followed by one slot per logged sector.  They are reserved
+   right after the root directory's inode. */
+#define JOURNAL_SECTOR 2
+#define JOURNAL_SECTORS (1 + JOURNAL_MAX)
+
+void journal_init (bool format);
+
+void journal_begin (void);
+void journal_end (void);
+
+void journal_begin_commit (void);
+void journal_end_commit (void);
+bool journal_committing (void);
+
+block_sector_t journal_slot (size_t);
+void journal_commit (const block_sector_t sectors[], size_t cnt);
+void journal_checkpointed (void);
+
+#endif /* filesys/journal.h */
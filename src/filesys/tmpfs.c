@@ -0,0 +1,391 @@
+#include "filesys/tmpfs.h"
+#include <debug.h>
+#include <ohash.h>
+#include <round.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/sysctl.h"
+#include "threads/vaddr.h"
+
+/* Largest file in a tmpfs, the same as on disk. */
+#define TMPFS_FILE_MAX (8 * 1024 * 1024)
+
+/* Most pages of file data in all of tmpfs together, the tunable
+   fs.tmpfs_pages. */
+#define TMPFS_PAGES 256
+static int max_pages = TMPFS_PAGES;
+
+/* A file or directory in tmpfs.  Its data is kept in PAGES, one
+   page of the user pool per PGSIZE bytes; a null page reads as
+   zeros.  The part of a page past the end of the file is always
+   zero, since files never shrink.  Only its inode, through the
+   inode's lock, looks at anything but INUMBER. */
+struct tmpfs_node
+  {
+    block_sector_t inumber;     /* Inode number. */
+    bool is_dir;                /* Is it a directory? */
+    off_t length;               /* File size in bytes. */
+    size_t page_cnt;            /* Number of elements in PAGES. */
+    uint8_t **pages;            /* Data pages, or nulls. */
+  };
+
+/* The nodes by inode number, the next inode number to give out,
+   and the number of data pages in use, and the lock that
+   protects them. */
+static struct ohash nodes;
+static block_sector_t next_inumber;
+static int used_pages;
+static struct lock tmpfs_lock;
+
+/* The directory that tmpfs is mounted on, 0 if none, its inode,
+   kept open so that the directory cannot be removed, and the
+   root of the tmpfs. */
+static block_sector_t mount_point;
+static struct inode *mount_inode;
+static block_sector_t root_inumber;
+
+static uint8_t *get_page (struct tmpfs_node *, size_t idx);
+static void free_page (struct tmpfs_node *, size_t idx);
+
+/* Initializes tmpfs. */
+void
+tmpfs_init (void)
+{
+  if (!ohash_init (&nodes, ohash_word, NULL))
+    PANIC ("out of memory for tmpfs");
+  next_inumber = TMPFS_INUMBER_MIN;
+  used_pages = 0;
+  lock_init_named (&tmpfs_lock, "tmpfs");
+  sysctl_register ("fs.tmpfs_pages", &max_pages, 0, 65536);
+}
+
+/* Mounts an empty tmpfs on the directory named PATH, which is
+   created if it does not exist, and which may be neither the
+   root directory nor itself in tmpfs.  Returns false if PATH is
+   not such a directory, a tmpfs is already mounted, the file
+   system device is too big for tmpfs inode numbers, or memory is
+   exhausted. */
+bool
+tmpfs_mount (const char *path)
+{
+  struct file *file;
+  struct inode *inode, *parent = NULL;
+  block_sector_t inumber, root;
+  struct dir *dir;
+  bool success;
+
+  if (block_size (fs_device) > TMPFS_INUMBER_MIN)
+    return false;
+  file = filesys_open (path);
+  if (file == NULL && filesys_mkdir (path))
+    file = filesys_open (path);
+  if (file == NULL)
+    return false;
+  inode = inode_reopen (file_get_inode (file));
+  file_close (file);
+  inumber = inode_get_inumber (inode);
+  if (!inode_is_dir (inode) || inumber == ROOT_DIR_SECTOR
+      || tmpfs_is_inumber (inumber) || mount_inode != NULL)
+    {
+      inode_close (inode);
+      return false;
+    }
+
+  /* The root's ".." leads back out to the mount point's parent. */
+  dir = dir_open (inode_reopen (inode));
+  if (dir != NULL)
+    dir_lookup (dir, "..", &parent);
+  dir_close (dir);
+  success = (parent != NULL
+             && tmpfs_allocate_inumber (&root)
+             && dir_create (root, 16, inode_get_inumber (parent)));
+  inode_close (parent);
+  if (!success)
+    {
+      inode_close (inode);
+      return false;
+    }
+
+  mount_inode = inode;
+  root_inumber = root;
+  mount_point = inumber;
+  return true;
+}
+
+/* Returns the inode number to open for the directory entry that
+   holds SECTOR: the root of tmpfs if SECTOR is the directory it
+   is mounted on, otherwise SECTOR itself. */
+block_sector_t
+tmpfs_cross (block_sector_t sector)
+{
+  return sector == mount_point && sector != 0 ? root_inumber : sector;
+}
+
+/* Stores a new, unused tmpfs inode number into *SECTORP.
+   Returns false if there are none left. */
+bool
+tmpfs_allocate_inumber (block_sector_t *sectorp)
+{
+  bool success;
+
+  lock_acquire (&tmpfs_lock);
+  success = next_inumber != 0;
+  if (success)
+    *sectorp = next_inumber++;
+  lock_release (&tmpfs_lock);
+  return success;
+}
+
+/* Creates a node with inode number SECTOR, from
+   tmpfs_allocate_inumber(), LENGTH bytes long, all zeros.  It is
+   a directory if IS_DIR is true.  Returns false if LENGTH is too
+   big or memory is exhausted. */
+bool
+tmpfs_create (block_sector_t sector, off_t length, bool is_dir)
+{
+  struct tmpfs_node *node;
+  bool success;
+
+  ASSERT (tmpfs_is_inumber (sector));
+  ASSERT (length >= 0);
+
+  if (length > TMPFS_FILE_MAX)
+    return false;
+  node = malloc (sizeof *node);
+  if (node == NULL)
+    return false;
+  node->inumber = sector;
+  node->is_dir = is_dir;
+  node->length = length;
+  node->page_cnt = 0;
+  node->pages = NULL;
+
+  lock_acquire (&tmpfs_lock);
+  success = ohash_insert (&nodes, sector, node);
+  lock_release (&tmpfs_lock);
+  if (!success)
+    free (node);
+  return success;
+}
+
+/* Returns the node with inode number SECTOR, or a null pointer
+   if there is none. */
+struct tmpfs_node *
+tmpfs_lookup (block_sector_t sector)
+{
+  struct tmpfs_node *node;
+
+  lock_acquire (&tmpfs_lock);
+  node = ohash_find (&nodes, sector);
+  lock_release (&tmpfs_lock);
+  return node;
+}
+
+/* Deletes the node with inode number SECTOR, if there is one,
+   with its data.  Its inode must not be open. */
+void
+tmpfs_release (block_sector_t sector)
+{
+  struct tmpfs_node *node;
+  size_t i;
+
+  lock_acquire (&tmpfs_lock);
+  node = ohash_delete (&nodes, sector);
+  lock_release (&tmpfs_lock);
+  if (node == NULL)
+    return;
+
+  for (i = 0; i < node->page_cnt; i++)
+    free_page (node, i);
+  free (node->pages);
+  free (node);
+}
+
+/* Reads SIZE bytes from NODE into BUFFER, starting at position
+   OFFSET.  Returns the number of bytes read, which is less than
+   SIZE at end of file. */
+off_t
+tmpfs_read (struct tmpfs_node *node, void *buffer_, off_t size,
+            off_t offset)
+{
+  uint8_t *buffer = buffer_;
+  off_t bytes_read = 0;
+
+  if (offset >= node->length)
+    return 0;
+  if (size > node->length - offset)
+    size = node->length - offset;
+  while (size > 0)
+    {
+      size_t idx = offset / PGSIZE;
+      int page_ofs = offset % PGSIZE;
+      off_t chunk_size = PGSIZE - page_ofs;
+
+      if (size < chunk_size)
+        chunk_size = size;
+      if (idx < node->page_cnt && node->pages[idx] != NULL)
+        memcpy (buffer + bytes_read, node->pages[idx] + page_ofs,
+                chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
+
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_read += chunk_size;
+    }
+  return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER into NODE, starting at OFFSET,
+   extending it if the write ends past end of file.  Returns the
+   number of bytes written, which is less than SIZE if the file
+   would grow too big or tmpfs is out of pages. */
+off_t
+tmpfs_write (struct tmpfs_node *node, const void *buffer_, off_t size,
+             off_t offset)
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+
+  if (offset >= TMPFS_FILE_MAX)
+    return 0;
+  if (size > TMPFS_FILE_MAX - offset)
+    size = TMPFS_FILE_MAX - offset;
+  while (size > 0)
+    {
+      size_t idx = offset / PGSIZE;
+      int page_ofs = offset % PGSIZE;
+      off_t chunk_size = PGSIZE - page_ofs;
+      uint8_t *page = get_page (node, idx);
+
+      if (page == NULL)
+        break;
+      if (size < chunk_size)
+        chunk_size = size;
+      memcpy (page + page_ofs, buffer + bytes_written, chunk_size);
+
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_written += chunk_size;
+    }
+  if (bytes_written > 0 && offset > node->length)
+    node->length = offset;
+  return bytes_written;
+}
+
+/* Gives bytes OFFSET up to OFFSET + LEN of NODE pages of their
+   own, growing the file if it is shorter, so that writes there
+   cannot run out of pages.  Returns false if the file would be
+   too big or tmpfs is out of pages; pages taken by then are
+   kept, but the length is unchanged. */
+bool
+tmpfs_allocate (struct tmpfs_node *node, off_t offset, off_t len)
+{
+  off_t end = offset + len;
+  size_t idx;
+
+  if (end > TMPFS_FILE_MAX)
+    return false;
+  for (idx = offset / PGSIZE; (off_t) (idx * PGSIZE) < end; idx++)
+    if (get_page (node, idx) == NULL)
+      return false;
+  if (end > node->length)
+    node->length = end;
+  return true;
+}
+
+/* Frees the pages of NODE that bytes OFFSET up to OFFSET + LEN
+   cover entirely as far as the file goes, and zeros the parts of
+   the pages at either end that the range covers.  The length of
+   the file is unchanged. */
+void
+tmpfs_punch (struct tmpfs_node *node, off_t offset, off_t len)
+{
+  off_t end = offset + len < node->length ? offset + len : node->length;
+
+  while (offset < end)
+    {
+      size_t idx = offset / PGSIZE;
+      int page_ofs = offset % PGSIZE;
+      off_t chunk_size = PGSIZE - page_ofs;
+
+      if (end - offset < chunk_size)
+        chunk_size = end - offset;
+      if (page_ofs == 0
+          && (chunk_size == PGSIZE || offset + chunk_size == node->length))
+        free_page (node, idx);
+      else if (idx < node->page_cnt && node->pages[idx] != NULL)
+        memset (node->pages[idx] + page_ofs, 0, chunk_size);
+      offset += chunk_size;
+    }
+}
+
+/* Returns the length, in bytes, of NODE's data. */
+off_t
+tmpfs_length (const struct tmpfs_node *node)
+{
+  return node->length;
+}
+
+/* Returns true if NODE is a directory. */
+bool
+tmpfs_is_dir (const struct tmpfs_node *node)
+{
+  return node->is_dir;
+}
+
+/* Returns data page IDX of NODE, taking a zeroed page for it
+   first if it has none.  Returns a null pointer if tmpfs is out
+   of pages or memory is exhausted. */
+static uint8_t *
+get_page (struct tmpfs_node *node, size_t idx)
+{
+  uint8_t *page;
+
+  if (idx >= node->page_cnt)
+    {
+      size_t page_cnt = DIV_ROUND_UP (TMPFS_FILE_MAX, PGSIZE);
+      uint8_t **pages;
+
+      /* Grow the array to twice the size needed, but no bigger
+         than the largest file needs. */
+      if (page_cnt > (idx + 1) * 2)
+        page_cnt = (idx + 1) * 2;
+      pages = realloc (node->pages, page_cnt * sizeof *pages);
+      if (pages == NULL)
+        return NULL;
+      memset (pages + node->page_cnt, 0,
+              (page_cnt - node->page_cnt) * sizeof *pages);
+      node->pages = pages;
+      node->page_cnt = page_cnt;
+    }
+  if (node->pages[idx] != NULL)
+    return node->pages[idx];
+
+  lock_acquire (&tmpfs_lock);
+  page = used_pages < max_pages ? palloc_get_page (PAL_USER | PAL_ZERO) : NULL;
+  if (page != NULL)
+    used_pages++;
+  lock_release (&tmpfs_lock);
+  node->pages[idx] = page;
+  return page;
+}
+
+/* Frees data page IDX of NODE, if it has one. */
+static void
+free_page (struct tmpfs_node *node, size_t idx)
+{
+  if (idx >= node->page_cnt || node->pages[idx] == NULL)
+    return;
+  palloc_free_page (node->pages[idx]);
+  node->pages[idx] = NULL;
+  lock_acquire (&tmpfs_lock);
+  used_pages--;
+  lock_release (&tmpfs_lock);
+}
@@ -0,0 +1,54 @@
+#ifndef FILESYS_TMPFS_H
+#define FILESYS_TMPFS_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Memory-resident file system.
+
+   Files and directories in a tmpfs have inodes like those on
+   disk, opened and used through filesys/inode.h, but they live
+   only in memory: their data is kept in pages of the user pool,
+   and their inode numbers come from a range above any disk
+   sector number, so that directory entries and the open inode
+   table tell them apart without any change.  Nothing about them
+   goes through the buffer cache, the free map or the journal,
+   and all of it is lost when Pintos shuts down.
+
+   One tmpfs may be mounted, over an existing directory of the
+   file system; dir_lookup() then leads to its root instead of
+   the directory beneath it. */
+
+/* Inode numbers at or above this one belong to tmpfs. */
+#define TMPFS_INUMBER_MIN 0xf0000000u
+
+/* Returns true if SECTOR is a tmpfs inode number. */
+static inline bool
+tmpfs_is_inumber (block_sector_t sector)
+{
+  return sector >= TMPFS_INUMBER_MIN;
+}
+
+struct tmpfs_node;
+
+void tmpfs_init (void);
+bool tmpfs_mount (const char *path);
+block_sector_t tmpfs_cross (block_sector_t);
+
+/* Creating and deleting files, for filesys/inode.c. */
+bool tmpfs_allocate_inumber (block_sector_t *);
+bool tmpfs_create (block_sector_t, off_t length, bool is_dir);
+struct tmpfs_node *tmpfs_lookup (block_sector_t);
+void tmpfs_release (block_sector_t);
+
+/* Data of a file, for filesys/inode.c, which locks it. */
+off_t tmpfs_read (struct tmpfs_node *, void *, off_t size, off_t offset);
+off_t tmpfs_write (struct tmpfs_node *, const void *, off_t size,
+                   off_t offset);
+bool tmpfs_allocate (struct tmpfs_node *, off_t offset, off_t len);
+void tmpfs_punch (struct tmpfs_node *, off_t offset, off_t len);
+off_t tmpfs_length (const struct tmpfs_node *);
+bool tmpfs_is_dir (const struct tmpfs_node *);
+
+#endif /* filesys/tmpfs.h */
@@ -0,0 +1,32 @@
+#ifndef __LIB_AIO_H
+#define __LIB_AIO_H
+
+/* A read or write submitted with aio_submit(). */
+struct aio_request
+  {
+    int fd;                     /* Open file. */
+    int op;                     /* AIO_READ or AIO_WRITE. */
+    void *buffer;               /* Data to write, or room to read into. */
+    unsigned size;              /* Bytes to transfer. */
+    unsigned ofs;               /* Offset in the file. */
+    int id;                     /* Returned in the request's event. */
+  };
+
+/* The completion of a request, returned by aio_getevents(). */
+struct aio_event
+  {
+    int id;                     /* ID of the request. */
+    int result;                 /* Bytes transferred, or -1. */
+  };
+
+/* Operations. */
+#define AIO_READ 0              /* Read from the file. */
+#define AIO_WRITE 1             /* Write to the file. */
+
+/* Most requests a process may have submitted and not reaped. */
+#define AIO_MAX 32
+
+/* Most bytes in one request. */
+#define AIO_SIZE_MAX 16384
+
+#endif /* lib/aio.h */
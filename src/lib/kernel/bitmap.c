@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -21,13 +22,26 @@ typedef unsigned long elem_type;
 /* Number of bits in an element. */
 #define ELEM_BITS (sizeof (elem_type) * CHAR_BIT)
 
+/* Bitmaps with more than this many elements keep a summary. */
+#define SUMMARY_MIN ELEM_BITS
+
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   Scans work a whole element at a time.  A large bitmap also has
+   a summary, a second bitmap with one bit per element that is
+   set only if that element's bits are all true, so that a search
+   for a false bit in a nearly full bitmap skips ELEM_BITS
+   elements at a time.  The summary is allocated right after the
+   elements.  A summary bit may be clear for a full element, which
+   only costs time, but is never set for an element that has a
+   false bit. */
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    elem_type *full;    /* Summary of full elements, or null. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -69,6 +83,115 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+static size_t find_next (const struct bitmap *, size_t start, size_t end,
+                         bool value);
+
+/* Returns the number of bytes of summary for BIT_CNT bits. */
+static inline size_t
+summary_byte_cnt (size_t bit_cnt)
+{
+  return elem_cnt (bit_cnt) > SUMMARY_MIN ? byte_cnt (elem_cnt (bit_cnt)) : 0;
+}
+
+/* Returns a bit mask in which the bits actually used in element
+   IDX of B are set to 1 and the rest are set to 0. */
+static inline elem_type
+used_mask (const struct bitmap *b, size_t idx)
+{
+  return idx == elem_cnt (b->bit_cnt) - 1 ? last_mask (b) : (elem_type) -1;
+}
+
+/* Returns a bit mask with bits LO through HI - 1 set, where
+   LO < HI <= ELEM_BITS. */
+static inline elem_type
+range_mask (size_t lo, size_t hi)
+{
+  return ((elem_type) -1 >> (ELEM_BITS - (hi - lo))) << lo;
+}
+
+/* Returns the index of the lowest set bit in X, which must be
+   nonzero. */
+static inline size_t
+lowest_bit (elem_type x)
+{
+  return __builtin_ctzl (x);
+}
+
+/* Returns the number of set bits in X. */
+static inline size_t
+bit_count (elem_type x)
+{
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0f0f0f0f;
+  return (x * 0x01010101) >> 24;
+}
+
+/* Atomically sets the bits of MASK in *E.  This is equivalent to
+   `*e |= mask' except that it is guaranteed to be atomic on a
+   uniprocessor machine.  See the description of the OR
+   instruction in [IA32-v2b]. */
+static inline void
+elem_or (elem_type *e, elem_type mask)
+{
+  asm ("orl %1, %0" : "+m" (*e) : "r" (mask) : "cc");
+}
+
+/* Atomically clears the bits of MASK in *E.  This is equivalent to
+   `*e &= ~mask' except that it is guaranteed to be atomic on a
+   uniprocessor machine.  See the description of the AND
+   instruction in [IA32-v2a]. */
+static inline void
+elem_and_not (elem_type *e, elem_type mask)
+{
+  asm ("andl %1, %0" : "+m" (*e) : "r" (~mask) : "cc");
+}
+
+/* Returns true if every used bit of element IDX of B is set. */
+static inline bool
+elem_is_full (const struct bitmap *b, size_t idx)
+{
+  return (b->bits[idx] | ~used_mask (b, idx)) == (elem_type) -1;
+}
+
+/* Brings the summary bit for element IDX of B up to date after a
+   change to the element.  A concurrent change may empty the
+   element just after the summary bit is set, so the element is
+   checked again afterward; the thread making that change clears
+   the bit itself if it gets there last. */
+static void
+update_summary (struct bitmap *b, size_t idx)
+{
+  elem_type *s;
+  elem_type mask;
+
+  if (b->full == NULL)
+    return;
+  s = &b->full[elem_idx (idx)];
+  mask = bit_mask (idx);
+  if (elem_is_full (b, idx))
+    {
+      elem_or (s, mask);
+      if (!elem_is_full (b, idx))
+        elem_and_not (s, mask);
+    }
+  else
+    elem_and_not (s, mask);
+}
+
+#ifdef FILESYS
+/* Recomputes the whole summary of B. */
+static void
+rebuild_summary (struct bitmap *b)
+{
+  size_t i;
+
+  if (b->full != NULL)
+    for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+      update_summary (b, i);
+}
+#endif
+
 /* Creation and destruction. */
 
 /* Creates and returns a pointer to a newly allocated bitmap with room for
@@ -82,9 +205,15 @@ bitmap_create (size_t bit_cnt)
   if (b != NULL)
     {
       b->bit_cnt = bit_cnt;
-      b->bits = malloc (byte_cnt (bit_cnt));
+      b->bits = malloc (byte_cnt (bit_cnt) + summary_byte_cnt (bit_cnt));
       if (b->bits != NULL || bit_cnt == 0)
         {
+          b->full = NULL;
+          if (summary_byte_cnt (bit_cnt) > 0)
+            {
+              b->full = b->bits + elem_cnt (bit_cnt);
+              memset (b->full, 0, summary_byte_cnt (bit_cnt));
+            }
           bitmap_set_all (b, false);
           return b;
         }
@@ -105,6 +234,12 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->full = NULL;
+  if (summary_byte_cnt (bit_cnt) > 0)
+    {
+      b->full = b->bits + elem_cnt (bit_cnt);
+      memset (b->full, 0, summary_byte_cnt (bit_cnt));
+    }
   bitmap_set_all (b, false);
   return b;
 }
@@ -114,7 +249,8 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 size_t
 bitmap_buf_size (size_t bit_cnt) 
 {
-  return sizeof (struct bitmap) + byte_cnt (bit_cnt);
+  return sizeof (struct bitmap) + byte_cnt (bit_cnt)
+         + summary_byte_cnt (bit_cnt);
 }
 
 /* Destroys bitmap B, freeing its storage.
@@ -157,12 +293,9 @@ void
 bitmap_mark (struct bitmap *b, size_t bit_idx) 
 {
   size_t idx = elem_idx (bit_idx);
-  elem_type mask = bit_mask (bit_idx);
 
-  /* This is equivalent to `b->bits[idx] |= mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the OR instruction in [IA32-v2b]. */
-  asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  elem_or (&b->bits[idx], bit_mask (bit_idx));
+  update_summary (b, idx);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -170,12 +303,9 @@ void
 bitmap_reset (struct bitmap *b, size_t bit_idx) 
 {
   size_t idx = elem_idx (bit_idx);
-  elem_type mask = bit_mask (bit_idx);
 
-  /* This is equivalent to `b->bits[idx] &= ~mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the AND instruction in [IA32-v2a]. */
-  asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  elem_and_not (&b->bits[idx], bit_mask (bit_idx));
+  update_summary (b, idx);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -190,7 +320,8 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
   /* This is equivalent to `b->bits[idx] ^= mask' except that it
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
-  asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  asm ("xorl %1, %0" : "+m" (b->bits[idx]) : "r" (mask) : "cc");
+  update_summary (b, idx);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -217,14 +348,28 @@ bitmap_set_all (struct bitmap *b, bool value)
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
+  size_t end = start + cnt;
+
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  /* Set the bits a whole element, or the part of one in range, at
+     a time. */
+  while (start < end)
+    {
+      size_t idx = elem_idx (start);
+      size_t hi = end - idx * ELEM_BITS;
+      elem_type mask = range_mask (start % ELEM_BITS,
+                                   hi < ELEM_BITS ? hi : ELEM_BITS);
+
+      if (value)
+        elem_or (&b->bits[idx], mask);
+      else
+        elem_and_not (&b->bits[idx], mask);
+      update_summary (b, idx);
+      start = (idx + 1) * ELEM_BITS;
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,17 +377,24 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t end = start + cnt;
+  size_t true_cnt = 0;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  while (start < end)
+    {
+      size_t idx = elem_idx (start);
+      size_t hi = end - idx * ELEM_BITS;
+      elem_type mask = range_mask (start % ELEM_BITS,
+                                   hi < ELEM_BITS ? hi : ELEM_BITS);
+
+      true_cnt += bit_count (b->bits[idx] & mask);
+      start = (idx + 1) * ELEM_BITS;
+    }
+  return value ? true_cnt : cnt - true_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -250,16 +402,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_next (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -288,6 +435,57 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 
 /* Finding set or unset bits. */
 
+/* Returns the index of the first element at or after IDX, and
+   before END_IDX, whose summary bit in B is clear, or END_IDX if
+   there is none. */
+static size_t
+next_nonfull_elem (const struct bitmap *b, size_t idx, size_t end_idx)
+{
+  size_t word = elem_idx (idx);
+  elem_type x = ~b->full[word] & ((elem_type) -1 << (idx % ELEM_BITS));
+
+  while (x == 0)
+    {
+      if (++word * ELEM_BITS >= end_idx)
+        return end_idx;
+      x = ~b->full[word];
+    }
+  idx = word * ELEM_BITS + lowest_bit (x);
+  return idx < end_idx ? idx : end_idx;
+}
+
+/* Returns the index of the first bit in B at or after START, and
+   before END, that is set to VALUE, or END if there is none. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t idx, end_idx;
+  elem_type x;
+
+  if (start >= end)
+    return end;
+
+  idx = elem_idx (start);
+  end_idx = elem_cnt (end);
+  x = (b->bits[idx] ^ flip) & ((elem_type) -1 << (start % ELEM_BITS));
+  while (x == 0)
+    {
+      if (++idx >= end_idx)
+        return end;
+      if (!value && b->full != NULL)
+        {
+          idx = next_nonfull_elem (b, idx, end_idx);
+          if (idx >= end_idx)
+            return end;
+        }
+      x = b->bits[idx] ^ flip;
+    }
+
+  start = idx * ELEM_BITS + lowest_bit (x);
+  return start < end ? start : end;
+}
+
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
@@ -298,13 +496,30 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
+  if (cnt == 0)
+    return start;
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      /* Find the next bit set to VALUE, then the end of the run of
+         such bits that it starts.  A run too short to hold CNT
+         bits is skipped entirely. */
+      for (;;)
+        {
+          size_t end;
+
+          i = find_next (b, i, b->bit_cnt, value);
+          if (i > last)
+            break;
+          if (cnt == 1)
+            return i;
+          end = find_next (b, i, i + cnt, !value);
+          if (end == i + cnt)
+            return i;
+          i = end;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -346,6 +561,7 @@ bitmap_read (struct bitmap *b, struct file *file)
       off_t size = byte_cnt (b->bit_cnt);
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      rebuild_summary (b);
     }
   return success;
 }
@@ -6,6 +6,7 @@
    See hash.h for basic information. */
 
 #include "hash.h"
+#include <string.h>
 #include "../debug.h"
 #include "threads/malloc.h"
 
@@ -18,6 +19,20 @@ static struct hash_elem *find_elem (struct hash *, struct list *,
 static void insert_elem (struct hash *, struct list *, struct hash_elem *);
 static void remove_elem (struct hash *, struct hash_elem *);
 static void rehash (struct hash *);
+static bool resize (struct hash *, size_t bucket_cnt);
+static void migrate (struct hash *, size_t bucket_cnt);
+
+/* Element per bucket ratios. */
+#define MIN_ELEMS_PER_BUCKET  1 /* Elems/bucket < 1: reduce # of buckets. */
+#define BEST_ELEMS_PER_BUCKET 2 /* Ideal elems/bucket. */
+#define MAX_ELEMS_PER_BUCKET  4 /* Elems/bucket > 4: increase # of buckets. */
+
+/* Smallest number of buckets a table has. */
+#define MIN_BUCKET_CNT 4
+
+/* Number of old buckets emptied by each insertion or deletion
+   while the table is being resized. */
+#define MIGRATE_STEP 2
 
 /* Initializes hash table H to compute hash values using HASH and
    compare hash elements using LESS, given auxiliary data AUX. */
@@ -26,8 +41,12 @@ hash_init (struct hash *h,
            hash_hash_func *hash, hash_less_func *less, void *aux) 
 {
   h->elem_cnt = 0;
-  h->bucket_cnt = 4;
+  h->bucket_cnt = MIN_BUCKET_CNT;
   h->buckets = malloc (sizeof *h->buckets * h->bucket_cnt);
+  h->old_buckets = NULL;
+  h->old_bucket_cnt = h->migrate_idx = 0;
+  h->min_bucket_cnt = MIN_BUCKET_CNT;
+  h->load = BEST_ELEMS_PER_BUCKET;
   h->hash = hash;
   h->less = less;
   h->aux = aux;
@@ -55,6 +74,7 @@ hash_clear (struct hash *h, hash_action_func *destructor)
 {
   size_t i;
 
+  migrate (h, SIZE_MAX);
   for (i = 0; i < h->bucket_cnt; i++) 
     {
       struct list *bucket = &h->buckets[i];
@@ -88,9 +108,42 @@ hash_destroy (struct hash *h, hash_action_func *destructor)
 {
   if (destructor != NULL)
     hash_clear (h, destructor);
+  free (h->old_buckets);
   free (h->buckets);
 }
 
+/* Makes hash table H aim for ELEMS_PER_BUCKET elements per
+   bucket, on average, instead of the default of 2.  A lower load
+   makes lookups faster at the cost of memory.  Takes effect
+   gradually, as elements are inserted and deleted. */
+void
+hash_set_load (struct hash *h, unsigned elems_per_bucket)
+{
+  ASSERT (elems_per_bucket > 0);
+
+  h->load = elems_per_bucket;
+}
+
+/* Sizes hash table H for ELEM_CNT elements at its target load,
+   and keeps it from shrinking below that size, so that growing
+   to ELEM_CNT elements involves no resizing.  Returns false if
+   memory for the buckets could not be allocated, in which case
+   the table is still usable. */
+bool
+hash_reserve (struct hash *h, size_t elem_cnt)
+{
+  size_t bucket_cnt = MIN_BUCKET_CNT;
+
+  while (bucket_cnt < elem_cnt / h->load)
+    bucket_cnt *= 2;
+  h->min_bucket_cnt = bucket_cnt;
+  if (h->bucket_cnt >= bucket_cnt)
+    return true;
+
+  migrate (h, SIZE_MAX);
+  return resize (h, bucket_cnt);
+}
+
 /* Inserts NEW into hash table H and returns a null pointer, if
    no equal element is already in the table.
    If an equal element is already in the table, returns it
@@ -166,6 +219,7 @@ hash_apply (struct hash *h, hash_action_func *action)
   
   ASSERT (action != NULL);
 
+  migrate (h, SIZE_MAX);
   for (i = 0; i < h->bucket_cnt; i++) 
     {
       struct list *bucket = &h->buckets[i];
@@ -195,13 +249,17 @@ hash_apply (struct hash *h, hash_action_func *action)
    Modifying hash table H during iteration, using any of the
    functions hash_clear(), hash_destroy(), hash_insert(),
    hash_replace(), or hash_delete(), invalidates all
-   iterators. */
+   iterators.
+
+   If H is being resized, the resize is completed first, so that
+   all of its elements are in a single bucket array. */
 void
 hash_first (struct hash_iterator *i, struct hash *h) 
 {
   ASSERT (i != NULL);
   ASSERT (h != NULL);
 
+  migrate (h, SIZE_MAX);
   i->hash = h;
   i->bucket = i->hash->buckets;
   i->elem = list_elem_to_hash_elem (list_head (i->bucket));
@@ -257,56 +315,110 @@ hash_empty (struct hash *h)
   return h->elem_cnt == 0;
 }
 
-/* Fowler-Noll-Vo hash constants, for 32-bit word sizes. */
-#define FNV_32_PRIME 16777619u
-#define FNV_32_BASIS 2166136261u
+/* The hash functions below are MurmurHash3, 32-bit variant by
+   Austin Appleby, which consumes its input a word at a time and
+   mixes the result well enough that the bucket index can be
+   taken from the low bits. */
+#define MURMUR_C1 0xcc9e2d51u
+#define MURMUR_C2 0x1b873593u
+
+/* Rotates X left by N bits. */
+static inline uint32_t
+rotl32 (uint32_t x, int n)
+{
+  return (x << n) | (x >> (32 - n));
+}
+
+/* Mixes word K into hash H. */
+static inline uint32_t
+murmur_mix (uint32_t h, uint32_t k)
+{
+  k *= MURMUR_C1;
+  k = rotl32 (k, 15);
+  k *= MURMUR_C2;
+
+  h ^= k;
+  h = rotl32 (h, 13);
+  return h * 5 + 0xe6546b64u;
+}
+
+/* Finishes hash H of SIZE bytes, so that every input bit affects
+   every output bit. */
+static inline uint32_t
+murmur_finish (uint32_t h, size_t size)
+{
+  h ^= size;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
 
 /* Returns a hash of the SIZE bytes in BUF. */
 unsigned
 hash_bytes (const void *buf_, size_t size)
 {
-  /* Fowler-Noll-Vo 32-bit hash, for bytes. */
-  const unsigned char *buf = buf_;
-  unsigned hash;
+  const uint8_t *buf = buf_;
+  size_t left = size;
+  uint32_t hash = 0;
+  uint32_t k = 0;
 
   ASSERT (buf != NULL);
 
-  hash = FNV_32_BASIS;
-  while (size-- > 0)
-    hash = (hash * FNV_32_PRIME) ^ *buf++;
+  for (; left >= sizeof k; left -= sizeof k, buf += sizeof k)
+    {
+      memcpy (&k, buf, sizeof k);
+      hash = murmur_mix (hash, k);
+    }
 
-  return hash;
+  /* Mix in the last 1 to 3 bytes, if any, without the rotation by
+     13 that a whole word gets. */
+  if (left > 0)
+    {
+      k = 0;
+      memcpy (&k, buf, left);
+      k *= MURMUR_C1;
+      k = rotl32 (k, 15);
+      k *= MURMUR_C2;
+      hash ^= k;
+    }
+
+  return murmur_finish (hash, size);
 } 
 
 /* Returns a hash of string S. */
 unsigned
-hash_string (const char *s_) 
+hash_string (const char *s) 
 {
-  const unsigned char *s = (const unsigned char *) s_;
-  unsigned hash;
-
   ASSERT (s != NULL);
 
-  hash = FNV_32_BASIS;
-  while (*s != '\0')
-    hash = (hash * FNV_32_PRIME) ^ *s++;
-
-  return hash;
+  return hash_bytes (s, strlen (s));
 }
 
 /* Returns a hash of integer I. */
 unsigned
 hash_int (int i) 
 {
-  return hash_bytes (&i, sizeof i);
+  return murmur_finish (murmur_mix (0, i), sizeof i);
 }
-
-/* Returns the bucket in H that E belongs in. */
+
+/* Returns the bucket in H that E belongs in.  While H is being
+   resized, that is E's old bucket if it has not been emptied
+   yet. */
 static struct list *
 find_bucket (struct hash *h, struct hash_elem *e) 
 {
-  size_t bucket_idx = h->hash (e, h->aux) & (h->bucket_cnt - 1);
-  return &h->buckets[bucket_idx];
+  unsigned hash = h->hash (e, h->aux);
+
+  if (h->old_buckets != NULL)
+    {
+      size_t old_idx = hash & (h->old_bucket_cnt - 1);
+      if (old_idx >= h->migrate_idx)
+        return &h->old_buckets[old_idx];
+    }
+  return &h->buckets[hash & (h->bucket_cnt - 1)];
 }
 
 /* Searches BUCKET in H for a hash element equal to E.  Returns
@@ -339,41 +451,51 @@ is_power_of_2 (size_t x)
   return x != 0 && turn_off_least_1bit (x) == 0;
 }
 
-/* Element per bucket ratios. */
-#define MIN_ELEMS_PER_BUCKET  1 /* Elems/bucket < 1: reduce # of buckets. */
-#define BEST_ELEMS_PER_BUCKET 2 /* Ideal elems/bucket. */
-#define MAX_ELEMS_PER_BUCKET  4 /* Elems/bucket > 4: increase # of buckets. */
-
-/* Changes the number of buckets in hash table H to match the
-   ideal.  This function can fail because of an out-of-memory
-   condition, but that'll just make hash accesses less efficient;
-   we can still continue. */
+/* Moves hash table H toward the ideal number of buckets.  If a
+   resize is in progress, empties a few more of its old buckets.
+   Otherwise, starts a resize if the number of buckets is far
+   enough from the ideal.  Allocating the new buckets can fail
+   because of an out-of-memory condition, but that'll just make
+   hash accesses less efficient; we can still continue. */
 static void
 rehash (struct hash *h) 
 {
-  size_t old_bucket_cnt, new_bucket_cnt;
-  struct list *new_buckets, *old_buckets;
-  size_t i;
+  size_t new_bucket_cnt;
 
   ASSERT (h != NULL);
 
-  /* Save old bucket info for later use. */
-  old_buckets = h->buckets;
-  old_bucket_cnt = h->bucket_cnt;
+  if (h->old_buckets != NULL)
+    {
+      migrate (h, MIGRATE_STEP);
+      return;
+    }
 
   /* Calculate the number of buckets to use now.
-     We want one bucket for about every BEST_ELEMS_PER_BUCKET.
-     We must have at least four buckets, and the number of
-     buckets must be a power of 2. */
-  new_bucket_cnt = h->elem_cnt / BEST_ELEMS_PER_BUCKET;
-  if (new_bucket_cnt < 4)
-    new_bucket_cnt = 4;
+     We want one bucket for about every `load' elements.
+     We must have at least min_bucket_cnt buckets, and the number
+     of buckets must be a power of 2. */
+  new_bucket_cnt = h->elem_cnt / h->load;
+  if (new_bucket_cnt < h->min_bucket_cnt)
+    new_bucket_cnt = h->min_bucket_cnt;
   while (!is_power_of_2 (new_bucket_cnt))
     new_bucket_cnt = turn_off_least_1bit (new_bucket_cnt);
 
   /* Don't do anything if the bucket count wouldn't change. */
-  if (new_bucket_cnt == old_bucket_cnt)
-    return;
+  if (new_bucket_cnt != h->bucket_cnt)
+    resize (h, new_bucket_cnt);
+}
+
+/* Starts resizing hash table H, which must not already be
+   resizing, to NEW_BUCKET_CNT buckets.  Returns false if the new
+   buckets could not be allocated. */
+static bool
+resize (struct hash *h, size_t new_bucket_cnt)
+{
+  struct list *new_buckets;
+  size_t i;
+
+  ASSERT (h->old_buckets == NULL);
+  ASSERT (is_power_of_2 (new_bucket_cnt));
 
   /* Allocate new buckets and initialize them as empty. */
   new_buckets = malloc (sizeof *new_buckets * new_bucket_cnt);
@@ -382,34 +504,52 @@ rehash (struct hash *h)
       /* Allocation failed.  This means that use of the hash table will
          be less efficient.  However, it is still usable, so
          there's no reason for it to be an error. */
-      return;
+      return false;
     }
   for (i = 0; i < new_bucket_cnt; i++) 
     list_init (&new_buckets[i]);
 
-  /* Install new bucket info. */
+  /* Install new bucket info.  The elements stay in the old
+     buckets until migrate() moves them. */
+  h->old_buckets = h->buckets;
+  h->old_bucket_cnt = h->bucket_cnt;
+  h->migrate_idx = 0;
   h->buckets = new_buckets;
   h->bucket_cnt = new_bucket_cnt;
+  migrate (h, MIGRATE_STEP);
+  return true;
+}
+
+/* Moves the elements of up to BUCKET_CNT more old buckets of
+   hash table H into its new buckets, and frees the old bucket
+   array once it is empty.  Does nothing if H is not being
+   resized. */
+static void
+migrate (struct hash *h, size_t bucket_cnt)
+{
+  if (h->old_buckets == NULL)
+    return;
 
-  /* Move each old element into the appropriate new bucket. */
-  for (i = 0; i < old_bucket_cnt; i++) 
+  for (; bucket_cnt > 0 && h->migrate_idx < h->old_bucket_cnt; bucket_cnt--)
     {
-      struct list *old_bucket;
-      struct list_elem *elem, *next;
+      struct list *old_bucket = &h->old_buckets[h->migrate_idx++];
 
-      old_bucket = &old_buckets[i];
-      for (elem = list_begin (old_bucket);
-           elem != list_end (old_bucket); elem = next) 
+      while (!list_empty (old_bucket))
         {
-          struct list *new_bucket
-            = find_bucket (h, list_elem_to_hash_elem (elem));
-          next = list_next (elem);
-          list_remove (elem);
-          list_push_front (new_bucket, elem);
+          struct list_elem *elem = list_pop_front (old_bucket);
+          struct hash_elem *e = list_elem_to_hash_elem (elem);
+          size_t idx = h->hash (e, h->aux) & (h->bucket_cnt - 1);
+
+          list_push_front (&h->buckets[idx], elem);
         }
     }
 
-  free (old_buckets);
+  if (h->migrate_idx >= h->old_bucket_cnt)
+    {
+      free (h->old_buckets);
+      h->old_buckets = NULL;
+      h->old_bucket_cnt = h->migrate_idx = 0;
+    }
 }
 
 /* Inserts E into BUCKET (in hash table H). */
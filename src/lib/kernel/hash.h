@@ -18,7 +18,13 @@
    conversion from a struct hash_elem back to a structure object
    that contains it.  This is the same technique used in the
    linked list implementation.  Refer to lib/kernel/list.h for a
-   detailed explanation. */
+   detailed explanation.
+
+   The table resizes itself to keep about `load' elements per
+   bucket, 2 by default.  Resizing is incremental: the elements of
+   the old bucket array move to the new one a few buckets at a
+   time, as part of later insertions and deletions, so that no
+   single operation has to move them all. */
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -61,6 +67,11 @@ struct hash
     size_t elem_cnt;            /* Number of elements in table. */
     size_t bucket_cnt;          /* Number of buckets, a power of 2. */
     struct list *buckets;       /* Array of `bucket_cnt' lists. */
+    struct list *old_buckets;   /* Array being emptied, or null. */
+    size_t old_bucket_cnt;      /* Number of lists in `old_buckets'. */
+    size_t migrate_idx;         /* Old buckets before this are empty. */
+    size_t min_bucket_cnt;      /* Never shrink below this. */
+    unsigned load;              /* Target elements per bucket. */
     hash_hash_func *hash;       /* Hash function. */
     hash_less_func *less;       /* Comparison function. */
     void *aux;                  /* Auxiliary data for `hash' and `less'. */
@@ -78,6 +89,8 @@ struct hash_iterator
 bool hash_init (struct hash *, hash_hash_func *, hash_less_func *, void *aux);
 void hash_clear (struct hash *, hash_action_func *);
 void hash_destroy (struct hash *, hash_action_func *);
+void hash_set_load (struct hash *, unsigned elems_per_bucket);
+bool hash_reserve (struct hash *, size_t elem_cnt);
 
 /* Search, insertion, deletion. */
 struct hash_elem *hash_insert (struct hash *, struct hash_elem *);
@@ -0,0 +1,218 @@
+#include "heap.h"
+#include "../debug.h"
+
+/* The elements form a complete binary tree: numbering them 1, 2,
+   3, ... in breadth-first order, element N has children 2N and
+   2N + 1.  The path from the root to element N therefore follows
+   the bits of N below its most significant one, 0 for left and 1
+   for right, which is how the last element, and the place for a
+   new one, are found without an array. */
+
+static struct heap_elem *find_nth (const struct heap *, size_t n);
+static void swap_with_parent (struct heap *, struct heap_elem *);
+static void sift_up (struct heap *, struct heap_elem *);
+static void sift_down (struct heap *, struct heap_elem *);
+
+/* Initializes H as an empty heap ordered by LESS, given auxiliary
+   data AUX. */
+void
+heap_init (struct heap *h, heap_less_func *less, void *aux)
+{
+  ASSERT (h != NULL);
+  ASSERT (less != NULL);
+
+  h->root = NULL;
+  h->elem_cnt = 0;
+  h->less = less;
+  h->aux = aux;
+}
+
+/* Inserts E into H. */
+void
+heap_push (struct heap *h, struct heap_elem *e)
+{
+  size_t n = ++h->elem_cnt;
+
+  e->left = e->right = NULL;
+  if (n == 1)
+    {
+      e->parent = NULL;
+      h->root = e;
+      return;
+    }
+
+  e->parent = find_nth (h, n / 2);
+  if (n % 2 == 0)
+    e->parent->left = e;
+  else
+    e->parent->right = e;
+  sift_up (h, e);
+}
+
+/* Returns the least element in H, or a null pointer if H is
+   empty. */
+struct heap_elem *
+heap_top (const struct heap *h)
+{
+  return h->root;
+}
+
+/* Removes and returns the least element in H, or returns a null
+   pointer if H is empty. */
+struct heap_elem *
+heap_pop (struct heap *h)
+{
+  struct heap_elem *e = h->root;
+
+  if (e != NULL)
+    heap_remove (h, e);
+  return e;
+}
+
+/* Removes E, which must be in H, from H. */
+void
+heap_remove (struct heap *h, struct heap_elem *e)
+{
+  struct heap_elem *last;
+
+  ASSERT (h->elem_cnt > 0);
+
+  /* Detach the last element from the tree. */
+  last = find_nth (h, h->elem_cnt--);
+  if (last->parent == NULL)
+    h->root = NULL;
+  else if (last->parent->left == last)
+    last->parent->left = NULL;
+  else
+    last->parent->right = NULL;
+  if (last == e)
+    return;
+
+  /* Put it in E's place and let it find its level. */
+  last->parent = e->parent;
+  last->left = e->left;
+  last->right = e->right;
+  if (last->left != NULL)
+    last->left->parent = last;
+  if (last->right != NULL)
+    last->right->parent = last;
+  if (last->parent == NULL)
+    h->root = last;
+  else if (last->parent->left == e)
+    last->parent->left = last;
+  else
+    last->parent->right = last;
+  heap_update (h, last);
+}
+
+/* Restores the heap order after the key of E, which is in H, has
+   changed. */
+void
+heap_update (struct heap *h, struct heap_elem *e)
+{
+  if (e->parent != NULL && h->less (e, e->parent, h->aux))
+    sift_up (h, e);
+  else
+    sift_down (h, e);
+}
+
+/* Returns the number of elements in H. */
+size_t
+heap_size (const struct heap *h)
+{
+  return h->elem_cnt;
+}
+
+/* Returns true if H is empty, false otherwise. */
+bool
+heap_empty (const struct heap *h)
+{
+  return h->elem_cnt == 0;
+}
+
+/* Returns element number N of H, counting from 1 in breadth-first
+   order.  N must be at most the number of elements in H. */
+static struct heap_elem *
+find_nth (const struct heap *h, size_t n)
+{
+  struct heap_elem *e = h->root;
+  int bit;
+
+  ASSERT (n > 0);
+
+  for (bit = 8 * sizeof n - 1; (n >> bit) == 0; bit--)
+    continue;
+  while (bit-- > 0)
+    e = (n >> bit) & 1 ? e->right : e->left;
+  return e;
+}
+
+/* Exchanges the places of C and its parent in H. */
+static void
+swap_with_parent (struct heap *h, struct heap_elem *c)
+{
+  struct heap_elem *p = c->parent;
+  struct heap_elem *g = p->parent;
+  struct heap_elem *c_left = c->left, *c_right = c->right;
+  struct heap_elem *sibling;
+
+  /* P becomes a child of C, on the side C was on. */
+  if (p->left == c)
+    {
+      sibling = p->right;
+      c->left = p;
+      c->right = sibling;
+    }
+  else
+    {
+      sibling = p->left;
+      c->left = sibling;
+      c->right = p;
+    }
+  if (sibling != NULL)
+    sibling->parent = c;
+
+  /* C's children become P's. */
+  p->left = c_left;
+  p->right = c_right;
+  if (c_left != NULL)
+    c_left->parent = p;
+  if (c_right != NULL)
+    c_right->parent = p;
+
+  /* C takes P's place under G. */
+  p->parent = c;
+  c->parent = g;
+  if (g == NULL)
+    h->root = c;
+  else if (g->left == p)
+    g->left = c;
+  else
+    g->right = c;
+}
+
+/* Moves E up H while it is less than its parent. */
+static void
+sift_up (struct heap *h, struct heap_elem *e)
+{
+  while (e->parent != NULL && h->less (e, e->parent, h->aux))
+    swap_with_parent (h, e);
+}
+
+/* Moves E down H while one of its children is less than it. */
+static void
+sift_down (struct heap *h, struct heap_elem *e)
+{
+  for (;;)
+    {
+      struct heap_elem *c = e->left;
+
+      if (c == NULL)
+        break;
+      if (e->right != NULL && h->less (e->right, c, h->aux))
+        c = e->right;
+      if (!h->less (c, e, h->aux))
+        break;
+      swap_with_parent (h, c);
+    }
+}
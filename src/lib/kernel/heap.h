@@ -0,0 +1,85 @@
+#ifndef __LIB_KERNEL_HEAP_H
+#define __LIB_KERNEL_HEAP_H
+
+/* Binary min-heap.
+
+   Like the list and hash table, this heap does not use dynamic
+   allocation.  Each structure that can be in a heap embeds a
+   struct heap_elem member, and the heap links these together
+   into a complete binary tree in which no element is less than
+   its parent.  The heap_entry macro converts a struct heap_elem
+   back to the structure that contains it.
+
+   heap_push(), heap_pop() and heap_remove() take O(lg n) time;
+   heap_top() takes O(1).  Elements that compare equal come out
+   in an arbitrary order.
+
+   For example, a heap of timers ordered by expiry:
+
+      struct timer
+        {
+          int64_t expires;
+          struct heap_elem elem;
+        };
+
+      static bool
+      timer_less (const struct heap_elem *a, const struct heap_elem *b,
+                  void *aux UNUSED)
+      {
+        return (heap_entry (a, struct timer, elem)->expires
+                < heap_entry (b, struct timer, elem)->expires);
+      }
+
+      struct heap timers;
+      heap_init (&timers, timer_less, NULL);
+      heap_push (&timers, &t->elem);
+      ...
+      struct timer *first = heap_entry (heap_pop (&timers),
+                                        struct timer, elem); */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Heap element. */
+struct heap_elem
+  {
+    struct heap_elem *parent;   /* Parent, or null for the root. */
+    struct heap_elem *left;     /* Children, or null. */
+    struct heap_elem *right;
+  };
+
+/* Converts pointer to heap element HEAP_ELEM into a pointer to
+   the structure that HEAP_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the heap element. */
+#define heap_entry(HEAP_ELEM, STRUCT, MEMBER)           \
+        ((STRUCT *) ((uint8_t *) (HEAP_ELEM)            \
+                     - offsetof (STRUCT, MEMBER)))
+
+/* Compares the value of two heap elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool heap_less_func (const struct heap_elem *a,
+                             const struct heap_elem *b,
+                             void *aux);
+
+/* Heap. */
+struct heap
+  {
+    struct heap_elem *root;     /* Least element, or null. */
+    size_t elem_cnt;            /* Number of elements. */
+    heap_less_func *less;       /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+void heap_init (struct heap *, heap_less_func *, void *aux);
+void heap_push (struct heap *, struct heap_elem *);
+struct heap_elem *heap_top (const struct heap *);
+struct heap_elem *heap_pop (struct heap *);
+void heap_remove (struct heap *, struct heap_elem *);
+void heap_update (struct heap *, struct heap_elem *);
+size_t heap_size (const struct heap *);
+bool heap_empty (const struct heap *);
+
+#endif /* lib/kernel/heap.h */
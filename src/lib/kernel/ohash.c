@@ -0,0 +1,277 @@
+/* Open-addressing hash table.
+
+   See ohash.h for basic information. */
+
+#include "ohash.h"
+#include "../debug.h"
+#include "threads/malloc.h"
+
+static size_t home_slot (const struct ohash *, unsigned hash);
+static size_t probe_dist (const struct ohash *, size_t idx, unsigned hash);
+static void place (struct ohash *, struct ohash_slot);
+static bool resize (struct ohash *, size_t slot_cnt);
+
+/* Smallest number of slots a table has. */
+#define MIN_SLOT_CNT 16
+
+/* Multiplier that scatters hash values over the slots, 2**32
+   divided by the golden ratio. */
+#define SCATTER 0x9e3779b9u
+
+/* Initializes hash table H to compute hash values using HASH,
+   given auxiliary data AUX.  Returns false if memory is
+   exhausted. */
+bool
+ohash_init (struct ohash *h, ohash_hash_func *hash, void *aux)
+{
+  h->elem_cnt = 0;
+  h->slot_cnt = 0;
+  h->min_slot_cnt = MIN_SLOT_CNT;
+  h->slots = NULL;
+  h->hash = hash;
+  h->aux = aux;
+  return resize (h, MIN_SLOT_CNT);
+}
+
+/* Destroys hash table H.
+
+   If DESTRUCTOR is non-null, then it is first called for each
+   entry in the table.  DESTRUCTOR may, if appropriate,
+   deallocate the value.  Modifying H while ohash_destroy() is
+   running yields undefined behavior. */
+void
+ohash_destroy (struct ohash *h, ohash_action_func *destructor)
+{
+  if (destructor != NULL)
+    ohash_apply (h, destructor);
+  free (h->slots);
+  h->slots = NULL;
+  h->slot_cnt = h->elem_cnt = 0;
+}
+
+/* Makes room in H for ELEM_CNT entries, so that inserting up to
+   that many does not allocate memory, and keeps H at least that
+   big from then on.  Returns false if memory is exhausted. */
+bool
+ohash_reserve (struct ohash *h, size_t elem_cnt)
+{
+  size_t slot_cnt = MIN_SLOT_CNT;
+
+  while (slot_cnt / 4 * 3 < elem_cnt)
+    slot_cnt *= 2;
+  h->min_slot_cnt = slot_cnt;
+  return h->slot_cnt >= slot_cnt || resize (h, slot_cnt);
+}
+
+/* Returns the value under KEY in H, or a null pointer if there
+   is none. */
+void *
+ohash_find (const struct ohash *h, uintptr_t key)
+{
+  unsigned hash = h->hash (key, h->aux);
+  size_t mask = h->slot_cnt - 1;
+  size_t idx = home_slot (h, hash);
+  size_t dist;
+
+  /* An entry that sits closer to its home slot than KEY would
+     have been displaced by KEY, so KEY is not beyond it. */
+  for (dist = 0; ; dist++)
+    {
+      const struct ohash_slot *s = &h->slots[idx];
+
+      if (s->value == NULL || probe_dist (h, idx, s->hash) < dist)
+        return NULL;
+      if (s->hash == hash && s->key == key)
+        return s->value;
+      idx = (idx + 1) & mask;
+    }
+}
+
+/* Inserts VALUE, which must not be null, under KEY, which must
+   not be in H already.  Returns false, leaving H unchanged, if H
+   is full and memory to grow it is exhausted. */
+bool
+ohash_insert (struct ohash *h, uintptr_t key, void *value)
+{
+  struct ohash_slot new;
+
+  ASSERT (value != NULL);
+
+  /* If growing fails, there is still room as long as one slot
+     stays empty, at the cost of longer probes. */
+  if ((h->elem_cnt + 1) * 4 > h->slot_cnt * 3
+      && !resize (h, h->slot_cnt * 2)
+      && h->elem_cnt + 1 >= h->slot_cnt)
+    return false;
+
+  new.hash = h->hash (key, h->aux);
+  new.key = key;
+  new.value = value;
+  place (h, new);
+  h->elem_cnt++;
+  return true;
+}
+
+/* Removes the entry under KEY from H and returns its value, or
+   returns a null pointer if there is none. */
+void *
+ohash_delete (struct ohash *h, uintptr_t key)
+{
+  unsigned hash = h->hash (key, h->aux);
+  size_t mask = h->slot_cnt - 1;
+  size_t idx = home_slot (h, hash);
+  size_t dist;
+  void *value;
+
+  for (dist = 0; ; dist++)
+    {
+      struct ohash_slot *s = &h->slots[idx];
+
+      if (s->value == NULL || probe_dist (h, idx, s->hash) < dist)
+        return NULL;
+      if (s->hash == hash && s->key == key)
+        break;
+      idx = (idx + 1) & mask;
+    }
+
+  /* Shift the entries after IDX back by one slot, up to the next
+     empty slot or entry in its home slot. */
+  value = h->slots[idx].value;
+  for (;;)
+    {
+      size_t next = (idx + 1) & mask;
+      struct ohash_slot *s = &h->slots[next];
+
+      if (s->value == NULL || probe_dist (h, next, s->hash) == 0)
+        break;
+      h->slots[idx] = *s;
+      idx = next;
+    }
+  h->slots[idx].value = NULL;
+  h->elem_cnt--;
+
+  /* Shrinking is only an economy, so failure is harmless. */
+  if (h->slot_cnt > h->min_slot_cnt && h->elem_cnt * 8 < h->slot_cnt)
+    resize (h, h->slot_cnt / 2);
+  return value;
+}
+
+/* Calls ACTION for each entry in hash table H in arbitrary
+   order.  Modifying hash table H while ohash_apply() is running
+   yields undefined behavior, whether done from ACTION or
+   elsewhere. */
+void
+ohash_apply (struct ohash *h, ohash_action_func *action)
+{
+  size_t i;
+
+  ASSERT (action != NULL);
+
+  for (i = 0; i < h->slot_cnt; i++)
+    if (h->slots[i].value != NULL)
+      action (h->slots[i].key, h->slots[i].value, h->aux);
+}
+
+/* Returns the number of entries in H. */
+size_t
+ohash_size (const struct ohash *h)
+{
+  return h->elem_cnt;
+}
+
+/* Returns true if H contains no entries, false otherwise. */
+bool
+ohash_empty (const struct ohash *h)
+{
+  return h->elem_cnt == 0;
+}
+
+/* Returns a hash of KEY.  The table scatters hash values over
+   its slots itself, so a key can serve as its own hash. */
+unsigned
+ohash_word (uintptr_t key, void *aux UNUSED)
+{
+  return key;
+}
+
+/* Returns the slot where an entry with HASH belongs in H. */
+static size_t
+home_slot (const struct ohash *h, unsigned hash)
+{
+  return (unsigned) (hash * SCATTER) >> h->shift;
+}
+
+/* Returns how far slot IDX of H is past the home slot of an
+   entry with HASH. */
+static size_t
+probe_dist (const struct ohash *h, size_t idx, unsigned hash)
+{
+  return (idx - home_slot (h, hash)) & (h->slot_cnt - 1);
+}
+
+/* Puts NEW into H, which has an empty slot and must not contain
+   NEW's key, displacing entries that sit closer to their home
+   slots than NEW would.  An entry already under the key would be
+   met before NEW displaces any other. */
+static void
+place (struct ohash *h, struct ohash_slot new)
+{
+  size_t mask = h->slot_cnt - 1;
+  size_t idx = home_slot (h, new.hash);
+  size_t dist = 0;
+
+  for (;;)
+    {
+      struct ohash_slot *s = &h->slots[idx];
+      size_t s_dist;
+
+      if (s->value == NULL)
+        {
+          *s = new;
+          return;
+        }
+      ASSERT (s->hash != new.hash || s->key != new.key);
+      s_dist = probe_dist (h, idx, s->hash);
+      if (s_dist < dist)
+        {
+          struct ohash_slot displaced = *s;
+
+          *s = new;
+          new = displaced;
+          dist = s_dist;
+        }
+      idx = (idx + 1) & mask;
+      dist++;
+    }
+}
+
+/* Changes the number of slots in H to SLOT_CNT, a power of 2
+   large enough for H's entries, and moves the entries over.
+   Returns false, leaving H unchanged, if memory is exhausted. */
+static bool
+resize (struct ohash *h, size_t slot_cnt)
+{
+  struct ohash_slot *old_slots = h->slots;
+  size_t old_slot_cnt = h->slot_cnt;
+  size_t i;
+
+  ASSERT (slot_cnt >= MIN_SLOT_CNT);
+  ASSERT ((slot_cnt & (slot_cnt - 1)) == 0);
+  ASSERT (h->elem_cnt < slot_cnt);
+
+  h->slots = calloc (slot_cnt, sizeof *h->slots);
+  if (h->slots == NULL)
+    {
+      h->slots = old_slots;
+      return false;
+    }
+  h->slot_cnt = slot_cnt;
+  for (h->shift = 32; slot_cnt > 1; slot_cnt /= 2)
+    h->shift--;
+
+  for (i = 0; i < old_slot_cnt; i++)
+    if (old_slots[i].value != NULL)
+      place (h, old_slots[i]);
+  free (old_slots);
+  return true;
+}
@@ -0,0 +1,81 @@
+#ifndef __LIB_KERNEL_OHASH_H
+#define __LIB_KERNEL_OHASH_H
+
+/* Open-addressing hash table.
+
+   Where lib/kernel/hash.h chains elements embedded in the
+   structures they index, this table keeps each entry, a
+   word-sized key and a pointer to its value, inline in a single
+   array of slots.  A lookup probes consecutive slots and
+   compares keys there, so it usually touches one or two cache
+   lines and never the values it passes over.  It suits hot
+   lookup tables keyed by a number or an address, such as a
+   sector number.
+
+   Collisions are resolved by linear probing with Robin Hood
+   insertion: an entry being placed takes the slot of any entry
+   that sits closer to its own home slot, which keeps every
+   probe sequence short.  Each slot also keeps its entry's hash
+   value, so that slots are skipped without calling the hash
+   function and the table grows without rehashing.  Deletion
+   shifts the entries that follow back by one slot instead of
+   leaving tombstones.
+
+   The table grows to keep at most 3/4 of its slots in use and
+   shrinks when fewer than 1/8 are.  Values must not be null,
+   which marks an empty slot.  Keys are compared with ==, and
+   the table does no locking of its own. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Computes and returns the hash value for KEY, given auxiliary
+   data AUX. */
+typedef unsigned ohash_hash_func (uintptr_t key, void *aux);
+
+/* Performs some operation on the entry with KEY and VALUE, given
+   auxiliary data AUX. */
+typedef void ohash_action_func (uintptr_t key, void *value, void *aux);
+
+/* A slot of the table.  Empty if VALUE is null. */
+struct ohash_slot
+  {
+    unsigned hash;              /* Hash value of KEY. */
+    uintptr_t key;              /* Key. */
+    void *value;                /* Value, or null if empty. */
+  };
+
+/* Open-addressing hash table. */
+struct ohash
+  {
+    size_t elem_cnt;            /* Number of entries in table. */
+    size_t slot_cnt;            /* Number of slots, a power of 2. */
+    size_t min_slot_cnt;        /* Never shrink below this. */
+    unsigned shift;             /* 32 - log2 (slot_cnt). */
+    struct ohash_slot *slots;   /* Array of `slot_cnt' slots. */
+    ohash_hash_func *hash;      /* Hash function. */
+    void *aux;                  /* Auxiliary data for `hash'. */
+  };
+
+/* Basic life cycle. */
+bool ohash_init (struct ohash *, ohash_hash_func *, void *aux);
+void ohash_destroy (struct ohash *, ohash_action_func *);
+bool ohash_reserve (struct ohash *, size_t elem_cnt);
+
+/* Search, insertion, deletion. */
+void *ohash_find (const struct ohash *, uintptr_t key);
+bool ohash_insert (struct ohash *, uintptr_t key, void *value);
+void *ohash_delete (struct ohash *, uintptr_t key);
+
+/* Iteration. */
+void ohash_apply (struct ohash *, ohash_action_func *);
+
+/* Information. */
+size_t ohash_size (const struct ohash *);
+bool ohash_empty (const struct ohash *);
+
+/* Sample hash function. */
+unsigned ohash_word (uintptr_t key, void *aux);
+
+#endif /* lib/kernel/ohash.h */
@@ -0,0 +1,388 @@
+#include "rbtree.h"
+#include "../debug.h"
+
+/* The tree keeps the usual red-black invariants, which bound its
+   height by 2 lg (n + 1): the root is black, a red element has no
+   red child, and every path from an element down to a null child
+   passes the same number of black elements.  See [CLRS], chapter
+   13, on which this implementation is based.  Null children count
+   as black. */
+
+static void rotate_left (struct rbtree *, struct rb_elem *);
+static void rotate_right (struct rbtree *, struct rb_elem *);
+static void replace_child (struct rbtree *, struct rb_elem *parent,
+                           struct rb_elem *old, struct rb_elem *new);
+static void insert_fixup (struct rbtree *, struct rb_elem *);
+static void remove_fixup (struct rbtree *, struct rb_elem *,
+                          struct rb_elem *parent);
+
+/* Returns true if E is a red element, false if it is black or
+   null. */
+static inline bool
+is_red (const struct rb_elem *e)
+{
+  return e != NULL && e->red;
+}
+
+/* Returns the leftmost element of the subtree rooted at E. */
+static struct rb_elem *
+leftmost (struct rb_elem *e)
+{
+  while (e->left != NULL)
+    e = e->left;
+  return e;
+}
+
+/* Returns the rightmost element of the subtree rooted at E. */
+static struct rb_elem *
+rightmost (struct rb_elem *e)
+{
+  while (e->right != NULL)
+    e = e->right;
+  return e;
+}
+
+/* Initializes T as an empty tree ordered by LESS, given auxiliary
+   data AUX. */
+void
+rb_init (struct rbtree *t, rb_less_func *less, void *aux)
+{
+  ASSERT (t != NULL);
+  ASSERT (less != NULL);
+
+  t->root = NULL;
+  t->elem_cnt = 0;
+  t->less = less;
+  t->aux = aux;
+}
+
+/* Inserts E into T, after any elements equal to it. */
+void
+rb_insert (struct rbtree *t, struct rb_elem *e)
+{
+  struct rb_elem *parent = NULL;
+  struct rb_elem **link = &t->root;
+
+  while (*link != NULL)
+    {
+      parent = *link;
+      link = t->less (e, parent, t->aux) ? &parent->left : &parent->right;
+    }
+
+  e->parent = parent;
+  e->left = e->right = NULL;
+  e->red = true;
+  *link = e;
+  t->elem_cnt++;
+  insert_fixup (t, e);
+}
+
+/* Removes E, which must be in T, from T. */
+void
+rb_remove (struct rbtree *t, struct rb_elem *e)
+{
+  struct rb_elem *child, *parent;
+  bool removed_red;
+
+  ASSERT (t->elem_cnt > 0);
+
+  if (e->left == NULL || e->right == NULL)
+    {
+      /* E has at most one child, which takes its place. */
+      child = e->left != NULL ? e->left : e->right;
+      parent = e->parent;
+      removed_red = e->red;
+      replace_child (t, parent, e, child);
+      if (child != NULL)
+        child->parent = parent;
+    }
+  else
+    {
+      /* E's successor S, which has no left child, leaves its own
+         place to its right child and takes E's place and
+         color. */
+      struct rb_elem *s = leftmost (e->right);
+
+      child = s->right;
+      removed_red = s->red;
+      if (s->parent == e)
+        parent = s;
+      else
+        {
+          parent = s->parent;
+          parent->left = child;
+          if (child != NULL)
+            child->parent = parent;
+          s->right = e->right;
+          s->right->parent = s;
+        }
+      s->left = e->left;
+      s->left->parent = s;
+      s->parent = e->parent;
+      s->red = e->red;
+      replace_child (t, e->parent, e, s);
+    }
+
+  t->elem_cnt--;
+  if (!removed_red)
+    remove_fixup (t, child, parent);
+}
+
+/* Returns the first element in T equal to KEY, or a null pointer
+   if there is none. */
+struct rb_elem *
+rb_find (const struct rbtree *t, const struct rb_elem *key)
+{
+  struct rb_elem *e = rb_lower_bound (t, key);
+
+  return e != NULL && !t->less (key, e, t->aux) ? e : NULL;
+}
+
+/* Returns the first element in T that is not less than KEY, or a
+   null pointer if every element is less than KEY. */
+struct rb_elem *
+rb_lower_bound (const struct rbtree *t, const struct rb_elem *key)
+{
+  struct rb_elem *e = t->root;
+  struct rb_elem *found = NULL;
+
+  while (e != NULL)
+    if (t->less (e, key, t->aux))
+      e = e->right;
+    else
+      {
+        found = e;
+        e = e->left;
+      }
+  return found;
+}
+
+/* Returns the least element in T, or a null pointer if T is
+   empty. */
+struct rb_elem *
+rb_min (const struct rbtree *t)
+{
+  return t->root != NULL ? leftmost (t->root) : NULL;
+}
+
+/* Returns the greatest element in T, or a null pointer if T is
+   empty. */
+struct rb_elem *
+rb_max (const struct rbtree *t)
+{
+  return t->root != NULL ? rightmost (t->root) : NULL;
+}
+
+/* Returns the element after E in its tree, or a null pointer if E
+   is the last one. */
+struct rb_elem *
+rb_next (const struct rb_elem *e)
+{
+  if (e->right != NULL)
+    return leftmost (e->right);
+  while (e->parent != NULL && e->parent->right == e)
+    e = e->parent;
+  return e->parent;
+}
+
+/* Returns the element before E in its tree, or a null pointer if
+   E is the first one. */
+struct rb_elem *
+rb_prev (const struct rb_elem *e)
+{
+  if (e->left != NULL)
+    return rightmost (e->left);
+  while (e->parent != NULL && e->parent->left == e)
+    e = e->parent;
+  return e->parent;
+}
+
+/* Returns the number of elements in T. */
+size_t
+rb_size (const struct rbtree *t)
+{
+  return t->elem_cnt;
+}
+
+/* Returns true if T is empty, false otherwise. */
+bool
+rb_empty (const struct rbtree *t)
+{
+  return t->elem_cnt == 0;
+}
+
+/* Makes NEW take the place of OLD as a child of PARENT in T, or
+   as T's root if PARENT is null. */
+static void
+replace_child (struct rbtree *t, struct rb_elem *parent,
+               struct rb_elem *old, struct rb_elem *new)
+{
+  if (parent == NULL)
+    t->root = new;
+  else if (parent->left == old)
+    parent->left = new;
+  else
+    parent->right = new;
+}
+
+/* Rotates the subtree rooted at E to the left, making E's right
+   child its root. */
+static void
+rotate_left (struct rbtree *t, struct rb_elem *e)
+{
+  struct rb_elem *r = e->right;
+
+  e->right = r->left;
+  if (r->left != NULL)
+    r->left->parent = e;
+  r->parent = e->parent;
+  replace_child (t, e->parent, e, r);
+  r->left = e;
+  e->parent = r;
+}
+
+/* Rotates the subtree rooted at E to the right, making E's left
+   child its root. */
+static void
+rotate_right (struct rbtree *t, struct rb_elem *e)
+{
+  struct rb_elem *l = e->left;
+
+  e->left = l->right;
+  if (l->right != NULL)
+    l->right->parent = e;
+  l->parent = e->parent;
+  replace_child (t, e->parent, e, l);
+  l->right = e;
+  e->parent = l;
+}
+
+/* Restores the invariants of T after red element E was
+   inserted. */
+static void
+insert_fixup (struct rbtree *t, struct rb_elem *e)
+{
+  while (is_red (e->parent))
+    {
+      struct rb_elem *p = e->parent;
+      struct rb_elem *g = p->parent;
+
+      if (p == g->left)
+        {
+          struct rb_elem *uncle = g->right;
+
+          if (is_red (uncle))
+            {
+              p->red = uncle->red = false;
+              g->red = true;
+              e = g;
+              continue;
+            }
+          if (e == p->right)
+            {
+              rotate_left (t, p);
+              e = p;
+              p = e->parent;
+            }
+          p->red = false;
+          g->red = true;
+          rotate_right (t, g);
+        }
+      else
+        {
+          struct rb_elem *uncle = g->left;
+
+          if (is_red (uncle))
+            {
+              p->red = uncle->red = false;
+              g->red = true;
+              e = g;
+              continue;
+            }
+          if (e == p->left)
+            {
+              rotate_right (t, p);
+              e = p;
+              p = e->parent;
+            }
+          p->red = false;
+          g->red = true;
+          rotate_left (t, g);
+        }
+    }
+  t->root->red = false;
+}
+
+/* Restores the invariants of T after a black element was removed
+   from under PARENT, leaving E, which may be null, in its place
+   with one black element too few on its paths. */
+static void
+remove_fixup (struct rbtree *t, struct rb_elem *e, struct rb_elem *parent)
+{
+  while (e != t->root && !is_red (e))
+    {
+      if (e == parent->left)
+        {
+          struct rb_elem *s = parent->right;
+
+          if (is_red (s))
+            {
+              s->red = false;
+              parent->red = true;
+              rotate_left (t, parent);
+              s = parent->right;
+            }
+          if (!is_red (s->left) && !is_red (s->right))
+            {
+              s->red = true;
+              e = parent;
+              parent = e->parent;
+              continue;
+            }
+          if (!is_red (s->right))
+            {
+              s->left->red = false;
+              s->red = true;
+              rotate_right (t, s);
+              s = parent->right;
+            }
+          s->red = parent->red;
+          parent->red = false;
+          s->right->red = false;
+          rotate_left (t, parent);
+        }
+      else
+        {
+          struct rb_elem *s = parent->left;
+
+          if (is_red (s))
+            {
+              s->red = false;
+              parent->red = true;
+              rotate_right (t, parent);
+              s = parent->left;
+            }
+          if (!is_red (s->left) && !is_red (s->right))
+            {
+              s->red = true;
+              e = parent;
+              parent = e->parent;
+              continue;
+            }
+          if (!is_red (s->left))
+            {
+              s->right->red = false;
+              s->red = true;
+              rotate_left (t, s);
+              s = parent->left;
+            }
+          s->red = parent->red;
+          parent->red = false;
+          s->left->red = false;
+          rotate_right (t, parent);
+        }
+      e = t->root;
+    }
+  if (e != NULL)
+    e->red = false;
+}
@@ -0,0 +1,64 @@
+#ifndef __LIB_KSTAT_H
+#define __LIB_KSTAT_H
+
+/* Kernel-wide statistics, as kept by the kernel and returned by
+   the kstat system call.  Unlike the statistics printed at
+   power-off, these can be read while the system runs.  Counters
+   count from boot. */
+
+/* Number of block device roles: kernel, filesys, scratch, swap. */
+#define KSTAT_BLOCK_CNT 4
+
+/* Scheduler. */
+struct kstat_sched
+  {
+    long long ticks;            /* Timer ticks. */
+    long long idle_ticks;       /* Ticks spent idle. */
+    long long kernel_ticks;     /* Ticks in kernel threads. */
+    long long user_ticks;       /* Ticks in user programs. */
+    long long voluntary;        /* Switches by blocking or yielding. */
+    long long involuntary;      /* Switches by preemption. */
+    unsigned thread_cnt;        /* Threads in existence. */
+    unsigned ready_cnt;         /* Threads ready to run. */
+  };
+
+/* Memory: page pools, kernel heap and paging. */
+struct kstat_mem
+  {
+    unsigned kernel_pages;      /* Pages in the kernel pool. */
+    unsigned kernel_used;       /* Of those, pages in use. */
+    unsigned user_pages;        /* Pages in the user pool. */
+    unsigned user_used;         /* Of those, pages in use. */
+    unsigned heap_bytes;        /* Bytes of kernel heap in use. */
+    unsigned heap_pages;        /* Pages holding the kernel heap. */
+    long long page_faults;      /* Page faults taken. */
+    unsigned swap_slots;        /* Pages the swap device holds. */
+    unsigned swap_used;         /* Of those, slots in use. */
+    unsigned zswap_pages;       /* Of those, slots held compressed in
+                                   memory instead of on disk. */
+    unsigned zswap_bytes;       /* Kernel heap bytes they take. */
+    long long merged;           /* Frames freed by merging ones that
+                                   held the same anonymous data. */
+  };
+
+/* A block device. */
+struct kstat_block
+  {
+    char name[8];               /* Device name, or "" if the role
+                                   has no device. */
+    unsigned long long read_cnt;        /* Sectors read. */
+    unsigned long long write_cnt;       /* Sectors written. */
+    unsigned long long read_reqs;       /* Read transfers. */
+    unsigned long long write_reqs;      /* Write transfers. */
+    unsigned long long cycles;          /* Total time in transfers. */
+  };
+
+struct kstat
+  {
+    struct kstat_sched sched;
+    struct kstat_mem mem;
+    struct kstat_block block[KSTAT_BLOCK_CNT]; /* Block devices by
+                                                  role. */
+  };
+
+#endif /* lib/kstat.h */
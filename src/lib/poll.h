@@ -0,0 +1,23 @@
+#ifndef __LIB_POLL_H
+#define __LIB_POLL_H
+
+/* A file descriptor to watch in a poll call. */
+struct pollfd
+  {
+    int fd;                     /* Descriptor, ignored if negative. */
+    short events;               /* Events of interest. */
+    short revents;              /* Events that occurred. */
+  };
+
+/* Events.  POLLERR, POLLHUP and POLLNVAL are reported whether
+   asked for or not. */
+#define POLLIN 0x001            /* Reading would not block. */
+#define POLLOUT 0x004           /* Writing would not block. */
+#define POLLERR 0x008           /* Write end of a pipe without readers. */
+#define POLLHUP 0x010           /* Read end of a pipe without writers. */
+#define POLLNVAL 0x020          /* Not an open descriptor. */
+
+/* Maximum number of descriptors in one poll call. */
+#define POLL_MAX 64
+
+#endif /* lib/poll.h */
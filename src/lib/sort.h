@@ -0,0 +1,145 @@
+#ifndef __LIB_SORT_H
+#define __LIB_SORT_H
+
+/* Type-specialized sorting.
+
+   sort() and qsort() in lib/stdlib.c work on elements of any
+   size and call the comparison function through a pointer for
+   every comparison.  When the element type is known, this header
+   can instead generate a sort function for it in which the
+   comparison is inlined and elements are moved by assignment.
+   For example:
+
+      #define INT_LESS(A, B) ((A) < (B))
+      SORT_DEFINE (sort_ints, int, INT_LESS)
+
+   defines a static function
+
+      void sort_ints (int *array, size_t cnt);
+
+   that sorts ARRAY into ascending order according to INT_LESS,
+   which is given two elements of type TYPE (not pointers to
+   them) and must return true if the first sorts before the
+   second.  LESS may be a macro or a function and may evaluate
+   its arguments more than once.
+
+   Both versions are the same introsort: a median-of-three
+   quicksort that insertion sorts small partitions and falls back
+   to heap sort if partitioning goes on too long.  Neither is
+   stable. */
+
+#include <stddef.h>
+
+/* Partitions of at most this many elements are insertion
+   sorted. */
+#define SORT_INSERTION_MAX 12
+
+/* Returns the number of levels of partitioning after which an
+   introsort of CNT elements switches to heap sort: twice the
+   base-2 logarithm of CNT. */
+static inline int
+sort_depth_limit (size_t cnt)
+{
+  int depth = 0;
+
+  for (; cnt > 1; cnt >>= 1)
+    depth += 2;
+  return depth;
+}
+
+#define SORT_DEFINE(NAME, TYPE, LESS)                                   \
+static void                                                             \
+NAME##_heapify (TYPE *array, size_t i, size_t cnt)                      \
+{                                                                       \
+  TYPE t = array[i];                                                    \
+  size_t child;                                                         \
+                                                                        \
+  for (; (child = 2 * i + 1) < cnt; i = child)                          \
+    {                                                                   \
+      if (child + 1 < cnt && LESS (array[child], array[child + 1]))     \
+        child++;                                                        \
+      if (!LESS (t, array[child]))                                      \
+        break;                                                          \
+      array[i] = array[child];                                          \
+    }                                                                   \
+  array[i] = t;                                                         \
+}                                                                       \
+                                                                        \
+static void                                                             \
+NAME##_intro (TYPE *array, size_t cnt, int depth)                       \
+{                                                                       \
+  size_t i, j;                                                          \
+                                                                        \
+  while (cnt > SORT_INSERTION_MAX)                                      \
+    {                                                                   \
+      TYPE *mid = &array[cnt / 2];                                      \
+      TYPE *last = &array[cnt - 1];                                     \
+      TYPE pivot, t;                                                    \
+                                                                        \
+      if (depth-- == 0)                                                 \
+        {                                                               \
+          for (i = cnt / 2; i-- > 0; )                                  \
+            NAME##_heapify (array, i, cnt);                             \
+          for (i = cnt - 1; i > 0; i--)                                 \
+            {                                                           \
+              t = array[0];                                             \
+              array[0] = array[i];                                      \
+              array[i] = t;                                             \
+              NAME##_heapify (array, 0, i);                             \
+            }                                                           \
+          return;                                                       \
+        }                                                               \
+                                                                        \
+      /* Median of three, moved to the front as the pivot. */           \
+      if (LESS (*mid, array[0]))                                        \
+        t = *mid, *mid = array[0], array[0] = t;                        \
+      if (LESS (*last, *mid))                                           \
+        {                                                               \
+          t = *last, *last = *mid, *mid = t;                            \
+          if (LESS (*mid, array[0]))                                    \
+            t = *mid, *mid = array[0], array[0] = t;                    \
+        }                                                               \
+      pivot = *mid, *mid = array[0], array[0] = pivot;                  \
+                                                                        \
+      for (i = 0, j = cnt; ; )                                          \
+        {                                                               \
+          while (LESS (array[++i], pivot))                              \
+            continue;                                                   \
+          while (LESS (pivot, array[--j]))                              \
+            continue;                                                   \
+          if (i >= j)                                                   \
+            break;                                                      \
+          t = array[i], array[i] = array[j], array[j] = t;              \
+        }                                                               \
+      array[0] = array[j], array[j] = pivot;                            \
+                                                                        \
+      if (j < cnt - j - 1)                                              \
+        {                                                               \
+          NAME##_intro (array, j, depth);                               \
+          array += j + 1;                                               \
+          cnt -= j + 1;                                                 \
+        }                                                               \
+      else                                                              \
+        {                                                               \
+          NAME##_intro (array + j + 1, cnt - j - 1, depth);             \
+          cnt = j;                                                      \
+        }                                                               \
+    }                                                                   \
+                                                                        \
+  for (i = 1; i < cnt; i++)                                             \
+    {                                                                   \
+      TYPE t = array[i];                                                \
+                                                                        \
+      for (j = i; j > 0 && LESS (t, array[j - 1]); j--)                 \
+        array[j] = array[j - 1];                                        \
+      array[j] = t;                                                     \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+static void __attribute__ ((unused))                                    \
+NAME (TYPE *array, size_t cnt)                                          \
+{                                                                       \
+  NAME##_intro (array, cnt, sort_depth_limit (cnt));                    \
+}
+
+#endif /* lib/sort.h */
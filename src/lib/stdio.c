@@ -13,7 +13,7 @@ struct vsnprintf_aux
     int max_length;     /* Max length of output string. */
   };
 
-static void vsnprintf_helper (char, void *);
+static void vsnprintf_helper (const char *, size_t, void *);
 
 /* Like vprintf(), except that output is stored into BUFFER,
    which must have space for BUF_SIZE characters.  Writes at most
@@ -43,12 +43,18 @@ vsnprintf (char *buffer, size_t buf_size, const char *format, va_list args)
 
 /* Helper function for vsnprintf(). */
 static void
-vsnprintf_helper (char ch, void *aux_)
+vsnprintf_helper (const char *s, size_t n, void *aux_)
 {
   struct vsnprintf_aux *aux = aux_;
 
-  if (aux->length++ < aux->max_length)
-    *aux->p++ = ch;
+  if (aux->length < aux->max_length)
+    {
+      size_t room = aux->max_length - aux->length;
+      size_t cnt = n < room ? n : room;
+      memcpy (aux->p, s, cnt);
+      aux->p += cnt;
+    }
+  aux->length += n;
 }
 
 /* Like printf(), except that output is stored into BUFFER,
@@ -140,44 +146,75 @@ static const struct integer_base base_o = {8, "01234567", 0, 3};
 static const struct integer_base base_x = {16, "0123456789abcdef", 'x', 4};
 static const struct integer_base base_X = {16, "0123456789ABCDEF", 'X', 4};
 
+/* Size of the buffer in which __vprintf() collects its output.
+   Most lines fit, so that most printf() calls make a single call
+   to the output function, and the console gets whole strings. */
+#define PRINTF_BUF_SIZE 128
+
+/* Output collected by __vprintf(). */
+struct printf_buffer
+  {
+    char buf[PRINTF_BUF_SIZE];  /* Output not yet passed to OUTPUT. */
+    size_t len;                 /* Number of bytes in BUF. */
+    void (*output) (const char *, size_t, void *); /* Output function. */
+    void *aux;                  /* Auxiliary data for OUTPUT. */
+  };
+
 static const char *parse_conversion (const char *format,
                                      struct printf_conversion *,
                                      va_list *);
 static void format_integer (uintmax_t value, bool is_signed, bool negative, 
                             const struct integer_base *,
                             const struct printf_conversion *,
-                            void (*output) (char, void *), void *aux);
-static void output_dup (char ch, size_t cnt,
-                        void (*output) (char, void *), void *aux);
+                            struct printf_buffer *);
 static void format_string (const char *string, int length,
                            struct printf_conversion *,
-                           void (*output) (char, void *), void *aux);
-
+                           struct printf_buffer *);
+static void emit (struct printf_buffer *, const char *, size_t);
+static void emit_dup (struct printf_buffer *, char ch, size_t cnt);
+static void emit_flush (struct printf_buffer *);
+
+/* Formats FORMAT with ARGS and passes the output to OUTPUT with
+   auxiliary data AUX.  The output is passed in pieces, each as a
+   pointer and a length, of up to PRINTF_BUF_SIZE bytes except
+   for longer literal text or strings. */
 void
 __vprintf (const char *format, va_list args,
-           void (*output) (char, void *), void *aux)
+           void (*output) (const char *, size_t, void *), void *aux)
 {
-  for (; *format != '\0'; format++)
+  struct printf_buffer pb;
+
+  pb.len = 0;
+  pb.output = output;
+  pb.aux = aux;
+  while (*format != '\0')
     {
       struct printf_conversion c;
+      const char *percent;
 
-      /* Literally copy non-conversions to output. */
-      if (*format != '%') 
+      /* Literally copy non-conversions to output, all the way to
+         the next conversion at once. */
+      percent = strchr (format, '%');
+      if (percent == NULL)
         {
-          output (*format, aux);
-          continue;
+          emit (&pb, format, strlen (format));
+          break;
         }
-      format++;
+      emit (&pb, format, percent - format);
+      format = percent + 1;
 
       /* %% => %. */
       if (*format == '%') 
         {
-          output ('%', aux);
+          emit (&pb, "%", 1);
+          format++;
           continue;
         }
 
       /* Parse conversion specifiers. */
       format = parse_conversion (format, &c, &args);
+      if (*format == '\0')
+        break;
 
       /* Do conversion. */
       switch (*format) 
@@ -221,7 +258,7 @@ __vprintf (const char *format, va_list args,
               }
 
             format_integer (value < 0 ? -value : value,
-                            true, value < 0, &base_d, &c, output, aux);
+                            true, value < 0, &base_d, &c, &pb);
           }
           break;
           
@@ -276,7 +313,7 @@ __vprintf (const char *format, va_list args,
               default: NOT_REACHED ();
               }
 
-            format_integer (value, false, false, b, &c, output, aux);
+            format_integer (value, false, false, b, &c, &pb);
           }
           break;
 
@@ -284,7 +321,7 @@ __vprintf (const char *format, va_list args,
           {
             /* Treat character as single-character string. */
             char ch = va_arg (args, int);
-            format_string (&ch, 1, &c, output, aux);
+            format_string (&ch, 1, &c, &pb);
           }
           break;
 
@@ -298,7 +335,7 @@ __vprintf (const char *format, va_list args,
             /* Limit string length according to precision.
                Note: if c.precision == -1 then strnlen() will get
                SIZE_MAX for MAXLEN, which is just what we want. */
-            format_string (s, strnlen (s, c.precision), &c, output, aux);
+            format_string (s, strnlen (s, c.precision), &c, &pb);
           }
           break;
           
@@ -310,7 +347,7 @@ __vprintf (const char *format, va_list args,
 
             c.flags = POUND;
             format_integer ((uintptr_t) p, false, false,
-                            &base_x, &c, output, aux);
+                            &base_x, &c, &pb);
           }
           break;
       
@@ -322,14 +359,20 @@ __vprintf (const char *format, va_list args,
         case 'n':
           /* We don't support floating-point arithmetic,
              and %n can be part of a security hole. */
-          __printf ("<<no %%%c in kernel>>", output, aux, *format);
+          emit (&pb, "<<no %", 6);
+          emit (&pb, format, 1);
+          emit (&pb, " in kernel>>", 12);
           break;
 
         default:
-          __printf ("<<no %%%c conversion>>", output, aux, *format);
+          emit (&pb, "<<no %", 6);
+          emit (&pb, format, 1);
+          emit (&pb, " conversion>>", 13);
           break;
         }
+      format++;
     }
+  emit_flush (&pb);
 }
 
 /* Parses conversion option characters starting at FORMAT and
@@ -459,26 +502,68 @@ parse_conversion (const char *format, struct printf_conversion *c,
   return format;
 }
 
-/* Performs an integer conversion, writing output to OUTPUT with
-   auxiliary data AUX.  The integer converted has absolute value
-   VALUE.  If IS_SIGNED is true, does a signed conversion with
-   NEGATIVE indicating a negative value; otherwise does an
-   unsigned conversion and ignores NEGATIVE.  The output is done
-   according to the provided base B.  Details of the conversion
-   are in C. */
+/* Stores the digits of VALUE in base B, without leading zeros,
+   in the bytes just before END and returns a pointer to the
+   first.  Stores nothing if VALUE is zero.  Hexadecimal and
+   octal digits come from shifts, and decimal digits from 32-bit
+   division once VALUE is small enough, because 64-bit division
+   is a slow library call on the 80x86. */
+static char *
+format_digits (uintmax_t value, const struct integer_base *b, char *end)
+{
+  char *cp = end;
+
+  if (b->base == 16)
+    for (; value > 0; value >>= 4)
+      *--cp = b->digits[value & 15];
+  else if (b->base == 8)
+    for (; value > 0; value >>= 3)
+      *--cp = b->digits[value & 7];
+  else
+    {
+      uint32_t small;
+
+      for (; value > UINT32_MAX; value /= 10)
+        *--cp = b->digits[value % 10];
+      for (small = value; small > 0; small /= 10)
+        *--cp = b->digits[small % 10];
+    }
+  return cp;
+}
+
+/* Performs an integer conversion, writing output to PB.  The
+   integer converted has absolute value VALUE.  If IS_SIGNED is
+   true, does a signed conversion with NEGATIVE indicating a
+   negative value; otherwise does an unsigned conversion and
+   ignores NEGATIVE.  The output is done according to the
+   provided base B.  Details of the conversion are in C. */
 static void
 format_integer (uintmax_t value, bool is_signed, bool negative, 
                 const struct integer_base *b,
                 const struct printf_conversion *c,
-                void (*output) (char, void *), void *aux)
+                struct printf_buffer *pb)
 {
   char buf[64], *cp;            /* Buffer and current position. */
-  int x;                        /* `x' character to use or 0 if none. */
+  char *end = buf + sizeof buf; /* End of buffer. */
+  char x[2];                    /* `0x' or `0X' prefix. */
   int sign;                     /* Sign character or 0 if none. */
   int precision;                /* Rendered precision. */
   int pad_cnt;                  /* # of pad characters to fill field width. */
   int digit_cnt;                /* # of digits output so far. */
 
+  /* Fast path for a conversion without flags, width, or
+     precision, such as a plain "%d" or "%x". */
+  if (c->flags == 0 && c->width == 0 && c->precision < 0)
+    {
+      cp = format_digits (value, b, end);
+      if (cp == end)
+        *--cp = '0';
+      if (is_signed && negative)
+        *--cp = '-';
+      emit (pb, cp, end - cp);
+      return;
+    }
+
   /* Determine sign character, if any.
      An unsigned conversion will never have a sign character,
      even if one of the flags requests one. */
@@ -496,86 +581,123 @@ format_integer (uintmax_t value, bool is_signed, bool negative,
   /* Determine whether to include `0x' or `0X'.
      It will only be included with a hexadecimal conversion of a
      nonzero value with the # flag. */
-  x = (c->flags & POUND) && value ? b->x : 0;
-
-  /* Accumulate digits into buffer.
-     This algorithm produces digits in reverse order, so later we
-     will output the buffer's content in reverse. */
-  cp = buf;
-  digit_cnt = 0;
-  while (value > 0) 
+  x[0] = '0';
+  x[1] = (c->flags & POUND) && value ? b->x : 0;
+
+  /* Accumulate digits into the end of the buffer, most
+     significant digit first. */
+  if (c->flags & GROUP)
     {
-      if ((c->flags & GROUP) && digit_cnt > 0 && digit_cnt % b->group == 0)
-        *cp++ = ',';
-      *cp++ = b->digits[value % b->base];
-      value /= b->base;
-      digit_cnt++;
+      cp = end;
+      digit_cnt = 0;
+      while (value > 0) 
+        {
+          if (digit_cnt > 0 && digit_cnt % b->group == 0)
+            *--cp = ',';
+          *--cp = b->digits[value % b->base];
+          value /= b->base;
+          digit_cnt++;
+        }
     }
+  else
+    cp = format_digits (value, b, end);
 
-  /* Append enough zeros to match precision.
+  /* Prepend enough zeros to match precision.
      If requested precision is 0, then a value of zero is
      rendered as a null string, otherwise as "0".
      If the # flag is used with base 8, the result must always
      begin with a zero. */
   precision = c->precision < 0 ? 1 : c->precision;
-  while (cp - buf < precision && cp < buf + sizeof buf - 1)
-    *cp++ = '0';
-  if ((c->flags & POUND) && b->base == 8 && (cp == buf || cp[-1] != '0'))
-    *cp++ = '0';
+  while (end - cp < precision && cp > buf + 1)
+    *--cp = '0';
+  if ((c->flags & POUND) && b->base == 8 && (cp == end || *cp != '0'))
+    *--cp = '0';
 
   /* Calculate number of pad characters to fill field width. */
-  pad_cnt = c->width - (cp - buf) - (x ? 2 : 0) - (sign != 0);
+  pad_cnt = c->width - (end - cp) - (x[1] ? 2 : 0) - (sign != 0);
   if (pad_cnt < 0)
     pad_cnt = 0;
 
   /* Do output. */
   if ((c->flags & (MINUS | ZERO)) == 0)
-    output_dup (' ', pad_cnt, output, aux);
+    emit_dup (pb, ' ', pad_cnt);
   if (sign)
-    output (sign, aux);
-  if (x) 
-    {
-      output ('0', aux);
-      output (x, aux); 
-    }
+    emit_dup (pb, sign, 1);
+  if (x[1])
+    emit (pb, x, 2);
   if (c->flags & ZERO)
-    output_dup ('0', pad_cnt, output, aux);
-  while (cp > buf)
-    output (*--cp, aux);
+    emit_dup (pb, '0', pad_cnt);
+  emit (pb, cp, end - cp);
   if (c->flags & MINUS)
-    output_dup (' ', pad_cnt, output, aux);
-}
-
-/* Writes CH to OUTPUT with auxiliary data AUX, CNT times. */
-static void
-output_dup (char ch, size_t cnt, void (*output) (char, void *), void *aux) 
-{
-  while (cnt-- > 0)
-    output (ch, aux);
+    emit_dup (pb, ' ', pad_cnt);
 }
 
 /* Formats the LENGTH characters starting at STRING according to
-   the conversion specified in C.  Writes output to OUTPUT with
-   auxiliary data AUX. */
+   the conversion specified in C.  Writes output to PB. */
 static void
 format_string (const char *string, int length,
                struct printf_conversion *c,
-               void (*output) (char, void *), void *aux) 
+               struct printf_buffer *pb) 
 {
-  int i;
   if (c->width > length && (c->flags & MINUS) == 0)
-    output_dup (' ', c->width - length, output, aux);
-  for (i = 0; i < length; i++)
-    output (string[i], aux);
+    emit_dup (pb, ' ', c->width - length);
+  emit (pb, string, length);
   if (c->width > length && (c->flags & MINUS) != 0)
-    output_dup (' ', c->width - length, output, aux);
+    emit_dup (pb, ' ', c->width - length);
+}
+
+/* Appends the N bytes in S to PB, first passing PB's buffer to
+   its output function if there is not room for them.  Passes
+   pieces too big for the buffer straight through. */
+static void
+emit (struct printf_buffer *pb, const char *s, size_t n)
+{
+  if (n > sizeof pb->buf - pb->len)
+    {
+      emit_flush (pb);
+      if (n >= sizeof pb->buf)
+        {
+          pb->output (s, n, pb->aux);
+          return;
+        }
+    }
+  memcpy (pb->buf + pb->len, s, n);
+  pb->len += n;
+}
+
+/* Appends CH to PB, CNT times. */
+static void
+emit_dup (struct printf_buffer *pb, char ch, size_t cnt) 
+{
+  while (cnt > 0)
+    {
+      size_t n;
+
+      if (pb->len == sizeof pb->buf)
+        emit_flush (pb);
+      n = sizeof pb->buf - pb->len;
+      if (n > cnt)
+        n = cnt;
+      memset (pb->buf + pb->len, ch, n);
+      pb->len += n;
+      cnt -= n;
+    }
+}
+
+/* Passes the output collected in PB to its output function. */
+static void
+emit_flush (struct printf_buffer *pb)
+{
+  if (pb->len > 0)
+    pb->output (pb->buf, pb->len, pb->aux);
+  pb->len = 0;
 }
 
 /* Wrapper for __vprintf() that converts varargs into a
    va_list. */
 void
 __printf (const char *format,
-          void (*output) (char, void *), void *aux, ...) 
+          void (*output) (const char *, size_t, void *), void *aux, ...) 
 {
   va_list args;
 
@@ -583,7 +705,7 @@ __printf (const char *format,
   __vprintf (format, args, output, aux);
   va_end (args);
 }
-
+
 /* Dumps the SIZE bytes in BUF to the console as hex bytes
    arranged 16 per line.  Numeric offsets are also included,
    starting at OFS for the first byte in BUF.  If ASCII is true
@@ -27,11 +27,12 @@ int puts (const char *);
 void hex_dump (uintptr_t ofs, const void *, size_t size, bool ascii);
 void print_human_readable_size (uint64_t sz);
 
-/* Internal functions. */
+/* Internal functions.  These pass their output to OUTPUT a
+   string at a time, as a pointer and a length. */
 void __vprintf (const char *format, va_list args,
-                void (*output) (char, void *), void *aux);
+                void (*output) (const char *, size_t, void *), void *aux);
 void __printf (const char *format,
-               void (*output) (char, void *), void *aux, ...);
+               void (*output) (const char *, size_t, void *), void *aux, ...);
 
 /* Try to be helpful. */
 #define sprintf dont_use_sprintf_use_snprintf
@@ -1,8 +1,10 @@
 #include <ctype.h>
 #include <debug.h>
 #include <random.h>
+#include <sort.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* Converts a string representation of a signed decimal integer
    in S into an `int', which is returned. */
@@ -52,7 +54,7 @@ compare_thunk (const void *a, const void *b, void *aux)
    using COMPARE.  When COMPARE is passed a pair of elements A
    and B, respectively, it must return a strcmp()-type result,
    i.e. less than zero if A < B, zero if A == B, greater than
-   zero if A > B.  Runs in O(n lg n) time and O(1) space in
+   zero if A > B.  Runs in O(n lg n) time and O(lg n) space in
    CNT. */
 void
 qsort (void *array, size_t cnt, size_t size,
@@ -61,21 +63,46 @@ qsort (void *array, size_t cnt, size_t size,
   sort (array, cnt, size, compare_thunk, &compare);
 }
 
+/* A 32-bit word that may alias any other type. */
+typedef uint32_t __attribute__ ((may_alias)) word_t;
+
+/* Swaps the elements of SIZE bytes at A and B, a word at a time
+   if SIZE and their addresses allow it. */
+static inline void
+swap_elems (unsigned char *a, unsigned char *b, size_t size)
+{
+  if (((uintptr_t) a | (uintptr_t) b | size) % sizeof (word_t) == 0)
+    {
+      word_t *wa = (word_t *) a;
+      word_t *wb = (word_t *) b;
+      size_t i;
+
+      for (i = 0; i < size / sizeof (word_t); i++)
+        {
+          word_t t = wa[i];
+          wa[i] = wb[i];
+          wb[i] = t;
+        }
+    }
+  else
+    {
+      size_t i;
+
+      for (i = 0; i < size; i++)
+        {
+          unsigned char t = a[i];
+          a[i] = b[i];
+          b[i] = t;
+        }
+    }
+}
+
 /* Swaps elements with 1-based indexes A_IDX and B_IDX in ARRAY
    with elements of SIZE bytes each. */
 static void
 do_swap (unsigned char *array, size_t a_idx, size_t b_idx, size_t size)
 {
-  unsigned char *a = array + (a_idx - 1) * size;
-  unsigned char *b = array + (b_idx - 1) * size;
-  size_t i;
-
-  for (i = 0; i < size; i++)
-    {
-      unsigned char t = a[i];
-      a[i] = b[i];
-      b[i] = t;
-    }
+  swap_elems (array + (a_idx - 1) * size, array + (b_idx - 1) * size, size);
 }
 
 /* Compares elements with 1-based indexes A_IDX and B_IDX in
@@ -122,33 +149,137 @@ heapify (unsigned char *array, size_t i, size_t cnt, size_t size,
     }
 }
 
+/* Heap sorts ARRAY, which contains CNT elements of SIZE bytes
+   each, using COMPARE to compare elements, passing AUX as
+   auxiliary data. */
+static void
+heap_sort (unsigned char *array, size_t cnt, size_t size,
+           int (*compare) (const void *, const void *, void *aux),
+           void *aux)
+{
+  size_t i;
+
+  /* Build a heap. */
+  for (i = cnt / 2; i > 0; i--)
+    heapify (array, i, cnt, size, compare, aux);
+
+  /* Sort the heap. */
+  for (i = cnt; i > 1; i--) 
+    {
+      do_swap (array, 1, i, size);
+      heapify (array, 1, i - 1, size, compare, aux); 
+    }
+}
+
+/* Insertion sorts ARRAY, which contains CNT elements of SIZE
+   bytes each, using COMPARE to compare elements, passing AUX as
+   auxiliary data. */
+static void
+insertion_sort (unsigned char *array, size_t cnt, size_t size,
+                int (*compare) (const void *, const void *, void *aux),
+                void *aux)
+{
+  unsigned char *end = array + cnt * size;
+  unsigned char *i, *j;
+
+  for (i = array + size; i < end; i += size)
+    for (j = i; j > array && compare (j - size, j, aux) > 0; j -= size)
+      swap_elems (j - size, j, size);
+}
+
+/* Sorts ARRAY, which contains CNT elements of SIZE bytes each,
+   by quicksort, using COMPARE to compare elements, passing AUX
+   as auxiliary data.  Once DEPTH levels of partitioning have not
+   brought a partition down to SORT_INSERTION_MAX elements, the
+   pivots must be poor, so the partition is heap sorted instead. */
+static void
+intro_sort (unsigned char *array, size_t cnt, size_t size,
+            int (*compare) (const void *, const void *, void *aux),
+            void *aux, int depth)
+{
+  while (cnt > SORT_INSERTION_MAX)
+    {
+      unsigned char *lo = array;
+      unsigned char *mid = array + cnt / 2 * size;
+      unsigned char *hi = array + (cnt - 1) * size;
+      unsigned char *i, *j;
+      size_t left_cnt;
+
+      if (depth-- == 0)
+        {
+          heap_sort (array, cnt, size, compare, aux);
+          return;
+        }
+
+      /* Order the first, middle and last elements, then use the
+         median as the pivot, moved to the front.  The last
+         element is then at least the pivot, which stops the
+         upward scan below without a bounds check. */
+      if (compare (mid, lo, aux) < 0)
+        swap_elems (mid, lo, size);
+      if (compare (hi, mid, aux) < 0)
+        {
+          swap_elems (hi, mid, size);
+          if (compare (mid, lo, aux) < 0)
+            swap_elems (mid, lo, size);
+        }
+      swap_elems (lo, mid, size);
+
+      /* Partition around the pivot at LO. */
+      i = lo;
+      j = lo + cnt * size;
+      for (;;)
+        {
+          do
+            i += size;
+          while (compare (i, lo, aux) < 0);
+          do
+            j -= size;
+          while (compare (lo, j, aux) < 0);
+          if (i >= j)
+            break;
+          swap_elems (i, j, size);
+        }
+      swap_elems (lo, j, size);
+
+      /* Recurse into the smaller side, so that the stack stays
+         O(lg n) deep, and loop on the larger. */
+      left_cnt = (j - lo) / size;
+      if (left_cnt < cnt - left_cnt - 1)
+        {
+          intro_sort (lo, left_cnt, size, compare, aux, depth);
+          array = j + size;
+          cnt -= left_cnt + 1;
+        }
+      else
+        {
+          intro_sort (j + size, cnt - left_cnt - 1, size, compare, aux, depth);
+          cnt = left_cnt;
+        }
+    }
+  insertion_sort (array, cnt, size, compare, aux);
+}
+
 /* Sorts ARRAY, which contains CNT elements of SIZE bytes each,
    using COMPARE to compare elements, passing AUX as auxiliary
    data.  When COMPARE is passed a pair of elements A and B,
    respectively, it must return a strcmp()-type result, i.e. less
    than zero if A < B, zero if A == B, greater than zero if A >
-   B.  Runs in O(n lg n) time and O(1) space in CNT. */
+   B.  Runs in O(n lg n) time and O(lg n) space in CNT.
+
+   This is an introsort: a median-of-three quicksort that
+   insertion sorts small partitions and falls back to heap sort
+   if partitioning goes too deep.  The sort is not stable. */
 void
 sort (void *array, size_t cnt, size_t size,
       int (*compare) (const void *, const void *, void *aux),
       void *aux) 
 {
-  size_t i;
-
   ASSERT (array != NULL || cnt == 0);
   ASSERT (compare != NULL);
   ASSERT (size > 0);
 
-  /* Build a heap. */
-  for (i = cnt / 2; i > 0; i--)
-    heapify (array, i, cnt, size, compare, aux);
-
-  /* Sort the heap. */
-  for (i = cnt; i > 1; i--) 
-    {
-      do_swap (array, 1, i, size);
-      heapify (array, 1, i - 1, size, compare, aux); 
-    }
+  intro_sort (array, cnt, size, compare, aux, sort_depth_limit (cnt));
 }
 
 /* Searches ARRAY, which contains CNT elements of SIZE bytes
@@ -1,5 +1,27 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
+
+/* The block functions below move data a 32-bit word at a time
+   with the x86 string instructions, after copying single bytes
+   until the destination is word-aligned.  Blocks shorter than
+   WORD_COPY_MIN bytes are not worth the setup and are handled a
+   byte at a time.  The direction flag is clear on entry to any C
+   function, as the ABI requires and intr-stubs.S ensures for
+   interrupt handlers. */
+#define WORD_COPY_MIN 16
+
+/* A 32-bit word that may alias any other type. */
+typedef uint32_t __attribute__ ((may_alias)) word_t;
+
+/* The string functions scan a word at a time once the pointer is
+   word-aligned.  An aligned word never crosses a page boundary,
+   so reading the bytes past the terminator in the same word is
+   safe.  HAS_ZERO(W) is nonzero if and only if word W has a zero
+   byte; BYTES(C) is a word with every byte equal to C. */
+#define HAS_ZERO(W) (((W) - 0x01010101u) & ~(W) & 0x80808080u)
+#define BYTES(C) ((unsigned char) (C) * 0x01010101u)
+#define IS_ALIGNED(P) (((uintptr_t) (P) & (sizeof (word_t) - 1)) == 0)
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -12,8 +34,19 @@ memcpy (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  while (size-- > 0)
-    *dst++ = *src++;
+  if (size >= WORD_COPY_MIN)
+    {
+      size_t head = -(uintptr_t) dst & (sizeof (word_t) - 1);
+      size_t words = (size - head) / sizeof (word_t);
+
+      size -= head + words * sizeof (word_t);
+      asm volatile ("rep movsb; movl %4, %%ecx; rep movsl"
+                    : "+D" (dst), "+S" (src), "=&c" (head)
+                    : "2" (head), "g" (words)
+                    : "memory");
+    }
+  asm volatile ("rep movsb"
+                : "+D" (dst), "+S" (src), "+c" (size) : : "memory");
 
   return dst_;
 }
@@ -29,20 +62,35 @@ memmove (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  if (dst < src) 
-    {
-      while (size-- > 0)
-        *dst++ = *src++;
-    }
-  else 
+  /* Copying upward is safe unless DST starts inside SRC. */
+  if ((size_t) (dst - src) >= size)
+    return memcpy (dst_, src_, size);
+
+  /* Copy downward, from the end. */
+  dst += size;
+  src += size;
+  if (size >= WORD_COPY_MIN)
     {
-      dst += size;
-      src += size;
-      while (size-- > 0)
+      size_t tail = (uintptr_t) dst & (sizeof (word_t) - 1);
+      size_t words;
+
+      size -= tail;
+      while (tail-- > 0)
         *--dst = *--src;
+
+      words = size / sizeof (word_t);
+      size -= words * sizeof (word_t);
+      dst -= sizeof (word_t);
+      src -= sizeof (word_t);
+      asm volatile ("std; rep movsl; cld"
+                    : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+      dst += sizeof (word_t);
+      src += sizeof (word_t);
     }
+  while (size-- > 0)
+    *--dst = *--src;
 
-  return dst;
+  return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -58,6 +106,14 @@ memcmp (const void *a_, const void *b_, size_t size)
   ASSERT (a != NULL || size == 0);
   ASSERT (b != NULL || size == 0);
 
+  /* Skip over equal words, then find the differing byte. */
+  for (; size >= sizeof (word_t); size -= sizeof (word_t))
+    {
+      if (*(const word_t *) a != *(const word_t *) b)
+        break;
+      a += sizeof (word_t);
+      b += sizeof (word_t);
+    }
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -78,6 +134,23 @@ strcmp (const char *a_, const char *b_)
   ASSERT (a != NULL);
   ASSERT (b != NULL);
 
+  /* If A and B are equally misaligned, compare bytes up to a word
+     boundary, then skip over equal words with no terminator. */
+  if (((uintptr_t) a ^ (uintptr_t) b) % sizeof (word_t) == 0)
+    {
+      for (; !IS_ALIGNED (a); a++, b++)
+        if (*a == '\0' || *a != *b)
+          return *a < *b ? -1 : *a > *b;
+      for (;;)
+        {
+          word_t w = *(const word_t *) a;
+          if (w != *(const word_t *) b || HAS_ZERO (w))
+            break;
+          a += sizeof (word_t);
+          b += sizeof (word_t);
+        }
+    }
+
   while (*a != '\0' && *a == *b) 
     {
       a++;
@@ -113,9 +186,25 @@ char *
 strchr (const char *string, int c_) 
 {
   char c = c_;
+  word_t pattern = BYTES (c);
 
   ASSERT (string != NULL);
 
+  /* Scan up to a word boundary, then skip whole words containing
+     neither C nor a terminator. */
+  for (; !IS_ALIGNED (string); string++)
+    if (*string == c)
+      return (char *) string;
+    else if (*string == '\0')
+      return NULL;
+  for (;;)
+    {
+      word_t w = *(const word_t *) string;
+      if (HAS_ZERO (w) || HAS_ZERO (w ^ pattern))
+        break;
+      string += sizeof (word_t);
+    }
+
   for (;;) 
     if (*string == c)
       return (char *) string;
@@ -281,9 +370,21 @@ memset (void *dst_, int value, size_t size)
   unsigned char *dst = dst_;
 
   ASSERT (dst != NULL || size == 0);
-  
-  while (size-- > 0)
-    *dst++ = value;
+
+  if (size >= WORD_COPY_MIN)
+    {
+      size_t head = -(uintptr_t) dst & (sizeof (word_t) - 1);
+      size_t words = (size - head) / sizeof (word_t);
+      word_t pattern = (unsigned char) value * 0x01010101u;
+
+      size -= head + words * sizeof (word_t);
+      asm volatile ("rep stosb; movl %4, %%ecx; rep stosl"
+                    : "+D" (dst), "=&c" (head)
+                    : "a" (pattern), "1" (head), "g" (words)
+                    : "memory");
+    }
+  asm volatile ("rep stosb"
+                : "+D" (dst), "+c" (size) : "a" (value) : "memory");
 
   return dst_;
 }
@@ -296,7 +397,15 @@ strlen (const char *string)
 
   ASSERT (string != NULL);
 
-  for (p = string; *p != '\0'; p++)
+  /* Scan up to a word boundary, then skip whole words with no
+     null byte. */
+  for (p = string; !IS_ALIGNED (p); p++)
+    if (*p == '\0')
+      return p - string;
+  while (!HAS_ZERO (*(const word_t *) p))
+    p += sizeof (word_t);
+
+  for (; *p != '\0'; p++)
     continue;
   return p - string;
 }
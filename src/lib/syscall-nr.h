@@ -28,7 +28,47 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_FORK,                   /* Clone this process. */
+    SYS_VMSTAT,                 /* Obtain a process's paging statistics. */
+    SYS_PREAD,                  /* Read from a file at a given offset. */
+    SYS_PWRITE,                 /* Write to a file at a given offset. */
+    SYS_READV,                  /* Read into several buffers. */
+    SYS_WRITEV,                 /* Write from several buffers. */
+    SYS_SETTICKETS,             /* Set the caller's CPU share. */
+    SYS_SCHEDSTAT,              /* Print scheduler statistics. */
+    SYS_MEMSTAT,                /* Print kernel memory statistics. */
+    SYS_FSYNC,                  /* Write a file's data to disk. */
+    SYS_SYNC,                   /* Write all file system data to disk. */
+    SYS_COPY_FILE_RANGE,        /* Copy data between two files. */
+    SYS_GETDENTS,               /* Read many directory entries. */
+    SYS_KSTAT,                  /* Obtain kernel-wide statistics. */
+    SYS_SBRK,                   /* Grow or shrink the heap. */
+    SYS_MADVISE,                /* Give access pattern hints. */
+    SYS_MLOCK,                  /* Lock pages in memory. */
+    SYS_MUNLOCK,                /* Unlock pages. */
+    SYS_PIPE,                   /* Create a pipe. */
+    SYS_DUP2,                   /* Duplicate a file descriptor. */
+    SYS_SHM_MAP,                /* Map a shared memory segment. */
+    SYS_SHM_UNMAP,              /* Unmap a shared memory segment. */
+    SYS_SHM_UNLINK,             /* Remove a shared memory segment's name. */
+    SYS_THREAD_CREATE,          /* Start a thread in this process. */
+    SYS_THREAD_JOIN,            /* Wait for a thread to end. */
+    SYS_THREAD_EXIT,            /* End the calling thread. */
+    SYS_FUTEX_WAIT,             /* Wait on a futex. */
+    SYS_FUTEX_WAKE,             /* Wake threads waiting on a futex. */
+    SYS_POLL,                   /* Wait for descriptors to be ready. */
+    SYS_AIO_SUBMIT,             /* Start asynchronous reads and writes. */
+    SYS_AIO_GETEVENTS,          /* Reap finished asynchronous requests. */
+    SYS_SPAWN,                  /* Start a process with given stdin/out. */
+    SYS_FALLOCATE,              /* Reserve or free space in a file. */
+    SYS_SYSCTL,                 /* Read or set a kernel tunable. */
+    SYS_SNAPSHOT,               /* Save the process to a file. */
+    SYS_RESTORE,                /* Start a process from a snapshot. */
+    SYS_STRACE,                 /* Trace the process's system calls. */
+    SYS_OPEN_FLAGS              /* Open a file in a given mode. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -0,0 +1,32 @@
+#ifndef __LIB_SYSCTL_H
+#define __LIB_SYSCTL_H
+
+/* Kernel tunables, as read and set by the sysctl system call and
+   the kernel command-line option -o.
+
+   Each tunable is an int with a name of the form
+   SUBSYSTEM.NAME and a range of allowed values.  A new value
+   takes effect the next time the subsystem looks at it:
+
+     sched.latency        Ticks to run each ready thread once.
+     sched.slice_min      Shortest time slice, in ticks.
+     sched.lock_handoff   Hand released locks to waiters, 0 or 1.
+     vm.low_water         Free user pages that wake the cleaner.
+     vm.high_water        Free user pages the cleaner stops at.
+     vm.swap_cluster      Most pages written to swap at once.
+     vm.swap_read_around  Most pages read around a swap fault.
+     vm.seq_read_ahead    Pages read ahead for MADV_SEQUENTIAL.
+     vm.stack_ahead       Most pages mapped ahead of a stack fault.
+     vm.merge_interval    Ticks between passes of the page merger.
+     vm.merge_scan        Frames the page merger hashes per pass.
+     fs.read_ahead        Sectors read ahead of a file read.
+     fs.flush_interval    Ticks between write-behinds of the cache.
+     fs.tmpfs_pages       Most pages of file data in tmpfs.
+
+   Tunables of subsystems not built into the kernel do not
+   exist. */
+
+/* Longest name of a tunable. */
+#define SYSCTL_NAME_MAX 31
+
+#endif /* lib/sysctl.h */
@@ -0,0 +1,333 @@
+#include <malloc.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+
+/* A malloc() for user programs, after the kernel's in
+   threads/malloc.c.
+
+   The size of each request, in bytes, is rounded up to a power
+   of 2 and assigned to the "descriptor" that manages blocks of
+   that size.  The descriptor keeps a free list of blocks, and
+   malloc() and free() just pop and push it, so that programs
+   making many small allocations pay little for each.  When the
+   free list is empty, a new page, called an "arena", is taken
+   from the heap and divided into blocks for it.  Arenas of small
+   blocks are never given back: programs tend to reuse blocks of
+   the sizes they have freed.
+
+   Blocks bigger than 1 kB get pages of their own, with the page
+   count in the arena header at their start.  Freed big blocks go
+   on a list of free page runs, which later big requests are
+   carved from, first fit.  Runs at the end of the heap are
+   returned to the kernel instead.
+
+   Pages come from the heap, which sbrk() grows and shrinks.  The
+   kernel starts the heap page-aligned, and each request for
+   pages is padded to keep it so.  There is only one thread per
+   process, so nothing here is locked. */
+
+/* Page size, as in threads/vaddr.h. */
+#define PGSIZE 4096
+
+/* Magic number for detecting arena corruption. */
+#define ARENA_MAGIC 0x3ab10c8d
+
+/* Descriptor. */
+struct desc
+  {
+    size_t block_size;          /* Size of each element in bytes. */
+    size_t blocks_per_arena;    /* Number of blocks in an arena. */
+    struct block *free_list;    /* Free blocks. */
+  };
+
+/* Arena, 16 bytes so that blocks after it are aligned. */
+struct arena
+  {
+    unsigned magic;             /* Always set to ARENA_MAGIC. */
+    struct desc *desc;          /* Owning descriptor, null for big block. */
+    size_t page_cnt;            /* Pages in big block. */
+    struct arena *next;         /* Next free run, if a free big block. */
+  };
+
+/* Free block. */
+struct block
+  {
+    struct block *next;         /* Next free block. */
+  };
+
+/* Our set of descriptors, for 16 to 1024 bytes. */
+static struct desc descs[7];
+static size_t desc_cnt;
+
+/* Free big blocks. */
+static struct arena *free_runs;
+
+static void malloc_init (void);
+static struct arena *get_pages (size_t page_cnt);
+static struct arena *block_to_arena (void *);
+static struct block *arena_to_block (struct arena *, size_t idx);
+static void *big_malloc (size_t);
+static void big_free (struct arena *);
+
+/* Initializes the descriptors on the first call to malloc(). */
+static void
+malloc_init (void)
+{
+  size_t block_size;
+
+  for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
+    {
+      struct desc *d = &descs[desc_cnt++];
+      ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
+      d->block_size = block_size;
+      d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
+      d->free_list = NULL;
+    }
+}
+
+/* Obtains and returns a new block of at least SIZE bytes.
+   Returns a null pointer if memory is not available. */
+void *
+malloc (size_t size)
+{
+  struct desc *d;
+  struct block *b;
+
+  if (size == 0)
+    return NULL;
+  if (desc_cnt == 0)
+    malloc_init ();
+
+  /* Find the smallest descriptor that satisfies a SIZE-byte
+     request. */
+  for (d = descs; d < descs + desc_cnt; d++)
+    if (d->block_size >= size)
+      break;
+  if (d == descs + desc_cnt)
+    return big_malloc (size);
+
+  if (d->free_list == NULL)
+    {
+      /* Carve a new arena into blocks. */
+      struct arena *a = get_pages (1);
+      size_t i;
+
+      if (a == NULL)
+        return NULL;
+      a->magic = ARENA_MAGIC;
+      a->desc = d;
+      a->page_cnt = 1;
+      a->next = NULL;
+      for (i = d->blocks_per_arena; i-- > 0; )
+        {
+          b = arena_to_block (a, i);
+          b->next = d->free_list;
+          d->free_list = b;
+        }
+    }
+
+  b = d->free_list;
+  d->free_list = b->next;
+  return b;
+}
+
+/* Allocates and return A times B bytes initialized to zeroes.
+   Returns a null pointer if memory is not available. */
+void *
+calloc (size_t a, size_t b)
+{
+  void *p;
+  size_t size;
+
+  /* Calculate block size and make sure it fits in size_t. */
+  size = a * b;
+  if (size < a || size < b)
+    return NULL;
+
+  p = malloc (size);
+  if (p != NULL)
+    memset (p, 0, size);
+  return p;
+}
+
+/* Returns the number of bytes allocated for BLOCK. */
+static size_t
+block_size (void *block)
+{
+  struct arena *a = block_to_arena (block);
+
+  return (a->desc != NULL
+          ? a->desc->block_size
+          : a->page_cnt * PGSIZE - sizeof *a);
+}
+
+/* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
+   moving it in the process.
+   If successful, returns the new block; on failure, returns a
+   null pointer.
+   A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
+   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
+void *
+realloc (void *old_block, size_t new_size)
+{
+  void *new_block;
+  size_t old_size;
+
+  if (new_size == 0)
+    {
+      free (old_block);
+      return NULL;
+    }
+  if (old_block == NULL)
+    return malloc (new_size);
+
+  old_size = block_size (old_block);
+  if (new_size <= old_size)
+    return old_block;
+  new_block = malloc (new_size);
+  if (new_block != NULL)
+    {
+      memcpy (new_block, old_block, old_size);
+      free (old_block);
+    }
+  return new_block;
+}
+
+/* Frees block P, which must have been previously allocated with
+   malloc(), calloc(), or realloc(). */
+void
+free (void *p)
+{
+  struct arena *a;
+
+  if (p == NULL)
+    return;
+
+  a = block_to_arena (p);
+  if (a->desc != NULL)
+    {
+      struct block *b = p;
+
+#ifndef NDEBUG
+      /* Clear the block to help detect use-after-free bugs. */
+      memset (b, 0xcc, a->desc->block_size);
+#endif
+      b->next = a->desc->free_list;
+      a->desc->free_list = b;
+    }
+  else
+    big_free (a);
+}
+
+/* Returns a block of at least SIZE bytes on pages of its own. */
+static void *
+big_malloc (size_t size)
+{
+  size_t page_cnt;
+  struct arena **ap, *a;
+
+  if (size > SIZE_MAX - sizeof (struct arena))
+    return NULL;
+  page_cnt = DIV_ROUND_UP (size + sizeof (struct arena), PGSIZE);
+
+  /* Take the first free run that is big enough, splitting off
+     its tail if it is bigger than needed. */
+  for (ap = &free_runs; (a = *ap) != NULL; ap = &a->next)
+    if (a->page_cnt >= page_cnt)
+      {
+        *ap = a->next;
+        if (a->page_cnt > page_cnt)
+          {
+            struct arena *rest = (struct arena *) ((uint8_t *) a
+                                                   + page_cnt * PGSIZE);
+            rest->magic = ARENA_MAGIC;
+            rest->desc = NULL;
+            rest->page_cnt = a->page_cnt - page_cnt;
+            rest->next = *ap;
+            *ap = rest;
+          }
+        break;
+      }
+  if (a == NULL)
+    {
+      a = get_pages (page_cnt);
+      if (a == NULL)
+        return NULL;
+      a->magic = ARENA_MAGIC;
+      a->desc = NULL;
+    }
+  a->page_cnt = page_cnt;
+  a->next = NULL;
+  return a + 1;
+}
+
+/* Frees big block A.  Then gives the free runs at the end of the
+   heap back to the kernel. */
+static void
+big_free (struct arena *a)
+{
+  struct arena **ap;
+
+  a->next = free_runs;
+  free_runs = a;
+
+  for (ap = &free_runs; (a = *ap) != NULL; )
+    if ((uint8_t *) a + a->page_cnt * PGSIZE == sbrk (0))
+      {
+        *ap = a->next;
+        sbrk (-(intptr_t) (a->page_cnt * PGSIZE));
+        ap = &free_runs;
+      }
+    else
+      ap = &a->next;
+}
+
+/* Obtains PAGE_CNT contiguous pages from the end of the heap and
+   returns the first, or a null pointer if the heap cannot grow
+   that much. */
+static struct arena *
+get_pages (size_t page_cnt)
+{
+  uint8_t *end = sbrk (0);
+  size_t pad = ROUND_UP ((uintptr_t) end, PGSIZE) - (uintptr_t) end;
+  size_t size = page_cnt * PGSIZE;
+
+  if (size / PGSIZE != page_cnt || size + pad < size
+      || size + pad > INTPTR_MAX
+      || sbrk (size + pad) == (void *) -1)
+    return NULL;
+  return (struct arena *) (end + pad);
+}
+
+/* Returns the arena that block B is inside. */
+static struct arena *
+block_to_arena (void *b)
+{
+  struct arena *a = (struct arena *) ((uintptr_t) b & ~(PGSIZE - 1));
+
+  /* Check that the arena is valid. */
+  ASSERT (a != NULL);
+  ASSERT (a->magic == ARENA_MAGIC);
+
+  /* Check that the block is properly aligned for the arena. */
+  ASSERT (a->desc == NULL
+          || ((uintptr_t) b - (uintptr_t) (a + 1)) % a->desc->block_size == 0);
+  ASSERT (a->desc != NULL || (void *) b == a + 1);
+
+  return a;
+}
+
+/* Returns the (IDX - 1)'th block within arena A. */
+static struct block *
+arena_to_block (struct arena *a, size_t idx)
+{
+  ASSERT (a != NULL);
+  ASSERT (a->magic == ARENA_MAGIC);
+  ASSERT (idx < a->desc->blocks_per_arena);
+  return (struct block *) ((uint8_t *) a
+                           + sizeof *a
+                           + idx * a->desc->block_size);
+}
@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <malloc.h>
+#include <string.h>
+#include <syscall.h>
+
+/* Buffered streams.
+
+   A stream open for reading holds the bytes between POS and END
+   of its buffer that have been read from its file but not yet
+   returned to the program.  A stream open for writing holds the
+   bytes between the start of its buffer and POS that the program
+   has written but that have not yet been passed to write().  A
+   stream does one or the other, never both. */
+
+/* Stream flags. */
+#define STREAM_READ 0x01        /* Open for reading. */
+#define STREAM_WRITE 0x02       /* Open for writing. */
+#define STREAM_LINE 0x04        /* Flush output at each new-line. */
+#define STREAM_EOF 0x08         /* End of file reached. */
+#define STREAM_ERROR 0x10       /* Read or write failed. */
+#define STREAM_MALLOC 0x20      /* BUF came from malloc(). */
+
+struct FILE
+  {
+    int fd;                     /* File descriptor. */
+    unsigned flags;             /* STREAM_* flags, 0 if slot unused. */
+    char *buf;                  /* Buffer. */
+    size_t size;                /* Size of BUF. */
+    char *pos;                  /* Current position in BUF. */
+    char *end;                  /* End of buffered input. */
+  };
+
+static char stdin_buf[1];
+static char stdout_buf[BUFSIZ];
+
+/* All the streams. */
+static FILE streams[FOPEN_MAX] =
+  {
+    { STDIN_FILENO, STREAM_READ, stdin_buf, sizeof stdin_buf,
+      stdin_buf, stdin_buf },
+    { STDOUT_FILENO, STREAM_WRITE | STREAM_LINE, stdout_buf,
+      sizeof stdout_buf, stdout_buf, NULL },
+  };
+
+FILE *stdin = &streams[0];
+FILE *stdout = &streams[1];
+
+static bool refill (FILE *);
+
+/* Opens the file named NAME and returns a stream for it, or a
+   null pointer on failure.  MODE is "r" to read the file or "w"
+   to write it, replacing any file by that name. */
+FILE *
+fopen (const char *name, const char *mode)
+{
+  FILE *f;
+  int fd;
+
+  if (!strcmp (mode, "r"))
+    fd = open (name);
+  else if (!strcmp (mode, "w"))
+    {
+      remove (name);
+      fd = create (name, 0) ? open (name) : -1;
+    }
+  else
+    return NULL;
+  if (fd < 0)
+    return NULL;
+
+  f = fdopen (fd, mode);
+  if (f == NULL)
+    close (fd);
+  return f;
+}
+
+/* Returns a fully buffered stream for file descriptor FD, which
+   reads FD if MODE is "r" and writes it if MODE is "w", or a
+   null pointer on failure.  Closing the stream closes FD. */
+FILE *
+fdopen (int fd, const char *mode)
+{
+  unsigned flags;
+  FILE *f;
+
+  if (!strcmp (mode, "r"))
+    flags = STREAM_READ;
+  else if (!strcmp (mode, "w"))
+    flags = STREAM_WRITE;
+  else
+    return NULL;
+
+  for (f = streams; f < streams + FOPEN_MAX; f++)
+    if (f->flags == 0)
+      {
+        f->buf = malloc (BUFSIZ);
+        if (f->buf == NULL)
+          return NULL;
+        f->fd = fd;
+        f->flags = flags | STREAM_MALLOC;
+        f->size = BUFSIZ;
+        f->pos = f->end = f->buf;
+        return f;
+      }
+  return NULL;
+}
+
+/* Flushes and closes stream F, also closing its file descriptor
+   unless it is stdin or stdout.  Returns 0 if successful, EOF if
+   buffered output could not be written. */
+int
+fclose (FILE *f)
+{
+  int retval = fflush (f);
+
+  if (f->fd != STDIN_FILENO && f->fd != STDOUT_FILENO)
+    close (f->fd);
+  if (f->flags & STREAM_MALLOC)
+    free (f->buf);
+  f->flags = 0;
+  return retval;
+}
+
+/* Writes the output buffered by stream F, or by every stream if
+   F is null.  Returns 0 if successful, EOF on error. */
+int
+fflush (FILE *f)
+{
+  int retval = 0;
+
+  if (f == NULL)
+    {
+      for (f = streams; f < streams + FOPEN_MAX; f++)
+        if ((f->flags & STREAM_WRITE) && fflush (f) == EOF)
+          retval = EOF;
+    }
+  else if ((f->flags & STREAM_WRITE) && f->pos > f->buf)
+    {
+      int size = f->pos - f->buf;
+
+      if (write (f->fd, f->buf, size) != size)
+        {
+          f->flags |= STREAM_ERROR;
+          retval = EOF;
+        }
+      f->pos = f->buf;
+    }
+  return retval;
+}
+
+/* Returns nonzero if a read from F has reached end of file. */
+int
+feof (FILE *f)
+{
+  return (f->flags & STREAM_EOF) != 0;
+}
+
+/* Returns nonzero if a read or write of F has failed. */
+int
+ferror (FILE *f)
+{
+  return (f->flags & STREAM_ERROR) != 0;
+}
+
+/* Reads more input into the buffer of stream F, which must be
+   empty.  Reading stdin first flushes stdout, so that a prompt
+   appears before the program waits for the answer.  Returns true
+   if any bytes were read, false at end of file or on error. */
+static bool
+refill (FILE *f)
+{
+  int n;
+
+  if (!(f->flags & STREAM_READ) || (f->flags & STREAM_EOF))
+    return false;
+  if (f->fd == STDIN_FILENO)
+    fflush (stdout);
+
+  n = read (f->fd, f->buf, f->size);
+  if (n <= 0)
+    {
+      f->flags |= n < 0 ? STREAM_ERROR : STREAM_EOF;
+      return false;
+    }
+  f->pos = f->buf;
+  f->end = f->buf + n;
+  return true;
+}
+
+/* Reads and returns the next byte from stream F, or EOF at end
+   of file or on error. */
+int
+fgetc (FILE *f)
+{
+  if (f->pos >= f->end && !refill (f))
+    return EOF;
+  return (unsigned char) *f->pos++;
+}
+
+/* Reads a line from stream F into S, which has room for SIZE
+   bytes, up to and including the new-line, or SIZE - 1 bytes,
+   whichever is shorter, and null-terminates it.  Returns S, or a
+   null pointer if nothing was read before end of file or an
+   error. */
+char *
+fgets (char *s, int size, FILE *f)
+{
+  char *p = s;
+
+  if (size <= 0)
+    return NULL;
+  while (p < s + size - 1)
+    {
+      int c = fgetc (f);
+      if (c == EOF)
+        break;
+      *p++ = c;
+      if (c == '\n')
+        break;
+    }
+  if (p == s)
+    return NULL;
+  *p = '\0';
+  return s;
+}
+
+/* Reads up to CNT elements of SIZE bytes each from stream F into
+   BUFFER and returns the number of whole elements read.  Reads
+   as big as the stream buffer or bigger bypass it. */
+size_t
+fread (void *buffer_, size_t size, size_t cnt, FILE *f)
+{
+  char *buffer = buffer_;
+  size_t total = size * cnt;
+  size_t done = 0;
+
+  if (size == 0 || total / size != cnt)
+    return 0;
+  while (done < total)
+    {
+      size_t n = f->end - f->pos;
+
+      if (n == 0)
+        {
+          if (total - done >= f->size && (f->flags & STREAM_READ)
+              && !(f->flags & STREAM_EOF))
+            {
+              int m = read (f->fd, buffer + done, total - done);
+              if (m <= 0)
+                {
+                  f->flags |= m < 0 ? STREAM_ERROR : STREAM_EOF;
+                  break;
+                }
+              done += m;
+              continue;
+            }
+          if (!refill (f))
+            break;
+          n = f->end - f->pos;
+        }
+      if (n > total - done)
+        n = total - done;
+      memcpy (buffer + done, f->pos, n);
+      f->pos += n;
+      done += n;
+    }
+  return done / size;
+}
+
+/* Reads and returns the next byte from stdin, or EOF. */
+int
+getchar (void)
+{
+  return fgetc (stdin);
+}
+
+/* Writes C to stream F.  Returns C, or EOF on error. */
+int
+fputc (int c, FILE *f)
+{
+  if (!(f->flags & STREAM_WRITE))
+    return EOF;
+  *f->pos++ = c;
+  if ((f->pos >= f->buf + f->size
+       || (c == '\n' && (f->flags & STREAM_LINE)))
+      && fflush (f) == EOF)
+    return EOF;
+  return (unsigned char) c;
+}
+
+/* Writes string S to stream F.  Returns 0 if successful, EOF on
+   error. */
+int
+fputs (const char *s, FILE *f)
+{
+  size_t len = strlen (s);
+
+  return fwrite (s, 1, len, f) == len ? 0 : EOF;
+}
+
+/* Writes CNT elements of SIZE bytes each from BUFFER to stream F
+   and returns the number of whole elements written.  Writes as
+   big as the stream buffer or bigger bypass it. */
+size_t
+fwrite (const void *buffer_, size_t size, size_t cnt, FILE *f)
+{
+  const char *buffer = buffer_;
+  size_t total = size * cnt;
+  size_t done = 0;
+
+  if (!(f->flags & STREAM_WRITE) || size == 0 || total / size != cnt)
+    return 0;
+  while (done < total)
+    {
+      size_t room = f->buf + f->size - f->pos;
+      size_t n;
+
+      if (f->pos == f->buf && total - done >= f->size)
+        {
+          int m = write (f->fd, buffer + done, total - done);
+          if (m <= 0)
+            {
+              f->flags |= STREAM_ERROR;
+              break;
+            }
+          done += m;
+          continue;
+        }
+
+      n = total - done < room ? total - done : room;
+      memcpy (f->pos, buffer + done, n);
+      f->pos += n;
+      done += n;
+      if (f->pos >= f->buf + f->size && fflush (f) == EOF)
+        break;
+    }
+  if ((f->flags & STREAM_LINE) && memchr (buffer, '\n', done) != NULL)
+    fflush (f);
+  return done / size;
+}
+
+/* Auxiliary data for vfprintf_helper(). */
+struct vfprintf_aux
+  {
+    FILE *stream;       /* Output stream. */
+    int char_cnt;       /* Total characters written so far. */
+  };
+
+/* Writes the N bytes in S to the stream in AUX. */
+static void
+vfprintf_helper (const char *s, size_t n, void *aux_)
+{
+  struct vfprintf_aux *aux = aux_;
+
+  fwrite (s, 1, n, aux->stream);
+  aux->char_cnt += n;
+}
+
+/* Formats the printf() format specification FORMAT with
+   arguments given in ARGS and writes the output to stream F.
+   Returns the number of characters formatted. */
+int
+vfprintf (FILE *f, const char *format, va_list args)
+{
+  struct vfprintf_aux aux;
+
+  aux.stream = f;
+  aux.char_cnt = 0;
+  __vprintf (format, args, vfprintf_helper, &aux);
+  return aux.char_cnt;
+}
+
+/* Like printf(), but writes output to stream F. */
+int
+fprintf (FILE *f, const char *format, ...)
+{
+  va_list args;
+  int retval;
+
+  va_start (args, format);
+  retval = vfprintf (f, format, args);
+  va_end (args);
+
+  return retval;
+}
@@ -4,4 +4,43 @@
 int hprintf (int, const char *, ...) PRINTF_FORMAT (2, 3);
 int vhprintf (int, const char *, va_list) PRINTF_FORMAT (2, 0);
 
+/* Buffered streams.
+
+   Output to stdout is buffered until a new-line, until the buffer
+   fills, or until the program reads stdin or exits.  Streams on
+   files opened with fopen() or fdopen() are fully buffered.
+   stdin is unbuffered, because the console returns characters as
+   they are typed and programs like the shell echo each one. */
+typedef struct FILE FILE;
+extern FILE *stdin;
+extern FILE *stdout;
+
+/* Size of a stream buffer. */
+#define BUFSIZ 512
+
+/* Most streams open at once, including stdin and stdout. */
+#define FOPEN_MAX 16
+
+/* Returned by character input and output functions on end of
+   file or error. */
+#define EOF (-1)
+
+FILE *fopen (const char *name, const char *mode);
+FILE *fdopen (int fd, const char *mode);
+int fclose (FILE *);
+int fflush (FILE *);
+int feof (FILE *);
+int ferror (FILE *);
+
+int fgetc (FILE *);
+char *fgets (char *, int size, FILE *);
+size_t fread (void *, size_t size, size_t cnt, FILE *);
+int getchar (void);
+
+int fputc (int, FILE *);
+int fputs (const char *, FILE *);
+size_t fwrite (const void *, size_t size, size_t cnt, FILE *);
+int fprintf (FILE *, const char *, ...) PRINTF_FORMAT (2, 3);
+int vfprintf (FILE *, const char *, va_list) PRINTF_FORMAT (2, 0);
+
 #endif /* lib/user/stdio.h */
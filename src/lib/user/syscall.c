@@ -1,31 +1,66 @@
 #include <syscall.h>
+#include <stdio.h>
 #include "../syscall-nr.h"
 
+/* System call entry.
+
+   The macros below push a call's arguments and number and call
+   the stub in SYSCALL_TRAP, which enters the kernel with the
+   stack laid out as `int $0x30' expects: the stub first pops its
+   return address into %edx.  syscall_int_stub then uses
+   `int $0x30'.  syscall_sysenter_stub uses the faster SYSENTER,
+   passing the stack pointer in %ecx, and the kernel's SYSEXIT
+   returns straight to the address in %edx.  syscall_setup()
+   picks SYSENTER if the processor has it, in which case the
+   kernel supports it too.  Either way %ecx and %edx are not
+   preserved. */
+void syscall_setup (void);
+void syscall_int_stub (void);
+void syscall_sysenter_stub (void);
+asm (".text\n"
+     "syscall_int_stub:\n"
+     "\tpopl %edx\n"
+     "\tint $0x30\n"
+     "\tjmp *%edx\n"
+     "syscall_sysenter_stub:\n"
+     "\tpopl %edx\n"
+     "\tmovl %esp, %ecx\n"
+     "\tsysenter\n");
+
+/* Stub that the system call macros call. */
+static void (*syscall_trap) (void) = syscall_int_stub;
+
+/* CPUID leaf 1 EDX bit for SYSENTER and SYSEXIT. */
+#define CPUID_SEP 0x00000800
+
 /* Invokes syscall NUMBER, passing no arguments, and returns the
    return value as an `int'. */
 #define syscall0(NUMBER)                                        \
         ({                                                      \
           int retval;                                           \
           asm volatile                                          \
-            ("pushl %[number]; int $0x30; addl $4, %%esp"       \
+            ("pushl %[number]; call *%[trap]; addl $4, %%esp"   \
                : "=a" (retval)                                  \
-               : [number] "i" (NUMBER)                          \
-               : "memory");                                     \
+               : [number] "i" (NUMBER),                         \
+                 [trap] "m" (syscall_trap)                      \
+               : "ecx", "edx", "memory");                       \
           retval;                                               \
         })
 
 /* Invokes syscall NUMBER, passing argument ARG0, and returns the
    return value as an `int'. */
-#define syscall1(NUMBER, ARG0)                                           \
-        ({                                                               \
-          int retval;                                                    \
-          asm volatile                                                   \
-            ("pushl %[arg0]; pushl %[number]; int $0x30; addl $8, %%esp" \
-               : "=a" (retval)                                           \
-               : [number] "i" (NUMBER),                                  \
-                 [arg0] "g" (ARG0)                                       \
-               : "memory");                                              \
-          retval;                                                        \
+#define syscall1(NUMBER, ARG0)                                  \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg0]; pushl %[number]; "                 \
+             "call *%[trap]; addl $8, %%esp"                    \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [trap] "m" (syscall_trap),                     \
+                 [arg0] "g" (ARG0)                              \
+               : "ecx", "edx", "memory");                       \
+          retval;                                               \
         })
 
 /* Invokes syscall NUMBER, passing arguments ARG0 and ARG1, and
@@ -35,12 +70,13 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg1]; pushl %[arg0]; "                   \
-             "pushl %[number]; int $0x30; addl $12, %%esp"      \
+             "pushl %[number]; call *%[trap]; addl $12, %%esp"  \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
+                 [trap] "m" (syscall_trap),                     \
                  [arg0] "r" (ARG0),                             \
                  [arg1] "r" (ARG1)                              \
-               : "memory");                                     \
+               : "ecx", "edx", "memory");                       \
           retval;                                               \
         })
 
@@ -51,19 +87,59 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg2]; pushl %[arg1]; pushl %[arg0]; "    \
-             "pushl %[number]; int $0x30; addl $16, %%esp"      \
+             "pushl %[number]; call *%[trap]; addl $16, %%esp"  \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
+                 [trap] "m" (syscall_trap),                     \
                  [arg0] "r" (ARG0),                             \
                  [arg1] "r" (ARG1),                             \
                  [arg2] "r" (ARG2)                              \
-               : "memory");                                     \
+               : "ecx", "edx", "memory");                       \
           retval;                                               \
         })
 
+/* Invokes syscall NUMBER, passing arguments ARG0, ARG1, ARG2,
+   and ARG3, and returns the return value as an `int'. */
+#define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3)                \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg3]; pushl %[arg2]; "                   \
+             "pushl %[arg1]; pushl %[arg0]; "                   \
+             "pushl %[number]; call *%[trap]; addl $20, %%esp"  \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [trap] "m" (syscall_trap),                     \
+                 [arg0] "r" (ARG0),                             \
+                 [arg1] "r" (ARG1),                             \
+                 [arg2] "r" (ARG2),                             \
+                 [arg3] "r" (ARG3)                              \
+               : "ecx", "edx", "memory");                       \
+          retval;                                               \
+        })
+
+/* Makes system calls use SYSENTER if the processor has it.
+   Called by _start() before main(). */
+void
+syscall_setup (void)
+{
+  uint32_t eax, ebx, ecx, edx;
+
+  asm volatile ("cpuid"
+                : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                : "a" (1));
+  if (edx & CPUID_SEP)
+    syscall_trap = syscall_sysenter_stub;
+}
+
+/* halt(), exit(), fork() and snapshot() first write the output
+   buffered by stdio streams: otherwise it would be lost, or
+   written by both parent and child. */
+
 void
 halt (void) 
 {
+  fflush (NULL);
   syscall0 (SYS_HALT);
   NOT_REACHED ();
 }
@@ -71,6 +147,7 @@ halt (void)
 void
 exit (int status)
 {
+  fflush (NULL);
   syscall1 (SYS_EXIT, status);
   NOT_REACHED ();
 }
@@ -81,6 +158,12 @@ exec (const char *file)
   return (pid_t) syscall1 (SYS_EXEC, file);
 }
 
+pid_t
+spawn (const char *file, int stdin_fd, int stdout_fd)
+{
+  return (pid_t) syscall3 (SYS_SPAWN, file, stdin_fd, stdout_fd);
+}
+
 int
 wait (pid_t pid)
 {
@@ -182,3 +265,236 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+pid_t
+fork (void)
+{
+  fflush (NULL);
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
+bool
+vmstat (pid_t pid, struct vmstat *stats)
+{
+  return syscall2 (SYS_VMSTAT, pid, stats);
+}
+
+int
+pread (int fd, void *buffer, unsigned size, unsigned offset)
+{
+  return syscall4 (SYS_PREAD, fd, buffer, size, offset);
+}
+
+int
+pwrite (int fd, const void *buffer, unsigned size, unsigned offset)
+{
+  return syscall4 (SYS_PWRITE, fd, buffer, size, offset);
+}
+
+int
+readv (int fd, const struct iovec *iov, int iov_cnt)
+{
+  return syscall3 (SYS_READV, fd, iov, iov_cnt);
+}
+
+int
+writev (int fd, const struct iovec *iov, int iov_cnt)
+{
+  return syscall3 (SYS_WRITEV, fd, iov, iov_cnt);
+}
+
+int
+settickets (int tickets)
+{
+  return syscall1 (SYS_SETTICKETS, tickets);
+}
+
+void
+schedstat (void)
+{
+  syscall0 (SYS_SCHEDSTAT);
+}
+
+void
+memstat (void)
+{
+  syscall0 (SYS_MEMSTAT);
+}
+
+bool
+fsync (int fd)
+{
+  return syscall1 (SYS_FSYNC, fd);
+}
+
+void
+sync (void)
+{
+  syscall0 (SYS_SYNC);
+}
+
+bool
+fallocate (int fd, int mode, unsigned offset, unsigned length)
+{
+  return syscall4 (SYS_FALLOCATE, fd, mode, offset, length);
+}
+
+int
+copy_file_range (int fd_in, int fd_out, unsigned size)
+{
+  return syscall3 (SYS_COPY_FILE_RANGE, fd_in, fd_out, size);
+}
+
+int
+getdents (int fd, struct dirent *buffer, unsigned size)
+{
+  return syscall3 (SYS_GETDENTS, fd, buffer, size);
+}
+
+void
+kstat (struct kstat *stats)
+{
+  syscall1 (SYS_KSTAT, stats);
+}
+
+bool
+sysctl (const char *name, int *old, const int *new)
+{
+  return syscall3 (SYS_SYSCTL, name, old, new);
+}
+
+int
+snapshot (const char *file)
+{
+  fflush (NULL);
+  return syscall1 (SYS_SNAPSHOT, file);
+}
+
+pid_t
+restore (const char *file)
+{
+  return (pid_t) syscall1 (SYS_RESTORE, file);
+}
+
+bool
+strace (bool enable)
+{
+  return syscall1 (SYS_STRACE, enable);
+}
+
+int
+open_flags (const char *file, int flags)
+{
+  return syscall2 (SYS_OPEN_FLAGS, file, flags);
+}
+
+void *
+sbrk (intptr_t increment)
+{
+  return (void *) syscall1 (SYS_SBRK, increment);
+}
+
+bool
+madvise (void *addr, size_t length, int advice)
+{
+  return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+bool
+mlock (const void *addr, size_t length)
+{
+  return syscall2 (SYS_MLOCK, addr, length);
+}
+
+bool
+munlock (const void *addr, size_t length)
+{
+  return syscall2 (SYS_MUNLOCK, addr, length);
+}
+
+int
+pipe (int fds[2])
+{
+  return syscall1 (SYS_PIPE, fds);
+}
+
+int
+dup2 (int old_fd, int new_fd)
+{
+  return syscall2 (SYS_DUP2, old_fd, new_fd);
+}
+
+bool
+shm_map (const char *name, size_t size, void *addr)
+{
+  return syscall3 (SYS_SHM_MAP, name, size, addr);
+}
+
+bool
+shm_unmap (void *addr)
+{
+  return syscall1 (SYS_SHM_UNMAP, addr);
+}
+
+bool
+shm_unlink (const char *name)
+{
+  return syscall1 (SYS_SHM_UNLINK, name);
+}
+
+/* Where a thread made by thread_create() starts, as if called
+   with FUNC and AUX.  Returning from FUNC ends the thread. */
+static void
+thread_start (int (*func) (void *), void *aux)
+{
+  thread_exit (func (aux));
+}
+
+tid_t
+thread_create (int (*func) (void *), void *aux)
+{
+  return syscall3 (SYS_THREAD_CREATE, thread_start, func, aux);
+}
+
+int
+thread_join (tid_t tid)
+{
+  return syscall1 (SYS_THREAD_JOIN, tid);
+}
+
+void
+thread_exit (int status)
+{
+  syscall1 (SYS_THREAD_EXIT, status);
+  NOT_REACHED ();
+}
+
+int
+futex_wait (int *addr, int val)
+{
+  return syscall2 (SYS_FUTEX_WAIT, addr, val);
+}
+
+int
+futex_wake (int *addr, int cnt)
+{
+  return syscall2 (SYS_FUTEX_WAKE, addr, cnt);
+}
+
+int
+poll (struct pollfd *fds, unsigned nfds, int timeout)
+{
+  return syscall3 (SYS_POLL, fds, nfds, timeout);
+}
+
+int
+aio_submit (const struct aio_request *reqs, int cnt)
+{
+  return syscall2 (SYS_AIO_SUBMIT, reqs, cnt);
+}
+
+int
+aio_getevents (struct aio_event *events, int min, int max)
+{
+  return syscall3 (SYS_AIO_GETEVENTS, events, min, max);
+}
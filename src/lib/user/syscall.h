@@ -2,16 +2,41 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <aio.h>
 #include <debug.h>
+#include <iovec.h>
+#include <poll.h>
+#include <dirent.h>
+#include <kstat.h>
+#include <sysctl.h>
+#include <vmstat.h>
 
 /* Process identifier. */
 typedef int pid_t;
 #define PID_ERROR ((pid_t) -1)
 
+/* Thread identifier. */
+typedef int tid_t;
+#define TID_ERROR ((tid_t) -1)
+
 /* Map region identifier. */
 typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
 
+/* Access pattern hints for madvise(). */
+#define MADV_NORMAL 0           /* No special treatment. */
+#define MADV_SEQUENTIAL 1       /* Read ahead, evict behind. */
+#define MADV_RANDOM 2           /* No read-around. */
+#define MADV_WILLNEED 3         /* Read the pages in now. */
+#define MADV_DONTNEED 4         /* Discard the pages. */
+
+/* Mode flags for fallocate(). */
+#define FALLOC_PUNCH_HOLE 1     /* Free the range instead. */
+
+/* Mode flags for open_flags(). */
+#define O_APPEND 1              /* Every write goes to end of file. */
+
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
@@ -23,6 +48,7 @@ typedef int mapid_t;
 void halt (void) NO_RETURN;
 void exit (int status) NO_RETURN;
 pid_t exec (const char *file);
+pid_t spawn (const char *file, int stdin_fd, int stdout_fd);
 int wait (pid_t);
 bool create (const char *file, unsigned initial_size);
 bool remove (const char *file);
@@ -45,4 +71,43 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+pid_t fork (void);
+bool vmstat (pid_t, struct vmstat *);
+int pread (int fd, void *buffer, unsigned length, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned offset);
+int readv (int fd, const struct iovec *, int iov_cnt);
+int writev (int fd, const struct iovec *, int iov_cnt);
+int settickets (int tickets);
+void schedstat (void);
+void memstat (void);
+bool fsync (int fd);
+bool fallocate (int fd, int mode, unsigned offset, unsigned length);
+void sync (void);
+int copy_file_range (int fd_in, int fd_out, unsigned size);
+int getdents (int fd, struct dirent *, unsigned size);
+void kstat (struct kstat *);
+bool sysctl (const char *name, int *old, const int *new);
+int snapshot (const char *file);
+pid_t restore (const char *file);
+bool strace (bool enable);
+int open_flags (const char *file, int flags);
+void *sbrk (intptr_t increment);
+bool madvise (void *addr, size_t length, int advice);
+bool mlock (const void *addr, size_t length);
+bool munlock (const void *addr, size_t length);
+int pipe (int fds[2]);
+int dup2 (int old_fd, int new_fd);
+bool shm_map (const char *name, size_t size, void *addr);
+bool shm_unmap (void *addr);
+bool shm_unlink (const char *name);
+tid_t thread_create (int (*func) (void *), void *aux);
+int thread_join (tid_t);
+void thread_exit (int status) NO_RETURN;
+int futex_wait (int *addr, int val);
+int futex_wake (int *addr, int cnt);
+int poll (struct pollfd *, unsigned nfds, int timeout);
+int aio_submit (const struct aio_request *, int cnt);
+int aio_getevents (struct aio_event *, int min, int max);
+
 #endif /* lib/user/syscall.h */
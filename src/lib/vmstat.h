@@ -0,0 +1,20 @@
+#ifndef __LIB_VMSTAT_H
+#define __LIB_VMSTAT_H
+
+/* Paging statistics of a process, as kept by the kernel and
+   returned by the vmstat system call. */
+struct vmstat
+  {
+    unsigned minor_faults;      /* Pages brought in without I/O. */
+    unsigned major_faults;      /* Pages read from swap or a file. */
+    unsigned evictions;         /* Frames evicted to satisfy the process. */
+    unsigned swap_outs;         /* Pages of the process written to swap. */
+    unsigned resident;          /* Pages currently in memory. */
+    unsigned max_resident;      /* Peak of RESIDENT. */
+    unsigned locked;            /* Pages locked in memory by mlock(). */
+    unsigned dirty;             /* Mapped file pages not written back. */
+    unsigned allotted;          /* Resident pages allotted by the
+                                   page-fault frequency. */
+  };
+
+#endif /* lib/vmstat.h */
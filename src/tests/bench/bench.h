@@ -0,0 +1,34 @@
+#ifndef TESTS_BENCH_BENCH_H
+#define TESTS_BENCH_BENCH_H
+
+#include <stdint.h>
+
+/* Micro-benchmarks.
+
+   Each benchmark times a number of repetitions of one operation
+   with the CPU's time-stamp counter and reports the result with
+   msg() as one line in BENCH_FORMAT, for example
+
+      (syscall) bench null-syscall: 4096 ops, 812 cycles/op
+
+   which tests/bench/bench.pm parses.  The numbers depend on the
+   simulator and the host, so a benchmark passes as long as it
+   runs to completion and reports every result it should. */
+#define BENCH_FORMAT "bench %s: %u ops, %llu cycles/op"
+
+/* Reads the CPU's time-stamp counter. */
+static inline uint64_t
+bench_cycles (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Reports that OPS repetitions of benchmark NAME, begun when the
+   time-stamp counter read START, took the cycles up to now. */
+#define BENCH_REPORT(NAME, OPS, START)                                  \
+        msg (BENCH_FORMAT, NAME, (unsigned) (OPS),                      \
+             (unsigned long long) ((bench_cycles () - (START)) / (OPS)))
+
+#endif /* tests/bench/bench.h */
@@ -0,0 +1,41 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# Checks that the output of a benchmark contains a well-formed
+# result line for each of the benchmarks named in @names, and no
+# others.  A result line may end with further counts, as in
+# ", 12 faults".
+sub check_bench {
+    my (@names) = @_;
+    our ($test);
+
+    my (@output) = read_text_file ("$test.output");
+    common_checks ("run", @output);
+
+    my ($prefix) = $test =~ m%([^/]+)$%;
+    fail "missing \"($prefix) begin\"\n"
+      if !grep ($_ eq "($prefix) begin", @output);
+    fail "missing \"($prefix) end\"\n"
+      if !grep ($_ eq "($prefix) end", @output);
+
+    my (%results);
+    foreach (@output) {
+	my ($name, $ops, $cycles)
+	  = /^\(\S+\) bench (\S+): (\d+) ops, (\d+) cycles\/op(?:, \d+ [^,\s]+)*$/
+	  or next;
+	fail "$name reported twice\n" if exists $results{$name};
+	fail "$name ran no operations\n" if $ops == 0;
+	$results{$name} = $cycles;
+    }
+    foreach my $name (@names) {
+	fail "no result for $name\n" if !exists $results{$name};
+	delete $results{$name};
+    }
+    fail "unexpected result for " . join (", ", sort keys %results) . "\n"
+      if %results;
+    pass;
+}
+
+1;
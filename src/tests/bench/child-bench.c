@@ -0,0 +1,11 @@
+/* Child process for exec-wait, which exits at once. */
+
+#include "tests/lib.h"
+
+const char *test_name = "child-bench";
+
+int
+main (void) 
+{
+  return 0;
+}
@@ -0,0 +1,26 @@
+/* Times starting a trivial child process and waiting for it. */
+
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define OPS 32
+
+void
+test_main (void)
+{
+  uint64_t start;
+  int i;
+
+  start = bench_cycles ();
+  for (i = 0; i < OPS; i++)
+    {
+      pid_t pid = exec ("child-bench");
+      if (pid == PID_ERROR)
+        fail ("exec \"child-bench\" failed");
+      if (wait (pid) != 0)
+        fail ("child-bench failed");
+    }
+  BENCH_REPORT ("exec-wait", OPS, start);
+}
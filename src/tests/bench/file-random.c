@@ -0,0 +1,49 @@
+/* Times writing and reading sector-sized blocks at random
+   offsets in a file. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define FILE_SIZE (64 * 1024)
+#define BLOCK_CNT (FILE_SIZE / BLOCK_SIZE)
+#define OPS 512
+
+static char buf[BLOCK_SIZE];
+static unsigned order[OPS];
+
+void
+test_main (void)
+{
+  uint64_t start;
+  int fd, i;
+
+  for (i = 0; i < OPS; i++)
+    order[i] = random_ulong () % BLOCK_CNT * BLOCK_SIZE;
+
+  CHECK (create ("bench", FILE_SIZE), "create \"bench\"");
+  CHECK ((fd = open ("bench")) > 1, "open \"bench\"");
+
+  start = bench_cycles ();
+  for (i = 0; i < OPS; i++)
+    {
+      seek (fd, order[i]);
+      if (write (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("write at %u failed", order[i]);
+    }
+  BENCH_REPORT ("random-write", OPS, start);
+
+  start = bench_cycles ();
+  for (i = 0; i < OPS; i++)
+    {
+      seek (fd, order[i]);
+      if (read (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("read at %u failed", order[i]);
+    }
+  BENCH_REPORT ("random-read", OPS, start);
+
+  close (fd);
+}
@@ -0,0 +1,38 @@
+/* Times writing a file from start to end in sector-sized blocks,
+   then reading it back the same way. */
+
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define FILE_SIZE (64 * 1024)
+#define OPS (FILE_SIZE / BLOCK_SIZE)
+
+static char buf[BLOCK_SIZE];
+
+void
+test_main (void)
+{
+  uint64_t start;
+  int fd, i;
+
+  CHECK (create ("bench", 0), "create \"bench\"");
+  CHECK ((fd = open ("bench")) > 1, "open \"bench\"");
+
+  start = bench_cycles ();
+  for (i = 0; i < OPS; i++)
+    if (write (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+      fail ("write %d failed", i);
+  BENCH_REPORT ("seq-write", OPS, start);
+
+  seek (fd, 0);
+  start = bench_cycles ();
+  for (i = 0; i < OPS; i++)
+    if (read (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+      fail ("read %d failed", i);
+  BENCH_REPORT ("seq-read", OPS, start);
+
+  close (fd);
+}
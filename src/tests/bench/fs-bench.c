@@ -0,0 +1,153 @@
+/* File system throughput benchmark.
+
+   Usage: fs-bench [RECORD [FILE-SIZE [CHILDREN [READ-PCT]]]]
+
+   Starts CHILDREN child processes, each of which does
+   FILE-SIZE / RECORD reads and writes of RECORD bytes at random
+   record-aligned offsets in a file of its own of FILE-SIZE
+   bytes.  READ-PCT percent of the operations are reads and the
+   rest are writes.  The defaults are 512-byte records in 64 kB
+   files, 4 children and 50% reads.
+
+   Each child reports its mean, median, 90th and 99th percentile
+   latency in cycles and its throughput in bytes per 1,000
+   cycles.  The parent reports the throughput of the whole run.
+   Throughput is given per cycle, not per second, because user
+   programs cannot read the clock rate. */
+
+#include <random.h>
+#include <sort.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+
+const char *test_name = "fs-bench";
+
+#define MAX_RECORD 16384
+#define MAX_FILE_SIZE (1024 * 1024)
+#define MAX_CHILDREN 16
+#define MAX_OPS 1024
+
+#define UNSIGNED_LESS(A, B) ((A) < (B))
+SORT_DEFINE (sort_unsigned, unsigned, UNSIGNED_LESS)
+
+static char buf[MAX_RECORD];
+static unsigned latencies[MAX_OPS];
+
+static int run_child (int id, int record, int file_size, int read_pct);
+static unsigned throughput (uint64_t bytes, uint64_t cycles);
+
+int
+main (int argc, char *argv[]) 
+{
+  int record = argc > 1 ? atoi (argv[1]) : 512;
+  int file_size = argc > 2 ? atoi (argv[2]) : 64 * 1024;
+  int child_cnt = argc > 3 ? atoi (argv[3]) : 4;
+  int read_pct = argc > 4 ? atoi (argv[4]) : 50;
+  pid_t children[MAX_CHILDREN];
+  uint64_t start, cycles;
+  int i;
+
+  /* A child is started as "fs-bench -child ID RECORD FILE-SIZE
+     READ-PCT". */
+  if (argc == 6 && !strcmp (argv[1], "-child"))
+    return run_child (atoi (argv[2]), atoi (argv[3]), atoi (argv[4]),
+                      atoi (argv[5]));
+
+  msg ("begin");
+  if (record <= 0 || record > MAX_RECORD
+      || file_size < record || file_size > MAX_FILE_SIZE
+      || child_cnt <= 0 || child_cnt > MAX_CHILDREN
+      || read_pct < 0 || read_pct > 100)
+    fail ("bad arguments");
+  msg ("%d-byte records, %d-byte files, %d children, %d%% reads",
+       record, file_size, child_cnt, read_pct);
+
+  for (i = 0; i < child_cnt; i++)
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "fsb-%d", i);
+      if (!create (name, file_size))
+        fail ("create \"%s\" failed", name);
+    }
+
+  start = bench_cycles ();
+  for (i = 0; i < child_cnt; i++)
+    {
+      char cmd[64];
+
+      snprintf (cmd, sizeof cmd, "fs-bench -child %d %d %d %d",
+                i, record, file_size, read_pct);
+      children[i] = exec (cmd);
+      if (children[i] == PID_ERROR)
+        fail ("exec \"%s\" failed", cmd);
+    }
+  for (i = 0; i < child_cnt; i++)
+    if (wait (children[i]) != 0)
+      fail ("child %d failed", i);
+  cycles = bench_cycles () - start;
+
+  msg (BENCH_FORMAT ", %u B/kcycle", "total", child_cnt,
+       (unsigned long long) (cycles / child_cnt),
+       throughput ((uint64_t) child_cnt * file_size, cycles));
+  msg ("end");
+  return 0;
+}
+
+/* Runs child ID of the benchmark and reports its results.
+   Returns 0 if successful. */
+static int
+run_child (int id, int record, int file_size, int read_pct)
+{
+  int record_cnt = file_size / record;
+  int op_cnt = record_cnt < MAX_OPS ? record_cnt : MAX_OPS;
+  uint64_t total = 0;
+  char name[16];
+  int fd, i;
+
+  random_init (id + 1);
+  snprintf (name, sizeof name, "fsb-%d", id);
+  fd = open (name);
+  if (fd < 2)
+    fail ("open \"%s\" failed", name);
+
+  for (i = 0; i < op_cnt; i++)
+    {
+      unsigned ofs = random_ulong () % record_cnt * record;
+      bool is_read = (int) (random_ulong () % 100) < read_pct;
+      uint64_t start, cycles;
+      int bytes;
+
+      start = bench_cycles ();
+      seek (fd, ofs);
+      bytes = is_read ? read (fd, buf, record) : write (fd, buf, record);
+      cycles = bench_cycles () - start;
+      if (bytes != record)
+        fail ("%s of %d bytes at %u failed",
+              is_read ? "read" : "write", record, ofs);
+
+      latencies[i] = cycles < UINT32_MAX ? cycles : UINT32_MAX;
+      total += cycles;
+    }
+  close (fd);
+
+  sort_unsigned (latencies, op_cnt);
+  snprintf (name, sizeof name, "child-%d", id);
+  msg (BENCH_FORMAT ", %u p50, %u p90, %u p99, %u B/kcycle", name, op_cnt,
+       (unsigned long long) (total / op_cnt), latencies[op_cnt / 2],
+       latencies[op_cnt * 9 / 10], latencies[op_cnt * 99 / 100],
+       throughput ((uint64_t) op_cnt * record, total));
+  return 0;
+}
+
+/* Returns BYTES transferred in CYCLES as bytes per 1,000
+   cycles. */
+static unsigned
+throughput (uint64_t bytes, uint64_t cycles)
+{
+  return cycles > 0 ? bytes * 1000 / cycles : 0;
+}
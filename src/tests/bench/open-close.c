@@ -0,0 +1,27 @@
+/* Times opening and closing a file in the root directory. */
+
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define OPS 512
+
+void
+test_main (void)
+{
+  uint64_t start;
+  int i;
+
+  CHECK (create ("bench", 0), "create \"bench\"");
+
+  start = bench_cycles ();
+  for (i = 0; i < OPS; i++)
+    {
+      int fd = open ("bench");
+      if (fd < 2)
+        fail ("open \"bench\" failed");
+      close (fd);
+    }
+  BENCH_REPORT ("open-close", OPS, start);
+}
@@ -0,0 +1,40 @@
+/* Times page faults on a memory-mapped file, by reading one byte
+   from each of its pages. */
+
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define OPS 128
+
+static char buf[PAGE_SIZE];
+
+/* Receives the bytes read, so that the reads are not optimized
+   away. */
+static volatile char sink;
+
+void
+test_main (void)
+{
+  char *map = (char *) 0x10000000;
+  uint64_t start;
+  mapid_t mapid;
+  int fd, i;
+
+  CHECK (create ("bench", 0), "create \"bench\"");
+  CHECK ((fd = open ("bench")) > 1, "open \"bench\"");
+  for (i = 0; i < OPS; i++)
+    if (write (fd, buf, PAGE_SIZE) != PAGE_SIZE)
+      fail ("write %d failed", i);
+  CHECK ((mapid = mmap (fd, map)) != MAP_FAILED, "mmap \"bench\"");
+
+  start = bench_cycles ();
+  for (i = 0; i < OPS; i++)
+    sink = map[i * PAGE_SIZE];
+  BENCH_REPORT ("pf-file", OPS, start);
+
+  munmap (mapid);
+  close (fd);
+}
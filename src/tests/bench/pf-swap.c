@@ -0,0 +1,36 @@
+/* Times page faults that read pages back from swap.  Writes an
+   array larger than the user memory pool, which pushes most of
+   it out to swap, then touches each page again. */
+
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define OPS 768
+
+static char buf[OPS * PAGE_SIZE];
+
+/* Receives the bytes read, so that the reads are not optimized
+   away. */
+static volatile char sink;
+
+void
+test_main (void)
+{
+  uint64_t start;
+  int i, pass;
+
+  for (pass = 0; pass < 2; pass++)
+    for (i = 0; i < OPS; i++)
+      buf[i * PAGE_SIZE] = i;
+
+  start = bench_cycles ();
+  for (i = 0; i < OPS; i++)
+    sink = buf[i * PAGE_SIZE];
+  BENCH_REPORT ("pf-swap", OPS, start);
+
+  for (i = 0; i < OPS; i++)
+    if (buf[i * PAGE_SIZE] != (char) i)
+      fail ("page %d has wrong contents", i);
+}
@@ -0,0 +1,23 @@
+/* Times page faults on pages of zeros, by touching each page of
+   a large uninitialized array once. */
+
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define OPS 256
+
+static char buf[OPS * PAGE_SIZE];
+
+void
+test_main (void)
+{
+  uint64_t start;
+  int i;
+
+  start = bench_cycles ();
+  for (i = 0; i < OPS; i++)
+    buf[i * PAGE_SIZE] = 1;
+  BENCH_REPORT ("pf-zero", OPS, start);
+}
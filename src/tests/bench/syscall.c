@@ -0,0 +1,21 @@
+/* Times the round trip of a system call that does almost no
+   work. */
+
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define OPS 4096
+
+void
+test_main (void)
+{
+  uint64_t start;
+  int i;
+
+  start = bench_cycles ();
+  for (i = 0; i < OPS; i++)
+    isdir (-1);
+  BENCH_REPORT ("null-syscall", OPS, start);
+}
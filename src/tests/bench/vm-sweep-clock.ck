@@ -0,0 +1,4 @@
+# -*- perl -*-
+use tests::tests;
+use tests::bench::bench;
+check_bench (map { ("linear-$_", "random-$_") } 64, 128, 192, 256, 320, 384, 512);
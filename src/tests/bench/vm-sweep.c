@@ -0,0 +1,73 @@
+/* Sweeps the working set of a process across the size of the
+   user pool, which the Makefile fixes at 256 pages with -ul.
+   For each working set size, touches the pages of the set in
+   order and then in a random order for several passes, and
+   reports the cycles per touch along with the page faults and
+   swap writes the process's paging statistics record.
+
+   The same program runs once for each page replacement policy,
+   as vm-sweep-clock and vm-sweep-2hand, so that the policies can
+   be compared on identical workloads. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define MAX_PAGES 512
+#define PASS_CNT 4
+
+/* Working set sizes, in pages. */
+static const unsigned set_sizes[] = {64, 128, 192, 256, 320, 384, 512};
+
+static char buf[MAX_PAGES * PAGE_SIZE];
+static unsigned order[MAX_PAGES];
+
+static void sweep (const char *pattern, unsigned page_cnt);
+
+void
+test_main (void)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof set_sizes / sizeof *set_sizes; i++)
+    {
+      sweep ("linear", set_sizes[i]);
+      sweep ("random", set_sizes[i]);
+    }
+}
+
+/* Touches PAGE_CNT pages PASS_CNT times in PATTERN, which is
+   "linear" or "random", and reports the result. */
+static void
+sweep (const char *pattern, unsigned page_cnt)
+{
+  struct vmstat before, after;
+  char name[32];
+  uint64_t start;
+  unsigned i, pass;
+
+  for (i = 0; i < page_cnt; i++)
+    order[i] = i;
+  if (pattern[0] == 'r')
+    shuffle (order, page_cnt, sizeof *order);
+
+  if (!vmstat (0, &before))
+    fail ("vmstat failed");
+  start = bench_cycles ();
+  for (pass = 0; pass < PASS_CNT; pass++)
+    for (i = 0; i < page_cnt; i++)
+      buf[order[i] * PAGE_SIZE] += pass;
+  if (!vmstat (0, &after))
+    fail ("vmstat failed");
+
+  snprintf (name, sizeof name, "%s-%u", pattern, page_cnt);
+  msg (BENCH_FORMAT ", %u faults, %u swap-outs", name, page_cnt * PASS_CNT,
+       (unsigned long long) ((bench_cycles () - start)
+                             / (page_cnt * PASS_CNT)),
+       (after.minor_faults + after.major_faults)
+       - (before.minor_faults + before.major_faults),
+       after.swap_outs - before.swap_outs);
+}
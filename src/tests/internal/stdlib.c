@@ -1,4 +1,5 @@
-/* Test program for sorting and searching in lib/stdlib.c.
+/* Test program for sorting and searching in lib/stdlib.c and
+   lib/sort.h.
 
    Attempts to test the sorting and searching functionality that
    is not sufficiently tested elsewhere in Pintos.
@@ -11,6 +12,7 @@
 #include <debug.h>
 #include <limits.h>
 #include <random.h>
+#include <sort.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include "threads/test.h"
@@ -23,6 +25,10 @@ static int compare_ints (const void *, const void *);
 static void verify_order (const int[], size_t);
 static void verify_bsearch (const int[], size_t);
 
+/* Type-specialized sort for ints. */
+#define INT_LESS(A, B) ((A) < (B))
+SORT_DEFINE (sort_ints, int, INT_LESS)
+
 /* Test sorting and searching implementations. */
 void
 test (void) 
@@ -49,6 +55,11 @@ test (void)
           qsort (values, cnt, sizeof *values, compare_ints);
           verify_order (values, cnt);
           verify_bsearch (values, cnt);
+
+          /* Again with the type-specialized sort. */
+          shuffle (values, cnt);
+          sort_ints (values, cnt);
+          verify_order (values, cnt);
         }
     }
   
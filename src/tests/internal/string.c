@@ -0,0 +1,206 @@
+/* Test and micro-benchmark for the string and hash functions in
+   lib/string.c and lib/kernel/hash.c.
+
+   Checks the word-at-a-time strlen(), strchr(), strcmp() and the
+   block functions against simple byte-at-a-time versions on
+   random inputs, then reports how many CPU cycles each version
+   takes on average for a range of string lengths.  hash_bytes()
+   is timed against the Fowler-Noll-Vo hash it replaced.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <hash.h>
+#include <random.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/test.h"
+
+/* Longest string tested, and the buffers holding the strings,
+   with room for misalignment. */
+#define MAX_LEN 1024
+static char buf_a[MAX_LEN + 8], buf_b[MAX_LEN + 8];
+
+/* Times each function is run per measurement. */
+#define BENCH_REPEAT 256
+
+static size_t ref_strlen (const char *);
+static char *ref_strchr (const char *, int);
+static int ref_strcmp (const char *, const char *);
+static unsigned ref_hash_bytes (const void *, size_t);
+static void verify (void);
+static void bench (size_t len);
+static int sign (int);
+
+/* Reads the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Checks and times the string functions. */
+void
+test (void)
+{
+  size_t len;
+
+  verify ();
+
+  printf ("cycles per call (byte-at-a-time / word-at-a-time):\n");
+  for (len = 4; len <= MAX_LEN; len *= 4)
+    bench (len);
+  printf ("string: PASS\n");
+}
+
+/* Fills the first LEN bytes at P with random nonnull characters
+   from a small alphabet, so that strings often share prefixes,
+   and terminates it. */
+static void
+random_string (char *p, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    p[i] = 'a' + random_ulong () % 4;
+  p[len] = '\0';
+}
+
+/* Compares the library functions with the reference versions on
+   random strings at every alignment. */
+static void
+verify (void)
+{
+  int i;
+
+  printf ("verifying string functions:");
+  for (i = 0; i < 20000; i++)
+    {
+      size_t len = random_ulong () % 64;
+      char *a = buf_a + random_ulong () % 8;
+      char *b = buf_b + random_ulong () % 8;
+      int c = 'a' + random_ulong () % 5;
+
+      random_string (a, len);
+      if (random_ulong () % 2)
+        strlcpy (b, a, random_ulong () % (len + 1) + 1);
+      else
+        random_string (b, random_ulong () % 64);
+
+      ASSERT (strlen (a) == ref_strlen (a));
+      ASSERT (strchr (a, c) == ref_strchr (a, c));
+      ASSERT (strchr (a, '\0') == a + len);
+      ASSERT (sign (strcmp (a, b)) == sign (ref_strcmp (a, b)));
+      ASSERT (sign (memcmp (a, b, len + 1)) == sign (ref_strcmp (a, b)));
+
+      memcpy (b, a, len + 1);
+      memmove (a + 1, a, len + 1);
+      ASSERT (ref_strcmp (a + 1, b) == 0);
+      memmove (a, a + 1, len + 1);
+      ASSERT (ref_strcmp (a, b) == 0);
+      memset (a, c, len);
+      ASSERT (ref_strlen (a) == len);
+      ASSERT (ref_strchr (a, c) == (len > 0 ? a : NULL));
+    }
+  printf (" done\n");
+}
+
+/* Prints the cycles taken by each version of each function on
+   strings of LEN bytes. */
+static void
+bench (size_t len)
+{
+  volatile size_t sink = 0;
+  uint64_t start, t_ref, t_new;
+  char *a = buf_a, *b = buf_b;
+  int i;
+
+  random_string (a, len);
+  memcpy (b, a, len + 1);
+  printf ("  %4zu bytes:", len);
+
+#define BENCH(NAME, REF, NEW)                                   \
+  start = rdtsc ();                                             \
+  for (i = 0; i < BENCH_REPEAT; i++)                            \
+    sink += (size_t) (REF);                                     \
+  t_ref = rdtsc () - start;                                     \
+  start = rdtsc ();                                             \
+  for (i = 0; i < BENCH_REPEAT; i++)                            \
+    sink += (size_t) (NEW);                                     \
+  t_new = rdtsc () - start;                                     \
+  printf (" %s %llu/%llu", NAME, t_ref / BENCH_REPEAT,          \
+          t_new / BENCH_REPEAT)
+
+  BENCH ("strlen", ref_strlen (a), strlen (a));
+  BENCH ("strchr", ref_strchr (a, 'z'), strchr (a, 'z'));
+  BENCH ("strcmp", ref_strcmp (a, b), strcmp (a, b));
+  BENCH ("hash", ref_hash_bytes (a, len), hash_bytes (a, len));
+#undef BENCH
+  printf ("\n");
+}
+
+/* Byte-at-a-time strlen(). */
+static size_t
+ref_strlen (const char *s)
+{
+  const char *p;
+
+  for (p = s; *p != '\0'; p++)
+    continue;
+  return p - s;
+}
+
+/* Byte-at-a-time strchr(). */
+static char *
+ref_strchr (const char *s, int c_)
+{
+  char c = c_;
+
+  for (;;)
+    if (*s == c)
+      return (char *) s;
+    else if (*s == '\0')
+      return NULL;
+    else
+      s++;
+}
+
+/* Byte-at-a-time strcmp(). */
+static int
+ref_strcmp (const char *a_, const char *b_)
+{
+  const unsigned char *a = (const unsigned char *) a_;
+  const unsigned char *b = (const unsigned char *) b_;
+
+  while (*a != '\0' && *a == *b)
+    {
+      a++;
+      b++;
+    }
+  return *a < *b ? -1 : *a > *b;
+}
+
+/* Byte-at-a-time Fowler-Noll-Vo 32-bit hash. */
+static unsigned
+ref_hash_bytes (const void *buf_, size_t size)
+{
+  const unsigned char *buf = buf_;
+  unsigned hash = 2166136261u;
+
+  while (size-- > 0)
+    hash = (hash * 16777619u) ^ *buf++;
+  return hash;
+}
+
+/* Returns -1, 0, or 1 according to the sign of X. */
+static int
+sign (int x)
+{
+  return (x > 0) - (x < 0);
+}
@@ -0,0 +1,50 @@
+/* Times handing a lock back and forth between two kernel threads.
+   Each thread takes the lock, yields while holding it so that
+   the other thread blocks on it, then releases it and yields
+   again so that the other thread acquires it. */
+
+#include <stdio.h>
+#include "tests/bench/bench.h"
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define ROUND_CNT 512
+
+static struct lock lock;
+static struct semaphore done;
+
+static thread_func lock_thread;
+
+void
+test_bench_lock (void) 
+{
+  uint64_t start;
+
+  lock_init (&lock);
+  sema_init (&done, 0);
+
+  start = bench_cycles ();
+  thread_create ("locker", thread_get_priority (), lock_thread, NULL);
+  lock_thread (NULL);
+  sema_down (&done);
+  sema_down (&done);
+  BENCH_REPORT ("lock-handoff", 2 * ROUND_CNT, start);
+}
+
+/* Takes and releases the lock ROUND_CNT times, yielding in
+   between. */
+static void
+lock_thread (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ROUND_CNT; i++)
+    {
+      lock_acquire (&lock);
+      thread_yield ();
+      lock_release (&lock);
+      thread_yield ();
+    }
+  sema_up (&done);
+}
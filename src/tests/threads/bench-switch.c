@@ -0,0 +1,47 @@
+/* Times switching between two kernel threads, which pass control
+   back and forth through a pair of semaphores. */
+
+#include <stdio.h>
+#include "tests/bench/bench.h"
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define ROUND_CNT 1024
+
+static struct semaphore ping, pong;
+
+static thread_func pong_thread;
+
+void
+test_bench_switch (void) 
+{
+  uint64_t start;
+  int i;
+
+  sema_init (&ping, 0);
+  sema_init (&pong, 0);
+  thread_create ("pong", thread_get_priority (), pong_thread, NULL);
+
+  /* Each round switches to the other thread and back. */
+  start = bench_cycles ();
+  for (i = 0; i < ROUND_CNT; i++)
+    {
+      sema_up (&ping);
+      sema_down (&pong);
+    }
+  BENCH_REPORT ("context-switch", 2 * ROUND_CNT, start);
+}
+
+/* Answers each sema_up() of PING with one of PONG. */
+static void
+pong_thread (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ROUND_CNT; i++)
+    {
+      sema_down (&ping);
+      sema_up (&pong);
+    }
+}
@@ -0,0 +1,80 @@
+/* Queues work items behind one that keeps the only worker of a
+   work queue busy, and checks that they run in order of
+   priority, that one queued after a delay runs once it is over,
+   and that a cancelled one does not run at all. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/workqueue.h"
+#include "devices/timer.h"
+
+#define ITEM_CNT 6
+
+/* The queue lives as long as the kernel, as its thread does. */
+static struct workqueue wq;
+static struct work items[ITEM_CNT];
+static const char *names[ITEM_CNT] =
+  { "busy", "low 1", "high", "low 2", "delayed", "cancelled" };
+
+static struct semaphore busy_sema;      /* Lets the busy item end. */
+static struct semaphore done_sema;      /* Up once for each item run. */
+static int order[ITEM_CNT];             /* Items in the order run. */
+static int run_cnt;
+
+static work_func run_item;
+
+void
+test_workqueue (void)
+{
+  int i;
+
+  sema_init (&busy_sema, 0);
+  sema_init (&done_sema, 0);
+  workqueue_init (&wq, "test-wq", 1);
+
+  /* The items are below our priority, so that none of them runs
+     until we wait for them. */
+  work_init (&items[0], run_item, &items[0], PRI_DEFAULT - 1);
+  work_init (&items[1], run_item, &items[1], PRI_DEFAULT - 3);
+  work_init (&items[2], run_item, &items[2], PRI_DEFAULT - 2);
+  work_init (&items[3], run_item, &items[3], PRI_DEFAULT - 3);
+  work_init (&items[4], run_item, &items[4], PRI_DEFAULT - 2);
+  work_init (&items[5], run_item, &items[5], PRI_DEFAULT - 2);
+
+  msg ("Queueing items behind a busy worker.");
+  workqueue_queue (&wq, &items[0]);
+  thread_yield ();
+  for (i = 1; i <= 3; i++)
+    workqueue_queue (&wq, &items[i]);
+  if (workqueue_queue (&wq, &items[1]))
+    fail ("Queued an item that was already waiting.");
+  workqueue_queue_delayed (&wq, &items[4], 5);
+  workqueue_queue (&wq, &items[5]);
+  if (!workqueue_cancel (&items[5]))
+    fail ("Could not cancel a waiting item.");
+
+  msg ("Letting the busy item end.");
+  sema_up (&busy_sema);
+  for (i = 0; i < ITEM_CNT - 1; i++)
+    sema_down (&done_sema);
+
+  for (i = 0; i < run_cnt; i++)
+    msg ("Ran %s.", names[order[i]]);
+}
+
+/* Work function: records that item ITEM_ ran.  The first item
+   waits to be let go. */
+static void
+run_item (void *item_)
+{
+  struct work *item = item_;
+  int idx = item - items;
+
+  if (idx == 0)
+    sema_down (&busy_sema);
+  order[run_cnt++] = idx;
+  sema_up (&done_sema);
+}
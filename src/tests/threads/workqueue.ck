@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(workqueue) begin
+(workqueue) Queueing items behind a busy worker.
+(workqueue) Letting the busy item end.
+(workqueue) Ran busy.
+(workqueue) Ran high.
+(workqueue) Ran low 1.
+(workqueue) Ran low 2.
+(workqueue) Ran delayed.
+(workqueue) end
+EOF
+pass;
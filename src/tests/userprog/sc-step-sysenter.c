@@ -0,0 +1,43 @@
+/* Sets the trap flag and makes a system call with SYSENTER,
+   which does not clear the flag, so that the debug exception is
+   raised in the kernel, on its first instruction.  The kernel
+   must carry out the call and kill the process only once it is
+   back in user mode, where it traps again, instead of
+   panicking. */
+
+#include <string.h>
+#include <syscall-nr.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* CPUID leaf 1 EDX bit for SYSENTER and SYSEXIT. */
+#define CPUID_SEP 0x00000800
+
+void
+test_main (void) 
+{
+  static const char message[] = "(sc-step-sysenter) stepped in\n";
+  uint32_t eax, ebx, ecx, edx;
+
+  asm volatile ("cpuid"
+                : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                : "a" (1));
+  if (!(edx & CPUID_SEP))
+    {
+      /* Without SYSENTER there is nothing to step into. */
+      msg ("stepped in");
+      exit (-1);
+    }
+
+  /* POPF sets the trap flag, so the debug exception follows the
+     instruction after it, SYSENTER. */
+  asm volatile ("pushl %[size]; pushl %[buf]; pushl $1; pushl %[nr]; "
+                "movl %%esp, %%ecx; movl $1f, %%edx; "
+                "pushfl; orl $0x100, (%%esp); popfl; "
+                "sysenter; "
+                "1: addl $16, %%esp"
+                : : [nr] "i" (SYS_WRITE), [buf] "r" (message),
+                    [size] "r" (strlen (message))
+                : "eax", "ecx", "edx", "memory");
+  fail ("should have died stepping after the system call");
+}
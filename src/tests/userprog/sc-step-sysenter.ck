@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+# The process dies of the debug exception back in user mode,
+# which is reported with a register dump.
+@output = grep (!/: dying due to interrupt 0x01 \(.*\).$/
+		&& !/^Interrupt 0x01 \(.*\) at eip=/
+		&& !/^ cr2=.* error=.*/
+		&& !/^ eax=.* ebx=.* ecx=.* edx=.*/
+		&& !/^ esi=.* edi=.* esp=.* ebp=.*/
+		&& !/^ cs=.* ds=.* es=.* ss=.*/, @output);
+compare_output ("run", \@output, [<<'EOF']);
+(sc-step-sysenter) begin
+(sc-step-sysenter) stepped in
+sc-step-sysenter: exit(-1)
+EOF
+pass;
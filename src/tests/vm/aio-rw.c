@@ -0,0 +1,93 @@
+/* Writes a file with several asynchronous requests at once, then
+   reads it back the same way, closing the descriptor before the
+   reads are reaped, and checks the data.  A request on a bad
+   descriptor is refused. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHUNKS 4
+#define CHUNK_SIZE 4096
+
+static char buf[CHUNKS][CHUNK_SIZE];
+
+/* Submits CHUNKS requests of OP on FD, one for each chunk of BUF,
+   and returns the number submitted. */
+static int
+submit (int fd, int op)
+{
+  struct aio_request reqs[CHUNKS];
+  int i;
+
+  for (i = 0; i < CHUNKS; i++)
+    {
+      reqs[i].fd = fd;
+      reqs[i].op = op;
+      reqs[i].buffer = buf[i];
+      reqs[i].size = CHUNK_SIZE;
+      reqs[i].ofs = i * CHUNK_SIZE;
+      reqs[i].id = i;
+    }
+  return aio_submit (reqs, CHUNKS);
+}
+
+/* Reaps all CHUNKS requests and returns true if each moved a
+   whole chunk. */
+static bool
+reap (void)
+{
+  struct aio_event events[CHUNKS];
+  int seen = 0;
+  int cnt = 0;
+
+  while (cnt < CHUNKS)
+    {
+      int n = aio_getevents (events, 1, CHUNKS);
+      int i;
+
+      if (n <= 0)
+        return false;
+      for (i = 0; i < n; i++)
+        {
+          if (events[i].result != CHUNK_SIZE || events[i].id < 0
+              || events[i].id >= CHUNKS || seen & (1 << events[i].id))
+            return false;
+          seen |= 1 << events[i].id;
+        }
+      cnt += n;
+    }
+  return true;
+}
+
+void
+test_main (void)
+{
+  struct aio_request bad;
+  int fd, i;
+
+  CHECK (create ("data", CHUNKS * CHUNK_SIZE), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  for (i = 0; i < CHUNKS; i++)
+    memset (buf[i], 'a' + i, CHUNK_SIZE);
+  CHECK (submit (fd, AIO_WRITE) == CHUNKS, "submit writes");
+  CHECK (reap (), "reap writes");
+
+  memset (buf, 0, sizeof buf);
+  CHECK (submit (fd, AIO_READ) == CHUNKS, "submit reads");
+  close (fd);
+  CHECK (reap (), "reap reads");
+  for (i = 0; i < CHUNKS; i++)
+    if (buf[i][0] != 'a' + i || buf[i][CHUNK_SIZE - 1] != 'a' + i)
+      fail ("chunk %d has wrong data", i);
+
+  bad.fd = fd;
+  bad.op = AIO_READ;
+  bad.buffer = buf[0];
+  bad.size = 1;
+  bad.ofs = 0;
+  bad.id = 0;
+  CHECK (aio_submit (&bad, 1) == -1, "closed descriptor is refused");
+  CHECK (aio_getevents (NULL, 1, 0) == 0, "nothing left to reap");
+}
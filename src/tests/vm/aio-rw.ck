@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(aio-rw) begin
+(aio-rw) create "data"
+(aio-rw) open "data"
+(aio-rw) submit writes
+(aio-rw) reap writes
+(aio-rw) submit reads
+(aio-rw) reap reads
+(aio-rw) closed descriptor is refused
+(aio-rw) nothing left to reap
+(aio-rw) end
+EOF
+pass;
@@ -0,0 +1,86 @@
+/* Opens a file with O_APPEND and appends records to it from a
+   forked child and its parent at once, through the descriptor
+   the child inherits, then checks that the file holds every
+   record of both, each intact, and that a write through another
+   appending descriptor also goes to end of file. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Bytes per record, odd so that records straddle sectors. */
+#define RECORD_SIZE 37
+
+/* Records appended by each process. */
+#define RECORD_CNT 40
+
+#define FILE_SIZE (2 * RECORD_CNT * RECORD_SIZE)
+
+static char buf[FILE_SIZE + RECORD_SIZE];
+
+/* Appends RECORD_CNT records of C to FD. */
+static void
+append_records (int fd, char c)
+{
+  char record[RECORD_SIZE];
+  int i;
+
+  memset (record, c, sizeof record);
+  for (i = 0; i < RECORD_CNT; i++)
+    if (write (fd, record, sizeof record) != sizeof record)
+      fail ("append %d of '%c' failed", i, c);
+}
+
+void
+test_main (void)
+{
+  int parent_cnt = 0, child_cnt = 0;
+  pid_t child;
+  int fd, fd2, i;
+
+  CHECK (create ("log", 0), "create \"log\"");
+  CHECK ((fd = open_flags ("log", O_APPEND)) > 1,
+         "open \"log\" for appending");
+  CHECK ((child = fork ()) != PID_ERROR, "fork");
+  if (child == 0)
+    {
+      append_records (fd, 'c');
+      exit (0);
+    }
+  append_records (fd, 'p');
+  CHECK (wait (child) == 0, "wait for child");
+  CHECK (filesize (fd) == FILE_SIZE, "file is %d bytes", FILE_SIZE);
+
+  seek (fd, 0);
+  CHECK (read (fd, buf, FILE_SIZE) == FILE_SIZE, "read it back");
+  for (i = 0; i < FILE_SIZE; i += RECORD_SIZE)
+    {
+      char c = buf[i];
+      int j;
+
+      for (j = 1; j < RECORD_SIZE; j++)
+        if (buf[i + j] != c)
+          fail ("record at %d is torn", i);
+      if (c == 'p')
+        parent_cnt++;
+      else if (c == 'c')
+        child_cnt++;
+      else
+        fail ("record at %d is %d", i, c);
+    }
+  CHECK (parent_cnt == RECORD_CNT && child_cnt == RECORD_CNT,
+         "every record is there");
+
+  CHECK ((fd2 = open_flags ("log", O_APPEND)) > 1,
+         "open \"log\" for appending again");
+  seek (fd2, 0);
+  memset (buf, 'x', RECORD_SIZE);
+  CHECK (write (fd2, buf, RECORD_SIZE) == RECORD_SIZE, "append after seek");
+  CHECK (filesize (fd2) == FILE_SIZE + RECORD_SIZE
+         && tell (fd2) == FILE_SIZE + RECORD_SIZE,
+         "write went to end of file");
+  CHECK (pread (fd, buf, RECORD_SIZE, 0) == RECORD_SIZE && buf[0] != 'x',
+         "start of file is intact");
+  CHECK (open_flags ("log", 2) == -1, "unknown flag is refused");
+}
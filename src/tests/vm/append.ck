@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(append) begin
+(append) create "log"
+(append) open "log" for appending
+(append) fork
+(append) wait for child
+(append) file is 2960 bytes
+(append) read it back
+(append) every record is there
+(append) open "log" for appending again
+(append) append after seek
+(append) write went to end of file
+(append) start of file is intact
+(append) unknown flag is refused
+(append) end
+EOF
+pass;
@@ -0,0 +1,28 @@
+/* Child process for pipe-exec test.
+   Writes SIZE bytes of a pattern to the pipe end it inherited
+   from its parent, whose descriptor is its first argument, more
+   than the pipe holds, so that it must wait for the parent to
+   read. */
+
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/vm/pipe.inc"
+#include "tests/lib.h"
+
+const char *test_name = "child-pipe";
+
+int
+main (int argc, char *argv[])
+{
+  static char buf[SIZE];
+  int fd, i;
+
+  if (argc != 2)
+    fail ("bad command-line arguments");
+  fd = atoi (argv[1]);
+  for (i = 0; i < SIZE; i++)
+    buf[i] = PATTERN (i);
+  if (write (fd, buf, SIZE) != SIZE)
+    fail ("write to inherited pipe failed");
+  return 81;
+}
@@ -0,0 +1,33 @@
+/* Child process for page-prefetch test.
+   Reads each page of its initialized data, which is loaded from
+   the executable, and exits with the number of page faults that
+   took. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+
+#define DATA_PAGES 16
+#define PAGE_SIZE 4096
+
+const char *test_name = "child-prefetch";
+
+static volatile char data[DATA_PAGES * PAGE_SIZE] = { 1 };
+
+int
+main (void)
+{
+  struct vmstat before, after;
+  int sum = 0;
+  int i;
+
+  if (!vmstat (0, &before))
+    fail ("vmstat failed");
+  for (i = 0; i < DATA_PAGES; i++)
+    sum += data[i * PAGE_SIZE];
+  if (!vmstat (0, &after))
+    fail ("vmstat failed");
+  if (sum != 1)
+    fail ("data sums to %d instead of 1", sum);
+  return ((after.minor_faults + after.major_faults)
+          - (before.minor_faults + before.major_faults));
+}
@@ -0,0 +1,27 @@
+/* Child process for page-shm test.
+   Maps the segment its parent created, at another address than
+   the parent's, checks the pattern the parent wrote, and writes
+   its complement. */
+
+#include <syscall.h>
+#include "tests/vm/shm.inc"
+#include "tests/lib.h"
+
+#define ADDR ((char *) 0x20000000)
+
+const char *test_name = "child-shm";
+
+int
+main (void)
+{
+  int i;
+
+  if (!shm_map (NAME, SIZE, ADDR))
+    fail ("map \"%s\" failed", NAME);
+  for (i = 0; i < SIZE; i++)
+    if (ADDR[i] != PATTERN (i))
+      fail ("byte %d is %#x instead of %#x", i, ADDR[i], PATTERN (i));
+  for (i = 0; i < SIZE; i++)
+    ADDR[i] = ~PATTERN (i);
+  return 81;
+}
@@ -0,0 +1,28 @@
+/* Child process for pipe-spawn test.
+   Copies its standard input to its standard output in upper
+   case until end of file. */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+const char *test_name = "child-upper";
+
+int
+main (void)
+{
+  char buf[64];
+  int n, i;
+
+  while ((n = read (STDIN_FILENO, buf, sizeof buf)) > 0)
+    {
+      for (i = 0; i < n; i++)
+        buf[i] = toupper ((unsigned char) buf[i]);
+      if (write (STDOUT_FILENO, buf, n) != n)
+        fail ("write to standard output failed");
+    }
+  if (n < 0)
+    fail ("read from standard input failed");
+  return 82;
+}
@@ -0,0 +1,58 @@
+/* Reserves space for a file with fallocate(), which grows it
+   with zeros, writes into the space, then punches a hole that
+   covers whole sectors and parts of two more, and checks that
+   the hole reads as zeros, the rest is intact and the hole can
+   be written again. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 8192
+
+static char buf[FILE_SIZE];
+
+/* Fails unless bytes OFS up to END of BUF are all C. */
+static void
+check_range (int ofs, int end, char c)
+{
+  int i;
+
+  for (i = ofs; i < end; i++)
+    if (buf[i] != c)
+      fail ("byte %d is %d, not %d", i, buf[i], c);
+}
+
+void
+test_main (void)
+{
+  int fd;
+
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  CHECK (fallocate (fd, 0, 0, FILE_SIZE), "allocate %d bytes", FILE_SIZE);
+  CHECK (filesize (fd) == FILE_SIZE, "file is %d bytes", FILE_SIZE);
+  memset (buf, 'x', sizeof buf);
+  CHECK (read (fd, buf, FILE_SIZE) == FILE_SIZE, "read it");
+  check_range (0, FILE_SIZE, 0);
+
+  memset (buf, 'a', sizeof buf);
+  CHECK (pwrite (fd, buf, FILE_SIZE, 0) == FILE_SIZE, "fill it");
+  CHECK (fallocate (fd, FALLOC_PUNCH_HOLE, 1000, 3000), "punch a hole");
+  CHECK (pread (fd, buf, FILE_SIZE, 0) == FILE_SIZE, "read it back");
+  check_range (0, 1000, 'a');
+  check_range (1000, 4000, 0);
+  check_range (4000, FILE_SIZE, 'a');
+  CHECK (filesize (fd) == FILE_SIZE, "size is unchanged");
+
+  memset (buf, 'b', sizeof buf);
+  CHECK (pwrite (fd, buf, 3000, 1000) == 3000, "write into the hole");
+  CHECK (pread (fd, buf, FILE_SIZE, 0) == FILE_SIZE, "read it again");
+  check_range (0, 1000, 'a');
+  check_range (1000, 4000, 'b');
+  check_range (4000, FILE_SIZE, 'a');
+
+  CHECK (!fallocate (fd, 2, 0, 1), "unknown mode is refused");
+  close (fd);
+}
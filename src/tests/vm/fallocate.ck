@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fallocate) begin
+(fallocate) create "data"
+(fallocate) open "data"
+(fallocate) allocate 8192 bytes
+(fallocate) file is 8192 bytes
+(fallocate) read it
+(fallocate) fill it
+(fallocate) punch a hole
+(fallocate) read it back
+(fallocate) size is unchanged
+(fallocate) write into the hole
+(fallocate) read it again
+(fallocate) unknown mode is refused
+(fallocate) end
+EOF
+pass;
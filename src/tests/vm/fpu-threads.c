@@ -0,0 +1,55 @@
+/* Runs three threads of a process at once, each of which keeps a
+   running sum in the x87 register stack for long enough to be
+   preempted several times, adding a step of its own on each
+   iteration.  Each sum comes out exact only if every thread's
+   FPU registers survive switches to the others. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 3
+#define ITERATIONS 4000000
+
+/* Returns the sum of ITERATIONS times STEP, accumulated in the
+   FPU.  User programs are built without floating point, so this
+   is done in assembly. */
+static int
+fpu_sum (int step)
+{
+  int n = ITERATIONS;
+  int sum;
+
+  asm volatile ("fldz\n"
+                "1: fiaddl %2\n"
+                "decl %1\n"
+                "jnz 1b\n"
+                "fistpl %0"
+                : "=m" (sum), "+r" (n)
+                : "m" (step));
+  return sum;
+}
+
+/* Returns true if the sum for step AUX is right. */
+static int
+summer (void *aux)
+{
+  int step = (int) aux;
+
+  return fpu_sum (step) == step * ITERATIONS;
+}
+
+void
+test_main (void)
+{
+  tid_t tids[THREAD_CNT];
+  int i, ok;
+
+  for (i = 0; i < THREAD_CNT; i++)
+    CHECK ((tids[i] = thread_create (summer, (void *) (i + 1)))
+           != TID_ERROR, "start thread %d", i);
+  ok = summer ((void *) 4);
+  for (i = 0; i < THREAD_CNT; i++)
+    CHECK (thread_join (tids[i]) == 1, "thread %d's sum is exact", i);
+  CHECK (ok, "main thread's sum is exact");
+}
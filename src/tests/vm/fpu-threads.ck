@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fpu-threads) begin
+(fpu-threads) start thread 0
+(fpu-threads) start thread 1
+(fpu-threads) start thread 2
+(fpu-threads) thread 0's sum is exact
+(fpu-threads) thread 1's sum is exact
+(fpu-threads) thread 2's sum is exact
+(fpu-threads) main thread's sum is exact
+(fpu-threads) end
+EOF
+pass;
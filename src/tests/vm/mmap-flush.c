@@ -0,0 +1,74 @@
+/* Writes to a file through a mapping and, without unmapping it,
+   waits for the write-back thread to write the pages to the
+   file, then reads the data back using the read system call to
+   verify.  A write after that counts its page as dirty again. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 4
+#define ACTUAL ((char *) 0x10000000)
+
+/* Longest wait for the write-back, in timer ticks. */
+#define WAIT_TICKS 1000
+
+/* Returns the number of dirty mapped pages of the process. */
+static unsigned
+dirty_pages (void)
+{
+  struct vmstat s;
+
+  if (!vmstat (0, &s))
+    fail ("vmstat failed");
+  return s.dirty;
+}
+
+void
+test_main (void)
+{
+  static char buf[PAGE_SIZE];
+  struct kstat k;
+  long long start;
+  int map_handle, handle;
+  mapid_t map;
+  size_t i, j;
+
+  CHECK (create ("flush", PAGE_CNT * PAGE_SIZE), "create \"flush\"");
+  CHECK ((map_handle = open ("flush")) > 1, "open \"flush\"");
+  CHECK ((map = mmap (map_handle, ACTUAL)) != MAP_FAILED, "mmap \"flush\"");
+  memset (ACTUAL, 'x', PAGE_CNT * PAGE_SIZE);
+  if (dirty_pages () != PAGE_CNT)
+    fail ("%u dirty pages, expected %d", dirty_pages (), PAGE_CNT);
+
+  msg ("wait for write-back");
+  kstat (&k);
+  start = k.sched.ticks;
+  while (dirty_pages () > 0)
+    {
+      kstat (&k);
+      if (k.sched.ticks - start > WAIT_TICKS)
+        fail ("pages not written back after %d ticks", WAIT_TICKS);
+    }
+
+  CHECK ((handle = open ("flush")) > 1, "open \"flush\" again");
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      if (read (handle, buf, PAGE_SIZE) != PAGE_SIZE)
+        fail ("read of page %zu failed", i);
+      for (j = 0; j < PAGE_SIZE; j++)
+        if (buf[j] != 'x')
+          fail ("byte %zu of page %zu is %d", j, i, buf[j]);
+    }
+  msg ("file holds the written data");
+  close (handle);
+
+  ACTUAL[0] = 'y';
+  if (dirty_pages () != 1)
+    fail ("%u dirty pages after rewrite, expected 1", dirty_pages ());
+  munmap (map);
+  if (dirty_pages () != 0)
+    fail ("%u dirty pages after munmap", dirty_pages ());
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-flush) begin
+(mmap-flush) create "flush"
+(mmap-flush) open "flush"
+(mmap-flush) mmap "flush"
+(mmap-flush) wait for write-back
+(mmap-flush) open "flush" again
+(mmap-flush) file holds the written data
+(mmap-flush) end
+EOF
+pass;
@@ -0,0 +1,43 @@
+/* Forks a child that overwrites a large array inherited from its
+   parent, and verifies that each process keeps seeing its own
+   data afterward, as copy-on-write requires. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (256 * 1024)
+
+static char buf[SIZE];
+
+/* Fails unless every byte of BUF is VALUE. */
+static void
+check (char value)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != value)
+      fail ("byte %zu is %#x instead of %#x", i, buf[i], value);
+}
+
+void
+test_main (void)
+{
+  pid_t child;
+
+  memset (buf, 0x5a, sizeof buf);
+  CHECK ((child = fork ()) != PID_ERROR, "fork");
+  if (child == 0)
+    {
+      check (0x5a);
+      memset (buf, 0xa5, sizeof buf);
+      check (0xa5);
+      exit (81);
+    }
+  CHECK (wait (child) == 81, "wait for child");
+
+  msg ("check parent's data");
+  check (0x5a);
+}
@@ -0,0 +1,101 @@
+/* Builds a lock out of a futex and has threads take it to add to
+   a shared counter, checking that none of the additions is lost,
+   then waits on a futex for a flag that another thread sets.
+   Waiting on a word that no longer holds the expected value
+   returns at once. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 4
+#define ADD_CNT 2000
+
+/* A lock word: 0 if free, 1 if held, 2 if held with waiters. */
+static int lock_word;
+static int counter;
+static int flag;
+
+static void
+acquire (void)
+{
+  int c = __sync_val_compare_and_swap (&lock_word, 0, 1);
+
+  if (c == 0)
+    return;
+  if (c != 2)
+    c = __sync_lock_test_and_set (&lock_word, 2);
+  while (c != 0)
+    {
+      futex_wait (&lock_word, 2);
+      c = __sync_lock_test_and_set (&lock_word, 2);
+    }
+}
+
+static void
+release (void)
+{
+  if (__sync_fetch_and_sub (&lock_word, 1) != 1)
+    {
+      lock_word = 0;
+      futex_wake (&lock_word, 1);
+    }
+}
+
+/* Adds to COUNTER under the lock, ADD_CNT times. */
+static int
+add (void *aux UNUSED)
+{
+  int i;
+
+  for (i = 0; i < ADD_CNT; i++)
+    {
+      volatile int delay;
+      int old;
+
+      /* Widen the window in which a timer interrupt finds the
+         lock held. */
+      acquire ();
+      old = counter;
+      for (delay = 0; delay < 100; delay++)
+        continue;
+      counter = old + 1;
+      release ();
+    }
+  return 0;
+}
+
+/* Sets FLAG and wakes its waiter. */
+static int
+set_flag (void *aux UNUSED)
+{
+  flag = 1;
+  futex_wake (&flag, 1);
+  return 0;
+}
+
+void
+test_main (void)
+{
+  tid_t tids[THREAD_CNT];
+  tid_t setter;
+  int i;
+
+  CHECK (futex_wait (&flag, 1) == -1, "wait on changed word returns");
+
+  for (i = 0; i < THREAD_CNT; i++)
+    if ((tids[i] = thread_create (add, NULL)) == TID_ERROR)
+      fail ("thread_create #%d failed", i);
+  for (i = 0; i < THREAD_CNT; i++)
+    thread_join (tids[i]);
+  if (counter != THREAD_CNT * ADD_CNT)
+    fail ("counter is %d instead of %d", counter, THREAD_CNT * ADD_CNT);
+  msg ("counter is %d", counter);
+
+  CHECK ((setter = thread_create (set_flag, NULL)) != TID_ERROR,
+         "start setter");
+  while (flag == 0)
+    futex_wait (&flag, 0);
+  msg ("flag set");
+  thread_join (setter);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-futex) begin
+(page-futex) wait on changed word returns
+(page-futex) counter is 8000
+(page-futex) start setter
+(page-futex) flag set
+(page-futex) end
+EOF
+pass;
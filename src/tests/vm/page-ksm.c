@@ -0,0 +1,51 @@
+/* Fills pages with the same data, waits for the page merger to
+   free the frames holding the duplicates, then writes a word of
+   each page and checks that the pages split apart again with
+   the right contents. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 32
+#define WORD_CNT (PAGE_SIZE / sizeof (unsigned))
+
+static unsigned buf[PAGE_CNT][WORD_CNT];
+
+void
+test_main (void)
+{
+  struct kstat before, k;
+  int interval = 1, old_interval;
+  size_t p, i;
+
+  for (p = 0; p < PAGE_CNT; p++)
+    for (i = 0; i < WORD_CNT; i++)
+      buf[p][i] = i * 7 + 1;
+
+  CHECK (sysctl ("vm.merge_interval", &old_interval, &interval),
+         "merge every tick");
+  msg ("wait for merging");
+  kstat (&before);
+  do
+    {
+      kstat (&k);
+      if (k.sched.ticks > before.sched.ticks + 1000)
+        fail ("only %lld frames merged in 1000 ticks",
+              k.mem.merged - before.mem.merged);
+    }
+  while (k.mem.merged < before.mem.merged + PAGE_CNT / 2);
+
+  msg ("write each page");
+  for (p = 0; p < PAGE_CNT; p++)
+    buf[p][p] = 0;
+  for (p = 0; p < PAGE_CNT; p++)
+    for (i = 0; i < WORD_CNT; i++)
+      if (buf[p][i] != (i == p ? 0 : i * 7 + 1))
+        fail ("page %zu word %zu is %u", p, i, buf[p][i]);
+  msg ("pages read back intact");
+
+  CHECK (sysctl ("vm.merge_interval", NULL, &old_interval),
+         "restore merge interval");
+}
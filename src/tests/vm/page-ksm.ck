@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-ksm) begin
+(page-ksm) merge every tick
+(page-ksm) wait for merging
+(page-ksm) write each page
+(page-ksm) pages read back intact
+(page-ksm) restore merge interval
+(page-ksm) end
+EOF
+pass;
@@ -0,0 +1,52 @@
+/* Touches every page of a large array and checks that the
+   kernel-wide statistics account for the faults and the user
+   memory, and are otherwise consistent. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_CNT 64
+#define PAGE_SIZE 4096
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+void
+test_main (void)
+{
+  struct kstat before, after;
+  size_t i;
+
+  msg ("get statistics");
+  kstat (&before);
+  for (i = 0; i < PAGE_CNT; i++)
+    buf[i * PAGE_SIZE] = i;
+  msg ("get statistics again");
+  kstat (&after);
+
+  if (after.sched.ticks < before.sched.ticks)
+    fail ("timer ticks went from %lld back to %lld",
+          before.sched.ticks, after.sched.ticks);
+  if (after.sched.thread_cnt < after.sched.ready_cnt + 1)
+    fail ("%u threads but %u ready besides this one",
+          after.sched.thread_cnt, after.sched.ready_cnt);
+  if (after.mem.page_faults < before.mem.page_faults + PAGE_CNT)
+    fail ("only %lld page faults counted for %d pages",
+          after.mem.page_faults - before.mem.page_faults, PAGE_CNT);
+  if (after.mem.user_used < PAGE_CNT
+      || after.mem.user_used > after.mem.user_pages)
+    fail ("%u of %u user pages in use", after.mem.user_used,
+          after.mem.user_pages);
+  if (after.mem.kernel_used > after.mem.kernel_pages)
+    fail ("%u of %u kernel pages in use", after.mem.kernel_used,
+          after.mem.kernel_pages);
+  if (after.mem.heap_bytes == 0)
+    fail ("no kernel heap in use");
+  if (after.mem.swap_used > after.mem.swap_slots)
+    fail ("%u of %u swap slots in use", after.mem.swap_used,
+          after.mem.swap_slots);
+  /* Block device role 1 is the file system device. */
+  if (after.block[1].name[0] == '\0' || after.block[1].read_cnt == 0)
+    fail ("no reads counted from the file system device");
+  msg ("statistics are consistent");
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-kstat) begin
+(page-kstat) get statistics
+(page-kstat) get statistics again
+(page-kstat) statistics are consistent
+(page-kstat) end
+EOF
+pass;
@@ -0,0 +1,85 @@
+/* Gives madvise() each kind of hint and checks that the
+   contents of the pages are what the hints promise: unchanged
+   by SEQUENTIAL, RANDOM and WILLNEED, and discarded by DONTNEED,
+   which also takes the pages out of memory. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_CNT 32
+#define PAGE_SIZE 4096
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+/* Writes a pattern to every page of BUF. */
+static void
+fill (void)
+{
+  size_t i;
+
+  for (i = 0; i < PAGE_CNT; i++)
+    memset (buf + i * PAGE_SIZE, i + 1, PAGE_SIZE);
+}
+
+/* Fails unless every page of BUF holds the pattern written by
+   fill(). */
+static void
+check_fill (const char *hint)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != (char) (i / PAGE_SIZE + 1))
+      fail ("byte %zu is %d after %s", i, buf[i], hint);
+}
+
+void
+test_main (void)
+{
+  char *actual = (char *) 0x10000000;
+  struct vmstat before, after;
+  int handle;
+  mapid_t map;
+  size_t i;
+
+  fill ();
+  CHECK (madvise (buf, sizeof buf, MADV_SEQUENTIAL), "madvise SEQUENTIAL");
+  check_fill ("MADV_SEQUENTIAL");
+  CHECK (madvise (buf, sizeof buf, MADV_RANDOM), "madvise RANDOM");
+  check_fill ("MADV_RANDOM");
+  CHECK (madvise (buf, sizeof buf, MADV_NORMAL), "madvise NORMAL");
+
+  CHECK (vmstat (0, &before), "get statistics");
+  CHECK (madvise (buf, sizeof buf, MADV_DONTNEED), "madvise DONTNEED");
+  CHECK (vmstat (0, &after), "get statistics again");
+  if (after.resident + PAGE_CNT > before.resident)
+    fail ("resident set went only from %u to %u pages",
+          before.resident, after.resident);
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != 0)
+      fail ("byte %zu is %d after MADV_DONTNEED", i, buf[i]);
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, actual)) != MAP_FAILED, "mmap \"sample.txt\"");
+  CHECK (madvise (actual, strlen (sample), MADV_WILLNEED),
+         "madvise WILLNEED");
+  if (memcmp (actual, sample, strlen (sample)))
+    fail ("read of mmap'd file reported bad data");
+  memset (actual, '@', 16);
+  CHECK (madvise (actual, PAGE_SIZE, MADV_DONTNEED), "madvise DONTNEED");
+  if (memcmp (actual, "@@@@@@@@@@@@@@@@", 16)
+      || memcmp (actual + 16, sample + 16, strlen (sample) - 16))
+    fail ("mmap'd file lost its modified data");
+  munmap (map);
+  close (handle);
+
+  if (madvise (buf + 1, PAGE_SIZE, MADV_NORMAL))
+    fail ("madvise of misaligned address succeeded");
+  if (madvise (buf, PAGE_SIZE, 99))
+    fail ("madvise with bad advice succeeded");
+  if (madvise (actual, PAGE_SIZE, MADV_NORMAL))
+    fail ("madvise of unmapped pages succeeded");
+}
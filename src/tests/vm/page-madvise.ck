@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-madvise) begin
+(page-madvise) madvise SEQUENTIAL
+(page-madvise) madvise RANDOM
+(page-madvise) madvise NORMAL
+(page-madvise) get statistics
+(page-madvise) madvise DONTNEED
+(page-madvise) get statistics again
+(page-madvise) open "sample.txt"
+(page-madvise) mmap "sample.txt"
+(page-madvise) madvise WILLNEED
+(page-madvise) madvise DONTNEED
+(page-madvise) end
+EOF
+pass;
@@ -0,0 +1,83 @@
+/* Allocates many small blocks and a few big ones with the user
+   heap allocator and checks that none overwrites another.  Then
+   frees them and checks that the heap shrinks back once the big
+   blocks are gone. */
+
+#include <malloc.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SMALL_CNT 2048
+#define BIG_CNT 4
+#define BIG_SIZE (64 * 1024)
+
+static char *small[SMALL_CNT];
+static char *big[BIG_CNT];
+
+/* Returns the size of small block I. */
+static size_t
+small_size (size_t i)
+{
+  return 1 + i % 200;
+}
+
+/* Fails unless the SIZE bytes at P are all VALUE. */
+static void
+check_block (const char *p, size_t size, char value, const char *what)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (p[i] != value)
+      fail ("%s overwritten at byte %zu", what, i);
+}
+
+void
+test_main (void)
+{
+  void *small_end;
+  size_t i;
+
+  msg ("allocate small blocks");
+  for (i = 0; i < SMALL_CNT; i++)
+    {
+      small[i] = malloc (small_size (i));
+      if (small[i] == NULL)
+        fail ("malloc (%zu) failed", small_size (i));
+      memset (small[i], i, small_size (i));
+    }
+  small_end = sbrk (0);
+
+  msg ("allocate big blocks");
+  for (i = 0; i < BIG_CNT; i++)
+    {
+      big[i] = malloc (BIG_SIZE);
+      if (big[i] == NULL)
+        fail ("malloc (%d) failed", BIG_SIZE);
+      memset (big[i], 0x80 + i, BIG_SIZE);
+    }
+
+  msg ("grow a big block with realloc");
+  big[0] = realloc (big[0], 2 * BIG_SIZE);
+  if (big[0] == NULL)
+    fail ("realloc failed");
+
+  msg ("check and free small blocks");
+  for (i = 0; i < SMALL_CNT; i++)
+    {
+      check_block (small[i], small_size (i), i, "small block");
+      free (small[i]);
+    }
+
+  msg ("check and free big blocks");
+  for (i = 0; i < BIG_CNT; i++)
+    {
+      check_block (big[i], BIG_SIZE, 0x80 + i, "big block");
+      free (big[i]);
+    }
+
+  CHECK (sbrk (0) == small_end, "heap shrank to the small blocks");
+  CHECK (sbrk (-0x10000000) == (void *) -1, "shrink past the heap start");
+}
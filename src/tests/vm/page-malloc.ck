@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-malloc) begin
+(page-malloc) allocate small blocks
+(page-malloc) allocate big blocks
+(page-malloc) grow a big block with realloc
+(page-malloc) check and free small blocks
+(page-malloc) check and free big blocks
+(page-malloc) heap shrank to the small blocks
+(page-malloc) shrink past the heap start
+(page-malloc) end
+EOF
+pass;
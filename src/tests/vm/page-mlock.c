@@ -0,0 +1,55 @@
+/* Locks pages in memory with mlock() and checks the accounting,
+   the per-process limit, and that munlock() undoes it. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define LOCK_CNT 16
+#define BIG_CNT 128
+
+static char buf[LOCK_CNT * PAGE_SIZE];
+static char big[BIG_CNT * PAGE_SIZE];
+
+/* Fails unless the process has CNT pages locked. */
+static void
+check_locked (unsigned cnt)
+{
+  struct vmstat s;
+
+  if (!vmstat (0, &s))
+    fail ("vmstat failed");
+  if (s.locked != cnt)
+    fail ("%u pages locked, expected %u", s.locked, cnt);
+  if (s.resident < cnt)
+    fail ("only %u pages resident with %u locked", s.resident, cnt);
+}
+
+void
+test_main (void)
+{
+  size_t i;
+
+  memset (buf, 'x', sizeof buf);
+  CHECK (mlock (buf, sizeof buf), "mlock %d pages", LOCK_CNT);
+  check_locked (LOCK_CNT);
+  CHECK (mlock (buf, sizeof buf), "mlock them again");
+  check_locked (LOCK_CNT);
+
+  if (mlock (big, sizeof big))
+    fail ("mlock of %d pages beyond the limit succeeded", BIG_CNT);
+  check_locked (LOCK_CNT);
+  if (madvise (buf, PAGE_SIZE, MADV_DONTNEED))
+    fail ("madvise DONTNEED of a locked page succeeded");
+  if (mlock ((char *) 0x10000000, PAGE_SIZE))
+    fail ("mlock of unmapped pages succeeded");
+
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != 'x')
+      fail ("byte %zu of locked buffer is %d", i, buf[i]);
+
+  CHECK (munlock (buf, sizeof buf), "munlock");
+  check_locked (0);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-mlock) begin
+(page-mlock) mlock 16 pages
+(page-mlock) mlock them again
+(page-mlock) munlock
+(page-mlock) end
+EOF
+pass;
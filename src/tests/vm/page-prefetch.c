@@ -0,0 +1,24 @@
+/* Runs a child that reads the pages of its initialized data
+   twice.  The first run faults on each of them, and the kernel
+   records the faults, so the second run finds the pages read in
+   ahead and takes fewer faults. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define DATA_PAGES 16
+
+void
+test_main (void)
+{
+  int first, second;
+
+  CHECK ((first = wait (exec ("child-prefetch"))) >= 0, "first run");
+  CHECK ((second = wait (exec ("child-prefetch"))) >= 0, "second run");
+  if (first < DATA_PAGES)
+    fail ("first run took %d faults for %d pages", first, DATA_PAGES);
+  if (second >= first)
+    fail ("second run took %d faults, first run %d", second, first);
+  msg ("second run took fewer faults");
+}
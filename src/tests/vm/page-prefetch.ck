@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-prefetch) begin
+(page-prefetch) first run
+(page-prefetch) second run
+(page-prefetch) second run took fewer faults
+(page-prefetch) end
+EOF
+pass;
@@ -0,0 +1,55 @@
+/* Shares a named memory segment with a child started with exec(),
+   which maps it by name at another address, and with a child
+   created by fork(), which inherits the mapping.  Each sees the
+   other's writes.  The segment outlives its mappings until its
+   name is removed. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/shm.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ADDR ((char *) 0x10000000)
+
+void
+test_main (void)
+{
+  pid_t child;
+  int i;
+
+  CHECK (shm_map (NAME, SIZE, ADDR), "map \"%s\"", NAME);
+  for (i = 0; i < SIZE; i++)
+    if (ADDR[i] != 0)
+      fail ("byte %d of new segment is %#x", i, ADDR[i]);
+  for (i = 0; i < SIZE; i++)
+    ADDR[i] = PATTERN (i);
+
+  CHECK ((child = exec ("child-shm")) != PID_ERROR, "exec \"child-shm\"");
+  CHECK (wait (child) == 81, "wait for child");
+  for (i = 0; i < SIZE; i++)
+    if (ADDR[i] != ~PATTERN (i))
+      fail ("byte %d is %#x instead of %#x", i, ADDR[i], ~PATTERN (i));
+  msg ("parent sees child's writes");
+
+  CHECK ((child = fork ()) != PID_ERROR, "fork");
+  if (child == 0)
+    {
+      memset (ADDR, 0x5a, SIZE);
+      exit (82);
+    }
+  CHECK (wait (child) == 82, "wait for forked child");
+  for (i = 0; i < SIZE; i++)
+    if (ADDR[i] != 0x5a)
+      fail ("byte %d is %#x instead of 0x5a", i, ADDR[i]);
+  msg ("parent sees forked child's writes");
+
+  CHECK (shm_unmap (ADDR), "unmap");
+  CHECK (shm_map (NAME, SIZE, ADDR), "map again");
+  CHECK (ADDR[SIZE - 1] == 0x5a, "segment kept its data");
+  CHECK (shm_unmap (ADDR), "unmap again");
+  CHECK (shm_unlink (NAME), "unlink \"%s\"", NAME);
+  CHECK (!shm_unlink (NAME), "second unlink fails");
+  CHECK (shm_map (NAME, SIZE, ADDR) && ADDR[0] == 0,
+         "map after unlink gets a new segment");
+}
@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-shm) begin
+(page-shm) map "page-shm"
+(page-shm) exec "child-shm"
+(page-shm) wait for child
+(page-shm) parent sees child's writes
+(page-shm) fork
+(page-shm) wait for forked child
+(page-shm) parent sees forked child's writes
+(page-shm) unmap
+(page-shm) map again
+(page-shm) segment kept its data
+(page-shm) unmap again
+(page-shm) unlink "page-shm"
+(page-shm) second unlink fails
+(page-shm) map after unlink gets a new segment
+(page-shm) end
+EOF
+pass;
@@ -0,0 +1,87 @@
+/* Starts threads that share the process's memory and descriptors
+   but run on stacks of their own.  Each sums its own slice of a
+   global array, using a buffer on its stack big enough to make it
+   grow, and one writes to a pipe that the first thread reads.
+   Joining a thread returns what its function returned. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 4
+#define SLICE 4096
+
+static int data[THREAD_CNT * SLICE];
+static int sums[THREAD_CNT];
+static int pipe_fds[2];
+
+/* Sums slice *AUX of DATA into SUMS, by way of its stack. */
+static int
+sum_slice (void *aux)
+{
+  int slice = *(int *) aux;
+  int copy[SLICE];
+  int i;
+
+  memcpy (copy, data + slice * SLICE, sizeof copy);
+  for (i = 0; i < SLICE; i++)
+    sums[slice] += copy[i];
+  return slice + 100;
+}
+
+/* Writes the bytes of the string AUX to the pipe. */
+static int
+write_pipe (void *aux)
+{
+  const char *s = aux;
+  return write (pipe_fds[1], s, strlen (s));
+}
+
+void
+test_main (void)
+{
+  static const char text[] = "through a pipe";
+  int slices[THREAD_CNT];
+  tid_t tids[THREAD_CNT];
+  char buf[sizeof text];
+  tid_t writer;
+  int i;
+
+  for (i = 0; i < THREAD_CNT * SLICE; i++)
+    data[i] = i % 7;
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      slices[i] = i;
+      tids[i] = thread_create (sum_slice, &slices[i]);
+      if (tids[i] == TID_ERROR)
+        fail ("thread_create #%d failed", i);
+    }
+  msg ("started %d threads", THREAD_CNT);
+  for (i = 0; i < THREAD_CNT; i++)
+    if (thread_join (tids[i]) != i + 100)
+      fail ("thread #%d returned the wrong value", i);
+  msg ("joined %d threads", THREAD_CNT);
+  CHECK (thread_join (tids[0]) == -1, "second join fails");
+
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      int expected = 0;
+      int j;
+
+      for (j = i * SLICE; j < (i + 1) * SLICE; j++)
+        expected += j % 7;
+      if (sums[i] != expected)
+        fail ("sum of slice %d is %d instead of %d", i, sums[i], expected);
+    }
+  msg ("sums are correct");
+
+  CHECK (pipe (pipe_fds) == 0, "pipe");
+  CHECK ((writer = thread_create (write_pipe, (void *) text)) != TID_ERROR,
+         "start writer");
+  memset (buf, 0, sizeof buf);
+  CHECK (read (pipe_fds[0], buf, sizeof text - 1) == sizeof text - 1,
+         "read from pipe");
+  CHECK (!strcmp (buf, text), "read \"%s\"", buf);
+  CHECK (thread_join (writer) == sizeof text - 1, "join writer");
+}
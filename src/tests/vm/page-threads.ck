@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-threads) begin
+(page-threads) started 4 threads
+(page-threads) joined 4 threads
+(page-threads) second join fails
+(page-threads) sums are correct
+(page-threads) pipe
+(page-threads) start writer
+(page-threads) read from pipe
+(page-threads) read "through a pipe"
+(page-threads) join writer
+(page-threads) end
+EOF
+pass;
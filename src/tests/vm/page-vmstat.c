@@ -0,0 +1,33 @@
+/* Touches every page of a large array and checks that the
+   process's paging statistics account for the faults and the
+   pages brought into memory. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_CNT 64
+#define PAGE_SIZE 4096
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+void
+test_main (void)
+{
+  struct vmstat before, after;
+  size_t i;
+
+  CHECK (vmstat (0, &before), "get statistics");
+  for (i = 0; i < PAGE_CNT; i++)
+    buf[i * PAGE_SIZE] = i;
+  CHECK (vmstat (0, &after), "get statistics again");
+
+  if (after.minor_faults + after.major_faults
+      < before.minor_faults + before.major_faults + PAGE_CNT)
+    fail ("only %u faults counted for %d pages",
+          (after.minor_faults + after.major_faults)
+          - (before.minor_faults + before.major_faults), PAGE_CNT);
+  if (after.max_resident < before.resident + PAGE_CNT)
+    fail ("peak resident set of %u pages is too small", after.max_resident);
+  msg ("statistics are consistent");
+}
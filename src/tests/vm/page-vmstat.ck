@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-vmstat) begin
+(page-vmstat) get statistics
+(page-vmstat) get statistics again
+(page-vmstat) statistics are consistent
+(page-vmstat) end
+EOF
+pass;
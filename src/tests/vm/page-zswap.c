@@ -0,0 +1,51 @@
+/* Fills 2 MB of memory, more than fits in the user pool, with
+   pages that compress well and pages of zeros, and checks that
+   some of them were kept compressed in memory when they were
+   swapped out and that they all read back intact. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT (2 * 1024 * 1024 / PAGE_SIZE)
+
+static unsigned buf[PAGE_CNT][PAGE_SIZE / sizeof (unsigned)];
+
+/* Returns the value word I of page P should hold.  Every other
+   page is all zeros. */
+static unsigned
+value (size_t p, size_t i)
+{
+  return p % 2 ? p * 1000 + i % 16 : 0;
+}
+
+void
+test_main (void)
+{
+  struct kstat k;
+  size_t p, i;
+
+  msg ("initialize");
+  for (p = 0; p < PAGE_CNT; p++)
+    for (i = 0; i < PAGE_SIZE / sizeof (unsigned); i++)
+      buf[p][i] = value (p, i) + 1;
+  for (p = 0; p < PAGE_CNT; p++)
+    for (i = 0; i < PAGE_SIZE / sizeof (unsigned); i++)
+      buf[p][i]--;
+
+  kstat (&k);
+  if (k.mem.zswap_pages == 0)
+    fail ("no swapped pages held compressed");
+  if (k.mem.zswap_pages > k.mem.swap_used)
+    fail ("%u pages held compressed but %u swap slots in use",
+          k.mem.zswap_pages, k.mem.swap_used);
+  msg ("pages held compressed");
+
+  msg ("read pass");
+  for (p = 0; p < PAGE_CNT; p++)
+    for (i = 0; i < PAGE_SIZE / sizeof (unsigned); i++)
+      if (buf[p][i] != value (p, i))
+        fail ("word %zu of page %zu is %u, not %u", i, p, buf[p][i],
+              value (p, i));
+}
@@ -0,0 +1,51 @@
+/* Passes data through a pipe, first within the process and then
+   from a child that inherits the write end across exec().  The
+   child writes more than the pipe holds, so it blocks until we
+   read, and once it exits we see end of file.  Writing to a pipe
+   whose read end is closed fails. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/pipe.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  static char buf[SIZE + 1];
+  char cmd[64];
+  int fds[2];
+  pid_t child;
+  int total, n, i;
+
+  CHECK (pipe (fds) == 0, "pipe");
+  CHECK (write (fds[1], "hello", 5) == 5, "write to pipe");
+  CHECK (read (fds[0], buf, sizeof buf) == 5 && !memcmp (buf, "hello", 5),
+         "read from pipe");
+
+  snprintf (cmd, sizeof cmd, "child-pipe %d", fds[1]);
+  CHECK ((child = exec (cmd)) != PID_ERROR, "exec \"child-pipe\"");
+  close (fds[1]);
+
+  /* The child's copy is now the only write end. */
+  total = 0;
+  while ((n = read (fds[0], buf + total, sizeof buf - total)) > 0)
+    total += n;
+  if (n < 0)
+    fail ("read from pipe failed");
+  if (total != SIZE)
+    fail ("read %d bytes instead of %d", total, SIZE);
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != PATTERN (i))
+      fail ("byte %d is %#x instead of %#x", i, buf[i], PATTERN (i));
+  msg ("read %d bytes, then end of file", total);
+
+  CHECK (wait (child) == 81, "wait for child");
+  close (fds[0]);
+
+  CHECK (pipe (fds) == 0, "second pipe");
+  close (fds[0]);
+  CHECK (write (fds[1], "x", 1) == -1, "write without a reader fails");
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(pipe-exec) begin
+(pipe-exec) pipe
+(pipe-exec) write to pipe
+(pipe-exec) read from pipe
+(pipe-exec) exec "child-pipe"
+(pipe-exec) read 12288 bytes, then end of file
+(pipe-exec) wait for child
+(pipe-exec) second pipe
+(pipe-exec) write without a reader fails
+(pipe-exec) end
+EOF
+pass;
@@ -0,0 +1,49 @@
+/* Polls the ends of a pipe: the read end becomes ready when a
+   thread writes to the pipe while the first thread waits, and
+   reports a hang-up once the write end is closed.  A poll with a
+   timeout on an empty pipe returns 0, and a bad descriptor is
+   reported invalid. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static int fds[2];
+
+/* Writes one byte to the pipe. */
+static int
+writer (void *aux UNUSED)
+{
+  return write (fds[1], "x", 1);
+}
+
+void
+test_main (void)
+{
+  struct pollfd p[2];
+  tid_t tid;
+  char c;
+
+  CHECK (pipe (fds) == 0, "pipe");
+  p[0].fd = fds[0];
+  p[0].events = POLLIN;
+  p[1].fd = fds[1];
+  p[1].events = POLLOUT;
+  CHECK (poll (p, 2, 0) == 1 && p[0].revents == 0 && p[1].revents == POLLOUT,
+         "only the write end is ready");
+  CHECK (poll (p, 1, 50) == 0, "poll times out on empty pipe");
+
+  CHECK ((tid = thread_create (writer, NULL)) != TID_ERROR, "start writer");
+  CHECK (poll (p, 1, -1) == 1 && p[0].revents == POLLIN,
+         "read end ready after write");
+  CHECK (thread_join (tid) == 1, "join writer");
+  CHECK (read (fds[0], &c, 1) == 1 && c == 'x', "read byte");
+
+  close (fds[1]);
+  CHECK (poll (p, 1, -1) == 1 && p[0].revents == POLLHUP,
+         "read end hung up after close");
+
+  p[0].fd = 123;
+  CHECK (poll (p, 1, 0) == 1 && p[0].revents == POLLNVAL,
+         "bad descriptor is invalid");
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(pipe-poll) begin
+(pipe-poll) pipe
+(pipe-poll) only the write end is ready
+(pipe-poll) poll times out on empty pipe
+(pipe-poll) start writer
+(pipe-poll) read end ready after write
+(pipe-poll) join writer
+(pipe-poll) read byte
+(pipe-poll) read end hung up after close
+(pipe-poll) bad descriptor is invalid
+(pipe-poll) end
+EOF
+pass;
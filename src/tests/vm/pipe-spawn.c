@@ -0,0 +1,38 @@
+/* Starts a child with spawn() whose standard input and output are
+   pipes, feeds it a line and reads back what it makes of it,
+   then sees end of file once it exits.  A spawn with a
+   descriptor that is not open fails. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  char buf[32];
+  int in[2], out[2];
+  pid_t child;
+  int total, n;
+
+  CHECK (pipe (in) == 0 && pipe (out) == 0, "pipes");
+  CHECK ((child = spawn ("child-upper", in[0], out[1])) != PID_ERROR,
+         "spawn \"child-upper\"");
+  close (in[0]);
+  close (out[1]);
+
+  CHECK (write (in[1], "hello, pipe", 11) == 11, "write to child");
+  close (in[1]);
+  total = 0;
+  while ((n = read (out[0], buf + total, sizeof buf - total)) > 0)
+    total += n;
+  CHECK (n == 0 && total == 11 && !memcmp (buf, "HELLO, PIPE", 11),
+         "read upper case, then end of file");
+  CHECK (wait (child) == 82, "wait for child");
+  close (out[0]);
+
+  CHECK (spawn ("child-upper", 123, STDOUT_FILENO) == PID_ERROR,
+         "spawn with a bad descriptor fails");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(pipe-spawn) begin
+(pipe-spawn) pipes
+(pipe-spawn) spawn "child-upper"
+(pipe-spawn) write to child
+(pipe-spawn) read upper case, then end of file
+(pipe-spawn) wait for child
+(pipe-spawn) spawn with a bad descriptor fails
+(pipe-spawn) end
+EOF
+pass;
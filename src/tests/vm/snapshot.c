@@ -0,0 +1,68 @@
+/* Saves the process with snapshot(), changes its memory and its
+   descriptor's position, and starts a process from the snapshot,
+   which must see both as they were when the snapshot was
+   taken. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE 4096
+
+static char buf[3 * PAGE];
+
+/* Fails unless the SIZE bytes of BUF at OFS are VALUE. */
+static void
+check (size_t ofs, size_t size, char value)
+{
+  size_t i;
+
+  for (i = ofs; i < ofs + size; i++)
+    if (buf[i] != value)
+      fail ("byte %zu is %#x instead of %#x", i, buf[i], value);
+}
+
+void
+test_main (void)
+{
+  char local[16];
+  char data[5];
+  pid_t child;
+  int fd, r;
+
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  CHECK (write (fd, "hello", 5) == 5, "write \"data\"");
+  memset (buf, 'a', PAGE);
+  memset (buf + 2 * PAGE, 'c', PAGE);
+  strlcpy (local, "stack", sizeof local);
+
+  r = snapshot ("snap");
+  if (r == 1)
+    {
+      /* In the restored process. */
+      check (0, PAGE, 'a');
+      check (PAGE, PAGE, 0);
+      check (2 * PAGE, PAGE, 'c');
+      if (strcmp (local, "stack"))
+        fail ("stack holds \"%s\"", local);
+      if (tell (fd) != 5)
+        fail ("position is %u instead of 5", tell (fd));
+      seek (fd, 0);
+      if (read (fd, data, 5) != 5 || memcmp (data, "hello", 5))
+        fail ("read wrong data from \"data\"");
+      exit (81);
+    }
+  CHECK (r == 0, "snapshot \"snap\"");
+
+  memset (buf, 'b', sizeof buf);
+  strlcpy (local, "changed", sizeof local);
+  seek (fd, 0);
+  CHECK (snapshot ("snap") == -1, "snapshot to existing file fails");
+  CHECK ((child = restore ("snap")) != PID_ERROR, "restore \"snap\"");
+  CHECK (wait (child) == 81, "wait for restored process");
+
+  msg ("check original's data");
+  check (0, sizeof buf, 'b');
+}
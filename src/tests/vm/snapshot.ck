@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(snapshot) begin
+(snapshot) create "data"
+(snapshot) open "data"
+(snapshot) write "data"
+(snapshot) snapshot "snap"
+(snapshot) snapshot to existing file fails
+(snapshot) restore "snap"
+(snapshot) wait for restored process
+(snapshot) check original's data
+(snapshot) end
+EOF
+pass;
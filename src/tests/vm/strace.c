@@ -0,0 +1,31 @@
+/* Turns the tracing of the process's system calls on and off
+   with strace(), making calls in between, and checks that each
+   call returns the previous setting.  Then makes calls with
+   tracing off, which the check script verifies are missing from
+   the traced calls that the kernel reports at shutdown.  Run with
+   -trace, so that the calls are also recorded in the event
+   trace. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  int fd;
+
+  CHECK (!strace (true), "enable tracing");
+  CHECK (create ("traced", 16), "create \"traced\"");
+  CHECK ((fd = open ("traced")) > 1, "open \"traced\"");
+  CHECK (write (fd, "traced", 6) == 6, "write \"traced\"");
+  close (fd);
+  CHECK (strace (true), "enable tracing again");
+  CHECK (strace (false), "disable tracing");
+  CHECK (!strace (false), "tracing stays off");
+  CHECK (create ("untraced", 16), "create \"untraced\"");
+  CHECK ((fd = open ("untraced")) > 1, "open \"untraced\"");
+  CHECK (filesize (fd) == 16, "filesize \"untraced\"");
+  close (fd);
+  CHECK (remove ("traced"), "remove \"traced\"");
+}
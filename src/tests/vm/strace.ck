@@ -0,0 +1,53 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(strace) begin
+(strace) enable tracing
+(strace) create "traced"
+(strace) open "traced"
+(strace) write "traced"
+(strace) enable tracing again
+(strace) disable tracing
+(strace) tracing stays off
+(strace) create "untraced"
+(strace) open "untraced"
+(strace) filesize "untraced"
+(strace) remove "traced"
+(strace) end
+EOF
+
+# Collect the number of calls of each system call, and of traced
+# calls, that syscall_print_stats() printed at shutdown.
+my (@output) = read_text_file ("$test.output");
+my (%calls, %traced);
+foreach (@output) {
+    if (/^Syscalls:(.*)$/) {
+	%calls = reverse split (' ', $1);
+    } elsif (my ($name, $cnt) = /^Syscall (\w+): (\d+) traced calls/) {
+	$traced{$name} = $cnt;
+    }
+}
+fail "no system call statistics in output\n" if !%calls;
+
+# A call is traced if tracing was on when it was made, so the
+# strace() call that turns tracing off is traced but the one that
+# turns it on is not.  The traced writes are the write to the file
+# and the messages from "enable tracing" to "enable tracing again".
+my (%expected) = (create => 1, open => 1, write => 6, close => 1,
+		  strace => 2);
+foreach my $name (sort keys %expected) {
+    my ($cnt) = $traced{$name} // 0;
+    fail "$expected{$name} traced $name calls expected, but $cnt found\n"
+      if $cnt != $expected{$name};
+}
+foreach my $name (sort keys %traced) {
+    fail "$name called only with tracing off, but traced\n"
+      if !defined $expected{$name};
+}
+fail "calls with tracing off missing from system call counts\n"
+  if ($calls{create} // 0) != 2 || ($calls{remove} // 0) != 1;
+pass;
@@ -0,0 +1,33 @@
+/* Reads and sets a kernel tunable with sysctl() and checks that
+   values out of range and unknown names are rejected. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  int latency, value;
+
+  CHECK (sysctl ("sched.latency", &latency, NULL),
+         "read sched.latency");
+  value = latency * 2;
+  CHECK (sysctl ("sched.latency", NULL, &value), "double sched.latency");
+  CHECK (sysctl ("sched.latency", &value, NULL) && value == latency * 2,
+         "read it back");
+
+  value = 0;
+  CHECK (!sysctl ("sched.latency", NULL, &value),
+         "setting it to 0 fails");
+  CHECK (!sysctl ("sched.no_such_tunable", &value, NULL),
+         "reading an unknown tunable fails");
+  CHECK (!sysctl ("a.name.longer.than.any.tunable.may.have", &value, NULL),
+         "reading a name too long fails");
+
+  CHECK (sysctl ("sched.latency", &value, &latency)
+         && value == latency * 2,
+         "restore sched.latency, reading the old value");
+  CHECK (sysctl ("sched.latency", &value, NULL) && value == latency,
+         "read it back");
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(sysctl) begin
+(sysctl) read sched.latency
+(sysctl) double sched.latency
+(sysctl) read it back
+(sysctl) setting it to 0 fails
+(sysctl) reading an unknown tunable fails
+(sysctl) reading a name too long fails
+(sysctl) restore sched.latency, reading the old value
+(sysctl) read it back
+(sysctl) end
+EOF
+pass;
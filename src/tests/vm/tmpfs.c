@@ -0,0 +1,51 @@
+/* Uses the tmpfs that the kernel mounts on /tmp: writes a file
+   that spans many pages and reads it back, makes a directory in
+   it and walks back out through "..", and checks that the mount
+   point cannot be removed while files come and go inside it. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (64 * 1024)
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void)
+{
+  char name[READDIR_MAX_LEN + 1];
+  size_t i;
+  int fd;
+
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = i % 251;
+  CHECK (create ("/tmp/data", 0), "create \"/tmp/data\"");
+  CHECK ((fd = open ("/tmp/data")) > 1, "open \"/tmp/data\"");
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE, "write %d bytes",
+         FILE_SIZE);
+  CHECK (filesize (fd) == FILE_SIZE, "file is %d bytes", FILE_SIZE);
+  memset (buf, 0, sizeof buf);
+  CHECK (pread (fd, buf, FILE_SIZE, 0) == FILE_SIZE, "read it back");
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != (char) (i % 251))
+      fail ("byte %zu is %d, not %d", i, buf[i], (int) (i % 251));
+  close (fd);
+
+  CHECK (mkdir ("/tmp/sub"), "mkdir \"/tmp/sub\"");
+  CHECK (chdir ("/tmp/sub"), "chdir \"/tmp/sub\"");
+  CHECK (create ("inner", 0), "create \"inner\"");
+  CHECK (chdir ("../.."), "chdir \"../..\"");
+  CHECK ((fd = open ("tmp/sub/inner")) > 1, "open \"tmp/sub/inner\"");
+  close (fd);
+
+  CHECK ((fd = open ("/tmp")) > 1, "open \"/tmp\"");
+  CHECK (readdir (fd, name), "readdir \"/tmp\"");
+  close (fd);
+  CHECK (!remove ("/tmp"), "cannot remove \"/tmp\"");
+  CHECK (remove ("/tmp/sub/inner"), "remove \"/tmp/sub/inner\"");
+  CHECK (remove ("/tmp/sub"), "remove \"/tmp/sub\"");
+  CHECK (remove ("/tmp/data"), "remove \"/tmp/data\"");
+  CHECK (open ("/tmp/data") == -1, "\"/tmp/data\" is gone");
+}
@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(tmpfs) begin
+(tmpfs) create "/tmp/data"
+(tmpfs) open "/tmp/data"
+(tmpfs) write 65536 bytes
+(tmpfs) file is 65536 bytes
+(tmpfs) read it back
+(tmpfs) mkdir "/tmp/sub"
+(tmpfs) chdir "/tmp/sub"
+(tmpfs) create "inner"
+(tmpfs) chdir "../.."
+(tmpfs) open "tmp/sub/inner"
+(tmpfs) open "/tmp"
+(tmpfs) readdir "/tmp"
+(tmpfs) cannot remove "/tmp"
+(tmpfs) remove "/tmp/sub/inner"
+(tmpfs) remove "/tmp/sub"
+(tmpfs) remove "/tmp/data"
+(tmpfs) "/tmp/data" is gone
+(tmpfs) end
+EOF
+pass;
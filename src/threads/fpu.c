@@ -0,0 +1,231 @@
+#include "threads/fpu.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* CR0 bits. */
+#define CR0_MP 0x00000002       /* Monitor coprocessor: WAIT obeys TS. */
+#define CR0_EM 0x00000004       /* Emulation: FPU instructions trap. */
+#define CR0_TS 0x00000008       /* Task switched: next FPU use traps. */
+#define CR0_NE 0x00000020       /* Native x87 error reporting (#MF). */
+
+/* CR4 bits. */
+#define CR4_OSFXSR 0x00000200   /* FXSAVE, FXRSTOR and SSE enabled. */
+#define CR4_OSXMMEXCPT 0x00000400 /* Unmasked SSE errors raise #XF. */
+
+/* CPUID leaf 1 EDX bit for FXSAVE and FXRSTOR. */
+#define CPUID_FXSR 0x01000000
+
+/* Bytes saved by FXSAVE, which must be 16-byte aligned. */
+#define FXSAVE_SIZE 512
+
+/* MXCSR after reset: all SSE exceptions masked. */
+#define MXCSR_DEFAULT 0x1f80
+
+/* Does the processor have FXSAVE? */
+static bool have_fxsr;
+
+/* Thread whose state is in the FPU's registers, or null.  Only
+   changed with interrupts off. */
+static struct thread *owner;
+
+/* Is CR0.TS set?  Saves rewriting CR0 on every switch. */
+static bool ts_set;
+
+static uint32_t read_cr0 (void);
+static void write_cr0 (uint32_t);
+static void set_ts (bool);
+static void *save_area (struct thread *);
+static bool alloc_area (struct thread *);
+static void save (struct thread *);
+static void restore (struct thread *);
+
+/* Enables the FPU, and SSE if the processor has FXSAVE, with
+   CR0.TS set so that its first use traps. */
+void
+fpu_init (void)
+{
+  uint32_t eax, ebx, ecx, edx;
+
+  asm volatile ("cpuid"
+                : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                : "a" (1));
+  have_fxsr = (edx & CPUID_FXSR) != 0;
+  if (have_fxsr)
+    {
+      uint32_t cr4;
+
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4));
+    }
+
+  write_cr0 ((read_cr0 () & ~CR0_EM) | CR0_MP | CR0_NE | CR0_TS);
+  ts_set = true;
+}
+
+/* Sets CR0.TS for a switch to NEXT unless NEXT owns the FPU, in
+   which case its registers are still there.  Called with
+   interrupts off. */
+void
+fpu_switch (struct thread *next)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  set_ts (next != owner);
+}
+
+/* Handles a #NM trap by the running thread, by giving it the
+   FPU: the owner's registers are saved and the running thread's
+   are loaded.  Returns false if memory for the running thread's
+   save area is exhausted. */
+bool
+fpu_trap (void)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  bool fresh = cur->fpu == NULL;
+
+  /* Allocating may sleep, so it comes first. */
+  if (fresh && !alloc_area (cur))
+    return false;
+
+  old_level = intr_disable ();
+  set_ts (false);
+  if (owner != cur)
+    {
+      if (owner != NULL)
+        save (owner);
+      if (fresh)
+        {
+          uint32_t mxcsr = MXCSR_DEFAULT;
+
+          asm volatile ("fninit");
+          if (have_fxsr)
+            asm volatile ("ldmxcsr %0" : : "m" (mxcsr));
+        }
+      else
+        restore (cur);
+      owner = cur;
+    }
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Gives CHILD, a new thread that is a copy of PARENT, a copy of
+   PARENT's FPU state.  Returns false if memory is exhausted. */
+bool
+fpu_fork (struct thread *child, struct thread *parent)
+{
+  enum intr_level old_level;
+
+  if (parent->fpu == NULL)
+    return true;
+  if (!alloc_area (child))
+    return false;
+
+  /* Saving the owner's registers leaves them in an unknown state
+     with FNSAVE, so the parent gives up the FPU and reloads its
+     registers on its next use. */
+  old_level = intr_disable ();
+  if (owner == parent)
+    {
+      set_ts (false);
+      save (parent);
+      owner = NULL;
+      set_ts (true);
+    }
+  memcpy (save_area (child), save_area (parent), FXSAVE_SIZE);
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Frees the running thread's save area, which is exiting. */
+void
+fpu_exit (void)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (owner == cur)
+    owner = NULL;
+  intr_set_level (old_level);
+  free (cur->fpu);
+  cur->fpu = NULL;
+}
+
+/* Returns CR0. */
+static uint32_t
+read_cr0 (void)
+{
+  uint32_t cr0;
+
+  asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+  return cr0;
+}
+
+/* Sets CR0 to CR0. */
+static void
+write_cr0 (uint32_t cr0)
+{
+  asm volatile ("movl %0, %%cr0" : : "r" (cr0));
+}
+
+/* Sets CR0.TS if TS is true, otherwise clears it. */
+static void
+set_ts (bool ts)
+{
+  if (ts == ts_set)
+    return;
+  if (ts)
+    write_cr0 (read_cr0 () | CR0_TS);
+  else
+    asm volatile ("clts");
+  ts_set = ts;
+}
+
+/* Returns T's save area, aligned for FXSAVE. */
+static void *
+save_area (struct thread *t)
+{
+  return (void *) ROUND_UP ((uintptr_t) t->fpu, 16);
+}
+
+/* Allocates a save area for T.  Returns false if memory is
+   exhausted. */
+static bool
+alloc_area (struct thread *t)
+{
+  t->fpu = malloc (FXSAVE_SIZE + 15);
+  return t->fpu != NULL;
+}
+
+/* Saves the FPU's registers, which are T's, into T's save area.
+   CR0.TS must be clear. */
+static void
+save (struct thread *t)
+{
+  void *area = save_area (t);
+
+  if (have_fxsr)
+    asm volatile ("fxsave (%0)" : : "r" (area) : "memory");
+  else
+    asm volatile ("fnsave (%0)" : : "r" (area) : "memory");
+}
+
+/* Loads the FPU's registers from T's save area.  CR0.TS must be
+   clear. */
+static void
+restore (struct thread *t)
+{
+  void *area = save_area (t);
+
+  if (have_fxsr)
+    asm volatile ("fxrstor (%0)" : : "r" (area) : "memory");
+  else
+    asm volatile ("frstor (%0)" : : "r" (area) : "memory");
+}
@@ -0,0 +1,29 @@
+#ifndef THREADS_FPU_H
+#define THREADS_FPU_H
+
+#include <stdbool.h>
+
+struct thread;
+
+/* Lazy saving of the floating-point unit.
+
+   The kernel itself never uses the x87 or SSE registers, so they
+   only hold user state, and only one thread's at a time: the
+   thread that used them last, their owner.  A context switch
+   does not touch them but sets CR0.TS if the next thread is not
+   the owner, so that the next thread's first FPU instruction
+   traps with #NM.  fpu_trap() then saves the owner's registers
+   into its save area, loads the trapping thread's, or fresh ones
+   if it has not used the FPU before, and makes it the owner.
+   Threads that never use the FPU never have an area and never
+   pay for saving one.  FXSAVE is used, which covers the SSE
+   registers, if the processor has it; otherwise FNSAVE, which
+   covers the x87 ones only. */
+
+void fpu_init (void);
+void fpu_switch (struct thread *next);
+bool fpu_trap (void);
+bool fpu_fork (struct thread *child, struct thread *parent);
+void fpu_exit (void);
+
+#endif /* threads/fpu.h */
@@ -15,17 +15,25 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/profile.h"
+#include "threads/trace.h"
 #include "threads/pte.h"
+#include "threads/rcu.h"
+#include "threads/sysctl.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/process.h"
+#include "userprog/aio.h"
 #include "userprog/exception.h"
+#include "userprog/futex.h"
 #include "userprog/gdt.h"
+#include "userprog/poll.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
 #else
@@ -34,8 +42,18 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/virtio-blk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/tmpfs.h"
+#endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/mmap.h"
+#include "vm/page.h"
+#include "vm/shm.h"
+#include "vm/swap.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -45,10 +63,19 @@ uint32_t *init_page_dir;
 /* -f: Format the file system? */
 static bool format_filesys;
 
+/* -defrag: Defragment the file system in the background? */
+static bool defrag_filesys;
+
 /* -filesys, -scratch, -swap: Names of block devices to use,
-   overriding the defaults. */
+   overriding the defaults.  -swap takes a comma-separated list. */
 static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
+
+/* -ramdisk: RAM disks to create, as TYPE:KB[,...]. */
+static const char *ramdisk_spec;
+
+/* -tmpfs: Directory to mount a tmpfs on. */
+static const char *tmpfs_path;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
@@ -57,17 +84,33 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* Time-stamp counter when main() started, and the name of each
+   phase of booting with the counter when it finished. */
+#define BOOT_PHASE_MAX 8
+static uint64_t boot_start;
+static const char *boot_phase_names[BOOT_PHASE_MAX];
+static uint64_t boot_phase_ends[BOOT_PHASE_MAX];
+static int boot_phase_cnt;
+
 static void bss_init (void);
 static void paging_init (void);
+static bool cpu_has_pse (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
 static void run_actions (char **argv);
 static void usage (void);
+static void boot_phase (const char *name);
+static void print_boot_times (void);
 
 #ifdef FILESYS
 static void locate_block_devices (void);
 static void locate_block_device (enum block_type, const char *name);
+#ifdef VM
+static void locate_swap_devices (void);
+static void add_swap_device (struct block *);
+#endif
+static bool channel_in_use (struct block *);
 #endif
 
 int main (void) NO_RETURN;
@@ -80,6 +123,7 @@ main (void)
 
   /* Clear BSS. */  
   bss_init ();
+  boot_start = timer_cycles ();
 
   /* Break command line into arguments and parse options. */
   argv = read_command_line ();
@@ -98,6 +142,9 @@ main (void)
   palloc_init (user_page_limit);
   malloc_init ();
   paging_init ();
+  fpu_init ();
+  trace_init ();
+  boot_phase ("memory");
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -107,26 +154,58 @@ main (void)
 
   /* Initialize interrupt handlers. */
   intr_init ();
+  rcu_init ();
   timer_init ();
   kbd_init ();
   input_init ();
 #ifdef USERPROG
   exception_init ();
   syscall_init ();
+  futex_init ();
+  poll_init ();
+  process_init ();
 #endif
 
   /* Start thread scheduler and enable interrupts. */
+  boot_phase ("interrupts");
   thread_start ();
+  intr_work_start ();
   serial_init_queue ();
   timer_calibrate ();
+  boot_phase ("timer");
 
 #ifdef FILESYS
-  /* Initialize file system. */
+  /* Initialize file system.  RAM disks are registered first,
+     then virtio disks, so that each is preferred over the slower
+     kinds for the roles of its type. */
+  ramdisk_init (ramdisk_spec);
+  virtio_blk_init ();
   ide_init ();
   locate_block_devices ();
+  boot_phase ("disks");
   filesys_init (format_filesys);
+  if (tmpfs_path != NULL && !tmpfs_mount (tmpfs_path))
+    PANIC ("Cannot mount tmpfs on \"%s\"", tmpfs_path);
+  boot_phase ("filesys");
+  if (defrag_filesys)
+    fsutil_defrag_start ();
+#ifdef USERPROG
+  aio_init ();
+#endif
 #endif
 
+#ifdef VM
+  /* Initialize virtual memory. */
+  vm_frame_init ();
+  vm_page_init ();
+  vm_mmap_init ();
+  vm_shm_init ();
+  vm_swap_init ();
+  boot_phase ("vm");
+#endif
+
+  sysctl_check_boot ();
+  print_boot_times ();
   printf ("Boot complete.\n");
   
   /* Run actions specified on kernel command line. */
@@ -137,6 +216,34 @@ main (void)
   thread_exit ();
 }
 
+/* Notes that the boot phase called NAME has just finished. */
+static void
+boot_phase (const char *name)
+{
+  ASSERT (boot_phase_cnt < BOOT_PHASE_MAX);
+  boot_phase_names[boot_phase_cnt] = name;
+  boot_phase_ends[boot_phase_cnt] = timer_cycles ();
+  boot_phase_cnt++;
+}
+
+/* Prints how long each boot phase took. */
+static void
+print_boot_times (void)
+{
+  uint64_t start = boot_start;
+  int i;
+
+  printf ("Boot time:");
+  for (i = 0; i < boot_phase_cnt; i++)
+    {
+      printf (" %s %"PRIu64" ms,", boot_phase_names[i],
+              timer_cycles_to_ns (boot_phase_ends[i] - start) / 1000000);
+      start = boot_phase_ends[i];
+    }
+  printf (" total %"PRIu64" ms.\n",
+          timer_cycles_to_ns (start - boot_start) / 1000000);
+}
+
 /* Clear the "BSS", a segment that should be initialized to
    zeros.  It isn't actually stored on disk or zeroed by the
    kernel loader, so we have to zero it ourselves.
@@ -150,15 +257,26 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* CR4 bit that enables 4 MB pages.  See [IA32-v3a] 2.5 "Control
+   Registers". */
+#define CR4_PSE 0x00000010
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the CPU supports them, each whole 4 MB of physical memory
+   that holds no kernel text is mapped with a single 4 MB page,
+   saving its page table and most of the TLB entries the kernel
+   mapping would take.  The kernel text keeps 4 kB pages so that
+   it can stay read-only. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
+  bool pse = cpu_has_pse ();
   extern char _start, _end_kernel_text;
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
@@ -171,6 +289,15 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (pse && pte_idx == 0
+          && page + PTSPAN / PGSIZE <= init_ram_pages
+          && (vaddr >= &_end_kernel_text || vaddr + PTSPAN <= &_start))
+        {
+          pd[pde_idx] = pde_create_large_kernel (vaddr, true);
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
@@ -180,6 +307,15 @@ paging_init (void)
       pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
     }
 
+  /* 4 MB pages must be enabled before the page directory that
+     uses them is loaded. */
+  if (pse)
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PSE));
+    }
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
@@ -188,6 +324,18 @@ paging_init (void)
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
 }
 
+/* Returns true if the CPU supports 4 MB pages, as reported by
+   the CPUID instruction.  See [IA32-v2a] "CPUID--CPU
+   Identification". */
+static bool
+cpu_has_pse (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return (edx & (1u << 3)) != 0;
+}
+
 /* Breaks the kernel command line into words and returns them as
    an argv-like array. */
 static char **
@@ -247,15 +395,57 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_spec = value;
+      else if (!strcmp (name, "-tmpfs"))
+        tmpfs_path = value;
+      else if (!strcmp (name, "-defrag"))
+        defrag_filesys = true;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-evict"))
+        {
+          if (value != NULL && !strcmp (value, "clock"))
+            vm_evict_policy = EVICT_CLOCK;
+          else if (value != NULL && !strcmp (value, "2hand"))
+            vm_evict_policy = EVICT_TWO_HANDED;
+          else
+            PANIC ("unknown page replacement policy `%s'",
+                   value != NULL ? value : "");
+        }
+      else if (!strcmp (name, "-vmstat"))
+        vm_print_stats = true;
+      else if (!strcmp (name, "-stack"))
+        {
+          int kb = value != NULL ? atoi (value) : 0;
+          if (kb <= 0 || (size_t) kb > (size_t) PHYS_BASE / 1024)
+            PANIC ("bad stack limit `%s'", value != NULL ? value : "");
+          vm_stack_limit = ROUND_UP ((size_t) kb * 1024, PGSIZE);
+        }
+      else if (!strcmp (name, "-mlock"))
+        {
+          int kb = value != NULL ? atoi (value) : -1;
+          if (kb < 0 || (size_t) kb > (size_t) PHYS_BASE / 1024)
+            PANIC ("bad lock limit `%s'", value != NULL ? value : "");
+          vm_lock_limit = (size_t) kb * 1024;
+        }
 #endif
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-stride"))
+        thread_stride = true;
+      else if (!strcmp (name, "-mtrack"))
+        malloc_track = true;
+      else if (!strcmp (name, "-profile"))
+        profile_enabled = true;
+      else if (!strcmp (name, "-trace"))
+        trace_enabled = true;
+      else if (!strcmp (name, "-o"))
+        sysctl_set_boot (value);
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -263,6 +453,8 @@ parse_options (char **argv)
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
     }
+  if (thread_mlfqs && thread_stride)
+    PANIC ("-mlfqs and -stride cannot be used together");
 
   /* Initialize the random number generator based on the system
      time.  This has no effect if an "-rs" option was specified.
@@ -315,6 +507,7 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"defrag", 2, fsutil_defrag},
 #endif
       {NULL, 0, NULL},
     };
@@ -361,6 +554,7 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  defrag PATH        Defragment PATH, or every file under it.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
@@ -373,12 +567,24 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ramdisk=TYPE:KB[,...]  Create KB kB RAM disk of each TYPE.\n"
+          "  -tmpfs=DIR         Mount a memory-resident file system on DIR.\n"
+          "  -defrag            Defragment the file system periodically.\n"
 #ifdef VM
-          "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -swap=BDEV[,...]   Use BDEVs for swap instead of default.\n"
+          "  -evict=POLICY      Replace pages by POLICY: clock or 2hand.\n"
+          "  -vmstat            Print paging statistics of exiting processes.\n"
+          "  -stack=KB          Let user stacks grow to KB kB (default 8192).\n"
+          "  -mlock=KB          Let a process lock KB kB in memory (default 256).\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -stride            Share the CPU in proportion to thread tickets.\n"
+          "  -mtrack            Track outstanding kernel heap allocations.\n"
+          "  -profile           Sample the running code on each timer tick.\n"
+          "  -trace             Record kernel events, dumped at shutdown.\n"
+          "  -o=NAME=VALUE      Set kernel tunable NAME to VALUE.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
@@ -394,14 +600,34 @@ locate_block_devices (void)
   locate_block_device (BLOCK_FILESYS, filesys_bdev_name);
   locate_block_device (BLOCK_SCRATCH, scratch_bdev_name);
 #ifdef VM
-  locate_block_device (BLOCK_SWAP, swap_bdev_name);
+  locate_swap_devices ();
 #endif
 }
 
+/* Returns true if a block device already assigned a role is on
+   the same controller channel as BLOCK. */
+static bool
+channel_in_use (struct block *block)
+{
+  enum block_type role;
+
+  if (block_channel (block) < 0)
+    return false;
+  for (role = 0; role < BLOCK_ROLE_CNT; role++)
+    {
+      struct block *used = block_get_role (role);
+      if (used != NULL && block_channel (used) == block_channel (block))
+        return true;
+    }
+  return false;
+}
+
 /* Figures out what block device to use for the given ROLE: the
    block device with the given NAME, if NAME is non-null,
-   otherwise the first block device in probe order of type
-   ROLE. */
+   otherwise the first block device in probe order of type ROLE
+   that is on a channel no other role uses, so that, for example,
+   swap and file system traffic can overlap, or failing that the
+   first block device of type ROLE. */
 static void
 locate_block_device (enum block_type role, const char *name)
 {
@@ -415,9 +641,18 @@ locate_block_device (enum block_type role, const char *name)
     }
   else
     {
+      struct block *first = NULL;
+
       for (block = block_first (); block != NULL; block = block_next (block))
         if (block_type (block) == role)
-          break;
+          {
+            if (!channel_in_use (block))
+              break;
+            if (first == NULL)
+              first = block;
+          }
+      if (block == NULL)
+        block = first;
     }
 
   if (block != NULL)
@@ -426,4 +661,57 @@ locate_block_device (enum block_type role, const char *name)
       block_set_role (role, block);
     }
 }
+
+#ifdef VM
+/* Figures out what block devices to swap to: those named in the
+   comma-separated list SWAP_BDEV_NAME, if it is non-null,
+   otherwise every block device of type BLOCK_SWAP.  The first
+   is chosen as locate_block_device() chooses one and takes the
+   swap role; vm/swap.c stripes slots across it and the others. */
+static void
+locate_swap_devices (void)
+{
+  struct block *block;
+
+  if (swap_bdev_name != NULL)
+    {
+      char names[64];
+      char *name, *save_ptr;
+
+      strlcpy (names, swap_bdev_name, sizeof names);
+      name = strtok_r (names, ",", &save_ptr);
+      locate_block_device (BLOCK_SWAP, name);
+      if (block_get_role (BLOCK_SWAP) != NULL)
+        vm_swap_add_device (block_get_role (BLOCK_SWAP));
+      while ((name = strtok_r (NULL, ",", &save_ptr)) != NULL)
+        {
+          block = block_get_by_name (name);
+          if (block == NULL)
+            PANIC ("No such block device \"%s\"", name);
+          add_swap_device (block);
+        }
+      return;
+    }
+
+  locate_block_device (BLOCK_SWAP, NULL);
+  if (block_get_role (BLOCK_SWAP) == NULL)
+    return;
+  vm_swap_add_device (block_get_role (BLOCK_SWAP));
+  for (block = block_first (); block != NULL; block = block_next (block))
+    if (block_type (block) == BLOCK_SWAP
+        && block != block_get_role (BLOCK_SWAP))
+      add_swap_device (block);
+}
+
+/* Adds BLOCK to the swap devices besides the one in the swap
+   role, if there is room for it. */
+static void
+add_swap_device (struct block *block)
+{
+  if (vm_swap_add_device (block))
+    printf ("swap: also using %s\n", block_name (block));
+  else
+    printf ("swap: not using %s, too many devices\n", block_name (block));
+}
+#endif
 #endif
@@ -6,9 +6,14 @@
 #include "threads/flags.h"
 #include "threads/intr-stubs.h"
 #include "threads/io.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "devices/timer.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/process.h"
+#endif
 
 /* Programmable Interrupt Controller (PIC) registers.
    A PC has two PICs, called the master and slave PICs, with the
@@ -37,6 +42,20 @@ static const char *intr_names[INTR_CNT];
    unexpected interrupt is one that has no registered handler. */
 static unsigned int unexpected_cnt[INTR_CNT];
 
+/* Number of times each interrupt has been handled, and the total
+   and greatest number of CPU cycles spent in its handler. */
+static int64_t intr_cnt[INTR_CNT];
+static uint64_t intr_cycles[INTR_CNT];
+static uint64_t intr_max_cycles[INTR_CNT];
+
+/* Time-stamp at which intr_disable() last turned interrupts off,
+   or 0 if they have been turned back on since, and the longest
+   time interrupts have been kept off that way, with the code
+   that turned them back on. */
+static uint64_t off_start;
+static uint64_t off_max;
+static void *off_max_where;
+
 /* External interrupts are those generated by devices outside the
    CPU, such as the timer.  External interrupts run with
    interrupts turned off, so they never nest, nor are they ever
@@ -47,6 +66,12 @@ static unsigned int unexpected_cnt[INTR_CNT];
 static bool in_external_intr;   /* Are we processing an external interrupt? */
 static bool yield_on_return;    /* Should we yield on interrupt return? */
 
+/* Deferred work queued by interrupt handlers, and the number of
+   items in it as a semaphore for the thread that runs them.  The
+   queue is protected by disabling interrupts. */
+static struct list work_list;
+static struct semaphore work_sema;
+
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
 static void pic_end_of_interrupt (int irq);
@@ -56,6 +81,12 @@ static uint64_t make_intr_gate (void (*) (void), int dpl);
 static uint64_t make_trap_gate (void (*) (void), int dpl);
 static inline uint64_t make_idtr_operand (uint16_t limit, void *base);
 
+/* Deferred work. */
+static thread_func work_thread NO_RETURN;
+
+/* Statistics. */
+static enum intr_level enable (void *caller);
+
 /* Interrupt handlers. */
 void intr_handler (struct intr_frame *args);
 static void unexpected_interrupt (const struct intr_frame *);
@@ -80,16 +111,38 @@ intr_get_level (void)
 enum intr_level
 intr_set_level (enum intr_level level) 
 {
-  return level == INTR_ON ? intr_enable () : intr_disable ();
+  return (level == INTR_ON
+          ? enable (__builtin_return_address (0))
+          : intr_disable ());
 }
 
 /* Enables interrupts and returns the previous interrupt status. */
 enum intr_level
 intr_enable (void) 
+{
+  return enable (__builtin_return_address (0));
+}
+
+/* Enables interrupts for the code at CALLER and returns the
+   previous interrupt status.  If they were turned off by
+   intr_disable(), notes how long they stayed off. */
+static enum intr_level
+enable (void *caller) 
 {
   enum intr_level old_level = intr_get_level ();
   ASSERT (!intr_context ());
 
+  if (old_level == INTR_OFF && off_start != 0)
+    {
+      uint64_t cycles = timer_cycles () - off_start;
+      if (cycles > off_max)
+        {
+          off_max = cycles;
+          off_max_where = caller;
+        }
+      off_start = 0;
+    }
+
   /* Enable interrupts by setting the interrupt flag.
 
      See [IA32-v2b] "STI" and [IA32-v3a] 5.8.1 "Masking Maskable
@@ -110,6 +163,8 @@ intr_disable (void)
      Hardware Interrupts". */
   asm volatile ("cli" : : : "memory");
 
+  if (old_level == INTR_ON)
+    off_start = timer_cycles ();
   return old_level;
 }
 
@@ -155,6 +210,9 @@ intr_init (void)
   intr_names[17] = "#AC Alignment Check Exception";
   intr_names[18] = "#MC Machine-Check Exception";
   intr_names[19] = "#XF SIMD Floating-Point Exception";
+
+  list_init (&work_list);
+  sema_init (&work_sema, 0);
 }
 
 /* Registers interrupt VEC_NO to invoke HANDLER with descriptor
@@ -224,6 +282,91 @@ intr_yield_on_return (void)
   ASSERT (intr_context ());
   yield_on_return = true;
 }
+
+/* Initializes W to call FUNC with AUX when it is run.  W is not
+   queued. */
+void
+intr_work_init (struct intr_work *w, intr_work_func *func, void *aux)
+{
+  ASSERT (w != NULL && func != NULL);
+
+  w->func = func;
+  w->aux = aux;
+  w->queued = false;
+}
+
+/* Queues W to be run by the deferred work thread.  Returns true
+   if W was queued, false if it was already waiting to run, in
+   which case it still runs only once.  W may be queued again,
+   even by its own function, as soon as it starts to run.  May be
+   called from an interrupt handler. */
+bool
+intr_work_queue (struct intr_work *w)
+{
+  enum intr_level old_level = intr_disable ();
+  bool queued = !w->queued;
+
+  if (queued)
+    {
+      w->queued = true;
+      list_push_back (&work_list, &w->elem);
+      sema_up (&work_sema);
+    }
+  intr_set_level (old_level);
+  return queued;
+}
+
+/* Starts the thread that runs deferred work.  Work queued before
+   this is called runs once it has been. */
+void
+intr_work_start (void)
+{
+  if (thread_create ("intr-work", PRI_MAX, work_thread, NULL) == TID_ERROR)
+    PANIC ("can't start deferred interrupt work thread");
+}
+
+/* Deferred work thread.  Runs queued work items one at a time,
+   in the order they were queued. */
+static void
+work_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      enum intr_level old_level;
+      struct intr_work *w;
+
+      sema_down (&work_sema);
+      old_level = intr_disable ();
+      w = list_entry (list_pop_front (&work_list), struct intr_work, elem);
+      w->queued = false;
+      intr_set_level (old_level);
+
+      w->func (w->aux);
+    }
+}
+
+/* Returns true if external interrupt VEC_NO has been raised but
+   not yet delivered, for example because interrupts are off. */
+bool
+intr_is_pending (uint8_t vec_no)
+{
+  int irq = vec_no - 0x20;
+
+  ASSERT (vec_no >= 0x20 && vec_no < 0x30);
+
+  /* OCW3: make the next read of the control register return the
+     Interrupt Request Register. */
+  if (irq < 8)
+    {
+      outb (PIC0_CTRL, 0x0a);
+      return (inb (PIC0_CTRL) & (1 << irq)) != 0;
+    }
+  else
+    {
+      outb (PIC1_CTRL, 0x0a);
+      return (inb (PIC1_CTRL) & (1 << (irq - 8))) != 0;
+    }
+}
 
 /* 8259A Programmable Interrupt Controller. */
 
@@ -344,9 +487,17 @@ make_idtr_operand (uint16_t limit, void *base)
 void
 intr_handler (struct intr_frame *frame) 
 {
+  uint64_t start = timer_cycles ();
+  uint64_t cycles;
   bool external;
   intr_handler_func *handler;
 
+  /* Interrupts were on in the interrupted code, so any time
+     noted by intr_disable() is from before they were turned back
+     on by returning from an interrupt or switching threads. */
+  if (frame->eflags & FLAG_IF)
+    off_start = 0;
+
   /* External interrupts are special.
      We only handle one at a time (so interrupts must be off)
      and they need to be acknowledged on the PIC (see below).
@@ -374,6 +525,12 @@ intr_handler (struct intr_frame *frame)
   else
     unexpected_interrupt (frame);
 
+  cycles = timer_cycles () - start;
+  intr_cnt[frame->vec_no]++;
+  intr_cycles[frame->vec_no] += cycles;
+  if (cycles > intr_max_cycles[frame->vec_no])
+    intr_max_cycles[frame->vec_no] = cycles;
+
   /* Complete the processing of an external interrupt. */
   if (external) 
     {
@@ -384,8 +541,15 @@ intr_handler (struct intr_frame *frame)
       pic_end_of_interrupt (frame->vec_no); 
 
       if (yield_on_return) 
-        thread_yield (); 
+        thread_yield_preempted (); 
     }
+
+#ifdef USERPROG
+  /* A thread whose process is exiting does not go back to user
+     mode. */
+  if (frame->cs == SEL_UCSEG)
+    process_check_exit ();
+#endif
 }
 
 /* Handles an unexpected interrupt with interrupt frame F.  An
@@ -436,3 +600,22 @@ intr_name (uint8_t vec)
 {
   return intr_names[vec];
 }
+
+/* Prints interrupt statistics: how often each interrupt was
+   handled and how many CPU cycles its handler took, and the
+   longest time interrupts were kept off. */
+void
+intr_print_stats (void) 
+{
+  int vec;
+
+  for (vec = 0; vec < INTR_CNT; vec++)
+    if (intr_cnt[vec] != 0)
+      printf ("Interrupt %#04x (%s): %lld times, "
+              "%llu cycles average, %llu max\n",
+              vec, intr_names[vec], intr_cnt[vec],
+              intr_cycles[vec] / intr_cnt[vec], intr_max_cycles[vec]);
+  printf ("Interrupts: off for at most %llu cycles (%llu us), "
+          "turned back on at %p\n", off_max,
+          timer_cycles_to_ns (off_max) / 1000, off_max_where);
+}
@@ -1,6 +1,7 @@
 #ifndef THREADS_INTERRUPT_H
 #define THREADS_INTERRUPT_H
 
+#include <list.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -63,8 +64,32 @@ void intr_register_int (uint8_t vec, int dpl, enum intr_level,
                         intr_handler_func *, const char *name);
 bool intr_context (void);
 void intr_yield_on_return (void);
+bool intr_is_pending (uint8_t vec);
+
+/* Deferred interrupt work.
+
+   An external interrupt handler runs with interrupts off and may
+   not sleep, so it should do no more than it must, such as
+   acknowledging the device and waking a thread.  Anything else
+   can be queued as an intr_work, whose function later runs in a
+   kernel thread of the highest priority, with interrupts on.
+   There it may sleep, take locks and print. */
+typedef void intr_work_func (void *aux);
+
+struct intr_work
+  {
+    struct list_elem elem;      /* Element in the work queue. */
+    intr_work_func *func;       /* Function to run. */
+    void *aux;                  /* Argument for FUNC. */
+    bool queued;                /* In the work queue? */
+  };
+
+void intr_work_init (struct intr_work *, intr_work_func *, void *aux);
+bool intr_work_queue (struct intr_work *);
+void intr_work_start (void);
 
 void intr_dump_frame (const struct intr_frame *);
+void intr_print_stats (void);
 const char *intr_name (uint8_t vec);
 
 #endif /* threads/interrupt.h */
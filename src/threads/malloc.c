@@ -1,10 +1,12 @@
 #include "threads/malloc.h"
 #include <debug.h>
+#include <kstat.h>
 #include <list.h>
 #include <round.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -32,7 +34,35 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   Object caches, created with kmem_cache_create(), are
+   descriptors of their own whose block size is exactly that of
+   the objects they hold, rather than a power of 2, so that
+   frequently allocated structures waste little memory.  Their
+   objects may be freed with free() as well as with
+   kmem_cache_free().
+
+   To keep the descriptor locks off the common path, every
+   descriptor has a "magazine" of up to MAGAZINE_SIZE free
+   blocks, protected by disabling interrupts.  malloc() takes
+   a block from the magazine if it has one, and free() puts the
+   block there if it is not full.  Otherwise half a magazine of
+   blocks is moved to or from the shared free list at once, under
+   the lock.
+
+   With malloc_track set, by the -mtrack kernel option, each
+   allocation is also recorded in a table along with its size and
+   the address it was allocated from, so that the blocks still
+   outstanding can be listed by call site. */
+
+/* Free blocks cached off a descriptor's free list. */
+#define MAGAZINE_SIZE 8
+struct magazine
+  {
+    size_t cnt;                         /* Number of blocks. */
+    struct block *blocks[MAGAZINE_SIZE]; /* The blocks. */
+  };
 
 /* Descriptor. */
 struct desc
@@ -41,6 +71,21 @@ struct desc
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+    size_t alloc_cnt;           /* Blocks handed out, in total. */
+    size_t in_use;              /* Blocks off the free list. */
+    size_t in_use_max;          /* Most blocks ever in use. */
+    size_t arena_cnt;           /* Arenas currently held. */
+    size_t arena_max;           /* Most arenas ever held. */
+    struct magazine mag;        /* Free blocks off the list. */
+  };
+
+/* Object cache. */
+struct kmem_cache
+  {
+    struct desc desc;           /* Descriptor for the objects. */
+    const char *name;           /* Name, for statistics. */
+    size_t size;                /* Object size requested. */
+    kmem_ctor_func *ctor;       /* Constructor, or null. */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -64,6 +109,54 @@ struct block
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Our set of object caches. */
+#define KMEM_CACHE_MAX 16
+static struct kmem_cache caches[KMEM_CACHE_MAX];
+static size_t cache_cnt;
+static struct lock caches_lock;
+
+/* Blocks too big for any descriptor and the pages they hold.
+   Protected by disabling interrupts. */
+static size_t big_cnt, big_pages, big_pages_max;
+
+/* If true, record every allocation in the tag table.
+   Set by the -mtrack kernel option before malloc_init(). */
+bool malloc_track;
+
+/* An outstanding allocation, in the tag table. */
+struct alloc_tag
+  {
+    void *ptr;                  /* Block, or null if the slot is free. */
+    void *site;                 /* Address that allocated it. */
+    size_t size;                /* Bytes requested. */
+  };
+
+/* Tag table: an open-addressed hash table with linear probing,
+   keyed on block address.  Allocations made while it is 3/4 full
+   are not recorded, only counted.  Protected by disabling
+   interrupts. */
+#define TAG_BITS 11
+#define TAG_CNT (1 << TAG_BITS)
+static struct alloc_tag tags[TAG_CNT];
+static size_t tag_cnt, tag_dropped;
+
+/* Outstanding allocations from one call site. */
+#define TAG_SITE_MAX 24
+struct site_total
+  {
+    void *site;                 /* Address that allocated them. */
+    size_t cnt;                 /* Number of allocations. */
+    size_t bytes;               /* Bytes requested, in total. */
+  };
+
+static void *do_malloc (size_t);
+static void tag_add (void *, size_t, void *site);
+static void tag_remove (void *);
+static void print_tags (void);
+static void desc_init (struct desc *, size_t block_size, const char *name);
+static void *desc_alloc (struct desc *);
+static struct block *desc_take (struct desc *);
+static void desc_give (struct desc *, struct block *);
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
 
@@ -77,20 +170,172 @@ malloc_init (void)
     {
       struct desc *d = &descs[desc_cnt++];
       ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
-      d->block_size = block_size;
-      d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
-      list_init (&d->free_list);
-      lock_init (&d->lock);
+      desc_init (d, block_size, "malloc");
+    }
+  lock_init (&caches_lock);
+}
+
+/* Initializes descriptor D for blocks of BLOCK_SIZE bytes, naming
+   its lock NAME. */
+static void
+desc_init (struct desc *d, size_t block_size, const char *name)
+{
+  d->block_size = block_size;
+  d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
+  list_init (&d->free_list);
+  lock_init_named (&d->lock, name);
+  d->alloc_cnt = d->in_use = d->in_use_max = 0;
+  d->arena_cnt = d->arena_max = 0;
+}
+
+/* Creates and returns a cache of objects of SIZE bytes named
+   NAME, which must outlive the kernel.  If CTOR is nonnull, it is
+   called on each object as it is allocated.  Panics if there are
+   too many caches or SIZE is too big for one. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, kmem_ctor_func *ctor)
+{
+  struct kmem_cache *c;
+  size_t block_size;
+
+  /* Keep blocks aligned, and big enough to be linked into the
+     free list. */
+  block_size = ROUND_UP (size, sizeof (void *));
+  if (block_size < sizeof (struct block))
+    block_size = sizeof (struct block);
+  ASSERT (block_size <= (PGSIZE - sizeof (struct arena)) / 2);
+
+  lock_acquire (&caches_lock);
+  if (cache_cnt >= KMEM_CACHE_MAX)
+    PANIC ("too many object caches creating \"%s\"", name);
+  c = &caches[cache_cnt++];
+  lock_release (&caches_lock);
+
+  desc_init (&c->desc, block_size, name);
+  c->name = name;
+  c->size = size;
+  c->ctor = ctor;
+  return c;
+}
+
+/* Returns a new object from cache C, constructed by C's
+   constructor, if any, or a null pointer if memory is not
+   available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  void *p = desc_alloc (&c->desc);
+
+  if (p != NULL)
+    {
+      if (malloc_track)
+        tag_add (p, c->size, __builtin_return_address (0));
+      if (c->ctor != NULL)
+        c->ctor (p);
+    }
+  return p;
+}
+
+/* Returns object P, allocated from cache C, to the cache. */
+void
+kmem_cache_free (struct kmem_cache *c, void *p)
+{
+  ASSERT (p == NULL || block_to_arena (p)->desc == &c->desc);
+
+  free (p);
+}
+
+/* Returns the number of blocks of D cached in its magazine, which
+   count as in use in D but are free for malloc() to hand out. */
+static size_t
+cached_cnt (struct desc *d)
+{
+  return d->mag.cnt;
+}
+
+/* Stores the bytes of kernel heap in use, in blocks of every
+   size and in object caches, and the pages holding them in
+   STATS. */
+void
+malloc_get_kstat (struct kstat_mem *stats)
+{
+  size_t bytes = big_pages * PGSIZE;
+  size_t pages = big_pages;
+  size_t i;
+
+  for (i = 0; i < desc_cnt; i++)
+    {
+      struct desc *d = &descs[i];
+
+      bytes += (d->in_use - cached_cnt (d)) * d->block_size;
+      pages += d->arena_cnt;
+    }
+  for (i = 0; i < cache_cnt; i++)
+    {
+      struct desc *d = &caches[i].desc;
+
+      bytes += (d->in_use - cached_cnt (d)) * d->block_size;
+      pages += d->arena_cnt;
     }
+  stats->heap_bytes = bytes;
+  stats->heap_pages = pages;
+}
+
+/* Prints statistics about each descriptor and object cache that
+   has been used, and about big blocks.  If allocations are being
+   tracked, also lists the outstanding ones by call site. */
+void
+malloc_print_stats (void)
+{
+  size_t i;
+
+  for (i = 0; i < desc_cnt; i++)
+    {
+      struct desc *d = &descs[i];
+
+      if (d->alloc_cnt > 0)
+        printf ("Malloc %zu-byte blocks: %zu allocations, %zu bytes in use "
+                "(peak %zu), %zu pages (peak %zu)\n", d->block_size,
+                d->alloc_cnt, (d->in_use - cached_cnt (d)) * d->block_size,
+                d->in_use_max * d->block_size, d->arena_cnt, d->arena_max);
+    }
+  for (i = 0; i < cache_cnt; i++)
+    {
+      struct kmem_cache *c = &caches[i];
+      struct desc *d = &c->desc;
+
+      if (d->alloc_cnt > 0)
+        printf ("Cache %s: %zu-byte objects in %zu-byte blocks, "
+                "%zu allocations, %zu in use (peak %zu), "
+                "%zu pages (peak %zu)\n",
+                c->name, c->size, d->block_size, d->alloc_cnt,
+                d->in_use - cached_cnt (d), d->in_use_max,
+                d->arena_cnt, d->arena_max);
+    }
+  if (big_pages_max > 0)
+    printf ("Malloc big blocks: %zu in use, %zu pages (peak %zu)\n",
+            big_cnt, big_pages, big_pages_max);
+  if (malloc_track)
+    print_tags ();
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) 
+{
+  void *p = do_malloc (size);
+
+  if (p != NULL && malloc_track)
+    tag_add (p, size, __builtin_return_address (0));
+  return p;
+}
+
+/* Does the work of malloc(), without recording the allocation. */
+static void *
+do_malloc (size_t size)
 {
   struct desc *d;
-  struct block *b;
   struct arena *a;
 
   /* A null pointer satisfies a request for 0 bytes. */
@@ -107,10 +352,19 @@ malloc (size_t size)
       /* SIZE is too big for any descriptor.
          Allocate enough pages to hold SIZE plus an arena. */
       size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
+      enum intr_level old_level;
+
       a = palloc_get_multiple (0, page_cnt);
       if (a == NULL)
         return NULL;
 
+      old_level = intr_disable ();
+      big_cnt++;
+      big_pages += page_cnt;
+      if (big_pages > big_pages_max)
+        big_pages_max = big_pages;
+      intr_set_level (old_level);
+
       /* Initialize the arena to indicate a big block of PAGE_CNT
          pages, and return it. */
       a->magic = ARENA_MAGIC;
@@ -119,7 +373,69 @@ malloc (size_t size)
       return a + 1;
     }
 
+  return desc_alloc (d);
+}
+
+/* Returns a free block of descriptor D, or a null pointer if
+   memory is not available. */
+static void *
+desc_alloc (struct desc *d)
+{
+  struct block *refill[MAGAZINE_SIZE / 2];
+  struct magazine *m;
+  enum intr_level old_level;
+  size_t cnt, i;
+
+  /* Fast path: take a block from the magazine. */
+  old_level = intr_disable ();
+  m = &d->mag;
+  if (m->cnt > 0)
+    {
+      struct block *b = m->blocks[--m->cnt];
+      intr_set_level (old_level);
+      return b;
+    }
+  intr_set_level (old_level);
+
+  /* Take a batch of blocks from the shared free list. */
   lock_acquire (&d->lock);
+  for (cnt = 0; cnt < MAGAZINE_SIZE / 2; cnt++)
+    {
+      refill[cnt] = desc_take (d);
+      if (refill[cnt] == NULL)
+        break;
+    }
+  lock_release (&d->lock);
+  if (cnt == 0)
+    return NULL;
+
+  /* Keep all but one in the magazine, which another thread may
+     have refilled meanwhile. */
+  old_level = intr_disable ();
+  m = &d->mag;
+  for (i = 1; i < cnt && m->cnt < MAGAZINE_SIZE; i++)
+    m->blocks[m->cnt++] = refill[i];
+  intr_set_level (old_level);
+  if (i < cnt)
+    {
+      lock_acquire (&d->lock);
+      for (; i < cnt; i++)
+        desc_give (d, refill[i]);
+      lock_release (&d->lock);
+    }
+  return refill[0];
+}
+
+/* Removes a block from the free list of descriptor D, creating a
+   new arena if the list is empty, and returns it.  Returns a null
+   pointer if memory is not available.  D's lock must be held. */
+static struct block *
+desc_take (struct desc *d)
+{
+  struct block *b;
+  struct arena *a;
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
 
   /* If the free list is empty, create a new arena. */
   if (list_empty (&d->free_list))
@@ -129,15 +445,14 @@ malloc (size_t size)
       /* Allocate a page. */
       a = palloc_get_page (0);
       if (a == NULL) 
-        {
-          lock_release (&d->lock);
-          return NULL; 
-        }
+        return NULL; 
 
       /* Initialize arena and add its blocks to the free list. */
       a->magic = ARENA_MAGIC;
       a->desc = d;
       a->free_cnt = d->blocks_per_arena;
+      if (++d->arena_cnt > d->arena_max)
+        d->arena_max = d->arena_cnt;
       for (i = 0; i < d->blocks_per_arena; i++) 
         {
           struct block *b = arena_to_block (a, i);
@@ -149,10 +464,42 @@ malloc (size_t size)
   b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
   a = block_to_arena (b);
   a->free_cnt--;
-  lock_release (&d->lock);
+  d->alloc_cnt++;
+  if (++d->in_use > d->in_use_max)
+    d->in_use_max = d->in_use;
   return b;
 }
 
+/* Returns block B to the free list of descriptor D, freeing its
+   arena if that leaves it entirely unused.  D's lock must be
+   held. */
+static void
+desc_give (struct desc *d, struct block *b)
+{
+  struct arena *a = block_to_arena (b);
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
+
+  /* Add block to free list. */
+  list_push_front (&d->free_list, &b->free_elem);
+  d->in_use--;
+
+  /* If the arena is now entirely unused, free it. */
+  if (++a->free_cnt >= d->blocks_per_arena) 
+    {
+      size_t i;
+
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      for (i = 0; i < d->blocks_per_arena; i++) 
+        {
+          struct block *b = arena_to_block (a, i);
+          list_remove (&b->free_elem);
+        }
+      palloc_free_page (a);
+      d->arena_cnt--;
+    }
+}
+
 /* Allocates and return A times B bytes initialized to zeroes.
    Returns a null pointer if memory is not available. */
 void *
@@ -167,9 +514,13 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = do_malloc (size);
   if (p != NULL)
-    memset (p, 0, size);
+    {
+      memset (p, 0, size);
+      if (malloc_track)
+        tag_add (p, size, __builtin_return_address (0));
+    }
 
   return p;
 }
@@ -201,7 +552,9 @@ realloc (void *old_block, size_t new_size)
     }
   else 
     {
-      void *new_block = malloc (new_size);
+      void *new_block = do_malloc (new_size);
+      if (new_block != NULL && malloc_track)
+        tag_add (new_block, new_size, __builtin_return_address (0));
       if (old_block != NULL && new_block != NULL)
         {
           size_t old_size = block_size (old_block);
@@ -223,40 +576,50 @@ free (void *p)
       struct block *b = p;
       struct arena *a = block_to_arena (b);
       struct desc *d = a->desc;
-      
+
+      if (malloc_track)
+        tag_remove (p);
       if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
+          struct block *drain[MAGAZINE_SIZE / 2];
+          struct magazine *m;
+          enum intr_level old_level;
+          size_t cnt = 0;
 
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
-  
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
 
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
+          /* Fast path: keep the block in the magazine.  If
+             it is full, give half of it back to the free list. */
+          old_level = intr_disable ();
+          m = &d->mag;
+          if (m->cnt >= MAGAZINE_SIZE)
+            while (cnt < MAGAZINE_SIZE / 2)
+              drain[cnt++] = m->blocks[--m->cnt];
+          m->blocks[m->cnt++] = b;
+          intr_set_level (old_level);
+
+          if (cnt > 0)
             {
               size_t i;
 
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
+              lock_acquire (&d->lock);
+              for (i = 0; i < cnt; i++)
+                desc_give (d, drain[i]);
+              lock_release (&d->lock);
             }
-
-          lock_release (&d->lock);
         }
       else
         {
           /* It's a big block.  Free its pages. */
+          enum intr_level old_level = intr_disable ();
+          big_cnt--;
+          big_pages -= a->free_cnt;
+          intr_set_level (old_level);
+
           palloc_free_multiple (a, a->free_cnt);
           return;
         }
@@ -292,3 +655,123 @@ arena_to_block (struct arena *a, size_t idx)
                            + sizeof *a
                            + idx * a->desc->block_size);
 }
+
+/* Returns the tag table slot where block P belongs. */
+static size_t
+tag_hash (const void *p)
+{
+  return (uint32_t) ((uintptr_t) p * 2654435761u) >> (32 - TAG_BITS);
+}
+
+/* Records that SIZE bytes at P were allocated from SITE. */
+static void
+tag_add (void *p, size_t size, void *site)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (tag_cnt < TAG_CNT / 4 * 3)
+    {
+      size_t i = tag_hash (p);
+
+      while (tags[i].ptr != NULL)
+        i = (i + 1) % TAG_CNT;
+      tags[i].ptr = p;
+      tags[i].site = site;
+      tags[i].size = size;
+      tag_cnt++;
+    }
+  else
+    tag_dropped++;
+  intr_set_level (old_level);
+}
+
+/* Forgets the allocation at P, if it was recorded.  The entries
+   after it in the same run are moved back as needed, so that
+   lookups never have to skip over deleted slots. */
+static void
+tag_remove (void *p)
+{
+  enum intr_level old_level = intr_disable ();
+  size_t i, j;
+
+  for (i = tag_hash (p); tags[i].ptr != p; i = (i + 1) % TAG_CNT)
+    if (tags[i].ptr == NULL)
+      {
+        intr_set_level (old_level);
+        return;
+      }
+
+  for (j = (i + 1) % TAG_CNT; tags[j].ptr != NULL; j = (j + 1) % TAG_CNT)
+    {
+      /* The entry at J may fill the hole at I unless its home
+         slot lies cyclically in (I, J]. */
+      size_t home = tag_hash (tags[j].ptr);
+      if (i <= j ? home <= i || home > j : home <= i && home > j)
+        {
+          tags[i] = tags[j];
+          i = j;
+        }
+    }
+  tags[i].ptr = NULL;
+  tag_cnt--;
+  intr_set_level (old_level);
+}
+
+/* Prints the recorded allocations that are still outstanding,
+   summed by call site, largest first.  The addresses can be
+   turned into function names with the "backtrace" tool. */
+static void
+print_tags (void)
+{
+  struct site_total sites[TAG_SITE_MAX];
+  size_t site_cnt = 0, other_cnt = 0, other_bytes = 0;
+  enum intr_level old_level;
+  size_t i, j;
+
+  /* Sum the table by site with interrupts off, to get a
+     consistent snapshot, then print with them on. */
+  old_level = intr_disable ();
+  for (i = 0; i < TAG_CNT; i++)
+    if (tags[i].ptr != NULL)
+      {
+        for (j = 0; j < site_cnt; j++)
+          if (sites[j].site == tags[i].site)
+            break;
+        if (j < site_cnt)
+          {
+            sites[j].cnt++;
+            sites[j].bytes += tags[i].size;
+          }
+        else if (site_cnt < TAG_SITE_MAX)
+          {
+            sites[site_cnt].site = tags[i].site;
+            sites[site_cnt].cnt = 1;
+            sites[site_cnt].bytes = tags[i].size;
+            site_cnt++;
+          }
+        else
+          {
+            other_cnt++;
+            other_bytes += tags[i].size;
+          }
+      }
+  intr_set_level (old_level);
+
+  /* Sort by bytes, descending. */
+  for (i = 1; i < site_cnt; i++)
+    for (j = i; j > 0 && sites[j].bytes > sites[j - 1].bytes; j--)
+      {
+        struct site_total t = sites[j];
+        sites[j] = sites[j - 1];
+        sites[j - 1] = t;
+      }
+
+  printf ("Malloc outstanding allocations: %zu recorded, %zu not recorded\n",
+          tag_cnt, tag_dropped);
+  for (i = 0; i < site_cnt; i++)
+    printf ("  %p: %zu allocations, %zu bytes\n",
+            sites[i].site, sites[i].cnt, sites[i].bytes);
+  if (other_cnt > 0)
+    printf ("  other sites: %zu allocations, %zu bytes\n",
+            other_cnt, other_bytes);
+}
@@ -2,12 +2,29 @@
 #define THREADS_MALLOC_H
 
 #include <debug.h>
+#include <stdbool.h>
 #include <stddef.h>
 
+/* If true, record allocation sites for malloc_print_stats().
+   Controlled by kernel command-line option "-mtrack". */
+extern bool malloc_track;
+
 void malloc_init (void);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
 void free (void *);
 
+/* Object caches. */
+struct kmem_cache;
+struct kstat_mem;
+typedef void kmem_ctor_func (void *object);
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+                                      kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *) __attribute__ ((malloc));
+void kmem_cache_free (struct kmem_cache *, void *);
+
+void malloc_get_kstat (struct kstat_mem *);
+void malloc_print_stats (void);
+
 #endif /* threads/malloc.h */
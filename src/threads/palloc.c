@@ -2,13 +2,15 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <kstat.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,22 +25,78 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is managed as a binary buddy system.  Its free
+   memory is kept as blocks of 2**ORDER pages, aligned to their
+   size relative to the pool base, on one free list per order.
+   An allocation splits the smallest large enough free block in
+   halves until it has the order it needs, and a free merges a
+   block with its "buddy", the other half of the block it came
+   from, for as long as the buddy is free too.  Both take time
+   logarithmic in the pool size.  A request for a number of pages
+   that is not a power of 2 gives the unused tail of its block
+   back at once.
+
+   Pages are freed from the scheduler, which cannot take a lock,
+   so the pools are protected by disabling interrupts.
+
+   A pool that runs out of pages borrows from the other one, as
+   long as that leaves the lender its reserve of free pages, so
+   that user pages are not evicted to swap while kernel pages sit
+   unused, or the other way around.  A lent page goes back to the
+   pool it came from when it is freed, found by its address. */
+
+/* Fraction of a pool's pages kept from lending: 1/LEND_RESERVE_DIV. */
+#define LEND_RESERVE_DIV 8
+
+/* Largest block order: blocks of up to 2**BUDDY_ORDER_MAX pages. */
+#define BUDDY_ORDER_MAX 10
+
+/* Entries in a pool's order map.  The first page of each free
+   block is marked ORDER_FREE | order; other pages are 0. */
+#define ORDER_FREE 0x80
 
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
-    struct bitmap *used_map;            /* Bitmap of free pages. */
+    struct list free_lists[BUDDY_ORDER_MAX + 1]; /* Free blocks by order,
+                                                    linked through their
+                                                    first page. */
+    uint8_t *order_map;                 /* Order map, one byte per page. */
+    size_t page_cnt;                    /* Number of pages. */
+    size_t free_cnt;                    /* Number of free pages. */
+    size_t used_max;                    /* Most pages ever in use. */
+    size_t reserve;                     /* Free pages not to lend. */
+    size_t lent_cnt;                    /* Pages lent, in total. */
     uint8_t *base;                      /* Base of pool. */
+#ifndef NDEBUG
+    struct bitmap *used_map;            /* Allocated pages, for checks. */
+#endif
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Most free user pages kept zeroed ahead of time. */
+#define ZEROED_MAX 64
+
+/* Free user pages that the idle thread has already zeroed.
+   They are marked used in the pool's bitmap but still counted
+   in its free_cnt.  Protected by disabling interrupts, because
+   the idle thread must not block on a lock. */
+static void *zeroed_pages[ZEROED_MAX];
+static size_t zeroed_cnt;
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static void *take_zeroed_page (void);
+static struct pool *other_pool (const struct pool *);
+static size_t lendable_cnt (const struct pool *);
+static size_t buddy_alloc (struct pool *, size_t page_cnt, size_t reserve);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void buddy_free_block (struct pool *, size_t page_idx, int order);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -59,6 +117,10 @@ palloc_init (size_t user_page_limit)
   init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
   init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
              user_pages, "user pool");
+
+  /* An explicit limit on the user pool must hold. */
+  if (user_page_limit != SIZE_MAX)
+    kernel_pool.reserve = SIZE_MAX;
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -66,25 +128,38 @@ palloc_init (size_t user_page_limit)
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
    then the pages are filled with zeros.  If too few pages are
    available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
+   FLAGS, in which case the kernel panics.
+
+   A single zeroed user page comes from the pages zeroed by the
+   idle thread if there are any.  Those pages are also handed out
+   when the pool has no other free page.  Failing that, the pages
+   are borrowed from the other pool if it can spare them. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  bool single_user = pool == &user_pool && page_cnt == 1;
   void *pages;
   size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  if (single_user && (flags & PAL_ZERO)
+      && (pages = take_zeroed_page ()) != NULL)
+    return pages;
 
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
+  page_idx = buddy_alloc (pool, page_cnt, 0);
+  if (page_idx == BITMAP_ERROR)
+    {
+      if (single_user && (pages = take_zeroed_page ()) != NULL)
+        return pages;
+      pool = other_pool (pool);
+      page_idx = buddy_alloc (pool, page_cnt, pool->reserve);
+      if (page_idx != BITMAP_ERROR)
+        pool->lent_cnt += page_cnt;
+    }
+  pages = page_idx != BITMAP_ERROR ? pool->base + PGSIZE * page_idx : NULL;
 
   if (pages != NULL) 
     {
@@ -118,6 +193,7 @@ void
 palloc_free_multiple (void *pages, size_t page_cnt) 
 {
   struct pool *pool;
+  enum intr_level old_level;
   size_t page_idx;
 
   ASSERT (pg_ofs (pages) == 0);
@@ -137,8 +213,14 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  old_level = intr_disable ();
+#ifndef NDEBUG
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+#endif
+  buddy_free (pool, page_idx, page_cnt);
+  pool->free_cnt += page_cnt;
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -148,25 +230,164 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Zeroes one free user page, if fewer than ZEROED_MAX are
+   zeroed already, and keeps it for later PAL_ZERO allocations.
+   Called by the idle thread, so it never blocks.  Returns true if
+   it zeroed a page, false if there was nothing to do. */
+bool
+palloc_zero_idle (void)
+{
+  struct pool *pool = &user_pool;
+  enum intr_level old_level;
+  size_t page_idx;
+  void *page;
+
+  if (zeroed_cnt >= ZEROED_MAX)
+    return false;
+  old_level = intr_disable ();
+  page_idx = buddy_alloc (pool, 1, 0);
+  if (page_idx != BITMAP_ERROR)
+    pool->free_cnt++;
+  intr_set_level (old_level);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  page = pool->base + PGSIZE * page_idx;
+  memset (page, 0, PGSIZE);
+
+  old_level = intr_disable ();
+  if (zeroed_cnt < ZEROED_MAX)
+    {
+      zeroed_pages[zeroed_cnt++] = page;
+      page = NULL;
+    }
+  intr_set_level (old_level);
+
+  /* Someone else filled the last slot meanwhile.  The page never
+     left free_cnt, so it only goes back to the free lists. */
+  if (page != NULL)
+    {
+      old_level = intr_disable ();
+#ifndef NDEBUG
+      bitmap_reset (pool->used_map, page_idx);
+#endif
+      buddy_free (pool, page_idx, 1);
+      intr_set_level (old_level);
+    }
+  return true;
+}
+
+/* Returns the number of pages available to allocations from the
+   user pool if PAL_USER is set in FLAGS, otherwise from the kernel
+   pool: the pool's own free pages plus those the other pool can
+   lend.  The count may be out of date by the time it is
+   returned. */
+size_t
+palloc_free_cnt (enum palloc_flags flags)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+
+  return pool->free_cnt + lendable_cnt (other_pool (pool));
+}
+
+/* Stores the size of each pool and the pages of it in use in
+   STATS. */
+void
+palloc_get_kstat (struct kstat_mem *stats)
+{
+  enum intr_level old_level = intr_disable ();
+
+  stats->kernel_pages = kernel_pool.page_cnt;
+  stats->kernel_used = kernel_pool.page_cnt - kernel_pool.free_cnt;
+  stats->user_pages = user_pool.page_cnt;
+  stats->user_used = user_pool.page_cnt - user_pool.free_cnt;
+  intr_set_level (old_level);
+}
+
+/* Prints how many pages of each pool are in use, the most that
+   ever were, and how many each pool has lent to the other. */
+void
+palloc_print_stats (void)
+{
+  printf ("Palloc: kernel %zu of %zu pages in use (peak %zu), %zu lent; "
+          "user %zu of %zu pages in use (peak %zu), %zu lent\n",
+          kernel_pool.page_cnt - kernel_pool.free_cnt, kernel_pool.page_cnt,
+          kernel_pool.used_max, kernel_pool.lent_cnt,
+          user_pool.page_cnt - user_pool.free_cnt, user_pool.page_cnt,
+          user_pool.used_max, user_pool.lent_cnt);
+}
+
+/* Returns the pool that POOL borrows from. */
+static struct pool *
+other_pool (const struct pool *pool)
+{
+  return pool == &user_pool ? &kernel_pool : &user_pool;
+}
+
+/* Returns the number of free pages POOL can lend. */
+static size_t
+lendable_cnt (const struct pool *pool)
+{
+  size_t free_cnt = pool->free_cnt;
+
+  return free_cnt > pool->reserve ? free_cnt - pool->reserve : 0;
+}
+
+/* Removes a page from the pages zeroed by the idle thread and
+   returns it, or a null pointer if there is none. */
+static void *
+take_zeroed_page (void)
+{
+  enum intr_level old_level = intr_disable ();
+  void *page = NULL;
+
+  if (zeroed_cnt > 0)
+    {
+      page = zeroed_pages[--zeroed_cnt];
+      user_pool.free_cnt--;
+    }
+  intr_set_level (old_level);
+  return page;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
-    PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  /* We'll put the pool's order map, and its used_map in debug
+     builds, at its base.  Calculate the space needed for them and
+     subtract it from the pool's size. */
+  size_t meta_size = page_cnt;
+  size_t meta_pages;
+  int order;
+
+#ifndef NDEBUG
+  meta_size += bitmap_buf_size (page_cnt);
+#endif
+  meta_pages = DIV_ROUND_UP (meta_size, PGSIZE);
+  if (meta_pages > page_cnt)
+    PANIC ("Not enough memory in %s for its page map.", name);
+  page_cnt -= meta_pages;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
-  /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  /* Initialize the pool, with all of its pages free. */
+  for (order = 0; order <= BUDDY_ORDER_MAX; order++)
+    list_init (&p->free_lists[order]);
+  p->order_map = base;
+  memset (p->order_map, 0, page_cnt);
+#ifndef NDEBUG
+  p->used_map = bitmap_create_in_buf (page_cnt, p->order_map + page_cnt,
+                                      meta_pages * PGSIZE - page_cnt);
+#endif
+  p->base = base + meta_pages * PGSIZE;
+  p->page_cnt = page_cnt;
+  p->free_cnt = page_cnt;
+  p->used_max = 0;
+  p->reserve = page_cnt / LEND_RESERVE_DIV;
+  p->lent_cnt = 0;
+  buddy_free (p, 0, page_cnt);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -176,7 +397,113 @@ page_from_pool (const struct pool *pool, void *page)
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if no free block is big
+   enough or the allocation would leave POOL fewer than RESERVE
+   free pages.  Updates the free page count. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt, size_t reserve)
+{
+  enum intr_level old_level;
+  size_t page_idx;
+  int order, o;
+
+  /* Find the order needed. */
+  for (order = 0; order <= BUDDY_ORDER_MAX; order++)
+    if ((size_t) 1 << order >= page_cnt)
+      break;
+  if (order > BUDDY_ORDER_MAX)
+    return BITMAP_ERROR;
+
+  old_level = intr_disable ();
+
+  /* Take the smallest block that is big enough. */
+  for (o = order; o <= BUDDY_ORDER_MAX; o++)
+    if (!list_empty (&pool->free_lists[o]))
+      break;
+  if (o > BUDDY_ORDER_MAX || reserve > pool->free_cnt
+      || page_cnt > pool->free_cnt - reserve)
+    {
+      intr_set_level (old_level);
+      return BITMAP_ERROR;
+    }
+  page_idx = pg_no (list_pop_front (&pool->free_lists[o]))
+             - pg_no (pool->base);
+  pool->order_map[page_idx] = 0;
+
+  /* Split it, freeing the upper halves, until it has the right
+     order, then free the pages past PAGE_CNT. */
+  while (o > order)
+    {
+      o--;
+      buddy_free_block (pool, page_idx + ((size_t) 1 << o), o);
+    }
+  buddy_free (pool, page_idx + page_cnt, ((size_t) 1 << order) - page_cnt);
+
+#ifndef NDEBUG
+  ASSERT (!bitmap_contains (pool->used_map, page_idx, page_cnt, true));
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+#endif
+  pool->free_cnt -= page_cnt;
+  if (pool->page_cnt - pool->free_cnt > pool->used_max)
+    pool->used_max = pool->page_cnt - pool->free_cnt;
+  intr_set_level (old_level);
+
+  return page_idx;
+}
+
+/* Puts the PAGE_CNT pages of POOL starting at PAGE_IDX on the
+   free lists, as the biggest aligned blocks they divide into.
+   Does not update the free page count.  Must be called with
+   interrupts off. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (page_cnt > 0)
+    {
+      int order = 0;
+
+      while (order < BUDDY_ORDER_MAX
+             && (page_idx & ((size_t) 1 << order)) == 0
+             && (size_t) 2 << order <= page_cnt)
+        order++;
+      buddy_free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Puts the free block of 2**ORDER pages of POOL at PAGE_IDX on
+   its free list, merging it with its buddy for as long as the
+   buddy is free.  Must be called with interrupts off. */
+static void
+buddy_free_block (struct pool *pool, size_t page_idx, int order)
+{
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT ((page_idx & (((size_t) 1 << order) - 1)) == 0);
+
+  for (; order < BUDDY_ORDER_MAX; order++)
+    {
+      size_t buddy = page_idx ^ ((size_t) 1 << order);
+
+      if (buddy >= pool->page_cnt
+          || pool->order_map[buddy] != (ORDER_FREE | order))
+        break;
+      list_remove ((struct list_elem *) (pool->base + buddy * PGSIZE));
+      pool->order_map[buddy] = 0;
+      page_idx &= ~((size_t) 1 << order);
+    }
+
+  e = (struct list_elem *) (pool->base + page_idx * PGSIZE);
+  list_push_front (&pool->free_lists[order], e);
+  pool->order_map[page_idx] = ORDER_FREE | order;
+}
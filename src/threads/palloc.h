@@ -1,8 +1,11 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
+struct kstat_mem;
+
 /* How to allocate pages. */
 enum palloc_flags
   {
@@ -16,5 +19,9 @@ void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+size_t palloc_free_cnt (enum palloc_flags);
+bool palloc_zero_idle (void);
+void palloc_get_kstat (struct kstat_mem *);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
@@ -0,0 +1,126 @@
+#include "threads/profile.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "threads/vaddr.h"
+
+/* Number of distinct addresses the profiler can count, a power
+   of 2.  Samples of further addresses are only counted as
+   dropped. */
+#define PROFILE_BITS 12
+#define PROFILE_CNT (1 << PROFILE_BITS)
+
+/* Number of addresses printed by profile_print_stats(). */
+#define PROFILE_TOP 32
+
+/* Samples taken at one address. */
+struct profile_slot
+  {
+    uint32_t eip;               /* Sampled address, 0 if unused. */
+    unsigned cnt;               /* Samples taken there. */
+  };
+
+/* Set by the -profile kernel option. */
+bool profile_enabled;
+
+/* Open-addressed hash table of sampled addresses, with linear
+   probing.  Only the timer interrupt handler adds to it, so it
+   needs no other protection.  Only the bootstrap processor runs
+   the kernel, so one table serves. */
+static struct profile_slot slots[PROFILE_CNT];
+static unsigned slot_cnt;
+
+/* Sample counts. */
+static int64_t kernel_samples;  /* Samples in the kernel. */
+static int64_t user_samples;    /* Samples in user programs. */
+static int64_t dropped_samples; /* Samples not counted by address. */
+
+static int slot_cmp (const void *, const void *);
+
+/* Records a sample of the code interrupted by the timer
+   interrupt whose frame is F.  TICKS is the number of timer
+   ticks the interrupt accounts for: more than 1 when the timer
+   was stopped while the CPU was idle. */
+void
+profile_sample (const struct intr_frame *f, int ticks)
+{
+  uint32_t eip = (uint32_t) f->eip;
+  unsigned i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (is_user_vaddr (f->eip))
+    user_samples += ticks;
+  else
+    kernel_samples += ticks;
+
+  i = (eip * 2654435761u) >> (32 - PROFILE_BITS);
+  for (;;)
+    {
+      struct profile_slot *s = &slots[i];
+
+      if (s->eip == eip)
+        {
+          s->cnt += ticks;
+          return;
+        }
+      if (s->eip == 0)
+        {
+          /* Keep a quarter of the table free so that probes stay
+             short. */
+          if (slot_cnt >= PROFILE_CNT / 4 * 3)
+            break;
+          s->eip = eip;
+          s->cnt = ticks;
+          slot_cnt++;
+          return;
+        }
+      i = (i + 1) & (PROFILE_CNT - 1);
+    }
+  dropped_samples += ticks;
+}
+
+/* Prints the number of samples taken and the addresses sampled
+   most often.  Sorts the table, so no samples may be taken
+   afterward. */
+void
+profile_print_stats (void)
+{
+  int64_t total = kernel_samples + user_samples;
+  unsigned i, n;
+
+  if (!profile_enabled || total == 0)
+    return;
+  profile_enabled = false;
+
+  printf ("Profile: %lld samples, %lld kernel, %lld user, "
+          "%lld not counted by address\n",
+          total, kernel_samples, user_samples, dropped_samples);
+
+  qsort (slots, PROFILE_CNT, sizeof *slots, slot_cmp);
+  n = slot_cnt < PROFILE_TOP ? slot_cnt : PROFILE_TOP;
+  for (i = 0; i < n; i++)
+    printf ("Profile: %6u %3lld%% %#010"PRIx32" %s\n",
+            slots[i].cnt, slots[i].cnt * 100 / total, slots[i].eip,
+            is_user_vaddr ((void *) slots[i].eip) ? "user" : "kernel");
+
+  /* One line to paste into backtrace.  The user addresses belong
+     to whichever programs were running, so only kernel addresses
+     are listed. */
+  printf ("Profile addresses:");
+  for (i = 0; i < n; i++)
+    if (!is_user_vaddr ((void *) slots[i].eip))
+      printf (" %#"PRIx32, slots[i].eip);
+  printf ("\n");
+}
+
+/* Orders profile slots by decreasing sample count. */
+static int
+slot_cmp (const void *a_, const void *b_)
+{
+  const struct profile_slot *a = a_;
+  const struct profile_slot *b = b_;
+
+  return a->cnt < b->cnt ? 1 : a->cnt > b->cnt ? -1 : 0;
+}
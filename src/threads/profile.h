@@ -0,0 +1,19 @@
+#ifndef THREADS_PROFILE_H
+#define THREADS_PROFILE_H
+
+#include <stdbool.h>
+#include "threads/interrupt.h"
+
+/* Sampling profiler.
+
+   When enabled with the -profile kernel option, each timer
+   interrupt records the address of the instruction that it
+   interrupted.  At shutdown, the addresses sampled most often
+   are printed in a form that can be given to the backtrace
+   utility to find the functions they are in. */
+extern bool profile_enabled;
+
+void profile_sample (const struct intr_frame *, int ticks);
+void profile_print_stats (void);
+
+#endif /* threads/profile.h */
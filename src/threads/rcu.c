@@ -0,0 +1,146 @@
+#include "threads/rcu.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+
+/* Number of context switches so far.  A callback retired with
+   one count is run once the count has moved on. */
+static volatile unsigned gp_cnt;
+
+/* Callbacks waiting for their grace periods, oldest first, and
+   the deferred work that runs them.  The list is protected by
+   disabling interrupts, so that call_rcu() may be called from
+   anywhere. */
+static struct list callbacks;
+static struct intr_work callback_work;
+
+static void run_callbacks (void *aux);
+
+/* Initializes read-copy-update.  Callbacks queued from here on
+   run once the deferred work thread starts. */
+void
+rcu_init (void)
+{
+  list_init (&callbacks);
+  intr_work_init (&callback_work, run_callbacks, NULL);
+}
+
+/* Enters a read section.  Until the matching rcu_read_unlock(),
+   the running thread is not preempted, and it must not sleep. */
+void
+rcu_read_lock (void)
+{
+  thread_current ()->rcu_nesting++;
+  barrier ();
+}
+
+/* Leaves a read section.  Leaving the outermost one gives up the
+   CPU if a preemption was put off meanwhile. */
+void
+rcu_read_unlock (void)
+{
+  struct thread *t = thread_current ();
+
+  barrier ();
+  ASSERT (t->rcu_nesting > 0);
+  if (--t->rcu_nesting == 0 && t->rcu_preempt_owed)
+    {
+      t->rcu_preempt_owed = false;
+      if (intr_context ())
+        intr_yield_on_return ();
+      else if (intr_get_level () == INTR_ON)
+        thread_yield_preempted ();
+    }
+}
+
+/* Returns true if the running thread is in a read section. */
+bool
+rcu_read_held (void)
+{
+  return thread_current ()->rcu_nesting > 0;
+}
+
+/* Arranges for FUNC to be called with HEAD, from a kernel
+   thread, once every read section under way now has ended.  May
+   be called from an interrupt handler or with interrupts off. */
+void
+call_rcu (struct rcu_head *head, rcu_func *func)
+{
+  enum intr_level old_level;
+
+  ASSERT (head != NULL && func != NULL);
+
+  head->func = func;
+  old_level = intr_disable ();
+  head->gp = gp_cnt;
+  list_push_back (&callbacks, &head->elem);
+  intr_set_level (old_level);
+  intr_work_queue (&callback_work);
+}
+
+/* Waits until every read section under way now has ended.  Must
+   not be called in a read section. */
+void
+synchronize_rcu (void)
+{
+  unsigned gp = gp_cnt;
+
+  ASSERT (!intr_context ());
+  ASSERT (!rcu_read_held ());
+
+  while (gp_cnt == gp)
+    thread_yield ();
+}
+
+/* Called by the scheduler when the running thread is about to be
+   preempted.  Returns true, recording the preemption to be made
+   up by rcu_read_unlock(), if the thread is in a read section. */
+bool
+rcu_defer_preemption (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->rcu_nesting == 0)
+    return false;
+  t->rcu_preempt_owed = true;
+  return true;
+}
+
+/* Called by the scheduler with interrupts off at each context
+   switch, a quiescent state. */
+void
+rcu_quiescent (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  gp_cnt++;
+}
+
+/* Runs the callbacks whose grace periods have passed, from the
+   deferred work thread.  One still in its grace period is waited
+   for by yielding, which is itself a context switch. */
+static void
+run_callbacks (void *aux UNUSED)
+{
+  for (;;)
+    {
+      enum intr_level old_level = intr_disable ();
+      struct rcu_head *head;
+
+      if (list_empty (&callbacks))
+        {
+          intr_set_level (old_level);
+          return;
+        }
+      head = list_entry (list_front (&callbacks), struct rcu_head, elem);
+      if (head->gp == gp_cnt)
+        {
+          intr_set_level (old_level);
+          thread_yield ();
+          continue;
+        }
+      list_pop_front (&callbacks);
+      intr_set_level (old_level);
+
+      head->func (head);
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef THREADS_RCU_H
+#define THREADS_RCU_H
+
+#include <list.h>
+#include <stdbool.h>
+#include "threads/synch.h"
+
+/* Read-copy-update, for data that is read far more often than
+   it is changed.
+
+   A reader brackets its accesses with rcu_read_lock() and
+   rcu_read_unlock() instead of taking a lock.  It may not sleep
+   in between, and it is not preempted: a preemption that comes
+   due is put off until the outermost rcu_read_unlock().  Read
+   sections nest and may also be entered by interrupt handlers.
+
+   A writer, serialized against other writers by a lock of its
+   own, never changes an object that a reader may be looking at.
+   It builds a new version and publishes it with
+   rcu_assign_pointer(), or unlinks the old one, and then hands
+   the old version to call_rcu(), which frees it, or whatever
+   else its function does, once every reader that could have
+   seen it is done.  synchronize_rcu() waits for the same thing
+   instead.  Readers load published pointers with
+   rcu_dereference().
+
+   A context switch is a quiescent state: a thread cannot be
+   switched out inside a read section, so once the CPU has
+   switched threads after an object was retired, no reader still
+   holds it.  With a single CPU running, as now, that one switch
+   ends the grace period; other CPUs would each have to pass a
+   quiescent state too. */
+
+/* Called once a grace period has passed since it was handed to
+   call_rcu().  Typically frees the structure that contains
+   HEAD. */
+struct rcu_head;
+typedef void rcu_func (struct rcu_head *head);
+
+/* Callback waiting for a grace period, embedded in the retired
+   structure. */
+struct rcu_head
+  {
+    struct list_elem elem;      /* Element in the callback list. */
+    rcu_func *func;             /* Function to call. */
+    unsigned gp;                /* Context switches when retired. */
+  };
+
+/* Loads pointer P, published by rcu_assign_pointer(), in a read
+   section.  The object it points to is not read before P. */
+#define rcu_dereference(P)                                      \
+        ({                                                      \
+          typeof (P) rcu_p_ = *(typeof (P) volatile *) &(P);    \
+          barrier ();                                           \
+          rcu_p_;                                               \
+        })
+
+/* Publishes V as the new value of pointer P, after everything
+   the writer stored into the object V points to. */
+#define rcu_assign_pointer(P, V)                                \
+        do                                                      \
+          {                                                     \
+            barrier ();                                         \
+            *(typeof (P) volatile *) &(P) = (V);                \
+          }                                                     \
+        while (0)
+
+void rcu_init (void);
+void rcu_read_lock (void);
+void rcu_read_unlock (void);
+bool rcu_read_held (void);
+void call_rcu (struct rcu_head *, rcu_func *);
+void synchronize_rcu (void);
+
+/* For the scheduler. */
+bool rcu_defer_preemption (void);
+void rcu_quiescent (void);
+
+#endif /* threads/rcu.h */
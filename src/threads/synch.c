@@ -29,8 +29,61 @@
 #include "threads/synch.h"
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Most threads a priority donation is passed on to, following
+   the chain of lock holders that wait for another lock. */
+#define DONATION_DEPTH_MAX 8
+
+/* Lock profiling.  Locks created with lock_init_named() get a
+   profile that counts acquisitions and records how long the lock
+   is held.  Each acquisition also records the holder's call
+   stack, which a thread that has to wait for the lock copies as
+   a sample of who keeps it busy.  Printed by lock_print_stats()
+   at shutdown.  Profiles are never freed, so only locks that
+   live as long as the kernel should be named. */
+#define LOCK_PROFILE_MAX 48             /* Most named locks. */
+#define LOCK_BT_DEPTH 4                 /* Frames in a backtrace. */
+
+/* Number of times an adaptive lock yields to its holder before
+   blocking. */
+#define LOCK_ADAPTIVE_YIELDS 3
+
+/* Does lock_release() hand a contended lock straight to its
+   highest-priority waiter?  Otherwise the lock is only made free
+   and the waiter woken, to take it if no other thread has by the
+   time it runs.  The tunable sched.lock_handoff. */
+int lock_handoff = 1;
+
+struct lock_profile
+  {
+    const char *name;                   /* Name of the lock. */
+    struct lock *lock;                  /* The lock itself. */
+    unsigned acquire_cnt;               /* Number of acquisitions. */
+    unsigned yield_wins;                /* Acquired by yielding. */
+    unsigned yield_losses;              /* Blocked after yielding. */
+    unsigned handoffs;                  /* Handed to a waiter. */
+    unsigned morphs;                    /* Condition waiters moved to
+                                           the lock's waiters. */
+    unsigned rewaits;                   /* Woken, found it taken. */
+    int64_t max_hold;                   /* Longest hold, in ticks. */
+    int64_t acquired;                   /* When the holder got it. */
+    void *holder_bt[LOCK_BT_DEPTH];     /* Where the holder got it. */
+    void *sample_bt[LOCK_BT_DEPTH];     /* Holder's, at a contention. */
+  };
+static struct lock_profile profiles[LOCK_PROFILE_MAX];
+static size_t profile_cnt;
+
+static list_less_func waiter_less;
+static list_less_func cond_waiter_less;
+static void adaptive_wait (struct lock *);
+static void lock_wait (struct lock *, bool woken);
+static void hand_off (struct lock *);
+static void profile_acquired (struct lock *) NO_INLINE;
+static void save_backtrace (void **) NO_INLINE;
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -102,7 +155,8 @@ sema_try_down (struct semaphore *sema)
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any.
 
    This function may be called from an interrupt handler. */
 void
@@ -114,10 +168,14 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters)) 
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+    {
+      struct list_elem *e = list_max (&sema->waiters, waiter_less, NULL);
+      list_remove (e);
+      thread_unblock (list_entry (e, struct thread, elem));
+    }
   sema->value++;
   intr_set_level (old_level);
+  thread_preempt ();
 }
 
 static void sema_test_helper (void *sema_);
@@ -179,12 +237,58 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  lock->wait_cnt = 0;
+  lock->wait_ticks = 0;
+  lock->profile = NULL;
+  lock->adaptive = false;
+}
+
+/* Initializes LOCK like lock_init(), and gives it a profile under
+   NAME, which must outlive the lock.  If there are too many named
+   locks already, LOCK is not profiled. */
+void
+lock_init_named (struct lock *lock, const char *name)
+{
+  enum intr_level old_level;
+
+  ASSERT (name != NULL);
+
+  lock_init (lock);
+  old_level = intr_disable ();
+  if (profile_cnt < LOCK_PROFILE_MAX)
+    {
+      struct lock_profile *p = &profiles[profile_cnt++];
+
+      p->name = name;
+      p->lock = lock;
+      lock->profile = p;
+    }
+  intr_set_level (old_level);
+}
+
+/* Makes LOCK adaptive: a thread that finds it held first yields
+   the CPU a few times, in the hope that the holder releases it,
+   before it blocks.  Blocking costs a trip through the waiters
+   list and the scheduler in both lock_acquire() and
+   lock_release(), so this pays off for locks that are held only
+   briefly.  On a multiprocessor, spinning would be the thing to
+   do instead. */
+void
+lock_set_adaptive (struct lock *lock)
+{
+  ASSERT (lock != NULL);
+
+  lock->adaptive = true;
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
 
+   While waiting, the current thread donates its priority to the
+   holder of LOCK, and on to the holder of the lock that one
+   waits for, and so on, at most DONATION_DEPTH_MAX deep.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
@@ -192,12 +296,47 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  int64_t start = -1;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
-  sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
+  old_level = intr_disable ();
+  if (lock->holder != NULL && lock->adaptive)
+    adaptive_wait (lock);
+  if (lock->holder != NULL)
+    {
+      struct lock *l = lock;
+      int depth;
+
+      start = timer_ticks ();
+      if (lock->profile != NULL)
+        memcpy (lock->profile->sample_bt, lock->profile->holder_bt,
+                sizeof lock->profile->sample_bt);
+      cur->waiting_lock = lock;
+      for (depth = 0; !thread_mlfqs && depth < DONATION_DEPTH_MAX
+             && l != NULL && l->holder != NULL; depth++)
+        {
+          if (l->holder->priority >= cur->priority)
+            break;
+          thread_donate_priority (l->holder, cur->priority);
+          l = l->holder->waiting_lock;
+        }
+    }
+
+  lock_wait (lock, false);
+  if (start >= 0)
+    {
+      int64_t waited = timer_elapsed (start);
+
+      lock->wait_cnt++;
+      lock->wait_ticks += waited;
+      cur->stats.lock_ticks += waited;
+    }
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -216,11 +355,23 @@ lock_try_acquire (struct lock *lock)
 
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      enum intr_level old_level = intr_disable ();
+      lock->holder = thread_current ();
+      list_push_back (&lock->holder->held_locks, &lock->elem);
+      if (lock->profile != NULL)
+        profile_acquired (lock);
+      intr_set_level (old_level);
+    }
   return success;
 }
 
-/* Releases LOCK, which must be owned by the current thread.
+/* Releases LOCK, which must be owned by the current thread.  If
+   threads are waiting for LOCK and lock_handoff is set, the one
+   with the highest priority becomes its holder at once, so that
+   it neither races the releaser for it nor wakes up only to find
+   it taken again.  The priority donated for LOCK is given back,
+   and the thread yields if a waiter now outranks it.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
@@ -228,11 +379,66 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  /* Wake the next holder before dropping our priority, so that
+     no thread of middle priority can run in between. */
+  old_level = intr_disable ();
+  if (lock->profile != NULL)
+    {
+      int64_t held = timer_elapsed (lock->profile->acquired);
+
+      if (held > lock->profile->max_hold)
+        lock->profile->max_hold = held;
+    }
+  list_remove (&lock->elem);
   lock->holder = NULL;
-  sema_up (&lock->semaphore);
+  if (lock_handoff && !list_empty (&lock->semaphore.waiters))
+    hand_off (lock);
+  else
+    sema_up (&lock->semaphore);
+  if (!thread_mlfqs)
+    thread_update_priority (cur);
+  intr_set_level (old_level);
+  thread_preempt ();
+}
+
+/* Prints the profiles of the named locks that have been
+   used.  The backtraces can be decoded with the `backtrace'
+   program. */
+void
+lock_print_stats (void)
+{
+  size_t i, j;
+
+  for (i = 0; i < profile_cnt; i++)
+    {
+      const struct lock_profile *p = &profiles[i];
+
+      if (p->acquire_cnt == 0)
+        continue;
+      printf ("Lock %s: %u acquisitions, %u contended, %lld wait ticks, "
+              "%lld max hold ticks\n", p->name, p->acquire_cnt,
+              p->lock->wait_cnt, p->lock->wait_ticks, p->max_hold);
+      if (p->lock->adaptive)
+        printf ("  Adaptive: %u acquired by yielding, %u blocked anyway\n",
+                p->yield_wins, p->yield_losses);
+      if (p->handoffs > 0 || p->morphs > 0 || p->rewaits > 0)
+        printf ("  Handed off %u times, %u condition waiters moved, "
+                "%u woken to find it taken\n",
+                p->handoffs, p->morphs, p->rewaits);
+      if (p->lock->wait_cnt > 0)
+        {
+          printf ("  Holder at contention:");
+          for (j = 0; j < LOCK_BT_DEPTH && p->sample_bt[j] != NULL; j++)
+            printf (" %p", p->sample_bt[j]);
+          printf (".\n");
+        }
+    }
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -246,11 +452,11 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
-/* One semaphore in a list. */
-struct semaphore_elem 
+/* A thread waiting on a condition variable. */
+struct cond_waiter
   {
-    struct list_elem elem;              /* List element. */
-    struct semaphore semaphore;         /* This semaphore. */
+    struct list_elem elem;              /* Element in the waiters. */
+    struct thread *thread;              /* The waiting thread. */
   };
 
 /* Initializes condition variable COND.  A condition variable
@@ -280,6 +486,10 @@ cond_init (struct condition *cond)
    condition variables.  That is, there is a one-to-many mapping
    from locks to condition variables.
 
+   A signaled thread is not woken up, only to block again on LOCK
+   while the signaler still holds it.  It is moved to LOCK's
+   waiters instead, and wakes up once it can have LOCK.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
@@ -287,38 +497,57 @@ cond_init (struct condition *cond)
 void
 cond_wait (struct condition *cond, struct lock *lock) 
 {
-  struct semaphore_elem waiter;
+  struct cond_waiter waiter;
+  enum intr_level old_level;
 
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
   
-  sema_init (&waiter.semaphore, 0);
+  waiter.thread = thread_current ();
+  old_level = intr_disable ();
   list_push_back (&cond->waiters, &waiter.elem);
   lock_release (lock);
-  sema_down (&waiter.semaphore);
-  lock_acquire (lock);
+  thread_block ();
+  lock_wait (lock, true);
+  intr_set_level (old_level);
 }
 
 /* If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
+   this function signals the one with the highest priority to wake
+   up from its wait, by moving it to the waiters for LOCK, which
+   donates its priority to the caller.
    LOCK must be held before calling this function.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to signal a condition variable within an
    interrupt handler. */
 void
-cond_signal (struct condition *cond, struct lock *lock UNUSED) 
+cond_signal (struct condition *cond, struct lock *lock) 
 {
+  enum intr_level old_level;
+
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   if (!list_empty (&cond->waiters)) 
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+    {
+      struct list_elem *e = list_max (&cond->waiters, cond_waiter_less, NULL);
+      struct thread *t = list_entry (e, struct cond_waiter, elem)->thread;
+
+      list_remove (e);
+      t->waiting_lock = lock;
+      list_push_back (&lock->semaphore.waiters, &t->elem);
+      if (!thread_mlfqs)
+        thread_donate_priority (lock->holder, t->priority);
+      if (lock->profile != NULL)
+        lock->profile->morphs++;
+    }
+  intr_set_level (old_level);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -336,3 +565,277 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RWLOCK.  A reader/writer lock can be held by any
+   number of readers at once, or by a single writer.
+
+   Writers have preference: once a writer is waiting, new readers
+   wait too, so that a steady stream of readers can't starve
+   writers.  The lock is built from a lock and two condition
+   variables, so every thread that waits for it waits on
+   RWLOCK->LOCK's semaphore or a condition, in the same way as any
+   other lock waiter, and the holder of a write lock is recorded
+   in RWLOCK->WRITER. */
+void
+rwlock_init (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_init (&rwlock->lock);
+  cond_init (&rwlock->readers_ok);
+  cond_init (&rwlock->writers_ok);
+  rwlock->reader_cnt = 0;
+  rwlock->waiting_writer_cnt = 0;
+  rwlock->writer = NULL;
+}
+
+/* Acquires RWLOCK for reading, sleeping until no writer holds or
+   is waiting for it.  The current thread must not hold RWLOCK
+   for writing.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_by_current_thread (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  while (rwlock->writer != NULL || rwlock->waiting_writer_cnt > 0)
+    cond_wait (&rwlock->readers_ok, &rwlock->lock);
+  rwlock->reader_cnt++;
+  lock_release (&rwlock->lock);
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   reading. */
+void
+rwlock_release_read (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_acquire (&rwlock->lock);
+  ASSERT (rwlock->reader_cnt > 0);
+  if (--rwlock->reader_cnt == 0)
+    cond_signal (&rwlock->writers_ok, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
+/* Acquires RWLOCK for writing, sleeping until no other thread
+   holds it.  The current thread must not already hold RWLOCK.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_by_current_thread (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  rwlock->waiting_writer_cnt++;
+  while (rwlock->writer != NULL || rwlock->reader_cnt > 0)
+    cond_wait (&rwlock->writers_ok, &rwlock->lock);
+  rwlock->waiting_writer_cnt--;
+  rwlock->writer = thread_current ();
+  lock_release (&rwlock->lock);
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   writing.  Waiting writers go first; readers are let in only
+   when no writer is waiting. */
+void
+rwlock_release_write (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (rwlock_held_by_current_thread (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  rwlock->writer = NULL;
+  if (rwlock->waiting_writer_cnt > 0)
+    cond_signal (&rwlock->writers_ok, &rwlock->lock);
+  else
+    cond_broadcast (&rwlock->readers_ok, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
+/* Returns true if the current thread holds RWLOCK for writing,
+   false otherwise.  (Readers are not recorded.) */
+bool
+rwlock_held_by_current_thread (const struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  return rwlock->writer == thread_current ();
+}
+
+/* Returns true if thread A, waiting on a semaphore, has a lower
+   priority than thread B. */
+static bool
+waiter_less (const struct list_elem *a_, const struct list_elem *b_,
+             void *aux UNUSED)
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  return a->priority < b->priority;
+}
+
+/* Returns true if the thread waiting in cond_waiter A has a
+   lower priority than the one waiting in B. */
+static bool
+cond_waiter_less (const struct list_elem *a_, const struct list_elem *b_,
+                  void *aux UNUSED)
+{
+  const struct cond_waiter *a = list_entry (a_, struct cond_waiter, elem);
+  const struct cond_waiter *b = list_entry (b_, struct cond_waiter, elem);
+
+  return a->thread->priority < b->thread->priority;
+}
+
+/* Yields the CPU to give the holder of adaptive LOCK a chance to
+   release it, until it does or LOCK_ADAPTIVE_YIELDS yields have
+   passed.  Does not yield to a holder of lower priority, which
+   only runs once its priority is donated, by blocking.  Must be
+   called with interrupts off. */
+static void
+adaptive_wait (struct lock *lock)
+{
+  struct thread *cur = thread_current ();
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < LOCK_ADAPTIVE_YIELDS && lock->holder != NULL; i++)
+    {
+      if (!thread_mlfqs && !thread_stride
+          && lock->holder->priority < cur->priority)
+        break;
+      thread_yield ();
+    }
+
+  if (lock->profile != NULL)
+    {
+      if (lock->holder == NULL)
+        lock->profile->yield_wins++;
+      else
+        lock->profile->yield_losses++;
+    }
+}
+
+/* Makes the current thread the holder of LOCK, waiting first as
+   long as another thread holds it.  Returns at once if
+   lock_release() has already handed LOCK to this thread.  WOKEN
+   is true if the thread has just been woken up as a waiter for
+   LOCK, by lock_release() or after cond_signal() moved it there.
+   Must be called with interrupts off. */
+static void
+lock_wait (struct lock *lock, bool woken)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (lock->holder != cur)
+    {
+      if (lock->semaphore.value > 0)
+        {
+          lock->semaphore.value--;
+          lock->holder = cur;
+          list_push_back (&cur->held_locks, &lock->elem);
+          break;
+        }
+      if (woken && lock->profile != NULL)
+        lock->profile->rewaits++;
+      cur->waiting_lock = lock;
+      list_push_back (&lock->semaphore.waiters, &cur->elem);
+      thread_block ();
+      woken = true;
+    }
+  cur->waiting_lock = NULL;
+  if (lock->profile != NULL)
+    profile_acquired (lock);
+}
+
+/* Makes the highest-priority waiter for LOCK, which is not held,
+   its holder and wakes it up.  The new holder inherits the
+   priorities of the threads still waiting.  Must be called with
+   interrupts off. */
+static void
+hand_off (struct lock *lock)
+{
+  struct list_elem *e = list_max (&lock->semaphore.waiters, waiter_less,
+                                  NULL);
+  struct thread *t = list_entry (e, struct thread, elem);
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (lock->holder == NULL);
+
+  list_remove (e);
+  lock->holder = t;
+  list_push_back (&t->held_locks, &lock->elem);
+  t->waiting_lock = NULL;
+  if (!thread_mlfqs)
+    thread_update_priority (t);
+  if (lock->profile != NULL)
+    lock->profile->handoffs++;
+  thread_unblock (t);
+}
+
+/* Updates the profile of LOCK, which the current thread has just
+   acquired.  Must be called with interrupts off. */
+static void
+profile_acquired (struct lock *lock)
+{
+  struct lock_profile *p = lock->profile;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  p->acquire_cnt++;
+  p->acquired = timer_ticks ();
+  save_backtrace (p->holder_bt);
+}
+
+/* Stores the return addresses of up to LOCK_BT_DEPTH callers of
+   the lock functions in BT, padding with null pointers.  The walk
+   stays within the current thread's stack page, so that code
+   compiled without frame pointers yields garbage addresses
+   rather than a page fault. */
+static void
+save_backtrace (void **bt)
+{
+  void **frame = __builtin_frame_address (0);
+  void **top = (void **) ((uint8_t *) pg_round_down (frame) + PGSIZE);
+  int i;
+
+  /* Skip profile_acquired() and save_backtrace() themselves. */
+  for (i = 0; i < 2 && frame + 2 <= top; i++)
+    {
+      void **next = frame[0];
+
+      if (next <= frame)
+        break;
+      frame = next;
+    }
+
+  for (i = 0; i < LOCK_BT_DEPTH; i++)
+    {
+      void **next;
+
+      if (frame + 2 > top)
+        break;
+      bt[i] = frame[1];
+      next = frame[0];
+      if (next <= frame)
+        {
+          i++;
+          break;
+        }
+      frame = next;
+    }
+  for (; i < LOCK_BT_DEPTH; i++)
+    bt[i] = NULL;
+}
@@ -0,0 +1,180 @@
+#include "threads/sysctl.h"
+#include <debug.h>
+#include <limits.h>
+#include <string.h>
+
+/* Kernel tunables.
+
+   A subsystem registers each of its tunables during boot, with
+   the variable that holds it and the range of values it accepts,
+   and reads the variable wherever it would have used a constant.
+   Setting a tunable is a single store to the variable, so readers
+   need no lock; they see either the old value or the new one.
+
+   Registration ends before the first process runs, so the
+   registry itself is never changed while it is being read. */
+
+/* Most tunables. */
+#define SYSCTL_MAX 32
+
+/* Most -o options on the kernel command line. */
+#define SYSCTL_BOOT_MAX 16
+
+/* A registered tunable. */
+struct sysctl
+  {
+    const char *name;           /* Name, as SUBSYSTEM.NAME. */
+    int *value;                 /* Variable that holds it. */
+    int min, max;               /* Range of allowed values. */
+  };
+
+static struct sysctl sysctls[SYSCTL_MAX];
+static int sysctl_cnt;
+
+/* Settings from the kernel command line not yet applied, each a
+   "NAME=VALUE" string, or null once applied. */
+static const char *boot_settings[SYSCTL_BOOT_MAX];
+static int boot_setting_cnt;
+
+static struct sysctl *find_sysctl (const char *name);
+static void apply_boot_setting (struct sysctl *, const char **setting);
+static bool parse_int (const char *s, int *value);
+
+/* Registers tunable NAME, held in *VALUE, which accepts values
+   from MIN to MAX inclusive.  *VALUE must already hold its
+   default, which the kernel command line may then override. */
+void
+sysctl_register (const char *name, int *value, int min, int max)
+{
+  struct sysctl *s;
+  int i;
+
+  ASSERT (strlen (name) <= SYSCTL_NAME_MAX);
+  ASSERT (min <= *value && *value <= max);
+  ASSERT (find_sysctl (name) == NULL);
+  if (sysctl_cnt >= SYSCTL_MAX)
+    PANIC ("too many tunables");
+
+  s = &sysctls[sysctl_cnt++];
+  s->name = name;
+  s->value = value;
+  s->min = min;
+  s->max = max;
+  for (i = 0; i < boot_setting_cnt; i++)
+    if (boot_settings[i] != NULL)
+      apply_boot_setting (s, &boot_settings[i]);
+}
+
+/* Stores the value of tunable NAME in *VALUE.  Returns false if
+   there is no such tunable. */
+bool
+sysctl_get (const char *name, int *value)
+{
+  struct sysctl *s = find_sysctl (name);
+
+  if (s == NULL)
+    return false;
+  *value = *s->value;
+  return true;
+}
+
+/* Sets tunable NAME to VALUE.  Returns false if there is no such
+   tunable or VALUE is out of its range. */
+bool
+sysctl_set (const char *name, int value)
+{
+  struct sysctl *s = find_sysctl (name);
+
+  if (s == NULL || value < s->min || value > s->max)
+    return false;
+  *s->value = value;
+  return true;
+}
+
+/* Notes SETTING, given as "-o=NAME=VALUE" on the kernel command
+   line, to be applied when tunable NAME is registered.  Panics if
+   SETTING is malformed. */
+void
+sysctl_set_boot (const char *setting)
+{
+  if (setting == NULL || setting[0] == '=' || strchr (setting, '=') == NULL)
+    PANIC ("bad tunable setting `%s' (use -o=NAME=VALUE)",
+           setting != NULL ? setting : "");
+  if (boot_setting_cnt >= SYSCTL_BOOT_MAX)
+    PANIC ("too many -o options");
+  boot_settings[boot_setting_cnt++] = setting;
+}
+
+/* Panics if a tunable set on the kernel command line was never
+   registered.  Called once every subsystem is initialized. */
+void
+sysctl_check_boot (void)
+{
+  int i;
+
+  for (i = 0; i < boot_setting_cnt; i++)
+    if (boot_settings[i] != NULL)
+      PANIC ("unknown tunable in `-o=%s'", boot_settings[i]);
+}
+
+/* Returns the tunable called NAME, or a null pointer if there is
+   none. */
+static struct sysctl *
+find_sysctl (const char *name)
+{
+  int i;
+
+  for (i = 0; i < sysctl_cnt; i++)
+    if (!strcmp (sysctls[i].name, name))
+      return &sysctls[i];
+  return NULL;
+}
+
+/* Applies *SETTING, a "NAME=VALUE" string from the kernel command
+   line, to S if NAME is S's name, and then nulls out *SETTING.
+   Panics if VALUE is not a number in S's range. */
+static void
+apply_boot_setting (struct sysctl *s, const char **setting)
+{
+  size_t len = strlen (s->name);
+  int value;
+
+  if (strlen (*setting) <= len || memcmp (*setting, s->name, len)
+      || (*setting)[len] != '=')
+    return;
+  if (!parse_int (*setting + len + 1, &value)
+      || value < s->min || value > s->max)
+    PANIC ("bad value in `-o=%s' (range is %d to %d)",
+           *setting, s->min, s->max);
+  *s->value = value;
+  *setting = NULL;
+}
+
+/* Parses S, a decimal integer with an optional minus sign, into
+   *VALUE.  Returns false if S is empty, has anything else in it,
+   or does not fit in an int. */
+static bool
+parse_int (const char *s, int *value)
+{
+  bool negative = *s == '-';
+  long long v = 0;
+
+  if (negative)
+    s++;
+  if (*s == '\0')
+    return false;
+  for (; *s != '\0'; s++)
+    {
+      if (*s < '0' || *s > '9')
+        return false;
+      v = v * 10 + (*s - '0');
+      if (v > (long long) INT_MAX + 1)
+        return false;
+    }
+  if (negative)
+    v = -v;
+  if (v > INT_MAX)
+    return false;
+  *value = v;
+  return true;
+}
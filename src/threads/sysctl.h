@@ -0,0 +1,15 @@
+#ifndef THREADS_SYSCTL_H
+#define THREADS_SYSCTL_H
+
+#include <stdbool.h>
+#include <sysctl.h>
+
+void sysctl_register (const char *name, int *value, int min, int max);
+bool sysctl_get (const char *name, int *value);
+bool sysctl_set (const char *name, int value);
+
+/* Values given on the kernel command line. */
+void sysctl_set_boot (const char *setting);
+void sysctl_check_boot (void);
+
+#endif /* threads/sysctl.h */
@@ -4,12 +4,19 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "threads/fixed-point.h"
 #include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/rcu.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
+#include "threads/sysctl.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -20,14 +27,37 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running: one list for each
+   priority, and a bitmap of the priorities whose list is not
+   empty, so that the highest is found with a bit scan.
+   Protected by disabling interrupts. */
+static struct list ready_lists[PRI_MAX + 1];
+static uint32_t ready_map[(PRI_MAX + 32) / 32];
+static int ready_cnt;
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
+/* Number of buckets in tid_table. */
+#define TID_BUCKET_CNT 64
+
+/* All threads, indexed by tid: a thread is in the bucket of its
+   tid modulo TID_BUCKET_CNT.  Tids are allocated sequentially,
+   so consecutive threads spread evenly over the buckets.  Like
+   all_list, protected by disabling interrupts. */
+static struct list tid_table[TID_BUCKET_CNT];
+
+/* Number of zeroed pages kept ready for new threads. */
+#define THREAD_POOL_SIZE 4
+
+/* Zeroed pages for thread_create(), so that creating a thread
+   does not have to wait for a page to be cleared. */
+static void *thread_pool[THREAD_POOL_SIZE];
+static size_t thread_pool_cnt;
+static struct lock thread_pool_lock;
+
 /* Idle thread. */
 static struct thread *idle_thread;
 
@@ -49,9 +79,26 @@ struct kernel_thread_frame
 static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
-
-/* Scheduling. */
-#define TIME_SLICE 4            /* # of timer ticks to give each thread. */
+static long long voluntary_cnt;  /* # of switches by blocking or yielding. */
+static long long involuntary_cnt; /* # of switches by preemption. */
+static bool preempting;         /* Is the running thread being preempted? */
+
+/* Run queue length histogram: RUNQ_HIST[N] is the number of timer
+   ticks at which N threads were ready, with the last bucket
+   counting all longer queues. */
+#define RUNQ_HIST_CNT 16
+static long long runq_hist[RUNQ_HIST_CNT];
+
+/* Scheduling.  A thread runs for SCHED_LATENCY ticks divided
+   among the threads that are ready, but at least TIME_SLICE_MIN
+   ticks, so that the time slice shrinks as the ready queue grows
+   and a thread with no competition is not interrupted for
+   nothing.  Both are tunables, sched.latency and
+   sched.slice_min. */
+#define SCHED_LATENCY 16        /* # of ticks to run each ready thread once. */
+#define TIME_SLICE_MIN 2        /* Shortest time slice. */
+static int sched_latency = SCHED_LATENCY;
+static int time_slice_min = TIME_SLICE_MIN;
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
 
 /* If false (default), use round-robin scheduler.
@@ -59,6 +106,30 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* Multi-level feedback queue scheduler.  Priorities are
+   recomputed every MLFQS_PRIORITY_TICKS ticks, but between the
+   once-a-second updates of every thread's recent_cpu only the
+   threads charged for the ticks they ran can change priority, so
+   only those, kept in charged_list, are recomputed.  Protected by
+   disabling interrupts. */
+#define MLFQS_PRIORITY_TICKS 4
+static fp_t load_avg;                   /* System load average. */
+static struct list charged_list;        /* Threads charged ticks. */
+
+/* Stride scheduler.  Each tick a thread runs advances its pass by
+   its stride, STRIDE1 divided by its tickets, and the ready
+   thread with the lowest pass runs next, so that threads get the
+   CPU in proportion to their tickets.  Ready threads are kept in
+   a heap ordered by pass.  A thread that becomes ready after
+   sleeping starts no earlier than global_pass, the pass of the
+   last thread scheduled, so it cannot make up for the time it
+   slept.
+   Protected by disabling interrupts. */
+bool thread_stride;
+#define STRIDE1 (1 << 20)
+static struct heap stride_heap;
+static int64_t global_pass;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -70,6 +141,17 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static struct list *tid_bucket (tid_t);
+static struct thread *alloc_thread_page (void);
+static void ready_insert (struct thread *);
+static int ready_max_priority (void);
+static void set_effective_priority (struct thread *, int);
+static void mlfqs_tick (struct thread *);
+static void mlfqs_update_priority (struct thread *);
+static unsigned time_slice (void);
+static void print_thread_stats (struct thread *, void *);
+static void account_switch (struct thread *cur, struct thread *next);
+static heap_less_func pass_less;
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -87,17 +169,31 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
+  size_t i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
-  lock_init (&tid_lock);
-  list_init (&ready_list);
+  lock_init_named (&tid_lock, "tid");
+  lock_init_named (&thread_pool_lock, "thread_pool");
+  for (i = 0; i <= PRI_MAX; i++)
+    list_init (&ready_lists[i]);
+  list_init (&charged_list);
+  heap_init (&stride_heap, pass_less, NULL);
   list_init (&all_list);
+  for (i = 0; i < TID_BUCKET_CNT; i++)
+    list_init (&tid_table[i]);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT);
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
+  list_push_back (tid_bucket (initial_thread->tid),
+                  &initial_thread->tid_elem);
+
+  sysctl_register ("sched.latency", &sched_latency, 1, 1000);
+  sysctl_register ("sched.slice_min", &time_slice_min, 1, 1000);
+  sysctl_register ("sched.lock_handoff", &lock_handoff, 0, 1);
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
@@ -118,13 +214,19 @@ thread_start (void)
 }
 
 /* Called by the timer interrupt handler at each timer tick.
-   Thus, this function runs in an external interrupt context. */
+   Thus, this function runs in an external interrupt context.
+   SKIPPED is true for a tick that passed while the timer was
+   stopped in the idle thread: it is charged to the idle thread,
+   even if another thread has started to run since, so that the
+   idle time neither adds to that thread's recent_cpu nor uses up
+   its time slice. */
 void
-thread_tick (void) 
+thread_tick (bool skipped) 
 {
-  struct thread *t = thread_current ();
+  struct thread *t = skipped ? idle_thread : thread_current ();
 
   /* Update statistics. */
+  runq_hist[ready_cnt < RUNQ_HIST_CNT ? ready_cnt : RUNQ_HIST_CNT - 1]++;
   if (t == idle_thread)
     idle_ticks++;
 #ifdef USERPROG
@@ -134,17 +236,78 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+  if (thread_stride && t != idle_thread)
+    t->pass += STRIDE1 / t->tickets;
+
   /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
+  if (!skipped && ++thread_ticks >= time_slice () && ready_cnt > 0)
     intr_yield_on_return ();
 }
 
+/* Returns the number of ticks the running thread may run before
+   it is preempted in favour of the READY_CNT threads waiting. */
+static unsigned
+time_slice (void)
+{
+  unsigned slice_min = time_slice_min;
+  unsigned slice = sched_latency / (ready_cnt + 1);
+
+  return slice > slice_min ? slice : slice_min;
+}
+
+/* Stores a snapshot of the scheduler statistics in STATS. */
+void
+thread_get_kstat (struct kstat_sched *stats)
+{
+  enum intr_level old_level = intr_disable ();
+
+  stats->ticks = timer_ticks ();
+  stats->idle_ticks = idle_ticks;
+  stats->kernel_ticks = kernel_ticks;
+  stats->user_ticks = user_ticks;
+  stats->voluntary = voluntary_cnt;
+  stats->involuntary = involuntary_cnt;
+  stats->thread_cnt = list_size (&all_list);
+  stats->ready_cnt = ready_cnt;
+  intr_set_level (old_level);
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) 
 {
+  enum intr_level old_level;
+  int i;
+
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  printf ("Thread: %lld voluntary switches, %lld involuntary switches\n",
+          voluntary_cnt, involuntary_cnt);
+  printf ("Thread: run queue length histogram (ticks):");
+  for (i = 0; i < RUNQ_HIST_CNT; i++)
+    if (runq_hist[i] != 0)
+      printf (" %d%s:%lld", i, i == RUNQ_HIST_CNT - 1 ? "+" : "",
+              runq_hist[i]);
+  printf ("\n");
+
+  old_level = intr_disable ();
+  thread_foreach (print_thread_stats, NULL);
+  intr_set_level (old_level);
+}
+
+/* Prints the scheduler statistics of thread T.  An action for
+   thread_foreach(). */
+static void
+print_thread_stats (struct thread *t, void *aux UNUSED)
+{
+  const struct sched_stats *s = &t->stats;
+
+  printf ("Thread %d (%s): %u voluntary, %u involuntary switches, "
+          "%lld run, %lld ready, %lld lock ticks\n",
+          t->tid, t->name, s->voluntary, s->involuntary,
+          s->run_ticks, s->ready_ticks, s->lock_ticks);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -159,9 +322,8 @@ thread_print_stats (void)
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   The new thread preempts the running thread if its PRIORITY is
+   higher. */
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux) 
@@ -176,7 +338,7 @@ thread_create (const char *name, int priority,
   ASSERT (function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  t = alloc_thread_page ();
   if (t == NULL)
     return TID_ERROR;
 
@@ -185,6 +347,8 @@ thread_create (const char *name, int priority,
   tid = t->tid = allocate_tid ();
 
   old_level=intr_disable();
+  list_push_back (tid_bucket (tid), &t->tid_elem);
+
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame (t, sizeof *kf);
   kf->eip = NULL;
@@ -201,25 +365,10 @@ thread_create (const char *name, int priority,
   sf->ebp = 0;
 
  intr_set_level(old_level);
-  
+
  /* Add to run queue. */
   thread_unblock (t);
   
-  #ifdef USERPROG
-  /** User Code**/
-  sema_init(&t->self_wait, 0);
-  t->return_status=0;
-  list_init(&t->all_files);
-  list_init(&t->children);
-  t->parent = thread_current();
-  if(thread_current()!=initial_thread)
-    list_push_back(&thread_current()->children, &t->child_elem);
-  t->exit_status=false;
-  
-#endif
-
- 
-
   return tid;
 }
 
@@ -243,10 +392,12 @@ thread_block (void)
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
 
-   This function does not preempt the running thread.  This can
-   be important: if the caller had disabled interrupts itself,
+   If T has a higher priority than the running thread, the
+   running thread is preempted, but only if the caller had
+   interrupts on, or on return from an interrupt handler.  This
+   can be important: if the caller had disabled interrupts itself,
    it may expect that it can atomically unblock a thread and
-   update other data. */
+   update other data, and should call thread_preempt() once done. */
 void
 thread_unblock (struct thread *t) 
 {
@@ -256,9 +407,39 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+  ready_insert (t);
   t->status = THREAD_READY;
   intr_set_level (old_level);
+
+  if (old_level == INTR_ON || intr_context ())
+    thread_preempt ();
+}
+
+/* Yields the CPU if a ready thread has a higher priority than
+   the running thread.  In an interrupt handler, the yield
+   happens on return from the interrupt.  Does nothing if
+   interrupts are off otherwise. */
+void
+thread_preempt (void)
+{
+  enum intr_level old_level;
+  bool preempt;
+
+  /* The stride scheduler only switches at the end of a time
+     slice. */
+  if (thread_stride)
+    return;
+
+  old_level = intr_disable ();
+  preempt = ready_max_priority () > running_thread ()->priority;
+
+  intr_set_level (old_level);
+  if (!preempt)
+    return;
+  if (intr_context ())
+    intr_yield_on_return ();
+  else if (old_level == INTR_ON)
+    thread_yield_preempted ();
 }
 
 /* Returns the name of the running thread. */
@@ -302,31 +483,18 @@ thread_exit (void)
   ASSERT (!intr_context ());
 
 #ifdef USERPROG
-struct list_elem *child_list;
-struct thread *current_thread = thread_current();
-struct thread *child_thread;
-
-for(child_list = list_begin(&current_thread->children); child_list!= list_end(&current_thread->children); child_list=list_next(child_list)) {
-  child_thread=list_entry(child_list, struct thread, child_elem);
-  if(child_thread->status == THREAD_BLOCKED && child_thread->exit_status)
-      thread_unblock(child_thread);
-  else {
-    child_thread->parent = NULL;
-    list_remove (&child_thread->child_elem);
-  }
-
-}
-
-process_exit ();
-if(current_thread->parent && current_thread->parent!=initial_thread)
-    list_remove(&current_thread->child_elem);
+  process_exit ();
 #endif
+  fpu_exit ();
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
   intr_disable ();
   list_remove (&thread_current()->allelem);
+  list_remove (&thread_current ()->tid_elem);
+  if (thread_current ()->charged)
+    list_remove (&thread_current ()->charged_elem);
   thread_current ()->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
@@ -344,12 +512,24 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread) 
-    list_push_back (&ready_list, &cur->elem);
+    ready_insert (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
 }
 
+/* Yields the CPU like thread_yield(), on behalf of a scheduler
+   that preempts the current thread, which is then counted as an
+   involuntary switch. */
+void
+thread_yield_preempted (void)
+{
+  if (rcu_defer_preemption ())
+    return;
+  preempting = true;
+  thread_yield ();
+}
+
 /* Invoke function 'func' on all threads, passing along 'aux'.
    This function must be called with interrupts off. */
 void
@@ -367,11 +547,94 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's base priority to NEW_PRIORITY, and
+   yields if it is no longer the highest.  Priority donated to the
+   thread stays in effect until the locks are released. */
 void
 thread_set_priority (int new_priority) 
 {
-  thread_current ()->priority = new_priority;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (new_priority >= PRI_MIN && new_priority <= PRI_MAX);
+
+  /* The MLFQS computes priorities itself. */
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  cur->base_priority = new_priority;
+  thread_update_priority (cur);
+  intr_set_level (old_level);
+  thread_preempt ();
+}
+
+/* Raises the effective priority of T to PRIORITY, if it is
+   lower.  The idle thread takes no donations: it runs only when
+   nothing else is ready, whatever its priority.  Must be called
+   with interrupts off. */
+void
+thread_donate_priority (struct thread *t, int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t != idle_thread && t->priority < priority)
+    set_effective_priority (t, priority);
+}
+
+/* Recomputes the effective priority of T: its base priority,
+   raised to that of the highest-priority thread waiting for a
+   lock T holds.  The waiters' own priorities already include
+   what was donated to them, so donation through nested locks is
+   kept.  Must be called with interrupts off. */
+void
+thread_update_priority (struct thread *t)
+{
+  int priority = t->base_priority;
+  struct list_elem *e, *w;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&t->held_locks); e != list_end (&t->held_locks);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, elem);
+      struct list *waiters = &lock->semaphore.waiters;
+
+      for (w = list_begin (waiters); w != list_end (waiters);
+           w = list_next (w))
+        {
+          struct thread *waiter = list_entry (w, struct thread, elem);
+          if (waiter->priority > priority)
+            priority = waiter->priority;
+        }
+    }
+  set_effective_priority (t, priority);
+}
+
+/* Sets the effective priority of T to PRIORITY, moving T to the
+   matching ready list if it is ready.  The idle thread is never
+   in a ready list, even when preempted, so its priority stays
+   as it is.  Must be called with interrupts off. */
+static void
+set_effective_priority (struct thread *t, int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t == idle_thread)
+    return;
+  if (t->status == THREAD_READY && t->priority != priority
+      && !thread_stride)
+    {
+      list_remove (&t->elem);
+      ready_cnt--;
+      if (list_empty (&ready_lists[t->priority]))
+        ready_map[t->priority / 32] &= ~(1u << (t->priority % 32));
+      t->priority = priority;
+      ready_insert (t);
+    }
+  else
+    t->priority = priority;
 }
 
 /* Returns the current thread's priority. */
@@ -381,35 +644,149 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE, recomputes its
+   priority and yields if it is no longer the highest. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_nice (int nice) 
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  if (nice < NICE_MIN)
+    nice = NICE_MIN;
+  else if (nice > NICE_MAX)
+    nice = NICE_MAX;
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    mlfqs_update_priority (cur);
+  intr_set_level (old_level);
+  thread_preempt ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load = CONVERT_TO_INT_NEAR (load_avg * 100);
+
+  intr_set_level (old_level);
+  return load;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent = CONVERT_TO_INT_NEAR (thread_current ()->recent_cpu * 100);
+
+  intr_set_level (old_level);
+  return recent;
+}
+
+/* Returns the current thread's tickets. */
+int
+thread_get_tickets (void)
+{
+  return thread_current ()->tickets;
+}
+
+/* Sets the current thread's tickets, its share of the CPU under
+   the stride scheduler, to TICKETS.  Returns false, changing
+   nothing, if TICKETS is out of range. */
+bool
+thread_set_tickets (int tickets)
+{
+  if (tickets < TICKETS_MIN || tickets > TICKETS_MAX)
+    return false;
+  thread_current ()->tickets = tickets;
+  return true;
+}
+
+/* Does the MLFQS accounting for a timer tick, with CUR running.
+   Runs in the timer interrupt handler. */
+static void
+mlfqs_tick (struct thread *cur)
+{
+  int64_t now = timer_ticks ();
+
+  if (cur != idle_thread)
+    {
+      cur->recent_cpu = INT_ADD (cur->recent_cpu, 1);
+      if (!cur->charged)
+        {
+          cur->charged = true;
+          list_push_back (&charged_list, &cur->charged_elem);
+        }
+    }
+
+  if (now % TIMER_FREQ == 0)
+    {
+      /* Once a second, decay every thread's recent_cpu, which
+         changes the priority of all of them. */
+      int running = ready_cnt + (cur != idle_thread ? 1 : 0);
+      fp_t decay;
+      struct list_elem *e;
+
+      load_avg = (59 * load_avg + CONVERT_TO_FP (running)) / 60;
+      decay = FP_DIV (2 * load_avg, 2 * load_avg + CONVERT_TO_FP (1));
+      for (e = list_begin (&all_list); e != list_end (&all_list);
+           e = list_next (e))
+        {
+          struct thread *t = list_entry (e, struct thread, allelem);
+
+          if (t == idle_thread)
+            continue;
+          t->recent_cpu = FP_MUL (decay, t->recent_cpu);
+          t->recent_cpu = INT_ADD (t->recent_cpu, t->nice);
+          mlfqs_update_priority (t);
+        }
+      while (!list_empty (&charged_list))
+        list_entry (list_pop_front (&charged_list), struct thread,
+                    charged_elem)->charged = false;
+    }
+  else if (now % MLFQS_PRIORITY_TICKS == 0)
+    while (!list_empty (&charged_list))
+      {
+        struct thread *t = list_entry (list_pop_front (&charged_list),
+                                       struct thread, charged_elem);
+        t->charged = false;
+        mlfqs_update_priority (t);
+      }
+  else
+    return;
+
+  if (ready_max_priority () > cur->priority)
+    intr_yield_on_return ();
+}
+
+/* Sets the priority of T from its recent_cpu and nice values,
+   as the MLFQS does.  Must be called with interrupts off. */
+static void
+mlfqs_update_priority (struct thread *t)
+{
+  int priority = CONVERT_TO_INT_ZERO (CONVERT_TO_FP (PRI_MAX)
+                                      - t->recent_cpu / 4
+                                      - CONVERT_TO_FP (t->nice * 2));
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  t->base_priority = priority;
+  set_effective_priority (t, priority);
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -434,6 +811,16 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Nothing else is ready, so zero a free page for later
+         allocations.  One page at a time, so that a thread woken
+         up meanwhile gets the CPU back at once. */
+      intr_enable ();
+      if (palloc_zero_idle ())
+        continue;
+      intr_disable ();
+      if (ready_cnt > 0)
+        continue;
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -446,6 +833,7 @@ idle (void *idle_started_ UNUSED)
 
          See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
          7.11.1 "HLT Instruction". */
+      timer_idle_enter ();
       asm volatile ("sti; hlt" : : : "memory");
     }
 }
@@ -497,8 +885,40 @@ init_thread (struct thread *t, const char *name, int priority)
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
-  t->priority = priority;
+  t->priority = t->base_priority = priority;
+  list_init (&t->held_locks);
+  t->io_class = BLOCK_CLASS_SYNC;
+  t->tickets = TICKETS_DEFAULT;
+  if (t != running_thread ())
+    {
+      /* A new thread gets its creator's share and starts at its
+         pass. */
+      t->tickets = running_thread ()->tickets;
+      t->pass = running_thread ()->pass;
+    }
+  if (thread_mlfqs && t != running_thread ())
+    {
+      /* A new thread inherits the scheduling state of its
+         creator. */
+      struct thread *parent = running_thread ();
+      t->nice = parent->nice;
+      t->recent_cpu = parent->recent_cpu;
+      old_level = intr_disable ();
+      mlfqs_update_priority (t);
+      intr_set_level (old_level);
+    }
   t->magic = THREAD_MAGIC;
+#ifdef USERPROG
+  t->process = t;
+  lock_init (&t->process_lock);
+  list_init (&t->threads);
+  cond_init (&t->threads_done);
+  list_init (&t->children);
+  t->return_status = -1;
+#endif
+#ifdef VM
+  list_init (&t->vm_regions);
+#endif
 
   old_level = intr_disable ();
   list_push_back (&all_list, &t->allelem);
@@ -526,10 +946,73 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  int pri;
+  struct list *ready;
+  struct thread *t;
+
+  if (thread_stride)
+    {
+      struct heap_elem *e = heap_pop (&stride_heap);
+      if (e == NULL)
+        return idle_thread;
+      t = heap_entry (e, struct thread, heap_elem);
+      ready_cnt--;
+      global_pass = t->pass;
+      return t;
+    }
+
+  pri = ready_max_priority ();
+  if (pri < PRI_MIN)
     return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+
+  ready = &ready_lists[pri];
+  t = list_entry (list_pop_front (ready), struct thread, elem);
+  ready_cnt--;
+  if (list_empty (ready))
+    ready_map[pri / 32] &= ~(1u << (pri % 32));
+  return t;
+}
+
+/* Adds T to the back of the ready list of its priority, or to
+   the stride heap.  Must be called with interrupts off. */
+static void
+ready_insert (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->priority >= PRI_MIN && t->priority <= PRI_MAX);
+
+  /* A thread that was blocked starts waiting to run now; one that
+     is yielding is accounted for by schedule(). */
+  if (t->status == THREAD_BLOCKED)
+    t->stats.stamp = timer_ticks ();
+
+  if (thread_stride)
+    {
+      if (t->pass < global_pass)
+        t->pass = global_pass;
+      heap_push (&stride_heap, &t->heap_elem);
+      ready_cnt++;
+      return;
+    }
+
+  list_push_back (&ready_lists[t->priority], &t->elem);
+  ready_map[t->priority / 32] |= 1u << (t->priority % 32);
+  ready_cnt++;
+}
+
+/* Returns the highest priority of a ready thread, or PRI_MIN - 1
+   if no thread is ready.  Must be called with interrupts off. */
+static int
+ready_max_priority (void)
+{
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = (PRI_MAX + 32) / 32 - 1; i >= 0; i--)
+    if (ready_map[i] != 0)
+      return i * 32 + 31 - __builtin_clz (ready_map[i]);
+  return PRI_MIN - 1;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -560,11 +1043,13 @@ thread_schedule_tail (struct thread *prev)
 
   /* Start new time slice. */
   thread_ticks = 0;
+  rcu_quiescent ();
 
 #ifdef USERPROG
   /* Activate the new address space. */
   process_activate ();
 #endif
+  fpu_switch (cur);
 
   /* If the thread we switched from is dying, destroy its struct
      thread.  This must happen late so that thread_exit() doesn't
@@ -594,13 +1079,46 @@ schedule (void)
 
   ASSERT (intr_get_level () == INTR_OFF);
   ASSERT (cur->status != THREAD_RUNNING);
+  ASSERT (cur->rcu_nesting == 0);
   ASSERT (is_thread (next));
 
+  if (cur == idle_thread)
+    timer_idle_exit ();
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      account_switch (cur, next);
+      TRACE (TRACE_SWITCH, cur->tid, next->tid);
+      prev = switch_threads (cur, next);
+    }
+  preempting = false;
   thread_schedule_tail (prev);
 }
 
+/* Updates the statistics of CUR, which stops running, and NEXT,
+   which starts. */
+static void
+account_switch (struct thread *cur, struct thread *next)
+{
+  int64_t now = timer_ticks ();
+
+  cur->stats.run_ticks += now - cur->stats.stamp;
+  cur->stats.stamp = now;
+  if (preempting)
+    {
+      cur->stats.involuntary++;
+      involuntary_cnt++;
+    }
+  else
+    {
+      cur->stats.voluntary++;
+      voluntary_cnt++;
+    }
+
+  if (next != idle_thread)
+    next->stats.ready_ticks += now - next->stats.stamp;
+  next->stats.stamp = now;
+}
+
 /* Returns a tid to use for a new thread. */
 static tid_t
 allocate_tid (void) 
@@ -616,22 +1134,77 @@ allocate_tid (void)
 }
 
 
-/** User Code **/
+/* Returns a zeroed page for a new thread, from the pool if it
+   has any, or a null pointer if memory is exhausted. */
+static struct thread *
+alloc_thread_page (void)
+{
+  void *page = NULL;
+
+  lock_acquire (&thread_pool_lock);
+  if (thread_pool_cnt > 0)
+    page = thread_pool[--thread_pool_cnt];
+  lock_release (&thread_pool_lock);
+
+  return page != NULL ? page : palloc_get_page (PAL_ZERO);
+}
+
+/* Fills up the pool of zeroed thread pages, as far as memory
+   allows.  Meant to be called in the background. */
+void
+thread_pool_fill (void)
+{
+  for (;;)
+    {
+      void *page;
+      bool full;
+
+      lock_acquire (&thread_pool_lock);
+      full = thread_pool_cnt == THREAD_POOL_SIZE;
+      lock_release (&thread_pool_lock);
+      if (full)
+        break;
+
+      page = palloc_get_page (PAL_ZERO);
+      if (page == NULL)
+        break;
+      lock_acquire (&thread_pool_lock);
+      if (thread_pool_cnt < THREAD_POOL_SIZE)
+        {
+          thread_pool[thread_pool_cnt++] = page;
+          page = NULL;
+        }
+      lock_release (&thread_pool_lock);
+      palloc_free_page (page);
+    }
+}
+
+/* Returns the list of tid_table that holds the thread with id
+   TID, if there is one. */
+static struct list *
+tid_bucket (tid_t tid)
+{
+  return &tid_table[(unsigned) tid % TID_BUCKET_CNT];
+}
+
+/* Returns the live thread with id TID, or a null pointer if
+   there is none.  Interrupts must be off, or the caller in a
+   read section (see threads/rcu.h), so that the thread cannot
+   exit meanwhile: it would have to run to exit. */
 struct thread *
 get_thread_by_tid (tid_t tid)
 {
-  struct list_elem *all_list_elem;
-  struct thread *return_thread;
-  
-  return_thread = NULL;
-  for (all_list_elem = list_begin (&all_list); all_list_elem != list_end (&all_list); all_list_elem = list_next (all_list_elem))
+  struct list *bucket = tid_bucket (tid);
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF || rcu_read_held ());
+  for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e))
     {
-      return_thread = list_entry (all_list_elem, struct thread, allelem);
-      ASSERT (is_thread (return_thread));
-      if (return_thread->tid == tid)
-        return return_thread;
+      struct thread *t = list_entry (e, struct thread, tid_elem);
+      ASSERT (is_thread (t));
+      if (t->tid == tid)
+        return t;
     }
-    
   return NULL;
 }
 
@@ -639,3 +1212,15 @@ get_thread_by_tid (tid_t tid)
 /* Offset of `stack' member within `struct thread'.
    Used by switch.S, which can't figure it out on its own. */
 uint32_t thread_stack_ofs = offsetof (struct thread, stack);
+
+/* Orders stride_heap: returns true if thread A has a lower pass
+   than thread B. */
+static bool
+pass_less (const struct heap_elem *a_, const struct heap_elem *b_,
+           void *aux UNUSED)
+{
+  const struct thread *a = heap_entry (a_, struct thread, heap_elem);
+  const struct thread *b = heap_entry (b_, struct thread, heap_elem);
+
+  return a->pass < b->pass;
+}
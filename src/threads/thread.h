@@ -2,9 +2,14 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
+#include <heap.h>
 #include <list.h>
 #include <stdint.h>
+#include <kstat.h>
+#include <vmstat.h>
 
+#include "threads/alarm.h"
 #include "threads/synch.h"
 
 /* States in a thread's life cycle. */
@@ -26,6 +31,15 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness, for the MLFQS. */
+#define NICE_MIN -20                    /* Nicest. */
+#define NICE_MAX 20                     /* Least nice. */
+
+/* Thread tickets, for the stride scheduler. */
+#define TICKETS_MIN 1                   /* Smallest share. */
+#define TICKETS_DEFAULT 100             /* Default share. */
+#define TICKETS_MAX 10000               /* Largest share. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -76,6 +90,17 @@ typedef int tid_t;
    the `magic' member of the running thread's `struct thread' is
    set to THREAD_MAGIC.  Stack overflow will normally change this
    value, triggering the assertion. */
+/* Scheduler statistics for a thread.  Times are in timer ticks. */
+struct sched_stats
+  {
+    unsigned voluntary;                 /* Switches by blocking or yielding. */
+    unsigned involuntary;               /* Switches by preemption. */
+    int64_t run_ticks;                  /* Time spent running. */
+    int64_t ready_ticks;                /* Time spent ready to run. */
+    int64_t lock_ticks;                 /* Time spent waiting for locks. */
+    int64_t stamp;                      /* Start of the current state. */
+  };
+
 /* The `elem' member has a dual purpose.  It can be an element in
    the run queue (thread.c), or it can be an element in a
    semaphore wait list (synch.c).  It can be used these two ways
@@ -89,26 +114,98 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Effective priority. */
+    int base_priority;                  /* Priority before donations. */
+    int nice;                           /* Niceness, for -mlfqs. */
+    int recent_cpu;                     /* Recent CPU use, 17.14 fixed
+                                           point, for -mlfqs. */
+    bool charged;                       /* In charged_list? */
+    struct list_elem charged_elem;      /* Element in charged_list. */
+    int tickets;                        /* CPU share, for -stride. */
+    int64_t pass;                       /* Stride virtual time. */
+    struct heap_elem heap_elem;         /* Element in stride_heap. */
     struct list_elem allelem;           /* List element for all threads list. */
+    struct list_elem tid_elem;          /* List element for tid table. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
+    struct list held_locks;             /* Locks held, for donation. */
+    struct lock *waiting_lock;          /* Lock being waited for. */
+    struct sched_stats stats;           /* Scheduler statistics. */
+
+    /* Owned by threads/alarm.c. */
+    struct alarm alrm;                  /* Wakeup for timer_sleep(). */
+
+    /* Owned by threads/fpu.c. */
+    void *fpu;                          /* FPU save area, or null if the
+                                           FPU was never used. */
+
+    /* Owned by threads/rcu.c. */
+    int rcu_nesting;                    /* Depth of read sections. */
+    bool rcu_preempt_owed;              /* Preemption put off until the
+                                           read sections end? */
+
+    /* Owned by devices/block.c. */
+    int io_class;                       /* Class of its block I/O, an
+                                           enum block_class. */
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    struct thread *process;             /* Thread that holds the state
+                                           of the process: this one,
+                                           or the process's first. */
+    struct lock process_lock;           /* Held by the thread of the
+                                           process in the kernel. */
+    struct list threads;                /* Other threads' child_status. */
+    int thread_cnt;                     /* Other threads not yet ended. */
+    struct condition threads_done;      /* Signaled as each one ends. */
+    bool exiting;                       /* Has any thread called exit()? */
 
         /** User Defined**/
     struct file *self_file;
-    struct semaphore self_wait; 
-    struct list children;
-    struct list_elem child_elem;
-    struct thread *parent;
-    bool exit_status;
-    int return_status;
-    struct list all_files;
+    struct child_status *self_status;   /* Shared with the parent. */
+    struct list children;               /* Children's child_status. */
+    int return_status;                  /* Exit code, -1 unless set. */
+    struct fd_entry *fds;               /* Open descriptors, by fd. */
+    int fd_cnt;                         /* Number of slots in FDS. */
+    int fd_free;                        /* No free slot below this fd. */
+    struct dir *cwd;                    /* Working directory, or null
+                                           for the root. */
+    int tlb_batch_depth;                /* Nesting of pagedir batches. */
+    bool tlb_stale;                     /* TLB flush owed at batch end. */
+    uint8_t *heap_start;                /* Start of the heap, just past
+                                           the executable's data. */
+    uint8_t *heap_end;                  /* End of the heap, the break. */
+    struct aio_context *aio;            /* Asynchronous I/O, or null. */
+    struct exec_image *trace_image;     /* Executable whose faults are
+                                           being traced, or null. */
+    bool strace;                        /* Trace its system calls? */
     
+#endif
+#ifdef FILESYS
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nesting of journal_begin(). */
+#endif
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash vm_pages;               /* Supplemental page table. */
+    struct list vm_regions;             /* File-backed regions. */
+    struct vm_mfile **mfiles;           /* Memory-mapped files, sorted
+                                           by address. */
+    size_t mfile_cnt;                   /* Number of mapped files. */
+    size_t mfile_cap;                   /* Number of slots in MFILES. */
+    void *user_esp;                     /* User stack pointer on entry
+                                           to the kernel. */
+    struct vmstat vm_stats;             /* Paging statistics. */
+    void *stack_low;                    /* Lowest page of last growth. */
+    size_t stack_ahead;                 /* Pages mapped ahead then. */
+    uint8_t *stack_top;                 /* Top of the user stack, or
+                                           null for the stack below
+                                           PHYS_BASE. */
+    uint32_t stack_slots;               /* Threads' stack slots in use. */
+    unsigned pff_faults;                /* Page faults since PFF_START. */
+    int64_t pff_start;                  /* Run time at the first one. */
 #endif
 
     /* Owned by thread.c. */
@@ -122,10 +219,16 @@ struct thread
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* If true, use the stride scheduler, which gives each thread a
+   share of the CPU in proportion to its tickets.
+   Controlled by kernel command-line option "-stride". */
+extern bool thread_stride;
+
 void thread_init (void);
 void thread_start (void);
 
-void thread_tick (void);
+void thread_tick (bool skipped);
+void thread_get_kstat (struct kstat_sched *);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
@@ -140,6 +243,8 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+void thread_yield_preempted (void);
+void thread_preempt (void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
@@ -147,12 +252,18 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_donate_priority (struct thread *, int);
+void thread_update_priority (struct thread *);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
+int thread_get_tickets (void);
+bool thread_set_tickets (int);
+
 struct thread *get_thread_by_tid (tid_t);
+void thread_pool_fill (void);
 
 #endif /* threads/thread.h */
@@ -0,0 +1,130 @@
+#include "threads/trace.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Pages of trace records. */
+#define TRACE_PAGES 32
+
+/* Records per line of trace_dump() output. */
+#define TRACE_LINE_RECORDS 8
+
+/* Ring of records.  It is only written with interrupts off, so
+   it needs no lock. */
+struct trace_ring
+  {
+    struct trace_record *records; /* Ring storage, null if none. */
+    uint32_t cap;               /* Number of records it holds. */
+    uint32_t head;              /* Records ever written. */
+  };
+
+/* Set by the -trace kernel option. */
+bool trace_enabled;
+
+static struct trace_ring ring;
+
+static void put_record (uint64_t tsc, enum trace_event,
+                        uint32_t arg0, uint32_t arg1);
+
+/* Allocates the ring.  Until this runs, events are not
+   recorded. */
+void
+trace_init (void)
+{
+  if (!trace_enabled)
+    return;
+  ring.records = palloc_get_multiple (PAL_ASSERT, TRACE_PAGES);
+  ring.cap = TRACE_PAGES * PGSIZE / sizeof *ring.records;
+  ring.head = 0;
+}
+
+/* Records EVENT with arguments ARG0 and ARG1 in the ring.  Use
+   the TRACE macro instead, which skips the call when tracing is
+   disabled. */
+void
+trace_event (enum trace_event event, uint32_t arg0, uint32_t arg1)
+{
+  trace_event_data (event, arg0, arg1, NULL, 0);
+}
+
+/* Records EVENT with arguments ARG0 and ARG1 like trace_event(),
+   followed by the CNT words in DATA in TRACE_DATA records, two to
+   a record and the last padded with 0.  The records go into the
+   ring one after another with the same time stamp, so that a
+   decoder finds the data of an event in the records after it.
+   Call only if tracing is enabled. */
+void
+trace_event_data (enum trace_event event, uint32_t arg0, uint32_t arg1,
+                  const uint32_t *data, size_t cnt)
+{
+  enum intr_level old_level;
+  uint64_t tsc;
+  size_t i;
+
+  if (ring.records == NULL)
+    return;
+
+  old_level = intr_disable ();
+  tsc = timer_cycles ();
+  put_record (tsc, event, arg0, arg1);
+  for (i = 0; i < cnt; i += 2)
+    put_record (tsc, TRACE_DATA,
+                data[i], i + 1 < cnt ? data[i + 1] : 0);
+  intr_set_level (old_level);
+}
+
+/* Appends a record to the ring, overwriting the oldest if it is
+   full.  Interrupts must be off. */
+static void
+put_record (uint64_t tsc, enum trace_event event,
+            uint32_t arg0, uint32_t arg1)
+{
+  struct trace_record *rec = &ring.records[ring.head++ % ring.cap];
+
+  rec->tsc = tsc;
+  rec->event = event;
+  rec->cpu = 0;
+  rec->arg0 = arg0;
+  rec->arg1 = arg1;
+}
+
+/* Writes the contents of the ring to the console, oldest record
+   first, and stops tracing.  Each record is written as the hex
+   of its bytes, TRACE_LINE_RECORDS to a line.  The header names
+   CPU 0, the only one, as utils/pintos-trace expects. */
+void
+trace_dump (void)
+{
+  uint32_t cnt, lost, n;
+
+  if (!trace_enabled)
+    return;
+  trace_enabled = false;
+
+  if (ring.records != NULL)
+    {
+      cnt = ring.head < ring.cap ? ring.head : ring.cap;
+      lost = ring.head - cnt;
+      printf ("Trace: version %d, cpu 0, %"PRIu32" records of %zu bytes, "
+              "%"PRIu32" overwritten\n",
+              TRACE_VERSION, cnt, sizeof *ring.records, lost);
+      for (n = 0; n < cnt; n++)
+        {
+          const uint8_t *p = (const uint8_t *) &ring.records[(lost + n)
+                                                             % ring.cap];
+          size_t j;
+
+          if (n % TRACE_LINE_RECORDS == 0)
+            printf ("Trace data: ");
+          for (j = 0; j < sizeof *ring.records; j++)
+            printf ("%02x", p[j]);
+          if (n % TRACE_LINE_RECORDS == TRACE_LINE_RECORDS - 1
+              || n == cnt - 1)
+            printf ("\n");
+        }
+    }
+  printf ("Trace end\n");
+}
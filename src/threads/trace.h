@@ -0,0 +1,73 @@
+#ifndef THREADS_TRACE_H
+#define THREADS_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel event trace.
+
+   When enabled with the -trace kernel option, the TRACE macro
+   appends a fixed-size binary record to a ring buffer.  When the
+   ring fills, the oldest records are overwritten.  At shutdown,
+   the ring is written to the console in hex, for
+   utils/pintos-trace to decode.
+
+   The layout of struct trace_record and the values of enum
+   trace_event are shared with utils/pintos-trace: change both
+   together, and bump TRACE_VERSION. */
+
+/* Version of the record layout. */
+#define TRACE_VERSION 2
+
+/* Traced events.  The comment on each gives its two
+   arguments. */
+enum trace_event
+  {
+    TRACE_SWITCH = 1,           /* Running tid, next tid. */
+    TRACE_PAGE_FAULT,           /* Fault address, error code. */
+    TRACE_EVICT,                /* Frame address, 1 if swapped out. */
+    TRACE_BLOCK_QUEUE,          /* Sector, count | TRACE_BLOCK_WRITE. */
+    TRACE_BLOCK_SUBMIT,         /* Sector, count | TRACE_BLOCK_WRITE. */
+    TRACE_BLOCK_DONE,           /* Sector, count | TRACE_BLOCK_WRITE. */
+    TRACE_SYSCALL_ENTER,        /* System call number, tid. */
+    TRACE_SYSCALL_EXIT,         /* System call number, return value. */
+    TRACE_STRACE,               /* Tid, call number | arg count << 16. */
+    TRACE_DATA                  /* Two more words of the event before. */
+  };
+
+/* A TRACE_STRACE record, for a system call of a process traced
+   with strace(), is followed by TRACE_DATA records that hold the
+   call's time in cycles, its return value and its arguments, two
+   words to a record. */
+
+/* Set in the count of a block event for a write. */
+#define TRACE_BLOCK_WRITE 0x80000000u
+
+/* One traced event, 20 bytes. */
+struct trace_record
+  {
+    uint64_t tsc;               /* Time-stamp counter. */
+    uint16_t event;             /* A TRACE_* event. */
+    uint16_t cpu;               /* CPU that recorded it, always 0. */
+    uint32_t arg0, arg1;        /* Event-specific arguments. */
+  };
+
+extern bool trace_enabled;
+
+/* Records EVENT with arguments A and B, if tracing is enabled.
+   Cheap enough to leave in hot paths: a load and a branch when
+   tracing is off. */
+#define TRACE(EVENT, A, B)                                              \
+        do {                                                            \
+          if (trace_enabled)                                            \
+            trace_event ((EVENT), (uint32_t) (A), (uint32_t) (B));      \
+        } while (0)
+
+void trace_init (void);
+void trace_event (enum trace_event, uint32_t arg0, uint32_t arg1);
+void trace_event_data (enum trace_event, uint32_t arg0, uint32_t arg1,
+                       const uint32_t *data, size_t cnt);
+void trace_dump (void);
+
+#endif /* threads/trace.h */
@@ -0,0 +1,256 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+
+/* All work queues, for workqueue_print_stats(). */
+static struct list all_queues = LIST_INITIALIZER (all_queues);
+
+static thread_func worker NO_RETURN;
+static timer_event_func delay_done;
+static void queue_item (struct workqueue *, struct work *);
+static list_less_func work_higher;
+
+/* Initializes WQ as the queue NAME and starts its pool of
+   THREAD_CNT threads.  NAME must live as long as WQ does, which
+   should be as long as the kernel. */
+void
+workqueue_init (struct workqueue *wq, const char *name, int thread_cnt)
+{
+  enum intr_level old_level;
+  int i;
+
+  ASSERT (wq != NULL && name != NULL);
+  ASSERT (thread_cnt > 0 && thread_cnt <= WORKQUEUE_THREADS_MAX);
+
+  wq->name = name;
+  list_init (&wq->items);
+  sema_init (&wq->ready, 0);
+  wq->thread_cnt = thread_cnt;
+  wq->backlog = wq->max_backlog = 0;
+  wq->queue_cnt = wq->cancel_cnt = wq->run_cnt = 0;
+  wq->wait_cycles = wq->max_wait_cycles = 0;
+  wq->run_cycles = wq->max_run_cycles = 0;
+
+  old_level = intr_disable ();
+  list_push_back (&all_queues, &wq->all_elem);
+  intr_set_level (old_level);
+
+  for (i = 0; i < thread_cnt; i++)
+    {
+      char thread_name[16];
+
+      if (thread_cnt == 1)
+        snprintf (thread_name, sizeof thread_name, "%s", name);
+      else
+        snprintf (thread_name, sizeof thread_name, "%s-%d", name, i);
+      if (thread_create (thread_name, PRI_DEFAULT, worker, wq) == TID_ERROR)
+        PANIC ("can't start thread for work queue %s", name);
+    }
+}
+
+/* Initializes W to call FUNC with AUX, at PRIORITY, when it is
+   run.  W is not queued. */
+void
+work_init (struct work *w, work_func *func, void *aux, int priority)
+{
+  ASSERT (w != NULL && func != NULL);
+  ASSERT (priority >= PRI_MIN && priority <= PRI_MAX);
+
+  w->func = func;
+  w->aux = aux;
+  w->priority = priority;
+  w->wq = NULL;
+  w->queued = false;
+  timer_event_init (&w->delay, delay_done, w);
+}
+
+/* Queues W to be run by WQ's threads.  Returns true if W was
+   queued, false if it was already waiting to run or to be
+   queued, in which case it still runs only once.  W may be
+   queued again, even by its own function, as soon as it starts
+   to run.  May be called from an interrupt handler. */
+bool
+workqueue_queue (struct workqueue *wq, struct work *w)
+{
+  enum intr_level old_level = intr_disable ();
+  bool queued = !w->queued && !w->delay.pending;
+
+  if (queued)
+    queue_item (wq, w);
+  intr_set_level (old_level);
+  return queued;
+}
+
+/* Queues W to be run by WQ's threads once TICKS timer ticks have
+   passed, or at once if TICKS is not positive.  Returns false,
+   leaving W alone, if it was already waiting to run or to be
+   queued.  May be called from an interrupt handler. */
+bool
+workqueue_queue_delayed (struct workqueue *wq, struct work *w,
+                         int64_t ticks)
+{
+  enum intr_level old_level;
+  bool queued;
+
+  if (ticks <= 0)
+    return workqueue_queue (wq, w);
+
+  old_level = intr_disable ();
+  queued = !w->queued && !w->delay.pending;
+  if (queued)
+    {
+      w->wq = wq;
+      timer_event_add (&w->delay, ticks);
+    }
+  intr_set_level (old_level);
+  return queued;
+}
+
+/* Stops W from running, if it is waiting to run or to be
+   queued.  Returns true if it was, false if it had started to
+   run or was never queued.  Does not wait for a run that has
+   started to end. */
+bool
+workqueue_cancel (struct work *w)
+{
+  enum intr_level old_level = intr_disable ();
+  bool cancelled = false;
+
+  if (timer_event_cancel (&w->delay))
+    cancelled = true;
+  else if (w->queued)
+    {
+      /* The worker that takes the item's semaphore up finds
+         nothing to run and goes back to waiting. */
+      list_remove (&w->elem);
+      w->queued = false;
+      w->wq->backlog--;
+      cancelled = true;
+    }
+  if (cancelled)
+    w->wq->cancel_cnt++;
+  intr_set_level (old_level);
+  return cancelled;
+}
+
+/* Prints each work queue's statistics: how many items it ran,
+   its longest backlog, and how long the items waited to start
+   and then ran. */
+void
+workqueue_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_queues); e != list_end (&all_queues);
+       e = list_next (e))
+    {
+      struct workqueue *wq = list_entry (e, struct workqueue, all_elem);
+
+      if (wq->queue_cnt == 0)
+        continue;
+      printf ("Workqueue %s: %d threads, %llu queued, %llu cancelled, "
+              "%llu run, backlog %u, at most %u\n",
+              wq->name, wq->thread_cnt, wq->queue_cnt, wq->cancel_cnt,
+              wq->run_cnt, wq->backlog, wq->max_backlog);
+      if (wq->run_cnt > 0)
+        printf ("  wait %llu us average, %llu max; "
+                "run %llu us average, %llu max\n",
+                timer_cycles_to_ns (wq->wait_cycles / wq->run_cnt) / 1000,
+                timer_cycles_to_ns (wq->max_wait_cycles) / 1000,
+                timer_cycles_to_ns (wq->run_cycles / wq->run_cnt) / 1000,
+                timer_cycles_to_ns (wq->max_run_cycles) / 1000);
+    }
+}
+
+/* Puts W in WQ's items, in order of priority, and wakes a
+   worker for it.  Must be called with interrupts off. */
+static void
+queue_item (struct workqueue *wq, struct work *w)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  w->wq = wq;
+  w->queued = true;
+  w->queued_at = timer_cycles ();
+  list_insert_ordered (&wq->items, &w->elem, work_higher, NULL);
+  wq->queue_cnt++;
+  if (++wq->backlog > wq->max_backlog)
+    wq->max_backlog = wq->backlog;
+  sema_up (&wq->ready);
+}
+
+/* Timer event function: queues work item W_, whose delay is
+   over. */
+static void
+delay_done (void *w_)
+{
+  struct work *w = w_;
+
+  queue_item (w->wq, w);
+}
+
+/* Returns true if work item A_ runs before B_, that is, has a
+   higher priority. */
+static bool
+work_higher (const struct list_elem *a_, const struct list_elem *b_,
+             void *aux UNUSED)
+{
+  const struct work *a = list_entry (a_, struct work, elem);
+  const struct work *b = list_entry (b_, struct work, elem);
+
+  return a->priority > b->priority;
+}
+
+/* Worker thread of work queue WQ_.  Runs its items one at a
+   time, each at the item's priority. */
+static void
+worker (void *wq_)
+{
+  struct workqueue *wq = wq_;
+
+  for (;;)
+    {
+      enum intr_level old_level;
+      struct work *w;
+      work_func *func;
+      void *aux;
+      int priority;
+      uint64_t start, cycles;
+
+      sema_down (&wq->ready);
+      old_level = intr_disable ();
+      if (list_empty (&wq->items))
+        {
+          /* The item was cancelled. */
+          intr_set_level (old_level);
+          continue;
+        }
+      w = list_entry (list_pop_front (&wq->items), struct work, elem);
+      w->queued = false;
+      wq->backlog--;
+      start = timer_cycles ();
+      cycles = start - w->queued_at;
+      wq->wait_cycles += cycles;
+      if (cycles > wq->max_wait_cycles)
+        wq->max_wait_cycles = cycles;
+
+      /* W may be queued again, or freed, once it starts to run. */
+      func = w->func;
+      aux = w->aux;
+      priority = w->priority;
+      intr_set_level (old_level);
+
+      thread_set_priority (priority);
+      func (aux);
+
+      cycles = timer_cycles () - start;
+      old_level = intr_disable ();
+      wq->run_cnt++;
+      wq->run_cycles += cycles;
+      if (cycles > wq->max_run_cycles)
+        wq->max_run_cycles = cycles;
+      intr_set_level (old_level);
+    }
+}
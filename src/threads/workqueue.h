@@ -0,0 +1,71 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "devices/timer.h"
+#include "threads/synch.h"
+
+/* Work queues.
+
+   A work queue runs work items in a pool of kernel threads of
+   its own, so that a background activity need not start a thread
+   and loop on a semaphore.  An item's function runs in thread
+   context: it may sleep, take locks and print.  Waiting items
+   run in order of priority, first come first served among
+   equals, each at its own priority.  An item may also be queued
+   after a delay, kept by the timer.
+
+   Each queue counts the items queued and run, its backlog, and
+   how long the items waited and ran, which are printed at
+   shutdown. */
+
+/* Most threads in a work queue's pool. */
+#define WORKQUEUE_THREADS_MAX 8
+
+typedef void work_func (void *aux);
+
+/* A work item. */
+struct work
+  {
+    struct list_elem elem;      /* Element in the queue's items. */
+    work_func *func;            /* Function to run. */
+    void *aux;                  /* Argument for FUNC. */
+    int priority;               /* Priority to run at. */
+    struct workqueue *wq;       /* Queue waited for, or in. */
+    struct timer_event delay;   /* Queues the item when it expires. */
+    bool queued;                /* In WQ's items? */
+    uint64_t queued_at;         /* timer_cycles() when queued. */
+  };
+
+/* A work queue. */
+struct workqueue
+  {
+    struct list_elem all_elem;  /* Element in the list of queues. */
+    const char *name;           /* Name of the queue and its threads. */
+    struct list items;          /* Waiting items, by priority. */
+    struct semaphore ready;     /* Up once for each item queued. */
+    int thread_cnt;             /* Threads in the pool. */
+
+    /* Statistics. */
+    unsigned backlog;           /* Items waiting now. */
+    unsigned max_backlog;       /* Most items ever waiting. */
+    unsigned long long queue_cnt;  /* Items queued. */
+    unsigned long long cancel_cnt; /* Items cancelled. */
+    unsigned long long run_cnt;    /* Items run. */
+    uint64_t wait_cycles;       /* Total cycles items waited... */
+    uint64_t max_wait_cycles;   /* ...and the longest wait. */
+    uint64_t run_cycles;        /* Total cycles items ran... */
+    uint64_t max_run_cycles;    /* ...and the longest run. */
+  };
+
+void workqueue_init (struct workqueue *, const char *name, int thread_cnt);
+void work_init (struct work *, work_func *, void *aux, int priority);
+bool workqueue_queue (struct workqueue *, struct work *);
+bool workqueue_queue_delayed (struct workqueue *, struct work *,
+                              int64_t ticks);
+bool workqueue_cancel (struct work *);
+void workqueue_print_stats (void);
+
+#endif /* threads/workqueue.h */
@@ -0,0 +1,255 @@
+#include "userprog/aio.h"
+#include <debug.h>
+#include <list.h>
+#include "devices/block.h"
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/process.h"
+#include "userprog/uaccess.h"
+
+/* Number of threads that carry out requests.  Each has one
+   transfer going at a time, so this is the most that the block
+   queues see from all processes. */
+#define AIO_THREADS 4
+
+/* The requests of a process, made on its first aio_submit(). */
+struct aio_context
+  {
+    int pending;                /* Requests queued or in progress. */
+    struct list done;           /* Finished requests, oldest first. */
+    int done_cnt;               /* Number of requests in DONE. */
+    struct condition changed;   /* Signaled when a request finishes. */
+  };
+
+/* A submitted request. */
+struct aio_op
+  {
+    struct aio_context *ctx;    /* Process that submitted it. */
+    struct file *file;          /* Its own opening of the file. */
+    bool write;                 /* Write, or read? */
+    void *kbuf;                 /* Kernel copy of the data. */
+    void *ubuf;                 /* Process's buffer. */
+    unsigned size;              /* Bytes to transfer. */
+    off_t ofs;                  /* Offset in FILE. */
+    int id;                     /* Caller's ID for the request. */
+    int result;                 /* Bytes transferred, once done. */
+    struct list_elem elem;      /* In the queue, then in CTX->DONE. */
+  };
+
+/* Requests not yet started, oldest first, and the lock that
+   protects them and every aio_context.  QUEUE_READY is
+   signaled when a request is queued. */
+static struct list queue;
+static struct lock aio_lock;
+static struct condition queue_ready;
+
+static thread_func aio_thread;
+static void free_op (struct aio_op *);
+
+/* Initializes asynchronous I/O and starts its threads. */
+void
+aio_init (void)
+{
+  int i;
+
+  list_init (&queue);
+  lock_init_named (&aio_lock, "aio");
+  cond_init (&queue_ready);
+  for (i = 0; i < AIO_THREADS; i++)
+    thread_create ("aio", PRI_DEFAULT, aio_thread, NULL);
+}
+
+/* Submits, for the current process, a transfer of SIZE bytes
+   between user BUFFER and FILE at offset OFS, which writes the
+   buffer to the file if WRITE is true and otherwise reads the
+   file into it.  Its event will carry ID.  Returns false if the
+   process already has AIO_MAX requests, SIZE is over
+   AIO_SIZE_MAX, BUFFER cannot be read for a write, or memory is
+   exhausted. */
+bool
+aio_submit (struct file *file, bool write, void *buffer, unsigned size,
+            off_t ofs, int id)
+{
+  struct thread *p = process_current ();
+  struct aio_context *ctx = p->aio;
+  struct aio_op *op;
+
+  if (size > AIO_SIZE_MAX)
+    return false;
+  if (ctx == NULL)
+    {
+      ctx = malloc (sizeof *ctx);
+      if (ctx == NULL)
+        return false;
+      ctx->pending = 0;
+      list_init (&ctx->done);
+      ctx->done_cnt = 0;
+      cond_init (&ctx->changed);
+      p->aio = ctx;
+    }
+
+  /* Only this process's threads add to its count, and they hold
+     the process's lock, so it cannot grow after the check. */
+  if (ctx->pending + ctx->done_cnt >= AIO_MAX)
+    return false;
+  op = malloc (sizeof *op);
+  if (op == NULL)
+    return false;
+  op->kbuf = malloc (size > 0 ? size : 1);
+  op->file = file_reopen (file);
+  if (op->kbuf == NULL || op->file == NULL
+      || (write && !copy_from_user (op->kbuf, buffer, size)))
+    {
+      free_op (op);
+      return false;
+    }
+  op->ctx = ctx;
+  op->write = write;
+  op->ubuf = buffer;
+  op->size = size;
+  op->ofs = ofs;
+  op->id = id;
+
+  lock_acquire (&aio_lock);
+  ctx->pending++;
+  list_push_back (&queue, &op->elem);
+  cond_signal (&queue_ready, &aio_lock);
+  lock_release (&aio_lock);
+  return true;
+}
+
+/* Waits until at least MIN of the current process's requests
+   have finished, or until none is left unfinished, then stores
+   the events of up to MAX of the finished ones, oldest first, in
+   EVENTS and returns how many it stored.  The data of a read is
+   copied to its buffer here; if the buffer is not writable, the
+   event's result is -1.  Other threads of the process go on
+   while this one waits, and an exiting process's threads stop
+   waiting. */
+int
+aio_getevents (struct aio_event *events, int min, int max)
+{
+  struct thread *p = process_current ();
+  struct aio_context *ctx = p->aio;
+  struct list reaped;
+  int cnt = 0;
+
+  if (ctx == NULL)
+    return 0;
+
+  list_init (&reaped);
+  process_unlock ();
+  lock_acquire (&aio_lock);
+  while (ctx->done_cnt < min && ctx->pending > 0 && !p->exiting)
+    cond_wait (&ctx->changed, &aio_lock);
+  while (cnt < max && !list_empty (&ctx->done))
+    {
+      list_push_back (&reaped, list_pop_front (&ctx->done));
+      ctx->done_cnt--;
+      cnt++;
+    }
+  lock_release (&aio_lock);
+  process_lock ();
+
+  /* Every reaped request is freed, even if a buffer is bad. */
+  for (cnt = 0; !list_empty (&reaped); cnt++)
+    {
+      struct aio_op *op = list_entry (list_pop_front (&reaped),
+                                      struct aio_op, elem);
+
+      events[cnt].id = op->id;
+      events[cnt].result = op->result;
+      if (!op->write && op->result > 0
+          && !copy_to_user (op->ubuf, op->kbuf, op->result))
+        events[cnt].result = -1;
+      free_op (op);
+    }
+  return cnt;
+}
+
+/* Wakes the threads of PROCESS waiting in aio_getevents(), which
+   is exiting. */
+void
+aio_wake_process (struct thread *process)
+{
+  if (process->aio == NULL)
+    return;
+  lock_acquire (&aio_lock);
+  cond_broadcast (&process->aio->changed, &aio_lock);
+  lock_release (&aio_lock);
+}
+
+/* Frees the requests of the current process, which is exiting
+   and has no other threads left.  Requests not yet started are
+   dropped; those in progress are waited for. */
+void
+aio_exit (void)
+{
+  struct thread *p = process_current ();
+  struct aio_context *ctx = p->aio;
+  struct list_elem *e;
+
+  if (ctx == NULL)
+    return;
+
+  lock_acquire (&aio_lock);
+  for (e = list_begin (&queue); e != list_end (&queue); )
+    {
+      struct aio_op *op = list_entry (e, struct aio_op, elem);
+
+      e = list_next (e);
+      if (op->ctx == ctx)
+        {
+          list_remove (&op->elem);
+          list_push_back (&ctx->done, &op->elem);
+          ctx->pending--;
+        }
+    }
+  while (ctx->pending > 0)
+    cond_wait (&ctx->changed, &aio_lock);
+  lock_release (&aio_lock);
+
+  while (!list_empty (&ctx->done))
+    free_op (list_entry (list_pop_front (&ctx->done), struct aio_op, elem));
+  free (ctx);
+  p->aio = NULL;
+}
+
+/* Carries out queued requests, one at a time, forever. */
+static void
+aio_thread (void *aux UNUSED)
+{
+  block_set_class (BLOCK_CLASS_ASYNC);
+  for (;;)
+    {
+      struct aio_op *op;
+
+      lock_acquire (&aio_lock);
+      while (list_empty (&queue))
+        cond_wait (&queue_ready, &aio_lock);
+      op = list_entry (list_pop_front (&queue), struct aio_op, elem);
+      lock_release (&aio_lock);
+
+      op->result = (op->write
+                    ? file_write_at (op->file, op->kbuf, op->size, op->ofs)
+                    : file_read_at (op->file, op->kbuf, op->size, op->ofs));
+
+      lock_acquire (&aio_lock);
+      op->ctx->pending--;
+      list_push_back (&op->ctx->done, &op->elem);
+      op->ctx->done_cnt++;
+      cond_broadcast (&op->ctx->changed, &aio_lock);
+      lock_release (&aio_lock);
+    }
+}
+
+/* Frees OP with its buffer and its opening of the file. */
+static void
+free_op (struct aio_op *op)
+{
+  file_close (op->file);
+  free (op->kbuf);
+  free (op);
+}
@@ -0,0 +1,32 @@
+#ifndef USERPROG_AIO_H
+#define USERPROG_AIO_H
+
+#include <aio.h>
+#include <stdbool.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct thread;
+
+/* Asynchronous file I/O.
+
+   A process submits reads and writes of its files with
+   aio_submit(), which returns at once, and later reaps their
+   completions with aio_getevents().  The transfers are carried
+   out by a pool of kernel threads, through the buffer cache, so
+   that a process keeps several going at once, on both IDE
+   channels, while its own threads compute.  Each request has a
+   kernel buffer of its own, filled from the process's buffer on
+   submission for a write, and copied to it on reaping for a read,
+   so that no user page needs to stay pinned in between.  A
+   request holds its own opening of the file, so closing the
+   descriptor does not cancel it. */
+
+void aio_init (void);
+bool aio_submit (struct file *, bool write, void *buffer, unsigned size,
+                 off_t ofs, int id);
+int aio_getevents (struct aio_event *, int min, int max);
+void aio_wake_process (struct thread *process);
+void aio_exit (void);
+
+#endif /* userprog/aio.h */
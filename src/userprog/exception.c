@@ -1,17 +1,33 @@
 #include "userprog/exception.h"
 #include <inttypes.h>
 #include <stdio.h>
+#include "devices/block.h"
 #include "userprog/gdt.h"
+#include "userprog/process.h"
+#include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
 #include "userprog/syscall.h"
+#include "userprog/uaccess.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
 static void kill (struct intr_frame *);
+static void debug_exception (struct intr_frame *);
 static void page_fault (struct intr_frame *);
+static void device_not_available (struct intr_frame *);
+#ifdef VM
+static bool resolve_fault (struct intr_frame *, void *fault_addr,
+                           bool not_present, bool write, bool user);
+#endif
 
 /* Registers handlers for interrupts that can be caused by user
    programs.
@@ -45,10 +61,9 @@ exception_init (void)
      caused indirectly, e.g. #DE can be caused by dividing by
      0.  */
   intr_register_int (0, 0, INTR_ON, kill, "#DE Divide Error");
-  intr_register_int (1, 0, INTR_ON, kill, "#DB Debug Exception");
+  intr_register_int (1, 0, INTR_ON, debug_exception,
+                     "#DB Debug Exception");
   intr_register_int (6, 0, INTR_ON, kill, "#UD Invalid Opcode Exception");
-  intr_register_int (7, 0, INTR_ON, kill,
-                     "#NM Device Not Available Exception");
   intr_register_int (11, 0, INTR_ON, kill, "#NP Segment Not Present");
   intr_register_int (12, 0, INTR_ON, kill, "#SS Stack Fault Exception");
   intr_register_int (13, 0, INTR_ON, kill, "#GP General Protection Exception");
@@ -60,6 +75,19 @@ exception_init (void)
      We need to disable interrupts for page faults because the
      fault address is stored in CR2 and needs to be preserved. */
   intr_register_int (14, 0, INTR_OFF, page_fault, "#PF Page-Fault Exception");
+
+  /* A user program's first FPU instruction after a switch traps
+     here, to load its FPU state; see threads/fpu.h.  Finding
+     memory for the state may sleep. */
+  intr_register_int (7, 0, INTR_ON, device_not_available,
+                     "#NM Device Not Available Exception");
+}
+
+/* Stores the number of page faults taken in STATS. */
+void
+exception_get_kstat (struct kstat_mem *stats)
+{
+  stats->page_faults = page_fault_cnt;
 }
 
 /* Prints exception statistics. */
@@ -91,7 +119,8 @@ kill (struct intr_frame *f)
       printf ("%s: dying due to interrupt %#04x (%s).\n",
               thread_name (), f->vec_no, intr_name (f->vec_no));
       intr_dump_frame (f);
-      thread_exit (); 
+      sys_exit (-1);
+      NOT_REACHED ();
 
     case SEL_KCSEG:
       /* Kernel's code segment, which indicates a kernel bug.
@@ -110,6 +139,36 @@ kill (struct intr_frame *f)
     }
 }
 
+/* Debug exception handler.  A user program that single-steps
+   into SYSENTER, which unlike `int $0x30' does not clear the trap
+   flag, traps before the first instruction of sysenter_entry,
+   still on the small stack that SYSENTER_ESP points to and with
+   interrupts off.  We clear the flag so that the entry can go on,
+   and tell sysenter_entry to set it again in the flags it saves
+   for the return to user mode.  Any other debug exception is
+   handled like the other exceptions. */
+static void
+debug_exception (struct intr_frame *f)
+{
+  if (f->cs == SEL_KCSEG && f->eip == sysenter_entry)
+    {
+      f->eflags &= ~FLAG_TF;
+      sysenter_single_step = true;
+      return;
+    }
+  kill (f);
+}
+
+/* Device-not-available handler, which hands the FPU to the user
+   program that trapped using it.  The kernel never uses the FPU,
+   so a trap in the kernel is a bug. */
+static void
+device_not_available (struct intr_frame *f)
+{
+  if (f->cs != SEL_UCSEG || !fpu_trap ())
+    kill (f);
+}
+
 /* Page fault handler.  This is a skeleton that must be filled in
    to implement virtual memory.  Some solutions to project 2 may
    also require modifying this code.
@@ -147,6 +206,7 @@ page_fault (struct intr_frame *f)
 
   /* Count page faults. */
   page_fault_cnt++;
+  TRACE (TRACE_PAGE_FAULT, fault_addr, f->error_code);
 
   /* Determine cause. */
   not_present = (f->error_code & PF_P) == 0;
@@ -154,6 +214,51 @@ page_fault (struct intr_frame *f)
   user = (f->error_code & PF_U) != 0;
 
  t=thread_current();
+
+#ifdef VM
+  /* The threads of the process share its address space, which
+     only changes with the process's lock held.  A fault in a
+     system call already holds it.  A fault in the kernel without
+     it, such as in a transfer through a pipe, does not wait for
+     it, since the thread holding it may be waiting on the one
+     that faulted: the page is simply not brought in. */
+  if (fault_addr != NULL && is_user_vaddr (fault_addr)
+      && t->pagedir != NULL)
+    {
+      bool held = process_lock_held ();
+
+      if (held || user || process_trylock ())
+        {
+          enum block_class old_class;
+          bool resolved;
+
+          if (!held && user)
+            process_lock ();
+          old_class = block_set_class (BLOCK_CLASS_FAULT);
+          resolved = resolve_fault (f, fault_addr, not_present, write, user);
+          block_set_class (old_class);
+          if (!held)
+            process_unlock ();
+          if (resolved)
+            return;
+        }
+    }
+#endif
+
+  /* A fault in one of the user memory access routines that could
+     not be resolved resumes at its fixup, which makes the routine
+     fail. */
+  if (!user)
+    {
+      const struct exception_entry *e
+        = uaccess_find_fixup ((const void *) f->eip);
+      if (e != NULL)
+        {
+          f->eip = (void (*) (void)) e->fixup;
+          return;
+        }
+    }
+
  /* If user thread is attempting to access the kernel address space, exit from system with -1 */
  if(not_present || (is_kernel_vaddr (fault_addr) && user))
     sys_exit (-1);
@@ -169,3 +274,55 @@ page_fault (struct intr_frame *f)
   kill (f);
 }
 
+
+#ifdef VM
+/* Resolves a page fault at user address FAULT_ADDR in the current
+   process, as described for page_fault().  Returns false if the
+   fault is not one the virtual memory system handles.  Must be
+   called with the process's lock held. */
+static bool
+resolve_fault (struct intr_frame *f, void *fault_addr, bool not_present,
+               bool write, bool user)
+{
+  struct thread *t = thread_current ();
+
+  /* Bring in the page, or grow the stack, if FAULT_ADDR belongs
+     to the process.  The kernel faults here too when a system
+     call touches a user buffer that is not loaded, and then the
+     stack pointer to check is the one saved on entry to the
+     kernel. */
+  if (not_present)
+    {
+      void *esp = user ? f->esp : t->user_esp;
+      struct vm_page *page = vm_find_page (fault_addr);
+
+      if (page != NULL ? vm_load_page (page, false, write)
+          : (stack_access (esp, fault_addr)
+             && vm_grow_stack (pg_round_down (fault_addr), false) != NULL))
+        {
+          if (write && user)
+            vm_mmap_throttle ();
+          return true;
+        }
+    }
+
+  /* The first write to a copy-on-write page, or to a page of a
+     memory mapping since it was loaded or written back.  Only
+     user faults are throttled: the kernel may hold file system
+     locks that writing back would need. */
+  else if (write)
+    {
+      struct vm_page *page = vm_find_page (fault_addr);
+
+      if (page != NULL && page->cow)
+        return vm_copy_on_write (page);
+      if (page != NULL && vm_mmap_write_fault (page))
+        {
+          if (user)
+            vm_mmap_throttle ();
+          return true;
+        }
+    }
+  return false;
+}
+#endif
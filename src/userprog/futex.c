@@ -0,0 +1,193 @@
+#include "userprog/futex.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdint.h>
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* Number of buckets of waiters.  Waiters are hashed by their key
+   into a bucket, which has a lock of its own, so futexes in
+   different buckets do not contend. */
+#define FUTEX_BUCKETS 64
+
+/* A bucket of waiters. */
+struct futex_bucket
+  {
+    struct lock lock;           /* Protects WAITERS. */
+    struct list waiters;        /* Waiting futex_waiters, oldest first. */
+  };
+
+/* A thread waiting in futex_wait(), on its kernel stack. */
+struct futex_waiter
+  {
+    const int *key;             /* Kernel address of the futex word. */
+    struct thread *process;     /* The waiting thread's process. */
+    struct semaphore sema;      /* Upped to wake the thread. */
+    struct list_elem elem;      /* Element in the bucket's WAITERS. */
+  };
+
+static struct futex_bucket buckets[FUTEX_BUCKETS];
+
+static int *get_key (int *uaddr);
+static void put_key (int *uaddr);
+static struct futex_bucket *key_bucket (const int *key);
+
+/* Initializes the futex buckets. */
+void
+futex_init (void)
+{
+  size_t i;
+
+  for (i = 0; i < FUTEX_BUCKETS; i++)
+    {
+      lock_init (&buckets[i].lock);
+      list_init (&buckets[i].waiters);
+    }
+}
+
+/* If the word at user address UADDR still holds VAL, waits until
+   futex_wake() is called on the same word, and returns 0.
+   Otherwise returns -1 at once, as it does if UADDR is not an
+   aligned, writable word of the current process.  Checking the
+   word and starting to wait are atomic with respect to
+   futex_wake(), so a wake-up that follows a change of the word
+   is never missed.  Must be called with the process's lock held,
+   which is released while waiting. */
+int
+futex_wait (int *uaddr, int val)
+{
+  struct thread *p = process_current ();
+  struct futex_waiter w;
+  struct futex_bucket *b;
+
+  w.key = get_key (uaddr);
+  if (w.key == NULL)
+    return -1;
+  b = key_bucket (w.key);
+
+  /* An exiting process's threads do not start waiting, since
+     futex_wake_process() has already gone by. */
+  lock_acquire (&b->lock);
+  if (*(volatile const int *) w.key != val || p->exiting)
+    {
+      lock_release (&b->lock);
+      put_key (uaddr);
+      return -1;
+    }
+  w.process = p;
+  sema_init (&w.sema, 0);
+  list_push_back (&b->waiters, &w.elem);
+  lock_release (&b->lock);
+
+  process_unlock ();
+  sema_down (&w.sema);
+  process_lock ();
+  put_key (uaddr);
+  return 0;
+}
+
+/* Wakes up to CNT threads waiting on the word at user address
+   UADDR, the ones that have waited longest first, and returns the
+   number woken, or -1 if UADDR is not an aligned, writable word
+   of the current process. */
+int
+futex_wake (int *uaddr, int cnt)
+{
+  const int *key = get_key (uaddr);
+  struct futex_bucket *b;
+  struct list_elem *e;
+  int woken = 0;
+
+  if (key == NULL)
+    return -1;
+  b = key_bucket (key);
+
+  lock_acquire (&b->lock);
+  for (e = list_begin (&b->waiters);
+       e != list_end (&b->waiters) && woken < cnt; )
+    {
+      struct futex_waiter *w = list_entry (e, struct futex_waiter, elem);
+
+      e = list_next (e);
+      if (w->key == key)
+        {
+          list_remove (&w->elem);
+          sema_up (&w->sema);
+          woken++;
+        }
+    }
+  lock_release (&b->lock);
+  put_key (uaddr);
+  return woken;
+}
+
+/* Wakes every thread of PROCESS that waits on a futex, once the
+   process has started exiting, so that the threads end. */
+void
+futex_wake_process (struct thread *process)
+{
+  size_t i;
+
+  ASSERT (process->exiting);
+  for (i = 0; i < FUTEX_BUCKETS; i++)
+    {
+      struct futex_bucket *b = &buckets[i];
+      struct list_elem *e;
+
+      lock_acquire (&b->lock);
+      for (e = list_begin (&b->waiters); e != list_end (&b->waiters); )
+        {
+          struct futex_waiter *w = list_entry (e, struct futex_waiter,
+                                               elem);
+
+          e = list_next (e);
+          if (w->process == process)
+            {
+              list_remove (&w->elem);
+              sema_up (&w->sema);
+            }
+        }
+      lock_release (&b->lock);
+    }
+}
+
+/* Returns the kernel address of the word at user address UADDR
+   in the frame that holds it, which is the futex's key, and keeps
+   the page in the frame until put_key().  The page is made
+   writable first, so that a copy-on-write page has a frame of its
+   own.  Returns a null pointer if UADDR is not an aligned,
+   writable word of the current process. */
+static int *
+get_key (int *uaddr)
+{
+  if ((uintptr_t) uaddr % sizeof *uaddr != 0 || !is_user_vaddr (uaddr))
+    return NULL;
+#ifdef VM
+  if (!vm_pin_buffer (uaddr, sizeof *uaddr, true))
+    return NULL;
+#endif
+  return pagedir_get_page (thread_current ()->pagedir, uaddr);
+}
+
+/* Lets the page of UADDR leave its frame again after get_key(). */
+static void
+put_key (int *uaddr UNUSED)
+{
+#ifdef VM
+  vm_unpin_buffer (uaddr, sizeof *uaddr);
+#endif
+}
+
+/* Returns the bucket of waiters on KEY. */
+static struct futex_bucket *
+key_bucket (const int *key)
+{
+  return &buckets[hash_bytes (&key, sizeof key) % FUTEX_BUCKETS];
+}
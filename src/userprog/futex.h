@@ -0,0 +1,24 @@
+#ifndef USERPROG_FUTEX_H
+#define USERPROG_FUTEX_H
+
+#include <stdbool.h>
+
+struct thread;
+
+/* Futexes.
+
+   A futex is a word of user memory that threads wait on in the
+   kernel until another thread wakes them, so that user locks only
+   enter the kernel when they are contended.  A waiter is keyed by
+   the frame that holds the word and the word's offset in it, not
+   by its user address, so threads of different processes that
+   share the frame, through shared memory, wait on the same
+   futex.  The page stays pinned in its frame while the thread
+   waits, so the key does not change. */
+
+void futex_init (void);
+int futex_wait (int *uaddr, int val);
+int futex_wake (int *uaddr, int cnt);
+void futex_wake_process (struct thread *process);
+
+#endif /* userprog/futex.h */
@@ -2,40 +2,187 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
+#include <hash.h>
 #include "threads/init.h"
+#include "threads/malloc.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of page directories kept ready for new processes. */
+#define PAGEDIR_POOL_SIZE 4
+
+/* Number of page directory entries for user virtual addresses.
+   The entries past them map the kernel and are the same in
+   every page directory. */
+#define USER_PDE_CNT (LOADER_PHYS_BASE >> PDSHIFT)
+
+/* Bookkeeping for a page directory: which of its user entries
+   have a page table, so that tearing it down only visits those. */
+struct pd_info
+  {
+    struct hash_elem elem;              /* Element in pd_infos. */
+    uint32_t *pd;                       /* The page directory. */
+    uint32_t used[USER_PDE_CNT / 32];   /* Bitmap of user PDEs in use. */
+  };
+
+/* Page directories with no user mappings, ready for new
+   processes, the pd_info of every page directory, and the lock
+   that protects both. */
+static uint32_t *pd_pool[PAGEDIR_POOL_SIZE];
+static size_t pd_pool_cnt;
+static struct hash pd_infos;
+static struct lock pd_lock;
+
+/* True if a batch deferred invalidating an entry of the TLB and
+   the TLB has not been flushed since.  Another thread sharing the
+   active page directory could then see the stale entry, so
+   pagedir_switch() must not keep the TLB. */
+static bool tlb_deferred;
 
 static uint32_t *active_pd (void);
-static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *vpage);
+static uint32_t *new_pagedir (void);
+static void free_pagedir (uint32_t *pd);
+static struct pd_info *find_info (uint32_t *pd);
+static hash_hash_func pd_info_hash;
+static hash_less_func pd_info_less;
+
+/* Initializes the pool of ready page directories, which starts
+   out empty. */
+void
+pagedir_init (void)
+{
+  lock_init_named (&pd_lock, "pagedir");
+  hash_init (&pd_infos, pd_info_hash, pd_info_less, NULL);
+}
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
    Returns the new page directory, or a null pointer if memory
-   allocation fails. */
+   allocation fails.  One from the pool is used if there is any. */
 uint32_t *
 pagedir_create (void) 
 {
-  uint32_t *pd = palloc_get_page (0);
-  if (pd != NULL)
-    memcpy (pd, init_page_dir, PGSIZE);
+  uint32_t *pd = NULL;
+
+  lock_acquire (&pd_lock);
+  if (pd_pool_cnt > 0)
+    pd = pd_pool[--pd_pool_cnt];
+  lock_release (&pd_lock);
+
+  return pd != NULL ? pd : new_pagedir ();
+}
+
+/* Fills up the pool of ready page directories, as far as memory
+   allows.  Called in the background, off the path of exec. */
+void
+pagedir_pool_fill (void)
+{
+  for (;;)
+    {
+      uint32_t *pd;
+      bool full;
+
+      lock_acquire (&pd_lock);
+      full = pd_pool_cnt == PAGEDIR_POOL_SIZE;
+      lock_release (&pd_lock);
+      if (full)
+        break;
+
+      pd = new_pagedir ();
+      if (pd == NULL)
+        break;
+      lock_acquire (&pd_lock);
+      if (pd_pool_cnt < PAGEDIR_POOL_SIZE)
+        {
+          pd_pool[pd_pool_cnt++] = pd;
+          pd = NULL;
+        }
+      lock_release (&pd_lock);
+      if (pd != NULL)
+        free_pagedir (pd);
+    }
+}
+
+/* Allocates a page directory and copies the kernel entries of
+   init_page_dir into it. */
+static uint32_t *
+new_pagedir (void)
+{
+  struct pd_info *info = calloc (1, sizeof *info);
+  uint32_t *pd = palloc_get_page (PAL_ZERO);
+
+  if (info == NULL || pd == NULL)
+    {
+      free (info);
+      palloc_free_page (pd);
+      return NULL;
+    }
+  memcpy (pd + USER_PDE_CNT, init_page_dir + USER_PDE_CNT,
+          PGSIZE - USER_PDE_CNT * sizeof *pd);
+
+  info->pd = pd;
+  lock_acquire (&pd_lock);
+  hash_insert (&pd_infos, &info->elem);
+  lock_release (&pd_lock);
   return pd;
 }
 
+/* Frees PD, which has no user mappings, and its pd_info. */
+static void
+free_pagedir (uint32_t *pd)
+{
+  struct pd_info *info;
+
+  lock_acquire (&pd_lock);
+  info = find_info (pd);
+  hash_delete (&pd_infos, &info->elem);
+  lock_release (&pd_lock);
+
+  free (info);
+  palloc_free_page (pd);
+}
+
+/* Returns the pd_info of PD.  Must be called with pd_lock
+   held. */
+static struct pd_info *
+find_info (uint32_t *pd)
+{
+  struct pd_info key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&pd_lock));
+  key.pd = pd;
+  e = hash_find (&pd_infos, &key.elem);
+  ASSERT (e != NULL);
+  return hash_entry (e, struct pd_info, elem);
+}
+
 /* Destroys page directory PD, freeing all the pages it
-   references. */
+   references.  Only the entries that were given a page table are
+   visited.  PD itself goes back to the pool, with its user
+   entries cleared, if the pool has room. */
 void
 pagedir_destroy (uint32_t *pd) 
 {
-  uint32_t *pde;
+  struct pd_info *info;
+  size_t i;
 
   if (pd == NULL)
     return;
 
   ASSERT (pd != init_page_dir);
-  for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
-    if (*pde & PTE_P) 
+  lock_acquire (&pd_lock);
+  info = find_info (pd);
+  lock_release (&pd_lock);
+
+  for (i = 0; i < USER_PDE_CNT / 32; i++)
+    while (info->used[i] != 0)
       {
+        int bit = __builtin_ctz (info->used[i]);
+        uint32_t *pde = pd + i * 32 + bit;
         uint32_t *pt = pde_get_pt (*pde);
         uint32_t *pte;
         
@@ -43,8 +190,19 @@ pagedir_destroy (uint32_t *pd)
           if (*pte & PTE_P) 
             palloc_free_page (pte_get_page (*pte));
         palloc_free_page (pt);
+        *pde = 0;
+        info->used[i] &= ~(1u << bit);
       }
-  palloc_free_page (pd);
+
+  lock_acquire (&pd_lock);
+  if (pd_pool_cnt < PAGEDIR_POOL_SIZE)
+    {
+      pd_pool[pd_pool_cnt++] = pd;
+      pd = NULL;
+    }
+  lock_release (&pd_lock);
+  if (pd != NULL)
+    free_pagedir (pd);
 }
 
 /* Returns the address of the page table entry for virtual
@@ -70,11 +228,18 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
     {
       if (create)
         {
+          size_t idx = pd_no (vaddr);
+          struct pd_info *info;
+
           pt = palloc_get_page (PAL_ZERO);
           if (pt == NULL) 
             return NULL; 
       
           *pde = pde_create (pt);
+          lock_acquire (&pd_lock);
+          info = find_info (pd);
+          info->used[idx / 32] |= 1u << (idx % 32);
+          lock_release (&pd_lock);
         }
       else
         return NULL;
@@ -152,35 +317,51 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
+    }
+}
+
+/* Makes the PTE for virtual page VPAGE in PD writable if WRITABLE
+   is true, read-only otherwise, if it is present. */
+void
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable)
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL && (*pte & PTE_P) != 0)
+    {
+      if (writable)
+        *pte |= PTE_W;
+      else
+        *pte &= ~(uint32_t) PTE_W;
+      invalidate_page (pd, vpage);
     }
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
-   Returns false if PD contains no PTE for VPAGE. */
+   Returns false if PD contains no present PTE for VPAGE. */
 bool
 pagedir_is_dirty (uint32_t *pd, const void *vpage) 
 {
   uint32_t *pte = lookup_page (pd, vpage, false);
-  return pte != NULL && (*pte & PTE_D) != 0;
+  return pte != NULL && (*pte & PTE_P) != 0 && (*pte & PTE_D) != 0;
 }
 
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
-   in PD. */
+   in PD, if it is present. */
 void
 pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty) 
 {
   uint32_t *pte = lookup_page (pd, vpage, false);
-  if (pte != NULL) 
+  if (pte != NULL && (*pte & PTE_P) != 0) 
     {
       if (dirty)
         *pte |= PTE_D;
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -188,28 +369,28 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
 /* Returns true if the PTE for virtual page VPAGE in PD has been
    accessed recently, that is, between the time the PTE was
    installed and the last time it was cleared.  Returns false if
-   PD contains no PTE for VPAGE. */
+   PD contains no present PTE for VPAGE. */
 bool
 pagedir_is_accessed (uint32_t *pd, const void *vpage) 
 {
   uint32_t *pte = lookup_page (pd, vpage, false);
-  return pte != NULL && (*pte & PTE_A) != 0;
+  return pte != NULL && (*pte & PTE_P) != 0 && (*pte & PTE_A) != 0;
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
-   VPAGE in PD. */
+   VPAGE in PD, if it is present. */
 void
 pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed) 
 {
   uint32_t *pte = lookup_page (pd, vpage, false);
-  if (pte != NULL) 
+  if (pte != NULL && (*pte & PTE_P) != 0) 
     {
       if (accessed)
         *pte |= PTE_A;
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -228,6 +409,48 @@ pagedir_activate (uint32_t *pd)
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base
      Address of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
+  tlb_deferred = false;
+}
+
+/* Makes PD the active page directory, like pagedir_activate(),
+   but keeps the TLB if PD is active already, as it is when
+   switching between threads of a process or back to a process
+   from a kernel thread that borrowed its page directory. */
+void
+pagedir_switch (uint32_t *pd)
+{
+  if (pd == NULL)
+    pd = init_page_dir;
+  if (pd != active_pd () || tlb_deferred)
+    pagedir_activate (pd);
+}
+
+/* Starts a batch of page table changes made by the running
+   thread.  Until the matching pagedir_batch_end(), changes to the
+   active page directory do not invalidate the TLB entry of each
+   page they touch; the whole TLB is flushed once at the end
+   instead.  Meanwhile the TLB may still hold the old translations,
+   so the caller must not access the affected user pages.  Batches
+   may nest. */
+void
+pagedir_batch_begin (void)
+{
+  thread_current ()->tlb_batch_depth++;
+}
+
+/* Ends a batch started by pagedir_batch_begin(), flushing the
+   TLB if any change in the batch required it. */
+void
+pagedir_batch_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->tlb_batch_depth > 0);
+  if (--t->tlb_batch_depth == 0 && t->tlb_stale)
+    {
+      t->tlb_stale = false;
+      pagedir_activate (active_pd ());
+    }
 }
 
 /* Returns the currently active page directory. */
@@ -243,21 +466,53 @@ active_pd (void)
   return ptov (pd);
 }
 
-/* Seom page table changes can cause the CPU's translation
+/* Some page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
-   table.  When this happens, we have to "invalidate" the TLB by
-   re-activating it.
+   table.  When this happens, we have to "invalidate" the TLB
+   entry of the page that changed.
 
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
+   This function invalidates the TLB entry of VPAGE if PD is the
+   active page directory.  (If PD is not active then its entries
+   are not in the TLB, so there is no need to invalidate
+   anything.)  Inside a batch, it only records that the TLB has
+   to be flushed when the batch ends. */
 static void
-invalidate_pagedir (uint32_t *pd) 
+invalidate_page (uint32_t *pd, const void *vpage) 
 {
-  if (active_pd () == pd) 
+  struct thread *t;
+
+  if (active_pd () != pd)
+    return;
+
+  t = thread_current ();
+  if (t->tlb_batch_depth > 0)
     {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-         "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
-    } 
+      t->tlb_stale = true;
+      tlb_deferred = true;
+    }
+  else
+    {
+      /* INVLPG drops the TLB entry of a single page.  See
+         [IA32-v2a] "INVLPG--Invalidate TLB Entry". */
+      asm volatile ("invlpg (%0)" : : "r" (vpage) : "memory");
+    }
+}
+
+/* Returns a hash value for the pd_info E. */
+static unsigned
+pd_info_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct pd_info *info = hash_entry (e, struct pd_info, elem);
+  return hash_bytes (&info->pd, sizeof info->pd);
+}
+
+/* Returns true if pd_info A precedes pd_info B. */
+static bool
+pd_info_less (const struct hash_elem *a_, const struct hash_elem *b_,
+              void *aux UNUSED)
+{
+  const struct pd_info *a = hash_entry (a_, struct pd_info, elem);
+  const struct pd_info *b = hash_entry (b_, struct pd_info, elem);
+
+  return a->pd < b->pd;
 }
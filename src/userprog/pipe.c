@@ -0,0 +1,190 @@
+#include "userprog/pipe.h"
+#include <debug.h>
+#include <poll.h>
+#include <stdint.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/poll.h"
+#include "userprog/uaccess.h"
+
+/* A pipe. */
+struct pipe
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct condition readable;  /* Signaled when bytes arrive. */
+    struct condition writable;  /* Signaled when room is made. */
+    uint8_t *buf;               /* PGSIZE-byte ring buffer. */
+    unsigned head;              /* Offset of the oldest byte. */
+    unsigned used;              /* Bytes in BUF. */
+    int readers;                /* Open read ends. */
+    int writers;                /* Open write ends. */
+  };
+
+/* Creates a pipe with one read end and one write end open and
+   stores it in *PIPEP.  Returns false if memory is exhausted. */
+bool
+pipe_create (struct pipe **pipep)
+{
+  struct pipe *p = malloc (sizeof *p);
+
+  if (p == NULL)
+    return false;
+  p->buf = palloc_get_page (0);
+  if (p->buf == NULL)
+    {
+      free (p);
+      return false;
+    }
+  lock_init (&p->lock);
+  cond_init (&p->readable);
+  cond_init (&p->writable);
+  p->head = p->used = 0;
+  p->readers = p->writers = 1;
+  *pipep = p;
+  return true;
+}
+
+/* Opens another read end of P, or another write end if WRITER. */
+void
+pipe_open_end (struct pipe *p, bool writer)
+{
+  lock_acquire (&p->lock);
+  if (writer)
+    p->writers++;
+  else
+    p->readers++;
+  lock_release (&p->lock);
+}
+
+/* Closes a read end of P, or a write end if WRITER, and frees P
+   once no end is open.  Closing the last end of a kind wakes the
+   processes blocked on the other end so that they see it. */
+void
+pipe_close_end (struct pipe *p, bool writer)
+{
+  bool last;
+
+  lock_acquire (&p->lock);
+  if (writer)
+    {
+      ASSERT (p->writers > 0);
+      if (--p->writers == 0)
+        cond_broadcast (&p->readable, &p->lock);
+    }
+  else
+    {
+      ASSERT (p->readers > 0);
+      if (--p->readers == 0)
+        cond_broadcast (&p->writable, &p->lock);
+    }
+  last = p->readers == 0 && p->writers == 0;
+  lock_release (&p->lock);
+  poll_notify ();
+
+  if (last)
+    {
+      palloc_free_page (p->buf);
+      free (p);
+    }
+}
+
+/* Reads up to SIZE bytes from P into user buffer UBUF, waiting
+   until at least one byte is available.  Returns the number of
+   bytes read, 0 at end of file, or -1 if UBUF is not writable,
+   in which case nothing is consumed. */
+int
+pipe_read (struct pipe *p, void *ubuf, unsigned size)
+{
+  unsigned cnt, first;
+  bool ok;
+
+  if (size == 0)
+    return 0;
+
+  lock_acquire (&p->lock);
+  while (p->used == 0 && p->writers > 0)
+    cond_wait (&p->readable, &p->lock);
+
+  cnt = size < p->used ? size : p->used;
+  first = cnt < PGSIZE - p->head ? cnt : PGSIZE - p->head;
+  ok = (copy_to_user (ubuf, p->buf + p->head, first)
+        && copy_to_user ((uint8_t *) ubuf + first, p->buf, cnt - first));
+  if (ok && cnt > 0)
+    {
+      p->head = (p->head + cnt) % PGSIZE;
+      p->used -= cnt;
+      cond_broadcast (&p->writable, &p->lock);
+    }
+  lock_release (&p->lock);
+  if (ok && cnt > 0)
+    poll_notify ();
+
+  return ok ? (int) cnt : -1;
+}
+
+/* Writes the SIZE bytes in user buffer UBUF to P, waiting for
+   room as needed.  Returns the number of bytes written, which is
+   less than SIZE only if the last read end is closed or UBUF
+   cannot be read partway through, or -1 if nothing could be
+   written for either reason. */
+int
+pipe_write (struct pipe *p, const void *ubuf, unsigned size)
+{
+  unsigned done = 0;
+
+  lock_acquire (&p->lock);
+  while (done < size)
+    {
+      unsigned tail, cnt;
+
+      while (p->used == PGSIZE && p->readers > 0)
+        cond_wait (&p->writable, &p->lock);
+      if (p->readers == 0)
+        break;
+
+      /* Fill as much of the free space as is contiguous. */
+      tail = (p->head + p->used) % PGSIZE;
+      cnt = size - done;
+      if (cnt > PGSIZE - p->used)
+        cnt = PGSIZE - p->used;
+      if (cnt > PGSIZE - tail)
+        cnt = PGSIZE - tail;
+      if (!copy_from_user (p->buf + tail, (const uint8_t *) ubuf + done,
+                           cnt))
+        break;
+      p->used += cnt;
+      done += cnt;
+      cond_broadcast (&p->readable, &p->lock);
+      poll_notify ();
+    }
+  lock_release (&p->lock);
+
+  return done > 0 || size == 0 ? (int) done : -1;
+}
+
+/* Returns the poll() events that hold for a read end of P, or a
+   write end if WRITER: POLLIN if a read would not wait, POLLHUP
+   if the write ends are all closed, POLLOUT if a write would not
+   wait, or POLLERR if the read ends are all closed. */
+int
+pipe_poll (struct pipe *p, bool writer)
+{
+  int events = 0;
+
+  lock_acquire (&p->lock);
+  if (!writer)
+    {
+      if (p->used > 0)
+        events |= POLLIN;
+      if (p->writers == 0)
+        events |= POLLHUP;
+    }
+  else if (p->readers == 0)
+    events |= POLLERR;
+  else if (p->used < PGSIZE)
+    events |= POLLOUT;
+  lock_release (&p->lock);
+  return events;
+}
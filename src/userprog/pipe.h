@@ -0,0 +1,24 @@
+#ifndef USERPROG_PIPE_H
+#define USERPROG_PIPE_H
+
+#include <stdbool.h>
+
+/* Pipes.
+
+   A pipe carries bytes from the processes holding its write end
+   to those holding its read end through a one-page ring buffer.
+   Readers block while the buffer is empty and writers while it
+   is full.  Once every write end is closed, reads return what is
+   left and then end of file; once every read end is closed,
+   writes fail. */
+struct pipe;
+
+bool pipe_create (struct pipe **);
+void pipe_open_end (struct pipe *, bool writer);
+void pipe_close_end (struct pipe *, bool writer);
+
+int pipe_read (struct pipe *, void *ubuf, unsigned size);
+int pipe_write (struct pipe *, const void *ubuf, unsigned size);
+int pipe_poll (struct pipe *, bool writer);
+
+#endif /* userprog/pipe.h */
@@ -0,0 +1,94 @@
+#include "userprog/poll.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "userprog/process.h"
+
+/* The threads waiting in poll().  Events come from interrupt
+   handlers too, so the list is only looked at with interrupts
+   off. */
+static struct list waiters;
+
+static timer_event_func poll_timeout;
+
+/* Initializes the list of waiters. */
+void
+poll_init (void)
+{
+  list_init (&waiters);
+}
+
+/* Starts a wait by the current thread on W, which ends TICKS
+   timer ticks from now, or never if TICKS is negative.  Events
+   from here on until poll_end() wake the thread, even those that
+   happen before it goes to sleep in poll_wait(), so the caller
+   checks its descriptors after this and misses none. */
+void
+poll_begin (struct poll_waiter *w, int64_t ticks)
+{
+  enum intr_level old_level;
+
+  sema_init (&w->sema, 0);
+  w->timed_out = ticks == 0;
+  w->has_timeout = ticks > 0;
+  old_level = intr_disable ();
+  list_push_back (&waiters, &w->elem);
+  if (w->has_timeout)
+    {
+      timer_event_init (&w->timeout, poll_timeout, w);
+      timer_event_add (&w->timeout, ticks);
+    }
+  intr_set_level (old_level);
+}
+
+/* Sleeps until an event or the timeout of W since the last call,
+   or since poll_begin().  The process's lock is released
+   meanwhile. */
+void
+poll_wait (struct poll_waiter *w)
+{
+  process_unlock ();
+  sema_down (&w->sema);
+  process_lock ();
+}
+
+/* Ends the wait on W. */
+void
+poll_end (struct poll_waiter *w)
+{
+  enum intr_level old_level = intr_disable ();
+
+  list_remove (&w->elem);
+  if (w->has_timeout)
+    timer_event_cancel (&w->timeout);
+  intr_set_level (old_level);
+}
+
+/* Wakes every thread in poll() to check its descriptors again.
+   May be called from an interrupt handler. */
+void
+poll_notify (void)
+{
+  enum intr_level old_level = intr_disable ();
+  struct list_elem *e;
+
+  for (e = list_begin (&waiters); e != list_end (&waiters);
+       e = list_next (e))
+    {
+      struct poll_waiter *w = list_entry (e, struct poll_waiter, elem);
+
+      /* One pending wake-up is enough. */
+      if (w->sema.value == 0)
+        sema_up (&w->sema);
+    }
+  intr_set_level (old_level);
+}
+
+/* Timer event function: ends the wait of poll_waiter W_. */
+static void
+poll_timeout (void *w_)
+{
+  struct poll_waiter *w = w_;
+
+  w->timed_out = true;
+  sema_up (&w->sema);
+}
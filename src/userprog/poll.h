@@ -0,0 +1,36 @@
+#ifndef USERPROG_POLL_H
+#define USERPROG_POLL_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "devices/timer.h"
+#include "threads/synch.h"
+
+/* Waiting for descriptors to become ready.
+
+   A thread in poll() checks its descriptors and, if none is
+   ready, sleeps until something that could make one ready
+   happens: keys arrive at the console, or a pipe is read,
+   written or closed.  Each such event calls poll_notify(), which
+   wakes every polling thread to check its descriptors again.
+   Regular files are always ready, since their reads and writes
+   finish without waiting for other threads. */
+
+/* A thread in poll(). */
+struct poll_waiter
+  {
+    struct semaphore sema;      /* Upped by an event or the timeout. */
+    bool has_timeout;           /* Is TIMEOUT set? */
+    struct timer_event timeout; /* Ends the wait. */
+    bool timed_out;             /* Has TIMEOUT gone off? */
+    struct list_elem elem;      /* Element in the list of waiters. */
+  };
+
+void poll_init (void);
+void poll_begin (struct poll_waiter *, int64_t ticks);
+void poll_wait (struct poll_waiter *);
+void poll_end (struct poll_waiter *);
+void poll_notify (void);
+
+#endif /* userprog/poll.h */
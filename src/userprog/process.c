@@ -5,23 +5,259 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "userprog/aio.h"
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
+#include "userprog/uaccess.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 
 #include "threads/malloc.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#include "vm/snapshot.h"
+#endif
+
+/* Number of executables whose layout is cached. */
+#define EXEC_CACHE_SIZE 8
+
+/* Most page faults recorded in the trace of an executable. */
+#define EXEC_TRACE_MAX 64
+
+/* A loadable segment of an executable, as validated by load(). */
+struct exec_segment
+  {
+    off_t file_page;            /* Page-aligned offset in the file. */
+    void *mem_page;             /* First user page. */
+    uint32_t read_bytes;        /* Bytes to read from the file. */
+    uint32_t zero_bytes;        /* Bytes to zero after them. */
+    bool writable;              /* Is the segment writable? */
+  };
+
+/* The validated layout of an executable.  Kept in exec_cache so
+   that loading the same executable again skips reading and
+   checking its headers.  An image is only valid while the
+   executable's write count is unchanged.
+
+   Each run of an executable faults in much the same pages of it,
+   in much the same order, so an image also records a trace of
+   them: the first process to load the image records the pages of
+   the executable it faults on, up to EXEC_TRACE_MAX of them, and
+   when it is done the trace is sorted by address.  Each later
+   load() of the image reads the pages in the trace ahead, in
+   order, before the process starts, which spares it the faults
+   and reads the executable in one pass instead of a page at a
+   time as the faults jump around.  Only the tracing process
+   writes TRACE and TRACE_CNT, and no one reads them until TRACED
+   is set. */
+struct exec_image
+  {
+    struct list_elem elem;      /* Element in exec_cache. */
+    int ref_cnt;                /* The cache and each load() using it. */
+    struct inode *inode;        /* Executable, held open. */
+    unsigned write_cnt;         /* inode_write_cnt() when parsed. */
+    bool parsing;               /* Headers still being read? */
+    bool valid;                 /* Loadable executable, once parsed? */
+    bool cached;                /* In exec_cache? */
+    void (*entry) (void);       /* Entry point. */
+    int seg_cnt;                /* Number of segments. */
+    struct exec_segment *segs;  /* Loadable segments. */
+    bool tracing;               /* Being traced by a process? */
+    bool traced;                /* Is the trace complete? */
+    int trace_cnt;              /* Number of pages in TRACE. */
+    void *trace[EXEC_TRACE_MAX]; /* User pages, faulted or sorted. */
+  };
+
+/* Wakes up the spawn pool thread, which refills the pools of
+   thread pages and page directories that new processes take
+   theirs from. */
+static struct semaphore spawn_pool_sema;
+
+/* Cached executable images, most recently used first, and the
+   lock that protects the list and the images' REF_CNT, PARSING,
+   VALID, CACHED, TRACING and TRACED.  EXEC_PARSED is signaled
+   when an image has been parsed. */
+static struct list exec_cache;
+static size_t exec_cache_cnt;
+static struct lock exec_cache_lock;
+static struct condition exec_parsed;
 
 static thread_func start_process NO_RETURN;
+static thread_func spawn_pool NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static struct exec_image *exec_image_get (struct file *,
+                                          const char *file_name);
+static bool parse_executable (struct exec_image *, struct file *,
+                              const char *file_name);
+static void exec_cache_insert (struct exec_image *, struct list *dropped);
+static void exec_image_release (struct exec_image *);
+#ifdef VM
+static void start_trace (struct exec_image *);
+static void end_trace (void);
+#endif
+
+/* The exit status of a process, shared with its parent.  It
+   outlives whichever of the two exits first, so that an exiting
+   process frees its thread at once and its parent can still wait
+   for it.  It is freed when both are done with it. */
+struct child_status
+  {
+    tid_t tid;                          /* Child's thread id. */
+    bool started;                       /* Did the child load? */
+    int exit_code;                      /* Set before EXIT_SEMA is upped. */
+    struct semaphore start_sema;        /* Upped once the child loads. */
+    struct semaphore exit_sema;         /* Upped when the child exits. */
+    int ref_cnt;                        /* Parent and child, if alive. */
+    struct list_elem elem;              /* In the parent's children. */
+  };
+
+/* What process_execute() hands to the child. */
+struct exec_info
+  {
+    char *args;                         /* Page with the stack image. */
+    size_t args_ofs;                    /* Its offset in ARGS. */
+    const char *file_name;              /* argv[0], within ARGS. */
+    struct child_status *status;        /* Child's exit status. */
+    struct dir *cwd;                    /* Child's working directory. */
+    struct fd_entry *fds;               /* Child's descriptor table. */
+    int fd_cnt;                         /* Number of slots in FDS. */
+    bool strace;                        /* Trace the child's calls? */
+  };
+
+static bool build_args (struct exec_info *, const char *cmd_line);
+static struct child_status *child_status_create (void);
+static void child_status_release (struct child_status *);
+static tid_t wait_for_start (struct child_status *, tid_t, bool unlock);
+static void report_start (bool success);
+static void end_thread (void);
+#ifdef VM
+static thread_func start_fork NO_RETURN;
+static thread_func start_restore NO_RETURN;
+static thread_func start_thread NO_RETURN;
+static uint8_t *stack_slot_top (int slot);
+static void free_stack_slot (uint8_t *top);
+
+/* What process_fork() hands to the child. */
+struct fork_info
+  {
+    struct intr_frame if_;              /* Parent's user context. */
+    struct thread *parent;              /* Parent process. */
+    struct thread *caller;              /* Thread that called fork(). */
+    uint8_t *stack_top;                 /* The forking thread's stack. */
+    struct child_status *status;        /* Child's exit status. */
+  };
+
+/* What process_restore() hands to the child. */
+struct restore_info
+  {
+    struct file *file;                  /* Snapshot, owned by the child. */
+    struct child_status *status;        /* Child's exit status. */
+    bool strace;                        /* Trace the child's calls? */
+  };
+
+/* What process_thread_create() hands to the new thread. */
+struct thread_info
+  {
+    struct thread *process;             /* Process it runs in. */
+    struct child_status *status;        /* Its exit status. */
+    void *eip;                          /* User code to start at. */
+    void *esp;                          /* Initial user stack pointer. */
+    uint8_t *stack_top;                 /* Top of its stack slot. */
+  };
+#endif
+
+/* Initializes the cache of loaded executables and starts the
+   thread that keeps resources ready for new processes. */
+void
+process_init (void)
+{
+  list_init (&exec_cache);
+  lock_init_named (&exec_cache_lock, "exec_cache");
+  cond_init (&exec_parsed);
+  pagedir_init ();
+  sema_init (&spawn_pool_sema, 1);
+  thread_create ("spawn-pool", PRI_DEFAULT, spawn_pool, NULL);
+}
+
+/* Returns the thread that holds the state of the running
+   thread's process, which is the running thread itself unless
+   process_thread_create() started it. */
+struct thread *
+process_current (void)
+{
+  return thread_current ()->process;
+}
+
+/* Acquires the lock of the current process, which a thread
+   holds while it is in the kernel on behalf of the process. */
+void
+process_lock (void)
+{
+  lock_acquire (&process_current ()->process_lock);
+}
+
+/* Acquires the lock of the current process if no other thread
+   holds it.  Returns true if successful. */
+bool
+process_trylock (void)
+{
+  return lock_try_acquire (&process_current ()->process_lock);
+}
+
+/* Releases the lock of the current process. */
+void
+process_unlock (void)
+{
+  lock_release (&process_current ()->process_lock);
+}
+
+/* Returns true if the running thread holds the lock of its
+   process. */
+bool
+process_lock_held (void)
+{
+  return lock_held_by_current_thread (&process_current ()->process_lock);
+}
+
+/* Ends the running thread if a thread of its process has called
+   exit(), as each thread of the process does on its next way
+   back to user mode.  Called by intr_handler() on the way. */
+void
+process_check_exit (void)
+{
+  if (process_current ()->exiting)
+    {
+      intr_enable ();
+      thread_exit ();
+    }
+}
+
+/* Spawn pool thread.  Whenever woken up, refills the pools of
+   ready thread pages and page directories, so that processes
+   start without waiting for pages to be cleared or copied. */
+static void
+spawn_pool (void *aux UNUSED)
+{
+  for (;;)
+    {
+      sema_down (&spawn_pool_sema);
+      thread_pool_fill ();
+      pagedir_pool_fill ();
+    }
+}
 
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
@@ -29,136 +265,530 @@ static bool load (const char *cmdline, void (**eip) (void), void **esp);
    thread id, or TID_ERROR if the thread cannot be created. */
 tid_t
 process_execute (const char *file_name)  {
-  char *fn_copy;
-  tid_t tid;
+  return process_spawn (file_name, STDIN_FILENO, STDOUT_FILENO);
+}
 
-  struct thread *child;
+/* Like process_execute(), but the new process's descriptors 0
+   and 1 are copies of our STDIN_FD and STDOUT_FD, so that a
+   shell sets up a pipeline stage in one call.  Other threads of
+   the process go on while the child loads.  Returns TID_ERROR
+   also if STDIN_FD or STDOUT_FD is not open. */
+tid_t
+process_spawn (const char *file_name, int stdin_fd, int stdout_fd)
+{
+  struct thread *cur = process_current ();
+  struct exec_info info;
+  tid_t tid;
 
-  /* Make a copy of FILE_NAME.
+  /* Lay out the arguments in a page of our own.
      Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page (0);
-  if (fn_copy == NULL)
+  info.args = palloc_get_page (0);
+  if (info.args == NULL)
     return TID_ERROR;
-  strlcpy (fn_copy, file_name, PGSIZE);
-
- 
-  char *save;
-  char *fn_copy_malloc= malloc(strlen(file_name)+1);
-  if(fn_copy_malloc==NULL) {
-      palloc_free_page (fn_copy);
+  info.status = child_status_create ();
+  info.cwd = cur->cwd != NULL ? dir_reopen (cur->cwd) : NULL;
+  info.fds = NULL;
+  info.fd_cnt = 0;
+  info.strace = cur->strace;
+  if (info.status == NULL || !build_args (&info, file_name)
+      || (cur->cwd != NULL && info.cwd == NULL)
+      || !syscall_copy_fds (&info.fds, &info.fd_cnt, stdin_fd, stdout_fd))
+    {
+      syscall_close_fds (info.fds, info.fd_cnt);
+      dir_close (info.cwd);
+      free (info.status);
+      palloc_free_page (info.args);
       return TID_ERROR;
-  }
-  
-  memcpy(fn_copy_malloc,file_name,strlen(file_name)+1);
-  file_name= strtok_r(fn_copy_malloc, " ",&save);
+    }
 
-  /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
-  
+  /* Create a new thread to execute FILE_NAME.  From here on the
+     child frees INFO.ARGS and owns INFO.CWD and INFO.FDS, copies
+     of ours, so that it inherits our descriptors. */
+  tid = thread_create (info.file_name, PRI_DEFAULT, start_process, &info);
   if(tid==TID_ERROR) {
-      palloc_free_page (fn_copy);
+      syscall_close_fds (info.fds, info.fd_cnt);
+      dir_close (info.cwd);
+      free (info.status);
+      palloc_free_page (info.args);
       return TID_ERROR;
   }
 
-  /** User Code **/
- child = get_thread_by_tid(tid);
- sema_down(&child->self_wait);
- 
- if(child->return_status==-1)
-  tid=TID_ERROR;
+  sema_up (&spawn_pool_sema);
+  return wait_for_start (info.status, tid, true);
+}
+
+/* Builds in INFO->ARGS the initial user stack of a process run
+   with CMD_LINE, split into arguments at spaces: the argument
+   strings, argv[] with its null terminator, argv, argc and a fake
+   return address, in that order from the top down.  The image is
+   laid out at the end of the page exactly as it will be at the
+   top of the user stack, with the pointers holding their final
+   user addresses, so the child just copies it into place.
+
+   While the strings are copied, the addresses of argv[] are
+   collected at the bottom of the page and then moved up below
+   them.  Returns false if CMD_LINE has no argument or does not
+   fit in a page. */
+static bool
+build_args (struct exec_info *info, const char *cmd_line)
+{
+  uint8_t *page = (uint8_t *) info->args;
+  uint8_t *base = (uint8_t *) PHYS_BASE - PGSIZE;
+  char **argv_addrs = (char **) page;
+  uint8_t *top = page + PGSIZE;
+  uint8_t *argv_start;
+  uint32_t *words;
+  int argc = 0;
+
+  for (;;)
+    {
+      size_t len;
+
+      while (*cmd_line == ' ')
+        cmd_line++;
+      if (*cmd_line == '\0')
+        break;
+      for (len = 0; cmd_line[len] != ' ' && cmd_line[len] != '\0'; len++)
+        continue;
+
+      /* Leave room for this argument's address and the null
+         terminator of argv[]. */
+      if (top - page < (ptrdiff_t) (len + 1 + (argc + 2) * sizeof (char *)))
+        return false;
+      top -= len + 1;
+      memcpy (top, cmd_line, len);
+      top[len] = '\0';
+      if (argc == 0)
+        info->file_name = (char *) top;
+      argv_addrs[argc++] = (char *) (base + (top - page));
+      cmd_line += len;
+    }
+  if (argc == 0)
+    return false;
+
+  /* Word-align, then move argv[] into place and add the rest. */
+  argv_start = page + (((top - page) & ~3) - (argc + 1) * sizeof (char *));
+  if (argv_start - page < 3 * (ptrdiff_t) sizeof (uint32_t))
+    return false;
+  memmove (argv_start, argv_addrs, argc * sizeof (char *));
+  ((char **) argv_start)[argc] = NULL;
+  words = (uint32_t *) argv_start - 3;
+  words[0] = 0;                                   /* Return address. */
+  words[1] = argc;                                /* argc. */
+  words[2] = (uint32_t) (base + (argv_start - page)); /* argv. */
+  info->args_ofs = (uint8_t *) words - page;
+  return true;
+}
+
+/* Returns a new exit status record, referenced by both the
+   parent and the child, or a null pointer if memory is
+   exhausted. */
+static struct child_status *
+child_status_create (void)
+{
+  struct child_status *status = malloc (sizeof *status);
+
+  if (status == NULL)
+    return NULL;
+  status->tid = TID_ERROR;
+  status->started = false;
+  status->exit_code = -1;
+  sema_init (&status->start_sema, 0);
+  sema_init (&status->exit_sema, 0);
+  status->ref_cnt = 2;
+  return status;
+}
+
+/* Drops a reference to STATUS, freeing it if it was the last.
+   The parent and the child may drop theirs at the same time, so
+   the count is updated with interrupts off. */
+static void
+child_status_release (struct child_status *status)
+{
+  enum intr_level old_level = intr_disable ();
+  bool last = --status->ref_cnt == 0;
+  intr_set_level (old_level);
+
+  if (last)
+    free (status);
+}
+
+/* Waits until the child with thread id TID and exit status
+   STATUS has set itself up.  If UNLOCK is true, the process's
+   lock, if held, is released meanwhile, which is safe when the
+   child works only from copies of our state.  Returns TID, or
+   TID_ERROR if the child failed to start. */
+static tid_t
+wait_for_start (struct child_status *status, tid_t tid, bool unlock)
+{
+  unlock = unlock && process_lock_held ();
+  if (unlock)
+    process_unlock ();
+  sema_down (&status->start_sema);
+  if (unlock)
+    process_lock ();
+  if (!status->started)
+    {
+      /* The child exits on its own. */
+      child_status_release (status);
+      return TID_ERROR;
+    }
+
+  status->tid = tid;
+  list_push_back (&process_current ()->children, &status->elem);
+  return tid;
+}
+
+/* Tells the parent of the current process whether it has set
+   itself up successfully.  On failure the process must exit
+   afterward. */
+static void
+report_start (bool success)
+{
+  struct child_status *status = thread_current ()->self_status;
+
+  status->started = success;
+  sema_up (&status->start_sema);
+}
+
+#ifdef VM
+/* Starts a new process that is a copy of the current one and
+   returns to user mode from interrupt frame F, like the caller
+   but with 0 as the return value.  The child's memory shares the
+   parent's frames copy-on-write, so forking costs no copying
+   until one of the processes writes.  Open files are not
+   inherited, but the working directory is.  Returns the child's thread id, or TID_ERROR if it
+   cannot be created. */
+tid_t
+process_fork (struct intr_frame *f)
+{
+  struct fork_info info;
+  tid_t tid;
+
+  /* INFO stays valid because the child is done with it before
+     wait_for_start() returns. */
+  info.if_ = *f;
+  info.parent = process_current ();
+  info.caller = thread_current ();
+  info.stack_top = thread_current ()->stack_top;
+  info.status = child_status_create ();
+  if (info.status == NULL)
+    return TID_ERROR;
+  tid = thread_create (thread_name (), PRI_DEFAULT, start_fork, &info);
+  if (tid == TID_ERROR)
+    {
+      free (info.status);
+      return TID_ERROR;
+    }
+  sema_up (&spawn_pool_sema);
+  return wait_for_start (info.status, tid, false);
+}
+
+/* A thread function that copies the parent's address space into
+   a forked process and starts it running. */
+static void
+start_fork (void *info_)
+{
+  struct fork_info *info = info_;
+  struct intr_frame if_ = info->if_;
+  struct thread *parent = info->parent;
+  struct thread *t = thread_current ();
+  bool success = false;
+
+  t->self_status = info->status;
+  t->heap_start = parent->heap_start;
+  t->heap_end = parent->heap_end;
+  t->stack_top = info->stack_top;
+  t->stack_slots = parent->stack_slots;
+  t->strace = parent->strace;
+  if (parent->cwd != NULL)
+    t->cwd = dir_reopen (parent->cwd);
+  t->pagedir = pagedir_create ();
+  if (t->pagedir != NULL && (parent->cwd == NULL || t->cwd != NULL)
+      && fpu_fork (t, info->caller))
+    {
+      process_activate ();
+      if (vm_page_table_init () && parent->self_file != NULL)
+        t->self_file = file_reopen (parent->self_file);
+      if (t->self_file != NULL)
+        {
+          file_deny_write (t->self_file);
+          success = vm_fork_pages (parent);
+        }
+    }
+
+  /* Report to the parent, which lets it go on. */
+  report_start (success);
+  if (!success)
+    thread_exit ();
+
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Starts a new process from the snapshot in FILE_NAME, saved by
+   vm_snapshot_save(), which goes on from where the saved process
+   called snapshot() as if that returned 1.  Pages of the snapshot
+   are only read when touched.  Returns the new process's thread
+   id, or TID_ERROR if the file cannot be opened or is not a valid
+   snapshot. */
+tid_t
+process_restore (const char *file_name)
+{
+  struct restore_info info;
+  tid_t tid;
+
+  info.file = filesys_open (file_name);
+  info.status = child_status_create ();
+  info.strace = process_current ()->strace;
+  if (info.file == NULL || info.status == NULL)
+    {
+      file_close (info.file);
+      free (info.status);
+      return TID_ERROR;
+    }
+  tid = thread_create ("restore", PRI_DEFAULT, start_restore, &info);
+  if (tid == TID_ERROR)
+    {
+      file_close (info.file);
+      free (info.status);
+      return TID_ERROR;
+    }
+  sema_up (&spawn_pool_sema);
+  return wait_for_start (info.status, tid, true);
+}
 
- while(child->status == THREAD_BLOCKED)
-  thread_unblock(child);
+/* A thread function that sets up a process from a snapshot and
+   starts it running.  The snapshot stays open as the process's
+   self_file, which its pages are read from. */
+static void
+start_restore (void *info_)
+{
+  struct restore_info *info = info_;
+  struct thread *t = thread_current ();
+  struct intr_frame if_;
+  bool success = false;
 
-if(child->return_status==-1)
-  process_wait(child->tid);
+  t->self_status = info->status;
+  t->self_file = info->file;
+  t->strace = info->strace;
+  file_deny_write (t->self_file);
+  t->pagedir = pagedir_create ();
+  if (t->pagedir != NULL)
+    {
+      process_activate ();
+      success = (vm_page_table_init ()
+                 && vm_snapshot_load (t->self_file, &if_));
+    }
+
+  /* Report to the parent, which lets it go on. */
+  report_start (success);
+  if (!success)
+    thread_exit ();
 
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Starts a new thread in the current process that enters user
+   mode at EIP with a stack of its own, as if EIP had been called
+   with arguments FUNC and AUX, which the user library's start
+   routine at EIP passes on to the thread's function.  The thread
+   shares the process's address space, descriptors and the rest
+   of its state.  Returns the new thread's id, or TID_ERROR if
+   all stack slots are taken or the thread cannot be created.
+   Must be called with the process's lock held. */
+tid_t
+process_thread_create (void *eip, void *func, void *aux)
+{
+  struct thread *p = process_current ();
+  uint32_t args[3] = { 0, (uint32_t) func, (uint32_t) aux };
+  struct thread_info info;
+  tid_t tid;
+  int slot;
+
+  ASSERT (process_lock_held ());
+  if (!is_user_vaddr (eip))
+    return TID_ERROR;
+  for (slot = 0; slot < PROCESS_THREAD_MAX; slot++)
+    if ((p->stack_slots & (1u << slot)) == 0)
+      break;
+  if (slot == PROCESS_THREAD_MAX || stack_slot_top (slot) == NULL)
+    return TID_ERROR;
+
+  /* The stack starts with a fake return address and the start
+     routine's arguments, on a page that is only loaded when
+     copy_to_user() touches it. */
+  info.stack_top = stack_slot_top (slot);
+  info.esp = info.stack_top - sizeof args;
+  if (!vm_range_is_free (info.stack_top - PGSIZE, 1)
+      || vm_new_zero_page (info.stack_top - PGSIZE, true) == NULL)
+    return TID_ERROR;
+  info.process = p;
+  info.eip = eip;
+  info.status = child_status_create ();
+  if (info.status == NULL || !copy_to_user (info.esp, args, sizeof args))
+    {
+      free (info.status);
+      free_stack_slot (info.stack_top);
+      return TID_ERROR;
+    }
+
+  /* The thread counts as running in the process from here on,
+     so that the process waits for it to end before exiting. */
+  p->stack_slots |= 1u << slot;
+  p->thread_cnt++;
+  tid = thread_create (thread_name (), PRI_DEFAULT, start_thread, &info);
   if (tid == TID_ERROR)
-    palloc_free_page (fn_copy); 
+    {
+      p->thread_cnt--;
+      free (info.status);
+      free_stack_slot (info.stack_top);
+      return TID_ERROR;
+    }
+
+  /* INFO stays valid until the thread ups START_SEMA. */
+  sema_down (&info.status->start_sema);
+  info.status->tid = tid;
+  list_push_back (&p->threads, &info.status->elem);
   return tid;
 }
 
+/* A thread function that joins a thread to a process and starts
+   it running in user mode. */
+static void
+start_thread (void *info_)
+{
+  struct thread_info *info = info_;
+  struct thread *t = thread_current ();
+  struct intr_frame if_;
+
+  t->process = info->process;
+  t->pagedir = info->process->pagedir;
+  t->self_status = info->status;
+  t->stack_top = info->stack_top;
+
+  memset (&if_, 0, sizeof if_);
+  if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
+  if_.cs = SEL_UCSEG;
+  if_.eflags = FLAG_IF | FLAG_MBS;
+  if_.eip = info->eip;
+  if_.esp = info->esp;
+  process_activate ();
+
+  /* Let the creator go on, which makes INFO invalid. */
+  sema_up (&t->self_status->start_sema);
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Waits for thread TID of the current process, started by
+   process_thread_create(), to end, and returns the status it
+   passed to thread_exit(), or -1 if it was ended otherwise.
+   Returns -1 at once if TID is not such a thread, is the calling
+   thread, or has already been joined.  The process's lock is
+   released meanwhile, since the thread may need it to end. */
+int
+process_thread_join (tid_t tid)
+{
+  struct thread *p = process_current ();
+  struct list_elem *e;
+
+  if (tid == thread_current ()->tid)
+    return -1;
+  for (e = list_begin (&p->threads); e != list_end (&p->threads);
+       e = list_next (e))
+    {
+      struct child_status *status = list_entry (e, struct child_status, elem);
+      int exit_code;
+
+      if (status->tid != tid)
+        continue;
+
+      /* Another thread joining TID does not find it. */
+      list_remove (e);
+      process_unlock ();
+      sema_down (&status->exit_sema);
+      process_lock ();
+      exit_code = status->exit_code;
+      child_status_release (status);
+      return exit_code;
+    }
+  return -1;
+}
+
+/* Returns the top of the user stack in stack slot SLOT, or a null
+   pointer if the slot does not fit below the first thread's
+   stack. */
+static uint8_t *
+stack_slot_top (int slot)
+{
+  size_t below = vm_stack_limit + (size_t) slot * PROCESS_STACK_SIZE;
+
+  if (below + PROCESS_STACK_SIZE >= (size_t) PHYS_BASE)
+    return NULL;
+  return (uint8_t *) PHYS_BASE - below;
+}
+
+/* Gives the stack slot whose top is TOP back to the current
+   process, freeing the pages its stack has grown to.  Pages of
+   memory mappings or shared memory that the process placed in
+   the slot are left alone. */
+static void
+free_stack_slot (uint8_t *top)
+{
+  int slot = (stack_slot_top (0) - top) / PROCESS_STACK_SIZE;
+  uint8_t *upage;
+
+  process_current ()->stack_slots &= ~(1u << slot);
+  for (upage = top - PROCESS_STACK_SIZE; upage < top; upage += PGSIZE)
+    {
+      struct vm_page *page = vm_lookup_page (upage);
+
+      if (page != NULL && (page->type == ZERO || page->type == SWAP))
+        vm_free_page (page);
+    }
+}
+#endif
+
 /* A thread function that loads a user process and starts it
    running. */
-static void start_process (void *file_name_)
+static void start_process (void *info_)
 {
-  char *file_name = file_name_;
+  struct exec_info *info = info_;
+  char *args = info->args;
+  size_t args_ofs = info->args_ofs;
   struct intr_frame intr_frm;
   bool success;
 
-  /* My Implementation */
-  char *token, *save_ptr;
-  void *start;
-  int argc;
-  int i;
-  int *argv_off; /* Maximum of 2 arguments */
-  size_t file_name_lenght;
-  struct thread *t;
-  /* == My Implementation */
+  thread_current ()->self_status = info->status;
+  thread_current ()->cwd = info->cwd;
+  thread_current ()->fds = info->fds;
+  thread_current ()->fd_cnt = info->fd_cnt;
+  thread_current ()->strace = info->strace;
 
   /* Initialize interrupt frame and load executable. */
   memset (&intr_frm, 0, sizeof intr_frm);
   intr_frm.gs = intr_frm.fs = intr_frm.es = intr_frm.ds = intr_frm.ss = SEL_UDSEG;
   intr_frm.cs = SEL_UCSEG;
   intr_frm.eflags = FLAG_IF | FLAG_MBS;
- 
-  /* My Implementation */
-  t = thread_current ();
-  argc = 0;
-  argv_off = malloc (32 * sizeof (int));
-  if (!argv_off)
-    goto end;
-  file_name_lenght = strlen (file_name);
-  argv_off[0] = 0;
-  for (token = strtok_r (file_name, " ", &save_ptr); token != NULL;token = strtok_r (NULL, " ", &save_ptr)) {
-      while (*(save_ptr) == ' ')
-            ++save_ptr;
-      argv_off[++argc] = save_ptr - file_name;
-   }
- 
-  success = load (file_name, &intr_frm.eip, &intr_frm.esp);
- 
-  /* Setting up stack */
-  if (success) {
-      t->self_file = filesys_open (file_name);
-      file_deny_write (t->self_file);
-      intr_frm.esp -= file_name_lenght + 1;
-      start = intr_frm.esp;
-      memcpy (intr_frm.esp, file_name, file_name_lenght + 1);
-      intr_frm.esp -= 4 - (file_name_lenght + 1) % 4;
-      intr_frm.esp -= 4;
-      *(int *)(intr_frm.esp) = 0;
-      /* Now pushing argv[x] */
-      for (i = argc - 1; i >= 0; --i) {
-          intr_frm.esp -= 4;
-          *(void **)(intr_frm.esp) = start + argv_off[i]; /* argv[x] */
-        }
+  success = load (info->file_name, &intr_frm.eip, &intr_frm.esp);
 
-      intr_frm.esp -= 4;
-      *(char **)(intr_frm.esp) = (intr_frm.esp + 4); /* argv */
-      intr_frm.esp -= 4;
-      *(int *)(intr_frm.esp) = argc;
-      intr_frm.esp -= 4;
-      *(int *)(intr_frm.esp) = 0;
-     
-      sema_up (&t->self_wait);
-      intr_disable ();
-      thread_block ();
-      intr_enable ();
-    } else {
-      free (argv_off);
-end:
-      t->return_status = -1;
-      sema_up (&t->self_wait);
-      intr_disable ();
-      thread_block ();
-      intr_enable ();
-      thread_exit ();
+  /* Copy the arguments to the top of the stack. */
+  if (success)
+    {
+      intr_frm.esp = (uint8_t *) PHYS_BASE - (PGSIZE - args_ofs);
+      memcpy (intr_frm.esp, args + args_ofs, PGSIZE - args_ofs);
     }
- 
-  free (argv_off);
-  /* If load failed, quit. */
-  palloc_free_page (file_name);
+  palloc_free_page (args);
+
+  /* Tell the parent, which lets it go on.  If load failed,
+     quit. */
+  report_start (success);
+  if (!success)
+    thread_exit ();
+
   /* Start the user process by simulating a return from an
      interrupt, implemented by intr_exit (in
      threads/intr-stubs.S).  Because intr_exit takes all of its
@@ -174,61 +804,81 @@ end:
    exception), returns -1.  If TID is invalid or if it was not a
    child of the calling process, or if process_wait() has already
    been successfully called for the given TID, returns -1
-   immediately, without waiting.
-
-   This function will be implemented in problem 2-2.  For now, it
-   does nothing. */
+   immediately, without waiting. */
 int
 process_wait (tid_t child_tid)  {
-  //return -1;
-
-  struct thread *c_t;
-  int return_value=-1;
-
-  c_t=get_thread_by_tid(child_tid);
- //debug_backtrace_all();
-  
-  if(!c_t || c_t->return_status==-1 || c_t->status == THREAD_DYING)
-    goto end;
-
-  if(c_t->return_status!=-1 && c_t->return_status!=0) {
-    return_value=c_t->return_status;
-    goto end;
-  }
-
-  sema_down(&c_t->self_wait);
-
-  return_value=c_t->return_status;
-
-  printf("%s: exit(%d)\n", c_t->name, return_value);
-  while(c_t->status== THREAD_BLOCKED)
-    thread_unblock(c_t);
-
-  end:
-    c_t->return_status=-1;
-    return return_value;
+  struct list *children = &process_current ()->children;
+  struct list_elem *e;
 
+  for (e = list_begin (children); e != list_end (children); e = list_next (e))
+    {
+      struct child_status *status = list_entry (e, struct child_status, elem);
+      int exit_code;
+
+      if (status->tid != child_tid)
+        continue;
+
+      /* The other threads of the process may go on meanwhile, but
+         do not find the child to wait for it too. */
+      list_remove (e);
+      process_unlock ();
+      sema_down (&status->exit_sema);
+      process_lock ();
+      exit_code = status->exit_code;
+      child_status_release (status);
+      return exit_code;
+    }
+  return -1;
 }
 
-/* Free the current process's resources. */
+/* Free the current process's resources.  A thread started by
+   process_thread_create() only gives back its own; the process's
+   first thread waits for the others to end first. */
 void process_exit (void) {
   struct thread *cur = thread_current ();
   uint32_t *pd;
-  /** User Code **/
 
-  while(!list_empty(&cur->self_wait.waiters))
-    sema_up(&cur->self_wait);
+  if (cur->process != cur)
+    {
+      end_thread ();
+      return;
+    }
+
+  /* The other threads end on their way back to user mode. */
+  if (!process_lock_held ())
+    process_lock ();
+  cur->exiting = true;
+  while (cur->thread_cnt > 0)
+    cond_wait (&cur->threads_done, &cur->process_lock);
+  process_unlock ();
+  while (!list_empty (&cur->threads))
+    child_status_release (list_entry (list_pop_front (&cur->threads),
+                                      struct child_status, elem));
+
+#ifdef VM
+  /* Write back the mapped files, then free the pages before
+     closing the executable they may be loaded from. */
+  vm_delete_all_mfiles ();
+  vm_free_all_pages ();
+#endif
+  /** User Code **/
 
+  aio_exit ();
+#ifdef VM
+  end_trace ();
+#endif
   file_close(cur->self_file);
   cur->self_file=NULL;
-  cur->exit_status=true;
-
-  if(cur->parent) {
-    intr_disable();
-    thread_block();
-    intr_enable();
-  }
+  dir_close (cur->cwd);
+  cur->cwd = NULL;
+  syscall_close_fds (cur->fds, cur->fd_cnt);
+  cur->fds = NULL;
+  cur->fd_cnt = 0;
 
+  /* The children's statuses are no longer needed by us. */
+  while (!list_empty (&cur->children))
+    child_status_release (list_entry (list_pop_front (&cur->children),
+                                      struct child_status, elem));
 
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
@@ -245,6 +895,54 @@ void process_exit (void) {
       pagedir_activate (NULL);
       pagedir_destroy (pd);
     }
+
+  /* Hand the exit code to the parent.  Our thread is freed as
+     soon as we return. */
+  if (cur->self_status != NULL)
+    {
+      printf ("%s: exit(%d)\n", cur->name, cur->return_status);
+#ifdef VM
+      if (vm_print_stats)
+        printf ("%s: faults %u minor, %u major; evictions %u; "
+                "swap-outs %u; max resident %u\n", cur->name,
+                cur->vm_stats.minor_faults, cur->vm_stats.major_faults,
+                cur->vm_stats.evictions, cur->vm_stats.swap_outs,
+                cur->vm_stats.max_resident);
+#endif
+      cur->self_status->exit_code = cur->return_status;
+      sema_up (&cur->self_status->exit_sema);
+      child_status_release (cur->self_status);
+      cur->self_status = NULL;
+    }
+}
+
+/* Ends a thread started by process_thread_create(): frees its
+   stack, hands its exit code to a thread that joins it and lets
+   the process's first thread know, in case it is waiting to
+   exit. */
+static void
+end_thread (void)
+{
+  struct thread *cur = thread_current ();
+  struct thread *p = cur->process;
+
+  if (!process_lock_held ())
+    process_lock ();
+#ifdef VM
+  free_stack_slot (cur->stack_top);
+#endif
+
+  /* The page directory is the process's, so it is only let go.
+     It stays active, borrowed, until the next thread switch. */
+  cur->pagedir = NULL;
+
+  cur->self_status->exit_code = cur->return_status;
+  sema_up (&cur->self_status->exit_sema);
+  child_status_release (cur->self_status);
+  cur->self_status = NULL;
+  p->thread_cnt--;
+  cond_signal (&p->threads_done, &p->process_lock);
+  process_unlock ();
 }
 
 /* Sets up the CPU for running user code in the current
@@ -253,8 +951,14 @@ void process_exit (void) {
 void process_activate (void) {
   struct thread *t = thread_current ();
 
-  /* Activate thread's page tables. */
-  pagedir_activate (t->pagedir);
+  /* Activate thread's page tables.  A kernel thread never
+     touches user memory, so it borrows the page directory of
+     whichever thread ran before it instead of flushing the TLB.
+     That page directory cannot be freed under it: a process
+     switches to the base page directory before destroying its
+     own. */
+  if (t->pagedir != NULL)
+    pagedir_switch (t->pagedir);
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
@@ -334,9 +1038,8 @@ static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
    Returns true if successful, false otherwise. */
 bool load (const char *file_name, void (**eip) (void), void **esp)  {
   struct thread *t = thread_current ();
-  struct Elf32_Ehdr ehdr;
+  struct exec_image *image = NULL;
   struct file *file = NULL;
-  off_t file_ofs;
   bool success = false;
   int i;
 
@@ -345,6 +1048,10 @@ bool load (const char *file_name, void (**eip) (void), void **esp)  {
   if (t->pagedir == NULL) 
     goto done;
   process_activate ();
+#ifdef VM
+  if (!vm_page_table_init ())
+    goto done;
+#endif
 
   /* Open executable file. */
   file = filesys_open (file_name);
@@ -354,31 +1061,177 @@ bool load (const char *file_name, void (**eip) (void), void **esp)  {
       goto done; 
     }
 
+  /* Find the layout of the executable. */
+  image = exec_image_get (file, file_name);
+  if (image == NULL)
+    goto done;
+
+  t->heap_start = NULL;
+  for (i = 0; i < image->seg_cnt; i++)
+    {
+      struct exec_segment *seg = &image->segs[i];
+      uint8_t *seg_end = ((uint8_t *) seg->mem_page + seg->read_bytes
+                          + seg->zero_bytes);
+
+      if (!load_segment (file, seg->file_page, seg->mem_page,
+                         seg->read_bytes, seg->zero_bytes, seg->writable))
+        goto done;
+      if (seg_end > t->heap_start)
+        t->heap_start = seg_end;
+    }
+  t->heap_end = t->heap_start;
+
+  /* Set up stack. */
+  if (!setup_stack (esp))
+    goto done;
+
+  /* Start address. */
+  *eip = image->entry;
+
+  success = true;
+#ifdef VM
+  start_trace (image);
+#endif
+
+ done:
+  /* We arrive here whether the load is successful or not.  On
+     success the executable stays open, and writes to it denied,
+     while the process runs: its pages may be loaded from it at
+     any time. */
+  if (image != NULL)
+    exec_image_release (image);
+  if (success)
+    {
+      file_deny_write (file);
+      t->self_file = file;
+    }
+  else
+    file_close (file);
+  return success;
+}
+
+/* Returns the layout of executable FILE, with a reference that
+   the caller must drop with exec_image_release(), or a null
+   pointer if FILE is not a loadable executable or memory is
+   exhausted.  The layout comes from the cache if FILE has not
+   been written since it was cached; otherwise FILE's headers are
+   read and the result is cached.  The headers are read without
+   the cache's lock, so loads of other executables go on, but an
+   image goes into the cache before it is parsed, so that loads of
+   the same executable meanwhile wait for it instead of reading
+   the headers again. */
+static struct exec_image *
+exec_image_get (struct file *file, const char *file_name)
+{
+  struct inode *inode = file_get_inode (file);
+  struct exec_image *image;
+  struct list dropped;
+  struct list_elem *e;
+  bool valid;
+
+  lock_acquire (&exec_cache_lock);
+  for (e = list_begin (&exec_cache); e != list_end (&exec_cache);
+       e = list_next (e))
+    {
+      image = list_entry (e, struct exec_image, elem);
+      if (image->inode == inode && image->write_cnt == inode_write_cnt (inode))
+        {
+          list_remove (e);
+          list_push_front (&exec_cache, e);
+          image->ref_cnt++;
+          while (image->parsing)
+            cond_wait (&exec_parsed, &exec_cache_lock);
+          valid = image->valid;
+          lock_release (&exec_cache_lock);
+          if (valid)
+            return image;
+          exec_image_release (image);
+          return NULL;
+        }
+    }
+
+  image = malloc (sizeof *image);
+  if (image == NULL)
+    {
+      lock_release (&exec_cache_lock);
+      return NULL;
+    }
+  image->ref_cnt = 1;
+  image->inode = inode_reopen (inode);
+  image->write_cnt = inode_write_cnt (inode);
+  image->seg_cnt = 0;
+  image->segs = NULL;
+  image->parsing = true;
+  image->valid = false;
+  image->tracing = false;
+  image->traced = false;
+  image->trace_cnt = 0;
+  list_init (&dropped);
+  exec_cache_insert (image, &dropped);
+  lock_release (&exec_cache_lock);
+  while (!list_empty (&dropped))
+    exec_image_release (list_entry (list_pop_front (&dropped),
+                                    struct exec_image, elem));
+
+  valid = parse_executable (image, file, file_name);
+
+  /* An image that failed leaves the cache, with its reference. */
+  lock_acquire (&exec_cache_lock);
+  image->parsing = false;
+  image->valid = valid;
+  if (!valid && image->cached)
+    {
+      list_remove (&image->elem);
+      image->cached = false;
+      exec_cache_cnt--;
+      image->ref_cnt--;
+    }
+  cond_broadcast (&exec_parsed, &exec_cache_lock);
+  lock_release (&exec_cache_lock);
+  if (valid)
+    return image;
+  exec_image_release (image);
+  return NULL;
+}
+
+/* Reads and validates the headers of executable FILE into IMAGE.
+   Returns false if FILE is not a loadable executable or memory
+   is exhausted. */
+static bool
+parse_executable (struct exec_image *image, struct file *file,
+                  const char *file_name)
+{
+  struct Elf32_Ehdr ehdr;
+  struct Elf32_Phdr *phdrs = NULL;
+  off_t phdrs_size;
+  int i;
+
   /* Read and verify executable header. */
-  if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
+  if (file_read_at (file, &ehdr, sizeof ehdr, 0) != sizeof ehdr
       || memcmp (ehdr.e_ident, "\177ELF\1\1\1", 7)
       || ehdr.e_type != 2
       || ehdr.e_machine != 3
       || ehdr.e_version != 1
       || ehdr.e_phentsize != sizeof (struct Elf32_Phdr)
+      || ehdr.e_phnum == 0
       || ehdr.e_phnum > 1024) {
       printf ("load: %s: error loading executable\n", file_name);
-      goto done; 
+      goto error;
     }
 
-  /* Read program headers. */
-  file_ofs = ehdr.e_phoff;
-  for (i = 0; i < ehdr.e_phnum; i++) {
-      struct Elf32_Phdr phdr;
+  /* Read the program headers, all in one go. */
+  phdrs_size = ehdr.e_phnum * sizeof *phdrs;
+  phdrs = malloc (phdrs_size);
+  image->segs = malloc (ehdr.e_phnum * sizeof *image->segs);
+  if (phdrs == NULL || image->segs == NULL
+      || ehdr.e_phoff > (Elf32_Off) file_length (file)
+      || file_read_at (file, phdrs, phdrs_size, ehdr.e_phoff) != phdrs_size)
+    goto error;
 
-      if (file_ofs < 0 || file_ofs > file_length (file))
-        goto done;
-      file_seek (file, file_ofs);
+  for (i = 0; i < ehdr.e_phnum; i++) {
+      struct Elf32_Phdr *phdr = &phdrs[i];
 
-      if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
-        goto done;
-      file_ofs += sizeof phdr;
-      switch (phdr.p_type) 
+      switch (phdr->p_type) 
         {
         case PT_NULL:
         case PT_NOTE:
@@ -390,55 +1243,193 @@ bool load (const char *file_name, void (**eip) (void), void **esp)  {
         case PT_DYNAMIC:
         case PT_INTERP:
         case PT_SHLIB:
-          goto done;
+          goto error;
         case PT_LOAD:
-          if (validate_segment (&phdr, file)) {
-              bool writable = (phdr.p_flags & PF_W) != 0;
-              uint32_t file_page = phdr.p_offset & ~PGMASK;
-              uint32_t mem_page = phdr.p_vaddr & ~PGMASK;
-              uint32_t page_offset = phdr.p_vaddr & PGMASK;
-              uint32_t read_bytes, zero_bytes;
-              if (phdr.p_filesz > 0) {
+          if (validate_segment (phdr, file)) {
+              struct exec_segment *seg = &image->segs[image->seg_cnt++];
+              uint32_t page_offset = phdr->p_vaddr & PGMASK;
+
+              seg->writable = (phdr->p_flags & PF_W) != 0;
+              seg->file_page = phdr->p_offset & ~PGMASK;
+              seg->mem_page = (void *) (phdr->p_vaddr & ~PGMASK);
+              if (phdr->p_filesz > 0) {
                   /* Normal segment.
                      Read initial part from disk and zero the rest. */
-                  read_bytes = page_offset + phdr.p_filesz;
-                  zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
-                                - read_bytes);
+                  seg->read_bytes = page_offset + phdr->p_filesz;
+                  seg->zero_bytes = (ROUND_UP (page_offset + phdr->p_memsz,
+                                               PGSIZE)
+                                     - seg->read_bytes);
                 }
               else {
                   /* Entirely zero.
                      Don't read anything from disk. */
-                  read_bytes = 0;
-                  zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
+                  seg->read_bytes = 0;
+                  seg->zero_bytes = ROUND_UP (page_offset + phdr->p_memsz,
+                                              PGSIZE);
                 }
-              if (!load_segment (file, file_page, (void *) mem_page,
-                                 read_bytes, zero_bytes, writable))
-                goto done;
             }
           else
-            goto done;
+            goto error;
           break;
         }
     }
 
-  /* Set up stack. */
-  if (!setup_stack (esp))
-    goto done;
+  image->entry = (void (*) (void)) ehdr.e_entry;
+  free (phdrs);
+  return true;
 
-  /* Start address. */
-  *eip = (void (*) (void)) ehdr.e_entry;
+ error:
+  free (phdrs);
+  return false;
+}
 
-  success = true;
+/* Adds IMAGE to the cache of executable images, which takes a
+   reference to it.  Drops the stale images of the same
+   executable, the images of removed executables, which would
+   otherwise keep their disk space allocated, and the least
+   recently used image if the cache is full, adding them to
+   DROPPED, whose references the caller must release after
+   releasing the cache's lock.  Must be called with the lock
+   held. */
+static void
+exec_cache_insert (struct exec_image *image, struct list *dropped)
+{
+  struct list_elem *e, *next;
 
- done:
-  /* We arrive here whether the load is successful or not. */
-  file_close (file);
-  return success;
+  ASSERT (lock_held_by_current_thread (&exec_cache_lock));
+  for (e = list_begin (&exec_cache); e != list_end (&exec_cache); e = next)
+    {
+      struct exec_image *old = list_entry (e, struct exec_image, elem);
+
+      next = list_next (e);
+      if (old->inode == image->inode || inode_is_removed (old->inode))
+        {
+          list_remove (e);
+          list_push_back (dropped, e);
+          old->cached = false;
+          exec_cache_cnt--;
+        }
+    }
+  if (exec_cache_cnt == EXEC_CACHE_SIZE)
+    {
+      e = list_pop_back (&exec_cache);
+      list_push_back (dropped, e);
+      list_entry (e, struct exec_image, elem)->cached = false;
+      exec_cache_cnt--;
+    }
+  list_push_front (&exec_cache, &image->elem);
+  image->cached = true;
+  exec_cache_cnt++;
+  image->ref_cnt++;
 }
-
+
+/* Drops a reference to IMAGE, freeing it if it was the last. */
+static void
+exec_image_release (struct exec_image *image)
+{
+  bool last;
+
+  lock_acquire (&exec_cache_lock);
+  last = --image->ref_cnt == 0;
+  lock_release (&exec_cache_lock);
+
+  if (last)
+    {
+      inode_close (image->inode);
+      free (image->segs);
+      free (image);
+    }
+}
+
+#ifdef VM
+/* Reads ahead the pages in the trace of IMAGE, which the current
+   process has just loaded, or has the process record the trace
+   if no other process is recording it.  The pages are loaded only
+   while free frames last, and mapped as not accessed, so that the
+   clock evicts them first if this run does not use them. */
+static void
+start_trace (struct exec_image *image)
+{
+  struct thread *t = process_current ();
+  bool traced;
+  int i;
+
+  lock_acquire (&exec_cache_lock);
+  traced = image->traced;
+  if (!traced && !image->tracing)
+    {
+      image->tracing = true;
+      image->ref_cnt++;
+      t->trace_image = image;
+    }
+  lock_release (&exec_cache_lock);
+
+  if (traced)
+    for (i = 0; i < image->trace_cnt; i++)
+      if (!vm_prefetch_page (image->trace[i]))
+        break;
+}
+
+/* Records a page fault of the current process on user page UPAGE,
+   whose data comes from FILE, in the trace it is recording, if
+   any.  Only faults on pages of the executable are recorded. */
+void
+process_trace_fault (struct file *file, void *upage)
+{
+  struct thread *t = process_current ();
+  struct exec_image *image = t->trace_image;
+
+  if (image == NULL || file != t->self_file)
+    return;
+  image->trace[image->trace_cnt++] = upage;
+  if (image->trace_cnt == EXEC_TRACE_MAX)
+    end_trace ();
+}
+
+/* Compares the user pages A_ and B_ by address, for qsort(). */
+static int
+compare_pages (const void *a_, const void *b_)
+{
+  const uint8_t *a = *(void **) a_;
+  const uint8_t *b = *(void **) b_;
+
+  return a < b ? -1 : a > b;
+}
+
+/* Completes the trace that the current process is recording, if
+   any, sorting it by address without duplicates. */
+static void
+end_trace (void)
+{
+  struct thread *t = process_current ();
+  struct exec_image *image = t->trace_image;
+  int i, cnt;
+
+  if (image == NULL)
+    return;
+  t->trace_image = NULL;
+
+  qsort (image->trace, image->trace_cnt, sizeof *image->trace,
+         compare_pages);
+  for (i = cnt = 0; i < image->trace_cnt; i++)
+    if (cnt == 0 || image->trace[i] != image->trace[cnt - 1])
+      image->trace[cnt++] = image->trace[i];
+  image->trace_cnt = cnt;
+
+  lock_acquire (&exec_cache_lock);
+  image->tracing = false;
+  image->traced = true;
+  lock_release (&exec_cache_lock);
+  exec_image_release (image);
+}
+#endif
+
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
+static void unmap_heap_pages (uint8_t *upage, size_t cnt);
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -507,6 +1498,13 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifdef VM
+  /* Register the segment, whose pages are read from FILE on their
+     first access.  Read-only pages may share a frame with the
+     same page of another process running FILE. */
+  return vm_new_region (upage, (read_bytes + zero_bytes) / PGSIZE, file, ofs,
+                        read_bytes, writable, true);
+#else
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
@@ -542,6 +1540,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       upage += PGSIZE;
     }
   return true;
+#endif
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
@@ -549,6 +1548,12 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 static bool
 setup_stack (void **esp) 
 {
+#ifdef VM
+  if (vm_grow_stack (((uint8_t *) PHYS_BASE) - PGSIZE, false) == NULL)
+    return false;
+  *esp = PHYS_BASE;
+  return true;
+#else
   uint8_t *kpage;
   bool success = false;
 
@@ -563,8 +1568,109 @@ setup_stack (void **esp)
         palloc_free_page (kpage);
     }
   return success;
+#endif
+}
+
+/* Maps zeroed, writable pages at the CNT user pages starting at
+   UPAGE, which are past the current process's heap.  Returns
+   true if successful, false if any of the pages is in use or
+   memory is exhausted, in which case none is mapped. */
+static bool
+map_heap_pages (uint8_t *upage, size_t cnt)
+{
+  size_t i;
+
+#ifdef VM
+  if (!vm_range_is_free (upage, cnt))
+    return false;
+  for (i = 0; i < cnt; i++)
+    if (vm_new_zero_page (upage + i * PGSIZE, true) == NULL)
+      {
+        while (i-- > 0)
+          vm_free_page (vm_find_page (upage + i * PGSIZE));
+        return false;
+      }
+#else
+  for (i = 0; i < cnt; i++)
+    {
+      uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+
+      if (kpage == NULL || !install_page (upage + i * PGSIZE, kpage, true))
+        {
+          palloc_free_page (kpage);
+          unmap_heap_pages (upage, i);
+          return false;
+        }
+    }
+#endif
+  return true;
+}
+
+/* Unmaps the CNT user pages starting at UPAGE, at the end of the
+   current process's heap, and discards their contents. */
+static void
+unmap_heap_pages (uint8_t *upage, size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      uint8_t *addr = upage + i * PGSIZE;
+#ifdef VM
+      vm_free_page (vm_find_page (addr));
+#else
+      uint32_t *pd = thread_current ()->pagedir;
+      void *kpage = pagedir_get_page (pd, addr);
+
+      pagedir_clear_page (pd, addr);
+      palloc_free_page (kpage);
+#endif
+    }
+}
+
+/* Moves the end of the current process's heap, its break, by
+   INCREMENT bytes, which may be negative, and returns the old
+   break.  Pages are mapped and unmapped as the break crosses
+   page boundaries.  Returns a null pointer, leaving the break
+   alone, if the break would move below the start of the heap or
+   into the area the threads' stacks may grow into, or if memory is
+   exhausted. */
+void *
+process_sbrk (intptr_t increment)
+{
+  struct thread *t = process_current ();
+  uintptr_t start = (uintptr_t) t->heap_start;
+  uintptr_t end = (uintptr_t) t->heap_end;
+  uintptr_t new_end;
+  uint8_t *old_top, *new_top;
+#ifdef VM
+  uint8_t *bottom = stack_slot_top (PROCESS_THREAD_MAX - 1);
+  uintptr_t limit = bottom != NULL ? (uintptr_t) bottom - PROCESS_STACK_SIZE
+                    : 0;
+#else
+  uintptr_t limit = (uintptr_t) PHYS_BASE - PGSIZE;
+#endif
+
+  if (increment < 0 ? (uintptr_t) -increment > end - start
+      : end > limit || (uintptr_t) increment > limit - end)
+    return NULL;
+  new_end = end + increment;
+
+  old_top = pg_round_up ((void *) end);
+  new_top = pg_round_up ((void *) new_end);
+  if (new_top > old_top)
+    {
+      if (!map_heap_pages (old_top, (new_top - old_top) / PGSIZE))
+        return NULL;
+    }
+  else if (new_top < old_top)
+    unmap_heap_pages (new_top, (old_top - new_top) / PGSIZE);
+
+  t->heap_end = (uint8_t *) new_end;
+  return (void *) end;
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -584,3 +1690,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
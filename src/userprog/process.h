@@ -3,7 +3,42 @@
 
 #include "threads/thread.h"
 
+/* A process may run more than one thread.  The threads share the
+   page directory, the address space, the descriptors and the
+   rest of the state of the process, which is kept in the thread
+   that started it and found with process_current().  Each thread
+   has a user stack of its own.  A thread in the kernel on behalf
+   of the process holds the process's lock, so the threads see
+   its state change one system call or page fault at a time. */
+
+#ifdef VM
+/* Threads started by process_thread_create() each get a slot of
+   PROCESS_STACK_SIZE bytes for their stacks, below the area the
+   first thread's stack grows into.  There are PROCESS_THREAD_MAX
+   slots. */
+#define PROCESS_THREAD_MAX 32
+#define PROCESS_STACK_SIZE (64 * 1024)
+#endif
+
+void process_init (void);
 tid_t process_execute (const char *file_name);
+tid_t process_spawn (const char *file_name, int stdin_fd, int stdout_fd);
+#ifdef VM
+struct intr_frame;
+tid_t process_fork (struct intr_frame *);
+tid_t process_restore (const char *file_name);
+tid_t process_thread_create (void *eip, void *func, void *aux);
+int process_thread_join (tid_t);
+struct file;
+void process_trace_fault (struct file *, void *upage);
+#endif
+struct thread *process_current (void);
+void process_lock (void);
+bool process_trylock (void);
+void process_unlock (void);
+bool process_lock_held (void);
+void process_check_exit (void);
+void *process_sbrk (intptr_t increment);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
@@ -1,19 +1,45 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <iovec.h>
+#include <kstat.h>
+#include <poll.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
 #include "threads/vaddr.h"
 #include "threads/init.h"
+#include "threads/sysctl.h"
+#include "threads/trace.h"
 #include "userprog/process.h"
 #include <list.h>
+#include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/palloc.h"
 #include "threads/malloc.h"
+#include "threads/rcu.h"
+#include "devices/block.h"
 #include "devices/input.h"
+#include "devices/timer.h"
+#include "userprog/aio.h"
+#include "userprog/exception.h"
+#include "userprog/futex.h"
+#include "userprog/pipe.h"
+#include "userprog/poll.h"
+#include "userprog/uaccess.h"
 #include "threads/synch.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/mmap.h"
+#include "vm/page.h"
+#include "vm/shm.h"
+#include "vm/snapshot.h"
+#include "vm/swap.h"
+#endif
 
 static void syscall_handler (struct intr_frame *);
 
@@ -23,225 +49,525 @@ static void sys_halt (void);
 static void sys_close (int file_desc);
 static bool sys_create (const char *file, unsigned initial_size);
 static int sys_open (const char *file);
+static int sys_open_flags (const char *file, int flags);
 static int sys_exec (const char *cmd);
+static int sys_spawn (const char *cmd, int stdin_fd, int stdout_fd);
 static int sys_wait(tid_t pid);
 static int sys_filesize (int fd);
 static void sys_seek(int file_desc, int pos);
 static unsigned sys_tell(int file_desc);
 static bool sys_remove (const char *file);
+static int sys_pread (int fd, void *buffer, unsigned size, unsigned ofs);
+static int sys_pwrite (int fd, const void *buffer, unsigned size,
+                       unsigned ofs);
+static int sys_readv (int fd, const struct iovec *iov, int iov_cnt);
+static int sys_writev (int fd, const struct iovec *iov, int iov_cnt);
+static int sys_settickets (int tickets);
+static void sys_schedstat (void);
+static void sys_memstat (void);
+static bool sys_chdir (const char *dir);
+static bool sys_mkdir (const char *dir);
+static bool sys_readdir (int fd, char *name);
+static bool sys_isdir (int fd);
+static int sys_inumber (int fd);
+static bool sys_fsync (int fd);
+static void sys_sync (void);
+static bool sys_fallocate (int fd, int mode, unsigned ofs, unsigned len);
+static int sys_copy_file_range (int fd_in, int fd_out, unsigned size);
+static int sys_getdents (int fd, struct dirent *buffer, unsigned size);
+static void sys_kstat (struct kstat *stats);
+static bool sys_sysctl (const char *name, int *old, const int *new);
+static bool sys_strace (int enable);
+static void *sys_sbrk (intptr_t increment);
+static int sys_pipe (int *fds);
+static int sys_dup2 (int old_fd, int new_fd);
+static int sys_futex_wait (int *addr, int val);
+static int sys_futex_wake (int *addr, int cnt);
+static int sys_poll (struct pollfd *fds, unsigned nfds, int timeout);
+static int sys_aio_submit (const struct aio_request *reqs, int cnt);
+static int sys_aio_getevents (struct aio_event *events, int min, int max);
+#ifdef VM
+static bool sys_vmstat (tid_t tid, struct vmstat *stats);
+static mapid_t sys_mmap (int fd, void *addr);
+static void sys_munmap (mapid_t mapid);
+static bool sys_madvise (void *addr, unsigned length, int advice);
+static bool sys_mlock (void *addr, unsigned length);
+static bool sys_munlock (void *addr, unsigned length);
+static bool sys_shm_map (const char *name, unsigned size, void *addr);
+static bool sys_shm_unmap (void *addr);
+static bool sys_shm_unlink (const char *name);
+static tid_t sys_thread_create (void *eip, void *func, void *aux);
+static int sys_thread_join (tid_t tid);
+static void sys_thread_exit (int status);
+static int sys_snapshot (const char *file, struct intr_frame *f);
+static tid_t sys_restore (const char *file);
+#endif
 
-typedef int (*handler) (uint32_t, uint32_t, uint32_t);
-static handler syscall_vec[128];
-static struct lock file_lock;
+typedef int (*handler) (uint32_t, uint32_t, uint32_t, uint32_t);
 
-struct filedescriptor_elem {
-    int filedesc;
-    struct file *file;
-    struct list_elem elem;
-    struct list_elem thread_elem;
+/* Number of system call numbers. */
+#define SYSCALL_CNT (SYS_OPEN_FLAGS + 1)
+
+/* Maximum number of arguments of a system call. */
+#define SYSCALL_MAX_ARGS 4
+
+/* Bit for argument N in the POINTERS mask of a system call. */
+#define ARG_PTR(N) (1u << (N))
+
+/* A system call.  The dispatcher reads only ARG_CNT argument
+   words from the user stack and checks that the arguments marked
+   in POINTERS are user addresses; other arguments are passed as
+   0.  A call without a handler kills the process. */
+struct syscall
+  {
+    const char *name;           /* Name, for statistics. */
+    handler func;               /* Handler. */
+    int arg_cnt;                /* Number of arguments. */
+    unsigned pointers;          /* Arguments that are user pointers. */
   };
 
-static struct list open_file_list;
-static struct file *find_file_by_fde (int file_desc);
-static struct filedescriptor_elem *find_fde_by_file (int file_desc);
+static struct syscall syscalls[SYSCALL_CNT];
+
+/* Number of calls of each system call, for profiling. */
+static unsigned syscall_cnt[SYSCALL_CNT];
+
+/* Number of buckets in a latency histogram of a system call.
+   Bucket 0 counts calls that took fewer than
+   2**(SYSCALL_LATENCY_SHIFT + 1) CPU cycles, bucket I counts
+   those that took at least 2**(SYSCALL_LATENCY_SHIFT + I) cycles
+   and fewer than twice that, and the last bucket also counts
+   everything slower. */
+#define SYSCALL_LATENCY_BUCKETS 16
+#define SYSCALL_LATENCY_SHIFT 8
+
+/* Times of the calls of a system call made by processes traced
+   with strace(). */
+struct syscall_times
+  {
+    unsigned long long cnt;             /* Number of calls timed. */
+    unsigned long long cycles;          /* Total time in them. */
+    unsigned long long latency[SYSCALL_LATENCY_BUCKETS];
+                                        /* Histogram of call times. */
+  };
+
+static struct syscall_times call_times[SYSCALL_CNT];
+
+static void trace_call (int nr, const uint32_t *args, int arg_cnt,
+                        uint32_t ret, uint64_t start);
+
+static void register_syscall (int nr, const char *name, handler,
+                              int arg_cnt, unsigned pointers);
+
+/* Initial number of slots in a process's file descriptor table.
+   Descriptors 0 and 1 are the console while their slots are
+   empty. */
+#define FD_TABLE_MIN 16
+
+static bool fd_grow (int cnt);
+static int fd_install (const struct fd_entry *entry);
+static struct fd_entry *fd_entry (int file_desc);
+static struct file *fd_lookup (int file_desc);
+static bool fd_dup (struct fd_entry *dst, const struct fd_entry *src);
+static void fd_release (struct fd_entry *);
+static bool is_dir (struct file *file);
+static int read_console (uint8_t *buffer, unsigned size);
+static int poll_events (int fd);
+static int pipe_transfer (const struct fd_entry *, void *buffer,
+                          unsigned size);
+static bool user_buffer_ok (const void *buffer, unsigned size);
+static void pin_buffer (const void *buffer, unsigned size, bool write);
+static void unpin_buffer (const void *buffer, unsigned size);
+static char *copy_in_string (const char *ustr, size_t size);
+static void copy_out (void *udst, const void *src, size_t size);
+
+/* Most bytes of a file name or path passed to a system call,
+   including the null terminator.  Longer ones are rejected as
+   the file system would reject them. */
+#define PATH_MAX 512
 
 void
 syscall_init (void)  {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 
-  syscall_vec[SYS_EXIT] = (handler)sys_exit;
-  syscall_vec[SYS_HALT] = (handler)sys_halt;
-  syscall_vec[SYS_CREATE] = (handler)sys_create;
-  syscall_vec[SYS_OPEN] = (handler)sys_open;
-  syscall_vec[SYS_CLOSE] = (handler)sys_close;
-  syscall_vec[SYS_READ] = (handler)sys_read;
-  syscall_vec[SYS_WRITE] = (handler)sys_write;
-  syscall_vec[SYS_EXEC] = (handler)sys_exec;
-  syscall_vec[SYS_WAIT] = (handler)sys_wait;
-  syscall_vec[SYS_FILESIZE] = (handler)sys_filesize;
-  syscall_vec[SYS_SEEK] = (handler)sys_seek;
-  syscall_vec[SYS_TELL] = (handler)sys_tell;
-  syscall_vec[SYS_REMOVE] = (handler)sys_remove;
-  
-  list_init (&open_file_list);
-  lock_init (&file_lock);
+  register_syscall (SYS_HALT, "halt", (handler)sys_halt, 0, 0);
+  register_syscall (SYS_EXIT, "exit", (handler)sys_exit, 1, 0);
+  register_syscall (SYS_EXEC, "exec", (handler)sys_exec, 1, ARG_PTR (0));
+  register_syscall (SYS_WAIT, "wait", (handler)sys_wait, 1, 0);
+  register_syscall (SYS_CREATE, "create", (handler)sys_create,
+                    2, ARG_PTR (0));
+  register_syscall (SYS_REMOVE, "remove", (handler)sys_remove,
+                    1, ARG_PTR (0));
+  register_syscall (SYS_OPEN, "open", (handler)sys_open, 1, ARG_PTR (0));
+  register_syscall (SYS_FILESIZE, "filesize", (handler)sys_filesize, 1, 0);
+  register_syscall (SYS_READ, "read", (handler)sys_read, 3, 0);
+  register_syscall (SYS_WRITE, "write", (handler)sys_write, 3, 0);
+  register_syscall (SYS_SEEK, "seek", (handler)sys_seek, 2, 0);
+  register_syscall (SYS_TELL, "tell", (handler)sys_tell, 1, 0);
+  register_syscall (SYS_CLOSE, "close", (handler)sys_close, 1, 0);
+  register_syscall (SYS_CHDIR, "chdir", (handler)sys_chdir, 1, ARG_PTR (0));
+  register_syscall (SYS_MKDIR, "mkdir", (handler)sys_mkdir, 1, ARG_PTR (0));
+  register_syscall (SYS_READDIR, "readdir", (handler)sys_readdir,
+                    2, ARG_PTR (1));
+  register_syscall (SYS_ISDIR, "isdir", (handler)sys_isdir, 1, 0);
+  register_syscall (SYS_INUMBER, "inumber", (handler)sys_inumber, 1, 0);
+#ifdef VM
+  /* Fork is dispatched by syscall_handler() itself. */
+  register_syscall (SYS_FORK, "fork", NULL, 0, 0);
+  register_syscall (SYS_VMSTAT, "vmstat", (handler)sys_vmstat,
+                    2, ARG_PTR (1));
+  register_syscall (SYS_MMAP, "mmap", (handler)sys_mmap, 2, 0);
+  register_syscall (SYS_MUNMAP, "munmap", (handler)sys_munmap, 1, 0);
+  register_syscall (SYS_MADVISE, "madvise", (handler)sys_madvise, 3, 0);
+  register_syscall (SYS_MLOCK, "mlock", (handler)sys_mlock, 2, 0);
+  register_syscall (SYS_MUNLOCK, "munlock", (handler)sys_munlock, 2, 0);
+  register_syscall (SYS_SHM_MAP, "shm_map", (handler)sys_shm_map,
+                    3, ARG_PTR (0));
+  register_syscall (SYS_SHM_UNMAP, "shm_unmap", (handler)sys_shm_unmap, 1, 0);
+  register_syscall (SYS_SHM_UNLINK, "shm_unlink", (handler)sys_shm_unlink,
+                    1, ARG_PTR (0));
+  register_syscall (SYS_THREAD_CREATE, "thread_create",
+                    (handler)sys_thread_create, 3, 0);
+  register_syscall (SYS_THREAD_JOIN, "thread_join", (handler)sys_thread_join,
+                    1, 0);
+  register_syscall (SYS_THREAD_EXIT, "thread_exit", (handler)sys_thread_exit,
+                    1, 0);
+  register_syscall (SYS_SNAPSHOT, "snapshot", (handler)sys_snapshot,
+                    1, ARG_PTR (0));
+  register_syscall (SYS_RESTORE, "restore", (handler)sys_restore,
+                    1, ARG_PTR (0));
+#endif
+  register_syscall (SYS_PREAD, "pread", (handler)sys_pread, 4, 0);
+  register_syscall (SYS_PWRITE, "pwrite", (handler)sys_pwrite, 4, 0);
+  register_syscall (SYS_READV, "readv", (handler)sys_readv, 3, ARG_PTR (1));
+  register_syscall (SYS_WRITEV, "writev", (handler)sys_writev,
+                    3, ARG_PTR (1));
+  register_syscall (SYS_SETTICKETS, "settickets", (handler)sys_settickets,
+                    1, 0);
+  register_syscall (SYS_SCHEDSTAT, "schedstat", (handler)sys_schedstat,
+                    0, 0);
+  register_syscall (SYS_MEMSTAT, "memstat", (handler)sys_memstat, 0, 0);
+  register_syscall (SYS_FSYNC, "fsync", (handler)sys_fsync, 1, 0);
+  register_syscall (SYS_SYNC, "sync", (handler)sys_sync, 0, 0);
+  register_syscall (SYS_COPY_FILE_RANGE, "copy_file_range",
+                    (handler)sys_copy_file_range, 3, 0);
+  register_syscall (SYS_GETDENTS, "getdents", (handler)sys_getdents,
+                    3, ARG_PTR (1));
+  register_syscall (SYS_KSTAT, "kstat", (handler)sys_kstat, 1, ARG_PTR (0));
+  register_syscall (SYS_SBRK, "sbrk", (handler)sys_sbrk, 1, 0);
+  register_syscall (SYS_PIPE, "pipe", (handler)sys_pipe, 1, ARG_PTR (0));
+  register_syscall (SYS_DUP2, "dup2", (handler)sys_dup2, 2, 0);
+  register_syscall (SYS_FUTEX_WAIT, "futex_wait", (handler)sys_futex_wait,
+                    2, ARG_PTR (0));
+  register_syscall (SYS_FUTEX_WAKE, "futex_wake", (handler)sys_futex_wake,
+                    2, ARG_PTR (0));
+  register_syscall (SYS_POLL, "poll", (handler)sys_poll, 3, ARG_PTR (0));
+  register_syscall (SYS_AIO_SUBMIT, "aio_submit", (handler)sys_aio_submit,
+                    2, ARG_PTR (0));
+  register_syscall (SYS_AIO_GETEVENTS, "aio_getevents",
+                    (handler)sys_aio_getevents, 3, ARG_PTR (0));
+  register_syscall (SYS_SPAWN, "spawn", (handler)sys_spawn, 3, ARG_PTR (0));
+  register_syscall (SYS_FALLOCATE, "fallocate", (handler)sys_fallocate,
+                    4, 0);
+  register_syscall (SYS_SYSCTL, "sysctl", (handler)sys_sysctl,
+                    3, ARG_PTR (0));
+  register_syscall (SYS_STRACE, "strace", (handler)sys_strace, 1, 0);
+  register_syscall (SYS_OPEN_FLAGS, "open_flags", (handler)sys_open_flags,
+                    2, ARG_PTR (0));
+}
+
+/* Enters system call NR in the dispatch table. */
+static void
+register_syscall (int nr, const char *name, handler func,
+                  int arg_cnt, unsigned pointers)
+{
+  ASSERT (nr >= 0 && nr < SYSCALL_CNT);
+  ASSERT (arg_cnt >= 0 && arg_cnt <= SYSCALL_MAX_ARGS);
+
+  syscalls[nr].name = name;
+  syscalls[nr].func = func;
+  syscalls[nr].arg_cnt = arg_cnt;
+  syscalls[nr].pointers = pointers;
+}
 
+/* Prints the number of calls of each system call, and the times
+   of those made by traced processes. */
+void
+syscall_print_stats (void)
+{
+  int nr, i;
+
+  printf ("Syscalls:");
+  for (nr = 0; nr < SYSCALL_CNT; nr++)
+    if (syscall_cnt[nr] > 0)
+      printf (" %u %s", syscall_cnt[nr], syscalls[nr].name);
+  printf ("\n");
+
+  for (nr = 0; nr < SYSCALL_CNT; nr++)
+    {
+      const struct syscall_times *t = &call_times[nr];
+
+      if (t->cnt == 0)
+        continue;
+      printf ("Syscall %s: %llu traced calls, average %llu cycles "
+              "(%llu us)\n", syscalls[nr].name, t->cnt, t->cycles / t->cnt,
+              timer_cycles_to_ns (t->cycles / t->cnt) / 1000);
+      printf ("  latency (2^n cycles):");
+      for (i = 0; i < SYSCALL_LATENCY_BUCKETS; i++)
+        if (t->latency[i] != 0)
+          printf (" %d:%llu", i + SYSCALL_LATENCY_SHIFT, t->latency[i]);
+      printf ("\n");
+    }
+}
+
+/* Accounts for system call NR, with the ARG_CNT arguments in
+   ARGS, made by a traced process: the call returned RET after
+   the cycles since START.  Adds the call to the event trace, if
+   enabled, and to the call's latency histogram. */
+static void
+trace_call (int nr, const uint32_t *args, int arg_cnt, uint32_t ret,
+            uint64_t start)
+{
+  uint64_t cycles = timer_cycles () - start;
+  struct syscall_times *t = &call_times[nr];
+  enum intr_level old_level;
+  int bucket;
+
+  if (trace_enabled)
+    {
+      uint32_t data[2 + SYSCALL_MAX_ARGS];
+
+      data[0] = cycles < UINT32_MAX ? cycles : UINT32_MAX;
+      data[1] = ret;
+      memcpy (data + 2, args, arg_cnt * sizeof *args);
+      trace_event_data (TRACE_STRACE, thread_current ()->tid,
+                        nr | arg_cnt << 16, data, 2 + arg_cnt);
+    }
+
+  for (bucket = 0; bucket < SYSCALL_LATENCY_BUCKETS - 1; bucket++)
+    if ((cycles >> (SYSCALL_LATENCY_SHIFT + bucket + 1)) == 0)
+      break;
+  old_level = intr_disable ();
+  t->cnt++;
+  t->cycles += cycles;
+  t->latency[bucket]++;
+  intr_set_level (old_level);
+}
+
+/* Set when a user program enters the kernel with SYSENTER with
+   the trap flag set, for sysenter_entry to put the flag back in
+   the program's saved flags. */
+bool sysenter_single_step;
+
+/* Handles a system call made with SYSENTER, whose entry stub in
+   userprog/sysenter.S has built interrupt frame F as `int $0x30'
+   would have.  Does what intr_handler() would do for the call. */
+void
+syscall_sysenter (struct intr_frame *f)
+{
+  syscall_handler (f);
+  process_check_exit ();
 }
 
 /* This function calls the appropriate function. */
 static void
 syscall_handler (struct intr_frame *f UNUSED)  {
-  handler hndlr;
+  const struct syscall *sc;
+  uint32_t args[SYSCALL_MAX_ARGS] = { 0, 0, 0, 0 };
+  bool traced = process_current ()->strace;
+  uint64_t start = traced ? timer_cycles () : 0;
   int *stk_pos;
-  int return_value;
+  int nr, i;
   
   stk_pos = f->esp;
+#ifdef VM
+  thread_current ()->user_esp = f->esp;
+#endif
+
+  /* One thread of the process at a time is in a system call. */
+  process_lock ();
   
-  if (!is_user_vaddr (stk_pos))
+  if (!copy_from_user (&nr, stk_pos, sizeof nr))
      sys_exit (-1);
-  
-  if (*stk_pos < SYS_HALT || *stk_pos > SYS_INUMBER)
+  if (nr < SYS_HALT || nr >= SYSCALL_CNT)
      sys_exit (-1);
-  
-  hndlr = syscall_vec[*stk_pos];
+  syscall_cnt[nr]++;
+  TRACE (TRACE_SYSCALL_ENTER, nr, thread_current ()->tid);
 
-  if (!(is_user_vaddr (stk_pos + 1) && is_user_vaddr (stk_pos + 2) && is_user_vaddr (stk_pos + 3)))
+#ifdef VM
+  /* The child returns from the same interrupt frame. */
+  if (nr == SYS_FORK)
+    {
+      f->eax = process_fork (f);
+      if (traced)
+        trace_call (nr, args, 0, f->eax, start);
+      process_unlock ();
+      return;
+    }
+#endif
+  
+  sc = &syscalls[nr];
+  if (sc->func == NULL)
      sys_exit (-1);
 
-  return_value = hndlr (*(stk_pos + 1), *(stk_pos + 2), *(stk_pos + 3));
+  /* Fetch only the arguments the call takes. */
+  if (!copy_from_user (args, stk_pos + 1, sc->arg_cnt * sizeof *args))
+     sys_exit (-1);
+  for (i = 0; i < sc->arg_cnt; i++)
+    if ((sc->pointers & ARG_PTR (i)) && !is_user_vaddr ((void *) args[i]))
+      sys_exit (-1);
 
-  f->eax = return_value;
-  return;
+#ifdef VM
+  /* The snapshot saves the frame to return from. */
+  if (nr == SYS_SNAPSHOT)
+    f->eax = sys_snapshot ((const char *) args[0], f);
+  else
+#endif
+    f->eax = sc->func (args[0], args[1], args[2], args[3]);
+  if (traced)
+    trace_call (nr, args, sc->arg_cnt, f->eax, start);
+  process_unlock ();
+  TRACE (TRACE_SYSCALL_EXIT, nr, f->eax);
 }
 
 /* Read from the current file in execution */
 static int sys_read (int file_desc, void *buffer, unsigned size) {
-  struct file * fl;
+  struct fd_entry *e = fd_entry (file_desc);
   int return_val=-1;
 
-  lock_acquire(&file_lock);
-  if(file_desc==STDIN_FILENO)
-  {
-    uint16_t i;
-    for(i=0;i<size;i++)
-      *(uint8_t *)(buffer + i)= input_getc();
-    return_val=size;
-  }
-  else if(file_desc==STDOUT_FILENO)
+  if(e == NULL && file_desc==STDIN_FILENO)
+    return_val = read_console (buffer, size);
+  else if(e == NULL && file_desc==STDOUT_FILENO)
     return_val = -1;
-  else if(!is_user_vaddr(buffer) || !is_user_vaddr(buffer + size))
-  {
-    lock_release(&file_lock);
-    sys_exit(-1);
-  }
-  else
-  {
-    fl=find_file_by_fde(file_desc);
-    if(fl)
-      return_val=file_read(fl,buffer,size);
-    else  
-      return_val = -1;
-  }
-
-  lock_release (&file_lock);
+  else if (!user_buffer_ok (buffer, size))
+    sys_exit (-1);
+  else if (e != NULL && e->pipe != NULL)
+    return_val = e->writer ? -1 : pipe_transfer (e, buffer, size);
+  else if (e != NULL)
+    {
+      pin_buffer (buffer, size, true);
+      return_val=file_read(e->file,buffer,size);
+      unpin_buffer (buffer, size);
+    }
+
   return return_val;
 }
 
 /* Write to the file. */
 static int sys_write (int file_desc, const void *buffer, unsigned length) {
-  struct file * f;
+  struct fd_entry *e = fd_entry (file_desc);
   int return_val = -1;
-  lock_acquire (&file_lock);
-  if (file_desc == STDOUT_FILENO) /* stdout */
-    putbuf (buffer, length);
-  
-  else if (file_desc == STDIN_FILENO)  
-    return_val = -1;
-  else if (!is_user_vaddr (buffer) || !is_user_vaddr (buffer + length))
+  if (e == NULL && file_desc == STDOUT_FILENO) /* stdout */
     {
-      lock_release (&file_lock);
-      sys_exit (-1);
+      if (!user_buffer_ok (buffer, length))
+        sys_exit (-1);
+      pin_buffer (buffer, length, false);
+      putbuf (buffer, length);
+      unpin_buffer (buffer, length);
+      return_val = length;
     }
-  else
+  
+  else if (e == NULL && file_desc == STDIN_FILENO)
+    return_val = -1;
+  else if (!user_buffer_ok (buffer, length))
+    sys_exit (-1);
+  else if (e != NULL && e->pipe != NULL)
+    return_val = e->writer ? pipe_transfer (e, (void *) buffer, length) : -1;
+  else if (e != NULL && !is_dir (e->file))
     {
-      f = find_file_by_fde (file_desc);
-      if (!f)
-        return_val = -1;
-        
-      return_val = file_write (f, buffer, length);
+      pin_buffer (buffer, length, false);
+      return_val = file_write (e->file, buffer, length);
+      unpin_buffer (buffer, length);
     }
     
-  lock_release (&file_lock);
   return return_val;
 }
 
-/* Terminates and exits the process */
+/* Terminates and exits the process.  The first thread of the
+   process to call it sets the exit code; the other threads end
+   on their way back to user mode. */
 int sys_exit(int status)
 {
+  struct thread *p = process_current ();
 
-  struct thread *cur;
-  cur=thread_current();
-
-  if (lock_held_by_current_thread (&file_lock))
-    lock_release (&file_lock);
-
-  if(list_empty(&cur->all_files))
-    goto end;
-  else {
-    struct list_elem *element;
-    while(!list_empty(&cur->all_files))
+  /* process_exit() closes the descriptors. */
+  if (!p->exiting)
     {
-      element=list_begin(&cur->all_files);
-      sys_close(list_entry(element, struct filedescriptor_elem, thread_elem)->filedesc);
+      p->return_status = status;
+      p->exiting = true;
+      futex_wake_process (p);
+      aio_wake_process (p);
+      poll_notify ();
     }
-  }
-
-end:
-  cur->return_status=status;
   thread_exit();
   return -1;
 }
 
-/* Close the file in execution */ 
+/* Close the file in execution.  Closing a redirected descriptor
+   0 or 1 makes it the console again. */
 static void sys_close(int file_desc) {
 
-  struct filedescriptor_elem *fde;
-  fde=find_fde_by_file(file_desc);
+  struct thread *cur = process_current ();
+  struct fd_entry *e = fd_entry (file_desc);
 
-  if(fde!=NULL)
-  { 
-	  file_close(fde->file);
-	  list_remove(&fde->elem);
-	  list_remove(&fde->thread_elem);
-	  free(fde);
-  }
+  if (e != NULL)
+    {
+      fd_release (e);
+      if (file_desc < cur->fd_free)
+        cur->fd_free = file_desc;
+    }
 }
 
 /* Creates a new file */
 static bool sys_create (const char *file, unsigned initial_size)
 {
+  char *name;
+  bool success;
  
   if(!file)
     sys_exit(-1);
   
-  int return_value;
-  lock_acquire(&file_lock);
-  return_value = filesys_create (file, initial_size);
-  lock_release(&file_lock);
-
-  return return_value;
+  name = copy_in_string (file, PATH_MAX);
+  if (name == NULL)
+    return false;
+  success = filesys_create (name, initial_size);
+  free (name);
+  return success;
 }
 
 /* Opens a file for file operations */
 static int sys_open (const char *file)
 {
+  return sys_open_flags (file, 0);
+}
+
+/* Opens FILE like sys_open(), in the mode that FLAGS selects, in
+   which O_APPEND makes every write() go to end of file in one
+   step.  Returns -1 if FLAGS has any other bit set. */
+static int sys_open_flags (const char *file, int flags)
+{
+  struct fd_entry entry;
   struct file *f;
-  struct filedescriptor_elem *fde;
+  char *name;
+  int fd;
   
-  if (file == NULL) 
+  if (file == NULL || (flags & ~O_APPEND) != 0)
      return -1;
-  if (!is_user_vaddr (file))
-    sys_exit (-1);
-  f = filesys_open (file);
+  name = copy_in_string (file, PATH_MAX);
+  if (name == NULL)
+    return -1;
+  f = filesys_open (name);
+  free (name);
   if (!f) 
     return -1;
+  file_set_append (f, (flags & O_APPEND) != 0);
     
-  fde = (struct filedescriptor_elem *)malloc (sizeof (struct filedescriptor_elem));
-  if (!fde) 
-    {
-      file_close (f);
-      return -1;
-    }
-  else
-  {
-    static int fid=2;
-    fde->file = f;
-    fde->filedesc = fid++;
-    list_push_back (&open_file_list, &fde->elem);
-    list_push_back (&thread_current ()->all_files, &fde->thread_elem);
-    return fde->filedesc;
-  }
-  return -1;
+  entry.file = f;
+  entry.pipe = NULL;
+  entry.writer = false;
+  fd = fd_install (&entry);
+  if (fd == -1)
+    file_close (f);
+  return fd;
 }
 
 /* Halts the execution of the file */
@@ -251,13 +577,32 @@ static void sys_halt (void) {
 
 /* Starts execution of the clind process */
 static int sys_exec (const char *cmd) {
+  char *cmd_line;
   int ret;
-  if (!cmd || !is_user_vaddr(cmd))
+
+  if (!cmd)
+    return -1;
+  cmd_line = copy_in_string (cmd, PGSIZE);
+  if (cmd_line == NULL)
     return -1;
+  ret = process_execute (cmd_line);
+  free (cmd_line);
+  return ret;
+}
 
-  lock_acquire(&file_lock);
-  ret = process_execute(cmd);
-  lock_release(&file_lock);
+/* Runs CMD like exec(), with descriptors STDIN_FD and STDOUT_FD
+   as the new process's descriptors 0 and 1. */
+static int sys_spawn (const char *cmd, int stdin_fd, int stdout_fd) {
+  char *cmd_line;
+  int ret;
+
+  if (!cmd)
+    return -1;
+  cmd_line = copy_in_string (cmd, PGSIZE);
+  if (cmd_line == NULL)
+    return -1;
+  ret = process_spawn (cmd_line, stdin_fd, stdout_fd);
+  free (cmd_line);
   return ret;
 }
 
@@ -266,25 +611,297 @@ static int sys_wait (tid_t tid) {
   return process_wait(tid);
 }
 
-/* This is a new method.  It checks if the file belongs any file descriptor. If yes, it returns the file ense it returns null*/
-static struct file *find_file_by_fde (int file_desc) {
-  struct filedescriptor_elem *fd;
-  struct list_elem *el;
-  
-  for (el = list_begin (&open_file_list); el != list_end (&open_file_list); el = list_next (el))
+/* Reads console input into the SIZE bytes at user address BUFFER
+   until BUFFER is full or a line is complete, and returns the
+   number of bytes read.  Keys are taken from the input buffer in
+   batches into a kernel buffer, because the user buffer may fault
+   and so cannot be written with interrupts off. */
+static int read_console (uint8_t *buffer, unsigned size) {
+  uint8_t keys[64];
+  unsigned cnt = 0;
+
+  if (!user_buffer_ok (buffer, size))
+    sys_exit (-1);
+  while (cnt < size)
     {
-      fd = list_entry (el, struct filedescriptor_elem, elem);
-      if (fd->filedesc == file_desc)
-        return fd->file;
+      size_t n, i;
+
+      /* Other threads of the process may go on while we wait. */
+      process_unlock ();
+      n = input_read (keys, size - cnt < sizeof keys
+                            ? size - cnt : sizeof keys);
+      process_lock ();
+      memcpy (buffer + cnt, keys, n);
+      cnt += n;
+      for (i = 0; i < n; i++)
+        if (keys[i] == '\n' || keys[i] == '\r')
+          return cnt;
     }
-    
-  return NULL;
+  return cnt;
+}
+
+/* Reads from or writes to pipe end E, as it is a read or write
+   end, with the SIZE bytes at user address BUFFER.  The transfer
+   may wait for another thread of the process, so the process's
+   lock is released meanwhile.  The buffer stays pinned, since a
+   fault in the pipe's copy would need the lock, and the end stays
+   open, in case another thread closes its descriptor. */
+static int
+pipe_transfer (const struct fd_entry *e, void *buffer, unsigned size)
+{
+  struct pipe *pipe = e->pipe;
+  bool writer = e->writer;
+  int n;
+
+  pin_buffer (buffer, size, !writer);
+  pipe_open_end (pipe, writer);
+  process_unlock ();
+  n = (writer ? pipe_write (pipe, buffer, size)
+       : pipe_read (pipe, buffer, size));
+  process_lock ();
+  pipe_close_end (pipe, writer);
+  unpin_buffer (buffer, size);
+  return n;
+}
+
+/* Returns the poll() events that hold for descriptor FD.  Files
+   are always ready, and so are the console's output and, once a
+   key is waiting, its input. */
+static int
+poll_events (int fd)
+{
+  struct fd_entry *e = fd_entry (fd);
+
+  if (e != NULL && e->pipe != NULL)
+    return pipe_poll (e->pipe, e->writer);
+  if (e != NULL)
+    return POLLIN | POLLOUT;
+  if (fd == STDOUT_FILENO)
+    return POLLOUT;
+  if (fd != STDIN_FILENO)
+    return POLLNVAL;
+
+  return input_empty () ? 0 : POLLIN;
+}
+
+/* Returns true if the SIZE bytes at BUFFER lie below PHYS_BASE.
+   An empty buffer is never checked, so read() and write() of
+   nothing accept any pointer, null included. */
+static bool user_buffer_ok (const void *buffer, unsigned size) {
+  return (size == 0
+          || (is_user_vaddr (buffer)
+              && is_user_vaddr ((const uint8_t *) buffer + size)));
+}
+
+/* Keeps the SIZE bytes at user address BUFFER in memory until
+   unpin_buffer(), so that the file system and console never
+   fault on them with their locks held.  The kernel is going to
+   write the buffer if WRITE is true.  Kills the process if the
+   buffer is not valid.  Without VM, user pages never leave
+   memory. */
+static void pin_buffer (const void *buffer UNUSED, unsigned size UNUSED,
+                        bool write UNUSED) {
+#ifdef VM
+  if (!vm_pin_buffer (buffer, size, write))
+    sys_exit (-1);
+#endif
+}
+
+/* Copies the null-terminated string at user address USTR into a
+   new kernel buffer of SIZE bytes, so that the file system never
+   faults on it, and returns the buffer, which the caller must
+   free().  Returns a null pointer if the string does not fit or
+   memory is exhausted.  Kills the process if USTR is not a valid
+   string. */
+static char *copy_in_string (const char *ustr, size_t size) {
+  char *str = malloc (size);
+  int len;
+
+  if (str == NULL)
+    return NULL;
+  len = strncpy_from_user (str, ustr, size);
+  if (len < 0)
+    {
+      free (str);
+      sys_exit (-1);
+    }
+  if ((size_t) len == size)
+    {
+      free (str);
+      return NULL;
+    }
+  return str;
+}
+
+/* Copies the SIZE bytes at SRC to user address UDST.  Kills the
+   process if UDST is not valid and writable. */
+static void copy_out (void *udst, const void *src, size_t size) {
+  if (!copy_to_user (udst, src, size))
+    sys_exit (-1);
+}
+
+/* Releases a buffer pinned by pin_buffer(). */
+static void unpin_buffer (const void *buffer UNUSED, unsigned size UNUSED) {
+#ifdef VM
+  vm_unpin_buffer (buffer, size);
+#endif
+}
+
+/* Returns the slot of descriptor FILE_DESC in the current
+   process, or a null pointer if the descriptor is not open. */
+static struct fd_entry *fd_entry (int file_desc) {
+  struct thread *cur = process_current ();
+  struct fd_entry *e;
+
+  if (file_desc < 0 || file_desc >= cur->fd_cnt)
+    return NULL;
+  e = &cur->fds[file_desc];
+  return e->file != NULL || e->pipe != NULL ? e : NULL;
+}
+
+/* Returns the file open as descriptor FILE_DESC in the current
+   process, or a null pointer if there is none.  Pipes are not
+   files, so calls that take only files reject them. */
+static struct file *fd_lookup (int file_desc) {
+  struct fd_entry *e = fd_entry (file_desc);
+
+  return e != NULL ? e->file : NULL;
+}
+
+/* Returns true if FILE is a directory, which may be read with
+   readdir() but not written. */
+static bool is_dir (struct file *file) {
+  return inode_is_dir (file_get_inode (file));
+}
+
+/* Grows the descriptor table of the current process to at least
+   CNT slots, at least doubling it.  Returns false if memory is
+   exhausted. */
+static bool fd_grow (int cnt) {
+  struct thread *cur = process_current ();
+  int new_cnt = cur->fd_cnt < FD_TABLE_MIN ? FD_TABLE_MIN : 2 * cur->fd_cnt;
+  struct fd_entry *fds;
+
+  if (new_cnt < cnt)
+    new_cnt = cnt;
+  fds = realloc (cur->fds, new_cnt * sizeof *fds);
+  if (fds == NULL)
+    return false;
+  memset (fds + cur->fd_cnt, 0, (new_cnt - cur->fd_cnt) * sizeof *fds);
+  cur->fds = fds;
+  cur->fd_cnt = new_cnt;
+  return true;
+}
+
+/* Enters ENTRY in the descriptor table of the current process at
+   the lowest free descriptor above the console's, growing the
+   table if it is full.  Returns the descriptor, or -1 if memory
+   is exhausted. */
+static int fd_install (const struct fd_entry *entry) {
+  struct thread *cur = process_current ();
+  int fd = cur->fd_free < 2 ? 2 : cur->fd_free;
+
+  while (fd < cur->fd_cnt
+         && (cur->fds[fd].file != NULL || cur->fds[fd].pipe != NULL))
+    fd++;
+  if (fd == cur->fd_cnt && !fd_grow (fd + 1))
+    return -1;
+  cur->fds[fd] = *entry;
+  cur->fd_free = fd + 1;
+  return fd;
+}
+
+/* Makes DST another descriptor for what SRC refers to: a new
+   opening of the same file, at the same position and in the same
+   mode, or another
+   end of the same pipe.  Returns false if memory is
+   exhausted. */
+static bool fd_dup (struct fd_entry *dst, const struct fd_entry *src) {
+  *dst = *src;
+  if (src->pipe != NULL)
+    pipe_open_end (src->pipe, src->writer);
+  else
+    {
+      dst->file = file_reopen (src->file);
+      if (dst->file == NULL)
+        return false;
+      file_seek (dst->file, file_tell (src->file));
+      file_set_append (dst->file, file_is_append (src->file));
+    }
+  return true;
+}
+
+/* Closes what E refers to and marks E free. */
+static void fd_release (struct fd_entry *e) {
+  if (e->pipe != NULL)
+    pipe_close_end (e->pipe, e->writer);
+  else
+    file_close (e->file);
+  e->file = NULL;
+  e->pipe = NULL;
+  e->writer = false;
+}
+
+/* Stores in *FDS a copy of the current process's descriptor
+   table, for a process it starts with exec(), and its size in
+   *CNT.  Every open descriptor is duplicated as by dup2(), except
+   that descriptors 0 and 1 of the copy are duplicates of
+   STDIN_FD and STDOUT_FD; each of those is the console, as 0 and 1
+   are, if it is the same as the descriptor it replaces and that
+   one is free.  Returns false if STDIN_FD or STDOUT_FD is not
+   valid or memory is exhausted. */
+bool
+syscall_copy_fds (struct fd_entry **fds, int *cnt,
+                  int stdin_fd, int stdout_fd)
+{
+  struct thread *cur = process_current ();
+  int src[2] = { stdin_fd, stdout_fd };
+  int fd, fd_cnt;
+
+  *fds = NULL;
+  *cnt = 0;
+  for (fd = 0; fd < 2; fd++)
+    if (src[fd] != fd && fd_entry (src[fd]) == NULL)
+      return false;
+  fd_cnt = cur->fd_cnt;
+  if (fd_cnt == 0 && (stdin_fd != 0 || stdout_fd != 1))
+    fd_cnt = FD_TABLE_MIN;
+  if (fd_cnt == 0)
+    return true;
+  *fds = calloc (fd_cnt, sizeof **fds);
+  if (*fds == NULL)
+    return false;
+  for (fd = 0; fd < fd_cnt; fd++)
+    {
+      struct fd_entry *e = fd_entry (fd < 2 ? src[fd] : fd);
+
+      if (e != NULL && !fd_dup (&(*fds)[fd], e))
+        {
+          syscall_close_fds (*fds, fd);
+          *fds = NULL;
+          return false;
+        }
+    }
+  *cnt = fd_cnt;
+  return true;
+}
+
+/* Closes the CNT descriptors in table FDS and frees it. */
+void
+syscall_close_fds (struct fd_entry *fds, int cnt)
+{
+  int fd;
+
+  for (fd = 0; fd < cnt; fd++)
+    if (fds[fd].file != NULL || fds[fd].pipe != NULL)
+      fd_release (&fds[fd]);
+  free (fds);
 }
 
 /* gets the size of the file using the file_length function */
 static int sys_filesize (int file_desc) {
   struct file *file_size;
-  file_size = find_file_by_fde(file_desc);
+  file_size = fd_lookup(file_desc);
   if (!file_size)
     return -1;
 
@@ -294,7 +911,7 @@ static int sys_filesize (int file_desc) {
 /* Tells the current position in the file which is under execution*/
 static unsigned sys_tell(int file_desc) {
   struct file *f;
-  f = find_file_by_fde(file_desc);
+  f = fd_lookup(file_desc);
 
   if(!f)
     return -1;
@@ -306,7 +923,7 @@ static unsigned sys_tell(int file_desc) {
 /* Changes position in the file while performing file operation */
 static void sys_seek(int file_desc, int pos) {
   struct file *fl;
-  fl = find_file_by_fde(file_desc);
+  fl = fd_lookup(file_desc);
   if(!fl)
     sys_exit (-1);
   
@@ -314,36 +931,616 @@ static void sys_seek(int file_desc, int pos) {
 }
 
 static bool sys_remove (const char *file) {
+  char *name;
+  bool success;
+
   if (!file)
     return false;
+  name = copy_in_string (file, PATH_MAX);
+  if (name == NULL)
+    return false;
+  success = filesys_remove (name);
+  free (name);
+  return success;
+}
+
+/* Reads SIZE bytes at offset OFS of file FD into BUFFER, without
+   using or changing the file's position. */
+static int sys_pread (int fd, void *buffer, unsigned size, unsigned ofs) {
+  struct file *f = fd_lookup (fd);
+  int return_val;
 
-  if (!is_user_vaddr (file))
+  if (f == NULL)
+    return -1;
+  if (!user_buffer_ok (buffer, size))
     sys_exit (-1);
 
-  lock_acquire(&file_lock);
-  int return_value = filesys_remove (file);
-  lock_release(&file_lock);
+  pin_buffer (buffer, size, true);
+  return_val = file_read_at (f, buffer, size, ofs);
+  unpin_buffer (buffer, size);
+  return return_val;
+}
 
-  return return_value;
+/* Writes SIZE bytes from BUFFER at offset OFS of file FD, without
+   using or changing the file's position. */
+static int sys_pwrite (int fd, const void *buffer, unsigned size,
+                       unsigned ofs) {
+  struct file *f = fd_lookup (fd);
+  int return_val;
+
+  if (f == NULL || is_dir (f))
+    return -1;
+  if (!user_buffer_ok (buffer, size))
+    sys_exit (-1);
+
+  pin_buffer (buffer, size, false);
+  return_val = file_write_at (f, buffer, size, ofs);
+  unpin_buffer (buffer, size);
+  return return_val;
 }
 
-/* My Implementation 
-   This struct is used to get the structure of the file. This is used provide the structure of the file which is needed to retieve the file description 
-   of the file to be closed.	
-*/
-static struct filedescriptor_elem *find_fde_by_file (int file_desc) {
-  struct filedescriptor_elem *fd;
-  struct list_elem *el;
-  struct thread *cur;
+/* Copies the IOV_CNT buffer descriptors at user address IOV into
+   kernel array KIOV.  Returns false if IOV_CNT is out of range. */
+static bool copy_iovec (struct iovec *kiov, const struct iovec *iov,
+                        int iov_cnt) {
+  if (iov_cnt < 0 || iov_cnt > IOV_MAX)
+    return false;
+  if (!copy_from_user (kiov, iov, iov_cnt * sizeof *kiov))
+    sys_exit (-1);
+  return true;
+}
 
-  cur=thread_current();
-  
-  for (el = list_begin (&cur->all_files); el != list_end (&cur->all_files); el = list_next (el))
+/* Reads from file FD into the IOV_CNT buffers described at IOV,
+   filling each in turn, and returns the total number of bytes
+   read.  Stops early at the end of the file. */
+static int sys_readv (int fd, const struct iovec *iov, int iov_cnt) {
+  struct iovec kiov[IOV_MAX];
+  int total = 0;
+  int i;
+
+  if (!copy_iovec (kiov, iov, iov_cnt))
+    return -1;
+  for (i = 0; i < iov_cnt; i++)
     {
-      fd = list_entry (el, struct filedescriptor_elem, thread_elem);
-      if (fd->filedesc == file_desc)
-        return fd;
+      int n = sys_read (fd, kiov[i].iov_base, kiov[i].iov_len);
+
+      if (n < 0)
+        return total > 0 ? total : -1;
+      total += n;
+      if ((size_t) n < kiov[i].iov_len)
+        break;
     }
-    
-  return NULL;
+  return total;
+}
+
+/* Writes the IOV_CNT buffers described at IOV to file FD, one
+   after the other, and returns the total number of bytes
+   written. */
+static int sys_writev (int fd, const struct iovec *iov, int iov_cnt) {
+  struct iovec kiov[IOV_MAX];
+  int total = 0;
+  int i;
+
+  if (!copy_iovec (kiov, iov, iov_cnt))
+    return -1;
+  for (i = 0; i < iov_cnt; i++)
+    {
+      int n = sys_write (fd, kiov[i].iov_base, kiov[i].iov_len);
+
+      if (n < 0)
+        return total > 0 ? total : -1;
+      total += n;
+      if ((size_t) n < kiov[i].iov_len)
+        break;
+    }
+  return total;
+}
+
+/* Gives the calling process TICKETS tickets, its share of the CPU
+   under the stride scheduler.  Returns the previous number of
+   tickets, or -1 if TICKETS is out of range. */
+static int sys_settickets (int tickets) {
+  int old = thread_get_tickets ();
+
+  return thread_set_tickets (tickets) ? old : -1;
+}
+
+/* Prints the scheduler statistics to the console, for
+   debugging. */
+static void sys_schedstat (void) {
+  thread_print_stats ();
+}
+
+/* Prints the kernel heap and page allocator statistics to the
+   console, including the outstanding allocations if they are
+   being tracked, for debugging. */
+static void sys_memstat (void) {
+  malloc_print_stats ();
+  palloc_print_stats ();
+}
+
+/* Stores a snapshot of the kernel-wide scheduler, memory and
+   block device statistics in STATS.  The parts are taken one
+   after another, so they are not exactly simultaneous. */
+static void sys_kstat (struct kstat *stats) {
+  struct kstat copy;
+
+  memset (&copy, 0, sizeof copy);
+  thread_get_kstat (&copy.sched);
+  palloc_get_kstat (&copy.mem);
+  malloc_get_kstat (&copy.mem);
+  exception_get_kstat (&copy.mem);
+#ifdef VM
+  vm_swap_get_kstat (&copy.mem);
+  vm_frame_get_kstat (&copy.mem);
+#endif
+  block_get_kstat (copy.block);
+  copy_out (stats, &copy, sizeof copy);
+}
+
+/* Reads or sets kernel tunable NAME.  If OLD is nonnull, stores
+   the tunable's value in *OLD; if NEW is nonnull, then sets it to
+   *NEW.  Returns false, changing nothing, if there is no such
+   tunable or *NEW is out of its range. */
+static bool sys_sysctl (const char *name, int *old, const int *new) {
+  char *kname = copy_in_string (name, SYSCTL_NAME_MAX + 1);
+  int old_value, new_value;
+  bool success;
+
+  if (kname == NULL)
+    return false;
+  if (new != NULL && !copy_from_user (&new_value, new, sizeof new_value))
+    {
+      free (kname);
+      sys_exit (-1);
+    }
+  success = (sysctl_get (kname, &old_value)
+             && (new == NULL || sysctl_set (kname, new_value)));
+  free (kname);
+  if (success && old != NULL)
+    copy_out (old, &old_value, sizeof old_value);
+  return success;
+}
+
+/* Turns the tracing of the calling process's system calls on if
+   ENABLE is nonzero and off otherwise, and returns whether it was
+   on.  Processes it starts from then on inherit the setting. */
+static bool sys_strace (int enable) {
+  struct thread *p = process_current ();
+  bool old = p->strace;
+
+  p->strace = enable != 0;
+  return old;
+}
+
+/* Moves the end of the heap by INCREMENT bytes and returns its
+   old end, or (void *) -1 if it cannot be moved so far. */
+static void *sys_sbrk (intptr_t increment) {
+  void *old_end = process_sbrk (increment);
+
+  return old_end != NULL ? old_end : (void *) -1;
+}
+
+/* Creates a pipe and stores descriptors for its read and write
+   ends in FDS[0] and FDS[1].  Returns 0 if successful, -1 if
+   memory is exhausted. */
+static int sys_pipe (int *fds) {
+  struct fd_entry ends[2];
+  struct pipe *p;
+  int kfds[2];
+
+  if (!pipe_create (&p))
+    return -1;
+  ends[0].file = ends[1].file = NULL;
+  ends[0].pipe = ends[1].pipe = p;
+  ends[0].writer = false;
+  ends[1].writer = true;
+
+  kfds[0] = fd_install (&ends[0]);
+  kfds[1] = kfds[0] != -1 ? fd_install (&ends[1]) : -1;
+  if (kfds[1] == -1)
+    {
+      if (kfds[0] != -1)
+        sys_close (kfds[0]);
+      else
+        pipe_close_end (p, false);
+      pipe_close_end (p, true);
+      return -1;
+    }
+  copy_out (fds, kfds, sizeof kfds);
+  return 0;
+}
+
+/* Makes NEW_FD refer to what OLD_FD does, closing NEW_FD first if
+   it is open.  This is how a process sets up the standard input
+   and output of the children it runs with exec(), which inherit
+   its descriptors.  Returns NEW_FD, or -1 if OLD_FD is not open,
+   NEW_FD is out of range, or memory is exhausted. */
+static int sys_dup2 (int old_fd, int new_fd) {
+  struct thread *cur = process_current ();
+  struct fd_entry *e = fd_entry (old_fd);
+  struct fd_entry copy;
+
+  if (e == NULL || new_fd < 0 || new_fd >= FD_MAX)
+    return -1;
+  if (old_fd == new_fd)
+    return new_fd;
+  if (!fd_dup (&copy, e))
+    return -1;
+  if (new_fd >= cur->fd_cnt && !fd_grow (new_fd + 1))
+    {
+      fd_release (&copy);
+      return -1;
+    }
+  sys_close (new_fd);
+  cur->fds[new_fd] = copy;
+  return new_fd;
+}
+
+/* Waits on the futex at ADDR if it holds VAL. */
+static int sys_futex_wait (int *addr, int val) {
+  return futex_wait (addr, val);
+}
+
+/* Wakes up to CNT threads waiting on the futex at ADDR. */
+static int sys_futex_wake (int *addr, int cnt) {
+  return futex_wake (addr, cnt);
+}
+
+/* Waits until one of the NFDS descriptors described at FDS is
+   ready for the events asked for, or TIMEOUT milliseconds have
+   passed, forever if TIMEOUT is negative.  Sets the events that
+   hold for each descriptor and returns the number of descriptors
+   with any, which is 0 on a timeout, or -1 if NFDS is too big. */
+static int sys_poll (struct pollfd *fds, unsigned nfds, int timeout) {
+  struct pollfd kfds[POLL_MAX];
+  struct poll_waiter w;
+  int ready;
+
+  if (nfds > POLL_MAX)
+    return -1;
+  if (!copy_from_user (kfds, fds, nfds * sizeof *kfds))
+    sys_exit (-1);
+
+  poll_begin (&w, timeout < 0 ? -1
+              : ((int64_t) timeout * TIMER_FREQ + 999) / 1000);
+  for (;;)
+    {
+      unsigned i;
+
+      ready = 0;
+      for (i = 0; i < nfds; i++)
+        {
+          int events = kfds[i].fd < 0 ? 0 : poll_events (kfds[i].fd);
+
+          kfds[i].revents = events & (kfds[i].events
+                                      | POLLERR | POLLHUP | POLLNVAL);
+          if (kfds[i].revents != 0)
+            ready++;
+        }
+
+      /* An exiting process's threads stop waiting. */
+      if (ready > 0 || w.timed_out || process_current ()->exiting)
+        break;
+      poll_wait (&w);
+    }
+  poll_end (&w);
+
+  copy_out (fds, kfds, nfds * sizeof *kfds);
+  return ready;
+}
+
+/* Submits the CNT asynchronous requests described at REQS, in
+   order, and returns the number submitted.  Stops at the first
+   request that is not a read or write of an open file, or that
+   aio_submit() refuses, returning -1 if that is the first. */
+static int sys_aio_submit (const struct aio_request *reqs, int cnt) {
+  int i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct aio_request r;
+      struct file *f;
+      bool write;
+
+      if (!copy_from_user (&r, reqs + i, sizeof r))
+        sys_exit (-1);
+      write = r.op == AIO_WRITE;
+      f = fd_lookup (r.fd);
+      if (f == NULL || (r.op != AIO_READ && !write) || (write && is_dir (f)))
+        break;
+      if (!user_buffer_ok (r.buffer, r.size))
+        sys_exit (-1);
+      if (!aio_submit (f, write, r.buffer, r.size, r.ofs, r.id))
+        break;
+    }
+  return i > 0 || cnt <= 0 ? i : -1;
+}
+
+/* Waits for at least MIN of the process's asynchronous requests
+   to finish, or for all of them if fewer are left, and stores the
+   events of up to MAX of those that have in EVENTS.  Returns the
+   number of events stored, or -1 if MAX is out of range. */
+static int sys_aio_getevents (struct aio_event *events, int min, int max) {
+  struct aio_event kevents[AIO_MAX];
+  int cnt;
+
+  if (max < 0 || max > AIO_MAX)
+    return -1;
+  cnt = aio_getevents (kevents, min, max);
+  copy_out (events, kevents, cnt * sizeof *kevents);
+  return cnt;
+}
+
+/* Changes the working directory to DIR. */
+static bool sys_chdir (const char *dir) {
+  char *name = copy_in_string (dir, PATH_MAX);
+  bool success;
+
+  if (name == NULL)
+    return false;
+  success = filesys_chdir (name);
+  free (name);
+  return success;
+}
+
+/* Creates directory DIR. */
+static bool sys_mkdir (const char *dir) {
+  char *name = copy_in_string (dir, PATH_MAX);
+  bool success;
+
+  if (name == NULL)
+    return false;
+  success = filesys_mkdir (name);
+  free (name);
+  return success;
+}
+
+/* Reads the next entry of directory FD into NAME, which has room
+   for NAME_MAX + 1 bytes.  The entry is found at the file
+   position of FD, which is advanced past it. */
+static bool sys_readdir (int fd, char *name) {
+  struct file *f = fd_lookup (fd);
+  char entry[NAME_MAX + 1];
+  off_t pos;
+
+  if (f == NULL || !is_dir (f))
+    return false;
+
+  pos = file_tell (f);
+  if (!dir_readdir_at (file_get_inode (f), &pos, entry))
+    return false;
+  file_seek (f, pos);
+  copy_out (name, entry, strlen (entry) + 1);
+  return true;
+}
+
+/* Returns true if FD is a directory. */
+static bool sys_isdir (int fd) {
+  struct file *f = fd_lookup (fd);
+
+  return f != NULL && is_dir (f);
+}
+
+/* Returns the inode number of FD, which is unique among the
+   files and directories that exist at the same time. */
+static int sys_inumber (int fd) {
+  struct file *f = fd_lookup (fd);
+
+  if (f == NULL)
+    return -1;
+  return inode_get_inumber (file_get_inode (f));
+}
+
+/* Writes the data and metadata of the file open as FD to disk.
+   Returns false if FD is not open. */
+static bool sys_fsync (int fd) {
+  struct file *f = fd_lookup (fd);
+
+  if (f == NULL)
+    return false;
+  file_sync (f);
+  return true;
+}
+
+/* Writes all modified file system data to disk. */
+static void sys_sync (void) {
+  filesys_sync ();
+}
+
+/* Allocates the space for LEN bytes of file FD from offset OFS,
+   growing the file if it is shorter.  If MODE is
+   FALLOC_PUNCH_HOLE, frees the space of the range instead.
+   Returns false if FD is not an open file, is a directory, or
+   can't be written, if MODE is not known or, when allocating, if
+   the disk is full. */
+static bool sys_fallocate (int fd, int mode, unsigned ofs, unsigned len) {
+  struct file *f = fd_lookup (fd);
+
+  if (f == NULL || is_dir (f) || ofs > INT32_MAX || len > INT32_MAX - ofs)
+    return false;
+  if (mode == 0)
+    return file_allocate (f, ofs, len);
+  else if (mode == FALLOC_PUNCH_HOLE)
+    return file_punch_hole (f, ofs, len);
+  else
+    return false;
+}
+
+/* Copies up to SIZE bytes from FD_IN to FD_OUT, starting at and
+   advancing each file's position, without passing the data
+   through user memory.  Returns the number of bytes copied, or
+   -1 if either descriptor is not an open file or FD_OUT is a
+   directory. */
+static int sys_copy_file_range (int fd_in, int fd_out, unsigned size) {
+  struct file *in = fd_lookup (fd_in);
+  struct file *out = fd_lookup (fd_out);
+
+  if (in == NULL || out == NULL || is_dir (in) || is_dir (out))
+    return -1;
+  return file_copy (out, in, size);
+}
+
+/* Reads entries of the directory open as FD into BUFFER, as many
+   as fit in its SIZE bytes, starting at and advancing the
+   directory's position.  Returns the number of entries stored,
+   which is 0 at the end of the directory, or -1 if FD is not a
+   directory. */
+static int sys_getdents (int fd, struct dirent *buffer, unsigned size) {
+  struct file *f = fd_lookup (fd);
+  size_t cnt = size / sizeof *buffer;
+  off_t pos;
+
+  if (f == NULL || !is_dir (f))
+    return -1;
+  if (!is_user_vaddr (buffer + cnt))
+    sys_exit (-1);
+
+  pos = file_tell (f);
+  cnt = dir_readdir_many (file_get_inode (f), &pos, buffer, cnt);
+  file_seek (f, pos);
+  return cnt;
+}
+
+#ifdef VM
+/* Copies the paging statistics of process TID, or of the calling
+   process if TID is 0, into STATS.  Returns false if there is no
+   such process. */
+static bool sys_vmstat (tid_t tid, struct vmstat *stats) {
+  struct thread *t;
+  struct vmstat copy;
+
+  /* Keep the process from exiting while we look at it. */
+  rcu_read_lock ();
+  t = tid == 0 ? thread_current () : get_thread_by_tid (tid);
+  if (t != NULL)
+    copy = t->process->vm_stats;
+  rcu_read_unlock ();
+
+  if (t == NULL)
+    return false;
+  copy_out (stats, &copy, sizeof copy);
+  return true;
+}
+
+/* Maps the file open as FD at user address ADDR.  The kernel
+   never touches ADDR itself: the pages are loaded on fault. */
+static mapid_t sys_mmap (int fd, void *addr) {
+  struct file *f = fd_lookup (fd);
+
+  if (f == NULL)
+    return MAP_FAILED;
+  return vm_insert_mfile (f, addr);
+}
+
+/* Unmaps MAPID, writing its modified pages back to the file. */
+static void sys_munmap (mapid_t mapid) {
+  vm_delete_mfile (mapid);
+}
+
+/* Applies access pattern hint ADVICE to the LENGTH bytes at
+   ADDR.  Like mmap, the range is checked against the address
+   space rather than accessed. */
+static bool sys_madvise (void *addr, unsigned length, int advice) {
+  return vm_madvise (addr, length, advice);
+}
+
+/* Locks the pages spanned by the LENGTH bytes at ADDR in memory,
+   up to the per-process limit set by -mlock and the limit on the
+   frames locked by all processes together. */
+static bool sys_mlock (void *addr, unsigned length) {
+  return vm_lock_pages (addr, length);
+}
+
+/* Unlocks the pages spanned by the LENGTH bytes at ADDR. */
+static bool sys_munlock (void *addr, unsigned length) {
+  return vm_unlock_pages (addr, length);
+}
+
+/* Maps SIZE bytes of the shared memory segment named NAME at
+   ADDR, creating the segment if needed.  Like mmap, ADDR is only
+   checked against the address space. */
+static bool sys_shm_map (const char *name, unsigned size, void *addr) {
+  char *kname = copy_in_string (name, SHM_NAME_MAX + 1);
+  bool success;
+
+  if (kname == NULL)
+    return false;
+  success = vm_shm_map (kname, size, addr);
+  free (kname);
+  return success;
+}
+
+/* Unmaps the shared memory mapping at ADDR. */
+static bool sys_shm_unmap (void *addr) {
+  return vm_shm_unmap (addr);
+}
+
+/* Removes the name of the shared memory segment named NAME. */
+static bool sys_shm_unlink (const char *name) {
+  char *kname = copy_in_string (name, SHM_NAME_MAX + 1);
+  bool success;
+
+  if (kname == NULL)
+    return false;
+  success = vm_shm_unlink (kname);
+  free (kname);
+  return success;
+}
+
+/* Starts a thread in the current process at user address EIP,
+   which the user library's start routine passes FUNC and AUX
+   to. */
+static tid_t sys_thread_create (void *eip, void *func, void *aux) {
+  return process_thread_create (eip, func, aux);
+}
+
+/* Waits for thread TID of the current process to end. */
+static int sys_thread_join (tid_t tid) {
+  return process_thread_join (tid);
+}
+
+/* Ends the calling thread with STATUS, for thread_join().  The
+   process's first thread has no one to join it, so for it this
+   is exit(). */
+static void sys_thread_exit (int status) {
+  struct thread *cur = thread_current ();
+
+  if (cur == process_current ())
+    sys_exit (status);
+  cur->return_status = status;
+  thread_exit ();
+}
+
+/* Saves the process, as it is in this call from frame F, to a
+   new file named FILE.  Returns 0, or -1 on failure; a process
+   restored from the file returns 1 instead. */
+static int sys_snapshot (const char *file, struct intr_frame *f) {
+  char *name;
+  bool success;
+
+  if (file == NULL)
+    return -1;
+  name = copy_in_string (file, PATH_MAX);
+  if (name == NULL)
+    return -1;
+  success = vm_snapshot_save (name, f);
+  free (name);
+  return success ? 0 : -1;
+}
+
+/* Starts a new process from the snapshot in FILE. */
+static tid_t sys_restore (const char *file) {
+  char *name;
+  tid_t tid;
+
+  if (file == NULL)
+    return TID_ERROR;
+  name = copy_in_string (file, PATH_MAX);
+  if (name == NULL)
+    return TID_ERROR;
+  tid = process_restore (name);
+  free (name);
+  return tid;
 }
+#endif
@@ -1,7 +1,37 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stdbool.h>
+
+/* Descriptors that dup2() or restore() may create are below
+   this, so that they cannot be made to allocate a huge table. */
+#define FD_MAX 1024
+
+/* A slot in a process's file descriptor table, which refers to
+   an open file or to one end of a pipe, or to neither if it is
+   free.  Descriptors 0 and 1 are the console while free. */
+struct fd_entry
+  {
+    struct file *file;          /* Open file, or null. */
+    struct pipe *pipe;          /* Pipe, or null. */
+    bool writer;                /* Write end of PIPE? */
+  };
+
+struct intr_frame;
+
 void syscall_init (void);
+void syscall_sysenter (struct intr_frame *);
+
+/* SYSENTER entry point, in userprog/sysenter.S, and whether a
+   user program single-stepped into it; see debug_exception() in
+   userprog/exception.c. */
+void sysenter_entry (void);
+extern bool sysenter_single_step;
+void syscall_print_stats (void);
+
+bool syscall_copy_fds (struct fd_entry **, int *cnt,
+                       int stdin_fd, int stdout_fd);
+void syscall_close_fds (struct fd_entry *, int cnt);
 
 int sys_exit (int status);
 
@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stddef.h>
 #include "userprog/gdt.h"
+#include "userprog/syscall.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
@@ -75,6 +76,18 @@ struct tss
 /* Kernel TSS. */
 static struct tss *tss;
 
+/* Model-specific registers for SYSENTER.  See [IA32-v3b] 4.8.7
+   "Fast System Calls". */
+#define MSR_SYSENTER_CS 0x174   /* Kernel code selector. */
+#define MSR_SYSENTER_ESP 0x175  /* Kernel stack pointer. */
+#define MSR_SYSENTER_EIP 0x176  /* Kernel entry point. */
+
+/* CPUID leaf 1 EDX bit for SYSENTER and SYSEXIT. */
+#define CPUID_SEP 0x00000800
+
+static void sysenter_init (void);
+static void write_msr (uint32_t msr, uint32_t value);
+
 /* Initializes the kernel TSS. */
 void
 tss_init (void) 
@@ -86,6 +99,39 @@ tss_init (void)
   tss->ss0 = SEL_KDSEG;
   tss->bitmap = 0xdfff;
   tss_update ();
+  sysenter_init ();
+}
+
+/* Enables SYSENTER as a second way into syscall_handler(), if
+   the processor has it.  A thread's kernel stack changes on every
+   switch, but SYSENTER_ESP is fixed, so it points to the last
+   word of the TSS's page, which holds the address of the TSS's
+   esp0, kept current by tss_update().  The entry stub's first
+   two instructions load the stack from there.  The rest of the
+   page, below, is a stack for the debug exception that a user
+   program single-stepping into SYSENTER raises before them. */
+static void
+sysenter_init (void)
+{
+  void **top = (void **) ((uint8_t *) tss + PGSIZE) - 1;
+  uint32_t eax, ebx, ecx, edx;
+
+  asm volatile ("cpuid"
+                : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                : "a" (1));
+  if (!(edx & CPUID_SEP))
+    return;
+  write_msr (MSR_SYSENTER_CS, SEL_KCSEG);
+  *top = &tss->esp0;
+  write_msr (MSR_SYSENTER_ESP, (uint32_t) top);
+  write_msr (MSR_SYSENTER_EIP, (uint32_t) sysenter_entry);
+}
+
+/* Sets model-specific register MSR to VALUE. */
+static void
+write_msr (uint32_t msr, uint32_t value)
+{
+  asm volatile ("wrmsr" : : "c" (msr), "a" (value), "d" (0));
 }
 
 /* Returns the kernel TSS. */
@@ -0,0 +1,117 @@
+#include "userprog/uaccess.h"
+#include <stdint.h>
+#include "threads/vaddr.h"
+
+/* Bounds of the exception table, set by the linker script. */
+extern const struct exception_entry _start_ex_table[], _end_ex_table[];
+
+static bool user_range (const void *, size_t);
+static bool copy_words (void *dst, const void *src, size_t size);
+
+/* Copies SIZE bytes from user address USRC to kernel address DST.
+   Returns false if part of the user range is not mapped. */
+bool
+copy_from_user (void *dst, const void *usrc, size_t size)
+{
+  return user_range (usrc, size) && copy_words (dst, usrc, size);
+}
+
+/* Copies SIZE bytes from kernel address SRC to user address UDST.
+   Returns false if part of the user range is not mapped or not
+   writable. */
+bool
+copy_to_user (void *udst, const void *src, size_t size)
+{
+  return user_range (udst, size) && copy_words (udst, src, size);
+}
+
+/* Copies the null-terminated string at user address USRC into
+   the SIZE bytes at DST.  Returns the length of the string, or
+   SIZE if it does not fit, in which case DST is not terminated.
+   Returns -1 if the string runs into memory that is not mapped or
+   is not user memory. */
+int
+strncpy_from_user (char *dst, const char *usrc, size_t size)
+{
+  size_t room, limit, left;
+  int fault;
+
+  if (!is_user_vaddr (usrc))
+    return -1;
+  room = (size_t) ((const uint8_t *) PHYS_BASE - (const uint8_t *) usrc);
+  limit = left = size < room ? size : room;
+
+  /* Copies a byte at a time, up to and including the terminator,
+     counting LEFT down. */
+  asm volatile ("xorl %[fault], %[fault]\n\t"
+                "1: testl %%ecx, %%ecx\n\t"
+                "jz 3f\n"
+                "2: lodsb\n\t"
+                "stosb\n\t"
+                "decl %%ecx\n\t"
+                "testb %%al, %%al\n\t"
+                "jnz 1b\n\t"
+                "jmp 3f\n"
+                "4: movl $1, %[fault]\n"
+                "3:\n\t"
+                ".pushsection __ex_table, \"a\"\n\t"
+                ".long 2b, 4b\n\t"
+                ".popsection"
+                : [fault] "=&r" (fault), "+S" (usrc), "+D" (dst),
+                  "+c" (left)
+                : : "eax", "cc", "memory");
+
+  /* DST and USRC now point past the last byte copied. */
+  if (fault)
+    return -1;
+  if (left < limit && dst[-1] == '\0')
+    return limit - left - 1;
+  return limit == size ? (int) size : -1;
+}
+
+/* Returns the exception table entry for the instruction at EIP,
+   or a null pointer if it has none. */
+const struct exception_entry *
+uaccess_find_fixup (const void *eip)
+{
+  const struct exception_entry *e;
+
+  for (e = _start_ex_table; e < _end_ex_table; e++)
+    if (e->insn == eip)
+      return e;
+  return NULL;
+}
+
+/* Returns true if the SIZE bytes at ADDR lie in user memory. */
+static bool
+user_range (const void *addr, size_t size)
+{
+  return (size_t) ((const uint8_t *) PHYS_BASE - (const uint8_t *) addr)
+         >= size && is_user_vaddr (addr);
+}
+
+/* Copies SIZE bytes from SRC to DST, a word at a time and then
+   the bytes left over.  Returns false if either faults. */
+static bool
+copy_words (void *dst, const void *src, size_t size)
+{
+  size_t words = size / sizeof (uint32_t);
+  int fault;
+
+  asm volatile ("xorl %[fault], %[fault]\n\t"
+                "1: rep movsl\n\t"
+                "movl %[bytes], %%ecx\n"
+                "2: rep movsb\n\t"
+                "jmp 4f\n"
+                "3: movl $1, %[fault]\n"
+                "4:\n\t"
+                ".pushsection __ex_table, \"a\"\n\t"
+                ".long 1b, 3b\n\t"
+                ".long 2b, 3b\n\t"
+                ".popsection"
+                : [fault] "=&r" (fault), "+D" (dst), "+S" (src),
+                  "+c" (words)
+                : [bytes] "r" (size % sizeof (uint32_t))
+                : "cc", "memory");
+  return !fault;
+}
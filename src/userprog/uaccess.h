@@ -0,0 +1,30 @@
+#ifndef USERPROG_UACCESS_H
+#define USERPROG_UACCESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Copying between user and kernel memory.
+
+   These routines only check that the user range lies below
+   PHYS_BASE.  They then access it directly, and a fault that the
+   page fault handler cannot resolve resumes at a fixup in the
+   routine instead of killing the process, so that the routine
+   returns failure.  The faulting instructions and their fixups
+   are listed in the exception table, the __ex_table section,
+   which the page fault handler searches. */
+
+/* An entry of the exception table. */
+struct exception_entry
+  {
+    void *insn;                 /* Instruction that may fault. */
+    void *fixup;                /* Where to resume if it does. */
+  };
+
+bool copy_from_user (void *dst, const void *usrc, size_t size);
+bool copy_to_user (void *udst, const void *src, size_t size);
+int strncpy_from_user (char *dst, const char *usrc, size_t size);
+
+const struct exception_entry *uaccess_find_fixup (const void *eip);
+
+#endif /* userprog/uaccess.h */
@@ -488,4 +488,271 @@ sub max {
     return $max;
 }
 
+# On-disk format of the Pintos file system, as in filesys/inode.c,
+# filesys/directory.c, filesys/journal.c, filesys/cache.h and
+# filesys/filesys.h.
+my ($FS_FREE_MAP_SECTOR) = 0;
+my ($FS_ROOT_DIR_SECTOR) = 1;
+my ($FS_JOURNAL_SECTOR) = 2;
+my ($FS_JOURNAL_SECTORS) = 1 + 64;
+my ($FS_JOURNAL_MAGIC) = 0x4a524e4c;
+my ($FS_INODE_MAGIC) = 0x494e4f44;
+my ($FS_DIRECT_CNT) = 12;
+my ($FS_PTRS_PER_SECTOR) = 128;
+my ($FS_INLINE_MAX) = 444;
+my ($FS_NAME_MAX) = 14;
+my ($FS_DIR_HEADER_SIZE) = 4;
+my ($FS_DIR_ENTRY_SIZE) = 24;
+my ($FS_DIR_BLOCK_ENTRIES) = 21;
+my ($FS_DIR_MIN_ENTRIES) = 16;
+
+# make_filesys($dir, $sectors)
+#
+# Returns the contents of a Pintos file system partition of $sectors
+# sectors that holds a copy of the tree of files and directories
+# under $dir, so that the kernel can use it without formatting or
+# extracting anything.  If $sectors is undefined, the partition is
+# made 1 MB larger than the tree needs, and at least 2 MB.
+#
+# The image is laid out the way the kernel would like to have it
+# but, growing files a write at a time, rarely gets: every file is
+# one contiguous run of sectors, its inode and index blocks followed
+# by its data, and the entries of each directory are sorted by name
+# and followed by the inodes and data of its files, then by its
+# subdirectories.  Files and directories small enough are stored
+# inline in their inodes.
+sub make_filesys {
+    my ($dir, $sectors) = @_;
+
+    my ($root) = fs_scan ($dir, '/');
+
+    # Lay out the tree after the free map, the journal and the
+    # cache manifest, which is left empty.  The free map's own size
+    # depends on the size of the partition.
+    my ($tree_sectors) = fs_count ($root) - 1;
+    my ($fixed) = $FS_JOURNAL_SECTOR + $FS_JOURNAL_SECTORS + 1;
+    if (!defined $sectors) {
+	$sectors = $fixed + $tree_sectors + 2048;
+	$sectors += fs_sector_cnt (fs_free_map_size ($sectors));
+	$sectors = 4096 if $sectors < 4096;
+    }
+    my ($free_map_size) = fs_free_map_size ($sectors);
+    my ($used) = $fixed + fs_sector_cnt ($free_map_size) + $tree_sectors;
+    die "$dir: needs $used sectors, file system has only $sectors\n"
+      if $used > $sectors;
+
+    my ($image) = "\0" x ($sectors * 512);
+    my ($next) = $fixed;
+    my ($free_map) = {INODE => $FS_FREE_MAP_SECTOR,
+		      SIZE => $free_map_size};
+    fs_place ($free_map, \$next);
+    $root->{INODE} = $FS_ROOT_DIR_SECTOR;
+    $root->{PARENT} = $root;
+    fs_place ($root, \$next);
+    fs_place_children ($root, \$next);
+    die if $next != $used;
+
+    # Write the tree.
+    fs_write_node (\$image, $root);
+
+    # Write the journal header, with no transaction to replay.
+    substr ($image, $FS_JOURNAL_SECTOR * 512, 8)
+      = pack ("V V", $FS_JOURNAL_MAGIC, 0);
+
+    # Write the free map: everything before $next is in use.
+    my ($bits) = "\0" x $free_map_size;
+    vec ($bits, $_, 1) = 1 foreach 0...$next - 1;
+    $free_map->{CONTENTS} = $bits;
+    fs_write_inode (\$image, $free_map, 0);
+
+    return $image;
+}
+
+# fs_scan($path, $name)
+#
+# Returns a node describing the file or directory $path, to be
+# named $name in the file system.  The node of a directory lists the
+# nodes of its entries, sorted by name.
+sub fs_scan {
+    my ($path, $name) = @_;
+    my ($node) = {NAME => $name, PATH => $path};
+
+    if (-d $path) {
+	my ($handle);
+	opendir ($handle, $path) or die "$path: opendir: $!\n";
+	my (@names) = sort grep ($_ ne '.' && $_ ne '..', readdir ($handle));
+	closedir ($handle);
+
+	$node->{IS_DIR} = 1;
+	$node->{CHILDREN} = [map (fs_scan ("$path/$_", $_), @names)];
+	my ($cnt) = 2 + @names;
+	$cnt = $FS_DIR_MIN_ENTRIES if $cnt < $FS_DIR_MIN_ENTRIES;
+	$node->{SIZE} = (int ($cnt / $FS_DIR_BLOCK_ENTRIES) * 512
+			 + $FS_DIR_HEADER_SIZE
+			 + $cnt % $FS_DIR_BLOCK_ENTRIES * $FS_DIR_ENTRY_SIZE);
+    } elsif (-f $path) {
+	$node->{IS_DIR} = 0;
+	$node->{SIZE} = -s $path;
+    } else {
+	die "$path: not a regular file or directory\n";
+    }
+    die "$path: name longer than $FS_NAME_MAX characters\n"
+      if length ($name) > $FS_NAME_MAX;
+    return $node;
+}
+
+# fs_sector_cnt($size)
+#
+# Returns the number of data and index sectors a file $size bytes
+# long takes, not counting its inode.
+sub fs_sector_cnt {
+    my ($size) = @_;
+    return 0 if $size <= $FS_INLINE_MAX;
+
+    my ($data) = div_round_up ($size, 512);
+    my ($index) = 0;
+    $index++ if $data > $FS_DIRECT_CNT;
+    my ($doubly) = $data - $FS_DIRECT_CNT - $FS_PTRS_PER_SECTOR;
+    $index += 1 + div_round_up ($doubly, $FS_PTRS_PER_SECTOR) if $doubly > 0;
+    die "file of $size bytes is too large\n"
+      if $doubly > $FS_PTRS_PER_SECTOR * $FS_PTRS_PER_SECTOR;
+    return $data + $index;
+}
+
+# fs_free_map_size($sectors)
+#
+# Returns the size in bytes of the free map of a file system with
+# $sectors sectors, which is made of 32-bit words.
+sub fs_free_map_size {
+    my ($sectors) = @_;
+    return div_round_up ($sectors, 32) * 4;
+}
+
+# fs_count($node)
+#
+# Returns the number of sectors taken by $node and everything under
+# it, counting its inode.
+sub fs_count {
+    my ($node) = @_;
+    my ($cnt) = 1 + fs_sector_cnt ($node->{SIZE});
+    $cnt += fs_count ($_) foreach @{$node->{CHILDREN} || []};
+    return $cnt;
+}
+
+# fs_place($node, \$next)
+#
+# Assigns sectors starting at $next to the index blocks and data of
+# $node, whose inode already has its sector, and advances $next past
+# them.  Index blocks come first, in the order the kernel reads
+# them, so that the data is one run.
+sub fs_place {
+    my ($node, $next) = @_;
+    my ($cnt) = fs_sector_cnt ($node->{SIZE});
+    my ($data) = $cnt > 0 ? div_round_up ($node->{SIZE}, 512) : 0;
+    my (@index) = map ($$next + $_, 0...$cnt - $data - 1);
+
+    $node->{INDEX} = \@index;
+    $node->{SECTORS} = [map ($$next + $cnt - $data + $_, 0...$data - 1)];
+    $$next += $cnt;
+}
+
+# fs_place_children($dir, \$next)
+#
+# Assigns sectors to everything under directory $dir, starting at
+# $next: first the inodes of its entries, each file's followed by
+# its data, then each subdirectory's contents in turn.
+sub fs_place_children {
+    my ($dir, $next) = @_;
+
+    foreach my $child (@{$dir->{CHILDREN}}) {
+	$child->{INODE} = $$next++;
+	$child->{PARENT} = $dir;
+	fs_place ($child, $next);
+    }
+    foreach my $child (grep ($_->{IS_DIR}, @{$dir->{CHILDREN}})) {
+	fs_place_children ($child, $next);
+    }
+}
+
+# fs_write_node(\$image, $node)
+#
+# Writes $node and everything under it into $image.
+sub fs_write_node {
+    my ($image, $node) = @_;
+
+    if ($node->{IS_DIR}) {
+	my (@entries) = ([$node->{INODE}, '.', 1],
+			 [$node->{PARENT}{INODE}, '..', 1],
+			 map ([$_->{INODE}, $_->{NAME}, $_->{IS_DIR}],
+			      @{$node->{CHILDREN}}));
+	my ($contents) = '';
+	while (@entries) {
+	    my (@block) = splice (@entries, 0, $FS_DIR_BLOCK_ENTRIES);
+	    my ($sector) = pack ("v v", scalar (@block), 0);
+	    $sector .= pack ("V a15 C C x3", $_->[0], $_->[1], 1, $_->[2])
+	      foreach @block;
+	    $contents .= pack ("a512", $sector);
+	}
+	$node->{CONTENTS} = pack ("a$node->{SIZE}", $contents);
+	fs_write_inode ($image, $node, 1);
+	fs_write_node ($image, $_) foreach @{$node->{CHILDREN}};
+    } else {
+	my ($handle);
+	my ($fn) = $node->{PATH};
+	open ($handle, '<', $fn) or die "$fn: open: $!\n";
+	$node->{CONTENTS} = ($node->{SIZE} > 0
+			     ? read_fully ($handle, $fn, $node->{SIZE}) : '');
+	close ($handle);
+	fs_write_inode ($image, $node, 0);
+    }
+}
+
+# fs_write_inode(\$image, $node, $is_dir)
+#
+# Writes the inode, index blocks and data of $node into $image, its
+# data being the string $node->{CONTENTS}.
+sub fs_write_inode {
+    my ($image, $node, $is_dir) = @_;
+    my ($contents) = $node->{CONTENTS};
+    my (@ptrs) = @{$node->{SECTORS}};
+    my (@index) = @{$node->{INDEX}};
+    my (@direct) = (0) x $FS_DIRECT_CNT;
+    my ($indirect, $doubly) = (0, 0);
+    my ($inline) = @ptrs ? '' : $contents;
+
+    for my $i (0...$#ptrs) {
+	substr ($$image, $ptrs[$i] * 512, 512)
+	  = pack ("a512", substr ($contents, $i * 512, 512));
+    }
+    my (@first) = splice (@ptrs, 0, $FS_DIRECT_CNT);
+    @direct[0...$#first] = @first;
+    if (@ptrs) {
+	$indirect = shift (@index);
+	fs_write_ptrs ($image, $indirect,
+		       splice (@ptrs, 0, $FS_PTRS_PER_SECTOR));
+    }
+    if (@ptrs) {
+	my (@blocks);
+	$doubly = shift (@index);
+	while (@ptrs) {
+	    push (@blocks, shift (@index));
+	    fs_write_ptrs ($image, $blocks[-1],
+			   splice (@ptrs, 0, $FS_PTRS_PER_SECTOR));
+	}
+	fs_write_ptrs ($image, $doubly, @blocks);
+    }
+    substr ($$image, $node->{INODE} * 512, 512)
+      = pack ("V$FS_DIRECT_CNT V V V V V a$FS_INLINE_MAX",
+	      @direct, $indirect, $doubly, $node->{SIZE}, $FS_INODE_MAGIC,
+	      $is_dir, $inline);
+}
+
+# fs_write_ptrs(\$image, $sector, @ptrs)
+#
+# Writes an index block listing @ptrs into $sector of $image.
+sub fs_write_ptrs {
+    my ($image, $sector, @ptrs) = @_;
+    substr ($$image, $sector * 512, 512) = pack ("a512", pack ("V*", @ptrs));
+}
+
 1;
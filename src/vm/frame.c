@@ -1,160 +1,719 @@
 #include "vm/frame.h"
+#include <kstat.h>
+#include <ohash.h>
 #include <stdio.h>
+#include <string.h>
+#include <round.h>
+#include <stdlib.h>
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "filesys/inode.h"
 #include "userprog/syscall.h"
 #include "userprog/pagedir.h"
-#include "threads/malloc.h"
+#include "userprog/process.h"
+#include "threads/interrupt.h"
+#include "threads/loader.h"
 #include "threads/synch.h"
+#include "threads/sysctl.h"
+#include "threads/trace.h"
+#include "threads/workqueue.h"
+#include "threads/vaddr.h"
+#include "vm/shm.h"
+#include "vm/swap.h"
+
+/* The page cleaner starts evicting when fewer than
+   FRAME_LOW_WATER user pages are free, and goes on until at
+   least FRAME_HIGH_WATER are.  Both are tunables, vm.low_water
+   and vm.high_water. */
+#define FRAME_LOW_WATER 16
+#define FRAME_HIGH_WATER 32
+static int frame_low_water = FRAME_LOW_WATER;
+static int frame_high_water = FRAME_HIGH_WATER;
+
+/* Victims taken by one eviction, the tunable vm.swap_cluster, at
+   most SWAP_CLUSTER. */
+static int swap_cluster = SWAP_CLUSTER;
+
+/* Most pages of memory mappings written back in one batch, with
+   evict_lock held, by vm_frame_flush_mapped(). */
+#define FLUSH_BATCH 16
+
+/* Most evictions vm_get_frame() makes for one frame before it
+   gives up. */
+#define EVICT_TRIES 4
 
 /* Synchronization primitives for the frame table. */
 static struct lock frame_lock;
 static struct lock evict_lock;
-/* Hash table of frames for fast lookup. */
-static struct hash vm_frames;
-/* List of frames for the clock eviction algorithm. */
-static struct list vm_frames_list;
-static struct list_elem *e_next;
-
-/* Frame hash table helper functions. */
-static unsigned frame_hash (const struct hash_elem *, void *);
-static bool frame_less (const struct hash_elem *, 
+/* Frame descriptors, one for each page of physical memory and
+   indexed by physical page number, so that looking up a frame
+   and starting to use one need neither a search nor malloc().
+   Pages lent by the kernel pool can be user frames too, so the
+   table covers all of memory.  A descriptor is in use while its
+   ADDR is nonnull. */
+static struct vm_frame *frames;
+/* Hash table of the frames holding shareable file data, by inode
+   and block index. */
+static struct hash shared_frames;
+/* The clock hands are indexes into FRAMES, which they sweep in
+   order, skipping descriptors not in use and the frames locked
+   by mlock(), so eviction never visits those.  A hand needs no
+   fixing when the frame under it is freed.  CLOCK_CNT counts the
+   frames the hands visit and LOCKED_CNT the locked ones.  The
+   hands and counts are protected by frame_lock, but CLOCK_CNT is
+   read without it as a hint. */
+static size_t clock_hand;
+/* Front hand of the two-handed clock, or NO_HAND until it is
+   used. */
+#define NO_HAND SIZE_MAX
+static size_t front_hand = NO_HAND;
+static size_t clock_cnt;
+static size_t locked_cnt;
+
+/* Most frames mlock() may take out of the clock, whatever the
+   processes' own limits: half of the user pool, so that eviction
+   always has frames to choose from. */
+static size_t locked_max;
+
+/* Background work: the page cleaner and the page merger. */
+static struct workqueue vm_wq;
+static struct work cleaner_work;
+static struct work merger_work;
+
+/* Same-page merging.  Every vm.merge_interval ticks, or never if
+   it is 0, the page merger hashes the contents of up to
+   vm.merge_scan frames of anonymous memory, going round the
+   frame descriptors.  MERGE_TABLE remembers the last frame seen
+   with each hash, and a frame found to hold the same data as the
+   one remembered gives its pages to it, copy-on-write, and is
+   freed.  The table is emptied at the end of each round, as the
+   contents of its frames may have changed since. */
+#define MERGE_INTERVAL 100
+#define MERGE_SCAN 128
+static int merge_interval = MERGE_INTERVAL;
+static int merge_scan = MERGE_SCAN;
+static struct ohash merge_table;
+static bool merge_table_ok;             /* MERGE_TABLE initialized? */
+static size_t merge_next;               /* Next frame descriptor. */
+static long long merge_cnt;             /* Frames freed by merging. */
+
+/* Page replacement policy, chosen with the -evict option. */
+enum vm_evict_policy vm_evict_policy = EVICT_CLOCK;
+
+/* Shared frame hash table helper functions. */
+static unsigned share_hash (const struct hash_elem *, void *);
+static bool share_less (const struct hash_elem *, 
                         const struct hash_elem *, void *);
 /* Functions for frame lookup and frame delete. */
 static struct vm_frame *find_frame (void *);
+static struct vm_frame *frame_descriptor (void *);
 static void delete_frame (struct vm_frame *);
+static void unlink_frame (struct vm_frame *);
+static void free_frames (struct vm_frame **, size_t);
 
 /* Eviction helper function. */
-static bool eviction_scan_and_flip (struct vm_frame *);
-static void eviction (void);
+static bool frame_referenced (struct vm_frame *, bool clear);
+static bool frame_over_allotment (struct vm_frame *);
+static size_t eviction (void **reclaimed);
+static work_func page_cleaner;
+static work_func page_merger;
+static void merge_pass (void);
+static void merge_frame (struct vm_frame *);
+static bool frame_mergeable (struct vm_frame *);
+static bool merge_into (struct vm_frame *keep, struct vm_frame *victim);
+static void protect_frame (struct vm_frame *);
+static void unprotect_frame (struct vm_frame *);
+static void start_eviction (struct vm_frame **, size_t);
+static void *finish_eviction (struct vm_frame **, size_t, bool reclaim);
+static void free_frame (void *, uint32_t *);
+static void lock_page_state (struct vm_page *);
+static void new_frame (void *);
+static void lock_frame (struct vm_frame *);
+static void pin_frame (struct vm_frame *);
+static void unpin_frame (struct vm_frame *);
+static void unlock_frame (struct vm_frame *);
+
+/* Write-back helper functions. */
+static size_t collect_dirty (struct thread *, struct vm_page **);
+static int compare_file_order (const void *, const void *);
+static void write_back (struct vm_page *);
 
 /* Clock algorithm helper functions. */
-static void eviction_remove_pointer (struct vm_frame *);
-static struct vm_frame *eviction_get_next (void);
-static void eviction_move_next (void);
+static bool in_clock (const struct vm_frame *);
+static void eviction_place_front (void);
+static struct vm_frame *eviction_get_next (size_t *hand);
+static void eviction_move_next (size_t *hand);
 
 /* Initialise the frame table. */
 void
 vm_frame_init ()
 {
-  lock_init (&frame_lock);
-  lock_init (&evict_lock);
-  hash_init (&vm_frames, frame_hash, frame_less, NULL);
-  list_init (&vm_frames_list);
+  lock_init_named (&frame_lock, "frame");
+  lock_init_named (&evict_lock, "evict");
+  lock_set_adaptive (&frame_lock);
+  struct kstat_mem mem;
+  size_t i;
+
+  frames = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+                                DIV_ROUND_UP (init_ram_pages * sizeof *frames,
+                                              PGSIZE));
+  for (i = 0; i < init_ram_pages; i++)
+    {
+      lock_init (&frames[i].list_lock);
+      lock_set_adaptive (&frames[i].list_lock);
+    }
+  hash_init (&shared_frames, share_hash, share_less, NULL);
+  palloc_get_kstat (&mem);
+  locked_max = mem.user_pages / 2;
+
+  sysctl_register ("vm.low_water", &frame_low_water, 0, 4096);
+  sysctl_register ("vm.high_water", &frame_high_water, 0, 4096);
+  sysctl_register ("vm.swap_cluster", &swap_cluster, 1, SWAP_CLUSTER);
+  sysctl_register ("vm.merge_interval", &merge_interval, 0, 10000);
+  sysctl_register ("vm.merge_scan", &merge_scan, 1, 4096);
+
+  workqueue_init (&vm_wq, "vm", 2);
+  work_init (&cleaner_work, page_cleaner, NULL, PRI_DEFAULT);
+  work_init (&merger_work, page_merger, NULL, PRI_DEFAULT);
+  workqueue_queue_delayed (&vm_wq, &merger_work, MERGE_INTERVAL);
+}
+
+/* Stores the number of frames freed by same-page merging in
+   STATS. */
+void
+vm_frame_get_kstat (struct kstat_mem *stats)
+{
+  stats->merged = merge_cnt;
 }
 
-/* Sharing - Looks thourgh all the frames if there is one that contains
-   the required data. This function will be called on each page load of
-   a read only file segment. Because is called quite rare we don't need
-   a fast lookup in a hash table and choosed a list for simplicity. */
+/* Sharing - Returns the frame that holds the first READ_BYTES
+   bytes of block BLOCK_ID of INODE, zero-filled after them,
+   pinned, or a null pointer if there is none.  This is called on
+   each page load of a read only file segment, so the frames that
+   can be shared are indexed by their data in a hash table of
+   their own.  READ_BYTES is part of the identity because two
+   segments may end and begin in the same block of the file. */
 void *
-vm_lookup_frame (off_t block_id)
+vm_lookup_frame (struct inode *inode, off_t block_id, size_t read_bytes)
 {
+  struct vm_frame key;
+  struct hash_elem *e;
   void *addr = NULL;
 
-  struct hash_iterator it;
-  
+  key.inode = inode;
+  key.block_id = block_id;
+  key.read_bytes = read_bytes;
+
   /* Ensure synchronization with other access on the frame's table. */
   lock_acquire (&frame_lock);
-  hash_first (&it, &vm_frames);
-  while (hash_next (&it) && addr == NULL)
+  e = hash_find (&shared_frames, &key.share_elem);
+  if (e != NULL)
     {
-      struct vm_frame *vf = NULL;
-      vf = hash_entry (hash_cur (&it), struct vm_frame, hash_elem);
+      struct vm_frame *vf = hash_entry (e, struct vm_frame, share_elem);
+      addr = vf->addr;
+      pin_frame (vf);
+    }
+  lock_release (&frame_lock);
+  
+  return addr;
+}
 
-      /* Syncronize with the frame page list. */
-      lock_acquire (&vf->list_lock);
-      
-      struct list_elem *e = list_begin (&vf->pages);
-      struct vm_page *page = list_entry (e, struct vm_page, frame_elem);
+/* Enters the frame at ADDR, which holds the first READ_BYTES
+   bytes of block BLOCK_ID of INODE, in the shared frame index, so
+   that vm_lookup_frame() finds it.  Does nothing if another frame
+   already holds the same data. */
+void
+vm_frame_share (void *addr, struct inode *inode, off_t block_id,
+                size_t read_bytes)
+{
+  struct vm_frame *vf = find_frame (addr);
 
-      /* Takes a page to see if the frame contains the same data block. */
-      if (page->type == FILE && page->file_data.block_id == block_id)
-        {
-          addr = vf->addr;
-          vf->pinned = true;
-        }
+  if (vf == NULL)
+    return;
 
-      lock_release (&vf->list_lock);
+  lock_acquire (&frame_lock);
+  if (!vf->shared)
+    {
+      vf->inode = inode;
+      vf->block_id = block_id;
+      vf->read_bytes = read_bytes;
+      vf->shared = hash_insert (&shared_frames, &vf->share_elem) == NULL;
     }
   lock_release (&frame_lock);
-  
-  return addr;
 }
 
-/* Obtains a free frame. Evicts a frame if memory allocation fails. */
+/* Obtains a free frame. Evicts frames if memory allocation fails.
+   Returns a null pointer if no frame can be evicted, because
+   every frame is pinned or locked, or if memory freed by
+   evictions kept being taken by other threads.
+
+   The evicting thread keeps one of the frames it frees for itself,
+   so that no other thread can take it first, and evict_lock queues
+   evicting threads in FIFO order.  A fault therefore waits for at
+   most one eviction of its own, however many threads are
+   competing for memory. */
 void *
 vm_get_frame (enum palloc_flags flags)
 {
-  void *addr = palloc_get_page (flags);
-  
-  /* If memory allocation was successful. */
-  if (addr != NULL) 
-  {
-    struct vm_frame *vf;
-    vf = (struct vm_frame *) malloc (sizeof (struct vm_frame) );
-
-    if (vf == NULL)
-      return false;
+  void *addr;
+  int tries;
 
-    vf->addr = addr;
-    /* A new frame will be pinned until the caller will load the data to it.
-       This way pe make sure it won't be evicted anytime in between. */
-    vf->pinned = true;
-    list_init (&vf->pages);
-    lock_init (&vf->list_lock);
-
-    lock_acquire (&frame_lock);
-		list_push_back (&vm_frames_list, &vf->list_elem);
-    hash_insert (&vm_frames, &vf->hash_elem);   
-    lock_release (&frame_lock);
-  }
-  else
-  {
+  for (tries = 0; tries < EVICT_TRIES; tries++)
+    {
+      addr = vm_try_get_frame (flags);
+      if (addr != NULL)
+        return addr;
 #ifndef VM
-    /* We have fixed size memory in this case. */
-    sys_t_exit (-1);
+      /* We have fixed size memory in this case. */
+      sys_t_exit (-1);
 #endif
 
-    /* Evict a frame and try again. */
-    eviction ();
-    return vm_get_frame (flags);
-  }
+      /* Evict frames and take over one of them.  Taking one only
+         fails if the owners of all the victims freed them in the
+         meantime, which leaves free memory to allocate. */
+      ASSERT (flags & PAL_USER);
+      if (eviction (&addr) == 0)
+        break;
+      if (addr != NULL)
+        {
+          if (flags & PAL_ZERO)
+            memset (addr, 0, PGSIZE);
+          new_frame (addr);
+          return addr;
+        }
+    }
+  return NULL;
+}
+
+/* Obtains a free frame like vm_get_frame(), but returns a null
+   pointer instead of evicting when no memory is free.  Used for
+   speculative loads, which are not worth an eviction. */
+void *
+vm_try_get_frame (enum palloc_flags flags)
+{
+  void *addr = palloc_get_page (flags);
 
+  if (addr == NULL)
+    return NULL;
+  if ((flags & PAL_USER)
+      && palloc_free_cnt (PAL_USER) < (size_t) frame_low_water)
+    workqueue_queue (&vm_wq, &cleaner_work);
+
+  new_frame (addr);
   return addr;
 }
 
-/* Frees the given frame and writes the data back to swap
-   or file. This function will be called on process exit. */
+/* Starts using the descriptor of the frame at ADDR, a page just
+   obtained from the user pool. */
+static void
+new_frame (void *addr)
+{
+  struct vm_frame *vf = frame_descriptor (addr);
+
+  ASSERT (vf->addr == NULL);
+
+  /* A new frame will be pinned until the caller will load the data to it.
+     This way pe make sure it won't be evicted anytime in between. */
+  vf->pin_cnt = 1;
+  vf->lock_cnt = 0;
+  vf->shared = false;
+  vf->shm = NULL;
+  list_init (&vf->pages);
+
+  /* Setting ADDR puts the frame in the clock. */
+  lock_acquire (&frame_lock);
+  vf->addr = addr;
+  clock_cnt++;
+  lock_release (&frame_lock);
+}
+
+/* Removes the page of PAGEDIR from the frame at ADDR, where it
+   was about to be loaded, and frees the frame if no other page
+   shares it and it holds no shared memory page.  Used when
+   loading the page fails. */
 void 
 vm_free_frame (void *addr, uint32_t *pagedir)
 {
   lock_acquire (&evict_lock);
-  struct vm_frame *vf = find_frame (addr);  
-  struct list_elem *e;
-  
-  if (vf == NULL) 
+  free_frame (addr, pagedir);
+  lock_release (&evict_lock);
+}
+
+/* Removes PAGE from its frame, if it is loaded, without saving
+   its contents, and frees the frame if no other page shares it.
+   Used when the page itself goes away. */
+void
+vm_frame_drop_page (struct vm_page *page)
+{
+  vm_frame_drop_pages (&page, 1);
+}
+
+/* Drops each of the CNT pages in PAGES, at most VM_DROP_BATCH,
+   as vm_frame_drop_page() does, taking evict_lock and frame_lock
+   once for the whole batch rather than once per page. */
+void
+vm_frame_drop_pages (struct vm_page **pages, size_t cnt)
+{
+  struct vm_frame *empty[VM_DROP_BATCH];
+  size_t empty_cnt = 0;
+  size_t i;
+
+  ASSERT (cnt <= VM_DROP_BATCH);
+  lock_acquire (&evict_lock);
+  for (i = 0; i < cnt; i++)
     {
-      lock_release (&evict_lock);
-      return; 
+      struct vm_page *page = pages[i];
+      struct vm_frame *vf;
+
+      /* Holding evict_lock, the page cannot be halfway through an
+         eviction.  Frames emptied so far are freed before the
+         lock is let go, so that no eviction finds them. */
+      if (page->busy)
+        {
+          free_frames (empty, empty_cnt);
+          empty_cnt = 0;
+          lock_release (&evict_lock);
+          lock_page_state (page);
+        }
+
+      vf = page->loaded ? find_frame (page->kpage) : NULL;
+      if (vf == NULL)
+        continue;
+      lock_acquire (&vf->list_lock);
+      list_remove (&page->frame_elem);
+      lock_release (&vf->list_lock);
+      if (page->locked)
+        unlock_frame (vf);
+
+      /* A segment keeps its frame, which must be saved if the
+         page wrote to it: holding evict_lock, no eviction is
+         looking at the segment page. */
+      if (vf->shm != NULL && pagedir_is_dirty (page->pagedir, page->addr))
+        vf->shm->dirty = true;
+      page->loaded = false;
+      page->kpage = NULL;
+      page->cow = false;
+      vm_count_resident (page, -1);
+      vm_page_set_clean (page);
+
+      if (list_empty (&vf->pages) && vf->shm == NULL)
+        empty[empty_cnt++] = vf;
     }
+  free_frames (empty, empty_cnt);
+  lock_release (&evict_lock);
+}
+
+/* Pins the frame of PAGE and returns true if PAGE is loaded,
+   otherwise returns false.  Unlike vm_pin_page(), this is safe
+   while PAGE may be chosen for eviction by another thread: once
+   it returns true, PAGE stays loaded until it is unpinned.  If an
+   eviction is saving PAGE, waits for it to finish first. */
+bool
+vm_frame_pin_loaded (struct vm_page *page)
+{
+  bool loaded;
+
+  lock_page_state (page);
+  loaded = page->loaded;
+  if (loaded)
+    vm_frame_pin (page->kpage);
+  lock_release (&evict_lock);
+  return loaded;
+}
 
-  if (pagedir == NULL)
+/* Handles the first write to copy-on-write PAGE.  If its frame
+   is still shared with another process, or is in the shared frame
+   index where other pages may find it, as the zero frame is, PAGE
+   gets a private copy of the frame, otherwise it simply becomes
+   writable again.  The caller retries the access afterward, which
+   faults again if PAGE was evicted in the meantime.  Returns
+   false if no frame could be found for the copy. */
+bool
+vm_frame_unshare (struct vm_page *page)
+{
+  struct vm_frame *vf, *copy_vf;
+  void *copy;
+  bool shared;
+
+  /* The common case is a process writing a page whose other
+     sharers have already copied it or exited. */
+  lock_acquire (&evict_lock);
+  vf = page->loaded && page->cow ? find_frame (page->kpage) : NULL;
+  shared = vf != NULL && (list_size (&vf->pages) > 1 || vf->shared);
+  if (vf != NULL && !shared)
+    {
+      pagedir_set_writable (page->pagedir, page->addr, true);
+      page->cow = false;
+    }
+  lock_release (&evict_lock);
+  if (!shared)
+    return true;
+
+  /* Allocating may have to evict, which takes evict_lock, so the
+     frame is obtained first and the state checked again. */
+  copy = vm_get_frame (PAL_USER);
+  if (copy == NULL)
+    return false;
+  copy_vf = find_frame (copy);
+
+  lock_acquire (&evict_lock);
+  vf = page->loaded && page->cow ? find_frame (page->kpage) : NULL;
+  if (vf != NULL)
     {
-      /* Unloads and removes from the list all the pages that share 
-         this frame. This will be called when we evict a frame. */
       lock_acquire (&vf->list_lock);
-      while (!list_empty (&vf->pages) )
+      shared = list_size (&vf->pages) > 1 || vf->shared;
+      if (shared)
+        list_remove (&page->frame_elem);
+      lock_release (&vf->list_lock);
+
+      if (shared)
         {
-          e = list_begin (&vf->pages);
-          struct vm_page *page = list_entry (e, struct vm_page, frame_elem);
-          list_remove (&page->frame_elem);
-          vm_unload_page (page, vf->addr);
+          memcpy (copy, vf->addr, PGSIZE);
+          list_push_back (&copy_vf->pages, &page->frame_elem);
+          page->kpage = copy;
+          if (page->locked)
+            {
+              unlock_frame (vf);
+              lock_frame (copy_vf);
+            }
+
+          /* The page table entry exists, so this cannot fail.  The
+             copy differs from whatever backs the page. */
+          pagedir_clear_page (page->pagedir, page->addr);
+          pagedir_set_page (page->pagedir, page->addr, copy, true);
+          pagedir_set_dirty (page->pagedir, page->addr, true);
+          pagedir_set_accessed (page->pagedir, page->addr, true);
+
+          /* An indexed frame may be left without pages. */
+          if (list_empty (&vf->pages) && vf->pin_cnt == 0)
+            {
+              void *addr = vf->addr;
+              delete_frame (vf);
+              palloc_free_page (addr);
+            }
         }
-      lock_release (&vf->list_lock);
+      else
+        pagedir_set_writable (page->pagedir, page->addr, true);
+      page->cow = false;
     }
   else
+    shared = false;
+
+  if (shared)
+    unpin_frame (copy_vf);
+  else
+    free_frame (copy, NULL);
+  lock_release (&evict_lock);
+  return true;
+}
+
+/* Handles the first write to PAGE, a page of a memory mapping
+   that is mapped read-only because it has not been written since
+   it was loaded or written back: maps it writable and counts it
+   as dirty.  The caller retries the access afterward, which
+   faults again if PAGE was evicted in the meantime. */
+void
+vm_frame_mkwrite (struct vm_page *page)
+{
+  lock_acquire (&evict_lock);
+  if (page->loaded && !page->file_data.dirty)
+    {
+      pagedir_set_writable (page->pagedir, page->addr, true);
+      vm_page_set_dirty (page);
+    }
+  lock_release (&evict_lock);
+}
+
+/* Writes back the pages of memory mappings that have been written
+   since they were loaded or last written back, only those of
+   process OWNER unless it is null.  Rather than one at a time as
+   unmapping or eviction reaches them, the pages go in batches of
+   up to FLUSH_BATCH, in the order of their files' inode numbers
+   and then of their offsets, which mostly follows the order of
+   their blocks on disk.  Each batch is written with evict_lock
+   held, so that its pages can be neither evicted nor freed
+   meanwhile, but mappings that keep being written cannot hold
+   the lock for more than about one sweep of memory. */
+void
+vm_frame_flush_mapped (struct thread *owner)
+{
+  struct vm_page *batch[FLUSH_BATCH];
+  size_t batch_cnt, max_batches;
+
+  lock_acquire (&frame_lock);
+  max_batches = (clock_cnt + locked_cnt) / FLUSH_BATCH + 1;
+  lock_release (&frame_lock);
+
+  do
+    {
+      size_t i;
+
+      lock_acquire (&evict_lock);
+      batch_cnt = collect_dirty (owner, batch);
+      qsort (batch, batch_cnt, sizeof *batch, compare_file_order);
+      for (i = 0; i < batch_cnt; i++)
+        write_back (batch[i]);
+      lock_release (&evict_lock);
+    }
+  while (batch_cnt == FLUSH_BATCH && --max_batches > 0);
+}
+
+/* Stores in BATCH up to FLUSH_BATCH loaded pages of memory
+   mappings counted as dirty, of process OWNER only unless it is
+   null, and returns their number.  Pinned frames are skipped: a
+   system call is using them, or they are being loaded, evicted
+   or unmapped.  Pages of memory mappings are never shared, so
+   such a frame holds no other page.  Must be called with
+   evict_lock held. */
+static size_t
+collect_dirty (struct thread *owner, struct vm_page **batch)
+{
+  size_t cnt = 0;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&evict_lock));
+  lock_acquire (&frame_lock);
+  for (i = 0; i < init_ram_pages && cnt < FLUSH_BATCH; i++)
+    {
+      struct vm_frame *vf = &frames[i];
+      struct vm_page *page;
+
+      if (vf->addr == NULL || vf->pin_cnt > 0 || list_empty (&vf->pages))
+        continue;
+      page = list_entry (list_front (&vf->pages),
+                         struct vm_page, frame_elem);
+      if (page->type == FILE && page->file_data.mapped
+          && page->file_data.dirty
+          && (owner == NULL || page->thread == owner))
+        batch[cnt++] = page;
+    }
+  lock_release (&frame_lock);
+  return cnt;
+}
+
+/* Compares the pages of memory mappings that A_ and B_ point to
+   by inode number, then by offset in the file, for qsort(). */
+static int
+compare_file_order (const void *a_, const void *b_)
+{
+  const struct vm_page *a = *(struct vm_page * const *) a_;
+  const struct vm_page *b = *(struct vm_page * const *) b_;
+  struct inode *a_inode = file_get_inode (a->file_data.file);
+  struct inode *b_inode = file_get_inode (b->file_data.file);
+  block_sector_t a_ino = inode_get_inumber (a_inode);
+  block_sector_t b_ino = inode_get_inumber (b_inode);
+
+  if (a_ino != b_ino)
+    return a_ino < b_ino ? -1 : 1;
+  if (a->file_data.ofs != b->file_data.ofs)
+    return a->file_data.ofs < b->file_data.ofs ? -1 : 1;
+  return 0;
+}
+
+/* Writes PAGE of a memory mapping back to its file if it has
+   been modified.  PAGE is first mapped read-only, its dirty bit
+   cleared and it is marked clean, so that a write to it during
+   or after its write-back faults and counts it as dirty again.
+   Must be called with evict_lock held. */
+static void
+write_back (struct vm_page *page)
+{
+  bool dirty = pagedir_is_dirty (page->pagedir, page->addr);
+
+  ASSERT (lock_held_by_current_thread (&evict_lock));
+  pagedir_set_writable (page->pagedir, page->addr, false);
+  pagedir_set_dirty (page->pagedir, page->addr, false);
+  vm_page_set_clean (page);
+  if (dirty)
+    file_write_at (page->file_data.file, page->kpage,
+                   page->file_data.read_bytes, page->file_data.ofs);
+}
+
+/* Locks the frame of PAGE in memory for mlock(): until
+   vm_frame_unlock_page(), or until PAGE is freed, the clock does
+   not see the frame.  Returns false if PAGE is not loaded, or if
+   its frame would take the frames locked over locked_max.  The
+   caller marks PAGE as locked. */
+bool
+vm_frame_lock_page (struct vm_page *page)
+{
+  struct vm_frame *vf;
+  bool room = false;
+
+  /* Frames are only locked with evict_lock held, so LOCKED_CNT
+     cannot grow between the check and lock_frame(). */
+  lock_acquire (&evict_lock);
+  vf = page->loaded ? find_frame (page->kpage) : NULL;
+  if (vf != NULL)
+    {
+      lock_acquire (&frame_lock);
+      room = vf->lock_cnt > 0 || locked_cnt < locked_max;
+      lock_release (&frame_lock);
+      if (room)
+        lock_frame (vf);
+    }
+  lock_release (&evict_lock);
+  return room;
+}
+
+/* Undoes vm_frame_lock_page() on locked PAGE. */
+void
+vm_frame_unlock_page (struct vm_page *page)
+{
+  struct vm_frame *vf;
+
+  lock_acquire (&evict_lock);
+  vf = find_frame (page->kpage);
+  ASSERT (page->loaded && vf != NULL);
+  unlock_frame (vf);
+  lock_release (&evict_lock);
+}
+
+/* Counts one more locked page of frame VF, taking VF out of the
+   clock on the first.  Must be called with evict_lock held. */
+static void
+lock_frame (struct vm_frame *vf)
+{
+  ASSERT (lock_held_by_current_thread (&evict_lock));
+  lock_acquire (&frame_lock);
+  if (vf->lock_cnt++ == 0)
+    {
+      clock_cnt--;
+      locked_cnt++;
+    }
+  lock_release (&frame_lock);
+}
+
+/* Counts one less locked page of frame VF, giving VF back to the
+   clock with the last.  Must be called with evict_lock held. */
+static void
+unlock_frame (struct vm_frame *vf)
+{
+  ASSERT (lock_held_by_current_thread (&evict_lock));
+  ASSERT (vf->lock_cnt > 0);
+  lock_acquire (&frame_lock);
+  if (--vf->lock_cnt == 0)
+    {
+      locked_cnt--;
+      clock_cnt++;
+    }
+  lock_release (&frame_lock);
+}
+
+/* Does the work of vm_free_frame().  With a null PAGEDIR, only
+   frees the frame at ADDR if it holds no page.  Must be called
+   with evict_lock held. */
+static void
+free_frame (void *addr, uint32_t *pagedir)
+{
+  struct vm_frame *vf = find_frame (addr);
+
+  ASSERT (lock_held_by_current_thread (&evict_lock));
+  if (vf == NULL) 
+    return; 
+
+  if (pagedir != NULL)
     {
-      /* Frees only one page and the frame remains if it contains other
-         pages. Will be used this way on process_exit or file unmap. */
       struct vm_page *page = vm_frame_get_page (addr, pagedir);
       
       if (page != NULL)
@@ -162,18 +721,93 @@ vm_free_frame (void *addr, uint32_t *pagedir)
           lock_acquire (&vf->list_lock);
           list_remove (&page->frame_elem);
           lock_release (&vf->list_lock);
-          vm_unload_page (page, vf->addr);
+          page->kpage = NULL;
         }
     }
 
-  /* If the frames doen't contain any more pages we can free
-     the frame struct. */
-  if (list_empty (&vf->pages))
-  {
-    delete_frame (vf);
+  if (list_empty (&vf->pages) && vf->shm == NULL)
+    {
+      delete_frame (vf);
+      palloc_free_page (addr);
+    }
+}
+
+/* Acquires evict_lock for checking or changing whether PAGE is
+   loaded, once no eviction is saving it.  Only an eviction, with
+   evict_lock held, makes a page busy, so PAGE stays clear of
+   evictions until the lock is released. */
+static void
+lock_page_state (struct vm_page *page)
+{
+  for (;;)
+    {
+      lock_acquire (&evict_lock);
+      if (!page->busy)
+        return;
+      lock_release (&evict_lock);
+      vm_page_wait (page);
+    }
+}
+
+/* Returns the frame holding shared memory page SP, pinned, or a
+   null pointer if it is in no frame or is being evicted from
+   one. */
+void *
+vm_frame_lookup_shm (struct vm_shm_page *sp)
+{
+  void *addr;
+
+  lock_acquire (&frame_lock);
+  addr = sp->kpage;
+  if (addr != NULL)
+    pin_frame (find_frame (addr));
+  lock_release (&frame_lock);
+  return addr;
+}
+
+/* Records that the frame at ADDR, pinned, holds shared memory
+   page SP, so that vm_frame_lookup_shm() finds it. */
+void
+vm_frame_set_shm (void *addr, struct vm_shm_page *sp)
+{
+  struct vm_frame *vf = find_frame (addr);
+
+  ASSERT (vf != NULL && vf->pin_cnt > 0);
+  lock_acquire (&frame_lock);
+  vf->shm = sp;
+  sp->kpage = addr;
+  lock_release (&frame_lock);
+}
+
+/* Frees the frame holding shared memory page SP, which no page
+   maps any longer, if it is in one.  Returns false, doing
+   nothing, if an eviction is saving SP: the caller must wait for
+   it to end. */
+bool
+vm_frame_free_shm (struct vm_shm_page *sp)
+{
+  void *addr;
+
+  lock_acquire (&frame_lock);
+  if (sp->busy)
+    {
+      lock_release (&frame_lock);
+      return false;
+    }
+  addr = sp->kpage;
+  if (addr != NULL)
+    {
+      struct vm_frame *vf = find_frame (addr);
+
+      ASSERT (list_empty (&vf->pages));
+      unlink_frame (vf);
+      sp->kpage = NULL;
+    }
+  lock_release (&frame_lock);
+
+  if (addr != NULL)
     palloc_free_page (addr);
-  }
-  lock_release (&evict_lock);
+  return true;
 }
 
 /* Creates a mapping for the page to the vm_frame. */
@@ -221,26 +855,63 @@ vm_frame_get_page (void *frame, uint32_t *pagedir)
 }
 
 /* Removes the given page from its frame. Sets the clock eviction
-   pointer to the next frame. Reclaims memory of the frame struct. */
+   pointer to the next frame. Marks the frame descriptor unused. */
 static void
 delete_frame (struct vm_frame *vf)
 {
   lock_acquire (&frame_lock);
-	eviction_remove_pointer (vf);
-  hash_delete (&vm_frames, &vf->hash_elem);
-	list_remove (&vf->list_elem);
-	free (vf);
+  unlink_frame (vf);
+  lock_release (&frame_lock);
+}
+
+/* Does the work of delete_frame().  Must be called with
+   frame_lock held. */
+static void
+unlink_frame (struct vm_frame *vf)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+  if (vf->shared)
+    hash_delete (&shared_frames, &vf->share_elem);
+  if (in_clock (vf))
+    clock_cnt--;
+  else
+    locked_cnt--;
+  vf->addr = NULL;
+}
+
+/* Deletes the CNT frames in VFS, which hold no pages, under a
+   single acquisition of frame_lock, and frees their pages.  Must
+   be called with evict_lock held. */
+static void
+free_frames (struct vm_frame **vfs, size_t cnt)
+{
+  void *addrs[VM_DROP_BATCH];
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&evict_lock));
+  if (cnt == 0)
+    return;
+  lock_acquire (&frame_lock);
+  for (i = 0; i < cnt; i++)
+    {
+      addrs[i] = vfs[i]->addr;
+      unlink_frame (vfs[i]);
+    }
   lock_release (&frame_lock);
+  for (i = 0; i < cnt; i++)
+    palloc_free_page (addrs[i]);
 }
 
-/* Iterates over all the pages which are sharing the given frame.
-   Looks at the accesed bit of each page. If all of them are 0 
-   then we have found a victim frame, otherwise flip the first 1
-   bit and continue. Synchronization must be done by the caller.*/
+/* Iterates over all the pages which are sharing the given frame
+   and returns true if any of them has been accessed.  If CLEAR,
+   the accessed bits of all the pages are reset, so that a shared
+   frame is judged on the references of every page mapping it.
+   Synchronization must be done by the caller. */
 static bool
-eviction_scan_and_flip (struct vm_frame *vf)
+frame_referenced (struct vm_frame *vf, bool clear)
 {
   struct list_elem *e;
+  bool referenced = false;
   
   for (e = list_begin (&vf->pages); e != list_end (&vf->pages);
        e = list_next (e))
@@ -248,12 +919,32 @@ eviction_scan_and_flip (struct vm_frame *vf)
       struct vm_page *page = list_entry (e, struct vm_page, frame_elem);
       if (pagedir_is_accessed (page->pagedir, page->addr) )
         {
+          referenced = true;
+          if (!clear)
+            break;
           pagedir_set_accessed (page->pagedir, page->addr, false);
-          return false;
         }
     }
 
-  return true;
+  return referenced;
+}
+
+/* Returns true if a process with a page in frame VF has more
+   pages resident than it is allotted.  Synchronization must be
+   done by the caller. */
+static bool
+frame_over_allotment (struct vm_frame *vf)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&vf->pages); e != list_end (&vf->pages);
+       e = list_next (e))
+    {
+      struct vm_page *page = list_entry (e, struct vm_page, frame_elem);
+      if (vm_over_allotment (page->thread))
+        return true;
+    }
+  return false;
 }
 
 /* The Clock page replacement algorithm. We keep a circular list
@@ -261,51 +952,488 @@ eviction_scan_and_flip (struct vm_frame *vf)
    we look at the accessed bit. If it's 1 we set it to 0 and move on.
    This approach has better performance than the second chance 
    algorithm. For further reference and a more complete explication 
-   see MODERN OPERATING SYSTEMS, [Andrew S. Tanenbaum] page 111. */
-static void
-eviction ()
+   see MODERN OPERATING SYSTEMS, [Andrew S. Tanenbaum] page 111.
+
+   With the two-handed variant, a front hand running ahead of the
+   one above clears the accessed bits and the back hand takes the
+   frames that have not been referenced again since.  The distance
+   between the hands, rather than the size of memory, then sets
+   how long a page has to prove itself, so the hand does not have
+   to sweep all of memory under pressure.
+
+   Frames of processes holding more pages than allotted to their
+   working sets, as vm/page.c sets the allotments, are taken first,
+   so that a process running through memory does not evict the
+   working sets of the others.
+
+   Instead of a single frame, up to vm.swap_cluster victims are
+   taken from one sweep of the hand, so that the ones bound for
+   swap can be written out together with a single disk
+   transfer.
+
+   The victims are chosen and their pages unmapped with evict_lock
+   held, but the lock is released before their pages are written
+   out, so that other faults and evictions go on meanwhile.
+
+   The hand goes round at most as many times as it takes to find
+   a victim if there is one.  If none is found, because every
+   frame is pinned, gives up rather than wait with the locks held
+   for a frame to be unpinned, which may take either lock.
+
+   Returns the number of victims.  If RECLAIMED is nonnull, one of
+   the freed pages is stored in *RECLAIMED instead of being
+   returned to the page allocator, or a null pointer if none is
+   left. */
+static size_t
+eviction (void **reclaimed)
 {
-  struct vm_frame *victim = NULL;
+  struct vm_frame *victims[SWAP_CLUSTER];
+  size_t cluster = swap_cluster;
+  size_t victim_cnt = 0;
+  size_t steps = 0, turn, max_steps;
+  bool two_handed = vm_evict_policy == EVICT_TWO_HANDED;
+  void *kept;
 
   lock_acquire (&evict_lock);
-	lock_acquire (&frame_lock);
+  lock_acquire (&frame_lock);
+
+  if (two_handed && front_hand == NO_HAND)
+    eviction_place_front ();
+
+  /* The first turn of the hand only takes frames of processes
+     over their allotments.  Two more clear every accessed bit, so
+     once we have one victim there is no point sweeping any
+     further.  With no frame in the clock there is no turn to make,
+     and no victim. */
+  turn = clock_cnt;
+  max_steps = 3 * turn;
+  pagedir_batch_begin ();
+  while (victim_cnt < cluster && steps < max_steps)
+    {
+      struct vm_frame *vf;
+
+      steps++;
+      if (two_handed)
+        {
+          struct vm_frame *front = eviction_get_next (&front_hand);
+          eviction_move_next (&front_hand);
+          if (front->pin_cnt == 0)
+            frame_referenced (front, true);
+        }
+
+      vf = eviction_get_next (&clock_hand);
+      eviction_move_next (&clock_hand);
+
+      /* If the frame is pinned or accessed move on.  Pinned
+         frames are skipped before looking at their pages, and in
+         the first turn so are the frames of processes within
+         their allotments, without clearing their accessed bits. */
+      if (vf->pin_cnt > 0
+          || (steps <= turn && !frame_over_allotment (vf))
+          || frame_referenced (vf, !two_handed))
+        continue;  
+
+      /* Pin the victim so that it is not chosen twice, and take
+         it out of the shared frame index so that no page starts
+         sharing it. */
+      pin_frame (vf);
+      if (vf->shared)
+        {
+          hash_delete (&shared_frames, &vf->share_elem);
+          vf->shared = false;
+        }
+      if (vf->shm != NULL)
+        {
+          vf->shm->kpage = NULL;
+          vf->shm->busy = true;
+        }
+      victims[victim_cnt++] = vf;
+    }
+  lock_release (&frame_lock);
+
+  process_current ()->vm_stats.evictions += victim_cnt;
+  start_eviction (victims, victim_cnt);
+  pagedir_batch_end ();
+  lock_release (&evict_lock);
+  kept = finish_eviction (victims, victim_cnt, reclaimed != NULL);
+  if (reclaimed != NULL)
+    *reclaimed = kept;
+  return victim_cnt;
+}
+
+/* Begins the eviction of the CNT frames in VICTIMS, chosen by
+   eviction(), by unmapping all their pages.  The clean pages are
+   dropped from the frames; the dirty ones stay in them, busy,
+   until finish_eviction() has saved them.  Must be called with
+   evict_lock held. */
+static void
+start_eviction (struct vm_frame **victims, size_t cnt)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&evict_lock));
+  for (i = 0; i < cnt; i++)
+    {
+      struct vm_frame *vf = victims[i];
+      struct list_elem *e, *next;
+
+      lock_acquire (&vf->list_lock);
+      for (e = list_begin (&vf->pages); e != list_end (&vf->pages); e = next)
+        {
+          struct vm_page *page = list_entry (e, struct vm_page, frame_elem);
+
+          next = list_next (e);
+          if (!vm_evict_page (page))
+            list_remove (e);
+        }
+      lock_release (&vf->list_lock);
+    }
+}
+
+/* Saves the busy pages that start_eviction() left in the CNT
+   frames in VICTIMS, then frees the frames.  The pages bound for
+   swap that have a frame of their own, the common case, are
+   stored as one batch; the others, pages of memory mappings and
+   pages still sharing a frame after a fork, are saved one at a
+   time.  No lock is held meanwhile: the frames are pinned, so
+   nothing else touches them, and a fault on one of the pages
+   waits for that page alone.  If RECLAIM is true, returns the
+   physical page of one of the victims instead of freeing it,
+   otherwise a null pointer. */
+static void *
+finish_eviction (struct vm_frame **victims, size_t cnt, bool reclaim)
+{
+  void *kept = NULL;
+  void *kpages[SWAP_CLUSTER];
+  struct vm_page *pages[SWAP_CLUSTER];
+  size_t indices[SWAP_CLUSTER];
+  size_t swap_cnt = 0;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct vm_frame *vf = victims[i];
+      struct vm_page *page;
+
+      lock_acquire (&vf->list_lock);
+      page = NULL;
+      if (list_size (&vf->pages) == 1)
+        page = list_entry (list_front (&vf->pages),
+                           struct vm_page, frame_elem);
+      if (page != NULL && vf->shm == NULL
+          && !(page->type == FILE && page->file_data.mapped))
+        {
+          list_remove (&page->frame_elem);
+          kpages[swap_cnt] = vf->addr;
+          pages[swap_cnt++] = page;
+          TRACE (TRACE_EVICT, vf->addr, 1);
+        }
+      else
+        TRACE (TRACE_EVICT, vf->addr, 0);
+      lock_release (&vf->list_lock);
+    }
+
+  vm_swap_store_batch (kpages, swap_cnt, indices);
+  for (i = 0; i < swap_cnt; i++)
+    vm_unload_swapped_page (pages[i], indices[i]);
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct vm_frame *vf = victims[i];
+      void *addr = vf->addr;
+
+      if (vf->shm != NULL)
+        vm_shm_evicted (vf->shm, addr, !list_empty (&vf->pages));
+      while (!list_empty (&vf->pages))
+        {
+          struct vm_page *page;
+
+          lock_acquire (&vf->list_lock);
+          page = list_entry (list_pop_front (&vf->pages),
+                             struct vm_page, frame_elem);
+          lock_release (&vf->list_lock);
+          vm_save_page (page, addr);
+        }
+      delete_frame (vf);
+      if (reclaim && kept == NULL)
+        kept = addr;
+      else
+        palloc_free_page (addr);
+    }
+  return kept;
+}
+
+/* Page cleaner.  Queued when free user memory drops below the
+   low-water mark, it evicts frames until the high-water mark is
+   reached, so that page faults usually find a free frame and do
+   not have to wait for a victim to be written to swap. */
+static void
+page_cleaner (void *aux UNUSED)
+{
+  block_set_class (BLOCK_CLASS_BACKGROUND);
+  while (palloc_free_cnt (PAL_USER) < (size_t) frame_high_water
+         && clock_cnt > 0 && eviction (NULL) > 0)
+    continue;
+}
 
-  while (victim == NULL)
+/* Page merger.  Makes a pass over some of the frames every
+   vm.merge_interval ticks, queueing itself again for the next. */
+static void
+page_merger (void *aux UNUSED)
+{
+  block_set_class (BLOCK_CLASS_BACKGROUND);
+  if (merge_interval > 0)
+    merge_pass ();
+  workqueue_queue_delayed (&vm_wq, &merger_work,
+                           merge_interval > 0
+                           ? merge_interval : MERGE_INTERVAL);
+}
+
+/* Tries to merge each of the next vm.merge_scan frames in use
+   with a frame seen before that holds the same data.  Looks at
+   each frame descriptor at most once. */
+static void
+merge_pass (void)
+{
+  size_t scanned = 0;
+  size_t i;
+
+  for (i = 0; i < init_ram_pages && scanned < (size_t) merge_scan; i++)
     {
-			struct vm_frame *vf = eviction_get_next ();
-      ASSERT (vf != NULL);
+      struct vm_frame *vf;
 
-      /* If the frame is pinned or accessed move on. */
-      if (vf->pinned == true || eviction_scan_and_flip(vf) == false)
+      if (merge_next >= init_ram_pages || !merge_table_ok)
         {
-          eviction_move_next ();
-      	  continue;  
-        }    
+          if (merge_table_ok)
+            ohash_destroy (&merge_table, NULL);
+          merge_table_ok = ohash_init (&merge_table, ohash_word, NULL);
+          merge_next = 0;
+          if (!merge_table_ok)
+            return;
+        }
+
+      /* Most descriptors are unused, so look before locking. */
+      vf = &frames[merge_next++];
+      if (vf->addr != NULL)
+        {
+          merge_frame (vf);
+          scanned++;
+        }
+    }
+}
+
+/* Merges frame VF with the frame remembered under the hash of its
+   contents, if that one still holds the same data, or else
+   remembers VF under it. */
+static void
+merge_frame (struct vm_frame *vf)
+{
+  struct vm_frame *twin;
+  unsigned hash;
 
-      victim = vf;
+  lock_acquire (&evict_lock);
+  if (!frame_mergeable (vf))
+    {
+      lock_release (&evict_lock);
+      return;
     }
 
-	lock_release (&frame_lock);
+  /* The contents may change until the frames are write
+     protected, so the hash only points to a candidate. */
+  hash = hash_bytes (vf->addr, PGSIZE);
+  twin = ohash_find (&merge_table, hash);
+  if (twin != vf)
+    {
+      if (twin != NULL && frame_mergeable (twin) && merge_into (twin, vf))
+        merge_cnt++;
+      else
+        {
+          if (twin != NULL)
+            ohash_delete (&merge_table, hash);
+          ohash_insert (&merge_table, hash, vf);
+        }
+    }
   lock_release (&evict_lock);
-  vm_free_frame (victim->addr, NULL);
 }
 
-/* Pinns the frame at the given address. A pinned frame can;t be evicted. */
+/* Returns true if frame VF holds only loaded anonymous pages,
+   swap and zero pages, none of them locked or being evicted, and
+   nothing pins it or finds it through the shared frame index or
+   a shared memory segment.  Must be called with evict_lock
+   held. */
+static bool
+frame_mergeable (struct vm_frame *vf)
+{
+  struct list_elem *e;
+  bool mergeable;
+
+  ASSERT (lock_held_by_current_thread (&evict_lock));
+  if (vf->addr == NULL || vf->pin_cnt > 0 || vf->lock_cnt > 0 || vf->shared
+      || vf->shm != NULL)
+    return false;
+
+  lock_acquire (&vf->list_lock);
+  mergeable = !list_empty (&vf->pages);
+  for (e = list_begin (&vf->pages); mergeable && e != list_end (&vf->pages);
+       e = list_next (e))
+    {
+      struct vm_page *page = list_entry (e, struct vm_page, frame_elem);
+
+      mergeable = ((page->type == SWAP || page->type == ZERO)
+                   && page->loaded && !page->locked && !page->busy);
+    }
+  lock_release (&vf->list_lock);
+  return mergeable;
+}
+
+/* Merges frame VICTIM into frame KEEP if the two hold the same
+   data: the pages of VICTIM are mapped to KEEP, all the pages are
+   left copy-on-write, so that the first write to one gives it a
+   private copy again, and VICTIM is freed.  Each page keeps its
+   dirty bit, which compares the data with the page's own copy in
+   swap or its zeros.  Returns false, leaving both frames as they
+   were, if the data differ.  Must be called with evict_lock
+   held. */
+static bool
+merge_into (struct vm_frame *keep, struct vm_frame *victim)
+{
+  void *addr = victim->addr;
+
+  ASSERT (lock_held_by_current_thread (&evict_lock));
+  ASSERT (keep != victim);
+
+  /* Once neither frame is writable, only kernel threads holding
+     evict_lock could change them. */
+  protect_frame (keep);
+  protect_frame (victim);
+  if (memcmp (keep->addr, victim->addr, PGSIZE) != 0)
+    {
+      unprotect_frame (keep);
+      unprotect_frame (victim);
+      return false;
+    }
+
+  while (!list_empty (&victim->pages))
+    {
+      struct vm_page *page;
+      bool dirty, accessed;
+
+      lock_acquire (&victim->list_lock);
+      page = list_entry (list_pop_front (&victim->pages),
+                         struct vm_page, frame_elem);
+      lock_release (&victim->list_lock);
+
+      /* The page table entry exists, so this cannot fail. */
+      dirty = pagedir_is_dirty (page->pagedir, page->addr);
+      accessed = pagedir_is_accessed (page->pagedir, page->addr);
+      pagedir_clear_page (page->pagedir, page->addr);
+      pagedir_set_page (page->pagedir, page->addr, keep->addr, false);
+      pagedir_set_dirty (page->pagedir, page->addr, dirty);
+      pagedir_set_accessed (page->pagedir, page->addr, accessed);
+      page->kpage = keep->addr;
+
+      lock_acquire (&keep->list_lock);
+      list_push_back (&keep->pages, &page->frame_elem);
+      lock_release (&keep->list_lock);
+    }
+  delete_frame (victim);
+  palloc_free_page (addr);
+  return true;
+}
+
+/* Maps the pages of frame VF read-only, making the writable ones
+   copy-on-write.  Must be called with evict_lock held. */
+static void
+protect_frame (struct vm_frame *vf)
+{
+  struct list_elem *e;
+
+  lock_acquire (&vf->list_lock);
+  for (e = list_begin (&vf->pages); e != list_end (&vf->pages);
+       e = list_next (e))
+    {
+      struct vm_page *page = list_entry (e, struct vm_page, frame_elem);
+
+      pagedir_set_writable (page->pagedir, page->addr, false);
+      if (page->writable)
+        page->cow = true;
+    }
+  lock_release (&vf->list_lock);
+}
+
+/* Undoes protect_frame() on frame VF, which has not been
+   merged with another.  A frame shared by several pages after a
+   fork was copy-on-write already and stays so; a frame of a
+   single page is made writable again, as vm_frame_unshare()
+   would do on the first write.  Must be called with evict_lock
+   held. */
+static void
+unprotect_frame (struct vm_frame *vf)
+{
+  lock_acquire (&vf->list_lock);
+  if (list_size (&vf->pages) == 1)
+    {
+      struct vm_page *page = list_entry (list_front (&vf->pages),
+                                         struct vm_page, frame_elem);
+
+      if (page->writable)
+        {
+          pagedir_set_writable (page->pagedir, page->addr, true);
+          page->cow = false;
+        }
+    }
+  lock_release (&vf->list_lock);
+}
+
+/* Pins the frame at ADDR, which cannot be evicted until each of
+   its pins is dropped. */
 void
 vm_frame_pin (void *addr)
 {
   struct vm_frame *vf = find_frame (addr);
   if (vf != NULL)
-    vf->pinned = true;
+    pin_frame (vf);
 }
 
-/* Unpinns the frame at the given address. */
+/* Drops a pin of the frame at ADDR. */
 void
 vm_frame_unpin (void *addr)
 {
   struct vm_frame *vf = find_frame (addr);
   if (vf != NULL)
-    vf->pinned = false;
+    unpin_frame (vf);
+}
+
+/* Returns the number of pins of the frame at ADDR. */
+unsigned
+vm_frame_pin_cnt (void *addr)
+{
+  struct vm_frame *vf = find_frame (addr);
+
+  return vf != NULL ? vf->pin_cnt : 0;
+}
+
+/* Adds a pin to VF.  A frame may be pinned by several threads at
+   once, through pages of different processes that share it or
+   through overlapping buffers, each taking its own lock or none,
+   so the count is changed with interrupts off. */
+static void
+pin_frame (struct vm_frame *vf)
+{
+  enum intr_level old_level = intr_disable ();
+  vf->pin_cnt++;
+  intr_set_level (old_level);
+}
+
+/* Drops a pin of VF, which can be evicted again once none is
+   left. */
+static void
+unpin_frame (struct vm_frame *vf)
+{
+  enum intr_level old_level = intr_disable ();
+  ASSERT (vf->pin_cnt > 0);
+  vf->pin_cnt--;
+  intr_set_level (old_level);
 }
 
 /* Returns the frame containing the given page, or a null pointer in not 
@@ -313,72 +1441,87 @@ vm_frame_unpin (void *addr)
 static struct vm_frame *
 find_frame (void *addr)
 {
-  struct vm_frame vf;
-  struct hash_elem *e;
+  struct vm_frame *vf = frame_descriptor (addr);
 
-  vf.addr = addr;
-  lock_acquire (&frame_lock);
-  e = hash_find (&vm_frames, &vf.hash_elem);
-  lock_release (&frame_lock);
-  return e != NULL ? hash_entry (e, struct vm_frame, hash_elem) : NULL;
+  return vf->addr == addr ? vf : NULL;
 }
 
-/* Returns a hash value for a frame f. */
+/* Returns the descriptor of the frame at kernel virtual address
+   ADDR, whether or not it is in use. */
+static struct vm_frame *
+frame_descriptor (void *addr)
+{
+  size_t idx = vtop (addr) >> PGBITS;
+
+  ASSERT (idx < init_ram_pages);
+  return &frames[idx];
+}
+
+/* Returns a hash value for the data held by shared frame F. */
 static unsigned
-frame_hash (const struct hash_elem *f_, void *aux UNUSED)
+share_hash (const struct hash_elem *f_, void *aux UNUSED)
 {
-  const struct vm_frame *f = hash_entry (f_, struct vm_frame, hash_elem);
-  return hash_int ((unsigned)f->addr);
+  const struct vm_frame *f = hash_entry (f_, struct vm_frame, share_elem);
+  unsigned h = hash_int ((unsigned) f->inode);
+  h ^= hash_int (f->block_id);
+  return h ^ hash_int (f->read_bytes);
 }
 
-/* Returns true if a frame a preceds frame b. */
+/* Returns true if shared frame a preceds shared frame b. */
 static bool
-frame_less (const struct hash_elem *a_, const struct hash_elem *b_,
-               void *aux UNUSED)
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
 {
-  const struct vm_frame *a = hash_entry (a_, struct vm_frame, hash_elem);
-  const struct vm_frame *b = hash_entry (b_, struct vm_frame, hash_elem);
-  
-  return a->addr < b->addr;
+  const struct vm_frame *a = hash_entry (a_, struct vm_frame, share_elem);
+  const struct vm_frame *b = hash_entry (b_, struct vm_frame, share_elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->block_id != b->block_id)
+    return a->block_id < b->block_id;
+  return a->read_bytes < b->read_bytes;
 }
 
-/* Sets the eviction pointer to the next frame from the frame list. 
-   This function will be called when we delete a frame so we don't
-   end up with a dangling pointer. */
+/* Returns true if frame VF is one the clock hands visit: in use
+   and not locked by mlock(). */
+static bool
+in_clock (const struct vm_frame *vf)
+{
+  return vf->addr != NULL && vf->lock_cnt == 0;
+}
+
+/* Places the front hand of the two-handed clock a quarter of the
+   clock's frames ahead of the back hand. */
 static void
-eviction_remove_pointer (struct vm_frame *victim)
+eviction_place_front (void)
 {
-	if (e_next == NULL || e_next == list_end (&vm_frames_list) )
-		return;
-	struct vm_frame *vf = list_entry (e_next, struct vm_frame, list_elem);
+  size_t spread = clock_cnt / 4;
 
-	if (vf == victim)
-		eviction_move_next ();
+  front_hand = clock_hand;
+  while (spread-- > 0)
+    {
+      eviction_get_next (&front_hand);
+      eviction_move_next (&front_hand);
+    }
 }
 
-/* Returns the next frame to be evicted. */
+/* Moves clock hand HAND forward to the next frame the clock
+   visits, if it is not on one, and returns that frame. */
 static struct vm_frame *
-eviction_get_next (void)
+eviction_get_next (size_t *hand)
 {
-	if (e_next == NULL || e_next == list_end (&vm_frames_list) )
-  	e_next = list_begin (&vm_frames_list);
-  if (e_next != NULL)
-    {
-      /* Get the frame struct from the frame list. */
-		  struct vm_frame *vf = list_entry (e_next, struct vm_frame, list_elem);
-      return vf;
-    }  
-
-  NOT_REACHED ();
+  ASSERT (clock_cnt > 0);
+  while (!in_clock (&frames[*hand]))
+    eviction_move_next (hand);
+  return &frames[*hand];
 }
 
-/* Moves the clock pointer to the next frame. If we reached the end
-   we start again from the beginning like in a circular list. */
+/* Moves clock hand HAND to the next frame descriptor.  If we
+   reached the end we start again from the beginning like in a
+   circular list. */
 static void
-eviction_move_next (void)
+eviction_move_next (size_t *hand)
 {
-  if (e_next == NULL || e_next == list_end (&vm_frames_list) )
-    e_next = list_begin (&vm_frames_list);
-  else
-    e_next = list_next (e_next); 
+  if (++*hand >= init_ram_pages)
+    *hand = 0;
 }
@@ -9,25 +9,65 @@
 struct vm_frame 
   {
     void *addr;                 /* Physical address of the frame. */
-    bool pinned;                /* If the frame is pinned. */
-    struct hash_elem hash_elem; /* Hash element for the hash frame table. */
+    unsigned pin_cnt;           /* Pins keeping the frame from eviction. */
+    unsigned lock_cnt;          /* Pages of the frame locked by mlock(). */
     struct list pages;          /* A list of the pages that share this frame. */
+    bool shared;                /* In the shared frame index? */
+    struct inode *inode;        /* Shared file data: inode, */
+    off_t block_id;             /* block index... */
+    size_t read_bytes;          /* ...and bytes read from it. */
+    struct hash_elem share_elem; /* Hash element for the shared frame index. */
+    struct vm_shm_page *shm;    /* Shared memory page held, or null. */
     struct lock list_lock;      /* A lock to synchronize access to page list. */
-	  struct list_elem list_elem; /* List element for frame list. */
   };
 
+/* Most pages vm_frame_drop_pages() drops at once. */
+#define VM_DROP_BATCH 64
+
+/* Page replacement policies. */
+enum vm_evict_policy
+  {
+    EVICT_CLOCK,                /* Single-handed clock. */
+    EVICT_TWO_HANDED            /* Two-handed clock. */
+  };
+
+/* Page replacement policy in use, set by the kernel command-line
+   option -evict. */
+extern enum vm_evict_policy vm_evict_policy;
+
 /* Public functions of the frame table. */
 void vm_frame_init (void);
 /* Try to find a frame with the same read-only data. */
-void *vm_lookup_frame (off_t);
+void *vm_lookup_frame (struct inode *, off_t, size_t);
+void vm_frame_share (void *, struct inode *, off_t, size_t);
 /* Obtain a new free frame from memory. */
 void *vm_get_frame (enum palloc_flags flags);
+void *vm_try_get_frame (enum palloc_flags flags);
 void vm_free_frame (void *, uint32_t *);
+void vm_frame_drop_page (struct vm_page *);
+void vm_frame_drop_pages (struct vm_page **, size_t cnt);
+/* Copy-on-write support for forked processes. */
+bool vm_frame_pin_loaded (struct vm_page *);
+bool vm_frame_unshare (struct vm_page *);
+/* Frames of shared memory segments, for vm/shm.c. */
+void *vm_frame_lookup_shm (struct vm_shm_page *);
+void vm_frame_set_shm (void *, struct vm_shm_page *);
+bool vm_frame_free_shm (struct vm_shm_page *);
 /* Creates a mapping to the frame's loaded page. */
 bool vm_frame_set_page (void *, struct vm_page *);
 struct vm_page *vm_frame_get_page (void *, uint32_t *);
+/* Track and write back the pages of memory mappings. */
+void vm_frame_mkwrite (struct vm_page *);
+void vm_frame_flush_mapped (struct thread *);
+/* Keep the frame of a page out of the clock for mlock(). */
+bool vm_frame_lock_page (struct vm_page *);
+void vm_frame_unlock_page (struct vm_page *);
 /* Kernel pin / unpin the given frame. */
 void vm_frame_pin (void *);
 void vm_frame_unpin (void *);
+unsigned vm_frame_pin_cnt (void *);
+/* Statistics of same-page merging. */
+struct kstat_mem;
+void vm_frame_get_kstat (struct kstat_mem *);
 
 #endif /* vm/frame.h */
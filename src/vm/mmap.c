@@ -1,38 +1,111 @@
 #include "vm/mmap.h"
-#include <hash.h>
-#include <list.h>
+#include <round.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
-#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "vm/frame.h"
+#include "vm/page.h"
 
-static struct lock mfile_lock;
-static struct hash vm_mfiles;
+/* Initial number of slots in a process's mapping table. */
+#define MFILE_TABLE_MIN 4
 
-static unsigned vm_mfile_hash (const struct hash_elem *, void *);
-static bool vm_mfile_less (const struct hash_elem *, const struct hash_elem *,
-                    void *);
+/* The write-back thread writes back the modified pages of all the
+   memory mappings every MMAP_FLUSH_INTERVAL timer ticks, so that
+   long-lived mappings do not pile up modified pages to write all
+   at once when they are unmapped. */
+#define MMAP_FLUSH_INTERVAL TIMER_FREQ
 
-/* Initialise the mmap table. */
+/* A process writing one more page of its memory mappings while
+   more than MMAP_DIRTY_MAX of them are waiting to be written back
+   first writes them back itself, so that it cannot modify pages
+   faster than the disk takes them. */
+#define MMAP_DIRTY_MAX 64
+
+/* Each process keeps its mappings in its own array, t->mfiles,
+   sorted by address.  Mappings do not overlap, so a binary search
+   finds the one covering an address, and the mapid, being the
+   number of the first page, is found the same way.  Only the
+   process itself uses its table, so no lock is needed. */
+
+/* Object cache for mfiles. */
+static struct kmem_cache *mfile_cache;
+
+static size_t mfile_search (const void *addr);
+static bool overlaps (const void *start, const void *end);
+static void unmap_pages (void *start_addr, void *end_addr);
+static void remove_mfile (size_t idx);
+static thread_func mmap_flusher NO_RETURN;
+
+/* Initializes the memory-mapped file module. */
 void
-vm_mfile_init (void)
+vm_mmap_init (void)
+{
+  mfile_cache = kmem_cache_create ("vm_mfile", sizeof (struct vm_mfile),
+                                   NULL);
+  thread_create ("mmap-flush", PRI_DEFAULT, mmap_flusher, NULL);
+}
+
+/* Handles a write fault on PAGE of the current process, mapped
+   and present.  Returns false if PAGE is not part of a memory
+   mapping, otherwise makes it writable, as a page of a mapping is
+   mapped read-only until its first write after it is loaded or
+   written back, and returns true. */
+bool
+vm_mmap_write_fault (struct vm_page *page)
 {
-  lock_init (&mfile_lock);
-  hash_init (&vm_mfiles, vm_mfile_hash, vm_mfile_less, NULL);
+  if (page->type != FILE || !page->file_data.mapped)
+    return false;
+  process_current ()->vm_stats.minor_faults++;
+  vm_frame_mkwrite (page);
+  return true;
 }
 
-/* Returns the mfile with the given mapid, or a null pointer if not found. */
+/* Throttles the current process after it has written a page of
+   one of its memory mappings: past MMAP_DIRTY_MAX pages waiting
+   to be written back, it writes them all back itself. */
+void
+vm_mmap_throttle (void)
+{
+  struct thread *t = process_current ();
+
+  if (t->vm_stats.dirty > MMAP_DIRTY_MAX)
+    vm_frame_flush_mapped (t);
+}
+
+/* Returns the mfile of the current process with the given mapid,
+   or a null pointer if not found. */
 struct vm_mfile *
 vm_find_mfile (mapid_t mapid)
 {
-  struct vm_mfile mf;
-  struct hash_elem *e;
+  struct vm_mfile *mf;
 
-  mf.mapid = mapid;
-  e = hash_find (&vm_mfiles, &mf.hash_elem);
-  return e != NULL ? hash_entry (e, struct vm_mfile, hash_elem) : NULL;
+  if (mapid < 0)
+    return NULL;
+  mf = vm_mfile_lookup ((void *) ((uintptr_t) mapid << PGBITS));
+  return mf != NULL && mf->mapid == mapid ? mf : NULL;
 }
 
-/* Removes the given mapid from the fid. */
+/* Returns the mfile of the current process that covers user
+   address ADDR, or a null pointer if ADDR is not mapped. */
+struct vm_mfile *
+vm_mfile_lookup (const void *addr)
+{
+  struct thread *t = process_current ();
+  size_t idx = mfile_search (addr);
+
+  if (idx < t->mfile_cnt && t->mfiles[idx]->start_addr <= addr)
+    return t->mfiles[idx];
+  return NULL;
+}
+
+/* Removes the mapping with the given mapid from the current
+   process, writing its modified pages back to the file.  Returns
+   false if the process has no such mapping. */
 bool
 vm_delete_mfile (mapid_t mapid)
 {
@@ -40,49 +113,188 @@ vm_delete_mfile (mapid_t mapid)
   if (mf == NULL)
     return false;
 
-  /* Remove the given file from the hash table. */
-  lock_acquire (&mfile_lock);
-  hash_delete (&vm_mfiles, &mf->hash_elem);
-  list_remove (&mf->thread_elem);
-  free (mf);
-  lock_release (&mfile_lock);
-
+  unmap_pages (mf->start_addr, mf->end_addr);
+  remove_mfile (mfile_search (mf->start_addr));
   return true; 
 }
 
-/* Creates a new mfile from a given mapid and a fid. Intserts the new mfile
-in the mfile hash table so it will be found on future lookups. */
+/* Removes all the mappings of the current process, as on exit,
+   and frees its mapping table. */
 void
-vm_insert_mfile (mapid_t mapid, int fid, void *start_addr, void *end_addr)
+vm_delete_all_mfiles (void)
+{
+  struct thread *t = process_current ();
+
+  /* Write everything back in block order before unmapping. */
+  if (t->mfile_cnt > 0)
+    vm_frame_flush_mapped (t);
+  while (t->mfile_cnt > 0)
+    {
+      struct vm_mfile *mf = t->mfiles[t->mfile_cnt - 1];
+      unmap_pages (mf->start_addr, mf->end_addr);
+      remove_mfile (t->mfile_cnt - 1);
+    }
+  free (t->mfiles);
+  t->mfiles = NULL;
+  t->mfile_cap = 0;
+}
+
+/* Maps FILE into the address space of the current process at
+   user page ADDR and returns the new mapid, or MAP_FAILED if FILE
+   is empty, ADDR is not page aligned or the pages would overlap
+   any existing page.  The mapping is a region of the address
+   space: its pages are only created and read from the file when
+   first accessed and only written back when modified, so mapping
+   a file takes the same memory however big it is.  The mapping
+   uses its own reopened file, so it outlives the descriptor. */
+mapid_t
+vm_insert_mfile (struct file *file, void *addr)
 {
-  struct vm_mfile *mf = (struct vm_mfile *) malloc (sizeof (struct vm_mfile));
-  mf->fid = fid;
-  mf->mapid = mapid;
-  mf->start_addr = start_addr;
-  mf->end_addr = end_addr;
-
-  /* Insert the new file in the hash table. */
-  lock_acquire (&mfile_lock);
-  list_push_back (&thread_current ()->mfiles, &mf->thread_elem);
-  hash_insert (&vm_mfiles, &mf->hash_elem);
-  lock_release (&mfile_lock);
+  struct thread *t = process_current ();
+  off_t length = file_length (file);
+  size_t cnt = DIV_ROUND_UP (length, PGSIZE);
+  uint8_t *end = (uint8_t *) addr + cnt * PGSIZE;
+  struct vm_mfile *mf;
+  size_t idx;
+
+  if (addr == NULL || pg_ofs (addr) != 0 || length == 0)
+    return MAP_FAILED;
+  if (end <= (uint8_t *) addr || !is_user_vaddr (end - 1)
+      || overlaps (addr, end) || !vm_range_is_free (addr, cnt))
+    return MAP_FAILED;
+
+  /* Make room in the table first, as it is the easiest step to
+     undo. */
+  if (t->mfile_cnt == t->mfile_cap)
+    {
+      size_t cap = t->mfile_cap > 0 ? 2 * t->mfile_cap : MFILE_TABLE_MIN;
+      struct vm_mfile **mfiles = realloc (t->mfiles, cap * sizeof *mfiles);
+
+      if (mfiles == NULL)
+        return MAP_FAILED;
+      t->mfiles = mfiles;
+      t->mfile_cap = cap;
+    }
+
+  mf = kmem_cache_alloc (mfile_cache);
+  if (mf == NULL)
+    return MAP_FAILED;
+  mf->file = file_reopen (file);
+  if (mf->file == NULL)
+    {
+      kmem_cache_free (mfile_cache, mf);
+      return MAP_FAILED;
+    }
+  mf->mapid = pg_no (addr);
+  mf->start_addr = addr;
+  mf->end_addr = end;
+  if (!vm_new_mapping (addr, cnt, mf->file, length))
+    {
+      file_close (mf->file);
+      kmem_cache_free (mfile_cache, mf);
+      return MAP_FAILED;
+    }
+
+  /* Insert the new file in the table, keeping it sorted. */
+  idx = mfile_search (addr);
+  memmove (t->mfiles + idx + 1, t->mfiles + idx,
+           (t->mfile_cnt - idx) * sizeof *t->mfiles);
+  t->mfiles[idx] = mf;
+  t->mfile_cnt++;
+
+  return mf->mapid;
 }
 
-/* Returns a hash value for a mfile f. */
-static unsigned
-vm_mfile_hash (const struct hash_elem *mf_, void *aux UNUSED)
+/* Returns the index of the first mapping of the current process
+   that ends after ADDR, or the number of mappings if there is
+   none. */
+static size_t
+mfile_search (const void *addr)
 {
-  const struct vm_mfile *mf = hash_entry (mf_, struct vm_mfile, hash_elem);
-  return hash_int ((unsigned)mf->mapid);
+  struct thread *t = process_current ();
+  size_t lo = 0, hi = t->mfile_cnt;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (t->mfiles[mid]->end_addr <= addr)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
 }
 
-/* Returns true if a mfile precedes mfile b. */
+/* Returns true if the range from START up to END overlaps a
+   mapping of the current process. */
 static bool
-vm_mfile_less (const struct hash_elem *a_, const struct hash_elem *b_,
-               void *aux UNUSED)
+overlaps (const void *start, const void *end)
 {
-  const struct vm_mfile *a = hash_entry (a_, struct vm_mfile, hash_elem);
-  const struct vm_mfile *b = hash_entry (b_, struct vm_mfile, hash_elem);
+  struct thread *t = process_current ();
+  size_t idx = mfile_search (start);
+
+  return idx < t->mfile_cnt && t->mfiles[idx]->start_addr < end;
+}
 
-  return a->mapid < b->mapid;
+/* Removes the mapping of the current process from START_ADDR
+   up to END_ADDR and frees the pages created from it, first
+   writing back those that are loaded and modified.  A page
+   evicted meanwhile has already been written back by the
+   eviction.  The TLB is flushed once, at the end. */
+static void
+unmap_pages (void *start_addr, void *end_addr)
+{
+  uint8_t *upage;
+
+  vm_remove_region (start_addr);
+  pagedir_batch_begin ();
+  for (upage = start_addr; upage < (uint8_t *) end_addr; upage += PGSIZE)
+    {
+      struct vm_page *page = vm_lookup_page (upage);
+
+      if (page == NULL)
+        continue;
+      ASSERT (page->type == FILE && page->file_data.mapped);
+      if (vm_frame_pin_loaded (page))
+        {
+          if (pagedir_is_dirty (page->pagedir, page->addr))
+            {
+              file_write_at (page->file_data.file, page->kpage,
+                             page->file_data.read_bytes, page->file_data.ofs);
+              pagedir_set_dirty (page->pagedir, page->addr, false);
+            }
+          vm_unpin_page (page);
+        }
+      vm_free_page (page);
+    }
+  pagedir_batch_end ();
+}
+
+/* Removes the mapping at index IDX from the current process's
+   table, closes its file and frees it. */
+static void
+remove_mfile (size_t idx)
+{
+  struct thread *t = process_current ();
+  struct vm_mfile *mf = t->mfiles[idx];
+
+  t->mfile_cnt--;
+  memmove (t->mfiles + idx, t->mfiles + idx + 1,
+           (t->mfile_cnt - idx) * sizeof *t->mfiles);
+
+  file_close (mf->file);
+  kmem_cache_free (mfile_cache, mf);
+}
+
+/* Write-back thread for memory mappings. */
+static void
+mmap_flusher (void *aux UNUSED)
+{
+  block_set_class (BLOCK_CLASS_ASYNC);
+  for (;;)
+    {
+      timer_sleep (MMAP_FLUSH_INTERVAL);
+      vm_frame_flush_mapped (NULL);
+    }
 }
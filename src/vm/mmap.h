@@ -1,27 +1,36 @@
 #ifndef VM_MMAP_H
 #define VM_MMAP_H
 
-#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/file.h"
 
-/* Map region identifier. */
+struct vm_page;
+
+/* Map region identifier.  A mapping is identified by the page
+   number of its first page, which is unique within a process
+   since mappings never overlap. */
 typedef int mapid_t;
+#define MAP_FAILED ((mapid_t) -1)
 
 struct vm_mfile
   {
     mapid_t mapid;
-    int fid;                     /* File descriptor. */
-    struct hash_elem hash_elem;  /* Hash element for the hash frame table. */
-    struct list_elem thread_elem;/* List elem for a thread's mfile list. */
+    struct file *file;           /* Reopened file backing the mapping. */
     void *start_addr;            /* User virtual address of start and end */
     void *end_addr;              /* of the mapped file as it might span on */
                                  /* multiple pages. */
   };
 
-/* Initialise the memory mapped files table. */
-void vm_mfile_init (void);
 /* Memory mapped files functions. */
+void vm_mmap_init (void);
 struct vm_mfile *vm_find_mfile (mapid_t);
-void vm_insert_mfile (mapid_t, int, void *, void *);
+struct vm_mfile *vm_mfile_lookup (const void *);
+mapid_t vm_insert_mfile (struct file *, void *);
 bool vm_delete_mfile (mapid_t);
+void vm_delete_all_mfiles (void);
+/* Track the writes to memory mappings. */
+bool vm_mmap_write_fault (struct vm_page *);
+void vm_mmap_throttle (void);
 
 #endif /* vm/mmap.h */
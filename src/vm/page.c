@@ -1,60 +1,248 @@
 #include "vm/page.h"
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
 #include "userprog/pagedir.h"
+#include "userprog/process.h"
 #include "userprog/syscall.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/synch.h"
+#include "threads/sysctl.h"
+#include "threads/pte.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
 
-/* Ensure synchronization on load and unload. */
-static struct lock load_lock;
-static struct lock unload_lock;
+/* Most pages mapped ahead of a stack fault, the tunable
+   vm.stack_ahead. */
+#define STACK_AHEAD_MAX 8
+static int stack_ahead_max = STACK_AHEAD_MAX;
+
+/* Most pages read ahead of a fault on a page advised
+   MADV_SEQUENTIAL, the tunable vm.seq_read_ahead. */
+#define SEQ_READ_AHEAD 8
+static int seq_read_ahead = SEQ_READ_AHEAD;
+
+/* Most pages read around a swap fault, the tunable
+   vm.swap_read_around, at most SWAP_READ_AROUND. */
+static int swap_read_around = SWAP_READ_AROUND;
+
+/* Working sets.  Each process is allotted a number of resident
+   pages, and the clock prefers the frames of processes holding
+   more than their allotment, so that a process thrashing through
+   memory takes frames from itself before taking them from the
+   others.  The allotment follows the page-fault frequency, with
+   time measured by the process's own run time, so that a process
+   that sleeps keeps its allotment: every PFF_BATCH faults, the
+   allotment grows by PFF_BATCH pages if they took fewer than
+   PFF_FAST ticks and shrinks by as much if they took more than
+   PFF_SLOW ticks, within PFF_MIN pages and, while growing, the
+   size of the user pool shared by all the allotments. */
+#define PFF_BATCH 16
+#define PFF_FAST 4
+#define PFF_SLOW 100
+#define PFF_MIN 16
+#define PFF_INITIAL 32
+
+bool vm_print_stats;
+size_t vm_stack_limit = 8 * 1024 * 1024;
+size_t vm_lock_limit = 256 * 1024;
+
+/* A page whose contents an eviction is saving, to swap or to its
+   file, is busy.  The flag is changed with busy_lock held, and a
+   thread that needs a busy page waits on busy_cond until the
+   eviction is over, while faults on other pages go on with their
+   own disk transfers. */
+static struct lock busy_lock;
+static struct condition busy_cond;
+
+/* Sum of the allotments of all processes, and the number of pages
+   in the user pool that it is held to.  Updated with interrupts
+   off. */
+static size_t allotted_total;
+static size_t allot_budget;
+
+/* Object cache for page structs, which are allocated on page
+   faults and at every fork. */
+static struct kmem_cache *page_cache;
 
 /* Load function for the specific type of page. */
+static bool load_page (struct vm_page *page, bool pinned, bool write,
+                       bool ahead);
 static bool vm_load_file_page (uint8_t *kpage, struct vm_page *page);
 static void vm_load_swap_page (uint8_t *kpage, struct vm_page *page);
-static void vm_load_zero_page (uint8_t *kpage);
+static void install_around (struct vm_page *page, void *kpage);
+static void read_ahead (struct vm_page *page);
+static void discard_page (struct vm_page *page);
+static uint8_t *range_end (void *addr, size_t length);
 
-static void add_page (struct vm_page *page);
+static bool add_page (struct vm_page *page);
+static struct vm_region *new_region (void *start, size_t cnt,
+                                     struct file *, off_t ofs,
+                                     size_t read_bytes, bool writable);
+static struct vm_region *find_region (void *upage);
+static struct vm_page *region_page (void *upage);
+static bool fork_page (struct vm_page *page, struct thread *parent);
+static bool fork_page_data (struct vm_page *copy, struct vm_page *page);
+static bool pin_user_page (void *upage, bool write);
+static void unpin_user_pages (uint8_t *start, uint8_t *end);
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_destroy;
+static hash_action_func collect_page;
+static list_less_func page_addr_less;
+static void free_page_batch (struct list *dying);
+static void clear_mapping (struct vm_page *page);
+static void end_busy (struct vm_page *page);
+static bool in_swap_slot (struct vm_page *page, size_t index);
+static void count_fault (void);
+static int64_t run_time (const struct thread *t);
+static void set_allotment (struct thread *t, size_t allotted);
+static bool in_stack (const void *upage);
 
 /* Initialise the page table locks. */
 void
 vm_page_init (void)
 {
-  lock_init (&load_lock);
-  lock_init (&unload_lock);
+  struct kstat_mem mem;
+
+  lock_init_named (&busy_lock, "page_busy");
+  cond_init (&busy_cond);
+  palloc_get_kstat (&mem);
+  allot_budget = mem.user_pages;
+  page_cache = kmem_cache_create ("vm_page", sizeof (struct vm_page), NULL);
+
+  sysctl_register ("vm.stack_ahead", &stack_ahead_max, 0, 256);
+  sysctl_register ("vm.seq_read_ahead", &seq_read_ahead, 0, 256);
+  sysctl_register ("vm.swap_read_around", &swap_read_around,
+                   0, SWAP_READ_AROUND);
+}
+
+/* Initializes the supplemental page table of the current
+   process and gives the process its initial allotment of
+   resident pages.  Returns false if memory is exhausted. */
+bool
+vm_page_table_init (void)
+{
+  struct thread *t = process_current ();
+
+  if (!hash_init (&t->vm_pages, page_hash, page_less, NULL))
+    return false;
+  t->pff_faults = 0;
+  t->pff_start = run_time (t);
+  set_allotment (t, PFF_INITIAL);
+  return true;
+}
+
+/* Declares the region of CNT pages starting at user page START,
+   whose first READ_BYTES bytes are read from FILE starting at
+   offset OFS and the rest zeroed.  No page is created until it is
+   first accessed.  If SHAREABLE, read-only pages of the region
+   may share frames with other processes mapping the same file
+   data.  Returns false if memory is exhausted. */
+bool
+vm_new_region (void *start, size_t cnt, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable, bool shareable)
+{
+  struct vm_region *r = new_region (start, cnt, file, ofs, read_bytes,
+                                    writable);
+
+  if (r == NULL)
+    return false;
+  r->shareable = shareable && !writable;
+  return true;
+}
+
+/* Declares the writable memory mapping of the LENGTH bytes of
+   FILE at CNT pages starting at user page START.  Its pages are
+   created when first accessed, and their modifications written
+   back to FILE.  Returns false if memory is exhausted. */
+bool
+vm_new_mapping (void *start, size_t cnt, struct file *file, size_t length)
+{
+  struct vm_region *r = new_region (start, cnt, file, 0, length, true);
+
+  if (r == NULL)
+    return false;
+  r->mapped = true;
+  return true;
 }
 
-static int cnt = 0;
+/* Creates a region for vm_new_region() or vm_new_mapping(), not
+   shareable and not a memory mapping, and adds it to the current
+   process.  Returns a null pointer if memory is exhausted. */
+static struct vm_region *
+new_region (void *start, size_t cnt, struct file *file, off_t ofs,
+            size_t read_bytes, bool writable)
+{
+  struct vm_region *r = malloc (sizeof *r);
+
+  ASSERT (pg_ofs (start) == 0);
+  ASSERT (ofs % PGSIZE == 0);
+  ASSERT (read_bytes <= cnt * PGSIZE);
+  if (r == NULL)
+    return NULL;
+
+  r->start = start;
+  r->end = (uint8_t *) start + cnt * PGSIZE;
+  r->file = file;
+  r->ofs = ofs;
+  r->read_bytes = read_bytes;
+  r->writable = writable;
+  r->shareable = false;
+  r->mapped = false;
+  list_push_back (&process_current ()->vm_regions, &r->elem);
+  return r;
+}
+
+/* Removes the region of the current process that starts at user
+   page START, so that no more pages are created from it.  The
+   pages already created are left to the caller. */
+void
+vm_remove_region (void *start)
+{
+  struct vm_region *r = find_region (start);
+
+  ASSERT (r != NULL && r->start == start);
+  list_remove (&r->elem);
+  free (r);
+}
 
 /* Creates a new page from a file segment. */
 struct vm_page*
 vm_new_file_page (void *addr, struct file *file, off_t ofs, size_t read_bytes,
                   size_t zero_bytes, bool writable, off_t block_id)
 {
-  struct vm_page *page = (struct vm_page*) malloc (sizeof (struct vm_page));
+  struct vm_page *page = kmem_cache_alloc (page_cache);
   
   if (page == NULL)
     return NULL;
 
   page->type = FILE;
   page->addr = addr;
-  page->pagedir = thread_current ()->pagedir;
+  page->pagedir = process_current ()->pagedir;
+  page->thread = process_current ();
   page->file_data.file = file;
   page->file_data.ofs = ofs;
   page->file_data.read_bytes = read_bytes;
   page->file_data.zero_bytes = zero_bytes;
   page->file_data.block_id = block_id;
+  page->file_data.mapped = false;
+  page->file_data.dirty = false;
   page->writable = writable;
+  page->cow = false;
+  page->advice = MADV_NORMAL;
+  page->locked = false;
+  page->busy = false;
   page->loaded = false;
   page->kpage = NULL;
 
-  add_page (page);
+  if (!add_page (page))
+    return NULL;
 
   return page; 
 }
@@ -63,20 +251,41 @@ vm_new_file_page (void *addr, struct file *file, off_t ofs, size_t read_bytes,
 struct vm_page*
 vm_new_zero_page (void *addr, bool writable)
 {
-  struct vm_page *page = (struct vm_page*) malloc (sizeof (struct vm_page));
+  struct vm_page *page = kmem_cache_alloc (page_cache);
 
   if (page == NULL)
     return NULL;
 
   page->type = ZERO;
   page->addr = addr;
-  page->pagedir = thread_current ()->pagedir;
+  page->pagedir = process_current ()->pagedir;
+  page->thread = process_current ();
   page->writable = writable;
+  page->cow = false;
+  page->advice = MADV_NORMAL;
+  page->locked = false;
+  page->busy = false;
   page->loaded = false;
   page->kpage = NULL;  
 
-  add_page (page);
+  if (!add_page (page))
+    return NULL;
+
+  return page;
+}
+
+/* Creates a new writable page mapping page INDEX of shared memory
+   segment SHM.  The caller adds the page's reference to SHM. */
+struct vm_page *
+vm_new_shm_page (void *addr, struct vm_shm *shm, size_t index)
+{
+  struct vm_page *page = vm_new_zero_page (addr, true);
 
+  if (page == NULL)
+    return NULL;
+  page->type = SHM;
+  page->shm_data.shm = shm;
+  page->shm_data.index = index;
   return page;
 }
 
@@ -84,7 +293,7 @@ vm_new_zero_page (void *addr, bool writable)
 void
 vm_pin_page (struct vm_page *page)
 {
-  if (page->kpage != NULL)
+  if (page->kpage == NULL)
     return;
   vm_frame_pin (page->kpage);
 }
@@ -93,200 +302,1319 @@ vm_pin_page (struct vm_page *page)
 void
 vm_unpin_page (struct vm_page *page)
 {
-  if (page->kpage != NULL)
+  if (page->kpage == NULL)
     return;
   vm_frame_unpin (page->kpage);
 }
 
+/* Brings the pages spanned by the SIZE bytes at user address
+   BUFFER of the current process into memory and pins them, so
+   that the kernel can access the buffer without faulting, for
+   example while it holds file system locks.  The stack grows if
+   the buffer reaches below its current end.  If WRITE, the kernel
+   is going to write the buffer, so its pages must be writable.
+   Pages that are copy-on-write are unshared first.  Returns
+   false, with nothing pinned, if part of the buffer is not in the
+   address space.  An empty buffer pins nothing, wherever it
+   points.  vm_unpin_buffer() undoes a successful call. */
+bool
+vm_pin_buffer (const void *buffer, size_t size, bool write)
+{
+  uint8_t *start = pg_round_down (buffer);
+  uint8_t *end = (uint8_t *) buffer + size;
+  uint8_t *upage;
+
+  if (size == 0)
+    return true;
+  for (upage = start; upage < end; upage += PGSIZE)
+    if (!pin_user_page (upage, write))
+      {
+        unpin_user_pages (start, upage);
+        return false;
+      }
+  return true;
+}
+
+/* Unpins the pages of a buffer pinned by vm_pin_buffer(). */
+void
+vm_unpin_buffer (const void *buffer, size_t size)
+{
+  if (size > 0)
+    unpin_user_pages (pg_round_down (buffer), (uint8_t *) buffer + size);
+}
+
+/* Brings user page UPAGE into memory and pins it, for
+   vm_pin_buffer().  Returns false if UPAGE is not part of the
+   address space or, if WRITE, cannot be written, or if there is
+   no frame for a private copy of it. */
+static bool
+pin_user_page (void *upage, bool write)
+{
+  struct vm_page *page;
+
+  if (!is_user_vaddr (upage))
+    return false;
+  page = vm_find_page (upage);
+  if (page == NULL)
+    return (stack_access (thread_current ()->user_esp, upage)
+            && vm_grow_stack (upage, true) != NULL);
+  if (write && !page->writable)
+    return false;
+
+  /* A pinned page must keep its frame until it is unpinned, even
+     while the kernel only reads it: another thread of the process
+     may write it while a pipe transfer has let go of the process
+     lock.  So its copy-on-write frame is unshared first. */
+  if (page->cow)
+    {
+      if (!vm_copy_on_write (page))
+        return false;
+    }
+  else if (write && page->type == FILE && page->file_data.mapped)
+    vm_frame_mkwrite (page);
+  return vm_frame_pin_loaded (page) || vm_load_page (page, true, write);
+}
+
+/* Unpins the user pages from START up to END. */
+static void
+unpin_user_pages (uint8_t *start, uint8_t *end)
+{
+  uint8_t *upage;
+
+  for (upage = start; upage < end; upage += PGSIZE)
+    vm_unpin_page (vm_find_page (upage));
+}
+
 /* Loads a page and obtains a frame where for it. If PINNED
    is true the frame will be left pinned and the caller has
    to unpin it after usage. This is helpful on read / write
    operation and makes sure the frame won't be evicted by
-   another thread in meantime. */
+   another thread in meantime.
+
+   WRITE tells whether the page is loaded to be written.  A zero
+   page loaded only to be read is mapped read-only to a single
+   zero-filled frame shared by all such pages, and gets a frame
+   of its own on its first write, as a copy-on-write page.  A
+   page of a memory mapping loaded only to be read is mapped
+   read-only too, so that its first write faults and counts it
+   as dirty.
+
+   Loading a page of the current process advised MADV_SEQUENTIAL
+   also reads ahead the pages that follow it. */
 bool 
-vm_load_page (struct vm_page *page, bool pinned)
+vm_load_page (struct vm_page *page, bool pinned, bool write)
 {
-  /* Get a frame of memory. */
-  lock_acquire (&load_lock);
-  
+  if (!load_page (page, pinned, write, false))
+    return false;
+  if (page->advice == MADV_SEQUENTIAL && page->thread == process_current ())
+    read_ahead (page);
+  return true;
+}
+
+/* Does the work of vm_load_page(), without the read-ahead.  If
+   AHEAD, PAGE is loaded before it is accessed rather than on a
+   fault: only a free frame is used, without evicting, the page
+   is mapped as not accessed, so that the clock evicts it first if
+   it is not used, and no fault is counted.  Returns false if no
+   frame is free then.
+
+   No lock is held while a frame is found: two processes loading
+   the same shareable data at once may each read it into a frame
+   of their own, and only one of the frames is then indexed for
+   sharing. */
+static bool
+load_page (struct vm_page *page, bool pinned, bool write, bool ahead)
+{
+  bool shareable, zero_share, mapped;
+  struct inode *inode = NULL;
+  bool shared = false;
+
+  /* An eviction may still be saving the page, which decides what
+     it is loaded from. */
+  vm_page_wait (page);
+  shareable = page->type == FILE && page->file_data.block_id != -1;
+  zero_share = page->type == ZERO && !write;
+  mapped = page->type == FILE && page->file_data.mapped;
+
   /* If we have a read-only file try to look for a frame if any
      that contains the same data. */
-  if (page->type == FILE && page->file_data.block_id != -1)
-    page->kpage = vm_lookup_frame (page->file_data.block_id);
-  /* Otherwise obtain an empty frame from the frame table. */
+  if (shareable)
+    {
+      inode = file_get_inode (page->file_data.file);
+      page->kpage = vm_lookup_frame (inode, page->file_data.block_id,
+                                     page->file_data.read_bytes);
+      shared = page->kpage != NULL;
+    }
+  /* A zero frame is indexed as holding no bytes of no file. */
+  else if (zero_share)
+    {
+      page->kpage = vm_lookup_frame (NULL, 0, 0);
+      shared = page->kpage != NULL;
+    }
+  /* A segment page's frame is looked up and filled by vm/shm.c,
+     which holds its lock until the page is mapped. */
+  else if (page->type == SHM)
+    {
+      if (ahead)
+        return false;
+      page->kpage = vm_shm_lock_page (page->shm_data.shm,
+                                      page->shm_data.index, &shared);
+      if (page->kpage == NULL)
+        return false;
+    }
+  /* Otherwise obtain an empty frame from the frame table, if
+     possible one zeroed ahead of time for a zero page. */
   if (page->kpage == NULL)
-    page->kpage = vm_get_frame (PAL_USER);
+    {
+      enum palloc_flags flags = PAL_USER | (page->type == ZERO ? PAL_ZERO : 0);
+      page->kpage = ahead ? vm_try_get_frame (flags) : vm_get_frame (flags);
+    }
 
-  lock_release (&load_lock);
+  if (page->kpage == NULL)
+    return false;
   vm_frame_set_page (page->kpage, page);
 
   bool success = true;
-  /* Performs the specific loading operation. */
-  if (page->type == FILE)
+  /* Performs the specific loading operation.  A shared frame
+     already holds the data, so there is nothing to do. */
+  if (page->type == FILE && !shared)
     success = vm_load_file_page (page->kpage, page);
-  else if (page->type == ZERO)
-    vm_load_zero_page (page->kpage);
-  else
+  else if (page->type == SWAP)
     vm_load_swap_page (page->kpage, page);
 
   if (!success)
     {
-      vm_frame_unpin (page->kpage);
+      vm_free_frame (page->kpage, page->pagedir);
       return false;
     }
 
-  /* Clear any previous mapping and set a new one. */
-  pagedir_clear_page (page->pagedir, page->addr);
-  if (!pagedir_set_page (page->pagedir, page->addr, page->kpage, page->writable) )
+  /* Now that it holds the data, let other processes share it. */
+  if (shareable && !shared)
+    vm_frame_share (page->kpage, inode, page->file_data.block_id,
+                    page->file_data.read_bytes);
+  else if (zero_share && !shared)
+    vm_frame_share (page->kpage, NULL, 0, 0);
+  if (zero_share)
+    page->cow = page->writable;
+
+  /* Replace the pointer to the page struct by the mapping. */
+  if (!pagedir_set_page (page->pagedir, page->addr, page->kpage,
+                         page->writable && !zero_share
+                         && (write || !mapped)))
     {
       ASSERT (false);
       vm_frame_unpin (page->kpage);
+      if (page->type == SHM)
+        vm_shm_unlock_page ();
       return false;
     }
 
   pagedir_set_dirty (page->pagedir, page->addr, false);
-  pagedir_set_accessed (page->pagedir, page->addr, true);
+  pagedir_set_accessed (page->pagedir, page->addr, !ahead);
 
   page->loaded = true;
+  vm_count_resident (page, 1);
+  if (mapped && write)
+    vm_page_set_dirty (page);
+  if (!ahead)
+    {
+      struct vmstat *s = &process_current ()->vm_stats;
+
+      if (page->type == ZERO || shared)
+        s->minor_faults++;
+      else
+        s->major_faults++;
+      if (page->thread == process_current ())
+        {
+          count_fault ();
+          if (page->type == FILE)
+            process_trace_fault (page->file_data.file, page->addr);
+        }
+    }
+
   /* On succes we leave the frame pinned if the caller wants so. */
   if (!pinned)
     vm_frame_unpin (page->kpage);
+  if (page->type == SHM)
+    vm_shm_unlock_page ();
   return true;
 }
 
-/* Unloads a page by writing its content back to disk if the file
-   is writable or to swap if not. Clears the mapping and sets 
-   the pagedir entry to point to the page struct. */
-void
-vm_unload_page (struct vm_page *page, void *kpage)
+/* Begins the eviction of PAGE from its frame by unmapping it,
+   so that its next access faults.  A clean page is simply
+   dropped: file and zero pages can be read again from their
+   source, and a swap page keeps its slot while it is loaded, so
+   the slot still holds its contents.  Returns false then, and the
+   caller removes PAGE from the frame.  A dirty page must first be
+   saved, to its file for a page of a memory mapping and to swap
+   otherwise: then returns true, and PAGE stays in the frame,
+   busy, until vm_save_page() or vm_unload_swapped_page() has
+   saved it.  Must be called with evict_lock held. */
+bool
+vm_evict_page (struct vm_page *page)
 {
-  lock_acquire (&unload_lock);
-  if (page->type == FILE && pagedir_is_dirty (page->pagedir, page->addr) &&
-      file_writable (page->file_data.file) == false)
-    {
-      /* Write the page back to the file. */
-      vm_frame_pin (kpage);
-      sys_t_filelock (true);
+  enum intr_level old_level;
+  bool dirty;
 
-      file_seek (page->file_data.file, page->file_data.ofs);
-      file_write (page->file_data.file, kpage, page->file_data.read_bytes);
-      sys_t_filelock (false);
-      vm_frame_unpin (kpage);
-    }
-  else if (page->type == SWAP || pagedir_is_dirty (page->pagedir, page->addr))
+  ASSERT (page->loaded);
+  lock_acquire (&busy_lock);
+
+  /* Nothing may write the page between the test and the
+     unmapping. */
+  old_level = intr_disable ();
+  dirty = pagedir_is_dirty (page->pagedir, page->addr);
+  pagedir_clear_page (page->pagedir, page->addr);
+  intr_set_level (old_level);
+
+  page->busy = dirty;
+  clear_mapping (page);
+  lock_release (&busy_lock);
+  return dirty;
+}
+
+/* Saves the contents of busy PAGE from frame KPAGE, which it is
+   being evicted from: a page of a memory mapping is written back
+   to its file and any other page is stored to swap, except that
+   the frame of a shared memory page is saved once for all its
+   mappings by vm_shm_evicted().  Ends the eviction of PAGE. */
+void
+vm_save_page (struct vm_page *page, void *kpage)
+{
+  ASSERT (page->busy);
+  if (page->type == SHM)
+    end_busy (page);
+  else if (page->type == FILE && page->file_data.mapped)
     {
-      /* Store the page to swap. */
-      page->type = SWAP;
-      page->swap_data.index = vm_swap_store (kpage);
+      file_write_at (page->file_data.file, kpage,
+                     page->file_data.read_bytes, page->file_data.ofs);
+      end_busy (page);
     }
-  lock_release (&unload_lock);
+  else
+    vm_unload_swapped_page (page, vm_swap_store (kpage));
+}
+
+/* Ends the eviction of busy PAGE, whose contents the caller has
+   already stored to swap at INDEX, for example as part of a batch
+   written with vm_swap_store_batch().  The copy in its old slot,
+   if any, is stale. */
+void
+vm_unload_swapped_page (struct vm_page *page, size_t index)
+{
+  ASSERT (page->busy);
+  if (page->type == SWAP)
+    vm_swap_free (page->swap_data.index);
+  page->type = SWAP;
+  page->swap_data.index = index;
+  vm_swap_set_page (index, page);
+  end_busy (page);
+}
+
+/* Marks PAGE as no longer busy, counting it as swapped out if
+   it is in swap now, and wakes the threads waiting for it.
+   Other evictions of the process's pages may run at the same
+   time, so the count is updated with busy_lock held. */
+static void
+end_busy (struct vm_page *page)
+{
+  lock_acquire (&busy_lock);
+  if (page->type == SWAP)
+    page->thread->vm_stats.swap_outs++;
+  page->busy = false;
+  cond_broadcast (&busy_cond, &busy_lock);
+  lock_release (&busy_lock);
+}
+
+/* Waits until PAGE is not busy. */
+void
+vm_page_wait (struct vm_page *page)
+{
+  lock_acquire (&busy_lock);
+  while (page->busy)
+    cond_wait (&busy_cond, &busy_lock);
+  lock_release (&busy_lock);
+}
+
+/* Returns true if PAGE is in swap at INDEX and neither loaded nor
+   busy.  Only the process owning a page loads it, and only a
+   loaded page can be evicted, so this stays true until the
+   process loads or frees the page. */
+static bool
+in_swap_slot (struct vm_page *page, size_t index)
+{
+  bool in_slot;
+
+  lock_acquire (&busy_lock);
+  in_slot = (!page->loaded && !page->busy && page->type == SWAP
+             && page->swap_data.index == index);
+  lock_release (&busy_lock);
+  return in_slot;
+}
 
+/* Removes the hardware mapping of an unloaded page.  Its next
+   access faults and finds the page in the supplemental page
+   table. */
+static void
+clear_mapping (struct vm_page *page)
+{
   pagedir_clear_page (page->pagedir, page->addr);
-  pagedir_add_page (page->pagedir, page->addr, (void *)page);
+  if (page->loaded)
+    vm_count_resident (page, -1);
   page->loaded = false;
   page->kpage = NULL;
+  page->cow = false;
+  vm_page_set_clean (page);
 }
 
 /* Loads a file page into the given frame. Reads read_bytes from 
-   the file and sets the remaining bytes to 0. */
+   the file and sets the remaining bytes to 0.  The frame is the
+   only copy kept: the data is read around the buffer cache. */
 static bool
 vm_load_file_page (uint8_t *kpage, struct vm_page *page)
 {
   /* Read the content of the page from file. */
-
-  sys_t_filelock (true);
-  file_seek (page->file_data.file, page->file_data.ofs);
-  size_t ret = file_read (page->file_data.file, kpage, 
-                          page->file_data.read_bytes);
-  sys_t_filelock (false);
+  size_t ret = file_read_direct (page->file_data.file, kpage, 
+                                 page->file_data.read_bytes,
+                                 page->file_data.ofs);
    
   if (ret != page->file_data.read_bytes)
-    {
-      vm_free_frame (kpage, page->pagedir);
-      return false;
-    }
+    return false;
   
   /* Fill the rest of the page with zeroes. */
   memset (kpage + page->file_data.read_bytes, 0, page->file_data.zero_bytes);
   return true;
 }
 
-/* To load a zero page we just have to set everything to 0. Usually
-   pages wont't remain all zeros when they are swapped in. */
+/* Loads a page from the swap into main memory.  The swap slot
+   stays reserved for the page, which is mapped clean: if it is
+   not modified before its next eviction, it can simply be
+   dropped.
+
+   The slots that follow it are read in the same transfer as long
+   as they hold other pages of the same process and free frames
+   are available, on the bet that the process will soon fault on
+   them too.  Those pages are installed as loaded but not
+   accessed, so the clock evicts them first if the bet is wrong.
+   Pages advised MADV_RANDOM are neither read around nor read
+   around others. */
 static void
-vm_load_zero_page (uint8_t *kpage)
+vm_load_swap_page (uint8_t *kpage, struct vm_page *page)
 {
-  /* Fill this page only with zeroes. */
-  memset (kpage, 0, PGSIZE);
+  struct vm_page *around[SWAP_READ_AROUND];
+  void *kpages[SWAP_READ_AROUND + 1];
+  size_t around_max = swap_read_around;
+  size_t index = page->swap_data.index;
+  size_t cnt, i;
+
+  kpages[0] = kpage;
+  for (cnt = 1; cnt <= around_max; cnt++)
+    {
+      struct vm_page *next = vm_swap_get_page (index + cnt);
+
+      if (page->advice == MADV_RANDOM
+          || next == NULL || next->pagedir != page->pagedir
+          || next->advice == MADV_RANDOM || !in_swap_slot (next, index + cnt))
+        break;
+      kpages[cnt] = vm_try_get_frame (PAL_USER);
+      if (kpages[cnt] == NULL)
+        break;
+      around[cnt - 1] = next;
+    }
+
+  /* Read the content from swap. */
+  vm_swap_load_batch (index, cnt, kpages);
+
+  for (i = 1; i < cnt; i++)
+    install_around (around[i - 1], kpages[i]);
 }
 
-/* Loads a page from the swap into main memory and frees
-   the underlying swap slot. */
+/* Installs PAGE, whose contents have been read ahead from swap
+   into frame KPAGE. */
 static void
-vm_load_swap_page (uint8_t *kpage, struct vm_page *page)
+install_around (struct vm_page *page, void *kpage)
 {
-  /* Read the content from swap and free the swap slot. */
-  vm_swap_load (page->swap_data.index, kpage);
-  vm_swap_free (page->swap_data.index);
+  vm_frame_set_page (kpage, page);
+  page->kpage = kpage;
+
+  if (!pagedir_set_page (page->pagedir, page->addr, kpage, page->writable))
+    {
+      /* No memory for the page table: put the page back. */
+      vm_free_frame (kpage, page->pagedir);
+      return;
+    }
+  pagedir_set_dirty (page->pagedir, page->addr, false);
+  pagedir_set_accessed (page->pagedir, page->addr, false);
+
+  page->loaded = true;
+  vm_count_resident (page, 1);
+  vm_frame_unpin (kpage);
+}
+
+/* Reads ahead after a fault on PAGE of the current process,
+   which was advised MADV_SEQUENTIAL: the file pages that follow
+   it with the same advice are loaded into free frames, up to
+   vm.seq_read_ahead of them, so that the scan does not fault on
+   each.  The page before PAGE is marked as not accessed, so that
+   the clock evicts it first: a sequential scan does not come
+   back to the pages it has passed.  Pages in swap are already
+   read around by vm_load_swap_page(). */
+static void
+read_ahead (struct vm_page *page)
+{
+  uint8_t *upage = page->addr;
+  int cnt = seq_read_ahead;
+  int i;
+
+  if (upage >= (uint8_t *) PGSIZE)
+    pagedir_set_accessed (page->pagedir, upage - PGSIZE, false);
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct vm_page *next;
+
+      upage += PGSIZE;
+      if (!is_user_vaddr (upage))
+        break;
+      next = vm_lookup_page (upage);
+      if (next == NULL || next->advice != MADV_SEQUENTIAL
+          || next->type != FILE || next->busy)
+        break;
+      if (!next->loaded && !load_page (next, false, false, true))
+        break;
+    }
 }
 
 /* Creates a new zero page at the top of the thread's stack 
-   address space. Then loads the page into memory. */
+   address space. Then loads the page into memory.
+
+   A fault right below the previous growth means the stack is
+   running down, so pages below UVA are mapped too, twice as many
+   as the last time up to vm.stack_ahead, sparing the faults
+   they would take.  Only UVA is pinned if PINNED. */
 struct vm_page *
 vm_grow_stack (void *uva, bool pinned)
 {
+  struct thread *t = thread_current ();
   struct vm_page *page = vm_new_zero_page (uva, true);
-  if ( !vm_load_page (page, pinned) )
+  uint8_t *low = uva;
+  size_t ahead_max = stack_ahead_max;
+  size_t ahead = 0;
+
+  if (page == NULL)
     return NULL;
+  if ( !vm_load_page (page, pinned, true) )
+    {
+      vm_free_page (page);
+      return NULL;
+    }
+
+  if ((uint8_t *) uva + PGSIZE == t->stack_low)
+    ahead = t->stack_ahead == 0 ? 1 : t->stack_ahead * 2;
+  if (ahead > ahead_max)
+    ahead = ahead_max;
+  t->stack_ahead = 0;
+  while (t->stack_ahead < ahead)
+    {
+      uint8_t *addr = low - PGSIZE;
+      struct vm_page *p;
+
+      if (!in_stack (addr) || !vm_range_is_free (addr, 1))
+        break;
+      p = vm_new_zero_page (addr, true);
+      if (p == NULL)
+        break;
+      if (!vm_load_page (p, false, true))
+        {
+          vm_free_page (p);
+          break;
+        }
+      low = addr;
+      t->stack_ahead++;
+    }
+  t->stack_low = low;
 
   return page;
 }
 
-/* Searches for a supplemental page in the thread's pagedir. If the page
-   is not present we get the struct directly. Otherwise is the page is
-   loaded we obtain it from the frame table using the physical address. */
+/* Gives the current process, a child just forked from PARENT, a
+   copy of PARENT's address space.  PARENT must stay blocked
+   meanwhile.  Its loaded pages are not copied: they share their
+   frames with the child and, if writable, become copy-on-write
+   in both processes.  The others get their own descriptor of the
+   same backing store.  The executable must already be reopened
+   as the child's self_file.  Returns false if memory is
+   exhausted. */
+bool
+vm_fork_pages (struct thread *parent)
+{
+  struct thread *t = process_current ();
+  struct hash_iterator i;
+  struct list_elem *e;
+
+  for (e = list_begin (&parent->vm_regions); e != list_end (&parent->vm_regions);
+       e = list_next (e))
+    {
+      struct vm_region *r = list_entry (e, struct vm_region, elem);
+      struct vm_region *copy;
+
+      /* Memory mappings are not inherited. */
+      if (r->mapped)
+        continue;
+      copy = malloc (sizeof *copy);
+      if (copy == NULL)
+        return false;
+      *copy = *r;
+      if (copy->file == parent->self_file)
+        copy->file = t->self_file;
+      list_push_back (&t->vm_regions, &copy->elem);
+    }
+
+  hash_first (&i, &parent->vm_pages);
+  while (hash_next (&i))
+    if (!fork_page (hash_entry (hash_cur (&i), struct vm_page, spt_elem),
+                    parent))
+      return false;
+  return true;
+}
+
+/* Adds to the current process a copy of PAGE, a page of PARENT,
+   for vm_fork_pages().  Returns false if memory is exhausted. */
+static bool
+fork_page (struct vm_page *page, struct thread *parent)
+{
+  struct vm_page *copy;
+  bool dirty;
+
+  /* Memory mappings are not inherited. */
+  if (page->type == FILE && page->file_data.mapped)
+    return true;
+
+  copy = kmem_cache_alloc (page_cache);
+  if (copy == NULL)
+    return false;
+  *copy = *page;
+  copy->pagedir = process_current ()->pagedir;
+  copy->thread = process_current ();
+  copy->loaded = false;
+  copy->kpage = NULL;
+  copy->cow = false;
+  copy->locked = false;
+  copy->busy = false;
+  if (page->type == FILE && page->file_data.file == parent->self_file)
+    copy->file_data.file = process_current ()->self_file;
+
+  /* Shared memory stays shared: the copy maps the same page of the
+     segment and finds its frame through it. */
+  if (page->type == SHM)
+    {
+      if (!add_page (copy))
+        return false;
+      vm_shm_ref (copy->shm_data.shm);
+      return true;
+    }
+
+  /* A swap slot holds the data of a single page, so the copy
+     never refers to one.  A page in swap is brought in instead and
+     its frame shared. */
+  if (page->type == SWAP)
+    copy->type = ZERO;
+  if (!add_page (copy))
+    return false;
+  if (!vm_frame_pin_loaded (page))
+    {
+      if (page->type != SWAP)
+        return true;
+      if (!vm_load_page (page, true, true))
+        return false;
+    }
+
+  /* A private writable frame pinned by anyone else is pinned by
+     another thread of PARENT, in a pipe transfer that let go of
+     the process lock.  It must keep its frame until unpinned, so
+     it is not made copy-on-write: the copy gets its own frame. */
+  if (page->writable && !page->cow && vm_frame_pin_cnt (page->kpage) > 1)
+    return fork_page_data (copy, page);
+
+  if (!pagedir_set_page (copy->pagedir, copy->addr, page->kpage, false))
+    {
+      vm_unpin_page (page);
+      return false;
+    }
+
+  /* Whichever process evicts the frame first saves its own copy,
+     so the child's mapping must be dirty wherever the parent's
+     is, and also where only the parent's swap slot holds the data. */
+  dirty = pagedir_is_dirty (page->pagedir, page->addr) || page->type == SWAP;
+  pagedir_set_dirty (copy->pagedir, copy->addr, dirty);
+  if (page->writable)
+    {
+      pagedir_set_writable (page->pagedir, page->addr, false);
+      page->cow = copy->cow = true;
+    }
+  vm_frame_set_page (page->kpage, copy);
+  copy->kpage = page->kpage;
+  copy->loaded = true;
+  vm_count_resident (copy, 1);
+
+  vm_unpin_page (page);
+  return true;
+}
+
+/* Loads COPY, a page of the current process, with a copy of the
+   data of PAGE, a page of its parent, loaded and pinned, which is
+   unpinned.  Returns false if memory is exhausted. */
+static bool
+fork_page_data (struct vm_page *copy, struct vm_page *page)
+{
+  void *kpage = vm_get_frame (PAL_USER);
+
+  if (kpage == NULL)
+    {
+      vm_unpin_page (page);
+      return false;
+    }
+  memcpy (kpage, page->kpage, PGSIZE);
+  vm_unpin_page (page);
+
+  vm_frame_set_page (kpage, copy);
+  copy->kpage = kpage;
+  if (!pagedir_set_page (copy->pagedir, copy->addr, kpage, true))
+    {
+      vm_free_frame (kpage, copy->pagedir);
+      return false;
+    }
+  pagedir_set_dirty (copy->pagedir, copy->addr, true);
+  copy->loaded = true;
+  vm_count_resident (copy, 1);
+  vm_frame_unpin (kpage);
+  return true;
+}
+
+/* Handles a write fault on copy-on-write PAGE of the current
+   process, after which the faulting access can be retried.
+   Returns false if there was no memory for a copy of the page. */
+bool
+vm_copy_on_write (struct vm_page *page)
+{
+  process_current ()->vm_stats.minor_faults++;
+  return vm_frame_unshare (page);
+}
+
+/* Adds DELTA to the resident set size of the process owning
+   PAGE.  Other threads unload its pages too, so the update is
+   done with interrupts off.  The other statistics are only
+   updated by the process itself, or with evict_lock or, for
+   swap-outs, busy_lock held. */
+void
+vm_count_resident (struct vm_page *page, int delta)
+{
+  struct vmstat *s = &page->thread->vm_stats;
+  enum intr_level old_level = intr_disable ();
+
+  s->resident += delta;
+  if (s->resident > s->max_resident)
+    s->max_resident = s->resident;
+  intr_set_level (old_level);
+}
+
+/* Returns true if process T has more pages resident than it is
+   allotted. */
+bool
+vm_over_allotment (const struct thread *t)
+{
+  return t->vm_stats.resident > t->vm_stats.allotted;
+}
+
+/* Counts a page fault of the current process, adjusting its
+   allotment after every PFF_BATCH of them. */
+static void
+count_fault (void)
+{
+  struct thread *t = process_current ();
+  size_t allotted = t->vm_stats.allotted;
+  int64_t now, elapsed;
+
+  if (++t->pff_faults < PFF_BATCH)
+    return;
+  now = run_time (t);
+  elapsed = now - t->pff_start;
+  if (elapsed < PFF_FAST)
+    allotted += PFF_BATCH;
+  else if (elapsed > PFF_SLOW)
+    allotted = (allotted > PFF_MIN + PFF_BATCH
+                ? allotted - PFF_BATCH : PFF_MIN);
+  set_allotment (t, allotted);
+  t->pff_faults = 0;
+  t->pff_start = now;
+}
+
+/* Returns the time process T has spent running, in timer ticks,
+   including the current stretch if it is running. */
+static int64_t
+run_time (const struct thread *t)
+{
+  int64_t ticks = t->stats.run_ticks;
+
+  if (t == thread_current ())
+    ticks += timer_ticks () - t->stats.stamp;
+  return ticks;
+}
+
+/* Changes the allotment of process T to ALLOTTED pages, or to as
+   many as the budget leaves if that is less and more than it had.
+   An allotment of 0 gives the pages back, as on exit. */
+static void
+set_allotment (struct thread *t, size_t allotted)
+{
+  struct vmstat *s = &t->vm_stats;
+  enum intr_level old_level = intr_disable ();
+
+  allotted_total -= s->allotted;
+  if (allotted > s->allotted && allotted_total + allotted > allot_budget)
+    {
+      size_t room = (allotted_total < allot_budget
+                     ? allot_budget - allotted_total : 0);
+      allotted = room > s->allotted ? room : s->allotted;
+    }
+  s->allotted = allotted;
+  allotted_total += allotted;
+  intr_set_level (old_level);
+}
+
+/* Counts PAGE, of a memory mapping and just made writable, among
+   the dirty mapped pages of its process until it is written back
+   or unloaded.  Like the resident set size, the count is updated
+   with interrupts off. */
+void
+vm_page_set_dirty (struct vm_page *page)
+{
+  enum intr_level old_level = intr_disable ();
+
+  ASSERT (page->type == FILE && page->file_data.mapped);
+  if (!page->file_data.dirty)
+    {
+      page->file_data.dirty = true;
+      page->thread->vm_stats.dirty++;
+    }
+  intr_set_level (old_level);
+}
+
+/* Stops counting PAGE among the dirty mapped pages of its
+   process, if it is.  Does nothing for other kinds of page. */
+void
+vm_page_set_clean (struct vm_page *page)
+{
+  enum intr_level old_level;
+
+  if (page->type != FILE || !page->file_data.mapped)
+    return;
+  old_level = intr_disable ();
+  if (page->file_data.dirty)
+    {
+      page->file_data.dirty = false;
+      page->thread->vm_stats.dirty--;
+    }
+  intr_set_level (old_level);
+}
+
+/* Applies ADVICE, an MADV_* value, to the pages of the current
+   process spanned by the LENGTH bytes at page-aligned user address
+   ADDR.  MADV_NORMAL, MADV_SEQUENTIAL and MADV_RANDOM are kept in
+   the pages, so the pages of regions not accessed yet are created
+   to hold them.  MADV_WILLNEED reads in the pages backed by a file
+   or swap, as long as free frames last, instead of waiting for
+   their faults.  MADV_DONTNEED discards the pages, as
+   discard_page() describes, except that locked pages may not be
+   discarded.  Returns false, doing nothing, if ADVICE is not
+   valid or part of the range is not in the address space. */
+bool
+vm_madvise (void *addr, size_t length, int advice)
+{
+  uint8_t *start = addr;
+  uint8_t *end, *upage;
+  bool prefetch = true;
+
+  if (advice < MADV_NORMAL || advice > MADV_DONTNEED)
+    return false;
+  end = range_end (addr, length);
+  if (end == NULL)
+    return false;
+  if (advice == MADV_DONTNEED)
+    for (upage = start; upage < end; upage += PGSIZE)
+      if (vm_find_page (upage)->locked)
+        return false;
+
+  pagedir_batch_begin ();
+  for (upage = start; upage < end; upage += PGSIZE)
+    {
+      struct vm_page *page = vm_find_page (upage);
+
+      switch (advice)
+        {
+        case MADV_WILLNEED:
+          if (prefetch && !page->loaded && page->type != ZERO
+              && page->type != SHM)
+            prefetch = load_page (page, false, false, true);
+          break;
+        case MADV_DONTNEED:
+          discard_page (page);
+          break;
+        default:
+          page->advice = advice;
+          break;
+        }
+    }
+  pagedir_batch_end ();
+  return true;
+}
+
+/* Loads the file page at user page UPAGE of the current process
+   ahead of its first access, as MADV_WILLNEED does, unless it is
+   loaded already or is not a file page.  Returns false if no frame
+   was free for it. */
+bool
+vm_prefetch_page (void *upage)
+{
+  struct vm_page *page = vm_find_page (upage);
+
+  if (page == NULL || page->loaded || page->type != FILE)
+    return true;
+  return load_page (page, false, false, true);
+}
+
+/* Locks the pages of the current process spanned by the LENGTH
+   bytes at page-aligned user address ADDR in memory, for
+   mlock().  Each page is brought in now, with a private frame if
+   it is writable, so that it takes no fault later, not even for
+   copy-on-write, and its frame is kept out of reach of the clock
+   until the page is unlocked or freed.  Returns false, locking
+   nothing, if part of the range is not in the address space or
+   the process would have more than vm_lock_limit bytes locked.
+   Also returns false if memory runs out partway, or the frames
+   of all processes locked reach the limit of vm/frame.c, leaving
+   the pages locked until then locked. */
+bool
+vm_lock_pages (void *addr, size_t length)
+{
+  struct vmstat *s = &process_current ()->vm_stats;
+  uint8_t *start = addr;
+  uint8_t *end = range_end (addr, length);
+  uint8_t *upage;
+  size_t cnt = 0;
+
+  if (end == NULL)
+    return false;
+  for (upage = start; upage < end; upage += PGSIZE)
+    if (!vm_find_page (upage)->locked)
+      cnt++;
+  if (s->locked + cnt > vm_lock_limit / PGSIZE)
+    return false;
+
+  for (upage = start; upage < end; upage += PGSIZE)
+    {
+      struct vm_page *page = vm_find_page (upage);
+
+      if (page->locked)
+        continue;
+      if (!pin_user_page (upage, page->writable))
+        return false;
+      if (!vm_frame_lock_page (page))
+        {
+          vm_unpin_page (page);
+          return false;
+        }
+      vm_unpin_page (page);
+      page->locked = true;
+      s->locked++;
+    }
+  return true;
+}
+
+/* Unlocks the locked pages of the current process spanned by the
+   LENGTH bytes at page-aligned user address ADDR, for munlock().
+   Returns false, doing nothing, if part of the range is not in
+   the address space. */
+bool
+vm_unlock_pages (void *addr, size_t length)
+{
+  uint8_t *start = addr;
+  uint8_t *end = range_end (addr, length);
+  uint8_t *upage;
+
+  if (end == NULL)
+    return false;
+  for (upage = start; upage < end; upage += PGSIZE)
+    {
+      struct vm_page *page = vm_find_page (upage);
+
+      if (page->locked)
+        {
+          vm_frame_unlock_page (page);
+          page->locked = false;
+          process_current ()->vm_stats.locked--;
+        }
+    }
+  return true;
+}
+
+/* Returns the end of the LENGTH bytes at user address ADDR,
+   rounded up to a page boundary, if ADDR is page-aligned and every
+   page of the range is in the current process's address space,
+   otherwise a null pointer.  The pages of regions not accessed
+   yet are created on the way. */
+static uint8_t *
+range_end (void *addr, size_t length)
+{
+  uint8_t *start = addr;
+  uint8_t *end, *upage;
+
+  if (pg_ofs (addr) != 0 || !is_user_vaddr (addr)
+      || length > (size_t) ((uint8_t *) PHYS_BASE - start))
+    return NULL;
+  end = start + ROUND_UP (length, PGSIZE);
+  for (upage = start; upage < end; upage += PGSIZE)
+    if (vm_find_page (upage) == NULL)
+      return NULL;
+  return end;
+}
+
+/* Discards the contents of PAGE of the current process for
+   MADV_DONTNEED, freeing its frame and swap slot.  A page of a
+   memory mapping is written back first if it was modified.  A
+   page of a region, which includes every page of a memory
+   mapping, is removed, and created afresh from the region on its
+   next access, with the data of its file.  A page of shared
+   memory only loses its frame: the segment keeps the data.  Any
+   other page, of the heap or the stack, reads as zeros from then
+   on. */
+static void
+discard_page (struct vm_page *page)
+{
+  if (page->type == FILE && page->file_data.mapped)
+    {
+      if (vm_frame_pin_loaded (page))
+        {
+          if (pagedir_is_dirty (page->pagedir, page->addr))
+            {
+              file_write_at (page->file_data.file, page->kpage,
+                             page->file_data.read_bytes, page->file_data.ofs);
+              pagedir_set_dirty (page->pagedir, page->addr, false);
+            }
+          vm_unpin_page (page);
+        }
+    }
+  if (find_region (page->addr) != NULL)
+    {
+      vm_free_page (page);
+      return;
+    }
+
+  vm_frame_drop_page (page);
+  pagedir_clear_page (page->pagedir, page->addr);
+  if (page->type == SWAP)
+    {
+      vm_swap_free (page->swap_data.index);
+      page->type = ZERO;
+    }
+}
+
+/* Searches for the supplemental page containing ADDR in the
+   current process's page table.  A page of a region that has not
+   been accessed yet is created on the way.  Returns a null
+   pointer if ADDR is not part of the address space. */
 struct vm_page *
 vm_find_page (void *addr)
 {
-  uint32_t *pagedir = thread_current ()->pagedir;
-  struct vm_page *page = NULL;
-  page = (struct vm_page *) pagedir_find_page (pagedir, (const void *)addr);
+  void *upage = pg_round_down (addr);
+  struct vm_page *page = vm_lookup_page (upage);
+
+  return page != NULL ? page : region_page (upage);
+}
+
+/* Returns the page at user page UPAGE in the current process's
+   page table, or a null pointer if it has none.  Unlike
+   vm_find_page(), creates no page. */
+struct vm_page *
+vm_lookup_page (void *upage)
+{
+  struct vm_page key;
+  struct hash_elem *e;
+
+  key.addr = upage;
+  e = hash_find (&process_current ()->vm_pages, &key.spt_elem);
+  return e != NULL ? hash_entry (e, struct vm_page, spt_elem) : NULL;
+}
+
+/* Returns true if none of the CNT pages starting at user page
+   START is part of the current process's address space.  Unlike
+   vm_find_page(), creates no page. */
+bool
+vm_range_is_free (void *start, size_t cnt)
+{
+  struct thread *t = process_current ();
+  uint8_t *end = (uint8_t *) start + cnt * PGSIZE;
+  struct vm_page key;
+  struct list_elem *e;
+
+  for (e = list_begin (&t->vm_regions); e != list_end (&t->vm_regions);
+       e = list_next (e))
+    {
+      struct vm_region *r = list_entry (e, struct vm_region, elem);
+      if ((uint8_t *) r->start < end && (uint8_t *) start < (uint8_t *) r->end)
+        return false;
+    }
 
+  for (key.addr = start; (uint8_t *) key.addr < end;
+       key.addr = (uint8_t *) key.addr + PGSIZE)
+    if (hash_find (&t->vm_pages, &key.spt_elem) != NULL)
+      return false;
+  return true;
+}
+
+/* Returns the region of the current process that covers user
+   page UPAGE, or a null pointer if there is none. */
+static struct vm_region *
+find_region (void *upage)
+{
+  struct list *regions = &process_current ()->vm_regions;
+  struct list_elem *e;
+
+  for (e = list_begin (regions); e != list_end (regions); e = list_next (e))
+    {
+      struct vm_region *r = list_entry (e, struct vm_region, elem);
+      if (upage >= r->start && upage < r->end)
+        return r;
+    }
+  return NULL;
+}
+
+/* Creates the page at UPAGE from the region of the current
+   process that covers it.  Returns a null pointer if there is no
+   such region or memory is exhausted. */
+static struct vm_page *
+region_page (void *upage)
+{
+  struct vm_region *r = find_region (upage);
+  struct vm_page *page;
+  size_t ofs, read_bytes;
+  off_t file_ofs;
+
+  if (r == NULL)
+    return NULL;
+
+  ofs = (uint8_t *) upage - (uint8_t *) r->start;
+  if (ofs >= r->read_bytes)
+    return vm_new_zero_page (upage, r->writable);
+  file_ofs = r->ofs + ofs;
+  read_bytes = r->read_bytes - ofs < PGSIZE ? r->read_bytes - ofs : PGSIZE;
+  page = vm_new_file_page (upage, r->file, file_ofs, read_bytes,
+                           PGSIZE - read_bytes, r->writable,
+                           r->shareable ? file_ofs / PGSIZE : -1);
+  if (page != NULL)
+    page->file_data.mapped = r->mapped;
   return page;
 }
 
-/* Stores inside the page table entry a pointer to the page struct
-   so we can use the pagedir to track the supplemental page. */
-static void
+/* Enters PAGE in the supplemental page table of the current
+   process.  Only the process itself uses its table, so no lock
+   is needed.  Frees PAGE and returns false if a page already
+   exists at its address. */
+static bool
 add_page (struct vm_page *page)
 {
-  pagedir_add_page (page->pagedir, page->addr, (void *)page);
+  if (hash_insert (&process_current ()->vm_pages, &page->spt_elem) != NULL)
+    {
+      kmem_cache_free (page_cache, page);
+      return false;
+    }
+  return true;
 }
 
-/* Frees a page struct and it's corresponding swap slot. */
+/* Frees a page struct and it's corresponding frame and swap slot.
+   The contents of the page are discarded. */
 void
 vm_free_page (struct vm_page *page)
 {
   if (page == NULL)
     return;
   
+  hash_delete (&process_current ()->vm_pages, &page->spt_elem);
+  page_destroy (&page->spt_elem, NULL);
+}
+
+/* Frees all the pages and regions of the current process.  Called
+   on process exit, before its page directory is destroyed.  The
+   pages are freed in batches in address order, a page table at a
+   time, so that exiting holds the locks shared with other
+   processes once per batch rather than once per page, and never
+   for long. */
+void
+vm_free_all_pages (void)
+{
+  struct thread *t = process_current ();
+  struct list dying;
+
+  /* The table is only set up once the process starts loading. */
+  if (t->vm_pages.buckets != NULL)
+    {
+      list_init (&dying);
+      t->vm_pages.aux = &dying;
+      hash_destroy (&t->vm_pages, collect_page);
+      list_sort (&dying, page_addr_less, NULL);
+      while (!list_empty (&dying))
+        free_page_batch (&dying);
+    }
+  set_allotment (t, 0);
+  while (!list_empty (&t->vm_regions))
+    free (list_entry (list_pop_front (&t->vm_regions),
+                      struct vm_region, elem));
+}
+
+/* Adds the page with hash element E, which has already been
+   removed from the page table, to the list DYING_, through the
+   list element of E that the table no longer uses. */
+static void
+collect_page (struct hash_elem *e, void *dying_)
+{
+  struct list *dying = dying_;
+
+  list_push_back (dying, &e->list_elem);
+}
+
+/* Returns true if the page with list element A, as collected by
+   collect_page(), is at a lower address than that of B. */
+static bool
+page_addr_less (const struct list_elem *a_, const struct list_elem *b_,
+                void *aux UNUSED)
+{
+  const struct vm_page *a = list_entry (a_, struct vm_page,
+                                        spt_elem.list_elem);
+  const struct vm_page *b = list_entry (b_, struct vm_page,
+                                        spt_elem.list_elem);
+
+  return a->addr < b->addr;
+}
+
+/* Frees the pages at the front of DYING, which are sorted by
+   address and no longer in the page table, as page_destroy()
+   does: up to VM_DROP_BATCH of them that are covered by the same
+   page table.  Their frames are dropped with one acquisition of
+   the frame table locks, their swap slots released with one of the
+   swap lock, and their mappings cleared with one TLB flush. */
+static void
+free_page_batch (struct list *dying)
+{
+  struct vm_page *pages[VM_DROP_BATCH];
+  size_t indices[VM_DROP_BATCH];
+  size_t cnt = 0, index_cnt = 0;
+  uintptr_t pde;
+  size_t i;
+
+  pde = pd_no (list_entry (list_front (dying), struct vm_page,
+                           spt_elem.list_elem)->addr);
+  while (cnt < VM_DROP_BATCH && !list_empty (dying))
+    {
+      struct vm_page *page = list_entry (list_front (dying), struct vm_page,
+                                         spt_elem.list_elem);
+      if (pd_no (page->addr) != pde)
+        break;
+      list_pop_front (dying);
+      pages[cnt++] = page;
+    }
+
+  /* Dropping the pages from their frames also unlocks the
+     frames. */
+  for (i = 0; i < cnt; i++)
+    if (pages[i]->locked)
+      pages[i]->thread->vm_stats.locked--;
+  vm_frame_drop_pages (pages, cnt);
+
+  for (i = 0; i < cnt; i++)
+    if (pages[i]->type == SWAP)
+      indices[index_cnt++] = pages[i]->swap_data.index;
+  vm_swap_free_batch (indices, index_cnt);
+
+  pagedir_batch_begin ();
+  for (i = 0; i < cnt; i++)
+    pagedir_clear_page (pages[i]->pagedir, pages[i]->addr);
+  pagedir_batch_end ();
+
+  for (i = 0; i < cnt; i++)
+    {
+      if (pages[i]->type == SHM)
+        vm_shm_release (pages[i]->shm_data.shm);
+      kmem_cache_free (page_cache, pages[i]);
+    }
+}
+
+/* Does the work of vm_free_page() for the page with hash element
+   E, which has already been removed from the page table. */
+static void
+page_destroy (struct hash_elem *e, void *aux UNUSED)
+{
+  struct vm_page *page = hash_entry (e, struct vm_page, spt_elem);
+
+  /* Dropping the page from its frame also unlocks the frame. */
+  if (page->locked)
+    page->thread->vm_stats.locked--;
+  vm_frame_drop_page (page);
+
   /* Free the swap data of the page if necessary. */
-  if (page->type == SWAP && page->loaded == false)
+  if (page->type == SWAP)
     vm_swap_free (page->swap_data.index);
 
   /* Clear the mapping from the thread's pagedir. */
   pagedir_clear_page (page->pagedir, page->addr);
-  free (page);
-  --cnt;
+  if (page->type == SHM)
+    vm_shm_release (page->shm_data.shm);
+  kmem_cache_free (page_cache, page);
 }
 
 /* Use a heuristic to check for stack access. We check if the
-   address is in the user space and the fault access is at 
-   most 32 bytes below the stack pointer. */
+   address is in the user space, the fault access is at most 32
+   bytes below the stack pointer and the stack stays within
+   the current thread's stack area. */
 bool
 stack_access (const void *esp, void *addr)
 {
   return (uint32_t)addr > 0 && addr >= (esp - 32) &&
-     (PHYS_BASE - pg_round_down (addr)) <= (1<<23);
+     in_stack (pg_round_down (addr));
+}
+
+/* Returns true if user page UPAGE lies in the area the current
+   thread's stack may grow into: the vm_stack_limit bytes below
+   PHYS_BASE for the first thread of a process, or the slot of
+   PROCESS_STACK_SIZE bytes that a thread started by
+   process_thread_create() was given. */
+static bool
+in_stack (const void *upage)
+{
+  const uint8_t *top = thread_current ()->stack_top;
+  size_t size = PROCESS_STACK_SIZE;
+
+  if (top == NULL)
+    {
+      top = PHYS_BASE;
+      size = vm_stack_limit;
+    }
+  return (const uint8_t *) upage < top
+         && (size_t) (top - (const uint8_t *) upage) <= size;
+}
+
+/* Returns a hash value for page P. */
+static unsigned
+page_hash (const struct hash_elem *p_, void *aux UNUSED)
+{
+  const struct vm_page *p = hash_entry (p_, struct vm_page, spt_elem);
+  return hash_bytes (&p->addr, sizeof p->addr);
 }
 
+/* Returns true if page a precedes page b. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct vm_page *a = hash_entry (a_, struct vm_page, spt_elem);
+  const struct vm_page *b = hash_entry (b_, struct vm_page, spt_elem);
+
+  return a->addr < b->addr;
+}
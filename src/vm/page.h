@@ -1,27 +1,45 @@
 #ifndef VM_PAGE_H
 #define VM_PAGE_H
 
+#include <hash.h>
 #include <list.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include "filesys/file.h"
+#include "threads/thread.h"
+#include "vm/shm.h"
 
 enum vm_page_type
   {
     SWAP,
     FILE,
-    ZERO
+    ZERO,
+    SHM
   };
 
+/* Access pattern hints given to madvise(), as in
+   lib/user/syscall.h. */
+#define MADV_NORMAL 0           /* No special treatment. */
+#define MADV_SEQUENTIAL 1       /* Read ahead, evict behind. */
+#define MADV_RANDOM 2           /* No read-around. */
+#define MADV_WILLNEED 3         /* Read the pages in now. */
+#define MADV_DONTNEED 4         /* Discard the pages. */
+
 struct vm_page
 {
   enum vm_page_type type;        /* Page type from vm_page_type enum. */
   bool loaded;                   /* If the page is loaded. */
   bool writable;                 /* If the page is writable. */
+  bool cow;                      /* Mapped read-only until first write? */
+  int advice;                    /* Access pattern hint, a MADV_* value. */
+  bool locked;                   /* Locked in memory by mlock()? */
+  bool busy;                     /* Being saved by an eviction? */
   void *addr;                    /* User virtual address of the page. */
   void *kpage;                   /* Physical address of the page if loaded. */
   uint32_t *pagedir;             /* Page's hardware pagedir. */ 
+  struct thread *thread;         /* Process the page belongs to. */
   struct list_elem frame_elem;   /* List elem for frame shared pages list. */
+  struct hash_elem spt_elem;     /* Hash elem for the process's page table. */
 
   struct        
   {
@@ -30,31 +48,97 @@ struct vm_page
     size_t read_bytes;           /* Rad bytes of the file. */
     size_t zero_bytes;           /* Zero bytes of the file. */
     off_t block_id;              /* Inode block index for shared files. */
+    bool mapped;                 /* Memory-mapped: write back on unload. */
+    bool dirty;                  /* Mapped writable since written back? */
   } file_data;
 
   struct
   {
     size_t index;                 /* Swap block index. */
   } swap_data;
+
+  struct
+  {
+    struct vm_shm *shm;           /* Shared memory segment. */
+    size_t index;                 /* Page number in the segment. */
+  } shm_data;
 };
 
+/* A range of a process's address space that is backed by a file
+   and zero-filled past its file data, such as an executable
+   segment or a memory mapping.  Its pages are created on first
+   access, so a region costs the same however big it is. */
+struct vm_region
+  {
+    void *start;                 /* First user page. */
+    void *end;                   /* End of the region, page aligned. */
+    struct file *file;           /* File with the data. */
+    off_t ofs;                   /* Offset of START's data in FILE. */
+    size_t read_bytes;           /* Bytes of file data from START. */
+    bool writable;               /* Are the pages writable? */
+    bool shareable;              /* May frames be shared? */
+    bool mapped;                 /* Memory mapping, written back? */
+    struct list_elem elem;       /* List elem for the process's regions. */
+  };
+
+/* Print the paging statistics of each process when it exits?
+   Set by the kernel command-line option -vmstat. */
+extern bool vm_print_stats;
+
+/* Most bytes a user stack may grow to.  Set by the kernel
+   command-line option -stack. */
+extern size_t vm_stack_limit;
+
+/* Most bytes a process may lock in memory with mlock().  Set by
+   the kernel command-line option -mlock. */
+extern size_t vm_lock_limit;
+
 /* Initialize the page locks. */
 void vm_page_init (void);
+/* Set up the current process's page table and regions. */
+bool vm_page_table_init (void);
+bool vm_new_region (void *, size_t, struct file *, off_t, size_t, bool, bool);
+bool vm_new_mapping (void *, size_t, struct file *, size_t);
+void vm_remove_region (void *);
 /* Create a new page. */
 struct vm_page *vm_new_file_page (void *, struct file *, off_t, uint32_t, 
                                   uint32_t, bool, off_t);
 struct vm_page *vm_new_zero_page (void *, bool);
-/* Load or unload the given page. */
-bool vm_load_page (struct vm_page *, bool);
-void vm_unload_page (struct vm_page *, void *);
+struct vm_page *vm_new_shm_page (void *, struct vm_shm *, size_t);
+/* Load or evict the given page. */
+bool vm_load_page (struct vm_page *, bool, bool);
+bool vm_evict_page (struct vm_page *);
+void vm_save_page (struct vm_page *, void *);
+void vm_unload_swapped_page (struct vm_page *, size_t);
+void vm_page_wait (struct vm_page *);
+/* Copy-on-write support for fork. */
+bool vm_fork_pages (struct thread *);
+bool vm_copy_on_write (struct vm_page *);
+/* Account for a page entering or leaving memory. */
+void vm_count_resident (struct vm_page *, int);
+bool vm_over_allotment (const struct thread *);
+/* Track the pages of memory mappings not written back. */
+void vm_page_set_dirty (struct vm_page *);
+void vm_page_set_clean (struct vm_page *);
 /* Grow a thread's stack. */
 struct vm_page *vm_grow_stack (void *, bool);
 /* Pin or unpin a page's underlying frame. */
 void vm_pin_page (struct vm_page *);
 void vm_unpin_page (struct vm_page *);
+bool vm_pin_buffer (const void *, size_t, bool);
+void vm_unpin_buffer (const void *, size_t);
+/* Apply an access pattern hint. */
+bool vm_madvise (void *, size_t, int);
+bool vm_prefetch_page (void *);
+/* Lock or unlock pages in memory. */
+bool vm_lock_pages (void *, size_t);
+bool vm_unlock_pages (void *, size_t);
 /* Find / Free a given page. */
 struct vm_page *vm_find_page (void *);
+struct vm_page *vm_lookup_page (void *);
+bool vm_range_is_free (void *, size_t);
 void vm_free_page (struct vm_page *);
+void vm_free_all_pages (void);
 /* Heuristic for stack access. */
 bool stack_access (const void *, void *);
 
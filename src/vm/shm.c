@@ -0,0 +1,327 @@
+#include "vm/shm.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* A shared memory segment. */
+struct vm_shm
+  {
+    char name[SHM_NAME_MAX + 1]; /* Name, while NAMED. */
+    bool named;                 /* In the list of segments? */
+    size_t page_cnt;            /* Number of pages. */
+    struct vm_shm_page *pages;  /* The pages. */
+    int ref_cnt;                /* Pages mapping it, plus 1 if named. */
+    struct list_elem elem;      /* Element in shm_list. */
+  };
+
+/* The named segments, and the lock that protects them and the
+   segments' reference counts and pages.  SHM_COND is signaled
+   when a page stops being busy. */
+static struct list shm_list;
+static struct lock shm_lock;
+static struct condition shm_cond;
+
+static struct vm_shm *find_shm (const char *name);
+static struct vm_shm *create_shm (const char *name, size_t page_cnt);
+static void destroy_shm (struct vm_shm *);
+
+/* Initializes shared memory. */
+void
+vm_shm_init (void)
+{
+  list_init (&shm_list);
+  lock_init_named (&shm_lock, "shm");
+  cond_init (&shm_cond);
+}
+
+/* Maps the first SIZE bytes, rounded up to whole pages, of the
+   segment named NAME into the current process at ADDR, creating
+   the segment with that many zeroed pages if there is none by that
+   name.  Returns false if ADDR is not page-aligned, the range is
+   not free, an existing segment is smaller than SIZE, or memory
+   is exhausted. */
+bool
+vm_shm_map (const char *name, size_t size, void *addr)
+{
+  size_t cnt = DIV_ROUND_UP (size, PGSIZE);
+  uint8_t *end = (uint8_t *) addr + cnt * PGSIZE;
+  struct vm_shm *shm;
+  size_t i;
+
+  if (addr == NULL || pg_ofs (addr) != 0 || cnt == 0 || cnt > SHM_MAX_PAGES)
+    return false;
+  if (end <= (uint8_t *) addr || !is_user_vaddr (end - 1)
+      || !vm_range_is_free (addr, cnt))
+    return false;
+
+  /* Hold a reference of our own while the pages are created, so
+     that an unlink meanwhile does not free the segment. */
+  lock_acquire (&shm_lock);
+  shm = find_shm (name);
+  if (shm == NULL)
+    shm = create_shm (name, cnt);
+  if (shm != NULL && shm->page_cnt >= cnt)
+    shm->ref_cnt++;
+  else
+    shm = NULL;
+  lock_release (&shm_lock);
+  if (shm == NULL)
+    return false;
+
+  for (i = 0; i < cnt; i++)
+    {
+      uint8_t *upage = (uint8_t *) addr + i * PGSIZE;
+
+      if (vm_new_shm_page (upage, shm, i) == NULL)
+        break;
+      vm_shm_ref (shm);
+    }
+  if (i < cnt)
+    while (i-- > 0)
+      vm_free_page (vm_lookup_page ((uint8_t *) addr + i * PGSIZE));
+  vm_shm_release (shm);
+  return i == cnt;
+}
+
+/* Unmaps the shared memory mapping of the current process that
+   starts at ADDR.  The contents stay in the segment.  Returns
+   false if no mapping starts at ADDR. */
+bool
+vm_shm_unmap (void *addr)
+{
+  struct vm_page *page = pg_ofs (addr) == 0 ? vm_lookup_page (addr) : NULL;
+  struct vm_shm *shm;
+  size_t cnt, i;
+
+  if (page == NULL || page->type != SHM || page->shm_data.index != 0)
+    return false;
+
+  /* A mapping may cover only the start of its segment. */
+  shm = page->shm_data.shm;
+  cnt = shm->page_cnt;
+  for (i = 0; i < cnt; i++)
+    {
+      page = vm_lookup_page ((uint8_t *) addr + i * PGSIZE);
+      if (page == NULL || page->type != SHM || page->shm_data.shm != shm
+          || page->shm_data.index != i)
+        break;
+      vm_free_page (page);
+    }
+  return true;
+}
+
+/* Removes the name NAME of a segment, so that vm_shm_map() with
+   the same name creates a new one.  The segment itself goes away
+   once it is no longer mapped.  Returns false if there is no
+   segment named NAME. */
+bool
+vm_shm_unlink (const char *name)
+{
+  struct vm_shm *shm;
+
+  lock_acquire (&shm_lock);
+  shm = find_shm (name);
+  if (shm != NULL)
+    {
+      list_remove (&shm->elem);
+      shm->named = false;
+    }
+  lock_release (&shm_lock);
+
+  if (shm != NULL)
+    vm_shm_release (shm);
+  return shm != NULL;
+}
+
+/* Adds a reference to SHM, for a new page that maps it. */
+void
+vm_shm_ref (struct vm_shm *shm)
+{
+  lock_acquire (&shm_lock);
+  ASSERT (shm->ref_cnt > 0);
+  shm->ref_cnt++;
+  lock_release (&shm_lock);
+}
+
+/* Drops a reference to SHM, freeing it with its frames and swap
+   slots if it was the last.  The page that held the reference
+   must already be out of its frame. */
+void
+vm_shm_release (struct vm_shm *shm)
+{
+  lock_acquire (&shm_lock);
+  ASSERT (shm->ref_cnt > 0);
+  if (--shm->ref_cnt == 0)
+    destroy_shm (shm);
+  lock_release (&shm_lock);
+}
+
+/* Returns the frame holding page INDEX of SHM, pinned, to be
+   mapped by a page of the current process.  The page is found in
+   a frame if another mapping has it in memory; otherwise a frame
+   is filled from the segment's swap slot or with zeros.  *MINOR is
+   set to false if the page had to be read from swap.  Returns with
+   the shared memory lock held, so that no other mapping of the
+   page starts or stops using the frame before the caller has
+   added its page to the frame and mapped it: the caller must then
+   call vm_shm_unlock_page().  If no frame can be found, returns
+   a null pointer without the lock. */
+void *
+vm_shm_lock_page (struct vm_shm *shm, size_t index, bool *minor)
+{
+  struct vm_shm_page *sp = &shm->pages[index];
+  void *kpage;
+
+  ASSERT (index < shm->page_cnt);
+  lock_acquire (&shm_lock);
+  for (;;)
+    {
+      kpage = vm_frame_lookup_shm (sp);
+      if (kpage != NULL)
+        {
+          *minor = true;
+          return kpage;
+        }
+      if (!sp->busy)
+        break;
+      cond_wait (&shm_cond, &shm_lock);
+    }
+
+  /* Finding a frame may evict, even another page of this segment,
+     which takes the lock, so the page is loaded without it. */
+  sp->busy = true;
+  lock_release (&shm_lock);
+  kpage = vm_get_frame (PAL_USER | (sp->in_swap ? 0 : PAL_ZERO));
+  if (kpage == NULL)
+    {
+      lock_acquire (&shm_lock);
+      sp->busy = false;
+      cond_broadcast (&shm_cond, &shm_lock);
+      lock_release (&shm_lock);
+      return NULL;
+    }
+  if (sp->in_swap)
+    vm_swap_load (sp->swap_index, kpage);
+  *minor = !sp->in_swap;
+
+  lock_acquire (&shm_lock);
+  vm_frame_set_shm (kpage, sp);
+  sp->busy = false;
+  cond_broadcast (&shm_cond, &shm_lock);
+  return kpage;
+}
+
+/* Releases the lock taken by vm_shm_lock_page(). */
+void
+vm_shm_unlock_page (void)
+{
+  lock_release (&shm_lock);
+}
+
+/* Ends the eviction of segment page SP from frame KPAGE, whose
+   mappings have all been unmapped.  If any of them wrote to it,
+   as DIRTY tells, or one that is gone did, the contents go to a
+   new swap slot, which replaces the old one.  Otherwise the old
+   slot, or zeros if there is none, still holds them. */
+void
+vm_shm_evicted (struct vm_shm_page *sp, void *kpage, bool dirty)
+{
+  size_t index = 0;
+
+  /* Until SP stops being busy nothing else looks at it. */
+  dirty = dirty || sp->dirty;
+  if (dirty)
+    index = vm_swap_store (kpage);
+
+  lock_acquire (&shm_lock);
+  if (dirty)
+    {
+      if (sp->in_swap)
+        vm_swap_free (sp->swap_index);
+      sp->swap_index = index;
+      sp->in_swap = true;
+      sp->dirty = false;
+    }
+  sp->busy = false;
+  cond_broadcast (&shm_cond, &shm_lock);
+  lock_release (&shm_lock);
+}
+
+/* Returns the named segment NAME, or a null pointer if there is
+   none.  Must be called with shm_lock held. */
+static struct vm_shm *
+find_shm (const char *name)
+{
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&shm_lock));
+  for (e = list_begin (&shm_list); e != list_end (&shm_list);
+       e = list_next (e))
+    {
+      struct vm_shm *shm = list_entry (e, struct vm_shm, elem);
+      if (!strcmp (shm->name, name))
+        return shm;
+    }
+  return NULL;
+}
+
+/* Creates a segment named NAME of PAGE_CNT zeroed pages, with the
+   reference of its name.  Returns a null pointer if NAME is too
+   long or memory is exhausted.  Must be called with shm_lock
+   held. */
+static struct vm_shm *
+create_shm (const char *name, size_t page_cnt)
+{
+  struct vm_shm *shm;
+
+  ASSERT (lock_held_by_current_thread (&shm_lock));
+  if (strlen (name) > SHM_NAME_MAX)
+    return NULL;
+  shm = malloc (sizeof *shm);
+  if (shm == NULL)
+    return NULL;
+  shm->pages = calloc (page_cnt, sizeof *shm->pages);
+  if (shm->pages == NULL)
+    {
+      free (shm);
+      return NULL;
+    }
+  strlcpy (shm->name, name, sizeof shm->name);
+  shm->named = true;
+  shm->page_cnt = page_cnt;
+  shm->ref_cnt = 1;
+  list_push_back (&shm_list, &shm->elem);
+  return shm;
+}
+
+/* Frees SHM, which nothing refers to any longer, with the frames
+   and swap slots of its pages.  A page that an eviction is saving
+   is waited for first.  Must be called with shm_lock held. */
+static void
+destroy_shm (struct vm_shm *shm)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&shm_lock));
+  for (i = 0; i < shm->page_cnt; i++)
+    {
+      struct vm_shm_page *sp = &shm->pages[i];
+
+      do
+        while (sp->busy)
+          cond_wait (&shm_cond, &shm_lock);
+      while (!vm_frame_free_shm (sp));
+      if (sp->in_swap)
+        vm_swap_free (sp->swap_index);
+    }
+  free (shm->pages);
+  free (shm);
+}
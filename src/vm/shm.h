@@ -0,0 +1,55 @@
+#ifndef VM_SHM_H
+#define VM_SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Named shared memory.
+
+   A segment is a run of anonymous pages with a name, which any
+   process may map with vm_shm_map().  The vm_pages of all its
+   mappings share the frame that holds each of its pages, as the
+   pages of a fork share theirs, and stores through one mapping
+   are seen through all the others.  When the frame is evicted,
+   its contents are saved once, to a swap slot that belongs to
+   the segment rather than to any of the mappings, and the next
+   fault through any mapping brings it back.  A segment lives
+   until it is unlinked and no page maps it any longer. */
+
+/* Longest name of a segment. */
+#define SHM_NAME_MAX 14
+
+/* Most pages in a segment. */
+#define SHM_MAX_PAGES 1024
+
+/* A page of a segment.  KPAGE is set and cleared with the frame
+   table's lock held, and so is BUSY when an eviction starts.
+   DIRTY is set with the eviction lock held, when a mapping that
+   wrote to the frame is dropped.  The rest is protected by the
+   lock of vm/shm.c. */
+struct vm_shm_page
+  {
+    void *kpage;                /* Frame holding the page, or null. */
+    size_t swap_index;          /* Swap slot, if IN_SWAP. */
+    bool in_swap;               /* Does SWAP_INDEX hold the page? */
+    bool dirty;                 /* Written through a dropped mapping? */
+    bool busy;                  /* Being loaded or evicted? */
+  };
+
+struct vm_shm;
+
+void vm_shm_init (void);
+bool vm_shm_map (const char *name, size_t size, void *addr);
+bool vm_shm_unmap (void *addr);
+bool vm_shm_unlink (const char *name);
+
+/* Reference counting by the pages that map a segment. */
+void vm_shm_ref (struct vm_shm *);
+void vm_shm_release (struct vm_shm *);
+
+/* Loading and eviction. */
+void *vm_shm_lock_page (struct vm_shm *, size_t index, bool *minor);
+void vm_shm_unlock_page (void);
+void vm_shm_evicted (struct vm_shm_page *, void *kpage, bool dirty);
+
+#endif /* vm/shm.h */
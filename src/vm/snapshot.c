@@ -0,0 +1,550 @@
+/* Process snapshots.
+
+   See snapshot.h for basic information.
+
+   A snapshot file starts with a header, followed by the runs of
+   the address space, the open descriptors and the memory
+   mappings, and then, from the next page boundary on, the data
+   of the saved pages in address order.  A run is a range of
+   consecutive pages with the same protection that either all
+   have data, a page each in the file, or are all zero pages the
+   process never touched, which take no room.  The file is
+   written front to back, SNAPSHOT_BATCH pages per write, so its
+   data lies in the order it is mapped back in.
+
+   Descriptors and mappings are saved by inode number, not by
+   name, so a snapshot must be restored while the files they
+   refer to exist.  Pipes, shared memory and the state of the FPU
+   are not saved, and a process running more than one thread
+   cannot be saved. */
+
+#include "vm/snapshot.h"
+#include <debug.h>
+#include <round.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/flags.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/gdt.h"
+#include "userprog/process.h"
+#include "userprog/syscall.h"
+#include "userprog/uaccess.h"
+#include "vm/mmap.h"
+#include "vm/page.h"
+
+/* Identifies a snapshot file: "SNAP". */
+#define SNAPSHOT_MAGIC 0x50414e53
+
+/* Pages of data written to the file at a time. */
+#define SNAPSHOT_BATCH 8
+
+/* Most bytes of metadata before the data. */
+#define SNAPSHOT_META_MAX (16 * PGSIZE)
+
+/* Flags of EFLAGS that user code may set: CF, PF, AF, ZF, SF, DF
+   and OF. */
+#define USER_FLAGS 0x00000cd5
+
+/* The start of a snapshot file. */
+struct snapshot_header
+  {
+    uint32_t magic;             /* SNAPSHOT_MAGIC. */
+    char name[16];              /* Name of the process. */
+    struct intr_frame frame;    /* User context in snapshot(). */
+    uint8_t *heap_start;        /* Start of the heap. */
+    uint8_t *heap_end;          /* End of the heap. */
+    block_sector_t cwd;         /* Inode of the working directory. */
+    uint32_t run_cnt;           /* Number of runs. */
+    uint32_t fd_cnt;            /* Number of open descriptors. */
+    uint32_t mfile_cnt;         /* Number of memory mappings. */
+  };
+
+/* A run of pages. */
+struct snapshot_run
+  {
+    uint8_t *start;             /* First user page. */
+    uint32_t page_cnt;          /* Number of pages. */
+    bool writable;              /* Are the pages writable? */
+    bool zero;                  /* Zero, with no data in the file? */
+  };
+
+/* An open descriptor. */
+struct snapshot_fd
+  {
+    int fd;                     /* Descriptor, in increasing order. */
+    block_sector_t inumber;     /* Inode of the open file. */
+    off_t pos;                  /* Current position. */
+    bool append;                /* Opened with O_APPEND? */
+  };
+
+/* A memory mapping. */
+struct snapshot_mfile
+  {
+    uint8_t *start;             /* First user page of the mapping. */
+    block_sector_t inumber;     /* Inode of the mapped file. */
+  };
+
+/* The parts of a snapshot's metadata, which is kept in one block
+   of memory laid out as at the start of the file. */
+struct snapshot_meta
+  {
+    struct snapshot_header *header;
+    struct snapshot_run *runs;
+    struct snapshot_fd *fds;
+    struct snapshot_mfile *mfiles;
+  };
+
+/* A page of the address space being saved. */
+struct saved_page
+  {
+    uint8_t *addr;              /* User page. */
+    bool writable;              /* Is it writable? */
+    bool zero;                  /* Never touched and zero? */
+  };
+
+static size_t meta_size (const struct snapshot_header *);
+static void meta_layout (struct snapshot_meta *, void *block);
+static bool collect_pages (struct saved_page **, size_t *cnt);
+static int compare_pages (const void *, const void *);
+static size_t make_runs (const struct saved_page *, size_t cnt,
+                         struct snapshot_run *);
+static void save_descriptors (struct snapshot_meta *);
+static bool save_pages (struct file *, const struct saved_page *,
+                        size_t cnt, uint8_t *buf, off_t ofs);
+static bool map_runs (struct file *, const struct snapshot_meta *,
+                      off_t ofs);
+static bool open_fds (const struct snapshot_meta *);
+static bool map_mfiles (const struct snapshot_meta *);
+
+/* Saves the current process, which called snapshot() with user
+   context F, to a new file named FILE_NAME.  Pages not yet
+   created that a region would read from its file are read into
+   memory to be saved, and so are the swapped-out pages.  Returns
+   false, leaving no file behind, if FILE_NAME exists, the
+   process runs other threads, its metadata would not fit in
+   SNAPSHOT_META_MAX bytes, or the file cannot be written. */
+bool
+vm_snapshot_save (const char *file_name, const struct intr_frame *f)
+{
+  struct thread *t = process_current ();
+  struct snapshot_header h;
+  struct snapshot_meta m;
+  struct saved_page *pages;
+  struct file *file = NULL;
+  uint8_t *block = NULL;
+  uint8_t *buf = NULL;
+  size_t page_cnt, size;
+  bool created = false;
+  bool success = false;
+  int fd;
+
+  if (t->thread_cnt > 0 || !collect_pages (&pages, &page_cnt))
+    return false;
+
+  memset (&h, 0, sizeof h);
+  h.magic = SNAPSHOT_MAGIC;
+  strlcpy (h.name, t->name, sizeof h.name);
+  h.frame = *f;
+  h.heap_start = t->heap_start;
+  h.heap_end = t->heap_end;
+  h.cwd = (t->cwd != NULL ? inode_get_inumber (dir_get_inode (t->cwd))
+           : ROOT_DIR_SECTOR);
+  h.run_cnt = make_runs (pages, page_cnt, NULL);
+  for (fd = 0; fd < t->fd_cnt; fd++)
+    if (t->fds[fd].file != NULL)
+      h.fd_cnt++;
+  h.mfile_cnt = t->mfile_cnt;
+  size = ROUND_UP (meta_size (&h), PGSIZE);
+  if (size > SNAPSHOT_META_MAX)
+    goto done;
+
+  /* The metadata is written out to the page boundary, so that the
+     file has no hole before the data. */
+  block = calloc (1, size);
+  buf = palloc_get_multiple (0, SNAPSHOT_BATCH);
+  if (block == NULL || buf == NULL)
+    goto done;
+  memcpy (block, &h, sizeof h);
+  meta_layout (&m, block);
+  make_runs (pages, page_cnt, m.runs);
+  save_descriptors (&m);
+
+  created = filesys_create (file_name, 0);
+  if (created)
+    file = filesys_open (file_name);
+  success = (file != NULL
+             && file_write_at (file, block, size, 0) == (off_t) size
+             && save_pages (file, pages, page_cnt, buf, size));
+
+ done:
+  file_close (file);
+  if (created && !success)
+    filesys_remove (file_name);
+  if (buf != NULL)
+    palloc_free_multiple (buf, SNAPSHOT_BATCH);
+  free (block);
+  free (pages);
+  return success;
+}
+
+/* Sets up the current process, which has an empty page table and
+   regions, from snapshot FILE, and stores in F the user context
+   to resume.  FILE must stay open while the process runs, with
+   writes denied, as its executable would.  Returns false if FILE
+   is not a valid snapshot, a file it refers to cannot be opened
+   or memory is exhausted; the process must then exit, which
+   frees what was set up. */
+bool
+vm_snapshot_load (struct file *file, struct intr_frame *f)
+{
+  struct thread *t = process_current ();
+  struct snapshot_header h;
+  struct snapshot_meta m;
+  void *block = NULL;
+  size_t size;
+  bool success = false;
+
+  if (file_read_at (file, &h, sizeof h, 0) != (off_t) sizeof h
+      || h.magic != SNAPSHOT_MAGIC || h.run_cnt > SNAPSHOT_META_MAX
+      || h.fd_cnt > FD_MAX || h.mfile_cnt > SNAPSHOT_META_MAX
+      || h.heap_start > h.heap_end || h.heap_end > (uint8_t *) PHYS_BASE)
+    return false;
+  size = meta_size (&h);
+  if (size > SNAPSHOT_META_MAX)
+    return false;
+  block = malloc (size);
+  if (block == NULL || file_read_at (file, block, size, 0) != (off_t) size)
+    goto done;
+  meta_layout (&m, block);
+
+  if (h.cwd != ROOT_DIR_SECTOR)
+    {
+      struct inode *inode = inode_open (h.cwd);
+
+      if (inode == NULL || !inode_is_dir (inode))
+        {
+          inode_close (inode);
+          goto done;
+        }
+      t->cwd = dir_open (inode);
+      if (t->cwd == NULL)
+        goto done;
+    }
+  if (!map_runs (file, &m, ROUND_UP (size, PGSIZE))
+      || !open_fds (&m) || !map_mfiles (&m))
+    goto done;
+  t->heap_start = h.heap_start;
+  t->heap_end = h.heap_end;
+  h.name[sizeof h.name - 1] = '\0';
+  strlcpy (t->name, h.name, sizeof t->name);
+
+  /* Only the registers are taken from the file: the segments and
+     the privileged flags are those of any user process.  The
+     restored process sees snapshot() return 1. */
+  *f = h.frame;
+  f->cs = SEL_UCSEG;
+  f->gs = f->fs = f->es = f->ds = f->ss = SEL_UDSEG;
+  f->eflags = (h.frame.eflags & USER_FLAGS) | FLAG_IF | FLAG_MBS;
+  f->eax = 1;
+  success = true;
+
+ done:
+  free (block);
+  return success;
+}
+
+/* Returns the bytes of metadata of a snapshot with header H. */
+static size_t
+meta_size (const struct snapshot_header *h)
+{
+  return (sizeof *h + h->run_cnt * sizeof (struct snapshot_run)
+          + h->fd_cnt * sizeof (struct snapshot_fd)
+          + h->mfile_cnt * sizeof (struct snapshot_mfile));
+}
+
+/* Points M to the parts of the metadata in BLOCK, which starts
+   with its header. */
+static void
+meta_layout (struct snapshot_meta *m, void *block)
+{
+  m->header = block;
+  m->runs = (struct snapshot_run *) (m->header + 1);
+  m->fds = (struct snapshot_fd *) (m->runs + m->header->run_cnt);
+  m->mfiles = (struct snapshot_mfile *) (m->fds + m->header->fd_cnt);
+}
+
+/* Stores in *PAGES a new array of the pages of the current
+   process to be saved, sorted by address, and their number in
+   *CNT: the pages in its page table and those of its regions
+   not created yet, but neither memory mappings nor shared
+   memory.  Returns false if memory is exhausted. */
+static bool
+collect_pages (struct saved_page **pages, size_t *cnt)
+{
+  struct thread *t = process_current ();
+  size_t cap = hash_size (&t->vm_pages);
+  struct hash_iterator i;
+  struct list_elem *e;
+  struct saved_page *p;
+
+  for (e = list_begin (&t->vm_regions); e != list_end (&t->vm_regions);
+       e = list_next (e))
+    {
+      struct vm_region *r = list_entry (e, struct vm_region, elem);
+      if (!r->mapped)
+        cap += pg_no (r->end) - pg_no (r->start);
+    }
+  *pages = p = malloc ((cap > 0 ? cap : 1) * sizeof *p);
+  if (p == NULL)
+    return false;
+
+  /* A region page not created yet would be read from the file
+     or zeroed, as the region says. */
+  for (e = list_begin (&t->vm_regions); e != list_end (&t->vm_regions);
+       e = list_next (e))
+    {
+      struct vm_region *r = list_entry (e, struct vm_region, elem);
+      uint8_t *upage;
+
+      if (r->mapped)
+        continue;
+      for (upage = r->start; upage < (uint8_t *) r->end; upage += PGSIZE)
+        if (vm_lookup_page (upage) == NULL)
+          {
+            p->addr = upage;
+            p->writable = r->writable;
+            p->zero = (size_t) (upage - (uint8_t *) r->start) >= r->read_bytes;
+            p++;
+          }
+    }
+
+  hash_first (&i, &t->vm_pages);
+  while (hash_next (&i))
+    {
+      struct vm_page *page = hash_entry (hash_cur (&i), struct vm_page,
+                                         spt_elem);
+
+      if (page->type == SHM
+          || (page->type == FILE && page->file_data.mapped))
+        continue;
+      p->addr = page->addr;
+      p->writable = page->writable;
+      p->zero = page->type == ZERO && !page->loaded;
+      p++;
+    }
+
+  *cnt = p - *pages;
+  qsort (*pages, *cnt, sizeof **pages, compare_pages);
+  return true;
+}
+
+/* Orders saved pages by address. */
+static int
+compare_pages (const void *a_, const void *b_)
+{
+  const struct saved_page *a = a_;
+  const struct saved_page *b = b_;
+
+  return a->addr < b->addr ? -1 : a->addr > b->addr;
+}
+
+/* Groups the CNT PAGES, sorted by address, into runs, which are
+   stored in RUNS unless it is null, and returns their number. */
+static size_t
+make_runs (const struct saved_page *pages, size_t cnt,
+           struct snapshot_run *runs)
+{
+  size_t run_cnt = 0;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      const struct saved_page *p = &pages[i];
+
+      if (i == 0 || p->addr != p[-1].addr + PGSIZE
+          || p->writable != p[-1].writable || p->zero != p[-1].zero)
+        {
+          if (runs != NULL)
+            {
+              runs[run_cnt].start = p->addr;
+              runs[run_cnt].page_cnt = 0;
+              runs[run_cnt].writable = p->writable;
+              runs[run_cnt].zero = p->zero;
+            }
+          run_cnt++;
+        }
+      if (runs != NULL)
+        runs[run_cnt - 1].page_cnt++;
+    }
+  return run_cnt;
+}
+
+/* Records in M the open files and memory mappings of the current
+   process, as many as M's header says. */
+static void
+save_descriptors (struct snapshot_meta *m)
+{
+  struct thread *t = process_current ();
+  struct snapshot_fd *sfd = m->fds;
+  size_t i;
+  int fd;
+
+  for (fd = 0; fd < t->fd_cnt; fd++)
+    {
+      struct file *file = t->fds[fd].file;
+
+      if (file == NULL)
+        continue;
+      sfd->fd = fd;
+      sfd->inumber = inode_get_inumber (file_get_inode (file));
+      sfd->pos = file_tell (file);
+      sfd->append = file_is_append (file);
+      sfd++;
+    }
+  for (i = 0; i < m->header->mfile_cnt; i++)
+    {
+      struct vm_mfile *mf = t->mfiles[i];
+
+      m->mfiles[i].start = mf->start_addr;
+      m->mfiles[i].inumber = inode_get_inumber (file_get_inode (mf->file));
+    }
+}
+
+/* Writes the data of the CNT PAGES, sorted by address, to FILE
+   from offset OFS on, skipping zero pages.  The pages are
+   copied from user memory into BUF, which holds SNAPSHOT_BATCH
+   pages, and written a full BUF at a time.  Returns false if a
+   write falls short. */
+static bool
+save_pages (struct file *file, const struct saved_page *pages, size_t cnt,
+            uint8_t *buf, off_t ofs)
+{
+  size_t batch = 0;
+  size_t i;
+
+  for (i = 0; i <= cnt; i++)
+    {
+      off_t size = batch * PGSIZE;
+
+      if (batch == SNAPSHOT_BATCH || (i == cnt && batch > 0))
+        {
+          if (file_write_at (file, buf, size, ofs) != size)
+            return false;
+          ofs += size;
+          batch = 0;
+        }
+      if (i < cnt && !pages[i].zero)
+        {
+          if (!copy_from_user (buf + batch * PGSIZE, pages[i].addr, PGSIZE))
+            return false;
+          batch++;
+        }
+    }
+  return true;
+}
+
+/* Declares each run of M as a region of the current process,
+   reading the data of the runs that have some from FILE, the
+   first at offset OFS.  Returns false if the runs overlap or
+   leave user memory, the data is past the end of FILE, or
+   memory is exhausted. */
+static bool
+map_runs (struct file *file, const struct snapshot_meta *m, off_t ofs)
+{
+  off_t length = file_length (file);
+  uint8_t *prev_end = NULL;
+  size_t i;
+
+  for (i = 0; i < m->header->run_cnt; i++)
+    {
+      const struct snapshot_run *r = &m->runs[i];
+      size_t size = r->page_cnt * PGSIZE;
+
+      if (r->start == NULL || pg_ofs (r->start) != 0 || r->start < prev_end
+          || !is_user_vaddr (r->start) || r->page_cnt == 0
+          || r->page_cnt > pg_no (PHYS_BASE) - pg_no (r->start))
+        return false;
+      prev_end = r->start + size;
+      if (r->zero)
+        {
+          if (!vm_new_region (r->start, r->page_cnt, file, 0, 0,
+                              r->writable, false))
+            return false;
+          continue;
+        }
+      if (ofs > length || (size_t) (length - ofs) < size
+          || !vm_new_region (r->start, r->page_cnt, file, ofs, size,
+                             r->writable, false))
+        return false;
+      ofs += size;
+    }
+  return true;
+}
+
+/* Reopens the descriptors of M in the current process, at their
+   saved positions.  Returns false if they are out of order, a
+   file cannot be opened or memory is exhausted. */
+static bool
+open_fds (const struct snapshot_meta *m)
+{
+  struct thread *t = process_current ();
+  size_t cnt = m->header->fd_cnt;
+  int prev = -1;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      if (m->fds[i].fd <= prev || m->fds[i].fd >= FD_MAX)
+        return false;
+      prev = m->fds[i].fd;
+    }
+  if (cnt == 0)
+    return true;
+
+  t->fds = calloc (prev + 1, sizeof *t->fds);
+  if (t->fds == NULL)
+    return false;
+  t->fd_cnt = prev + 1;
+  for (i = 0; i < cnt; i++)
+    {
+      struct file *file = file_open (inode_open (m->fds[i].inumber));
+
+      if (file == NULL)
+        return false;
+      file_seek (file, m->fds[i].pos);
+      file_set_append (file, m->fds[i].append);
+      t->fds[m->fds[i].fd].file = file;
+    }
+  return true;
+}
+
+/* Maps the files of the memory mappings of M in the current
+   process again.  Returns false if a file cannot be opened or
+   mapped. */
+static bool
+map_mfiles (const struct snapshot_meta *m)
+{
+  size_t i;
+
+  for (i = 0; i < m->header->mfile_cnt; i++)
+    {
+      struct file *file = file_open (inode_open (m->mfiles[i].inumber));
+      mapid_t mapid;
+
+      if (file == NULL)
+        return false;
+      mapid = vm_insert_mfile (file, m->mfiles[i].start);
+      file_close (file);
+      if (mapid == MAP_FAILED)
+        return false;
+    }
+  return true;
+}
@@ -0,0 +1,22 @@
+#ifndef VM_SNAPSHOT_H
+#define VM_SNAPSHOT_H
+
+#include <stdbool.h>
+
+/* Process snapshots.
+
+   vm_snapshot_save() writes the address space, user registers,
+   descriptors and memory mappings of the current process to a
+   new file, which vm_snapshot_load() turns back into a process
+   later, even after a reboot.  Loading reads no page: the saved
+   pages become regions of the snapshot file, like the segments
+   of an executable, so a restored process only reads the pages
+   it touches.  See vm/snapshot.c for the file's layout. */
+
+struct file;
+struct intr_frame;
+
+bool vm_snapshot_save (const char *file_name, const struct intr_frame *);
+bool vm_snapshot_load (struct file *, struct intr_frame *);
+
+#endif /* vm/snapshot.h */
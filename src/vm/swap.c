@@ -1,92 +1,447 @@
 #include "vm/swap.h"
+#include "vm/zswap.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <bitmap.h>
+#include <round.h>
 #include "devices/block.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
 
 #define BLOCKS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
 
-static struct block *swap_block;
+/* Swap is managed as an array of page-sized slots, so every
+   transfer is page aligned.  A swap index is a slot number.
+
+   Slots below SLOT_TOP have been handed out at least once; the
+   free ones among them are kept on FREE_SLOTS, a stack.  Slots
+   from SLOT_TOP up have never been used and form one contiguous
+   free extent.  Both allocation and release are O(1).
+
+   The contents of a slot are kept compressed in memory when
+   vm/zswap.c has room for them, and only go to disk when it has
+   not, so a transfer of consecutive slots is split into the runs
+   of them that are on disk.
+
+   Slots are striped across all the swap devices, one page at a
+   time: slot I is slot I / DEV_CNT of device I % DEV_CNT.  A run
+   of consecutive slots thus becomes one transfer per device, and
+   the transfers are carried out at the same time.  Devices are
+   ordered so that neighbours are on different controller
+   channels where possible, since devices on one channel cannot
+   transfer at once.  Each device contributes as many slots as the
+   smallest one has. */
+static struct block *devs[SWAP_DEV_MAX];
+static size_t dev_cnt;
 static struct lock swap_lock;
 
-static struct bitmap *swap_map;
-static unsigned swap_size;
+static struct bitmap *swap_map;     /* Slots in use, for checking. */
+static size_t slot_cnt;             /* Number of slots. */
+static size_t slot_top;             /* First never-used slot. */
+static size_t *free_slots;          /* Stack of released slots. */
+static size_t free_cnt;             /* Number of entries in FREE_SLOTS. */
+static struct vm_page **slot_pages; /* Page stored in each used slot. */
+
+/* Bounce buffer that gathers a cluster of pages so that they can
+   be written with a single transfer, and the lock that guards
+   it. */
+static uint8_t *cluster_buf;
+static struct lock cluster_lock;
+
+static size_t slot_alloc (void);
+static struct block *slot_to_block (size_t);
+static block_sector_t slot_to_sector (size_t);
+static void order_devices (void);
+static int compare_index (const void *, const void *);
+static void transfer_run (size_t index, size_t cnt, void **pages,
+                          bool write);
+
+/* Adds BLOCK to the swap devices.  Must be called before
+   vm_swap_init(), which adds the device in the swap role itself,
+   if there is one and it has not been added.  Returns false if
+   there are SWAP_DEV_MAX devices already. */
+bool
+vm_swap_add_device (struct block *block)
+{
+  size_t i;
+
+  for (i = 0; i < dev_cnt; i++)
+    if (devs[i] == block)
+      return true;
+  if (dev_cnt >= SWAP_DEV_MAX)
+    return false;
+  devs[dev_cnt++] = block;
+  return true;
+}
 
 /* Initialise swap table. */
 void
 vm_swap_init ()
 {
-  swap_block = block_get_role (BLOCK_SWAP);
-  lock_init (&swap_lock);  
+  size_t dev_slots = 0;
+  size_t i;
 
-  swap_size = block_size (swap_block); 
-  swap_map = bitmap_create (swap_size);
+  lock_init_named (&swap_lock, "swap");  
+  if (block_get_role (BLOCK_SWAP) != NULL)
+    vm_swap_add_device (block_get_role (BLOCK_SWAP));
+  order_devices ();
+
+  for (i = 0; i < dev_cnt; i++)
+    {
+      size_t cnt = block_size (devs[i]) / BLOCKS_PER_PAGE;
+      if (i == 0 || cnt < dev_slots)
+        dev_slots = cnt;
+    }
+  slot_cnt = dev_slots * dev_cnt;
+  swap_map = bitmap_create (slot_cnt);
+  free_slots = malloc (slot_cnt * sizeof *free_slots);
+  slot_pages = calloc (slot_cnt, sizeof *slot_pages);
+  if (swap_map == NULL
+      || ((free_slots == NULL || slot_pages == NULL) && slot_cnt > 0))
+    PANIC ("couldn't allocate swap table");
+  slot_top = 0;
+  free_cnt = 0;
+
+  lock_init_named (&cluster_lock, "cluster");
+  cluster_buf = palloc_get_multiple (PAL_ASSERT, SWAP_CLUSTER);
+  vm_zswap_init (slot_cnt);
 }
 
 /* Loads a page from the swap to main memory. */
 void
 vm_swap_load (size_t index, void *addr)
 {
+  /* Make sure the index is valid.  The slot belongs to the
+     caller, so the transfer itself needs no lock. */
   lock_acquire (&swap_lock);
- 
-  size_t ofs; 
-  for (ofs = 0; ofs < BLOCKS_PER_PAGE; ++ofs)
-    {
-      /* Make sure the index is valid. */
-      ASSERT (index < swap_size);
-      ASSERT ( bitmap_test (swap_map, index) );
+  ASSERT (index < slot_cnt);
+  ASSERT (bitmap_test (swap_map, index));
+  lock_release (&swap_lock); 
+
+  if (!vm_zswap_load (index, addr))
+    block_read_multi (slot_to_block (index), slot_to_sector (index),
+                      BLOCKS_PER_PAGE, addr);
+}
 
-      block_read (swap_block, index, addr + ofs * BLOCK_SECTOR_SIZE);
-      ++index;
+/* Loads the CNT consecutive slots starting at INDEX into the
+   pages in PAGES, with a single transfer for each run of them
+   that is on disk. */
+void
+vm_swap_load_batch (size_t index, size_t cnt, void **pages)
+{
+  bool on_disk[SWAP_CLUSTER];
+  size_t i, j;
+
+  ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+  if (cnt == 1)
+    {
+      vm_swap_load (index, pages[0]);
+      return;
     }
 
-  lock_release (&swap_lock); 
-}
+  lock_acquire (&swap_lock);
+  ASSERT (index + cnt <= slot_cnt);
+  for (i = 0; i < cnt; i++)
+    ASSERT (bitmap_test (swap_map, index + i));
+  lock_release (&swap_lock);
 
+  for (i = 0; i < cnt; i++)
+    on_disk[i] = !vm_zswap_load (index + i, pages[i]);
+  for (i = 0; i < cnt; i = j)
+    {
+      for (j = i; j < cnt && on_disk[j]; j++)
+        continue;
+      if (j > i)
+        transfer_run (index + i, j - i, pages + i, false);
+      else
+        j++;
+    }
+}
 
 /* Stores a page from main memory to swap disk. */
 size_t
 vm_swap_store (void *addr)
 {
+  size_t index;
+
   lock_acquire (&swap_lock);
-  size_t index = bitmap_scan_and_flip (swap_map, 0, BLOCKS_PER_PAGE, false);
+  index = slot_alloc ();
+  lock_release (&swap_lock);
 
-  /* We must have a page at the given index. */
-  ASSERT (index != BITMAP_ERROR);
+  if (!vm_zswap_store (index, addr))
+    block_write_multi (slot_to_block (index), slot_to_sector (index),
+                       BLOCKS_PER_PAGE, addr);
+  return index;
+} 
 
-  size_t ofs, ind = index;
-  for (ofs = 0; ofs < BLOCKS_PER_PAGE; ++ofs)
-    {
-      /* Make sure the index is valid. */
-      ASSERT (index < swap_size);
-      ASSERT ( bitmap_test (swap_map, ind) );
+/* Stores the CNT pages in PAGES to swap, setting INDICES[i] to
+   the swap index of PAGES[i].  When enough never-used slots
+   remain the pages are placed in them back to back, and each run
+   of them that does not fit in memory is written with one
+   multi-sector transfer; otherwise they are stored one by one. */
+void
+vm_swap_store_batch (void **pages, size_t cnt, size_t *indices)
+{
+  bool on_disk[SWAP_CLUSTER];
+  size_t index;
+  size_t i, j;
 
-      block_write (swap_block, ind, addr + ofs * BLOCK_SECTOR_SIZE);
-      ++ind;
+  ASSERT (cnt <= SWAP_CLUSTER);
+  if (cnt == 0)
+    return;
+
+  lock_acquire (&swap_lock);
+  if (cnt == 1 || slot_cnt - slot_top < cnt)
+    {
+      lock_release (&swap_lock);
+      for (i = 0; i < cnt; i++)
+        indices[i] = vm_swap_store (pages[i]);
+      return;
     }
+  index = slot_top;
+  slot_top += cnt;
+  bitmap_set_multiple (swap_map, index, cnt, true);
   lock_release (&swap_lock);
 
-  return index;
-} 
+  for (i = 0; i < cnt; i++)
+    {
+      indices[i] = index + i;
+      on_disk[i] = !vm_zswap_store (index + i, pages[i]);
+    }
+  for (i = 0; i < cnt; i = j)
+    {
+      for (j = i; j < cnt && on_disk[j]; j++)
+        continue;
+      if (j > i)
+        transfer_run (index + i, j - i, pages + i, true);
+      else
+        j++;
+    }
+}
+
+/* Stores the number of swap slots, of slots in use and of those
+   held in memory in STATS. */
+void
+vm_swap_get_kstat (struct kstat_mem *stats)
+{
+  lock_acquire (&swap_lock);
+  stats->swap_slots = slot_cnt;
+  stats->swap_used = slot_top - free_cnt;
+  lock_release (&swap_lock);
+  vm_zswap_get_kstat (stats);
+}
 
-/* Frees a swap frame. Sets the corresponding bit to zero. */
+/* Frees a swap slot. */
 void
 vm_swap_free (size_t index)
 {
   lock_acquire (&swap_lock);
   
-  size_t ofs;
-  for (ofs = 0; ofs < BLOCKS_PER_PAGE; ++ofs)
-    {
-      /* Make sure the index is valid. */
-      ASSERT (index < swap_size);
-      ASSERT ( bitmap_test (swap_map, index) );
+  /* Make sure the index is valid. */
+  ASSERT (index < slot_cnt);
+  ASSERT (bitmap_test (swap_map, index));
+
+  bitmap_reset (swap_map, index);
+  slot_pages[index] = NULL;
+  free_slots[free_cnt++] = index;
+  lock_release (&swap_lock);
+
+  vm_zswap_free (index);
+}
 
-      bitmap_reset (swap_map, index);
-      ++index;
+/* Frees the CNT swap slots in INDICES, which it sorts, under a
+   single acquisition of swap_lock.  Each run of consecutive
+   slots is cleared from the bitmap at once, and the slots are
+   pushed on the free stack so that they are handed out again in
+   ascending order. */
+void
+vm_swap_free_batch (size_t *indices, size_t cnt)
+{
+  size_t i, j;
+
+  if (cnt == 0)
+    return;
+  qsort (indices, cnt, sizeof *indices, compare_index);
+
+  lock_acquire (&swap_lock);
+  for (i = 0; i < cnt; i = j)
+    {
+      for (j = i + 1; j < cnt && indices[j] == indices[i] + (j - i); j++)
+        continue;
+      ASSERT (indices[j - 1] < slot_cnt);
+      ASSERT (bitmap_all (swap_map, indices[i], j - i));
+      bitmap_set_multiple (swap_map, indices[i], j - i, false);
+    }
+  for (i = cnt; i-- > 0; )
+    {
+      slot_pages[indices[i]] = NULL;
+      free_slots[free_cnt++] = indices[i];
     }
   lock_release (&swap_lock);
+
+  for (i = 0; i < cnt; i++)
+    vm_zswap_free (indices[i]);
+}
+
+/* Records that slot INDEX holds the contents of PAGE. */
+void
+vm_swap_set_page (size_t index, struct vm_page *page)
+{
+  lock_acquire (&swap_lock);
+  ASSERT (index < slot_cnt);
+  ASSERT (bitmap_test (swap_map, index));
+  slot_pages[index] = page;
+  lock_release (&swap_lock);
+}
+
+/* Returns the page stored in slot INDEX, or a null pointer if
+   INDEX is out of range, free or has no recorded owner. */
+struct vm_page *
+vm_swap_get_page (size_t index)
+{
+  struct vm_page *page = NULL;
+
+  lock_acquire (&swap_lock);
+  if (index < slot_cnt && bitmap_test (swap_map, index))
+    page = slot_pages[index];
+  lock_release (&swap_lock);
+  return page;
+}
+
+/* Returns a free slot, marking it used.  Released slots are
+   reused first, so that the never-used extent stays available
+   for clustered writes.  Panics if swap is full.
+   Must be called with swap_lock held. */
+static size_t
+slot_alloc (void)
+{
+  size_t index;
+
+  ASSERT (lock_held_by_current_thread (&swap_lock));
+  if (free_cnt > 0)
+    index = free_slots[--free_cnt];
+  else if (slot_top < slot_cnt)
+    index = slot_top++;
+  else
+    PANIC ("out of swap space");
+
+  ASSERT (!bitmap_test (swap_map, index));
+  bitmap_mark (swap_map, index);
+  return index;
+}
+
+/* Compares the swap indices that A and B point to, for
+   qsort(). */
+static int
+compare_index (const void *a_, const void *b_)
+{
+  const size_t *a = a_, *b = b_;
+
+  return *a < *b ? -1 : *a > *b;
+}
+
+/* Orders the swap devices so that, where possible, each is on a
+   different controller channel from the one before it: each
+   position takes the first remaining device whose channel
+   differs from the previous device's. */
+static void
+order_devices (void)
+{
+  size_t i, j;
+
+  for (i = 1; i < dev_cnt; i++)
+    for (j = i; j < dev_cnt; j++)
+      if (block_channel (devs[j]) < 0
+          || block_channel (devs[j]) != block_channel (devs[i - 1]))
+        {
+          struct block *block = devs[j];
+          memmove (devs + i + 1, devs + i, (j - i) * sizeof *devs);
+          devs[i] = block;
+          break;
+        }
+}
+
+/* Transfers the CNT consecutive slots starting at INDEX between
+   disk and the pages in PAGES, writing them if WRITE is true and
+   reading them otherwise.  The slots on each device are
+   consecutive there, so they are gathered in cluster_buf and
+   moved with one request per device, all submitted before
+   waiting for any. */
+static void
+transfer_run (size_t index, size_t cnt, void **pages, bool write)
+{
+  struct block_request reqs[SWAP_DEV_MAX];
+  size_t parts = cnt < dev_cnt ? cnt : dev_cnt;
+  uint8_t *part_buf[SWAP_DEV_MAX];
+  size_t i, p;
+
+  ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+  if (cnt == 1)
+    {
+      if (write)
+        block_write_multi (slot_to_block (index), slot_to_sector (index),
+                           BLOCKS_PER_PAGE, pages[0]);
+      else
+        block_read_multi (slot_to_block (index), slot_to_sector (index),
+                          BLOCKS_PER_PAGE, pages[0]);
+      return;
+    }
+
+  lock_acquire (&cluster_lock);
+
+  /* Slot INDEX + I is page I / DEV_CNT of part I % DEV_CNT. */
+  part_buf[0] = cluster_buf;
+  for (p = 1; p < parts; p++)
+    part_buf[p] = part_buf[p - 1] + DIV_ROUND_UP (cnt - (p - 1), dev_cnt)
+                                    * PGSIZE;
+  if (write)
+    for (i = 0; i < cnt; i++)
+      memcpy (part_buf[i % dev_cnt] + i / dev_cnt * PGSIZE, pages[i],
+              PGSIZE);
+
+  if (parts == 1)
+    {
+      if (write)
+        block_write_multi (slot_to_block (index), slot_to_sector (index),
+                           cnt * BLOCKS_PER_PAGE, cluster_buf);
+      else
+        block_read_multi (slot_to_block (index), slot_to_sector (index),
+                          cnt * BLOCKS_PER_PAGE, cluster_buf);
+    }
+  else
+    {
+      for (p = 0; p < parts; p++)
+        {
+          size_t page_cnt = DIV_ROUND_UP (cnt - p, dev_cnt);
+          block_request_init (&reqs[p], slot_to_sector (index + p),
+                              page_cnt * BLOCKS_PER_PAGE, part_buf[p],
+                              write);
+          block_submit (slot_to_block (index + p), &reqs[p]);
+        }
+      for (p = 0; p < parts; p++)
+        block_wait (&reqs[p]);
+    }
+
+  if (!write)
+    for (i = 0; i < cnt; i++)
+      memcpy (pages[i], part_buf[i % dev_cnt] + i / dev_cnt * PGSIZE,
+              PGSIZE);
+  lock_release (&cluster_lock);
+}
+
+/* Returns the device holding swap slot INDEX. */
+static struct block *
+slot_to_block (size_t index)
+{
+  return devs[index % dev_cnt];
+}
+
+/* Returns the first sector of swap slot INDEX on its device. */
+static block_sector_t
+slot_to_sector (size_t index)
+{
+  return index / dev_cnt * BLOCKS_PER_PAGE;
 }
@@ -4,11 +4,34 @@
 #include <stdbool.h>
 #include <stddef.h>
 
-/* Initialise swap table bitmap. */
+/* Maximum number of pages written to swap in one transfer. */
+#define SWAP_CLUSTER 8
+
+/* Maximum number of pages read in on a swap fault besides the
+   faulting one. */
+#define SWAP_READ_AROUND 7
+
+/* Most swap devices, whose slots are striped together. */
+#define SWAP_DEV_MAX 4
+
+struct block;
+struct vm_page;
+struct kstat_mem;
+
+/* Initialise swap table bitmap, on the devices added first. */
+bool vm_swap_add_device (struct block *);
 void vm_swap_init (void);
 /* Swap table operations. */
 void vm_swap_load (size_t, void *);
+void vm_swap_load_batch (size_t, size_t, void **);
 size_t vm_swap_store (void *);
+void vm_swap_store_batch (void **, size_t, size_t *);
 void vm_swap_free (size_t);
+void vm_swap_free_batch (size_t *, size_t cnt);
+/* Owner of a swap slot, for read-around. */
+void vm_swap_set_page (size_t, struct vm_page *);
+struct vm_page *vm_swap_get_page (size_t);
+/* Statistics. */
+void vm_swap_get_kstat (struct kstat_mem *);
 
 #endif /* vm/swap.h */
@@ -0,0 +1,362 @@
+#include "vm/zswap.h"
+#include <debug.h>
+#include <kstat.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A compressed cache in front of the swap device.
+
+   A page stored to a swap slot is first compressed into a block
+   on the kernel heap, which takes the place of the slot's
+   contents on disk.  A page of zeros needs no block at all and
+   is only marked as such.  Only when the page does not compress
+   to half a page or less, or when the blocks would take more of
+   the kernel pool than allowed, is the page written to disk.
+   Each slot keeps its place on the device either way, so swap
+   indices, and read-around of consecutive slots, work the same
+   whether a slot is compressed or not.
+
+   The compression is LZ77 in the LZ4 block format: a sequence of
+   literal bytes copied as they are, each followed by a match of
+   at least MIN_MATCH bytes copied from up to 64 kB back.  A token
+   byte holds the literal count in its high nibble and the match
+   length, less MIN_MATCH, in its low one; a nibble of 15 is
+   extended by further bytes that add up to the rest, each 255
+   but the last.  The last sequence has literals only.  Matches
+   are found through a hash table of the last position at which
+   each 4-byte value was seen, so that compression is a single
+   pass over the page. */
+
+/* Shortest match encoded. */
+#define MIN_MATCH 4
+
+/* Hash table size, as a power of 2. */
+#define HASH_BITS 12
+
+/* Largest compressed page kept, in bytes. */
+#define MAX_SIZE (PGSIZE / 2)
+
+/* Fraction of the kernel pool the compressed blocks may take. */
+#define POOL_FRACTION 4
+
+/* Worst-case compressed size of a page, which has a literal
+   extension byte for every 255 literals. */
+#define BOUND_SIZE (PGSIZE + PGSIZE / 255 + 16)
+
+/* A compressed page. */
+struct zblock
+  {
+    uint16_t size;              /* Bytes in DATA. */
+    uint8_t data[];             /* Compressed contents. */
+  };
+
+/* Marks a slot holding a page of zeros. */
+static struct zblock zero_block;
+
+static struct lock zswap_lock;
+static struct zblock **slots;   /* Compressed copy of each slot. */
+static size_t pool_bytes;       /* Heap bytes taken by blocks. */
+static size_t pool_max;         /* Most heap bytes blocks may take. */
+static size_t page_cnt;         /* Slots held in memory. */
+
+/* Compression state, guarded by zswap_lock. */
+static uint16_t hash_table[1 << HASH_BITS];
+static uint8_t out_buf[BOUND_SIZE];
+
+static size_t compress (const uint8_t *);
+static bool decompress (const struct zblock *, uint8_t *);
+static bool is_zero_page (const void *);
+static size_t block_cost (size_t);
+
+/* Initializes the cache for a swap device of SLOT_CNT slots. */
+void
+vm_zswap_init (size_t slot_cnt)
+{
+  struct kstat_mem stats;
+
+  lock_init_named (&zswap_lock, "zswap");
+  slots = calloc (slot_cnt, sizeof *slots);
+  if (slots == NULL && slot_cnt > 0)
+    PANIC ("couldn't allocate compressed swap table");
+
+  palloc_get_kstat (&stats);
+  pool_max = stats.kernel_pages / POOL_FRACTION * PGSIZE;
+  pool_bytes = 0;
+  page_cnt = 0;
+}
+
+/* Stores a compressed copy of PAGE as the contents of free swap
+   slot INDEX.  Returns true if successful, false if the caller
+   must write PAGE to the slot on disk instead. */
+bool
+vm_zswap_store (size_t index, const void *page)
+{
+  struct zblock *block = NULL;
+  size_t size;
+
+  lock_acquire (&zswap_lock);
+  ASSERT (slots[index] == NULL);
+  if (is_zero_page (page))
+    block = &zero_block;
+  else
+    {
+      size = compress (page);
+      if (size > 0 && pool_bytes + block_cost (size) <= pool_max)
+        {
+          block = malloc (sizeof *block + size);
+          if (block != NULL)
+            {
+              block->size = size;
+              memcpy (block->data, out_buf, size);
+              pool_bytes += block_cost (size);
+            }
+        }
+    }
+  if (block != NULL)
+    {
+      slots[index] = block;
+      page_cnt++;
+    }
+  lock_release (&zswap_lock);
+  return block != NULL;
+}
+
+/* Loads the contents of swap slot INDEX into PAGE if the slot is
+   held in memory.  Returns true if so, false if the caller must
+   read it from disk.  The copy stays in the slot until the slot
+   is freed. */
+bool
+vm_zswap_load (size_t index, void *page)
+{
+  struct zblock *block;
+
+  lock_acquire (&zswap_lock);
+  block = slots[index];
+  lock_release (&zswap_lock);
+
+  /* The slot belongs to the caller, so nothing frees the block
+     while it is being read. */
+  if (block == &zero_block)
+    memset (page, 0, PGSIZE);
+  else if (block != NULL && !decompress (block, page))
+    PANIC ("compressed swap slot %zu is corrupt", index);
+  return block != NULL;
+}
+
+/* Frees the compressed copy of swap slot INDEX, if any. */
+void
+vm_zswap_free (size_t index)
+{
+  struct zblock *block;
+
+  lock_acquire (&zswap_lock);
+  block = slots[index];
+  slots[index] = NULL;
+  if (block != NULL)
+    {
+      page_cnt--;
+      if (block != &zero_block)
+        pool_bytes -= block_cost (block->size);
+    }
+  lock_release (&zswap_lock);
+
+  if (block != &zero_block)
+    free (block);
+}
+
+/* Stores the number of slots held in memory, and the heap bytes
+   they take, in STATS. */
+void
+vm_zswap_get_kstat (struct kstat_mem *stats)
+{
+  lock_acquire (&zswap_lock);
+  stats->zswap_pages = page_cnt;
+  stats->zswap_bytes = pool_bytes;
+  lock_release (&zswap_lock);
+}
+
+/* Returns true if the page at P is all zeros. */
+static bool
+is_zero_page (const void *p)
+{
+  const uint32_t *word = p;
+  size_t i;
+
+  for (i = 0; i < PGSIZE / sizeof *word; i++)
+    if (word[i] != 0)
+      return false;
+  return true;
+}
+
+/* Returns the heap bytes malloc() takes for a block holding SIZE
+   bytes of compressed data, whose size it rounds up to a power
+   of 2. */
+static size_t
+block_cost (size_t size)
+{
+  size_t cost = 16;
+
+  while (cost < sizeof (struct zblock) + size)
+    cost *= 2;
+  return cost;
+}
+
+/* Returns the 4 bytes at P as a 32-bit value. */
+static uint32_t
+read32 (const uint8_t *p)
+{
+  uint32_t v;
+
+  memcpy (&v, p, sizeof v);
+  return v;
+}
+
+/* Returns the hash table bucket for the 4 bytes at P. */
+static size_t
+hash (const uint8_t *p)
+{
+  return (read32 (p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Writes length LEN, less the 15 that fit in its token nibble,
+   to OP as extension bytes and returns the byte after them. */
+static uint8_t *
+put_length (uint8_t *op, size_t len)
+{
+  for (len -= 15; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = len;
+  return op;
+}
+
+/* Writes a sequence of the LIT_LEN literals at LIT to OP,
+   followed by a match of MATCH_LEN bytes from OFFSET bytes back
+   if MATCH_LEN is nonzero, and returns the byte after it. */
+static uint8_t *
+put_sequence (uint8_t *op, const uint8_t *lit, size_t lit_len,
+              size_t offset, size_t match_len)
+{
+  uint8_t *token = op++;
+  size_t match_code = match_len > 0 ? match_len - MIN_MATCH : 0;
+
+  *token = ((lit_len < 15 ? lit_len : 15) << 4
+            | (match_code < 15 ? match_code : 15));
+  if (lit_len >= 15)
+    op = put_length (op, lit_len);
+  memcpy (op, lit, lit_len);
+  op += lit_len;
+  if (match_len > 0)
+    {
+      *op++ = offset & 0xff;
+      *op++ = offset >> 8;
+      if (match_code >= 15)
+        op = put_length (op, match_code);
+    }
+  return op;
+}
+
+/* Compresses the page at SRC into out_buf.  Returns the
+   compressed size, or 0 if it is bigger than MAX_SIZE.  Must be
+   called with zswap_lock held. */
+static size_t
+compress (const uint8_t *src)
+{
+  const uint8_t *ip = src, *anchor = src;
+  const uint8_t *end = src + PGSIZE;
+  uint8_t *op = out_buf;
+
+  ASSERT (lock_held_by_current_thread (&zswap_lock));
+  memset (hash_table, 0, sizeof hash_table);
+  while (ip + MIN_MATCH <= end)
+    {
+      size_t h = hash (ip);
+      const uint8_t *ref = src + hash_table[h];
+      size_t len;
+
+      hash_table[h] = ip - src;
+      if (ref >= ip || read32 (ref) != read32 (ip))
+        {
+          ip++;
+          continue;
+        }
+
+      for (len = MIN_MATCH; ip + len < end && ref[len] == ip[len]; len++)
+        continue;
+      op = put_sequence (op, anchor, ip - anchor, ip - ref, len);
+      if (op - out_buf > MAX_SIZE)
+        return 0;
+      ip += len;
+      anchor = ip;
+    }
+  if (anchor < end)
+    op = put_sequence (op, anchor, end - anchor, 0, 0);
+  return op - out_buf <= MAX_SIZE ? (size_t) (op - out_buf) : 0;
+}
+
+/* Reads a length extension from *IP, which must not pass END,
+   adding it to *LEN.  Returns false if the input runs out. */
+static bool
+get_length (const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+  uint8_t b;
+
+  do
+    {
+      if (*ip >= end)
+        return false;
+      b = *(*ip)++;
+      *len += b;
+    }
+  while (b == 255);
+  return true;
+}
+
+/* Decompresses BLOCK into the page at DST.  Returns true if
+   successful, false if BLOCK does not decode to exactly one
+   page. */
+static bool
+decompress (const struct zblock *block, uint8_t *dst)
+{
+  const uint8_t *ip = block->data;
+  const uint8_t *end = block->data + block->size;
+  uint8_t *op = dst;
+  uint8_t *op_end = dst + PGSIZE;
+
+  while (ip < end)
+    {
+      uint8_t token = *ip++;
+      size_t lit_len = token >> 4;
+      size_t match_len = token & 15;
+      size_t offset;
+
+      if (lit_len == 15 && !get_length (&ip, end, &lit_len))
+        return false;
+      if (lit_len > (size_t) (end - ip) || lit_len > (size_t) (op_end - op))
+        return false;
+      memcpy (op, ip, lit_len);
+      ip += lit_len;
+      op += lit_len;
+      if (ip == end)
+        break;
+
+      /* The match may overlap the bytes it produces, so it is
+         copied a byte at a time. */
+      if (end - ip < 2)
+        return false;
+      offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (match_len == 15 && !get_length (&ip, end, &match_len))
+        return false;
+      match_len += MIN_MATCH;
+      if (offset == 0 || offset > (size_t) (op - dst)
+          || match_len > (size_t) (op_end - op))
+        return false;
+      for (; match_len > 0; match_len--, op++)
+        *op = op[-offset];
+    }
+  return op == op_end;
+}
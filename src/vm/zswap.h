@@ -0,0 +1,17 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct kstat_mem;
+
+/* Compressed in-memory copies of swap slots. */
+void vm_zswap_init (size_t slot_cnt);
+bool vm_zswap_store (size_t, const void *);
+bool vm_zswap_load (size_t, void *);
+void vm_zswap_free (size_t);
+/* Statistics. */
+void vm_zswap_get_kstat (struct kstat_mem *);
+
+#endif /* vm/zswap.h */